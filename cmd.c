@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include "cmd.h"
+#include "cmd_completion.h"
 #include "qcommon_io.h"
 #include "qcommon_mem.h"
 #include "qcommon.h"
@@ -34,6 +35,70 @@
 cmd_function_t **cmd_functions_addr = (cmd_function_t**)(0x887eb98);
 #define cmd_functions *cmd_functions_addr
 
+/*
+The engine walks cmd_functions itself so the linked list stays the authoritative
+structure. On top of it we keep a case insensitive hash index for our own lookups.
+Each index entry is allocated together with its command and also remembers the list
+pointer which points to the command, so removing needs no walk either.
+*/
+#define CMD_HASH_SIZE 1024
+
+typedef struct cmdHashEntry_s
+{
+	struct cmdHashEntry_s	*hashNext;
+	cmd_function_t		*cmd;
+	cmd_function_t		**back;
+} cmdHashEntry_t;
+
+static cmdHashEntry_t *cmd_hashTable[CMD_HASH_SIZE];
+
+
+static unsigned int Cmd_HashName( const char *name ) {
+
+	unsigned int hash = 2166136261u;
+	int c;
+
+	while((c = *name++)){
+		if(c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash & (CMD_HASH_SIZE -1);
+}
+
+/*
+============
+Cmd_FindEntry
+
+exact selects case sensitive matching as used for adding and removing of commands
+============
+*/
+static cmdHashEntry_t* Cmd_FindEntry( const char *cmd_name, qboolean exact ) {
+
+	cmdHashEntry_t *entry;
+
+	for(entry = cmd_hashTable[Cmd_HashName(cmd_name)]; entry; entry = entry->hashNext){
+		if(exact){
+			if(!strcmp(cmd_name, entry->cmd->name))
+				return entry;
+		}else if(!Q_stricmp(cmd_name, entry->cmd->name)){
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+static cmdHashEntry_t* Cmd_EntryForCommand( cmd_function_t *cmd ) {
+
+	cmdHashEntry_t *entry;
+
+	for(entry = cmd_hashTable[Cmd_HashName(cmd->name)]; entry; entry = entry->hashNext){
+		if(entry->cmd == cmd)
+			return entry;
+	}
+	return NULL;
+}
+
 
 /*
 ============
@@ -43,25 +108,40 @@ Cmd_AddCommand
 qboolean Cmd_AddCommand( const char *cmd_name, xcommand_t function ) {
 
 	cmd_function_t  *cmd;
+	cmdHashEntry_t  *entry, *head;
+	unsigned int hash;
 
 	// fail if the command already exists
-	for ( cmd = cmd_functions ; cmd ; cmd = cmd->next ) {
-		if ( !strcmp( cmd_name, cmd->name )) {
-			// allow completion-only commands to be silently doubled
-			if ( function != NULL ) {
-				Com_PrintWarning( "Cmd_AddCommand: %s already defined\n", cmd_name );
-			}
-			return qfalse;
+	if ( Cmd_FindEntry( cmd_name, qtrue ) ) {
+		// allow completion-only commands to be silently doubled
+		if ( function != NULL ) {
+			Com_PrintWarning( "Cmd_AddCommand: %s already defined\n", cmd_name );
 		}
+		return qfalse;
 	}
 
 	// use a small malloc to avoid zone fragmentation
-	cmd = Z_Malloc( sizeof( cmd_function_t ) + strlen(cmd_name) + 1);
-	strcpy((char*)(cmd +1), cmd_name);
-	cmd->name = (char*)(cmd +1);
+	cmd = Z_TagMalloc( sizeof( cmd_function_t ) + sizeof( cmdHashEntry_t ) + strlen(cmd_name) + 1, TAG_COMMANDS );
+	entry = (cmdHashEntry_t*)(cmd +1);
+	strcpy((char*)(entry +1), cmd_name);
+	cmd->name = (char*)(entry +1);
 	cmd->function = function;
 	cmd->next = cmd_functions;
+
+	if(cmd->next){
+		head = Cmd_EntryForCommand( cmd->next );
+		if(head)
+			head->back = &cmd->next;
+	}
 	cmd_functions = cmd;
+
+	hash = Cmd_HashName(cmd_name);
+	entry->cmd = cmd;
+	entry->back = &cmd_functions;
+	entry->hashNext = cmd_hashTable[hash];
+	cmd_hashTable[hash] = entry;
+
+	Cmd_CompletionAdd( cmd->name );
 	return qtrue;
 }
 
@@ -71,23 +151,32 @@ Cmd_RemoveCommand
 ============
 */
 qboolean Cmd_RemoveCommand( const char *cmd_name ) {
-	cmd_function_t  *cmd, **back;
-
-	back = &cmd_functions;
-	while ( 1 ) {
-		cmd = *back;
-		if ( !cmd ) {
-			// command wasn't active
-			return qfalse;
-		}
-		if ( !strcmp( cmd_name, cmd->name ) ) {
-			*back = cmd->next;
-			Z_Free( cmd );
-			return qtrue;
+	cmd_function_t  *cmd;
+	cmdHashEntry_t  *entry, *next, **link;
+
+	entry = Cmd_FindEntry( cmd_name, qtrue );
+	if ( !entry ) {
+		// command wasn't active
+		return qfalse;
+	}
+	cmd = entry->cmd;
+
+	*entry->back = cmd->next;
+	if(cmd->next){
+		next = Cmd_EntryForCommand( cmd->next );
+		if(next)
+			next->back = entry->back;
+	}
+
+	for(link = &cmd_hashTable[Cmd_HashName(cmd_name)]; *link; link = &(*link)->hashNext){
+		if(*link == entry){
+			*link = entry->hashNext;
+			break;
 		}
-		back = &cmd->next;
 	}
-	return qfalse;
+	Cmd_CompletionRemove( cmd->name );
+	Z_Free( cmd );
+	return qtrue;
 }
 
 
@@ -109,32 +198,27 @@ static void Cmd_Echo_f (void)
 qboolean Cmd_SetPower(const char *cmd_name, int power)
 {
 
-    cmd_function_t *cmd;
+    cmdHashEntry_t *entry;
     if(!cmd_name) return qfalse;
 
-    for(cmd = cmd_functions ; cmd ; cmd = cmd->next){
-        if(!Q_stricmp(cmd_name, cmd->name)){
-            if(cmd->minPower != power){
-                cmd->minPower = power;
-            }
-            return qtrue;
-        }
-    }
-    return qfalse;
+    entry = Cmd_FindEntry(cmd_name, qfalse);
+    if(!entry) return qfalse;
+
+    entry->cmd->minPower = power;
+    return qtrue;
 }
 
 int	Cmd_GetPower(const char* cmd_name)
 {
 
-    cmd_function_t *cmd;
-    for(cmd = cmd_functions ; cmd ; cmd = cmd->next){
-        if(!Q_stricmp(cmd_name,cmd->name)){
+    cmdHashEntry_t *entry;
+    if(!cmd_name) return -1;
 
-                if(!cmd->minPower) return 100;
-                else return cmd->minPower;
-        }
-    }
-    return -1; //Don't exist
+    entry = Cmd_FindEntry(cmd_name, qfalse);
+    if(!entry) return -1; //Don't exist
+
+    if(!entry->cmd->minPower) return 100;
+    else return entry->cmd->minPower;
 }
 
 void Cmd_ResetPower()
@@ -538,6 +622,76 @@ void Cmd_Exec_f( void ) {
 */
 
 
+/*
+===============
+Cmd_Exec_f
+
+The whole file gets read at once and split into lines in place. Empty lines
+and comments never reach the command buffer, every other line gets executed
+right away like the binary did it. Lines longer than EXEC_MAXLINE get split as
+FS_ReadLine() would have done. Configs which are not on disk, such as the
+rawfiles of the fastfiles, are left to the exec of the binary.
+===============
+*/
+#define EXEC_MAXLINE 4096
+
+static void Cmd_ExecLine( char* line, int len ) {
+
+	char save;
+
+	while(len > EXEC_MAXLINE -1)
+	{
+		save = line[EXEC_MAXLINE -1];
+		line[EXEC_MAXLINE -1] = '\0';
+		Cbuf_ExecuteBuffer(0, 0, line);
+		line[EXEC_MAXLINE -1] = save;
+		line += EXEC_MAXLINE -1;
+		len -= EXEC_MAXLINE -1;
+	}
+	Cbuf_ExecuteBuffer(0, 0, line);
+}
+
+void Cmd_Exec_f( void ) {
+	char    *f;
+	char	*line, *end, *next, *s;
+	char filename[MAX_QPATH];
+	int len;
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "exec <filename> : execute a script file\n" );
+		return;
+	}
+
+	Q_strncpyz( filename, Cmd_Argv( 1 ), sizeof( filename ) );
+	COM_DefaultExtension( filename, sizeof( filename ), ".cfg" );
+	len = FS_ReadFile( filename, (void **)&f );
+	if ( !f ) {
+		Cmd_Exec_f_old();
+		return;
+	}
+	Com_Printf( "execing %s\n",Cmd_Argv( 1 ) );
+
+	for(line = f, end = f + len; line < end; line = next)
+	{
+		next = memchr(line, '\n', end - line);
+		if(next == NULL)
+			next = end;
+		else
+			*next++ = '\0';
+
+		//Skip the leading whitespace only to tell what kind of line it is
+		for(s = line; s < next && (*s == ' ' || *s == '\t' || *s == '\r'); s++);
+
+		if(s >= next || *s == '\0' || (s[0] == '/' && s[1] == '/'))
+			continue;
+
+		Cmd_ExecLine(line, strlen(line));
+	}
+
+	FS_FreeFile( f );
+}
+
+
 void Cmd_Init( void ) {
 	*(int*)0x88799a0 = -1;
 	*(int*)0x887c300 = 0;
@@ -26,6 +26,7 @@
 #include "q_shared.h"
 #include "cmd_completion.h"
 #include "qcommon_io.h"
+#include "qcommon_mem.h"
 
 /*
 ===========================================
@@ -99,6 +100,190 @@ static void PrintMatches( const char *s ) {
 
 
 
+/*
+Prefix tries of the command and cvar names
+
+A completion only visits the nodes below the typed prefix, so it costs in the number of
+matches and not in the number of commands and cvars. Keys are case sensitive so each name
+gets its own terminal node, matching is case insensitive and can follow more than one
+branch. Children are sorted which lists the matches in order. The nodes point to the names,
+those belong to the commands and cvars.
+Cmd_AddCommand and Cmd_RemoveCommand keep the command trie up to date. The cvars get
+registered inside of the binary without us knowing, so the cvar trie gets topped up on
+completion once the number of cvars changed.
+*/
+
+#define COMPLETION_NODEBLOCK 512
+
+typedef struct completionNode_s {
+	struct completionNode_s	*child;
+	struct completionNode_s	*sibling;
+	const char		*name;	// set if a name ends here
+	char			c;
+} completionNode_t;
+
+typedef struct {
+	completionNode_t	root;
+	int			count;
+} completionTrie_t;
+
+static completionTrie_t	cmd_completionTrie;
+static completionTrie_t	cvar_completionTrie;
+static completionNode_t	*completionFreeNodes;
+
+
+static completionNode_t *Completion_AllocNode( char c ) {
+	completionNode_t *node;
+	int i;
+
+	if( !completionFreeNodes ) {
+		node = Z_TagMalloc( COMPLETION_NODEBLOCK * sizeof( completionNode_t ), TAG_COMMANDS );
+		for( i = 0; i < COMPLETION_NODEBLOCK; i++ ) {
+			node[i].sibling = completionFreeNodes;
+			completionFreeNodes = &node[i];
+		}
+	}
+	node = completionFreeNodes;
+	completionFreeNodes = node->sibling;
+
+	node->child = NULL;
+	node->sibling = NULL;
+	node->name = NULL;
+	node->c = c;
+	return node;
+}
+
+static void Completion_FreeNode( completionNode_t *node ) {
+	node->sibling = completionFreeNodes;
+	completionFreeNodes = node;
+}
+
+static void Completion_Insert( completionTrie_t *trie, const char *name ) {
+	completionNode_t *node, *newnode, **link;
+	const char *s;
+
+	node = &trie->root;
+
+	for( s = name; *s; s++ ) {
+		for( link = &node->child; *link && (*link)->c < *s; link = &(*link)->sibling );
+
+		if( !*link || (*link)->c != *s ) {
+			newnode = Completion_AllocNode( *s );
+			newnode->sibling = *link;
+			*link = newnode;
+		}
+		node = *link;
+	}
+
+	if( node->name )
+		return;
+
+	node->name = name;
+	trie->count++;
+}
+
+// Frees the node if nothing but the removed name was below it
+static void Completion_RemoveBelow( completionTrie_t *trie, completionNode_t **link, const char *s ) {
+	completionNode_t *node, **childlink;
+
+	node = *link;
+
+	if( *s ) {
+		for( childlink = &node->child; *childlink && (*childlink)->c != *s; childlink = &(*childlink)->sibling );
+		if( !*childlink )
+			return;
+		Completion_RemoveBelow( trie, childlink, s + 1 );
+	} else if( node->name ) {
+		node->name = NULL;
+		trie->count--;
+	}
+
+	if( !node->name && !node->child ) {
+		*link = node->sibling;
+		Completion_FreeNode( node );
+	}
+}
+
+static void Completion_Remove( completionTrie_t *trie, const char *name ) {
+	completionNode_t **link;
+
+	if( !*name )
+		return;
+
+	for( link = &trie->root.child; *link && (*link)->c != *name; link = &(*link)->sibling );
+	if( *link )
+		Completion_RemoveBelow( trie, link, name + 1 );
+}
+
+static void Completion_FreeBelow( completionNode_t *node ) {
+	completionNode_t *child, *next;
+
+	for( child = node->child; child; child = next ) {
+		next = child->sibling;
+		Completion_FreeBelow( child );
+		Completion_FreeNode( child );
+	}
+	node->child = NULL;
+}
+
+static void Completion_CallbackBelow( const completionNode_t *node, void(*callback)(const char *s) ) {
+	const completionNode_t *child;
+
+	if( node->name )
+		callback( node->name );
+
+	for( child = node->child; child; child = child->sibling )
+		Completion_CallbackBelow( child, callback );
+}
+
+// Calls back for every name which starts with prefix, ignoring case
+static void Completion_Match( const completionNode_t *node, const char *prefix, void(*callback)(const char *s) ) {
+	const completionNode_t *child;
+
+	if( !*prefix ) {
+		Completion_CallbackBelow( node, callback );
+		return;
+	}
+
+	for( child = node->child; child; child = child->sibling ) {
+		if( tolower( child->c ) == tolower( *prefix ) )
+			Completion_Match( child, prefix + 1, callback );
+	}
+}
+
+void Cmd_CompletionAdd( const char *name ) {
+	Completion_Insert( &cmd_completionTrie, name );
+}
+
+void Cmd_CompletionRemove( const char *name ) {
+	Completion_Remove( &cmd_completionTrie, name );
+}
+
+static void Cvar_CompletionCount( cvar_t const *cvar, void *count ) {
+	(*(int*)count)++;
+}
+
+static void Cvar_CompletionInsert( cvar_t const *cvar, void *none ) {
+	Completion_Insert( &cvar_completionTrie, cvar->name );
+}
+
+static void Cvar_UpdateCompletionTrie( void ) {
+	int count = 0;
+
+	Cvar_ForEach( Cvar_CompletionCount, &count );
+
+	if( count == cvar_completionTrie.count )
+		return;
+
+	if( count < cvar_completionTrie.count ) {
+		// Should not happen, the names we point to might be gone
+		Completion_FreeBelow( &cvar_completionTrie.root );
+		cvar_completionTrie.count = 0;
+	}
+	Cvar_ForEach( Cvar_CompletionInsert, NULL );
+}
+
+
 /*
 ===============
 Field_FindFirstSeparator
@@ -222,20 +407,23 @@ void Field_CompleteCommand( char *cmd, qboolean doCommands, qboolean doCvars )
 			return;
 		}
 
+		if( doCvars )
+			Cvar_UpdateCompletionTrie( );
+
 		if( doCommands )
-			Cmd_CommandCompletion( FindMatches );
+			Completion_Match( &cmd_completionTrie.root, completionString, FindMatches );
 
 		if( doCvars )
-			Cvar_ForEach(Cvar_CommandCompletionFind, NULL);
+			Completion_Match( &cvar_completionTrie.root, completionString, FindMatches );
 
 		if( !Field_Complete( ) )
 		{
 			// run through again, printing matches
 			if( doCommands )
-				Cmd_CommandCompletion( PrintMatches );
+				Completion_Match( &cmd_completionTrie.root, shortestMatch, PrintMatches );
 
 			if( doCvars )
-				Cvar_ForEach(Cvar_CommandCompletionPrint, NULL);
+				Completion_Match( &cvar_completionTrie.root, shortestMatch, PrintMatches );
 		}
 	}
 	Cmd_EndTokenizeString( );
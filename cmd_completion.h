@@ -51,6 +51,9 @@ void Cvar_CommandCompletionPrint( cvar_t const *cvar, void* none);
 void Cvar_CommandCompletionFind( cvar_t const *cvar, void* none);
 void Cvar_CompleteCvarName( char *args, int argNum );
 
+void Cmd_CompletionAdd( const char *name );
+void Cmd_CompletionRemove( const char *name );
+
 void Field_Clear( field_t *edit );
 void Field_CompleteCommand( char *cmd, qboolean doCommands, qboolean doCvars );
 void Field_AutoComplete( field_t *field );
@@ -36,14 +36,18 @@
 #include "qcommon.h"
 #include "cmd.h"
 #include "sys_net.h"
+#include "net_game.h"
 #include "xassets.h"
 #include "plugin_handler.h"
+#include "qcommon_profile.h"
+#include "qcommon_redirect.h"
 #include "misc.h"
 #include "scr_vm.h"
 #include "netchan.h"
 #include "server.h"
 #include "nvconfig.h"
 #include "hl2rcon.h"
+#include "sv_wwwserver.h"
 
 #include <string.h>
 #include <setjmp.h>
@@ -64,6 +68,7 @@ cvar_t* com_fixedtime;
 cvar_t* com_maxFrameTime;
 cvar_t* com_animCheck;
 cvar_t* com_developer;
+cvar_t* com_workerThreads;
 
 /*
 ========================================================================
@@ -83,13 +88,6 @@ typedef union{
 }universalArg_t;
 
 
-typedef enum {
-	// bk001129 - make sure SE_NONE is zero
-	SE_NONE = 0,    // evTime is still valid
-	SE_CONSOLE, // evPtr is a char*
-	SE_PACKET   // evPtr is a netadr_t followed by data bytes to evPtrLength
-} sysEventType_t;
-
 typedef struct {
 	int evTime;
 	sysEventType_t evType;
@@ -109,23 +107,56 @@ typedef struct{
 typedef timedEventArg_t timedEventArgs_t[MAX_TIMEDEVENTARGS];
 
 
+/*
+The system event queue is a bounded ring which any thread can add to while only the main
+thread takes events out. Every slot carries a sequence number: a producer claims a slot by
+advancing eventHead with compare-and-swap when the slot's sequence equals the position,
+fills it and publishes it by setting the sequence to position + 1. The consumer takes the
+slot once it sees position + 1 and hands it back with position + MAX_QUEUED_EVENTS.
+*/
 #define MAX_QUEUED_EVENTS  256
-#define MAX_TIMED_EVENTS  1024
 #define MASK_QUEUED_EVENTS ( MAX_QUEUED_EVENTS - 1 )
+
+/*
+Timed events live in a pool which grows when it is full. The pending ones are kept in a
+binary min-heap ordered by trigger time, events with the same trigger time run in the
+order they got added. A handle is the pool slot together with a generation count so a
+handle of an event which already ran or got cancelled doesn't hit a reused slot.
+*/
+#define TIMED_EVENTS_DEFAULT_SIZE  1024
+#define TIMED_EVENT_SLOTBITS  20
+#define MAX_TIMED_EVENTS  ( 1 << TIMED_EVENT_SLOTBITS )
 #define MASK_TIMED_EVENTS ( MAX_TIMED_EVENTS - 1 )
+#define MASK_TIMED_EVENT_GENERATION 0x3ff
 
 typedef struct{
 	int evTime, evTriggerTime;
 	timedEventArgs_t evArguments;
 	void (*evFunction)();
+	unsigned int evSequence;	//Keeps the order of events with the same trigger time
+	int heapIndex;			//-1 while the slot is free
+	int generation;
+	int nextFree;
 }timedSysEvent_t;
 
 
-static sysEvent_t  eventQueue[ MAX_QUEUED_EVENTS ];
-static timedSysEvent_t  timedEventBuffer[ MAX_QUEUED_EVENTS ];
-static int         eventHead = 0;
-static int         eventTail = 0;
-static int         timedEventHead = 0;
+typedef struct{
+	volatile unsigned int sequence;
+	sysEvent_t ev;
+}queuedSysEvent_t;
+
+static queuedSysEvent_t eventQueue[ MAX_QUEUED_EVENTS ];
+static volatile unsigned int eventHead = 0;
+static unsigned int eventTail = 0;
+static volatile int eventsDropped;
+static sysEvent_t  eventCurrent;	//The event Com_GetSystemEvent() returned last
+
+static timedSysEvent_t *timedEvents;
+static int         *timedEventHeap;
+static int         timedEventPoolSize;
+static int         timedEventCount;
+static int         timedEventFree = -1;
+static unsigned int timedEventSequence;
 
 
 void EventTimerTest(int time, int triggerTime, int value, char* s){
@@ -135,22 +166,172 @@ void EventTimerTest(int time, int triggerTime, int value, char* s){
 }
 
 
+static qboolean Com_TimedEventBefore( int a, int b )
+{
+	timedSysEvent_t *eva = &timedEvents[a];
+	timedSysEvent_t *evb = &timedEvents[b];
+
+	if(eva->evTriggerTime != evb->evTriggerTime)
+		return eva->evTriggerTime < evb->evTriggerTime;
+
+	return (int)(eva->evSequence - evb->evSequence) < 0;
+}
+
+static void Com_TimedEventHeapSet( int pos, int slot )
+{
+	timedEventHeap[pos] = slot;
+	timedEvents[slot].heapIndex = pos;
+}
+
+static void Com_TimedEventHeapUp( int pos )
+{
+	int slot = timedEventHeap[pos];
+	int parent;
+
+	while(pos > 0)
+	{
+		parent = (pos - 1) / 2;
+		if(!Com_TimedEventBefore(slot, timedEventHeap[parent]))
+			break;
+
+		Com_TimedEventHeapSet(pos, timedEventHeap[parent]);
+		pos = parent;
+	}
+	Com_TimedEventHeapSet(pos, slot);
+}
+
+static void Com_TimedEventHeapDown( int pos )
+{
+	int slot = timedEventHeap[pos];
+	int child;
+
+	while((child = 2 * pos + 1) < timedEventCount)
+	{
+		if(child + 1 < timedEventCount && Com_TimedEventBefore(timedEventHeap[child + 1], timedEventHeap[child]))
+			child++;
+
+		if(!Com_TimedEventBefore(timedEventHeap[child], slot))
+			break;
+
+		Com_TimedEventHeapSet(pos, timedEventHeap[child]);
+		pos = child;
+	}
+	Com_TimedEventHeapSet(pos, slot);
+}
+
+//Takes the event out of the heap and puts its slot on the freelist. The arguments stay untouched
+static void Com_ReleaseTimedEvent( int slot )
+{
+	int pos = timedEvents[slot].heapIndex;
+	int last;
+
+	timedEventCount--;
+
+	if(pos != timedEventCount)
+	{
+		last = timedEventHeap[timedEventCount];
+		Com_TimedEventHeapSet(pos, last);
+		if(pos > 0 && Com_TimedEventBefore(last, timedEventHeap[(pos - 1) / 2]))
+			Com_TimedEventHeapUp(pos);
+		else
+			Com_TimedEventHeapDown(pos);
+	}
+
+	timedEvents[slot].heapIndex = -1;
+	timedEvents[slot].generation = (timedEvents[slot].generation + 1) & MASK_TIMED_EVENT_GENERATION;
+	timedEvents[slot].nextFree = timedEventFree;
+	timedEventFree = slot;
+}
+
+static void Com_FreeTimedEventArgs( timedSysEvent_t *ev )
+{
+	int i;
+
+	for(i = 0; i < MAX_TIMEDEVENTARGS; i++)
+	{
+		if(ev->evArguments[i].size > 0){
+			Z_Free(ev->evArguments[i].arg.p);
+			ev->evArguments[i].size = 0;
+		}
+	}
+}
+
+static qboolean Com_GrowTimedEvents( void )
+{
+	timedSysEvent_t *newEvents;
+	int *newHeap;
+	int newSize;
+	int i;
+
+	if(timedEventPoolSize >= MAX_TIMED_EVENTS)
+		return qfalse;
+
+	if(timedEventPoolSize == 0)
+		newSize = TIMED_EVENTS_DEFAULT_SIZE;
+	else
+		newSize = timedEventPoolSize * 2;
+
+	newEvents = realloc(timedEvents, newSize * sizeof(timedSysEvent_t));
+	if(!newEvents)
+		return qfalse;
+	timedEvents = newEvents;
+
+	newHeap = realloc(timedEventHeap, newSize * sizeof(int));
+	if(!newHeap)
+		return qfalse;
+	timedEventHeap = newHeap;
+
+	//New slots go onto the freelist, lowest first
+	for(i = newSize -1; i >= timedEventPoolSize; i--)
+	{
+		timedEvents[i].heapIndex = -1;
+		timedEvents[i].generation = 0;
+		timedEvents[i].nextFree = timedEventFree;
+		timedEventFree = i;
+	}
+	timedEventPoolSize = newSize;
+	return qtrue;
+}
+
+//Returns the slot of a pending event or -1
+static int Com_TimedEventSlot( int handle )
+{
+	int slot;
+
+	if(handle < 0)
+		return -1;
+
+	slot = handle & MASK_TIMED_EVENTS;
+
+	if(slot >= timedEventPoolSize || timedEvents[slot].heapIndex < 0)
+		return -1;
+
+	if(timedEvents[slot].generation != ((handle >> TIMED_EVENT_SLOTBITS) & MASK_TIMED_EVENT_GENERATION))
+		return -1;
+
+	return slot;
+}
+
+
 /*
 ================
 Com_SetTimedEventCachelist
 
+Copies the data an argument of a pending event points to, so the caller's memory can go away
 ================
 */
 void Com_MakeTimedEventArgCached(unsigned int index, unsigned int arg, unsigned int size){
 
-	if(index >= MAX_TIMED_EVENTS)
+	int slot = Com_TimedEventSlot(index);
+
+	if(slot < 0)
 		Com_Error(ERR_FATAL, "Com_MakeTimedEventArgCached: Bad index: %d", index);
 
 	if(arg >= MAX_TIMEDEVENTARGS)
 		Com_Error(ERR_FATAL, "Com_MakeTimedEventArgCached: Bad function argument number. Allowed range is 0 - %d arguments", MAX_TIMEDEVENTARGS);
 
-	timedSysEvent_t  *ev = &timedEventBuffer[index];
-	void *ptr = Z_Malloc(size);
+	timedSysEvent_t  *ev = &timedEvents[slot];
+	void *ptr = Z_TagMalloc(size, TAG_EVENTS);
 	Com_Memcpy(ptr, ev->evArguments[arg].arg.p, size);
 	ev->evArguments[arg].size = size;
 	ev->evArguments[arg].arg.p = ptr;
@@ -161,52 +342,31 @@ void Com_MakeTimedEventArgCached(unsigned int index, unsigned int arg, unsigned
 ================
 Com_AddTimedEvent
 
+Returns a handle for Com_CancelTimedEvent / Com_MakeTimedEventArgCached or -1
 ================
 */
 int QDECL Com_AddTimedEvent( int delay, void *function, unsigned int argcount, ...)
 {
 	timedSysEvent_t  *ev;
-	int index;
+	int slot;
 	int i;
 	int time;
-	int triggerTime;
 
-	if ( timedEventHead >= MAX_TIMED_EVENTS )
+	if(argcount > MAX_TIMEDEVENTARGS)
 	{
-		Com_PrintWarning("Com_AddTimedEvent: overflow - Lost one event\n");
-		// we are discarding an event, but don't leak memory
+		Com_Error(ERR_FATAL, "Com_AddTimedEvent: Bad number of function arguments. Allowed range is 0 - %d arguments", MAX_TIMEDEVENTARGS);
 		return -1;
 	}
 
-	index = timedEventHead;
-
-	time = Sys_Milliseconds();
-
-	triggerTime = delay + time;
-
-	while(qtrue)
+	if ( timedEventFree < 0 && !Com_GrowTimedEvents() )
 	{
-		if(index > 0){
-
-			ev = &timedEventBuffer[index -1];
-
-			if(ev->evTriggerTime < triggerTime)
-			{
-				timedEventBuffer[index] = *ev;
-				index--;
-				continue;
-			}
-		}
-		break;
-	}
-
-	if(argcount > MAX_TIMEDEVENTARGS)
-	{
-		Com_Error(ERR_FATAL, "Com_AddTimedEvent: Bad number of function arguments. Allowed range is 0 - %d arguments", MAX_TIMEDEVENTARGS);
+		Com_PrintWarning("Com_AddTimedEvent: overflow - Lost one event\n");
 		return -1;
 	}
 
-	ev = &timedEventBuffer[index];
+	slot = timedEventFree;
+	ev = &timedEvents[slot];
+	timedEventFree = ev->nextFree;
 
 	va_list		argptr;
 	va_start(argptr, argcount);
@@ -221,19 +381,54 @@ int QDECL Com_AddTimedEvent( int delay, void *function, unsigned int argcount, .
 
 	va_end(argptr);
 
+	time = Sys_Milliseconds();
+
 	ev->evTime = time;
-	ev->evTriggerTime = triggerTime;
+	ev->evTriggerTime = delay + time;
 	ev->evFunction = function;
-	timedEventHead++;
-	return index;
+	ev->evSequence = timedEventSequence++;
+
+	timedEventCount++;
+	Com_TimedEventHeapSet(timedEventCount -1, slot);
+	Com_TimedEventHeapUp(timedEventCount -1);
+
+	return (ev->generation << TIMED_EVENT_SLOTBITS) | slot;
+}
+
+
+/*
+================
+Com_CancelTimedEvent
+
+Returns qfalse if the event has already been executed or cancelled
+================
+*/
+qboolean Com_CancelTimedEvent( int handle )
+{
+	int slot = Com_TimedEventSlot(handle);
+
+	if(slot < 0)
+		return qfalse;
+
+	Com_FreeTimedEventArgs(&timedEvents[slot]);
+	Com_ReleaseTimedEvent(slot);
+	return qtrue;
 }
 
 
 
 void Com_InitEventQueue()
 {
+    int i;
+
     // bk000306 - clear eventqueue
-    memset( eventQueue, 0, MAX_QUEUED_EVENTS * sizeof( sysEvent_t ) );
+    memset( eventQueue, 0, sizeof( eventQueue ) );
+
+    for(i = 0; i < MAX_QUEUED_EVENTS; i++)
+        eventQueue[i].sequence = i;
+
+    eventHead = 0;
+    eventTail = 0;
 }
 
 /*
@@ -243,60 +438,107 @@ Com_QueueEvent
 A time of 0 will get the current time
 Ptr should either be null, or point to a block of data that can
 be freed by the game later.
+Can be called from any thread and wakes up NET_Sleep() so the event gets
+handled right away. Returns qfalse if the queue is full, the caller still owns ptr then
 ================
 */
-void Com_QueueEvent( int time, sysEventType_t type, int value, int value2, int ptrLength, void *ptr )
+qboolean Com_QueueEvent( int time, sysEventType_t type, int value, int value2, int ptrLength, void *ptr )
 {
-	sysEvent_t  *ev;
+	queuedSysEvent_t  *slot;
+	unsigned int pos;
+	int diff;
 
-	ev = &eventQueue[ eventHead & MASK_QUEUED_EVENTS ];
+	if ( time == 0 )
+	{
+		time = Sys_Milliseconds();
+	}
 
-	if ( eventHead - eventTail >= MAX_QUEUED_EVENTS )
+	while ( qtrue )
 	{
-		Com_PrintWarning("Com_QueueEvent: overflow\n");
-		// we are discarding an event, but don't leak memory
-		if ( ev->evPtr )
+		pos = eventHead;
+		slot = &eventQueue[ pos & MASK_QUEUED_EVENTS ];
+		diff = (int)(slot->sequence - pos);
+
+		if ( diff == 0 )
 		{
-			Z_Free( ev->evPtr );
+			if ( __sync_bool_compare_and_swap( &eventHead, pos, pos + 1 ) )
+				break;
+		}
+		else if ( diff < 0 )
+		{
+			// the main thread has not picked up the oldest event yet
+			__sync_fetch_and_add( &eventsDropped, 1 );
+			return qfalse;
 		}
-		eventTail++;
 	}
 
-	eventHead++;
+	slot->ev.evTime = time;
+	slot->ev.evType = type;
+	slot->ev.evValue = value;
+	slot->ev.evValue2 = value2;
+	slot->ev.evPtrLength = ptrLength;
+	slot->ev.evPtr = ptr;
 
-	if ( time == 0 )
+	__sync_synchronize();
+	slot->sequence = pos + 1;
+
+	if ( !Sys_IsMainThread() )
 	{
-		time = Sys_Milliseconds();
+		NET_Wakeup();
 	}
+	return qtrue;
+}
 
-	ev->evTime = time;
-	ev->evType = type;
-	ev->evValue = value;
-	ev->evValue2 = value2;
-	ev->evPtrLength = ptrLength;
-	ev->evPtr = ptr;
+/*
+================
+Com_PopSystemEvent
+
+Main thread only
+================
+*/
+static sysEvent_t* Com_PopSystemEvent( void )
+{
+	queuedSysEvent_t  *slot;
+
+	slot = &eventQueue[ eventTail & MASK_QUEUED_EVENTS ];
+
+	if ( slot->sequence != eventTail + 1 )
+	{
+		return NULL;
+	}
+	__sync_synchronize();
+
+	eventCurrent = slot->ev;
+
+	__sync_synchronize();
+	slot->sequence = eventTail + MAX_QUEUED_EVENTS;
+	eventTail++;
+
+	return &eventCurrent;
 }
 
 /*
 ================
 Com_GetTimedEvent
 
+Copies the next due event and removes it
 ================
 */
-timedSysEvent_t* Com_GetTimedEvent( int time )
+qboolean Com_GetTimedEvent( int time, timedSysEvent_t *evt )
 {
-	timedSysEvent_t  *ev;
+	int slot;
 
-	if(timedEventHead > 0)
+	if(timedEventCount > 0)
 	{
-		ev = &timedEventBuffer[timedEventHead - 1];
-		if(ev->evTriggerTime <= time)
+		slot = timedEventHeap[0];
+		if(timedEvents[slot].evTriggerTime <= time)
 		{
-			timedEventHead--; //We have removed one event
-			return ev;
+			*evt = timedEvents[slot];
+			Com_ReleaseTimedEvent(slot);
+			return qtrue;
 		}
 	}
-	return NULL;
+	return qfalse;
 }
 
 
@@ -309,12 +551,20 @@ Com_GetSystemEvent
 sysEvent_t* Com_GetSystemEvent( void )
 {
 	char        *s;
-	// return if we have data
+	sysEvent_t  *ev;
+	int         dropped;
 
-	if ( eventHead > eventTail )
+	if ( eventsDropped )
 	{
-		eventTail++;
-		return &eventQueue[ ( eventTail - 1 ) & MASK_QUEUED_EVENTS ];
+		dropped = __sync_lock_test_and_set( &eventsDropped, 0 );
+		Com_PrintWarning("Com_QueueEvent: overflow, %i events dropped\n", dropped);
+	}
+
+	// return if we have data
+	ev = Com_PopSystemEvent();
+	if ( ev )
+	{
+		return ev;
 	}
 
 	// check for console commands
@@ -325,20 +575,16 @@ sysEvent_t* Com_GetSystemEvent( void )
 		int   len;
 
 		len = strlen( s ) + 1;
-		b = Z_Malloc( len );
+		b = Z_TagMalloc( len, TAG_EVENTS );
 		strcpy( b, s );
-		Com_QueueEvent( 0, SE_CONSOLE, 0, 0, len, b );
+		if ( !Com_QueueEvent( 0, SE_CONSOLE, 0, 0, len, b ) )
+		{
+			Z_Free( b );
+		}
 	}
 
 	// return if we have data
-	if ( eventHead > eventTail )
-	{
-		eventTail++;
-		return &eventQueue[ ( eventTail - 1 ) & MASK_QUEUED_EVENTS ];
-	}
-
-	// create an empty event to return
-	return NULL;
+	return Com_PopSystemEvent();
 }
 
 
@@ -352,6 +598,8 @@ Returns last event time
 void Com_EventLoop( void ) {
 	sysEvent_t	*ev;
 
+	Sys_RunCompletedJobs();
+
 	while ( 1 ) {
 		ev = Com_GetSystemEvent();
 
@@ -365,6 +613,9 @@ void Com_EventLoop( void ) {
 					Cbuf_AddText( 0,(char *)ev->evPtr );
 					Cbuf_AddText(0,"\n");
 				break;
+				case SE_PACKET:
+					NET_UDPPacketEvent( (netadr_t *)ev->evPtr, (byte *)ev->evPtr + sizeof(netadr_t), ev->evPtrLength - sizeof(netadr_t) );
+				break;
 				default:
 					Com_Error( ERR_FATAL, "Com_EventLoop: bad event type %i", ev->evType );
 				break;
@@ -383,32 +634,77 @@ Com_TimedEventLoop
 =================
 */
 void Com_TimedEventLoop( void ) {
-	timedSysEvent_t	*evt;
+	timedSysEvent_t	evt;
 	int time = Sys_Milliseconds();
-	int i;
 
 	while( qtrue ) {
-		evt = Com_GetTimedEvent(time);
 
 		// if no more events are available
-		if ( !evt ) {
+		if ( !Com_GetTimedEvent(time, &evt) ) {
 			break;
 		}
-		//Execute the passed eventhandler
-		if(evt->evFunction)
-			evt->evFunction(evt->evArguments[0].arg, evt->evArguments[1].arg, evt->evArguments[2].arg, evt->evArguments[3].arg,
-			evt->evArguments[4].arg, evt->evArguments[5].arg, evt->evArguments[6].arg, evt->evArguments[7].arg);
+		//Execute the passed eventhandler. It may add or cancel events
+		if(evt.evFunction)
+			evt.evFunction(evt.evArguments[0].arg, evt.evArguments[1].arg, evt.evArguments[2].arg, evt.evArguments[3].arg,
+			evt.evArguments[4].arg, evt.evArguments[5].arg, evt.evArguments[6].arg, evt.evArguments[7].arg);
 
-		for(i = 0; i < MAX_TIMEDEVENTARGS; i++)
-		{
-			if(evt->evArguments[i].size > 0){
-				Z_Free(evt->evArguments[i].arg.p);
-			}
-		}
+		Com_FreeTimedEventArgs(&evt);
 	}
 }
 
 
+/*
+=================
+Developer output channels
+
+A channel cvar of -1 follows developer. The script channel has the bool
+developer_script of the binary, it turns the channel on without developer.
+The levels get cached in com_dprintLevel for the Com_DPrintf macros
+=================
+*/
+int com_dprintLevel[DPRINT_NUM_CHANNELS];
+static cvar_t* com_dprintChannelCvars[DPRINT_NUM_CHANNELS];
+
+static void Com_UpdateDPrintChannels( cvar_t* var, void* arg )
+{
+    int i, developer;
+
+    developer = com_developer ? com_developer->integer : 0;
+    com_dprintLevel[DPRINT_GENERAL] = developer;
+
+    for(i = DPRINT_GENERAL +1; i < DPRINT_NUM_CHANNELS; i++)
+    {
+        if(com_dprintChannelCvars[i] == NULL)
+            com_dprintLevel[i] = developer;
+        else if(com_dprintChannelCvars[i]->integer < 0)
+            com_dprintLevel[i] = developer;
+        else
+            com_dprintLevel[i] = com_dprintChannelCvars[i]->integer;
+    }
+
+    if(com_developer_script && com_developer_script->integer && com_dprintLevel[DPRINT_SCRIPT] < 1)
+        com_dprintLevel[DPRINT_SCRIPT] = 1;
+}
+
+void Com_InitDPrintChannels( void )
+{
+    int i;
+
+    com_dprintChannelCvars[DPRINT_NET] = Cvar_RegisterInt("developer_net", -1, -1, 2, 0, "Developer output of the network code. -1 follows developer");
+    com_dprintChannelCvars[DPRINT_FS] = Cvar_RegisterInt("developer_fs", -1, -1, 2, 0, "Developer output of the filesystem. -1 follows developer");
+    com_dprintChannelCvars[DPRINT_PLUGIN] = Cvar_RegisterInt("developer_plugin", -1, -1, 2, 0, "Developer output of the plugin handler. -1 follows developer");
+
+    Cvar_AddChangeCallback(com_developer, Com_UpdateDPrintChannels, NULL);
+    Cvar_AddChangeCallback(com_developer_script, Com_UpdateDPrintChannels, NULL);
+    for(i = DPRINT_GENERAL +1; i < DPRINT_NUM_CHANNELS; i++)
+    {
+        if(com_dprintChannelCvars[i])
+            Cvar_AddChangeCallback(com_dprintChannelCvars[i], Com_UpdateDPrintChannels, NULL);
+    }
+    Com_UpdateDPrintChannels(NULL, NULL);
+}
+
+
 int Com_IsDeveloper()
 {
     if(com_developer && com_developer->integer)
@@ -538,7 +834,10 @@ void Com_Quit_f( void ) {
 
 		Com_Close();
 
+		Sys_ShutdownWorkerThreads();
+
 		Com_CloseLogFiles( );
+		NET_CaptureShutdown( );
 
 		FS_Shutdown(qtrue);
 		FS_ShutdownIwdPureCheckReferences();
@@ -562,6 +861,7 @@ void Com_InitCvars( void ){
     com_fixedtime = Cvar_RegisterInt("fixedtime", 0, 0, 1000, 0x80, "Use a fixed time rate for each frame");
     com_maxFrameTime = Cvar_RegisterInt("com_maxFrameTime", 100, 50, 1000, 0, "Time slows down if a frame takes longer than this many milliseconds");
     com_animCheck = Cvar_RegisterBool("com_animCheck", qfalse, 0, "Check anim tree");
+    com_workerThreads = Cvar_RegisterInt("com_workerThreads", 2, 0, MAX_WORKERTHREADS, CVAR_INIT, "Number of threads which execute background jobs such as file writes. 0 executes them on the main thread");
     s = va("%s %s %s %s", GAME_STRING, Q3_VERSION, PLATFORM_STRING, __DATE__ );
 
     com_version = Cvar_RegisterString ("version", s, CVAR_ROM | CVAR_SERVERINFO , "Game version");
@@ -583,6 +883,7 @@ void Com_InitCvars( void ){
 
     tmp = (cvar_t**)(0x88a6188);
     *tmp = Cvar_RegisterBool ("developer_script", qfalse, 16, "Enable developer script comments");
+    Com_InitDPrintChannels();
     tmp = (cvar_t**)(0x88a61b0);
     *tmp = Cvar_RegisterEnum("logfile", logfileEnum, 0, 0, "Write to logfile");
     tmp = (cvar_t**)(0x88a61a8);
@@ -619,8 +920,6 @@ void Com_Init(char* commandLine){
     }
     Com_Printf("%s %s %s build %i %s\n", GAME_STRING,Q3_VERSION,PLATFORM_STRING, BUILD_NUMBER, __DATE__);
 
-    XAssets_PatchLimits();  //Patch several asset-limits to higher values
-
     SL_Init();
 
     Swap_Init();
@@ -637,6 +936,16 @@ void Com_Init(char* commandLine){
 
     Com_InitCvars();
 
+    XAssets_PatchLimits();  //Patch several asset-limits to higher values, after the command line so the sizes can be set there
+
+    Sys_InitThreadPlacement();
+
+    Sys_InitWorkerThreads(com_workerThreads->integer);
+
+    Com_InitLogWriter();
+
+    Com_InitProfiler();
+
     Cvar_Init();
 
     CSS_InitConstantConfigStrings();
@@ -654,8 +963,12 @@ void Com_Init(char* commandLine){
         Mem_BeginAlloc("$init", qtrue);
     }
 
+    Com_StartupPhase("filesystem");
+
     FS_InitFilesystem();
 
+    Com_StartupPhase("default_cfg");
+
     Con_InitChannels();
 
     Cbuf_AddText(0, "exec default_mp.cfg\n");
@@ -738,10 +1051,14 @@ void Com_Init(char* commandLine){
         Cmd_AddCommand ("freeze", Com_Freeze_f);
     }
     Cmd_AddCommand ("quit", Com_Quit_f);
+    Cmd_AddCommand ("meminfo", Z_MemInfo_f);
+    Cmd_AddCommand ("redirectstatus", Com_RedirectStatus_f);
 
 //    Com_AddLoggingCommands();
 //    HL2Rcon_AddSourceAdminCommands();
 
+    Com_StartupPhase("sys_init");
+
     Sys_Init();
 
     Com_UpdateRealtime();
@@ -749,6 +1066,8 @@ void Com_Init(char* commandLine){
     Com_RandomBytes( (byte*)&qport, sizeof(int) );
     Netchan_Init( qport );
 
+    Com_StartupPhase("scripts");
+
     Scr_InitVariables();
 
     Scr_Init(); //VM_Init
@@ -759,9 +1078,16 @@ void Com_Init(char* commandLine){
 
     DObjInit();
 
+    Com_StartupPhase("plugins");
+
     PHandler_Init();
 
+    Com_StartupPhase("network");
+
     NET_Init();
+    NET_CaptureInit();
+
+    Com_StartupPhase("sv_init");
 
     SV_Init();
 
@@ -771,15 +1097,21 @@ void Com_Init(char* commandLine){
     DB_SetInitializing( qfalse );
     Com_Printf("end $init %d ms\n", Sys_Milliseconds() - msec);
 
+    Com_StartupPhase("fastfiles");
+
     if(useFastfiles->integer)
         R_Init();
 
+    Com_StartupPhase("nvconfig");
+
     Com_DvarDump(6,0);
 
     NV_LoadConfig();
 
     Com_Printf("--- Common Initialization Complete ---\n");
 
+    Com_StartupPhase("startup_cmds");
+
     Cbuf_Execute( 0, 0 );
 
     Com_AddStartupCommands( );
@@ -794,9 +1126,12 @@ void Com_Init(char* commandLine){
 
 
     HL2Rcon_Init();
+    SV_WWWServer_Init();
 
     AddRedirectLocations();
 
+    Com_StartupPhase("first_frame");
+
 }
 
 
@@ -959,19 +1294,50 @@ __optimize3 void Com_Frame( void ) {
 	}
 #endif
 	if(!SV_Frame( usec ))
+	{
+		// another thread has queued an event or finished a job while we were sleeping
+		if(NET_ConsumeWakeup())
+			Com_EventLoop();
 		return;
+	}
 
-	PHandler_Event(PLUGINS_ONFRAME);
+	PROFILE_BEGIN(PROFILE_PLUGINFRAME);
+	PHandler_TcpConnectionEvents();
+	PHandler_FrameEvent();
+	PROFILE_END(PROFILE_PLUGINFRAME);
 
+	PROFILE_BEGIN(PROFILE_EVENTLOOP);
 	Com_TimedEventLoop();
 	Com_EventLoop();
+	PROFILE_END(PROFILE_EVENTLOOP);
+
+	PROFILE_BEGIN(PROFILE_COMMANDS);
 	Cbuf_Execute (0 ,0);
+	PROFILE_END(PROFILE_COMMANDS);
+
+	PROFILE_BEGIN(PROFILE_NETWORK);
 	NET_Sleep(0);
+	NET_ReplayFrame();
 	NET_TcpServerPacketEventLoop();
+	SV_WWWServer_Frame();
+	Com_RedirectFlush();
+	HL2Rcon_FlushEventBatch();
+	Com_FlushBinaryLogs(qfalse);
+	PROFILE_END(PROFILE_NETWORK);
+
+	PROFILE_BEGIN(PROFILE_COMMANDS);
 	Cbuf_Execute (0 ,0);
+	Cvar_RunChangeCallbacks();
+	PROFILE_END(PROFILE_COMMANDS);
 
 	SetAnimCheck(com_animCheck->boolean);
 
+	PROFILE_END(PROFILE_FRAME);
+	Com_ProfileFrame();
+
+	if(com_startupPending)
+		Com_StartupDone();
+
 #ifdef TIMEDEBUG
 	if ( com_speeds->integer ) {
 		timeAfter = Sys_Milliseconds ();
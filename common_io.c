@@ -25,6 +25,7 @@
 #include "q_shared.h"
 #include "sys_thread.h"
 #include "qcommon_io.h"
+#include "qcommon_redirect.h"
 #include "qcommon_logprint.h"
 #include "qcommon.h"
 #include "sys_main.h"
@@ -59,6 +60,7 @@ qboolean Com_IsDeveloper( void ){ return qtrue; }
 //============================================================================
 static char	*rd_buffer;
 static int	rd_buffersize;
+static int	rd_bufferlen;	// strlen of rd_buffer, redirect buffers can be large
 static void	(*rd_flush)( char *buffer, qboolean );
 
 
@@ -68,6 +70,7 @@ void Com_BeginRedirect (char *buffer, int buffersize, void (*flush)( char *, qbo
 		return;
 	rd_buffer = buffer;
 	rd_buffersize = buffersize;
+	rd_bufferlen = 0;
 	rd_flush = flush;
 
 	*rd_buffer = 0;
@@ -81,6 +84,7 @@ void Com_EndRedirect (void)
 
 	rd_buffer = NULL;
 	rd_buffersize = 0;
+	rd_bufferlen = 0;
 	rd_flush = NULL;
 }
 
@@ -111,15 +115,20 @@ __cdecl void Com_PrintMessage( int dumbIWvar, char *msg, msgtype_t type) {
 				Sys_LeaveCriticalSection(5);
 				return;
 			}
-			if ((msglen + strlen(rd_buffer)) > (rd_buffersize - 1)) {
+			if ((msglen + rd_bufferlen) > (rd_buffersize - 1)) {
 
 				lock = qtrue;
 				rd_flush(rd_buffer, qfalse);
 				lock = qfalse;
 
 				*rd_buffer = 0;
+				rd_bufferlen = 0;
 			}
-			Q_strcat(rd_buffer, rd_buffersize, msg);
+			if (msglen > rd_buffersize - 1 - rd_bufferlen)
+				msglen = rd_buffersize - 1 - rd_bufferlen;
+			Com_Memcpy(rd_buffer + rd_bufferlen, msg, msglen);
+			rd_bufferlen += msglen;
+			rd_buffer[rd_bufferlen] = 0;
 			// TTimo nooo .. that would defeat the purpose
 			//rd_flush(rd_buffer);
 			//*rd_buffer = 0;
@@ -257,11 +266,12 @@ Com_DPrintf
 A Com_Printf that only shows up if the "developer" cvar is set
 ================
 */
-void QDECL Com_DPrintf( const char *fmt, ...) {
+void QDECL (Com_DPrintf)( const char *fmt, ...) {
 	va_list		argptr;
 	char		msg[MAXPRINTMSG];
-		
-	if ( !Com_IsDeveloper() ) {
+
+	//The macro did test it already, plugins come in here directly
+	if ( !com_dprintLevel[DPRINT_GENERAL] ) {
 		return;			// don't confuse non-developers with techie stuff...
 	}
 	
@@ -280,7 +290,7 @@ void QDECL Com_DPrintfWrapper( int drop, const char *fmt, ...) {
 	va_list		argptr;
 	char		msg[MAXPRINTMSG];
 		
-	if ( !Com_IsDeveloper() ) {
+	if ( !com_dprintLevel[DPRINT_GENERAL] ) {
 		return;			// don't confuse non-developers with techie stuff...
 	}
 	
@@ -294,6 +304,21 @@ void QDECL Com_DPrintfWrapper( int drop, const char *fmt, ...) {
         Com_PrintMessage( 0, msg, MSG_DEFAULT);
 }
 
+//Com_DPrintfChannel has checked the level of the channel
+void QDECL Com_DPrintChannel( const char *fmt, ...) {
+	va_list		argptr;
+	char		msg[MAXPRINTMSG];
+
+	msg[0] = '^';
+	msg[1] = '2';
+
+	va_start (argptr,fmt);
+	Q_vsnprintf (&msg[2], (sizeof(msg)-3), fmt, argptr);
+	va_end (argptr);
+
+        Com_PrintMessage( 0, msg, MSG_DEFAULT);
+}
+
 /*
 ================
 Com_DPrintNoRedirect
@@ -302,11 +327,11 @@ A Com_Printf that only shows up if the "developer" cvar is set
 This will not print to rcon
 ================
 */
-void QDECL Com_DPrintNoRedirect( const char *fmt, ... ) {
+void QDECL (Com_DPrintNoRedirect)( const char *fmt, ... ) {
 	va_list		argptr;
 	char		msg[MAXPRINTMSG];
 
-	if ( !Com_IsDeveloper() ) {
+	if ( !com_dprintLevel[DPRINT_GENERAL] ) {
 		return;			// don't confuse non-developers with techie stuff...
 	}
 	
@@ -335,53 +360,7 @@ void QDECL Com_PrintScriptRuntimeWarning(const char *fmt, ...)
 
 
 
-#define MAX_REDIRECTDESTINATIONS 4
-
-static void (*rd_destinations[MAX_REDIRECTDESTINATIONS])( const char *buffer, int len );
-
-
 void Com_PrintRedirect(char* msg, int msglen)
 {
-
-    int i;
-
-    for(i = 0; i < MAX_REDIRECTDESTINATIONS; i++)
-    {
-        if(rd_destinations[i] == NULL)
-            return;
-
-        rd_destinations[i](msg, msglen);
-
-    }
-
-}
-
-
-/*
-    To Add:
-    PbCapatureConsoleOutput(msg, MAXPRINTMSG);
-    HL2Rcon_SourceRconSendConsole( msg, msglen);
-    Com_PrintUDP( msg, msglen );
-*/
-
-
-void Com_AddRedirect(void (*rd_dest)(const char *, int))
-{
-    int i;
-
-    for(i = 0; i < MAX_REDIRECTDESTINATIONS; i++)
-    {
-        if(rd_destinations[i] == rd_dest)
-        {
-            Com_Error(ERR_FATAL, "Com_AddRedirect: Attempt to add an already defined redirect function twice.");
-            return;
-        }
-
-        if(rd_destinations[i] == NULL)
-        {
-            rd_destinations[i] = rd_dest;
-            return;
-        }
-    }
-    Com_Error(ERR_FATAL, "Com_AddRedirect: Out of redirect handles. Increase MAX_REDIRECTDESTINATIONS to add more redirect destinations");
+    Com_RedirectPublish(RD_CHANNEL_CONSOLE, msg, msglen, -1, 0);
 }
\ No newline at end of file
@@ -0,0 +1,403 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+/*
+========================================================================
+
+Structured binary logs
+
+Besides or instead of the text of games_mp.log and adminactions.log the
+lines get written as typed records into games_mp.bin and adminactions.bin,
+see qcommon_logbinary.h for the format. Records get collected into blocks
+which are compressed and handed to the async log writer once they are full
+or LOGBINARY_FLUSHMSEC old. tools/logbinary_reader.c reads the files.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon.h"
+#include "qcommon_io.h"
+#include "qcommon_logprint.h"
+#include "qcommon_logbinary.h"
+#include "filesystem.h"
+#include "cvar.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+
+#include <string.h>
+#include <limits.h>
+
+#define LOGBINARY_FLUSHMSEC 2000
+#define LOGBINARY_MAXRECORD (2 * LOGBINARY_MAXLINE)
+#define LOGBINARY_HASHBITS 12
+
+typedef struct{
+	const char*	filename;
+	int		slot;
+	fileHandle_t	file;
+	qboolean	failed;			//Could not be opened, stays off until the logfiles get closed
+	byte		block[LOGBINARY_BLOCKSIZE];
+	int		length;
+	int		records;
+	int		lastTime;
+	int		startMsec;		//When the first record of the block came in
+	unsigned int	realtime;
+}logBinaryStream_t;
+
+static logBinaryStream_t logBinaryStreams[2] = {
+	{ "games_mp.bin", LOGWRITER_GAMEBINARY },
+	{ "adminactions.bin", LOGWRITER_ADMINBINARY }
+};
+
+cvar_t* com_logBinary;
+
+
+static byte* Com_LogBinaryPutVarint(byte* p, unsigned long long value){
+
+	while(value >= 0x80){
+		*p++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	*p++ = value;
+	return p;
+}
+
+static unsigned int Com_LogBinaryZigzag(int value){
+
+	return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+//Only takes the numbers which get printed back the same way
+static qboolean Com_LogBinaryParseInt(const char* s, int len, int* value){
+
+	long long v = 0;
+	qboolean negative = qfalse;
+	int i = 0;
+
+	if(len > 0 && s[0] == '-'){
+		negative = qtrue;
+		i = 1;
+	}
+	if(i >= len || len - i > 10)
+		return qfalse;
+
+	if(s[i] == '0' && (len - i > 1 || negative))
+		return qfalse;
+
+	for(; i < len; i++){
+		if(s[i] < '0' || s[i] > '9')
+			return qfalse;
+		v = v * 10 + (s[i] - '0');
+	}
+	if(negative)
+		v = -v;
+
+	if(v < INT_MIN || v > INT_MAX)
+		return qfalse;
+
+	*value = v;
+	return qtrue;
+}
+
+/*
+LZ4 block compressor, greedy with a single hash table. Returns 0 if the output
+does not fit into dstcap, the block gets stored then.
+*/
+static byte* Com_LogBinaryEmitSequence(byte* op, byte* dstend, const byte* literals, int litlen, int offset, int matchlen){
+
+	byte* token;
+	int n;
+
+	if(op == NULL || op + 1 + litlen / 255 + 1 + litlen + 2 + matchlen / 255 + 1 > dstend)
+		return NULL;
+
+	token = op++;
+	*token = (litlen >= 15 ? 15 : litlen) << 4;
+	if(litlen >= 15){
+		for(n = litlen - 15; n >= 255; n -= 255)
+			*op++ = 255;
+		*op++ = n;
+	}
+	Com_Memcpy(op, literals, litlen);
+	op += litlen;
+
+	if(matchlen == 0) //The last literals of the block
+		return op;
+
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+
+	matchlen -= 4;
+	*token |= matchlen >= 15 ? 15 : matchlen;
+	if(matchlen >= 15){
+		for(n = matchlen - 15; n >= 255; n -= 255)
+			*op++ = 255;
+		*op++ = n;
+	}
+	return op;
+}
+
+static int Com_LogBinaryCompress(const byte* src, int srclen, byte* dst, int dstcap){
+
+	static int table[1 << LOGBINARY_HASHBITS];
+	const byte *ip, *anchor, *ref, *end;
+	byte *op;
+	unsigned int seq, hash;
+	int matchlen;
+
+	ip = anchor = src;
+	end = src + srclen;
+	op = dst;
+
+	memset(table, 0xff, sizeof(table));
+
+	//A match has to start 12 bytes and end 5 bytes before the end of the block at the latest
+	while(srclen >= 13 && ip <= end - 12 && op != NULL)
+	{
+		Com_Memcpy(&seq, ip, 4);
+		hash = (seq * 2654435761u) >> (32 - LOGBINARY_HASHBITS);
+		ref = table[hash] >= 0 ? src + table[hash] : NULL;
+		table[hash] = ip - src;
+
+		//Blocks are smaller than the 64 KB the offset can reach
+		if(ref == NULL || memcmp(ref, ip, 4)){
+			ip++;
+			continue;
+		}
+
+		for(matchlen = 4; ip + matchlen < end - 5 && ref[matchlen] == ip[matchlen]; matchlen++);
+
+		op = Com_LogBinaryEmitSequence(op, dst + dstcap, anchor, ip - anchor, ip - ref, matchlen);
+		ip += matchlen;
+		anchor = ip;
+	}
+
+	op = Com_LogBinaryEmitSequence(op, dst + dstcap, anchor, end - anchor, 0, 0);
+	if(op == NULL)
+		return 0;
+
+	return op - dst;
+}
+
+//s is NULL for a record without fields
+static int Com_LogBinaryEncode(byte* record, int type, int timedelta, const char* s, const char* end){
+
+	byte fields[LOGBINARY_MAXRECORD];
+	byte head[16];
+	byte *p, *h, *r;
+	const char* field;
+	int count, value;
+
+	p = fields;
+	count = 0;
+
+	while(s != NULL)
+	{
+		field = s;
+		while(s < end && *s != ';')
+			s++;
+
+		if(Com_LogBinaryParseInt(field, s - field, &value)){
+			p = Com_LogBinaryPutVarint(p, ((unsigned long long)Com_LogBinaryZigzag(value) << 1) | 1);
+		}else{
+			p = Com_LogBinaryPutVarint(p, (unsigned long long)(s - field) << 1);
+			Com_Memcpy(p, field, s - field);
+			p += s - field;
+		}
+		count++;
+
+		if(s < end)
+			s++;
+		else
+			s = NULL;
+	}
+
+	h = head;
+	*h++ = type;
+	h = Com_LogBinaryPutVarint(h, Com_LogBinaryZigzag(timedelta));
+	h = Com_LogBinaryPutVarint(h, count);
+
+	r = Com_LogBinaryPutVarint(record, (h - head) + (p - fields));
+	Com_Memcpy(r, head, h - head);
+	r += h - head;
+	Com_Memcpy(r, fields, p - fields);
+	r += p - fields;
+
+	return r - record;
+}
+
+static void Com_FlushBinaryLog(logBinaryStream_t* stream){
+
+	static byte out[sizeof(logBinaryBlockHeader_t) + LOGBINARY_BLOCKSIZE];
+	logBinaryBlockHeader_t header;
+	int stored;
+
+	if(stream->length == 0)
+		return;
+
+	stored = Com_LogBinaryCompress(stream->block, stream->length, out + sizeof(header), stream->length - 1);
+	if(stored == 0){
+		Com_Memcpy(out + sizeof(header), stream->block, stream->length);
+		stored = stream->length;
+	}
+
+	header.magic = LOGBINARY_BLOCKMAGIC;
+	header.version = LOGBINARY_VERSION;
+	header.stream = stream - logBinaryStreams;
+	header.rawLength = stream->length;
+	header.storedLength = stored;
+	header.records = stream->records;
+	header.realtime = stream->realtime;
+	Com_Memcpy(out, &header, sizeof(header));
+
+	Com_WriteLog(stream->slot, stream->file, (const char*)out, sizeof(header) + stored, com_logfile->integer > 1);
+
+	stream->length = 0;
+	stream->records = 0;
+	stream->lastTime = 0;
+}
+
+/*
+==================
+Com_WriteBinaryLog
+
+Same line as it goes into the text log, the game log without the timestamp
+==================
+*/
+void Com_WriteBinaryLog(int streamnum, int time, const char* line, int len){
+
+	static const char* typenames[] = LOGBINARY_TYPENAMES;
+	logBinaryStream_t* stream = &logBinaryStreams[streamnum];
+	byte record[LOGBINARY_MAXRECORD + 16];
+	const char *end, *field, *s;
+	int type, flags, recordlen;
+
+	if(len > LOGBINARY_MAXLINE)
+		len = LOGBINARY_MAXLINE;
+
+	Sys_EnterCriticalSection(5);
+
+	if(!stream->file && !stream->failed && FS_Initialized()){
+
+		stream->file = FS_FOpenFileAppend(stream->filename);
+		if(stream->file){
+			FS_ForceFlush(stream->file);
+		}else{
+			stream->failed = qtrue;
+			Com_PrintWarning("Com_WriteBinaryLog: Can not open %s for writing\n", stream->filename);
+		}
+	}
+
+	if(!stream->file){
+		Sys_LeaveCriticalSection(5);
+		return;
+	}
+
+	end = line + len;
+	flags = 0;
+	if(len > 0 && end[-1] == '\n')
+		end--;
+	else
+		flags = LOGBINARY_NONEWLINE;
+
+	for(field = line; field < end && *field != ';'; field++);
+
+	for(type = 1; type < LOGBINARY_NUMTYPES; type++){
+		if(strlen(typenames[type]) == field - line && !strncmp(typenames[type], line, field - line))
+			break;
+	}
+
+	if(type < LOGBINARY_NUMTYPES){
+		s = field < end ? field + 1 : NULL;
+	}else{
+		type = LOGBINARY_TEXT;
+		s = line;
+	}
+
+	recordlen = Com_LogBinaryEncode(record, type | flags, time - stream->lastTime, s, end);
+	if(stream->length + recordlen > LOGBINARY_BLOCKSIZE){
+		//The time difference starts over with the new block
+		Com_FlushBinaryLog(stream);
+		recordlen = Com_LogBinaryEncode(record, type | flags, time, s, end);
+	}
+
+	if(stream->length == 0){
+		stream->startMsec = Sys_Milliseconds();
+		stream->realtime = Com_GetRealtime();
+	}
+
+	Com_Memcpy(stream->block + stream->length, record, recordlen);
+	stream->length += recordlen;
+	stream->records++;
+	stream->lastTime = time;
+
+	Sys_LeaveCriticalSection(5);
+}
+
+//Called every frame, writes out the blocks which got old enough
+void Com_FlushBinaryLogs(qboolean force){
+
+	logBinaryStream_t* stream;
+	int i;
+
+	for(i = 0, stream = logBinaryStreams; i < 2; i++, stream++)
+	{
+		if(stream->length == 0)
+			continue;
+
+		if(!force && Sys_Milliseconds() - stream->startMsec < LOGBINARY_FLUSHMSEC)
+			continue;
+
+		Sys_EnterCriticalSection(5);
+		Com_FlushBinaryLog(stream);
+		Sys_LeaveCriticalSection(5);
+	}
+}
+
+void Com_CloseBinaryLogs(void){
+
+	logBinaryStream_t* stream;
+	int i;
+
+	Com_FlushBinaryLogs(qtrue);
+
+	Sys_EnterCriticalSection(5);
+
+	for(i = 0, stream = logBinaryStreams; i < 2; i++, stream++)
+	{
+		if(stream->file){
+			Com_ReleaseLog(stream->file);
+			FS_FCloseFile(stream->file);
+		}
+		stream->file = 0;
+		stream->failed = qfalse;
+	}
+
+	Sys_LeaveCriticalSection(5);
+}
+
+void Com_InitBinaryLogs(void){
+
+	com_logBinary = Cvar_RegisterInt("com_logBinary", 0, 0, 2, CVAR_ARCHIVE, "Writes the game and admin log as structured records into games_mp.bin and adminactions.bin. 1 writes them besides the text logs, 2 instead of them");
+}
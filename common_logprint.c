@@ -24,12 +24,21 @@
 
 #include "q_shared.h"
 #include "qcommon.h"
+#include "qcommon_io.h"
+#include "qcommon_logprint.h"
+#include "qcommon_logbinary.h"
 #include "filesystem.h"
+#include "cvar.h"
 #include "sys_thread.h"
 
 #include <stdarg.h>
 #include <time.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #ifndef MAXPRINTMSG
 #define MAXPRINTMSG 1024
@@ -41,6 +50,344 @@ static fileHandle_t debuglogfile;
 static fileHandle_t enterleavelogfile;
 
 
+/*
+Asynchronous log writer
+
+Log messages get appended to a ring buffer and a background thread writes them out in large blocks.
+There is only one producer at a time because Com_WriteLog holds critical section 5 and only the
+writer thread consumes, so the ring buffer needs no lock. The writer thread writes to duplicated
+file descriptors, so a logfile which gets closed by the game does not break pending writes.
+Messages get written synchronously if the writer is not running, the log is in sync mode
+or the file descriptor can not be duplicated.
+*/
+
+#define LOGWRITER_STAGINGSIZE 0x10000
+
+enum{
+    LOGRECORD_DATA,
+    LOGRECORD_SETFD,
+    LOGRECORD_WRAP
+};
+
+typedef struct{
+    short slot;
+    short type;
+    int len; //Length of data or the new file descriptor
+}logRecord_t;
+
+typedef struct{
+    fileHandle_t handle; //Handle the slot's file descriptor got duplicated from
+    void *file; //Detects a handle which got closed and reused for another file
+    int fd;
+}logWriterSlot_t;
+
+typedef struct{
+    byte *buffer;
+    unsigned int size;
+    volatile unsigned int head;
+    volatile unsigned int tail;
+    volatile qboolean busy;
+    qboolean running;
+    int dropped;
+    logWriterSlot_t slots[MAX_LOGWRITER_SLOTS]; //Only used by producers
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+}logWriter_t;
+
+static logWriter_t logwriter = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+static cvar_t* com_logBufferSize;
+static cvar_t* com_logDropMessages;
+
+#define LOGRECORD_ALIGN(len) (((len) + 3) & ~3)
+
+
+static void Com_LogWriterWriteFd(int fd, const byte* data, int len){
+
+    int written;
+
+    if(fd < 0)
+        return;
+
+    while(len > 0){
+
+        written = write(fd, data, len);
+        if(written < 0){
+            if(errno == EINTR)
+                continue;
+            return; //Nothing we could do about it from here
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+static void* Com_LogWriterThread(void* arg){
+
+    static byte staging[LOGWRITER_STAGINGSIZE];
+    int fds[MAX_LOGWRITER_SLOTS];
+    int stagingslot = -1;
+    int staginglen = 0;
+    logRecord_t record;
+    unsigned int pos, contiguous;
+    struct timeval now;
+    struct timespec timeout;
+    int i;
+
+    Sys_PlaceHelperThread("cod4x-logwriter");
+
+    for(i = 0; i < MAX_LOGWRITER_SLOTS; i++)
+        fds[i] = -1;
+
+    while(1)
+    {
+        logwriter.busy = qtrue;
+        __sync_synchronize();
+
+        while(logwriter.tail != logwriter.head)
+        {
+            pos = logwriter.tail % logwriter.size;
+            contiguous = logwriter.size - pos;
+
+            if(contiguous < sizeof(logRecord_t)){
+                logwriter.tail += contiguous;
+                continue;
+            }
+
+            Com_Memcpy(&record, logwriter.buffer + pos, sizeof(logRecord_t));
+
+            if(record.type == LOGRECORD_WRAP){
+                __sync_synchronize();
+                logwriter.tail += contiguous;
+                continue;
+            }
+
+            if(record.type == LOGRECORD_SETFD || stagingslot != record.slot || staginglen + record.len > LOGWRITER_STAGINGSIZE){
+                if(staginglen > 0)
+                    Com_LogWriterWriteFd(fds[stagingslot], staging, staginglen);
+                staginglen = 0;
+                stagingslot = record.slot;
+            }
+
+            if(record.type == LOGRECORD_SETFD){
+                if(fds[record.slot] >= 0)
+                    close(fds[record.slot]);
+                fds[record.slot] = record.len;
+            }else{
+                Com_Memcpy(staging + staginglen, logwriter.buffer + pos + sizeof(logRecord_t), record.len);
+                staginglen += record.len;
+            }
+
+            __sync_synchronize();
+            if(record.type == LOGRECORD_DATA)
+                logwriter.tail += sizeof(logRecord_t) + LOGRECORD_ALIGN(record.len);
+            else
+                logwriter.tail += sizeof(logRecord_t);
+        }
+
+        if(staginglen > 0)
+            Com_LogWriterWriteFd(fds[stagingslot], staging, staginglen);
+        staginglen = 0;
+
+        __sync_synchronize();
+        logwriter.busy = qfalse;
+
+        gettimeofday(&now, NULL);
+        timeout.tv_sec = now.tv_sec;
+        timeout.tv_nsec = now.tv_usec * 1000 + 100000000;
+        if(timeout.tv_nsec >= 1000000000){
+            timeout.tv_sec++;
+            timeout.tv_nsec -= 1000000000;
+        }
+
+        pthread_mutex_lock(&logwriter.lock);
+        if(logwriter.tail == logwriter.head)
+            pthread_cond_timedwait(&logwriter.wake, &logwriter.lock, &timeout);
+        pthread_mutex_unlock(&logwriter.lock);
+    }
+    return NULL;
+}
+
+static void Com_LogWriterWake(){
+
+    pthread_mutex_lock(&logwriter.lock);
+    pthread_cond_signal(&logwriter.wake);
+    pthread_mutex_unlock(&logwriter.lock);
+}
+
+//Must be called with critical section 5 held. Records which are not data are never dropped
+static qboolean Com_LogWriterPush(int slot, int type, const void* data, int len){
+
+    logRecord_t record;
+    unsigned int pos, contiguous, needed, total;
+    byte *dst;
+
+    if(len > (int)(logwriter.size / 4))
+        len = logwriter.size / 4;
+
+    pos = logwriter.head % logwriter.size;
+    contiguous = logwriter.size - pos;
+    needed = sizeof(logRecord_t) + LOGRECORD_ALIGN(type == LOGRECORD_DATA ? len : 0);
+
+    if(contiguous < needed)
+        total = contiguous + needed;
+    else
+        total = needed;
+
+    while(total > logwriter.size - (logwriter.head - logwriter.tail))
+    {
+        if(type == LOGRECORD_DATA && com_logDropMessages->boolean){
+            logwriter.dropped++;
+            return qfalse;
+        }
+        Com_LogWriterWake();
+        usleep(1000);
+    }
+
+    if(contiguous < needed){
+        if(contiguous >= sizeof(logRecord_t)){
+            record.slot = slot;
+            record.type = LOGRECORD_WRAP;
+            record.len = 0;
+            Com_Memcpy(logwriter.buffer + pos, &record, sizeof(logRecord_t));
+        }
+        pos = 0;
+    }
+
+    dst = logwriter.buffer + pos;
+    record.slot = slot;
+    record.type = type;
+    record.len = len;
+    Com_Memcpy(dst, &record, sizeof(logRecord_t));
+    if(type == LOGRECORD_DATA)
+        Com_Memcpy(dst + sizeof(logRecord_t), data, len);
+
+    __sync_synchronize();
+    logwriter.head += total;
+
+    if(logwriter.head - logwriter.tail > logwriter.size / 4)
+        Com_LogWriterWake();
+
+    return qtrue;
+}
+
+static void Com_LogWriterSetFd(int slot, fileHandle_t handle, int fd){
+
+    Com_LogWriterPush(slot, LOGRECORD_SETFD, NULL, fd);
+    logwriter.slots[slot].handle = handle;
+    logwriter.slots[slot].file = handle ? fsh[handle].handleFiles.file.o : NULL;
+    logwriter.slots[slot].fd = fd;
+}
+
+void Com_InitLogWriter(){
+
+    if(logwriter.running)
+        return;
+
+    com_logBufferSize = Cvar_RegisterInt("com_logBufferSize", 1024, 64, 65536, CVAR_INIT, "Size in kilobytes of the buffer for log messages which are waiting to be written to disk");
+    com_logDropMessages = Cvar_RegisterBool("com_logDropMessages", qfalse, 0, "Drop log messages if the log buffer is full instead of waiting until there is space");
+    Com_InitBinaryLogs();
+
+    logwriter.size = com_logBufferSize->integer * 1024;
+    logwriter.buffer = malloc(logwriter.size);
+    if(!logwriter.buffer){
+        Com_PrintWarning("Com_InitLogWriter: Out of memory. Logfiles will be written synchronously\n");
+        return;
+    }
+    logwriter.head = logwriter.tail = 0;
+
+    if(pthread_create(&logwriter.thread, NULL, Com_LogWriterThread, NULL) != 0){
+        Com_PrintWarning("Com_InitLogWriter: Can not create writer thread. Logfiles will be written synchronously\n");
+        free(logwriter.buffer);
+        logwriter.buffer = NULL;
+        return;
+    }
+    logwriter.running = qtrue;
+}
+
+//Blocks until everything in the log buffer has been written
+void Com_SyncLogWriter(){
+
+    if(!logwriter.running)
+        return;
+
+    Sys_EnterCriticalSection(5);
+
+    while(logwriter.tail != logwriter.head || logwriter.busy){
+        Com_LogWriterWake();
+        usleep(1000);
+    }
+
+    Sys_LeaveCriticalSection(5);
+}
+
+//Stops using the writer for this file
+static void Com_LogWriterReleaseSlot(int slot){
+
+    if(!logwriter.running || !logwriter.slots[slot].handle)
+        return;
+
+    Com_LogWriterSetFd(slot, 0, -1);
+    Com_SyncLogWriter();
+}
+
+void Com_WriteLog(int slot, fileHandle_t handle, const char* msg, int len, qboolean sync){
+
+    logWriterSlot_t *ws;
+    char note[64];
+    int fd;
+
+    if(!handle)
+        return;
+
+    Sys_EnterCriticalSection(5);
+
+    ws = &logwriter.slots[slot];
+
+    if(logwriter.running && !sync && (ws->handle != handle || ws->file != fsh[handle].handleFiles.file.o)){
+
+        fd = FS_DupFileDescriptor(handle);
+        if(fd >= 0)
+            Com_LogWriterSetFd(slot, handle, fd);
+        else
+            Com_LogWriterReleaseSlot(slot);
+    }
+
+    if(!logwriter.running || sync || ws->handle != handle){
+
+        //Everything written through the writer so far has to be on disk before
+        Com_LogWriterReleaseSlot(slot);
+        FS_Write(msg, len, handle);
+
+    }else{
+
+        if(logwriter.dropped > 0){
+            Com_sprintf(note, sizeof(note), "*** %i log messages dropped ***\n", logwriter.dropped);
+            if(Com_LogWriterPush(slot, LOGRECORD_DATA, note, strlen(note)))
+                logwriter.dropped = 0;
+        }
+        Com_LogWriterPush(slot, LOGRECORD_DATA, msg, len);
+    }
+
+    Sys_LeaveCriticalSection(5);
+}
+
+//Has to be called before a logfile handle gets closed
+void Com_ReleaseLog(fileHandle_t handle){
+
+    int i;
+
+    Sys_EnterCriticalSection(5);
+
+    for(i = 0; i < MAX_LOGWRITER_SLOTS; i++){
+        if(logwriter.slots[i].handle == handle)
+            Com_LogWriterReleaseSlot(i);
+    }
+
+    Sys_LeaveCriticalSection(5);
+}
+
+
 void QDECL SV_EnterLeaveLog( const char *fmt, ... ) {
 
 	Sys_EnterCriticalSection(5);
@@ -79,7 +426,7 @@ void QDECL SV_EnterLeaveLog( const char *fmt, ... ) {
 
 	    if ( enterleavelogfile && FS_Initialized()) {
 		Com_sprintf(msg, sizeof(msg), "%s: %s\n", ltime, inputmsg);
-		FS_Write(msg, strlen(msg), enterleavelogfile);
+		Com_WriteLog(LOGWRITER_ENTERLEAVE, enterleavelogfile, msg, strlen(msg), com_logfile->integer > 1);
 	    }
 
 	}
@@ -96,7 +443,12 @@ void QDECL Com_PrintAdministrativeLog( const char *msg ) {
 	time_t		realtime;
 
         // logfile
-	if ( com_logfile && com_logfile->integer ) {
+	if ( com_logfile && com_logfile->integer && com_logBinary && com_logBinary->integer ) {
+		Com_UpdateRealtime();
+		Com_WriteBinaryLog(LOGBINARY_STREAM_ADMIN, Com_GetRealtime(), msg, strlen(msg));
+	}
+
+	if ( com_logfile && com_logfile->integer && (!com_logBinary || com_logBinary->integer != 2) ) {
         // TTimo: only open the qconsole.log if the filesystem is in an initialized state
         //   also, avoid recursing in the qconsole.log opening (i.e. if fs_debug is on)
 
@@ -120,7 +472,7 @@ void QDECL Com_PrintAdministrativeLog( const char *msg ) {
 
 	    if ( adminlogfile && FS_Initialized())
 	    {
-		FS_Write(msg, strlen(msg), adminlogfile);
+		Com_WriteLog(LOGWRITER_ADMIN, adminlogfile, msg, strlen(msg), com_logfile->integer > 1);
 	    }
 
 	}
@@ -153,7 +505,7 @@ void Com_PrintLogfile( const char *msg )
 	    }
 	    if ( logfile && FS_Initialized()) 
 	    {
-	    	FS_Write(msg, strlen(msg), logfile);
+	    	Com_WriteLog(LOGWRITER_CONSOLE, logfile, msg, strlen(msg), com_logfile->integer > 1);
 	    }
 	}
 	Sys_LeaveCriticalSection(5);
@@ -165,6 +517,12 @@ This function should close all opened non Zip files
 */
 void Com_CloseLogFiles()
 {
+	Com_CloseBinaryLogs();
+
+	Com_ReleaseLog(adminlogfile);
+	Com_ReleaseLog(logfile);
+	Com_ReleaseLog(enterleavelogfile);
+
 	if(adminlogfile)
 		FS_FCloseFile( adminlogfile );
 	if(logfile)
@@ -0,0 +1,316 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+#include "q_shared.h"
+#include "qcommon_mem.h"
+#include "qcommon_io.h"
+#include "sys_thread.h"
+#include "qcommon_metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+==============================================================================
+
+Zone memory
+
+Blocks up to ZONE_MAXSLABCHUNK bytes come from slabs. Each slab holds chunks of a
+single size and freed chunks go back onto the free list of their size class. Small
+short-lived allocations can't fragment the heap this way and the process size stays at
+what was needed at peak time. Bigger blocks go straight to the C heap. Every block
+is charged to a tag and the tags get compared from one level load to the next
+==============================================================================
+*/
+
+#define ZONE_CRITSECTION 25
+#define ZONE_SLABSIZE 0x10000
+#define ZONE_MINCHUNK 32
+#define ZONE_NUMCLASSES 7	//32 to 2048 bytes
+#define ZONE_MAXSLABCHUNK ( ZONE_MINCHUNK << ( ZONE_NUMCLASSES - 1 ) )
+#define ZONE_LARGEBLOCK 0xff
+#define ZONE_MAGIC 0x1d4a
+#define ZONE_FREEMAGIC 0x1d4b
+
+typedef struct zblock_s{
+	struct zblock_s *next;		//Free list link while the chunk is unused
+	int size;			//Requested size
+	unsigned short magic;
+	byte tag;
+	byte sizeClass;
+	int unused;
+}zblock_t;
+
+static const char *zone_tagNames[TAG_COUNT] = {
+	"general",
+	"commands",
+	"admins",
+	"querylimit",
+	"events",
+	"script",
+	"download",
+	"plugins"
+};
+
+static struct{
+	struct{
+		int		blocks;
+		int		bytes;
+		int		peakBytes;
+		unsigned int	allocs;
+		int		levelBlocks;	//At the last level load
+		int		levelBytes;
+	}tags[TAG_COUNT];
+	struct{
+		zblock_t	*freeList;
+		int		slabs;
+		int		freeChunks;
+	}classes[ZONE_NUMCLASSES];
+	int	largeBlocks;
+	int	largeBytes;
+	qboolean levelCheckDone;
+}zone;
+
+
+static int Z_SizeClass( int total ) {
+
+	int sizeClass, chunk;
+
+	for(sizeClass = 0, chunk = ZONE_MINCHUNK; sizeClass < ZONE_NUMCLASSES; sizeClass++, chunk <<= 1)
+	{
+		if(total <= chunk)
+			return sizeClass;
+	}
+	return ZONE_LARGEBLOCK;
+}
+
+/* Has to be called inside the critical section */
+static qboolean Z_AddSlab( int sizeClass ) {
+
+	byte *slab;
+	zblock_t *chunk;
+	int i, chunkSize;
+
+	slab = malloc(ZONE_SLABSIZE);
+	if(!slab)
+		return qfalse;
+
+	chunkSize = ZONE_MINCHUNK << sizeClass;
+
+	for(i = 0; i + chunkSize <= ZONE_SLABSIZE; i += chunkSize)
+	{
+		chunk = (zblock_t*)&slab[i];
+		chunk->magic = ZONE_FREEMAGIC;
+		chunk->next = zone.classes[sizeClass].freeList;
+		zone.classes[sizeClass].freeList = chunk;
+		zone.classes[sizeClass].freeChunks++;
+	}
+	zone.classes[sizeClass].slabs++;
+	return qtrue;
+}
+
+void* Z_TagMalloc( int size, memtag_t tag ) {
+
+	zblock_t *block;
+	int sizeClass;
+
+	if(size < 0 || size > 0x40000000)
+		Com_Error(ERR_FATAL, "Z_Malloc: bad size %i", size);
+
+	if(tag < 0 || tag >= TAG_COUNT)
+		tag = TAG_GENERAL;
+
+	sizeClass = Z_SizeClass(size + sizeof(zblock_t));
+	block = NULL;
+
+	if(sizeClass == ZONE_LARGEBLOCK)
+	{
+		block = malloc(size + sizeof(zblock_t));
+		if(!block)
+			Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", size);
+	}
+
+	Sys_EnterCriticalSection(ZONE_CRITSECTION);
+
+	if(sizeClass == ZONE_LARGEBLOCK)
+	{
+		zone.largeBlocks++;
+		zone.largeBytes += size;
+
+	}else{
+
+		if(!zone.classes[sizeClass].freeList && !Z_AddSlab(sizeClass))
+		{
+			Sys_LeaveCriticalSection(ZONE_CRITSECTION);
+			Com_Error(ERR_FATAL, "Z_Malloc: failed on allocation of %i bytes", size);
+		}
+		block = zone.classes[sizeClass].freeList;
+		zone.classes[sizeClass].freeList = block->next;
+		zone.classes[sizeClass].freeChunks--;
+	}
+
+	zone.tags[tag].blocks++;
+	zone.tags[tag].bytes += size;
+	zone.tags[tag].allocs++;
+	if(zone.tags[tag].bytes > zone.tags[tag].peakBytes)
+		zone.tags[tag].peakBytes = zone.tags[tag].bytes;
+
+	Sys_LeaveCriticalSection(ZONE_CRITSECTION);
+
+	block->next = NULL;
+	block->size = size;
+	block->magic = ZONE_MAGIC;
+	block->tag = tag;
+	block->sizeClass = sizeClass;
+
+	//Callers expect cleared memory like from the original Z_Malloc
+	memset(block + 1, 0, size);
+	return block + 1;
+}
+
+void Z_TagFree( void *ptr ) {
+
+	zblock_t *block;
+
+	if(!ptr)
+		return;
+
+	block = (zblock_t*)ptr - 1;
+
+	if(block->magic == ZONE_FREEMAGIC)
+		Com_Error(ERR_FATAL, "Z_Free: memory block freed twice");
+
+	if(block->magic != ZONE_MAGIC)
+		Com_Error(ERR_FATAL, "Z_Free: memory block wasn't allocated by Z_Malloc");
+
+	Sys_EnterCriticalSection(ZONE_CRITSECTION);
+
+	block->magic = ZONE_FREEMAGIC;
+	zone.tags[block->tag].blocks--;
+	zone.tags[block->tag].bytes -= block->size;
+
+	if(block->sizeClass == ZONE_LARGEBLOCK)
+	{
+		zone.largeBlocks--;
+		zone.largeBytes -= block->size;
+
+	}else{
+
+		block->next = zone.classes[block->sizeClass].freeList;
+		zone.classes[block->sizeClass].freeList = block;
+		zone.classes[block->sizeClass].freeChunks++;
+		block = NULL;
+	}
+
+	Sys_LeaveCriticalSection(ZONE_CRITSECTION);
+
+	if(block)
+		free(block);
+}
+
+/*
+Memory of these tags only belongs to the running level, so they should not grow from one
+level to the next. Everything else is reported only when com_developer is set
+*/
+static qboolean Z_IsLevelTag( memtag_t tag ) {
+
+	return tag == TAG_EVENTS || tag == TAG_SCRIPT || tag == TAG_DOWNLOAD;
+}
+
+void Z_LevelCheck( void ) {
+
+	int tag, blocks, bytes;
+
+	Sys_EnterCriticalSection(ZONE_CRITSECTION);
+
+	for(tag = 0; tag < TAG_COUNT; tag++)
+	{
+		blocks = zone.tags[tag].blocks - zone.tags[tag].levelBlocks;
+		bytes = zone.tags[tag].bytes - zone.tags[tag].levelBytes;
+
+		if(zone.levelCheckDone && blocks > 0)
+		{
+			if(Z_IsLevelTag(tag))
+				Com_PrintWarning("Memory tag %s holds %d blocks (%d bytes) more than at the last level load\n", zone_tagNames[tag], blocks, bytes);
+			else
+				Com_DPrintf("Memory tag %s holds %d blocks (%d bytes) more than at the last level load\n", zone_tagNames[tag], blocks, bytes);
+		}
+		zone.tags[tag].levelBlocks = zone.tags[tag].blocks;
+		zone.tags[tag].levelBytes = zone.tags[tag].bytes;
+	}
+	zone.levelCheckDone = qtrue;
+
+	Sys_LeaveCriticalSection(ZONE_CRITSECTION);
+}
+
+void Z_MemInfo_f( void ) {
+
+	int i, chunkSize, totalBytes, totalBlocks, slabBytes;
+
+	Com_Printf("tag          blocks      bytes       peak     allocs\n");
+	Com_Printf("---------- -------- ---------- ---------- ----------\n");
+
+	for(i = 0, totalBytes = 0, totalBlocks = 0; i < TAG_COUNT; i++)
+	{
+		Com_Printf("%-10s %8d %10d %10d %10u\n", zone_tagNames[i], zone.tags[i].blocks, zone.tags[i].bytes,
+				zone.tags[i].peakBytes, zone.tags[i].allocs);
+		totalBytes += zone.tags[i].bytes;
+		totalBlocks += zone.tags[i].blocks;
+	}
+	Com_Printf("%-10s %8d %10d\n\n", "total", totalBlocks, totalBytes);
+
+	Com_Printf("chunk  slabs   used   free\n");
+	Com_Printf("----- ------ ------ ------\n");
+
+	for(i = 0, chunkSize = ZONE_MINCHUNK, slabBytes = 0; i < ZONE_NUMCLASSES; i++, chunkSize <<= 1)
+	{
+		if(!zone.classes[i].slabs)
+			continue;
+
+		Com_Printf("%5d %6d %6d %6d\n", chunkSize, zone.classes[i].slabs,
+				zone.classes[i].slabs * (ZONE_SLABSIZE / chunkSize) - zone.classes[i].freeChunks, zone.classes[i].freeChunks);
+		slabBytes += zone.classes[i].slabs * ZONE_SLABSIZE;
+	}
+	Com_Printf("%d KB in slabs, %d large blocks with %d KB\n", slabBytes / 1024, zone.largeBlocks, zone.largeBytes / 1024);
+}
+
+void Z_WriteMetrics( metricsBuf_t* buf ) {
+
+	int i;
+
+	Metrics_Declare(buf, "cod4x_zone_bytes", "gauge", "Bytes allocated from the zone by tag");
+	for(i = 0; i < TAG_COUNT; i++)
+		Metrics_Printf(buf, "cod4x_zone_bytes{tag=\"%s\"} %d\n", zone_tagNames[i], zone.tags[i].bytes);
+
+	Metrics_Declare(buf, "cod4x_zone_blocks", "gauge", "Blocks allocated from the zone by tag");
+	for(i = 0; i < TAG_COUNT; i++)
+		Metrics_Printf(buf, "cod4x_zone_blocks{tag=\"%s\"} %d\n", zone_tagNames[i], zone.tags[i].blocks);
+
+	Metrics_Declare(buf, "cod4x_zone_peak_bytes", "gauge", "Most bytes ever allocated from the zone by tag");
+	for(i = 0; i < TAG_COUNT; i++)
+		Metrics_Printf(buf, "cod4x_zone_peak_bytes{tag=\"%s\"} %d\n", zone_tagNames[i], zone.tags[i].peakBytes);
+
+	Metrics_Declare(buf, "cod4x_zone_allocs_total", "counter", "Zone allocations by tag");
+	for(i = 0; i < TAG_COUNT; i++)
+		Metrics_Printf(buf, "cod4x_zone_allocs_total{tag=\"%s\"} %u\n", zone_tagNames[i], zone.tags[i].allocs);
+}
@@ -0,0 +1,67 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+
+#include "q_shared.h"
+#include "qcommon_metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+
+void Metrics_Init( metricsBuf_t* buf, char* data, int size ) {
+
+	buf->data = data;
+	buf->size = size;
+	buf->len = 0;
+	buf->overflowed = qfalse;
+	if(size > 0)
+		data[0] = '\0';
+}
+
+void Metrics_Printf( metricsBuf_t* buf, const char* fmt, ... ) {
+
+	va_list argptr;
+	int len;
+
+	if(buf->overflowed)
+		return;
+
+	va_start(argptr, fmt);
+	len = Q_vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, argptr);
+	va_end(argptr);
+
+	if(len < 0 || len >= buf->size - buf->len)
+	{
+		buf->data[buf->len] = '\0';
+		buf->overflowed = qtrue;
+		return;
+	}
+	buf->len += len;
+}
+
+void Metrics_Declare( metricsBuf_t* buf, const char* name, const char* type, const char* help ) {
+
+	Metrics_Printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
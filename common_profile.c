@@ -0,0 +1,566 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+    Copyright (C) 1999-2005 Id Software, Inc.
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+#include "q_shared.h"
+#include "qcommon.h"
+#include "qcommon_io.h"
+#include "qcommon_profile.h"
+#include "qcommon_metrics.h"
+#include "filesystem.h"
+#include "cvar.h"
+#include "cmd.h"
+#include "sys_main.h"
+#include "hl2rcon.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+Frame time profiler
+
+Scopes get enclosed with PROFILE_BEGIN / PROFILE_END. Each sample lands in a histogram with
+4 buckets per power of two, so percentiles come without storing samples.
+A histogram covers PROFILE_WINDOW_USEC, reports merge the running and the last complete window.
+*/
+
+#define PROFILE_BUCKETS 128
+#define PROFILE_WINDOW_USEC 10000000ULL
+#define PROFILE_MAX_TRACEEVENTS 65536
+#define PROFILE_DEFAULT_TRACEFRAMES 200
+
+typedef struct{
+    unsigned int calls;
+    unsigned long long total;
+    unsigned int max;
+    unsigned int buckets[PROFILE_BUCKETS];
+}profileHistogram_t;
+
+typedef struct{
+    unsigned long long start; //0 while the scope is not entered
+    profileHistogram_t current;
+    profileHistogram_t last;
+    profileHistogram_t retired; //All windows before current, never reset for the metrics
+}profileScopeData_t;
+
+typedef struct{
+    int scope;
+    unsigned long long start;
+    unsigned int duration;
+}profileTraceEvent_t;
+
+static const char* profileScopeNames[MAX_PROFILE_SCOPES] = {
+    "frame",
+    "sleep",
+    "serverframe",
+    "gameframe",
+    "sendclientmessages",
+    "pluginframe",
+    "eventloop",
+    "network",
+    "commands",
+    "gamelog"
+};
+
+static struct{
+    profileScopeData_t scopes[MAX_PROFILE_SCOPES];
+    unsigned long long windowStart;
+    profileTraceEvent_t *trace;
+    int traceCount;
+    int traceFrames; //Frames left to record
+    char traceFile[MAX_QPATH];
+}profiler;
+
+qboolean com_profiling;
+static cvar_t* com_profile;
+static cvar_t* com_profileStream;
+
+
+static int Com_ProfileBucket(unsigned int usec){
+
+    int msb;
+
+    if(usec < 8)
+        return usec;
+
+    msb = 31 - __builtin_clz(usec);
+    return msb * 4 + ((usec >> (msb - 2)) & 3);
+}
+
+//Largest value which falls into this bucket
+static unsigned int Com_ProfileBucketLimit(int bucket){
+
+    int msb;
+    unsigned long long limit;
+
+    if(bucket < 8)
+        return bucket;
+
+    msb = bucket / 4;
+    limit = ((unsigned long long)(4 + (bucket & 3) + 1) << (msb - 2)) - 1;
+
+    if(limit > 0xffffffff)
+        return 0xffffffff;
+
+    return limit;
+}
+
+void Com_ProfileBegin(profileScope_t scope){
+
+    profiler.scopes[scope].start = Sys_MicrosecondsLong();
+}
+
+void Com_ProfileEnd(profileScope_t scope){
+
+    profileScopeData_t *s = &profiler.scopes[scope];
+    profileHistogram_t *h = &s->current;
+    profileTraceEvent_t *ev;
+    unsigned int usec;
+
+    if(!s->start)
+        return; //Profiling got enabled inside this scope
+
+    usec = Sys_MicrosecondsLong() - s->start;
+
+    h->calls++;
+    h->total += usec;
+    h->buckets[Com_ProfileBucket(usec)]++;
+    if(usec > h->max)
+        h->max = usec;
+
+    if(profiler.trace && profiler.traceCount < PROFILE_MAX_TRACEEVENTS){
+        ev = &profiler.trace[profiler.traceCount++];
+        ev->scope = scope;
+        ev->start = s->start;
+        ev->duration = usec;
+    }
+
+    s->start = 0;
+}
+
+static void Com_ProfileAdd(profileHistogram_t *out, const profileHistogram_t *h){
+
+    int i;
+
+    out->calls += h->calls;
+    out->total += h->total;
+    if(h->max > out->max)
+        out->max = h->max;
+
+    for(i = 0; i < PROFILE_BUCKETS; i++)
+        out->buckets[i] += h->buckets[i];
+}
+
+static void Com_ProfileMerge(profileScopeData_t *s, profileHistogram_t *out){
+
+    *out = s->last;
+    Com_ProfileAdd(out, &s->current);
+}
+
+static unsigned int Com_ProfilePercentile(profileHistogram_t *h, int percent){
+
+    unsigned int target, count;
+    unsigned int limit;
+    int i;
+
+    if(!h->calls)
+        return 0;
+
+    target = ((unsigned long long)h->calls * percent + 99) / 100;
+    count = 0;
+
+    for(i = 0; i < PROFILE_BUCKETS; i++){
+        count += h->buckets[i];
+        if(count >= target)
+            break;
+    }
+
+    limit = Com_ProfileBucketLimit(i);
+    if(limit > h->max)
+        return h->max;
+    return limit;
+}
+
+static void Com_ProfileReset(void){
+
+    int i;
+
+    for(i = 0; i < MAX_PROFILE_SCOPES; i++){
+        Com_ProfileAdd(&profiler.scopes[i].retired, &profiler.scopes[i].current);
+        Com_Memset(&profiler.scopes[i].current, 0, sizeof(profileHistogram_t));
+        Com_Memset(&profiler.scopes[i].last, 0, sizeof(profileHistogram_t));
+    }
+    profiler.windowStart = Sys_MicrosecondsLong();
+}
+
+static void Com_ProfileWriteTrace(void){
+
+    fileHandle_t f;
+    profileTraceEvent_t *ev;
+    unsigned long long base;
+    int i;
+
+    f = FS_SV_FOpenFileWrite(profiler.traceFile);
+
+    if(!f){
+        Com_PrintError("profile: Can not open %s for writing\n", profiler.traceFile);
+    }else{
+        base = profiler.traceCount > 0 ? profiler.trace[0].start : 0;
+        for(i = 0; i < profiler.traceCount; i++){
+            if(profiler.trace[i].start < base)
+                base = profiler.trace[i].start;
+        }
+
+        FS_Printf(f, "{\"traceEvents\":[\n");
+        for(i = 0, ev = profiler.trace; i < profiler.traceCount; i++, ev++){
+            FS_Printf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%llu,\"dur\":%u}%s\n",
+                profileScopeNames[ev->scope], ev->start - base, ev->duration, i + 1 < profiler.traceCount ? "," : "");
+        }
+        FS_Printf(f, "]}\n");
+        FS_FCloseFile(f);
+        Com_Printf("profile: Wrote %d events to %s\n", profiler.traceCount, profiler.traceFile);
+    }
+
+    free(profiler.trace);
+    profiler.trace = NULL;
+    profiler.traceCount = 0;
+}
+
+static void Com_ProfileWriteCSV(const char* filename){
+
+    fileHandle_t f;
+    profileHistogram_t h;
+    int i;
+
+    f = FS_SV_FOpenFileWrite(filename);
+    if(!f){
+        Com_PrintError("profile: Can not open %s for writing\n", filename);
+        return;
+    }
+
+    FS_Printf(f, "scope,calls,avg_usec,p50_usec,p99_usec,max_usec\n");
+
+    for(i = 0; i < MAX_PROFILE_SCOPES; i++){
+        Com_ProfileMerge(&profiler.scopes[i], &h);
+        FS_Printf(f, "%s,%u,%llu,%u,%u,%u\n", profileScopeNames[i], h.calls, h.calls ? h.total / h.calls : 0,
+            Com_ProfilePercentile(&h, 50), Com_ProfilePercentile(&h, 99), h.max);
+    }
+    FS_FCloseFile(f);
+    Com_Printf("profile: Wrote %s\n", filename);
+}
+
+//One line per window to the HL2 rcon consoles which stream the log
+static void Com_ProfileStreamSummary(void){
+
+    char line[1024];
+    int len, i;
+    profileHistogram_t *h;
+
+    len = Com_sprintf(line, sizeof(line), "profile:");
+
+    for(i = 0; i < MAX_PROFILE_SCOPES && len < sizeof(line); i++){
+        h = &profiler.scopes[i].last;
+        if(!h->calls)
+            continue;
+        len += Com_sprintf(line + len, sizeof(line) - len, " %s %u/%u/%u", profileScopeNames[i],
+            Com_ProfilePercentile(h, 50), Com_ProfilePercentile(h, 99), h->max);
+    }
+
+    if(len > sizeof(line) - 2)
+        len = sizeof(line) - 2;
+
+    line[len++] = '\n';
+    line[len] = '\0';
+
+    HL2Rcon_SourceRconSendConsole(line, len);
+}
+
+/*
+Cumulative histograms of all scopes since the start. Only every fourth bucket becomes a
+Prometheus bucket, these end on a power of two microseconds.
+Nothing gets sampled while com_profile is off
+*/
+void Com_ProfileWriteMetrics(metricsBuf_t* buf){
+
+    profileHistogram_t h;
+    unsigned int count;
+    int i, b;
+
+    Metrics_Declare(buf, "cod4x_profile_scope_seconds", "histogram", "Time spent in the profiled scopes while com_profile is enabled");
+
+    for(i = 0; i < MAX_PROFILE_SCOPES; i++){
+
+        h = profiler.scopes[i].retired;
+        Com_ProfileAdd(&h, &profiler.scopes[i].current);
+
+        for(b = 0, count = 0; b < PROFILE_BUCKETS; b++){
+            count += h.buckets[b];
+            //Buckets 11, 15, ... 95 end at 8 usec up to about 16 seconds
+            if(b >= 11 && b <= 95 && (b & 3) == 3)
+                Metrics_Printf(buf, "cod4x_profile_scope_seconds_bucket{scope=\"%s\",le=\"%g\"} %u\n",
+                    profileScopeNames[i], (Com_ProfileBucketLimit(b) + 1) / 1000000.0, count);
+        }
+        Metrics_Printf(buf, "cod4x_profile_scope_seconds_bucket{scope=\"%s\",le=\"+Inf\"} %u\n", profileScopeNames[i], h.calls);
+        Metrics_Printf(buf, "cod4x_profile_scope_seconds_sum{scope=\"%s\"} %.6f\n", profileScopeNames[i], h.total / 1000000.0);
+        Metrics_Printf(buf, "cod4x_profile_scope_seconds_count{scope=\"%s\"} %u\n", profileScopeNames[i], h.calls);
+    }
+}
+
+void Com_ProfileFrame(void){
+
+    static qboolean wasProfiling;
+    unsigned long long now;
+    int i;
+
+    if(profiler.traceFrames > 0){
+        profiler.traceFrames--;
+        if(profiler.traceFrames == 0)
+            Com_ProfileWriteTrace();
+    }
+
+    com_profiling = com_profile->boolean || profiler.traceFrames > 0;
+
+    if(!com_profiling){
+        if(wasProfiling){
+            //Don't take samples against stale start times once enabled again
+            for(i = 0; i < MAX_PROFILE_SCOPES; i++)
+                profiler.scopes[i].start = 0;
+        }
+        wasProfiling = qfalse;
+        return;
+    }
+
+    now = Sys_MicrosecondsLong();
+
+    if(!wasProfiling){
+        wasProfiling = qtrue;
+        profiler.windowStart = now;
+    }
+
+    if(now - profiler.windowStart < PROFILE_WINDOW_USEC)
+        return;
+
+    for(i = 0; i < MAX_PROFILE_SCOPES; i++){
+        Com_ProfileAdd(&profiler.scopes[i].retired, &profiler.scopes[i].current);
+        profiler.scopes[i].last = profiler.scopes[i].current;
+        Com_Memset(&profiler.scopes[i].current, 0, sizeof(profileHistogram_t));
+    }
+    profiler.windowStart = now;
+
+    if(com_profileStream->boolean)
+        Com_ProfileStreamSummary();
+}
+
+static void Com_Profile_f(void){
+
+    profileHistogram_t h;
+    const char* cmd;
+    int i, frames;
+
+    cmd = Cmd_Argc() > 1 ? Cmd_Argv(1) : "";
+
+    if(!Q_stricmp(cmd, "reset")){
+        Com_ProfileReset();
+        Com_Printf("profile: Statistics reset\n");
+        return;
+    }
+
+    if(!Q_stricmp(cmd, "csv")){
+        Com_ProfileWriteCSV(Cmd_Argc() > 2 ? Cmd_Argv(2) : "profile.csv");
+        return;
+    }
+
+    if(!Q_stricmp(cmd, "trace")){
+        if(profiler.trace){
+            Com_Printf("profile: A trace is already being recorded\n");
+            return;
+        }
+        frames = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : PROFILE_DEFAULT_TRACEFRAMES;
+        if(frames < 1)
+            frames = PROFILE_DEFAULT_TRACEFRAMES;
+
+        Q_strncpyz(profiler.traceFile, Cmd_Argc() > 3 ? Cmd_Argv(3) : "profile_trace.json", sizeof(profiler.traceFile));
+        profiler.trace = malloc(PROFILE_MAX_TRACEEVENTS * sizeof(profileTraceEvent_t));
+        if(!profiler.trace){
+            Com_PrintError("profile: Out of memory\n");
+            return;
+        }
+        profiler.traceCount = 0;
+        profiler.traceFrames = frames;
+        Com_Printf("profile: Recording the next %d frames into %s\n", frames, profiler.traceFile);
+        return;
+    }
+
+    if(cmd[0]){
+        Com_Printf("Usage: profile [reset | csv <file> | trace <frames> <file>]\n");
+        return;
+    }
+
+    if(!com_profile->boolean)
+        Com_Printf("Profiling is disabled. Set com_profile to 1 to collect timings\n");
+
+    Com_Printf("scope                   calls   avg usec   p50 usec   p99 usec   max usec\n");
+    Com_Printf("---------------------- -------- ---------- ---------- ---------- ----------\n");
+
+    for(i = 0; i < MAX_PROFILE_SCOPES; i++){
+        Com_ProfileMerge(&profiler.scopes[i], &h);
+        Com_Printf("%-22s %8u %10llu %10u %10u %10u\n", profileScopeNames[i], h.calls, h.calls ? h.total / h.calls : 0,
+            Com_ProfilePercentile(&h, 50), Com_ProfilePercentile(&h, 99), h.max);
+    }
+}
+
+/*
+Startup tracer
+
+Every Com_StartupPhase ends the previous phase. The clocks get read directly,
+the first phase starts before Sys_TimerInit ran.
+*/
+
+#define STARTUP_MAX_PHASES 32
+
+typedef struct{
+    const char* name;
+    unsigned long long wallStart;
+    unsigned long long wall;
+    unsigned long long cpu;
+}startupPhase_t;
+
+static struct{
+    startupPhase_t phases[STARTUP_MAX_PHASES];
+    int count;
+    unsigned long long cpuStart;
+}startup;
+
+qboolean com_startupPending = qtrue;
+
+
+static unsigned long long Com_StartupClock(clockid_t clock){
+
+    struct timespec ts;
+
+    if(clock_gettime(clock, &ts) != 0)
+        return 0;
+
+    return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void Com_StartupEndPhase(void){
+
+    startupPhase_t *phase;
+
+    if(startup.count == 0)
+        return;
+
+    phase = &startup.phases[startup.count -1];
+    if(phase->wall != 0)
+        return;
+
+    phase->wall = Com_StartupClock(CLOCK_MONOTONIC) - phase->wallStart;
+    phase->cpu = Com_StartupClock(CLOCK_PROCESS_CPUTIME_ID) - startup.cpuStart;
+    if(phase->wall == 0)
+        phase->wall = 1;
+}
+
+void Com_StartupPhase(const char* name){
+
+    startupPhase_t *phase;
+
+    if(!com_startupPending)
+        return;
+
+    Com_StartupEndPhase();
+
+    if(startup.count >= STARTUP_MAX_PHASES)
+        return;
+
+    phase = &startup.phases[startup.count++];
+    phase->name = name;
+    phase->wall = 0;
+    phase->cpu = 0;
+    startup.cpuStart = Com_StartupClock(CLOCK_PROCESS_CPUTIME_ID);
+    phase->wallStart = Com_StartupClock(CLOCK_MONOTONIC);
+}
+
+static void Com_StartupWriteTrace(const char* filename){
+
+    fileHandle_t f;
+    startupPhase_t *phase;
+    int i;
+
+    f = FS_SV_FOpenFileWrite(filename);
+    if(!f){
+        Com_PrintError("Startup: Can not open %s for writing\n", filename);
+        return;
+    }
+
+    FS_Printf(f, "{\"traceEvents\":[\n");
+    for(i = 0, phase = startup.phases; i < startup.count; i++, phase++){
+        FS_Printf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%llu,\"dur\":%llu,\"args\":{\"cpu_usec\":%llu}}%s\n",
+            phase->name, phase->wallStart - startup.phases[0].wallStart, phase->wall, phase->cpu, i + 1 < startup.count ? "," : "");
+    }
+    FS_Printf(f, "]}\n");
+    FS_FCloseFile(f);
+    Com_Printf("Startup: Wrote %d phases to %s\n", startup.count, filename);
+}
+
+//Called once the first frame is over, the maps of the command line are loaded then
+void Com_StartupDone(void){
+
+    cvar_t* com_startupTrace;
+    startupPhase_t *phase;
+    unsigned long long wall, cpu;
+    int i;
+
+    if(!com_startupPending)
+        return;
+
+    Com_StartupEndPhase();
+    com_startupPending = qfalse;
+
+    for(i = 0, wall = 0, cpu = 0; i < startup.count; i++){
+        wall += startup.phases[i].wall;
+        cpu += startup.phases[i].cpu;
+    }
+
+    Com_Printf("Startup phases:\n");
+    Com_Printf("%-22s %10s %10s %6s\n", "phase", "wall_ms", "cpu_ms", "wall%");
+    for(i = 0, phase = startup.phases; i < startup.count; i++, phase++){
+        Com_Printf("%-22s %10.1f %10.1f %5.1f%%\n", phase->name, phase->wall / 1000.0, phase->cpu / 1000.0,
+            wall ? phase->wall * 100.0 / wall : 0.0);
+    }
+    Com_Printf("%-22s %10.1f %10.1f\n", "total", wall / 1000.0, cpu / 1000.0);
+
+    com_startupTrace = Cvar_RegisterString("com_startupTrace", "", CVAR_INIT, "File in fs_homepath to write the startup phases to in the chrome://tracing format. Empty disables it");
+    if(*com_startupTrace->string)
+        Com_StartupWriteTrace(com_startupTrace->string);
+}
+
+void Com_InitProfiler(void){
+
+    com_profile = Cvar_RegisterBool("com_profile", qfalse, 0, "Collect frame timings of the server subsystems. See the command profile");
+    com_profileStream = Cvar_RegisterBool("com_profileStream", qfalse, 0, "Send a profile summary every 10 seconds to HL2 rcon consoles which stream the log");
+
+    Cmd_AddCommand("profile", Com_Profile_f);
+}
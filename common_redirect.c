@@ -0,0 +1,277 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon_mem.h"
+#include "qcommon_redirect.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+
+#include <string.h>
+
+#define MAX_REDIRECTSINKS 12
+#define RD_QUEUESIZE 0x10000
+#define RD_CRITSECTION 5	//The one Com_PrintMessage holds while it redirects
+
+typedef struct{
+	int	len;		//Without the terminating zero
+	short	client;
+	short	mode;
+}rdRecord_t;
+
+typedef struct{
+	byte	*data;
+	int	len;
+}rdQueue_t;
+
+typedef struct{
+	const char	*name;
+	rdChannel_t	channel;
+	void		*callback;
+	qboolean	queued;
+	qboolean	delivering;
+
+	rdQueue_t	queues[2];	//Filled and being delivered
+	int		fill;
+
+	unsigned int	delivered;
+	unsigned int	dropped;
+	unsigned long long droppedBytes;
+	int		peakBytes;
+	unsigned int	maxDeliverUsec;
+}rdSink_t;
+
+static rdSink_t rd_sinks[MAX_REDIRECTSINKS];
+static int rd_numSinks;
+
+static const char* rd_channelNames[RD_NUM_CHANNELS] = { "console", "gamelog", "chat" };
+
+
+static void Com_AddRedirectSink( rdChannel_t channel, const char* name, void* callback, qboolean queued ) {
+
+	rdSink_t *sink;
+	int i;
+
+	for(i = 0; i < rd_numSinks; i++)
+	{
+		if(rd_sinks[i].callback == callback && rd_sinks[i].channel == channel)
+		{
+			Com_Error(ERR_FATAL, "Com_AddRedirectSink: Attempt to add the redirect %s twice.", name);
+			return;
+		}
+	}
+	if(rd_numSinks >= MAX_REDIRECTSINKS)
+	{
+		Com_Error(ERR_FATAL, "Com_AddRedirectSink: Out of redirect handles. Increase MAX_REDIRECTSINKS to add more redirect destinations");
+		return;
+	}
+
+	sink = &rd_sinks[rd_numSinks];
+	Com_Memset(sink, 0, sizeof(rdSink_t));
+	sink->name = name;
+	sink->channel = channel;
+	sink->callback = callback;
+	sink->queued = queued;
+
+	if(queued)
+	{
+		sink->queues[0].data = Z_Malloc(RD_QUEUESIZE);
+		sink->queues[1].data = Z_Malloc(RD_QUEUESIZE);
+	}
+
+	//Published messages do not take the lock on the main thread for the sink count
+	Sys_EnterCriticalSection(RD_CRITSECTION);
+	rd_numSinks++;
+	Sys_LeaveCriticalSection(RD_CRITSECTION);
+}
+
+void Com_AddRedirect( const char* name, rdMessageSink_t sink, qboolean queued ) {
+	Com_AddRedirectSink(RD_CHANNEL_CONSOLE, name, sink, queued);
+}
+
+void G_PrintAddRedirect( const char* name, rdMessageSink_t sink, qboolean queued ) {
+	Com_AddRedirectSink(RD_CHANNEL_GAMELOG, name, sink, queued);
+}
+
+void G_AddChatRedirect( const char* name, rdChatSink_t sink, qboolean queued ) {
+	Com_AddRedirectSink(RD_CHANNEL_CHAT, name, sink, queued);
+}
+
+static void Com_RedirectDeliver( rdSink_t* sink, const char* msg, int len, int client, int mode ) {
+
+	if(sink->channel == RD_CHANNEL_CHAT)
+		((rdChatSink_t)sink->callback)(msg, client, mode);
+	else
+		((rdMessageSink_t)sink->callback)(msg, len);
+
+	sink->delivered++;
+}
+
+static void Com_RedirectEnqueue( rdSink_t* sink, const char* msg, int len, int client, int mode ) {
+
+	rdQueue_t *queue;
+	rdRecord_t rec;
+	int size;
+
+	size = sizeof(rdRecord_t) + len +1;
+
+	Sys_EnterCriticalSection(RD_CRITSECTION);
+
+	queue = &sink->queues[sink->fill];
+
+	if(queue->len + size > RD_QUEUESIZE)
+	{
+		sink->dropped++;
+		sink->droppedBytes += len;
+		Sys_LeaveCriticalSection(RD_CRITSECTION);
+		return;
+	}
+
+	rec.len = len;
+	rec.client = client;
+	rec.mode = mode;
+	Com_Memcpy(queue->data + queue->len, &rec, sizeof(rec));
+	Com_Memcpy(queue->data + queue->len + sizeof(rec), msg, len);
+	queue->data[queue->len + sizeof(rec) + len] = 0;
+	queue->len += size;
+
+	if(queue->len > sink->peakBytes)
+		sink->peakBytes = queue->len;
+
+	Sys_LeaveCriticalSection(RD_CRITSECTION);
+}
+
+/*
+==================
+Com_RedirectPublish
+
+The console channel comes in with RD_CRITSECTION held, from any thread
+==================
+*/
+void Com_RedirectPublish( rdChannel_t channel, const char* msg, int len, int client, int mode ) {
+
+	rdSink_t *sink;
+	int i;
+
+	for(i = 0, sink = rd_sinks; i < rd_numSinks; i++, sink++)
+	{
+		if(sink->channel != channel)
+			continue;
+
+		if(!sink->queued)
+		{
+			Com_RedirectDeliver(sink, msg, len, client, mode);
+			continue;
+		}
+		//What a sink prints while it delivers would come back to it next frame, and again
+		if(sink->delivering && Sys_IsMainThread())
+			continue;
+
+		Com_RedirectEnqueue(sink, msg, len, client, mode);
+	}
+}
+
+/*
+==================
+Com_RedirectFlush
+
+Called once per frame. Swaps the queues under the lock so printing
+threads only wait for the swap, not for the delivery
+==================
+*/
+void Com_RedirectFlush( void ) {
+
+	rdSink_t *sink;
+	rdQueue_t *queue;
+	rdRecord_t rec;
+	unsigned long long start;
+	unsigned int usec;
+	int i, pos;
+
+	for(i = 0, sink = rd_sinks; i < rd_numSinks; i++, sink++)
+	{
+		if(!sink->queued)
+			continue;
+
+		Sys_EnterCriticalSection(RD_CRITSECTION);
+		queue = &sink->queues[sink->fill];
+		if(queue->len == 0)
+		{
+			Sys_LeaveCriticalSection(RD_CRITSECTION);
+			continue;
+		}
+		sink->fill ^= 1;
+		Sys_LeaveCriticalSection(RD_CRITSECTION);
+
+		start = Sys_MicrosecondsLong();
+		sink->delivering = qtrue;
+
+		for(pos = 0; pos < queue->len; pos += sizeof(rdRecord_t) + rec.len +1)
+		{
+			Com_Memcpy(&rec, queue->data + pos, sizeof(rec));
+			Com_RedirectDeliver(sink, (const char*)queue->data + pos + sizeof(rec), rec.len, rec.client, rec.mode);
+		}
+		queue->len = 0;
+
+		sink->delivering = qfalse;
+		usec = Sys_MicrosecondsLong() - start;
+		if(usec > sink->maxDeliverUsec)
+			sink->maxDeliverUsec = usec;
+	}
+}
+
+void Com_RedirectStatus_f( void ) {
+
+	rdSink_t *sink;
+	int i;
+
+	Com_Printf("Sink                 Channel  Mode   Delivered    Dropped  Drop KB  Peak KB  Max ms\n");
+	Com_Printf("-------------------- -------- ------ ---------- ---------- -------- -------- -------\n");
+	for(i = 0, sink = rd_sinks; i < rd_numSinks; i++, sink++)
+	{
+		Com_Printf("%-20.20s %-8s %-6s %10u %10u %8llu %8d %7.2f\n", sink->name, rd_channelNames[sink->channel],
+			sink->queued ? "queued" : "sync", sink->delivered, sink->dropped, sink->droppedBytes / 1024,
+			sink->peakBytes / 1024, sink->maxDeliverUsec / 1000.0);
+	}
+}
+
+void Com_RedirectWriteMetrics( metricsBuf_t* buf ) {
+
+	rdSink_t *sink;
+	int i;
+
+	Metrics_Declare(buf, "cod4x_redirect_delivered_total", "counter", "Messages handed to the redirect sinks");
+	for(i = 0, sink = rd_sinks; i < rd_numSinks; i++, sink++)
+		Metrics_Printf(buf, "cod4x_redirect_delivered_total{sink=\"%s\",channel=\"%s\"} %u\n", sink->name, rd_channelNames[sink->channel], sink->delivered);
+
+	Metrics_Declare(buf, "cod4x_redirect_dropped_total", "counter", "Messages dropped because the queue of the sink was full");
+	for(i = 0, sink = rd_sinks; i < rd_numSinks; i++, sink++)
+		if(sink->queued)
+			Metrics_Printf(buf, "cod4x_redirect_dropped_total{sink=\"%s\",channel=\"%s\"} %u\n", sink->name, rd_channelNames[sink->channel], sink->dropped);
+
+	Metrics_Declare(buf, "cod4x_redirect_queue_peak_bytes", "gauge", "Most bytes waiting in the queue of the sink");
+	for(i = 0, sink = rd_sinks; i < rd_numSinks; i++, sink++)
+		if(sink->queued)
+			Metrics_Printf(buf, "cod4x_redirect_queue_peak_bytes{sink=\"%s\",channel=\"%s\"} %d\n", sink->name, rd_channelNames[sink->channel], sink->peakBytes);
+}
@@ -24,6 +24,9 @@
 #include "cvar.h"
 #include "cmd.h"
 #include "cmd_completion.h"
+#include "qcommon_io.h"
+
+#include <string.h>
 // nothing outside the Cvar_*() functions should modify these fields!
 
 #ifndef __CMD_COMPLETION_H__
@@ -74,6 +77,160 @@ void Cvar_Init (void)
 }
 
 
+/*
+============
+Cvar name index
+
+The cvars and their list belong to the binary, Cvar_FindMalleableVar walks all of them.
+We remember every cvar we have looked up once, the binary never frees a cvar. A hit gets
+checked against the name so a stale slot can only cost a lookup. Names which were not found
+do not get remembered, the cvar might get registered later.
+============
+*/
+#define CVAR_HASH_SIZE 2048	// power of 2, at most half of it gets used
+
+typedef struct{
+	unsigned int	hash;
+	cvar_t		*var;
+}cvarHashEntry_t;
+
+static cvarHashEntry_t cvar_hashTable[CVAR_HASH_SIZE];
+static int cvar_hashCount;
+
+
+static unsigned int Cvar_HashName( const char *name ) {
+
+	unsigned int hash = 2166136261u;
+	int c;
+
+	while((c = *name++)){
+		if(c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+============
+Cvar_FindVar
+
+Same as Cvar_FindMalleableVar without the walk for cvars which got looked up before
+============
+*/
+cvar_t *Cvar_FindVar( const char *var_name ) {
+
+	cvarHashEntry_t *entry;
+	cvar_t *var;
+	unsigned int hash, i;
+
+	hash = Cvar_HashName(var_name);
+
+	for(i = hash; (entry = &cvar_hashTable[i & (CVAR_HASH_SIZE -1)])->var; i++){
+		if(entry->hash == hash && !Q_stricmp(entry->var->name, var_name))
+			return entry->var;
+	}
+
+	var = Cvar_FindMalleableVar(var_name);
+	if(var && cvar_hashCount < CVAR_HASH_SIZE / 2){
+		entry->hash = hash;
+		entry->var = var;
+		cvar_hashCount++;
+	}
+	return var;
+}
+
+
+/*
+============
+Cvar change callbacks
+
+Cvars get set inside of the binary without telling us. Cvar_RunChangeCallbacks compares the
+subscribed cvars against their last value once per frame and calls back for those which have
+changed, so a subsystem does not have to poll its cvars or their modified flag, which belongs
+to whoever clears it first. Strings get compared by a hash of their content.
+============
+*/
+#define MAX_CVAR_CHANGECALLBACKS 64
+
+typedef struct{
+	cvar_t			*var;
+	cvarChangeCallback_t	callback;
+	void			*arg;
+	unsigned int		stringhash;
+	byte			value[sizeof(vec4_t)];
+}cvarChangeCallbackEntry_t;
+
+static cvarChangeCallbackEntry_t cvar_changeCallbacks[MAX_CVAR_CHANGECALLBACKS];
+static int cvar_numChangeCallbacks;
+
+
+static void Cvar_SnapshotValue( cvar_t *var, unsigned int *stringhash, byte *value ) {
+
+	if(var->type == CVAR_STRING){
+		*stringhash = Cvar_HashName(var->string) ^ strlen(var->string);
+		Com_Memset(value, 0, sizeof(vec4_t));
+	}else{
+		*stringhash = 0;
+		Com_Memcpy(value, var->vec4, sizeof(vec4_t));
+	}
+}
+
+qboolean Cvar_AddChangeCallback( cvar_t *var, cvarChangeCallback_t callback, void *arg ) {
+
+	cvarChangeCallbackEntry_t *entry;
+
+	if(var == NULL)
+		return qfalse;
+
+	if(cvar_numChangeCallbacks >= MAX_CVAR_CHANGECALLBACKS){
+		Com_PrintWarning("Cvar_AddChangeCallback: Too many callbacks, can not watch %s\n", var->name);
+		return qfalse;
+	}
+
+	entry = &cvar_changeCallbacks[cvar_numChangeCallbacks++];
+	entry->var = var;
+	entry->callback = callback;
+	entry->arg = arg;
+	Cvar_SnapshotValue(var, &entry->stringhash, entry->value);
+	return qtrue;
+}
+
+void Cvar_RemoveChangeCallback( cvar_t *var, cvarChangeCallback_t callback, void *arg ) {
+
+	int i;
+
+	for(i = 0; i < cvar_numChangeCallbacks; i++){
+		if(cvar_changeCallbacks[i].var == var && cvar_changeCallbacks[i].callback == callback && cvar_changeCallbacks[i].arg == arg){
+			cvar_numChangeCallbacks--;
+			cvar_changeCallbacks[i] = cvar_changeCallbacks[cvar_numChangeCallbacks];
+			return;
+		}
+	}
+}
+
+void Cvar_RunChangeCallbacks( void ) {
+
+	cvarChangeCallbackEntry_t *entry;
+	unsigned int stringhash;
+	byte value[sizeof(vec4_t)];
+	int i;
+
+	for(i = 0; i < cvar_numChangeCallbacks; i++){
+
+		entry = &cvar_changeCallbacks[i];
+		Cvar_SnapshotValue(entry->var, &stringhash, value);
+
+		if(stringhash == entry->stringhash && !memcmp(value, entry->value, sizeof(value)))
+			continue;
+
+		entry->stringhash = stringhash;
+		Com_Memcpy(entry->value, value, sizeof(value));
+		entry->callback(entry->var, entry->arg);
+	}
+}
+
+
 /*
 ============
 Cvar_VariableValue
@@ -82,7 +239,7 @@ Cvar_VariableValue
 float Cvar_VariableValue( const char *var_name ) {
 	cvar_t	*var;
 	
-	var = Cvar_FindMalleableVar (var_name);
+	var = Cvar_FindVar (var_name);
 	if (!var || var->type != CVAR_FLOAT)
 		return 0;
 	return var->value;
@@ -97,7 +254,7 @@ Cvar_VariableIntegerValue
 int Cvar_VariableIntegerValue( const char *var_name ) {
 	cvar_t	*var;
 	
-	var = Cvar_FindMalleableVar (var_name);
+	var = Cvar_FindVar (var_name);
 
 	if (!var || var->type != CVAR_INT)
 		return 0;
@@ -113,7 +270,7 @@ Cvar_VariableString
 const char* Cvar_VariableString( const char *var_name ) {
 	cvar_t *var;
 	
-	var = Cvar_FindMalleableVar (var_name);
+	var = Cvar_FindVar (var_name);
 	if (!var || var->type != CVAR_STRING)
 		return "";
 	return var->string;
@@ -113,6 +113,13 @@ char* __cdecl Cvar_DisplayableValue(cvar_t const*);
 char* __cdecl Cvar_GetVariantString(const char* name);
 cvar_t* __regparm1 Cvar_FindMalleableVar(const char* name);
 void Cvar_Init(void);
+cvar_t *Cvar_FindVar( const char *var_name );
+
+typedef void (*cvarChangeCallback_t)( cvar_t *var, void *arg );
+
+qboolean Cvar_AddChangeCallback( cvar_t *var, cvarChangeCallback_t callback, void *arg );
+void Cvar_RemoveChangeCallback( cvar_t *var, cvarChangeCallback_t callback, void *arg );
+void Cvar_RunChangeCallbacks( void );
 
 
 //defines Cvarflags
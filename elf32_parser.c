@@ -24,115 +24,120 @@
 #include <string.h>
 #include <elf.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "qcommon_io.h" // Com_Printf
 #include "g_shared.h"   // qboolean
 #include "elf32_parser.h"
 
+/*
+The file gets mapped read only, only the pages of the headers and of the two
+sections we look at are read from the disk
+*/
 int ELF32_GetStrTable(char *fname, char **output,elf_data_t *text)
 {
     Elf32_Ehdr *hdr;
     Elf32_Shdr *shdr;
     char *strtable;
     char *strings;
-    void *buff;
+    char *buff;
+    struct stat st;
     qboolean textfound = qfalse;
     qboolean dynstrfound = qfalse;
     int j,nstrings = 0;
+    int fd, strtableindex;
     long len;
-    
-    FILE *fp = fopen(fname,"rb");
-    
-    if(!fp){
+
+    fd = open(fname, O_RDONLY);
+    if(fd < 0){
         return qfalse;
     }
-    
-    fseek(fp,0,SEEK_END);
-    len = ftell(fp);
-    rewind(fp);
-    
-    if(len<=0)
-        return qfalse;
-    buff = malloc(len);
-    
-    if(buff == NULL)
-        return qfalse;
-        
-    if(fread(buff,len,1,fp)!=1){
-        if(buff)
-            free(buff);
+
+    if(fstat(fd, &st) != 0 || st.st_size < sizeof(Elf32_Ehdr)){
+        close(fd);
         return qfalse;
     }
-    hdr = buff;
+    len = st.st_size;
+
+    buff = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(buff == MAP_FAILED)
+        return qfalse;
+
+    hdr = (Elf32_Ehdr *)buff;
     if(hdr->e_ident[0] != ELFMAG0 || hdr->e_ident[1] != ELFMAG1 || hdr->e_ident[2] != ELFMAG2 || hdr->e_ident[3] != ELFMAG3){
-        if(buff)
-            free(buff);
+        munmap(buff, len);
         return qfalse;
     }
     if(hdr->e_type != ET_DYN){
-        if(buff)
-            free(buff);
+        munmap(buff, len);
         return qfalse;
     }
-    if((shdr = (Elf32_Shdr *)(buff + hdr->e_shoff))>=(Elf32_Shdr *)(buff + len-sizeof(Elf32_Shdr))){
-        if(buff)
-            free(buff);
+    if(hdr->e_shoff == 0 || hdr->e_shoff >= len || hdr->e_shnum > (len - hdr->e_shoff) / sizeof(Elf32_Shdr)){
+        munmap(buff, len);
         return qfalse;
     }
+    shdr = (Elf32_Shdr *)(buff + hdr->e_shoff);
+
     if(hdr->e_shstrndx!=SHN_UNDEF){
-        if(hdr->e_shstrndx!=SHN_XINDEX){     // Typical case, standard elf addressing
-            if(hdr->e_shstrndx<=hdr->e_shnum)
-                strtable = buff + shdr[hdr->e_shstrndx].sh_offset;
-            else{
-                Com_Printf("Error: the string table index is too big! String table index: %d, section headers: %d.\n",hdr->e_shstrndx,hdr->e_shnum);
-            if(buff)
-                free(buff);
+        if(hdr->e_shstrndx!=SHN_XINDEX)      // Typical case, standard elf addressing
+            strtableindex = hdr->e_shstrndx;
+        else                                // So called 'elf extended addressing'. Because 'simple' is too mainstream.
+            strtableindex = shdr[0].sh_link;
+
+        if(strtableindex >= hdr->e_shnum){
+            Com_Printf("Error: the string table index is too big! String table index: %d, section headers: %d.\n",strtableindex,hdr->e_shnum);
+            munmap(buff, len);
             return qfalse;
-            }
-        }else{        // So called 'elf extended addressing'. Because 'simple' is too mainstream.
-            if(shdr[0].sh_link<=hdr->e_shnum)
-                strtable = buff + shdr[shdr[0].sh_link].sh_offset;
-            else{
-                Com_Printf("Error: the string table index is too big! String table index: %d, section headers: %d.\n",shdr[0].sh_link,hdr->e_shnum);
-            if(buff)
-                free(buff);
+        }
+        if(shdr[strtableindex].sh_offset >= len || shdr[strtableindex].sh_size > len - shdr[strtableindex].sh_offset){
+            munmap(buff, len);
             return qfalse;
-            }
         }
+        strtable = buff + shdr[strtableindex].sh_offset;
     }
     else{
         Com_Printf("Could not find the string table.\n");
-        if(buff)
-            free(buff);
+        munmap(buff, len);
         return qfalse;
     }
-    //Com_Printf("Debug2\n");
+
     for(j=0;j<hdr->e_shnum;++j){
+        if(shdr[j].sh_name >= shdr[strtableindex].sh_size || !memchr(&strtable[shdr[j].sh_name], 0, shdr[strtableindex].sh_size - shdr[j].sh_name))
+            continue;
+
         if(strcmp(&strtable[shdr[j].sh_name],".text")==0){
             textfound = qtrue;
             text->size = shdr[j].sh_size;
             text->offset = shdr[j].sh_addr;
-            //Com_Printf("Debug: .text section found! Size: %d, address: %d.\n",shdr[j].sh_size,shdr[j].sh_addr);
             if(dynstrfound)
                 break;
         }
-        else if(strcmp(&strtable[shdr[j].sh_name],".dynstr")==0){
+        else if(strcmp(&strtable[shdr[j].sh_name],".dynstr")==0 && !dynstrfound){
+            if(shdr[j].sh_size == 0 || shdr[j].sh_offset >= len || shdr[j].sh_size > len - shdr[j].sh_offset)
+                continue;
+            strings = malloc(shdr[j].sh_size +1);
+            if(strings == NULL)
+                break;
             dynstrfound = qtrue;
             nstrings = shdr[j].sh_size;
-            strings = (char *)malloc(sizeof(char)*nstrings);
-            strings = malloc(shdr[j].sh_size);
             memcpy(strings,shdr[j].sh_offset + buff,shdr[j].sh_size);
+            strings[nstrings] = 0;  // The scan of the caller must not run off the end
             *output = strings;
             if(textfound)
                 break;
         }
     }
+    munmap(buff, len);
+
     if(textfound && dynstrfound){
-        if(buff)
-            free(buff);
         return nstrings;
     }else{
-        if(buff)
-            free(buff);
+        if(dynstrfound)
+            free(*output);
         return qfalse;
     }
 }
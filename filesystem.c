@@ -200,9 +200,11 @@ or configs will never get loaded from disk!
 #include "qcommon_io.h"
 #include "cvar.h"
 #include "q_platform.h"
+#include "sys_main.h"
 
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <unistd.h>
 
@@ -233,6 +235,109 @@ tFS_FOpenFileByMode FS_FOpenFileByMode = (tFS_FOpenFileByMode)(0x818ba98);
 */
 
 
+/*
+Cache of os paths which were not found on the disk. FS_SV_FOpenFileRead looks into
+fs_homepath before fs_basepath and most of the files are only in one of them, so
+without this every read from fs_basepath starts with a failed open.
+The entries expire after FS_PATHCACHE_MSEC because other code and the admin can
+create files on the disk. Files created through this file flush the cache at once.
+*/
+#define FS_PATHCACHE_SIZE 256
+#define FS_PATHCACHE_MSEC 2000
+
+typedef struct{
+	unsigned int	hash;
+	unsigned int	time;
+	int		generation;
+	char		ospath[MAX_OSPATH];
+}fsPathCacheEntry_t;
+
+static fsPathCacheEntry_t fs_pathCache[FS_PATHCACHE_SIZE];
+static int fs_pathCacheGeneration = 1;
+
+
+static unsigned int FS_HashOSPath( const char *ospath ) {
+
+	unsigned int hash = 2166136261u;
+
+	while(*ospath){
+		hash = (hash ^ (byte)*ospath) * 16777619u;
+		ospath++;
+	}
+	return hash;
+}
+
+/*
+==============
+FS_PathKnownMissing
+
+Returns qtrue if opening this path failed a short time ago
+==============
+*/
+static qboolean FS_PathKnownMissing( const char *ospath ) {
+
+	fsPathCacheEntry_t *entry;
+	unsigned int hash = FS_HashOSPath( ospath );
+
+	entry = &fs_pathCache[hash & (FS_PATHCACHE_SIZE -1)];
+
+	if(entry->generation != fs_pathCacheGeneration || entry->hash != hash)
+		return qfalse;
+
+	if(Sys_Milliseconds() - entry->time > FS_PATHCACHE_MSEC)
+		return qfalse;
+
+	return strcmp(entry->ospath, ospath) == 0;
+}
+
+static void FS_SetPathMissing( const char *ospath ) {
+
+	fsPathCacheEntry_t *entry;
+	unsigned int hash = FS_HashOSPath( ospath );
+
+	if(strlen(ospath) >= sizeof(entry->ospath))
+		return;
+
+	entry = &fs_pathCache[hash & (FS_PATHCACHE_SIZE -1)];
+	entry->hash = hash;
+	entry->time = Sys_Milliseconds();
+	entry->generation = fs_pathCacheGeneration;
+	strcpy(entry->ospath, ospath);
+}
+
+/*
+==============
+FS_InvalidatePathCache
+
+Has to be called whenever a file gets created
+==============
+*/
+void FS_InvalidatePathCache( void ) {
+	fs_pathCacheGeneration++;
+}
+
+/*
+==============
+FS_OpenExistingOSPath
+
+fopen() for reading which skips paths known to be missing
+==============
+*/
+static FILE* FS_OpenExistingOSPath( const char *ospath, const char *mode ) {
+
+	FILE *f;
+
+	if(FS_PathKnownMissing( ospath ))
+		return NULL;
+
+	f = fopen( ospath, mode );
+	if(!f && errno == ENOENT)
+		FS_SetPathMissing( ospath );
+
+	return f;
+}
+
+
 /*
 ==============
 FS_Initialized
@@ -275,6 +380,267 @@ void	FS_ForceFlush( fileHandle_t f ) {
 	setvbuf( file, NULL, _IONBF, 0 );
 }
 
+/*
+Returns a new OS file descriptor for an opened file or -1. Everything written to the handle so far
+gets flushed first. The descriptor stays valid when the handle gets closed and has to be closed by the caller
+*/
+int FS_DupFileDescriptor( fileHandle_t f ) {
+	FILE *file;
+
+	if ( f < 1 || f >= MAX_FILE_HANDLES ) {
+		return -1;
+	}
+	file = fsh[f].handleFiles.file.o;
+	if ( !file || fsh[f].zipFile ) {
+		return -1;
+	}
+	fflush( file );
+	return dup( fileno( file ) );
+}
+
+
+/*
+Read only mappings of whole files which are shared by everyone who reads the same
+file at the same time, e.g. clients downloading the same iwd.
+A view nobody uses anymore stays mapped for FS_FILEVIEW_LINGER_MSEC, the next client
+which wants the same usermap or mod iwd finds it ready. The key is the inode and its
+mtime, a replaced file never hits the old view.
+*/
+#define MAX_FILE_VIEWS 16
+#define FS_FILEVIEW_LINGER_MSEC 120000
+
+typedef struct{
+	dev_t	dev;
+	ino_t	ino;
+	time_t	mtime;
+	off_t	size;
+	byte	*data;
+	int	refcount;
+	int	releaseTime;		//When the last user let go of a lingering view
+}fileView_t;
+
+static fileView_t fs_fileViews[MAX_FILE_VIEWS];
+
+static void FS_UnmapFileView( fileView_t *view ) {
+
+	munmap(view->data, view->size);
+	Com_Memset(view, 0, sizeof(fileView_t));
+}
+
+/*
+==================
+FS_AcquireFileView
+
+Maps an opened file which is no pak file. Returns NULL if that is not possible.
+Every successful call needs a FS_ReleaseFileView
+==================
+*/
+const byte* FS_AcquireFileView( fileHandle_t f, int *size ) {
+
+	struct stat st;
+	fileView_t *view, *freeview, *oldest;
+	FILE *file;
+	void *data;
+	int i, now;
+
+	if ( f < 1 || f >= MAX_FILE_HANDLES ) {
+		return NULL;
+	}
+	file = fsh[f].handleFiles.file.o;
+	if ( !file || fsh[f].zipFile ) {
+		return NULL;
+	}
+
+	if(fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 || st.st_size > 0x7fffffff){
+		return NULL;
+	}
+
+	freeview = NULL;
+	oldest = NULL;
+	now = Sys_Milliseconds();
+
+	for(i = 0, view = fs_fileViews; i < MAX_FILE_VIEWS; i++, view++){
+
+		if(!view->data){
+			if(!freeview)
+				freeview = view;
+			continue;
+		}
+		if(view->dev == st.st_dev && view->ino == st.st_ino && view->mtime == st.st_mtime && view->size == st.st_size){
+			view->refcount++;
+			*size = view->size;
+			return view->data;
+		}
+		if(view->refcount){
+			continue;
+		}
+		if(now - view->releaseTime > FS_FILEVIEW_LINGER_MSEC){
+			FS_UnmapFileView(view);
+			if(!freeview)
+				freeview = view;
+			continue;
+		}
+		if(!oldest || oldest->releaseTime - view->releaseTime > 0)
+			oldest = view;
+	}
+
+	if(!freeview){
+		if(!oldest){
+			return NULL;
+		}
+		FS_UnmapFileView(oldest);
+		freeview = oldest;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(file), 0);
+	if(data == MAP_FAILED){
+		Com_DPrintfChannel(DPRINT_FS, 1, "FS_AcquireFileView: mmap of %s failed: %s\n", fsh[f].name, strerror(errno));
+		return NULL;
+	}
+	//Let the kernel read it ahead on its own instead of faulting in block by block
+	madvise(data, st.st_size, MADV_WILLNEED);
+
+	freeview->dev = st.st_dev;
+	freeview->ino = st.st_ino;
+	freeview->mtime = st.st_mtime;
+	freeview->size = st.st_size;
+	freeview->data = data;
+	freeview->refcount = 1;
+
+	*size = freeview->size;
+	return freeview->data;
+}
+
+
+void FS_ReleaseFileView( const byte* data ) {
+
+	fileView_t *view;
+	int i;
+
+	if(!data){
+		return;
+	}
+
+	for(i = 0, view = fs_fileViews; i < MAX_FILE_VIEWS; i++, view++){
+
+		if(view->refcount && view->data == data){
+			view->refcount--;
+			if(!view->refcount){
+				view->releaseTime = Sys_Milliseconds();
+			}
+			return;
+		}
+	}
+	Com_PrintError("FS_ReleaseFileView: Unknown view %p\n", data);
+}
+
+/*
+==================
+FS_SV_AcquireFileView
+
+Maps a file of fs_homepath or fs_basepath, the one FS_SV_FOpenFileRead would open.
+*size is -1 if the file does not exist. Returns NULL if it does not exist, is empty
+or can not be mapped, the length is in *size then
+==================
+*/
+const byte* FS_SV_AcquireFileView( const char *filename, int *size ) {
+
+	fileHandle_t f;
+	const byte *view;
+	int len;
+
+	len = FS_SV_FOpenFileRead(filename, &f);
+	if(!f){
+		*size = -1;
+		return NULL;
+	}
+
+	//The mapping stays valid after the file got closed
+	view = FS_AcquireFileView(f, size);
+	FS_FCloseFile(f);
+
+	if(!view)
+		*size = len;
+
+	return view;
+}
+
+/*
+==================
+FS_SV_OpenLineReader
+
+Returns qfalse if the file does not exist
+==================
+*/
+qboolean FS_SV_OpenLineReader( const char *filename, fileLineReader_t *reader ) {
+
+	Com_Memset(reader, 0, sizeof(fileLineReader_t));
+
+	reader->view = FS_SV_AcquireFileView(filename, &reader->size);
+	if(reader->view){
+		reader->owned = qtrue;
+		return qtrue;
+	}
+	if(reader->size < 0)
+		return qfalse;
+
+	FS_SV_FOpenFileRead(filename, &reader->file);
+	return reader->file != 0;
+}
+
+//Lines out of memory which belongs to the caller
+void FS_OpenBufferLineReader( const byte *data, int size, fileLineReader_t *reader ) {
+
+	Com_Memset(reader, 0, sizeof(fileLineReader_t));
+	reader->view = data;
+	reader->size = data ? size : 0;
+}
+
+/*
+==================
+FS_ReaderReadLine
+
+Same as FS_ReadLine. The line keeps its newline and gets cut after len -1 characters like fgets does
+==================
+*/
+int FS_ReaderReadLine( fileLineReader_t *reader, char *buffer, int len ) {
+
+	const byte *start, *end;
+	int n;
+
+	if(reader->file)
+		return FS_ReadLine(buffer, len, reader->file);
+
+	*buffer = 0;
+
+	if(reader->pos >= reader->size || len < 2)
+		return 0;
+
+	start = reader->view + reader->pos;
+	n = reader->size - reader->pos;
+	if(n > len -1)
+		n = len -1;
+
+	end = memchr(start, '\n', n);
+	if(end)
+		n = end - start +1;
+
+	Com_Memcpy(buffer, start, n);
+	buffer[n] = 0;
+	reader->pos += n;
+	return 1;
+}
+
+void FS_CloseLineReader( fileLineReader_t *reader ) {
+
+	if(reader->file)
+		FS_FCloseFile(reader->file);
+	if(reader->owned)
+		FS_ReleaseFileView(reader->view);
+
+	Com_Memset(reader, 0, sizeof(fileLineReader_t));
+}
+
 
 
 /*
@@ -440,7 +806,7 @@ qboolean FS_FileExists( const char *file )
 
 	testpath = FS_BuildOSPath( fs_homepath->string, "", file );
 
-	f = fopen( testpath, "rb" );
+	f = FS_OpenExistingOSPath( testpath, "rb" );
 	if (f) {
 		fclose( f );
 		return qtrue;
@@ -467,7 +833,7 @@ char* FS_SV_GetFilepath( const char *file )
 	testpath = FS_BuildOSPath( fs_homepath->string, file, "" );
         testpath[strlen(testpath)-1] = '\0';
 
-	f = fopen( testpath, "rb" );
+	f = FS_OpenExistingOSPath( testpath, "rb" );
 	if (f) {
 		fclose( f );
 		return testpath;
@@ -476,7 +842,7 @@ char* FS_SV_GetFilepath( const char *file )
         testpath = FS_BuildOSPath( fs_basepath->string, file, "" );
         testpath[strlen(testpath)-1] = '\0';
 
-	f = fopen( testpath, "rb" );
+	f = FS_OpenExistingOSPath( testpath, "rb" );
 	if (f) {
 		fclose( f );
 		return testpath;
@@ -502,6 +868,8 @@ void FS_Rename( const char *from, const char *to ) {
 		Com_Printf( "FS_Rename: %s --> %s\n", from_ospath, to_ospath );
 	}
 
+	FS_InvalidatePathCache();
+
 	if (rename( from_ospath, to_ospath )) {
 		// Failed, try copying it and deleting the original
 		FS_CopyFile ( from_ospath, to_ospath );
@@ -528,6 +896,8 @@ void FS_SV_Rename( const char *from, const char *to ) {
 		Com_Printf( "FS_Rename: %s --> %s\n", from_ospath, to_ospath );
 	}
 
+	FS_InvalidatePathCache();
+
 	if (rename( from_ospath, to_ospath )) {
 		// Failed, try copying it and deleting the original
 		FS_CopyFile ( from_ospath, to_ospath );
@@ -918,6 +1288,7 @@ fileHandle_t FS_SV_FOpenFileWrite( const char *filename ) {
 		return 0;
 	}
 
+	FS_InvalidatePathCache();
 	fsh[f].handleFiles.file.o = fopen( ospath, "wb" );
 
 	Q_strncpyz( fsh[f].name, filename, sizeof( fsh[f].name ) );
@@ -958,7 +1329,7 @@ int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp ) {
 		Com_Printf( "FS_SV_FOpenFileRead (fs_homepath): %s\n", ospath );
 	}
 
-	fsh[f].handleFiles.file.o = fopen( ospath, "rb" );
+	fsh[f].handleFiles.file.o = FS_OpenExistingOSPath( ospath, "rb" );
 	fsh[f].handleSync = qfalse;
 
         if (!fsh[f].handleFiles.file.o){
@@ -971,7 +1342,7 @@ int FS_SV_FOpenFileRead( const char *filename, fileHandle_t *fp ) {
                     Com_Printf( "FS_SV_FOpenFileRead (fs_basepath): %s\n", ospath );
                 }
 
-                fsh[f].handleFiles.file.o = fopen( ospath, "rb" );
+                fsh[f].handleFiles.file.o = FS_OpenExistingOSPath( ospath, "rb" );
                 fsh[f].handleSync = qfalse;
 
             }
@@ -1019,6 +1390,7 @@ fileHandle_t FS_SV_FOpenFileAppend( const char *filename ) {
 		return 0;
 	}
 
+	FS_InvalidatePathCache();
 	fsh[f].handleFiles.file.o = fopen( ospath, "ab" );
 	fsh[f].handleSync = qfalse;
 	if (!fsh[f].handleFiles.file.o) {
@@ -1229,6 +1601,7 @@ void FS_WriteFile( const char *qpath, const void *buffer, int size ) {
 	}
 
 	f = FS_FOpenFileWrite( qpath );
+	FS_InvalidatePathCache();
 	if ( !f ) {
 		Com_Printf( "Failed to open %s\n", qpath );
 		return;
@@ -1413,6 +1786,7 @@ void FS_SV_HomeCopyFile( char *from, char *to ) {
 		return;
 	}
 
+	FS_InvalidatePathCache();
 	f = fopen( to_ospath, "wb" );
 	if ( !f ) {
 		return;
@@ -1424,25 +1798,127 @@ void FS_SV_HomeCopyFile( char *from, char *to ) {
 }
 
 
+/*
+Set of "gamename/basename.iwd" of all searchpath paks, so FS_VerifyPak does not
+have to walk and rebuild every name for each download block. The searchpaths
+belong to the binary, the set gets rebuilt once the list head changes or
+FS_InvalidatePakAllowlist was called. Slots refer to the packs themselves.
+*/
+#define FS_PAKALLOWLIST_SIZE 1024	// power of 2, at most 3/4 gets used
+
+typedef struct {
+	unsigned int hash;
+	pack_t *pack;
+} fsPakAllowlistEntry_t;
+
+static fsPakAllowlistEntry_t fs_pakAllowlist[FS_PAKALLOWLIST_SIZE];
+static searchpath_t *fs_pakAllowlistHead;
+static qboolean fs_pakAllowlistValid;
+static qboolean fs_pakAllowlistOverflow;	// Too many paks, FS_VerifyPak walks the searchpaths
+
+static unsigned int FS_HashPakPathStep( unsigned int hash, const char *s ) {
+
+	while(*s)
+	{
+		hash ^= (unsigned char)tolower(*s);
+		hash *= 16777619u;
+		s++;
+	}
+	return hash;
+}
+
+static unsigned int FS_HashPakPath( const pack_t *pack ) {
+
+	unsigned int hash = 2166136261u;
+
+	hash = FS_HashPakPathStep(hash, pack->pakGamename);
+	hash = FS_HashPakPathStep(hash, "/");
+	hash = FS_HashPakPathStep(hash, pack->pakBasename);
+	return FS_HashPakPathStep(hash, ".iwd");
+}
+
+// Same as Q_stricmp() against "gamename/basename.iwd" without building it
+static qboolean FS_PakPathMatches( const pack_t *pack, const char *pak ) {
+
+	int len;
+
+	len = strlen(pack->pakGamename);
+	if(Q_stricmpn(pak, pack->pakGamename, len) || pak[len] != '/')
+		return qfalse;
+	pak += len +1;
+
+	len = strlen(pack->pakBasename);
+	if(Q_stricmpn(pak, pack->pakBasename, len))
+		return qfalse;
+
+	return !Q_stricmp(pak + len, ".iwd");
+}
+
+static void FS_BuildPakAllowlist( void ) {
+
+	searchpath_t *search;
+	unsigned int hash, i;
+	int count = 0;
+
+	Com_Memset(fs_pakAllowlist, 0, sizeof(fs_pakAllowlist));
+	fs_pakAllowlistOverflow = qfalse;
+	fs_pakAllowlistHead = fs_searchpaths;
+	fs_pakAllowlistValid = qtrue;
+
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		if ( !search->pack )
+			continue;
+
+		if(++count > FS_PAKALLOWLIST_SIZE / 4 * 3)
+		{
+			fs_pakAllowlistOverflow = qtrue;
+			return;
+		}
+		hash = FS_HashPakPath(search->pack);
+		for(i = hash; fs_pakAllowlist[i & (FS_PAKALLOWLIST_SIZE -1)].pack != NULL; i++);
+		fs_pakAllowlist[i & (FS_PAKALLOWLIST_SIZE -1)].hash = hash;
+		fs_pakAllowlist[i & (FS_PAKALLOWLIST_SIZE -1)].pack = search->pack;
+	}
+}
+
+/*
+==============
+FS_InvalidatePakAllowlist
+
+Has to be called whenever the searchpaths might have been rebuilt
+==============
+*/
+void FS_InvalidatePakAllowlist( void ) {
+	fs_pakAllowlistValid = qfalse;
+}
+
 // CVE-2006-2082
 // compared requested pak against the names as we built them in FS_ReferencedPakNames
 qboolean FS_VerifyPak( const char *pak ) {
 	char teststring[ BIG_INFO_STRING ];
 	searchpath_t    *search;
+	fsPakAllowlistEntry_t *entry;
+	unsigned int hash, i;
 
-	for ( search = fs_searchpaths ; search ; search = search->next ) {
-		if ( search->pack ) {
-			Q_strncpyz( teststring, search->pack->pakGamename, sizeof( teststring ) );
-			Q_strcat( teststring, sizeof( teststring ), "/" );
-			Q_strcat( teststring, sizeof( teststring ), search->pack->pakBasename );
-			Q_strcat( teststring, sizeof( teststring ), ".iwd" );
-			if ( !Q_stricmp( teststring, pak ) ) {
+	if(!fs_pakAllowlistValid || fs_pakAllowlistHead != fs_searchpaths)
+		FS_BuildPakAllowlist();
+
+	if(fs_pakAllowlistOverflow)
+	{
+		for ( search = fs_searchpaths ; search ; search = search->next ) {
+			if ( search->pack && FS_PakPathMatches(search->pack, pak) ) {
 				return qtrue;
 			}
-
 		}
-
+	}else{
+		hash = FS_HashPakPathStep(2166136261u, pak);
+		for(i = hash; (entry = &fs_pakAllowlist[i & (FS_PAKALLOWLIST_SIZE -1)])->pack != NULL; i++)
+		{
+			if(entry->hash == hash && FS_PakPathMatches(entry->pack, pak))
+				return qtrue;
+		}
 	}
+
 	Com_sprintf(teststring, sizeof( teststring ), "%s/mod.ff", fs_game->string);
 	if ( !Q_stricmp( teststring, pak ) ){
 		return qtrue;
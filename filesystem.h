@@ -189,6 +189,7 @@ qboolean FS_HomeRemove( const char *path );
 qboolean FS_SV_HomeRemove( const char *path );
 
 qboolean FS_FileExists( const char *file );
+void FS_InvalidatePathCache( void );
 
 char* FS_SV_GetFilepath( const char *file );
 void FS_Rename( const char *from, const char *to );
@@ -218,7 +219,26 @@ void QDECL FS_Printf( fileHandle_t h, const char *fmt, ... );
 int FS_Seek( fileHandle_t f, long offset, int origin );
 __cdecl const char* FS_GetBasepath();
 qboolean FS_VerifyPak( const char *pak );
+void FS_InvalidatePakAllowlist( void );
 void	FS_ForceFlush( fileHandle_t f );
+int FS_DupFileDescriptor( fileHandle_t f );
+const byte* FS_AcquireFileView( fileHandle_t f, int *size );
+void FS_ReleaseFileView( const byte* view );
+const byte* FS_SV_AcquireFileView( const char *filename, int *size );
+
+//Reads the lines of a mapped file, falls back to FS_ReadLine if it can not be mapped
+typedef struct{
+	fileHandle_t	file;
+	const byte	*view;
+	int		size;
+	int		pos;
+	qboolean	owned;		//The view is released by FS_CloseLineReader
+}fileLineReader_t;
+
+qboolean FS_SV_OpenLineReader( const char *filename, fileLineReader_t *reader );
+void FS_OpenBufferLineReader( const byte *data, int size, fileLineReader_t *reader );
+int FS_ReaderReadLine( fileLineReader_t *reader, char *buffer, int len );
+void FS_CloseLineReader( fileLineReader_t *reader );
 void __cdecl FS_InitFilesystem(void);
 void __cdecl FS_Shutdown(qboolean);
 void __cdecl FS_ShutdownIwdPureCheckReferences(void);
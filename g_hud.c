@@ -26,22 +26,137 @@
 #include "g_sv_shared.h"
 #include "scr_vm.h"
 
+#include <string.h>
+
 
 
 game_hudelem_t* g_hudelems = (game_hudelem_t*)(HUDELEM_ADDR);
 
+/*
+The setters only write fields which really change and return the HUDELEM_FIELD_* they touched.
+The last text of every element is remembered, so setting the same text again doesn't have to
+search the localized configstrings. Longer texts than the cache holds always get looked up.
+*/
+#define HUDELEM_TEXTCACHE_LENGTH 128
+
+static char g_hudTextCache[MAX_HUDELEMS][HUDELEM_TEXTCACHE_LENGTH];
+static int g_hudTextIndex[MAX_HUDELEMS];
+
+static void G_HudForgetText(game_hudelem_t* element){
+
+    int num = element - g_hudelems;
+
+    g_hudTextCache[num][0] = 0;
+    g_hudTextIndex[num] = 0;
+}
+
+static qboolean G_ColorCompare(ucolor_t a, ucolor_t b){
+
+    return a.red == b.red && a.green == b.green && a.blue == b.blue && a.alpha == b.alpha;
+}
 
-game_hudelem_t* G_GetNewHudElem(unsigned int clientnum){
+
+/*
+Free slots are kept on a stack so getting a new element doesn't have to scan the array.
+The game also frees elements on its own (disconnect, level change), these slots come back
+with the next rescan which happens once the stack is empty or got invalidated.
+Slots the game took itself get skipped when they are popped.
+*/
+static short g_hudFreeSlots[MAX_HUDELEMS];
+static int g_hudNumFreeSlots;
+static qboolean g_hudFreeSlotsValid;
+static int g_hudInUse;
+static int g_hudPeakInUse;
+
+static void G_HudRescanSlots(){
 
     int i;
-    game_hudelem_t* element = g_hudelems;
 
-    for(i = 0; i < MAX_HUDELEMS; i++, element++)
+    g_hudNumFreeSlots = 0;
+
+    //Lowest slots end up on top so they get used first like before
+    for(i = MAX_HUDELEMS -1; i >= 0; i--)
     {
-        if(element->inuse)
+        if(!g_hudelems[i].inuse){
+            g_hudFreeSlots[g_hudNumFreeSlots] = i;
+            g_hudNumFreeSlots++;
+        }
+    }
+    g_hudInUse = MAX_HUDELEMS - g_hudNumFreeSlots;
+    g_hudFreeSlotsValid = qtrue;
+}
+
+void G_HudInvalidateSlots(){
+
+    g_hudFreeSlotsValid = qfalse;
+}
+
+//Returns a free element which is marked as in use. Its fields still have to be set up
+game_hudelem_t* G_HudAllocElem(){
+
+    game_hudelem_t* element;
+
+    if(!g_hudFreeSlotsValid || g_hudNumFreeSlots == 0)
+        G_HudRescanSlots();
+
+    do
+    {
+        if(g_hudNumFreeSlots == 0)
+            return NULL;
+
+        g_hudNumFreeSlots--;
+        element = &g_hudelems[g_hudFreeSlots[g_hudNumFreeSlots]];
+
+    }while(element->inuse); //Got taken by the game itself
+
+    element->inuse = qtrue;
+
+    g_hudInUse++;
+    if(g_hudInUse > g_hudPeakInUse)
+        g_hudPeakInUse = g_hudInUse;
+
+    return element;
+}
+
+void G_HudStatus_f(){
+
+    int perClient[MAX_CLIENTS];
+    int global;
+    int i;
+
+    Com_Memset(perClient, 0, sizeof(perClient));
+    global = 0;
+
+    G_HudRescanSlots();
+
+    for(i = 0; i < MAX_HUDELEMS; i++)
+    {
+        if(!g_hudelems[i].inuse)
             continue;
 
-        element->inuse = qtrue;
+        if(g_hudelems[i].entitynum < MAX_CLIENTS)
+            perClient[g_hudelems[i].entitynum]++;
+        else
+            global++;
+    }
+
+    Com_Printf("Hudelems in use: %i of %i, peak: %i\n", g_hudInUse, MAX_HUDELEMS, g_hudPeakInUse);
+    Com_Printf("Visible to everyone: %i\n", global);
+    for(i = 0; i < MAX_CLIENTS; i++)
+    {
+        if(perClient[i])
+            Com_Printf("Client %i: %i\n", i, perClient[i]);
+    }
+}
+
+
+game_hudelem_t* G_GetNewHudElem(unsigned int clientnum){
+
+    game_hudelem_t* element = G_HudAllocElem();
+
+    if(element)
+    {
+
         element->x = 0;
         element->y = 0;
         element->var_03 = 0;
@@ -98,6 +213,7 @@ game_hudelem_t* G_GetNewHudElem(unsigned int clientnum){
             element->entitynum = clientnum;
 
         element->teamnum = 0;
+        G_HudForgetText(element);
         return element;
     }
     Com_PrintWarning("G_CreateHudElem: Exceeded limit of Hudelems\n");
@@ -105,30 +221,41 @@ game_hudelem_t* G_GetNewHudElem(unsigned int clientnum){
 }
 
 
-void G_HudSetColor(game_hudelem_t* element ,ucolor_t color,ucolor_t glowcolor){
+int G_HudSetColor(game_hudelem_t* element ,ucolor_t color,ucolor_t glowcolor){
+
+    if(G_ColorCompare(element->color, color) && G_ColorCompare(element->glowcolor, glowcolor))
+        return 0;
 
     element->color = color;
     element->glowcolor = glowcolor;
-
+    return HUDELEM_FIELD_COLOR;
 }
 
-void G_HudSetPosition(game_hudelem_t* element ,float x, float y, hudscrnalign_t scrnhalign,  hudscrnalign_t scrnvalign, hudalign_t alignx, hudalign_t aligny){
+int G_HudSetPosition(game_hudelem_t* element ,float x, float y, hudscrnalign_t scrnhalign,  hudscrnalign_t scrnvalign, hudalign_t alignx, hudalign_t aligny){
+
+    if(element->x == x && element->y == y && element->align == (alignx | aligny) && element->screenalign == scrnhalign + scrnvalign)
+        return 0;
 
     element->x = x;
     element->y = y;
     element->align = alignx | aligny;
     element->screenalign = scrnhalign + scrnvalign;
+    return HUDELEM_FIELD_POSITION;
 }
 
-void G_HudSetFont(game_hudelem_t* element ,float fontscale, fonttype_t fonttype){
+int G_HudSetFont(game_hudelem_t* element ,float fontscale, fonttype_t fonttype){
 
     if(fontscale > 4.6 || fontscale < 1.399999)
     {
         Com_PrintWarning("Fontscale: %f is out of range. Range is 1.4 to 4.6\n", fontscale);
         fontscale = 1.4;
     }
+    if(element->fontscale == fontscale && element->fonttype == fonttype)
+        return 0;
+
     element->fontscale = fontscale;
     element->fonttype = fonttype;
+    return HUDELEM_FIELD_FONT;
 }
 
 void G_HudSetMovingOverTime(game_hudelem_t* element ,int time, float newx, float newy){
@@ -165,7 +292,18 @@ void G_HudSetFadingOverTime(game_hudelem_t* element ,int time, ucolor_t newcolor
 }
 
 
-void G_HudSetText(game_hudelem_t* element ,const char *text){
+//Sets a text which is already in the localized configstrings
+static int G_HudSetTextIndex(game_hudelem_t* element ,const char *text, int index){
+
+    int num = element - g_hudelems;
+    int changed = 0;
+
+    if(element->hudTextConfigStringIndex != index || !element->inuse)
+        changed = HUDELEM_FIELD_TEXT;
+
+    //Clears a movement which got set up before
+    if(element->movex != 0 || element->movey != 0 || element->movealign != 0 || element->movescralign != 0)
+        changed |= HUDELEM_FIELD_POSITION;
 
     element->var_14 = 0;
     element->var_15 = 0;
@@ -185,15 +323,101 @@ void G_HudSetText(game_hudelem_t* element ,const char *text){
     element->var_29 = 0;
     element->var_30 = 0;
 
-    element->hudTextConfigStringIndex = G_LocalizedStringIndex(text);
+    element->hudTextConfigStringIndex = index;
     element->inuse = qtrue;
 
+    if(strlen(text) < HUDELEM_TEXTCACHE_LENGTH){
+        Q_strncpyz(g_hudTextCache[num], text, HUDELEM_TEXTCACHE_LENGTH);
+        g_hudTextIndex[num] = index;
+    }else{
+        G_HudForgetText(element);
+    }
+    return changed;
+}
+
+//Returns the configstring index of text. The element's cache is only trusted while nobody else changed its text
+static int G_HudTextIndex(game_hudelem_t* element ,const char *text){
+
+    int num = element - g_hudelems;
+
+    if(g_hudTextIndex[num] != 0 && element->hudTextConfigStringIndex == g_hudTextIndex[num] && !strcmp(g_hudTextCache[num], text))
+        return g_hudTextIndex[num];
+
+    return G_LocalizedStringIndex(text);
+}
+
+int G_HudSetText(game_hudelem_t* element ,const char *text){
+
+    return G_HudSetTextIndex(element, text, G_HudTextIndex(element, text));
+}
+
+/*
+Applies the same update to many elements, e.g. the same rule for all players.
+The text gets looked up only once. Returns how many elements changed
+*/
+int G_HudUpdateMany(game_hudelem_t** elements, int count, const hudelemUpdate_t* update){
+
+    game_hudelem_t* element;
+    int textindex = 0;
+    int changed;
+    int numchanged;
+    int i;
+
+    if(count < 1)
+        return 0;
+
+    if(update->fields & HUDELEM_FIELD_TEXT)
+        textindex = update->textindex ? update->textindex : G_HudTextIndex(elements[0], update->text);
+
+    for(i = 0, numchanged = 0; i < count; i++){
+
+        element = elements[i];
+        if(!element)
+            continue;
+
+        changed = 0;
+
+        if(update->fields & HUDELEM_FIELD_POSITION)
+            changed |= G_HudSetPosition(element, update->x, update->y, update->scrnhalign, update->scrnvalign, update->alignx, update->aligny);
+
+        if(update->fields & HUDELEM_FIELD_FONT)
+            changed |= G_HudSetFont(element, update->fontscale, update->fonttype);
+
+        if(update->fields & HUDELEM_FIELD_COLOR)
+            changed |= G_HudSetColor(element, update->color, update->glowcolor);
+
+        if(update->fields & HUDELEM_FIELD_FADE){
+            G_HudSetFadingOverTime(element, update->fadetime, update->fadecolor);
+            changed |= HUDELEM_FIELD_FADE;
+        }
+
+        if(update->fields & HUDELEM_FIELD_TEXT)
+            changed |= G_HudSetTextIndex(element, update->text, textindex);
+
+        if(changed)
+            numchanged++;
+    }
+    return numchanged;
 }
 
 void G_HudDestroy(game_hudelem_t* element){
 
+    qboolean wasinuse = element->inuse;
+
     Scr_FreeHudElem(element);
     element->inuse = qfalse;
+    G_HudForgetText(element);
+
+    if(!wasinuse || !g_hudFreeSlotsValid)
+        return;
+
+    if(g_hudNumFreeSlots >= MAX_HUDELEMS){
+        G_HudInvalidateSlots();
+        return;
+    }
+    g_hudFreeSlots[g_hudNumFreeSlots] = element - g_hudelems;
+    g_hudNumFreeSlots++;
+    g_hudInUse--;
 
 }
 
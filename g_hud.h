@@ -122,18 +122,48 @@ typedef struct
 
 }game_hudelem_t; //Size: 0xac
 
+//Fields which got changed / get set by G_HudUpdateMany
+#define HUDELEM_FIELD_TEXT	1
+#define HUDELEM_FIELD_POSITION	2
+#define HUDELEM_FIELD_FONT	4
+#define HUDELEM_FIELD_COLOR	8
+#define HUDELEM_FIELD_FADE	16
+
+typedef struct
+{
+    int		fields;		//HUDELEM_FIELD_* which get applied
+    const char*	text;
+    int		textindex;	//Localized string index of text if known already, 0 looks it up
+    float	x;
+    float	y;
+    hudscrnalign_t	scrnhalign;
+    hudscrnalign_t	scrnvalign;
+    hudalign_t	alignx;
+    hudalign_t	aligny;
+    float	fontscale;
+    fonttype_t	fonttype;
+    ucolor_t	color;
+    ucolor_t	glowcolor;
+    int		fadetime;
+    ucolor_t	fadecolor;
+}hudelemUpdate_t;
+
 extern game_hudelem_t* g_hudelems;
 
 qboolean OnSameTeam( gentity_t *ent1, gentity_t *ent2 );
 qboolean Cmd_FollowClient_f(gentity_t *ent, int clientnum);
 game_hudelem_t* G_GetNewHudElem(unsigned int clnum);
-void G_HudSetText(game_hudelem_t*, const char*);
-void G_HudSetPosition(game_hudelem_t*, float x, float y, hudscrnalign_t, hudscrnalign_t, hudalign_t alignx, hudalign_t aligny);
-void G_HudSetColor(game_hudelem_t*, ucolor_t, ucolor_t);
+game_hudelem_t* G_HudAllocElem( void );
+void G_HudInvalidateSlots( void );
+void G_HudStatus_f( void );
+int G_HudSetText(game_hudelem_t*, const char*);
+int G_HudSetPosition(game_hudelem_t*, float x, float y, hudscrnalign_t, hudscrnalign_t, hudalign_t alignx, hudalign_t aligny);
+int G_HudSetColor(game_hudelem_t*, ucolor_t, ucolor_t);
 void G_HudSetMovingOverTime(game_hudelem_t*, int, float newx, float newy);
-void G_HudSetFont(game_hudelem_t*, float fontscale, fonttype_t ft);
+int G_HudSetFont(game_hudelem_t*, float fontscale, fonttype_t ft);
 void G_HudSetFadingOverTime(game_hudelem_t* element ,int time, ucolor_t newcolor);
 void G_HudDestroy(game_hudelem_t* element);
+int G_HudUpdateMany(game_hudelem_t** elements, int count, const hudelemUpdate_t* update);
 
 
 #endif
@@ -30,6 +30,7 @@
 #include "plugin_handler.h"
 #include "cmd.h"
 #include "qcommon_io.h"
+#include "qcommon_redirect.h"
 #include "server.h"
 #include "scr_vm.h"
 
@@ -408,8 +409,8 @@ G_Say
 
 __cdecl void G_Say( gentity_t *ent, gentity_t *target, int mode, const char *chatText ) {
 	int j;
-	gentity_t   *other;
 	int color;
+	clientMask_t recipients;
 	char name[64];
 	// don't let text be too long for malicious reasons
 	char text[MAX_SAY_TEXT];
@@ -464,10 +465,10 @@ __cdecl void G_Say( gentity_t *ent, gentity_t *target, int mode, const char *cha
         }
 
 
-	G_ChatRedirect(text, ent->s.number, mode);
-
 	if ( target ) {
-		G_SayTo( ent, target, mode, color, teamname, name, text);
+		G_ChatRedirect(text, ent->s.number, mode);
+		if ( target->s.number >= MAX_CLIENTS || !(SV_ChatIgnoredBy(ent->s.number) & CLIENTMASK_BIT(target->s.number)) )
+			G_SayTo( ent, target, mode, color, teamname, name, text);
 		return;
 	}
 
@@ -477,6 +478,9 @@ __cdecl void G_Say( gentity_t *ent, gentity_t *target, int mode, const char *cha
 	if(!show)
 		return;
 
+	// Only after the plugins had their say, so chat they throttle does not reach the redirects either
+	G_ChatRedirect(text, ent->s.number, mode);
+
 	if(Scr_PlayerSay(ent, mode, textptr))
 	{
 		return;
@@ -488,56 +492,26 @@ __cdecl void G_Say( gentity_t *ent, gentity_t *target, int mode, const char *cha
 	// echo the text to the console
 	Com_Printf( "Say %s: %s\n", name, text );
 
-	// send it to all the apropriate clients
-	for ( j = 0; j < level.maxclients; j++ ) {
-		other = &g_entities[j];
-		G_SayTo( ent, other, mode, color, teamname, name, text );
+	// send it to all the apropriate clients, G_SayTo still has the final word on each
+	if ( mode == SAY_TEAM )
+		recipients = SV_TeamClientMask( ent->client->sess.sessionTeam, CS_CONNECTED );
+	else
+		recipients = SV_ClientMask( CS_CONNECTED );
+
+	recipients &= ~SV_ChatIgnoredBy( ent->s.number );
+	recipients |= CLIENTMASK_BIT( ent->s.number );
+
+	while ( recipients ) {
+		j = __builtin_ctzll( recipients );
+		recipients &= recipients -1;
+		if ( j >= level.maxclients )
+			break;
+		G_SayTo( ent, &g_entities[j], mode, color, teamname, name, text );
 	}
 }
 
 
-#define MAX_REDIRECTDESTINATIONS 4
-
-static void (*rd_destinations[MAX_REDIRECTDESTINATIONS])( const char *buffer, int client, int mode );
-
 void G_ChatRedirect(char* msg, int client, int mode)
 {
-
-    int i;
-
-    for(i = 0; i < MAX_REDIRECTDESTINATIONS; i++)
-    {
-        if(rd_destinations[i] == NULL)
-            return;
-
-        rd_destinations[i](msg, client, mode);
-
-    }
-
-}
-/*
-    To Add:
-    HL2Rcon_SourceRconSendChat(text, ent->s.number);
-*/
-
-
-void G_AddChatRedirect(void (*rd_dest)( const char *, int, int))
-{
-    int i;
-
-    for(i = 0; i < MAX_REDIRECTDESTINATIONS; i++)
-    {
-        if(rd_destinations[i] == rd_dest)
-        {
-            Com_Error(ERR_FATAL, "G_AddChatRedirect: Attempt to add an already defined redirect function twice.");
-            return;
-        }
-
-        if(rd_destinations[i] == NULL)
-        {
-            rd_destinations[i] = rd_dest;
-            return;
-        }
-    }
-    Com_Error(ERR_FATAL, "G_AddChatRedirect: Out of redirect handles. Increase MAX_REDIRECTDESTINATIONS to add more redirect destinations");
+    Com_RedirectPublish(RD_CHANNEL_CHAT, msg, strlen(msg), client, mode);
 }
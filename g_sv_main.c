@@ -29,8 +29,13 @@
 #include "plugin_handler.h"
 #include "g_shared.h"
 #include "g_sv_shared.h"
+#include "qcommon_redirect.h"
 #include "cmd.h"
 #include "server.h"
+#include "filesystem.h"
+#include "qcommon_logprint.h"
+#include "qcommon_logbinary.h"
+#include "qcommon_profile.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -168,57 +173,21 @@ __cdecl void QDECL G_LogPrintf( const char *fmt, ... ) {
 
 	stringlen = strlen( string );
 
+	PROFILE_BEGIN(PROFILE_GAMELOG);
+
 	G_PrintRedirect(string, stringlen);
 
-	if ( !level.logFile ) {
-		return;
+	if ( level.logFile ) {
+		if ( com_logBinary->integer )
+			Com_WriteBinaryLog( LOGBINARY_STREAM_GAME, level.time, string + timelen, stringlen - timelen );
+		if ( com_logBinary->integer != 2 )
+			Com_WriteLog( LOGWRITER_GAME, level.logFile, string, stringlen, fsh[level.logFile].handleSync );
 	}
 
-	FS_Write( string, stringlen, level.logFile );
+	PROFILE_END(PROFILE_GAMELOG);
 }
 
-#define MAX_REDIRECTDESTINATIONS 4
-
-static void (*rd_destinations[MAX_REDIRECTDESTINATIONS])( const char *buffer, int len );
-
 void G_PrintRedirect(char* msg, int len)
 {
-
-    int i;
-
-    for(i = 0; i < MAX_REDIRECTDESTINATIONS; i++)
-    {
-        if(rd_destinations[i] == NULL)
-            return;
-
-        rd_destinations[i](msg, len);
-
-    }
-
-}
-/*
-    To Add:
-    HL2Rcon_SourceRconSendGameLog(string, stringlen);
-*/
-
-
-void G_PrintAddRedirect(void (*rd_dest)( const char *, int))
-{
-    int i;
-
-    for(i = 0; i < MAX_REDIRECTDESTINATIONS; i++)
-    {
-        if(rd_destinations[i] == rd_dest)
-        {
-            Com_Error(ERR_FATAL, "G_PrintAddRedirect: Attempt to add an already defined redirect function twice.");
-            return;
-        }
-
-        if(rd_destinations[i] == NULL)
-        {
-            rd_destinations[i] = rd_dest;
-            return;
-        }
-    }
-    Com_Error(ERR_FATAL, "G_PrintAddRedirect: Out of redirect handles. Increase MAX_REDIRECTDESTINATIONS to add more redirect destinations");
+    Com_RedirectPublish(RD_CHANNEL_GAMELOG, msg, len, -1, 0);
 }
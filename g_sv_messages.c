@@ -33,15 +33,20 @@
 
 #define MAX_MESSAGES 63
 #define MAX_MSGBUFF 4096
+#define MESSAGE_INTERVAL 10000	//Time between two messages of the same player
 
 
 typedef struct{
 	char*		ruleStrings[MAX_MESSAGES +1];
 	char*		adStrings[MAX_MESSAGES +1];
+	int		ruleIndex[MAX_MESSAGES +1];	//Localized string indices, valid for the level of indexServerId
+	int		adIndex[MAX_MESSAGES +1];
+	int		indexServerId;
 	char		msgBuff[MAX_MSGBUFF];
 }msgDisplay_t;
 
 static msgDisplay_t messages;
+static int messageNextTime[MAX_CLIENTS];	//svs.time the next message of this player is due
 
 static char motdBuff[200];
 
@@ -85,10 +90,26 @@ void G_ShowMessage(game_hudelem_t* hudelem, const char* rule, int time){
 
 
 
-void G_PrintRuleForPlayer(client_t *cl){
+//The configstrings of the localized strings stay for the whole level, so every message gets looked up once
+static int G_MessageTextIndex(char** strings, int* indices, int slot){
+
+    if(messages.indexServerId != sv_serverId){
+        Com_Memset(messages.ruleIndex, 0, sizeof(messages.ruleIndex));
+        Com_Memset(messages.adIndex, 0, sizeof(messages.adIndex));
+        messages.indexServerId = sv_serverId;
+    }
+
+    if(indices[slot] == 0)
+        indices[slot] = G_LocalizedStringIndex(strings[slot]);
+
+    return indices[slot];
+}
+
+//Steps the rule rotation of this player. Returns the rule to show or NULL
+static const char* G_NextRuleForPlayer(client_t *cl, int* textindex){
 
     if(cl->msgType != 1)
-        return;
+        return NULL;
 
 
     char *rule = messages.ruleStrings[cl->currentAd];
@@ -96,27 +117,25 @@ void G_PrintRuleForPlayer(client_t *cl){
     if(rule == NULL){ //No looping, go to adverts
 
         cl->msgType++;
-        return;
+        return NULL;
     }
 
     if(!cl->hudMsg)
         G_SetupHudMessagesForPlayer(cl);
 
     if(!cl->hudMsg)
-        return; //Failure to get hudelem
+        return NULL; //Failure to get hudelem
 
-    G_HudSetPosition(cl->hudMsg, 0, 25, HUDSCRNALIGN_CENTER, HUDSCRNALIGN_TOP, HUDALIGN_CENTER, HUDALIGN_TOP);
-    G_HudSetFont(cl->hudMsg, 1.6, HUDFONT_DEFAULT);
-
-    G_ShowMessage(cl->hudMsg, rule, 5000);
+    *textindex = G_MessageTextIndex(messages.ruleStrings, messages.ruleIndex, cl->currentAd);
     cl->currentAd++;
+    return rule;
 }
 
-
-void G_PrintAdvertForPlayer(client_t *cl){
+//Steps the advert rotation of this player. Returns the advert to show or NULL
+static const char* G_NextAdvertForPlayer(client_t *cl, int* textindex){
 
     if(cl->msgType != 2)
-        return;
+        return NULL;
 
     char *ad = messages.adStrings[cl->currentAd];
 
@@ -127,7 +146,7 @@ void G_PrintAdvertForPlayer(client_t *cl){
                 G_HudDestroy(cl->hudMsg); //Nothing to show
 
             cl->hudMsg = NULL;
-            return;
+            return NULL;
         }
         cl->currentAd = 0;
         ad = messages.adStrings[cl->currentAd];
@@ -137,13 +156,137 @@ void G_PrintAdvertForPlayer(client_t *cl){
         G_SetupHudMessagesForPlayer(cl);
 
     if(!cl->hudMsg)
-        return; //Failure to get hudelem
+        return NULL; //Failure to get hudelem
 
-    G_HudSetPosition(cl->hudMsg, 0, 0, HUDSCRNALIGN_CENTER, HUDSCRNALIGN_TOP, HUDALIGN_CENTER, HUDALIGN_TOP);
-    G_HudSetFont(cl->hudMsg, 1.4, HUDFONT_DEFAULT);
-
-    G_ShowMessage(cl->hudMsg, ad, 8000);
+    *textindex = G_MessageTextIndex(messages.adStrings, messages.adIndex, cl->currentAd);
     cl->currentAd++;
+    return ad;
+}
+
+static void G_SetupMessageUpdate(hudelemUpdate_t* update, const char* text, int textindex, qboolean rule){
+
+    update->fields = HUDELEM_FIELD_POSITION | HUDELEM_FIELD_FONT | HUDELEM_FIELD_FADE | HUDELEM_FIELD_TEXT;
+    update->text = text;
+    update->textindex = textindex;
+    update->x = 0;
+    update->y = rule ? 25 : 0;
+    update->scrnhalign = HUDSCRNALIGN_CENTER;
+    update->scrnvalign = HUDSCRNALIGN_TOP;
+    update->alignx = HUDALIGN_CENTER;
+    update->aligny = HUDALIGN_TOP;
+    update->fontscale = rule ? 1.6 : 1.4;
+    update->fonttype = HUDFONT_DEFAULT;
+    update->fadetime = 700;
+    update->fadecolor.red = 255;
+    update->fadecolor.green = 255;
+    update->fadecolor.blue = 255;
+    update->fadecolor.alpha = 255;
+}
+
+//Shows the same message on many elements at once
+static void G_ShowMessageMany(game_hudelem_t** hudelems, int count, const char* text, int textindex, qboolean rule){
+
+    hudelemUpdate_t update;
+    int i;
+
+    G_SetupMessageUpdate(&update, text, textindex, rule);
+    G_HudUpdateMany(hudelems, count, &update);
+
+    for(i = 0; i < count; i++)
+        Com_AddTimedEvent((rule ? 5000 : 8000)+700, G_DestroyMessage, 1, hudelems[i]);
+}
+
+
+void G_PrintRuleForPlayer(client_t *cl){
+
+    int textindex;
+    const char* rule = G_NextRuleForPlayer(cl, &textindex);
+
+    if(rule)
+        G_ShowMessageMany(&cl->hudMsg, 1, rule, textindex, qtrue);
+}
+
+
+void G_PrintAdvertForPlayer(client_t *cl){
+
+    int textindex;
+    const char* ad = G_NextAdvertForPlayer(cl, &textindex);
+
+    if(ad)
+        G_ShowMessageMany(&cl->hudMsg, 1, ad, textindex, qfalse);
+}
+
+
+/*
+Tells if the next message of this player is due in this frame. The players get
+spread evenly over MESSAGE_INTERVAL, so every frame has about the same number
+of hudelem updates instead of all of them in one frame
+*/
+static qboolean G_MessageDue(int clnum){
+
+    int delta = messageNextTime[clnum] - svs.time;
+
+    if(delta > 0 && delta <= MESSAGE_INTERVAL)
+        return qfalse;
+
+    if(delta > 0 || delta <= -MESSAGE_INTERVAL){ //Never set or missed a whole interval, e.g. while the level started
+        messageNextTime[clnum] = svs.time + MESSAGE_INTERVAL * clnum / sv_maxclients->integer;
+        return qfalse;
+    }
+
+    messageNextTime[clnum] += MESSAGE_INTERVAL;
+    return qtrue;
+}
+
+/*
+Steps the rotation of all players whose message is due and shows every message which
+is due to several players with one batched update
+*/
+void G_PrintRulesAndAdverts(){
+
+    game_hudelem_t* hudelems[MAX_CLIENTS];
+    game_hudelem_t* batch[MAX_CLIENTS];
+    const char* texts[MAX_CLIENTS];
+    int textindices[MAX_CLIENTS];
+    qboolean isrule[MAX_CLIENTS];
+    client_t *cl;
+    int count, batchcount;
+    int i, j;
+
+    for(cl = svs.clients, i = 0, count = 0; i < sv_maxclients->integer; i++, cl++){
+
+        if(cl->state != CS_ACTIVE || !G_MessageDue(i))
+            continue;
+
+        isrule[count] = qtrue;
+        texts[count] = G_NextRuleForPlayer(cl, &textindices[count]);
+
+        if(!texts[count]){
+            isrule[count] = qfalse;
+            texts[count] = G_NextAdvertForPlayer(cl, &textindices[count]);
+        }
+
+        if(texts[count]){
+            hudelems[count] = cl->hudMsg;
+            count++;
+        }
+    }
+
+    for(i = 0; i < count; i++){
+
+        if(!texts[i])
+            continue;
+
+        for(j = i, batchcount = 0; j < count; j++){
+            if(texts[j] == texts[i]){
+                batch[batchcount] = hudelems[j];
+                batchcount++;
+                if(j != i)
+                    texts[j] = NULL;
+            }
+        }
+        G_ShowMessageMany(batch, batchcount, texts[i], textindices[i], isrule[i]);
+    }
 }
 
 
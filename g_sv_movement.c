@@ -29,11 +29,22 @@
 #include "player.h"
 #include "server.h"
 #include "g_sv_shared.h"
+#include "cmd.h"
+#include "sys_main.h"
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 qboolean extendedMovementControl = 0;
 
+/*
+The values the pmove hooks read for every player. The fields of client_t stay
+for everyone else, but they are spread over a huge struct, so the hooks get
+their own packed copy which is written whenever the values change.
+*/
+static pmoveParams_t pmove_params[MAX_CLIENTS];
+
 
 //This function init movement variables with default values
 void Pmove_ExtendedInitForClient(client_t *cl){
@@ -52,6 +63,10 @@ void Pmove_ExtendedInitForClient(client_t *cl){
         cl->gravity = (int)g_gravity->value;
     else
         cl->gravity = 800;
+
+    pmove_params[cl - svs.clients].moveSpeed = cl->playerMoveSpeed;
+    pmove_params[cl - svs.clients].gravity = cl->gravity;
+    pmove_params[cl - svs.clients].jumpHeight = cl->jumpHeight;
 }
 
 
@@ -60,7 +75,7 @@ void Pmove_ExtendedResetState( void ){
     int i;
     client_t *cl;
 
-    for(cl = svs.clients, i = 0; i < MAX_CLIENTS; i++){
+    for(cl = svs.clients, i = 0; i < MAX_CLIENTS; i++, cl++){
         Pmove_ExtendedInitForClient(cl);
     }
 
@@ -79,7 +94,7 @@ void Pmove_ExtendedTurnOn( void ){
 
     Com_DPrintf("Turning on per player based movement control. Default global cvars are now disabled\n");
 
-    for(cl = svs.clients, i = 0; i < MAX_CLIENTS; i++){
+    for(cl = svs.clients, i = 0; i < MAX_CLIENTS; i++, cl++){
         Pmove_ExtendedInitForClient(cl);
     }
 
@@ -87,10 +102,35 @@ void Pmove_ExtendedTurnOn( void ){
 }
 
 
+void Pmove_ExtendedSetSpeed( int clientNum, int speed ){
+
+    Pmove_ExtendedTurnOn();
+
+    svs.clients[clientNum].playerMoveSpeed = speed;
+    pmove_params[clientNum].moveSpeed = speed;
+}
+
+void Pmove_ExtendedSetGravity( int clientNum, int gravity ){
+
+    Pmove_ExtendedTurnOn();
+
+    svs.clients[clientNum].gravity = gravity;
+    pmove_params[clientNum].gravity = gravity;
+}
+
+void Pmove_ExtendedSetJumpHeight( int clientNum, float height ){
+
+    Pmove_ExtendedTurnOn();
+
+    svs.clients[clientNum].jumpHeight = height;
+    pmove_params[clientNum].jumpHeight = height;
+}
+
+
 __cdecl __optimize3 int Pmove_GetSpeed( playerState_t *ps ) {
 
 	if(extendedMovementControl)
-		return svs.clients[ps->clientNum].playerMoveSpeed;
+		return pmove_params[ps->clientNum].moveSpeed;
 	else
 		return g_speed->integer;
 
@@ -101,7 +141,7 @@ __cdecl __optimize3 int Pmove_GetGravity( playerState_t *ps ) {
 	int gravity;
 
 	if(extendedMovementControl)
-		gravity = svs.clients[ps->clientNum].gravity;
+		gravity = pmove_params[ps->clientNum].gravity;
 	else
 		gravity = (int)g_gravity->value;
 
@@ -112,7 +152,7 @@ __cdecl __optimize3 int Pmove_GetGravity( playerState_t *ps ) {
 __cdecl __optimize3 float Jump_GetHeight( playerState_t *ps) {
 
 	if(extendedMovementControl)
-		return svs.clients[ps->clientNum].jumpHeight;
+		return pmove_params[ps->clientNum].jumpHeight;
 	else
 		return jump_height->value;
 }
@@ -209,4 +249,102 @@ __cdecl __optimize3 float Jump_CalcHeight( playerState_t* ps ) {
 __cdecl __optimize3 void StuckInClient( gentity_t* gen )
 {
 
-}
\ No newline at end of file
+}
+
+
+/*
+==================
+Pmove_Bench_f
+
+pmovebench <pmoves>
+
+Runs the hooks the binary calls during a jump for every player slot, once with
+the global cvars and once with per player movement, and reports what a pmove
+costs in them. The rest of the pmove is the binary and the same in both modes
+==================
+*/
+#define PMOVEBENCH_MAXMOVES 10000000
+
+static void Pmove_BenchRun( playerState_t *states, int count, volatile float *sink ) {
+
+	playerState_t *ps;
+	vec3_t vec;
+	float step;
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		ps = &states[i % MAX_CLIENTS];
+		VectorCopy(ps->origin, vec);
+		vec[2] += 1.0f;
+
+		ps->gravity = Pmove_GetGravity(ps);
+		*sink += Pmove_GetSpeed(ps);
+		*sink += Jump_CalcHeight(ps);
+		*sink += Jump_IsPlayerAboveMax(ps);
+		if(Jump_GetStepHeight(ps, vec, &step))
+			*sink += step;
+		Jump_ClampVelocity(ps, vec);
+		*sink += ps->velocity[2];
+	}
+}
+
+void Pmove_Bench_f( void ) {
+
+	playerState_t *states;
+	qboolean extended;
+	volatile float sink = 0;
+	unsigned long long stock, custom;
+	int count, i;
+
+	if(Cmd_Argc() != 2){
+		Com_Printf("pmovebench <pmoves>\n");
+		return;
+	}
+
+	count = atoi(Cmd_Argv(1));
+	if(count < 1 || count > PMOVEBENCH_MAXMOVES){
+		Com_Printf("The number of pmoves has to be between 1 and %d\n", PMOVEBENCH_MAXMOVES);
+		return;
+	}
+
+	if(!g_speed || !g_gravity || !jump_height){
+		Com_Printf("The server must be running a level\n");
+		return;
+	}
+
+	states = malloc(MAX_CLIENTS * sizeof(playerState_t));
+	if(states == NULL){
+		Com_PrintError("pmovebench: Out of memory\n");
+		return;
+	}
+	Com_Memset(states, 0, MAX_CLIENTS * sizeof(playerState_t));
+
+	for(i = 0; i < MAX_CLIENTS; i++)
+	{
+		states[i].clientNum = i;
+		states[i].jumpOriginZ = 0;
+		states[i].origin[2] = (i % 48) * 1.0f;
+		states[i].velocity[2] = 300.0f - i * 5.0f;
+		states[i].pm_time = i * 40;
+		states[i].var_03 = (i & 1) ? 64 : 0;
+	}
+
+	extended = extendedMovementControl;
+
+	extendedMovementControl = qfalse;
+	stock = Sys_MicrosecondsLong();
+	Pmove_BenchRun(states, count, &sink);
+	stock = Sys_MicrosecondsLong() - stock;
+
+	extendedMovementControl = qtrue;
+	custom = Sys_MicrosecondsLong();
+	Pmove_BenchRun(states, count, &sink);
+	custom = Sys_MicrosecondsLong() - custom;
+
+	extendedMovementControl = extended;
+	free(states);
+
+	Com_Printf("%d pmoves: global cvars %.1f nsec, per player %.1f nsec per pmove\n", count,
+		stock * 1000.0 / count, custom * 1000.0 / count);
+}
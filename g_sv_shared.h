@@ -34,7 +34,6 @@
 void Init_CallVote(void);
 __cdecl void Cmd_CallVote_f( gentity_t *ent );
 void G_ChatRedirect(char* msg, int client, int mode);
-void G_AddChatRedirect(void (*rd_dest)( const char *, int, int));
 qboolean Cmd_FollowClient_f(gentity_t *ent, int clientnum);
 __cdecl void StopFollowingOnDeath( gentity_t *ent );
 __cdecl void G_Say( gentity_t *ent, gentity_t *target, int mode, const char *chatText );
@@ -62,14 +61,25 @@ void __cdecl SV_GameSendServerCommand(int clientnum, int svscmd_type, const char
 void G_ShowMotd(unsigned int clnum);
 void QDECL G_LogPrintf( const char *fmt, ... );
 void G_PrintRedirect(char* msg, int len);
-void G_PrintAddRedirect(void (*rd_dest)( const char *, int));
 __cdecl void ClientSpawn(gentity_t* ent, vec3_t* px, vec3_t* py);
 __cdecl void ClientUserinfoChanged( int clientNum );
 
 
+//Movement of one player as the pmove hooks read it
+typedef struct{
+	int	moveSpeed;
+	int	gravity;
+	float	jumpHeight;
+	int	pad;
+}pmoveParams_t;
+
 void Pmove_ExtendedResetState( void );
 void Pmove_ExtendedInitForClient(client_t *cl);
 void Pmove_ExtendedTurnOn( void );
+void Pmove_ExtendedSetSpeed( int clientNum, int speed );
+void Pmove_ExtendedSetGravity( int clientNum, int gravity );
+void Pmove_ExtendedSetJumpHeight( int clientNum, float height );
+void Pmove_Bench_f( void );
 __cdecl __optimize3 int Pmove_GetSpeed( playerState_t *ps );
 __cdecl __optimize3 int Pmove_GetGravity( playerState_t *ps );
 __cdecl __optimize3 float Jump_GetHeight( playerState_t *ps);
@@ -88,6 +98,7 @@ void __cdecl ClientBegin( int clientNum );
 
 void G_PrintRuleForPlayer(client_t *cl);
 void G_PrintAdvertForPlayer(client_t *cl);
+void G_PrintRulesAndAdverts( void );
 void G_SetupHudMessagesForPlayer(client_t* cl);
 void G_DestroyAdsForPlayer(client_t *cl);
 void G_AddRule(const char* newtext);
@@ -35,6 +35,7 @@
 #include "punkbuster.h"
 #include "net_game.h"
 #include "g_sv_shared.h"
+#include "qcommon_redirect.h"
 
 #include <stdint.h>
 #include <string.h>
@@ -53,7 +54,132 @@ Source Rcon facility
 
 
 sourceRcon_t sourceRcon;
-#define HL2RCON_SOURCEOUTPUTBUF_LENGTH 4096
+#define HL2RCON_SOURCEOUTPUTBUF_LENGTH 16384 //TCP takes the whole output of most commands in one packet
+
+
+/*
+Streaming subscribers
+
+Each topic keeps a list of the users which stream it, so the console output and the gamelog
+look at nobody when nobody streams them. A user can narrow down the stream with a regular
+expression for the console and gamelog lines and a mask of the event types. The packet gets
+framed once for all users which pass their filter.
+*/
+static void HL2Rcon_UpdateStreamSubscribers( void ){
+
+	rconUser_t* user;
+	int i;
+
+	Com_Memset(sourceRcon.numStreamSubscribers, 0, sizeof(sourceRcon.numStreamSubscribers));
+
+	for(i = 0, user = sourceRcon.activeRconUsers; i < MAX_RCONUSERS; i++, user++){
+
+		if(user->remote.type == NA_BAD)
+			continue;
+
+		if(user->streamlog)
+			sourceRcon.streamSubscribers[RCONSTREAM_CONLOG][sourceRcon.numStreamSubscribers[RCONSTREAM_CONLOG]++] = i;
+
+		if(user->streamgamelog)
+			sourceRcon.streamSubscribers[RCONSTREAM_GAMELOG][sourceRcon.numStreamSubscribers[RCONSTREAM_GAMELOG]++] = i;
+
+		if(user->streamchat)
+			sourceRcon.streamSubscribers[RCONSTREAM_CHAT][sourceRcon.numStreamSubscribers[RCONSTREAM_CHAT]++] = i;
+
+		if(user->streamevents)
+			sourceRcon.streamSubscribers[RCONSTREAM_EVENTS][sourceRcon.numStreamSubscribers[RCONSTREAM_EVENTS]++] = i;
+
+		if(user->streameventbatch)
+			sourceRcon.streamSubscribers[RCONSTREAM_EVENTBATCH][sourceRcon.numStreamSubscribers[RCONSTREAM_EVENTBATCH]++] = i;
+	}
+}
+
+static void HL2Rcon_ClearStreamFilter( rconUser_t* user ){
+
+	if(user->streamFilterActive)
+		regfree(&user->streamFilter);
+
+	user->streamFilterActive = qfalse;
+}
+
+static void HL2Rcon_ResetStreams( rconUser_t* user ){
+
+	user->streamlog = 0;
+	user->streamchat = 0;
+	user->streamgamelog = 0;
+	user->streamevents = 0;
+	user->streameventbatch = 0;
+	user->streamEventMask = -1;
+	HL2Rcon_ClearStreamFilter(user);
+}
+
+static qboolean HL2Rcon_StreamFilterPasses( rconUser_t* user, const byte* data, int msglen, int type ){
+
+	if(type == SERVERDATA_EVENT)
+		return msglen > 0 && data[0] < 32 && (user->streamEventMask & (1 << data[0]));
+
+	if(!user->streamFilterActive)
+		return qtrue;
+
+	return regexec(&user->streamFilter, (const char*)data, 0, NULL, 0) == 0;
+}
+
+static void HL2Rcon_StreamFilter_f( void ){
+
+	rconUser_t* user;
+	char pattern[MAX_STRING_CHARS];
+	char error[256];
+	int ret;
+
+	if(sourceRcon.redirectUser < 1 || sourceRcon.redirectUser > MAX_RCONUSERS){
+		Com_Printf("This command can only be used from SourceRcon\n");
+		return;
+	}
+
+	user = &sourceRcon.activeRconUsers[sourceRcon.redirectUser -1];
+
+	HL2Rcon_ClearStreamFilter(user);
+
+	if(Cmd_Argc() < 2){
+		Com_Printf("Streaming all console and gamelog lines\n");
+		return;
+	}
+
+	Cmd_Args(pattern, sizeof(pattern));
+
+	ret = regcomp(&user->streamFilter, pattern, REG_EXTENDED | REG_NOSUB | REG_ICASE);
+	if(ret != 0){
+		regerror(ret, &user->streamFilter, error, sizeof(error));
+		Com_Printf("Bad regular expression: %s\n", error);
+		return;
+	}
+	user->streamFilterActive = qtrue;
+
+	Com_Printf("Streaming only console and gamelog lines which match: %s\n", pattern);
+}
+
+static void HL2Rcon_StreamEvents_f( void ){
+
+	rconUser_t* user;
+
+	if(sourceRcon.redirectUser < 1 || sourceRcon.redirectUser > MAX_RCONUSERS){
+		Com_Printf("This command can only be used from SourceRcon\n");
+		return;
+	}
+
+	user = &sourceRcon.activeRconUsers[sourceRcon.redirectUser -1];
+
+	if(Cmd_Argc() < 2)
+		user->streamEventMask = -1;
+	else
+		user->streamEventMask = atoi(Cmd_Argv(1));
+
+	Com_Printf("Streaming events: %s %s %s %s\n",
+		user->streamEventMask & (1 << RCONEVENT_PLAYERENTERGAME) ? "enter" : "",
+		user->streamEventMask & (1 << RCONEVENT_PLAYERLEAVE) ? "leave" : "",
+		user->streamEventMask & (1 << RCONEVENT_LEVELSTART) ? "levelstart" : "",
+		user->streamEventMask & (1 << RCONEVENT_PLAYERENTERTEAM) ? "team" : "");
+}
 
 
 void HL2Rcon_SetSourceRconAdmin_f( void ){
@@ -240,6 +366,7 @@ void HL2Rcon_SourceRconStreaming_enable( int type ){
 	char* cg;
 	char* ch;
 	char* ev;
+	char* eb;
 
 	if(sourceRcon.redirectUser < 1 || sourceRcon.redirectUser > MAX_RCONUSERS){
 		Com_Printf("This command can only be used from SourceRcon\n");
@@ -252,6 +379,9 @@ void HL2Rcon_SourceRconStreaming_enable( int type ){
 	user->streamgamelog = type & 2;
 	user->streamchat = type & 4;
 	user->streamevents = type & 8;
+	user->streameventbatch = type & 16;
+
+	HL2Rcon_UpdateStreamSubscribers();
 
 	if(user->streamlog)
 		c = "logfile";
@@ -273,7 +403,12 @@ void HL2Rcon_SourceRconStreaming_enable( int type ){
 	else
 		ev = "";
 
-	Com_Printf("Streaming turned on for: %s %s %s %s\n", c, cg, ch, ev);
+	if(user->streameventbatch)
+		eb = "eventbatch";
+	else
+		eb = "";
+
+	Com_Printf("Streaming turned on for: %s %s %s %s %s\n", c, cg, ch, ev, eb);
 }
 
 void HL2Rcon_ClearSourceRconAdminList( )
@@ -318,10 +453,8 @@ void HL2Rcon_SourceRconDisconnect(netadr_t *from, int socketfd, int connectionId
 		return;
 	}
 	sourceRcon.activeRconUsers[connectionId].remote.type = NA_BAD;
-	sourceRcon.activeRconUsers[connectionId].streamlog = 0;
-	sourceRcon.activeRconUsers[connectionId].streamchat = 0;
-	sourceRcon.activeRconUsers[connectionId].streamgamelog = 0;
-	sourceRcon.activeRconUsers[connectionId].streamevents = 0;
+	HL2Rcon_ResetStreams(&sourceRcon.activeRconUsers[connectionId]);
+	HL2Rcon_UpdateStreamSubscribers();
 
 }
 
@@ -418,8 +551,8 @@ tcpclientstate_t HL2Rcon_SourceRconAuth(netadr_t *from, msg_t *msg, int socketfd
 	user->rconPower = login->power;
 	Q_strncpyz(user->rconUsername, login->username, sizeof(user->rconUsername));
 	user->socketfd = socketfd;
-	user->streamchat = 0;
-	user->streamlog = 0;
+	HL2Rcon_ResetStreams(user);
+	HL2Rcon_UpdateStreamSubscribers();
 	user->lastpacketid = packetid;
 	*connectionId = i;
 
@@ -457,41 +590,232 @@ void HL2Rcon_SourceRconSendConsole( const char* data, int msglen)
 	HL2Rcon_SourceRconSendDataToEachClient( (const byte*)data, msglen, SERVERDATA_CONLOG);
 }
 
+/*
+Event batches
+
+The events of a frame get collected in eventbatch and sent as one SERVERDATA_EVENTBATCH
+packet by HL2Rcon_FlushEventBatch, see hl2rcon.h for the format. Kills and damage only
+exist as gamelog lines of the game script, they get parsed once here so the tools do not
+have to parse the text. Nothing gets collected while nobody streams the batches.
+*/
+#define HL2RCON_EVENTBATCH_SIZE 0x4000
+
+static struct{
+	byte data[HL2RCON_EVENTBATCH_SIZE];
+	int len;
+	int count;
+}eventbatch;
+
+static const char* hl2rcon_meansOfDeath[] = {
+	"MOD_UNKNOWN", "MOD_PISTOL_BULLET", "MOD_RIFLE_BULLET", "MOD_GRENADE", "MOD_GRENADE_SPLASH",
+	"MOD_PROJECTILE", "MOD_PROJECTILE_SPLASH", "MOD_MELEE", "MOD_HEAD_SHOT", "MOD_CRUSH",
+	"MOD_TELEFRAG", "MOD_FALLING", "MOD_SUICIDE", "MOD_TRIGGER_HURT", "MOD_EXPLOSIVE",
+	"MOD_IMPACT", NULL
+};
+
+static const char* hl2rcon_hitLocations[] = {
+	"none", "helmet", "head", "neck", "torso_upper", "torso_lower", "right_arm_upper",
+	"left_arm_upper", "right_arm_lower", "left_arm_lower", "right_hand", "left_hand",
+	"right_leg_upper", "left_leg_upper", "right_leg_lower", "left_leg_lower", "right_foot",
+	"left_foot", "gun", NULL
+};
+
+static int HL2Rcon_EventNameIndex( const char** names, const char* name ){
+
+	int i;
+
+	for(i = 0; names[i]; i++){
+		if(!Q_stricmp(names[i], name))
+			return i;
+	}
+	return 255;
+}
+
+void HL2Rcon_FlushEventBatch( void ){
+
+	rconUser_t* user;
+	msg_t msg;
+	byte *sourcemsgbuf;
+	netTcpSendBuffer_t *sendbuf;
+	int i;
+
+	if(eventbatch.count == 0)
+		return;
+
+	sourcemsgbuf = MSG_GetBuffer(MAX_MSGLEN);
+	MSG_Init(&msg, sourcemsgbuf, MAX_MSGLEN);
+	MSG_WriteLong(&msg, 0); //writing 0 for now
+	MSG_WriteLong(&msg, 0);
+	MSG_WriteLong(&msg, SERVERDATA_EVENTBATCH);
+	MSG_WriteByte(&msg, HL2RCON_EVENTBATCH_VERSION);
+	MSG_WriteShort(&msg, eventbatch.count);
+	MSG_WriteData(&msg, eventbatch.data, eventbatch.len);
+	MSG_WriteByte(&msg, 0);
+
+	//Adjust the length
+	*(int32_t*)msg.data = msg.cursize - 4;
+
+	eventbatch.len = 0;
+	eventbatch.count = 0;
+
+	sendbuf = NET_TcpAllocSendBuffer(msg.data, msg.cursize);
+	MSG_FreeBuffer(sourcemsgbuf);
+	if(!sendbuf)
+		return;
+
+	for(i = 0; i < sourceRcon.numStreamSubscribers[RCONSTREAM_EVENTBATCH]; i++){
+		user = &sourceRcon.activeRconUsers[sourceRcon.streamSubscribers[RCONSTREAM_EVENTBATCH][i]];
+		NET_TcpSendBuffer(user->socketfd, sendbuf);
+	}
+	NET_TcpReleaseSendBuffer(sendbuf);
+}
+
+//A string gets appended as length byte and characters if given
+static void HL2Rcon_QueueEvent( int type, const byte* payload, int len, const char* string ){
+
+	int stringlen = 0;
+
+	if(sourceRcon.numStreamSubscribers[RCONSTREAM_EVENTBATCH] == 0)
+		return;
+
+	if(string){
+		stringlen = strlen(string);
+		if(stringlen > 255 - len -1)
+			stringlen = 255 - len -1;
+	}
+
+	if(eventbatch.len + 2 + len + (string ? stringlen +1 : 0) > sizeof(eventbatch.data) || eventbatch.count == 0xffff)
+		HL2Rcon_FlushEventBatch();
+
+	eventbatch.data[eventbatch.len++] = len + (string ? stringlen +1 : 0);
+	eventbatch.data[eventbatch.len++] = type;
+	Com_Memcpy(eventbatch.data + eventbatch.len, payload, len);
+	eventbatch.len += len;
+
+	if(string){
+		eventbatch.data[eventbatch.len++] = stringlen;
+		Com_Memcpy(eventbatch.data + eventbatch.len, string, stringlen);
+		eventbatch.len += stringlen;
+	}
+	eventbatch.count++;
+}
+
+/*
+Kill and damage lines of the gamelog:
+K;victimguid;victimnum;victimteam;victimname;attackerguid;attackernum;attackerteam;attackername;weapon;damage;mod;hitloc
+*/
+#define HL2RCON_HITFIELDS 13
+
+static void HL2Rcon_QueueGameLogEvent( const char* line ){
+
+	char buf[1024];
+	char* fields[HL2RCON_HITFIELDS +1];
+	char* s;
+	int numfields, attacker, damage;
+	byte payload[6];
+
+	//Skip the timestamp
+	while(*line == ' ')
+		line++;
+	line = strchr(line, ' ');
+	if(line == NULL)
+		return;
+	line++;
+
+	if((line[0] != 'K' && line[0] != 'D') || line[1] != ';')
+		return;
+
+	Q_strncpyz(buf, line, sizeof(buf));
+	s = strchr(buf, '\n');
+	if(s)
+		*s = 0;
+
+	for(numfields = 0, s = buf; s && numfields <= HL2RCON_HITFIELDS; numfields++){
+		fields[numfields] = s;
+		s = strchr(s, ';');
+		if(s)
+			*s++ = 0;
+	}
+
+	//Names with a ';' would make the fields ambiguous
+	if(numfields != HL2RCON_HITFIELDS)
+		return;
+
+	attacker = atoi(fields[6]);
+	if(attacker < 0 || attacker > 254)
+		attacker = 255;
+
+	damage = atoi(fields[10]);
+	if(damage < 0)
+		damage = 0;
+	if(damage > 0xffff)
+		damage = 0xffff;
+
+	payload[0] = atoi(fields[2]);
+	payload[1] = attacker;
+	payload[2] = damage & 0xff;
+	payload[3] = damage >> 8;
+	payload[4] = HL2Rcon_EventNameIndex(hl2rcon_meansOfDeath, fields[11]);
+	payload[5] = HL2Rcon_EventNameIndex(hl2rcon_hitLocations, fields[12]);
+
+	HL2Rcon_QueueEvent(buf[0] == 'K' ? RCONEVENT_KILL : RCONEVENT_DAMAGE, payload, sizeof(payload), fields[9]);
+}
+
 void HL2Rcon_SourceRconSendGameLog( const char* data, int msglen)
 {
 	HL2Rcon_SourceRconSendDataToEachClient( (const byte*)data, msglen, SERVERDATA_GAMELOG);
+
+	if(sourceRcon.numStreamSubscribers[RCONSTREAM_EVENTBATCH] > 0)
+		HL2Rcon_QueueGameLogEvent( data );
 }
 
 
 
 void HL2Rcon_SourceRconSendChat( const char* data, int clientnum, int mode)
 {
+    byte payload[2];
+
     HL2Rcon_SourceRconSendChatToEachClient( data, NULL, clientnum, qfalse);
+
+    payload[0] = clientnum;
+    payload[1] = mode;
+    HL2Rcon_QueueEvent( RCONEVENT_CHAT, payload, sizeof(payload), data);
 }
 
 void HL2Rcon_SourceRconSendDataToEachClient( const byte* data, int msglen, int type){
 
 	rconUser_t* user;
-	int i;
+	int i, topic;
 	msg_t msg;
 	int32_t *updatelen;
-	byte sourcemsgbuf[MAX_MSGLEN];
-	qboolean msgbuild = qfalse;
+	byte *sourcemsgbuf;
+	netTcpSendBuffer_t *sendbuf = NULL;
 
-	for(i = 0, user = sourceRcon.activeRconUsers; i < MAX_RCONUSERS; i++, user++ ){
+	switch(type)
+	{
+		case SERVERDATA_CONLOG:
+			topic = RCONSTREAM_CONLOG;
+			break;
+		case SERVERDATA_GAMELOG:
+			topic = RCONSTREAM_GAMELOG;
+			break;
+		case SERVERDATA_EVENT:
+			topic = RCONSTREAM_EVENTS;
+			break;
+		default:
+			return;
+	}
 
-		if(!user->streamgamelog && type == SERVERDATA_GAMELOG)
-			continue;
+	for(i = 0; i < sourceRcon.numStreamSubscribers[topic]; i++ ){
 
-		if(!user->streamlog && type == SERVERDATA_CONLOG)
-			continue;
+		user = &sourceRcon.activeRconUsers[sourceRcon.streamSubscribers[topic][i]];
 
-		if(!user->streamevents && type == SERVERDATA_EVENT)
+		if(!HL2Rcon_StreamFilterPasses(user, data, msglen, type))
 			continue;
 
-		
-		if(!msgbuild){
-			MSG_Init(&msg, sourcemsgbuf, sizeof(sourcemsgbuf));
+		if(!sendbuf){
+			sourcemsgbuf = MSG_GetBuffer(MAX_MSGLEN);
+			MSG_Init(&msg, sourcemsgbuf, MAX_MSGLEN);
 			MSG_WriteLong(&msg, 0); //writing 0 for now
 			MSG_WriteLong(&msg, 0);
 			MSG_WriteLong(&msg, type);
@@ -506,10 +830,16 @@ void HL2Rcon_SourceRconSendDataToEachClient( const byte* data, int msglen, int t
 			//Adjust the length
 			updatelen = (int32_t*)msg.data;
 			*updatelen = msg.cursize - 4;
-			msgbuild = qtrue;
+
+			//Serialized once, every receiver just references it
+			sendbuf = NET_TcpAllocSendBuffer(msg.data, msg.cursize);
+			MSG_FreeBuffer(sourcemsgbuf);
+			if(!sendbuf)
+				return;
 		}
-		NET_SendData(user->socketfd, msg.data, msg.cursize);
+		NET_TcpSendBuffer(user->socketfd, sendbuf);
 	}
+	NET_TcpReleaseSendBuffer(sendbuf);
 }
 
 
@@ -521,16 +851,19 @@ void HL2Rcon_SourceRconSendChatToEachClient( const char *text, rconUser_t *self,
 	int i;
 	msg_t msg;
 	int32_t *updatelen;
-	byte sourcemsgbuf[MAX_MSGLEN];
+	byte *sourcemsgbuf;
 
 
+	if(sourceRcon.numStreamSubscribers[RCONSTREAM_CHAT] == 0)
+		return;
 
-	for(i = 0, user = sourceRcon.activeRconUsers; i < MAX_RCONUSERS; i++, user++ ){
+	sourcemsgbuf = MSG_GetBuffer(MAX_MSGLEN);
 
-		if(!user->streamchat)
-			continue;
+	for(i = 0; i < sourceRcon.numStreamSubscribers[RCONSTREAM_CHAT]; i++ ){
 
-		MSG_Init(&msg, sourcemsgbuf, sizeof(sourcemsgbuf));
+		user = &sourceRcon.activeRconUsers[sourceRcon.streamSubscribers[RCONSTREAM_CHAT][i]];
+
+		MSG_Init(&msg, sourcemsgbuf, MAX_MSGLEN);
 		MSG_WriteLong(&msg, 0); //writing 0 for now
 		MSG_WriteLong(&msg, 0);
 		MSG_WriteLong(&msg, SERVERDATA_CHAT);
@@ -565,6 +898,7 @@ void HL2Rcon_SourceRconSendChatToEachClient( const char *text, rconUser_t *self,
 
 		NET_SendData(user->socketfd, msg.data, msg.cursize);
 	}
+	MSG_FreeBuffer(sourcemsgbuf);
 }
 
 
@@ -585,7 +919,7 @@ void HL2Rcon_SourceRconFlushRedirect(char* outputbuf, qboolean lastcommand){
 	MSG_WriteLong(&msg, 0); //writing 0 for now
 	MSG_WriteLong(&msg, user->lastpacketid);
 	MSG_WriteLong(&msg, SERVERDATA_RESPONSE_VALUE);
-	MSG_WriteBigString(&msg, outputbuf);
+	MSG_WriteData(&msg, outputbuf, strlen(outputbuf) +1); //Can be longer than a big string
 
 	MSG_WriteByte(&msg, 0);
 
@@ -758,12 +1092,14 @@ void HL2Rcon_Init(){
 	Cmd_AddCommand ("rcondeladmin", HL2Rcon_UnsetSourceRconAdmin_f);
 	Cmd_AddCommand ("rconaddadmin", HL2Rcon_SetSourceRconAdmin_f);
 	Cmd_AddCommand ("rconlistadmins", HL2Rcon_ListSourceRconAdmins_f);
+	Cmd_AddCommand ("rconstreamfilter", HL2Rcon_StreamFilter_f);
+	Cmd_AddCommand ("rconstreamevents", HL2Rcon_StreamEvents_f);
 
 	NET_TCPAddEventType(HL2Rcon_SourceRconEvent, HL2Rcon_SourceRconAuth, HL2Rcon_SourceRconDisconnect, 9038723);
 
-	Com_AddRedirect(HL2Rcon_SourceRconSendConsole);
-	G_PrintAddRedirect(HL2Rcon_SourceRconSendGameLog);
-	G_AddChatRedirect(HL2Rcon_SourceRconSendChat);
+	Com_AddRedirect("hl2rcon_console", HL2Rcon_SourceRconSendConsole, qtrue);
+	G_PrintAddRedirect("hl2rcon_gamelog", HL2Rcon_SourceRconSendGameLog, qtrue);
+	G_AddChatRedirect("hl2rcon_chat", HL2Rcon_SourceRconSendChat, qtrue);
 
 }
 
@@ -776,6 +1112,7 @@ void HL2Rcon_EventClientEnterWorld(int cid){
     data[1] = cid;
 
     HL2Rcon_SourceRconSendDataToEachClient( data, 2, SERVERDATA_EVENT);
+    HL2Rcon_QueueEvent( data[0], data +1, 1, NULL);
 
 }
 
@@ -787,6 +1124,7 @@ void HL2Rcon_EventClientLeave(int cid){
     data[1] = cid;
 
     HL2Rcon_SourceRconSendDataToEachClient( data, 2, SERVERDATA_EVENT);
+    HL2Rcon_QueueEvent( data[0], data +1, 1, NULL);
 
 }
 
@@ -798,18 +1136,20 @@ void HL2Rcon_EventLevelStart()
     data[0] = RCONEVENT_LEVELSTART;
 
     HL2Rcon_SourceRconSendDataToEachClient( data, 1, SERVERDATA_EVENT);
+    HL2Rcon_QueueEvent( data[0], NULL, 0, NULL);
 
 }
 
 void HL2Rcon_EventClientEnterTeam(int cid, int team){
 
-    byte data[2];
+    byte data[3];
 
     data[0] = RCONEVENT_PLAYERENTERTEAM;
     data[1] = cid;
     data[2] = team;
 
     HL2Rcon_SourceRconSendDataToEachClient( data, 3, SERVERDATA_EVENT);
+    HL2Rcon_QueueEvent( data[0], data +1, 2, NULL);
 
 }
 
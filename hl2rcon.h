@@ -25,6 +25,8 @@
 #include "sys_net.h"
 #include "msg.h"
 
+#include <regex.h>
+
 #ifndef __HL2RCON_H__
 #define __HL2RCON_H__
 
@@ -39,6 +41,15 @@ Source Rcon facility
 #define MAX_RCONUSERS 8
 #define MAX_RCONLOGINS 64
 
+typedef enum{
+    RCONSTREAM_CONLOG,
+    RCONSTREAM_GAMELOG,
+    RCONSTREAM_CHAT,
+    RCONSTREAM_EVENTS,
+    RCONSTREAM_EVENTBATCH,
+    RCONSTREAM_TOPICS
+}rconStreamTopic_t;
+
 typedef struct{
 	netadr_t remote;
 	int socketfd;
@@ -47,8 +58,12 @@ typedef struct{
 	qboolean streamchat;
 	qboolean streamgamelog;
 	qboolean streamevents;
+	qboolean streameventbatch;
 	int rconPower; //unused for now
 	char rconUsername[32];
+	qboolean streamFilterActive;
+	regex_t streamFilter; //Console and gamelog lines have to match it
+	int streamEventMask; //Bit for each sourceRconEvents_t
 }rconUser_t;
 
 typedef struct{
@@ -61,6 +76,9 @@ typedef struct{
 typedef struct{
 	rconLogin_t rconUsers[MAX_RCONLOGINS];
 	rconUser_t activeRconUsers[MAX_RCONUSERS];
+	//Indices of the users which stream the topic
+	byte streamSubscribers[RCONSTREAM_TOPICS][MAX_RCONUSERS];
+	int numStreamSubscribers[RCONSTREAM_TOPICS];
 	//For redirect
 	int redirectUser;
 }sourceRcon_t;
@@ -79,14 +97,36 @@ typedef enum{
     SERVERDATA_GETSTATUS = 68,
     SERVERDATA_STATUSRESPONSE = 69,
     SERVERDATA_SAY = 70,
-    SERVERDATA_EVENT = 71
+    SERVERDATA_EVENT = 71,
+    SERVERDATA_EVENTBATCH = 72
 }sourceRconCommands_t;
 
+/*
+SERVERDATA_EVENTBATCH carries all events of a server frame:
+byte version (HL2RCON_EVENTBATCH_VERSION), short count, then count records of
+byte length of the payload, byte event type, payload
+
+Payloads of version 1, strings are a length byte followed by the characters:
+PLAYERENTERGAME, PLAYERLEAVE:	byte client
+LEVELSTART:			nothing
+PLAYERENTERTEAM:		byte client, byte team
+KILL, DAMAGE:			byte victim, byte attacker (255 for none), short damage,
+				byte means of death, byte hit location, string weapon
+CHAT:				byte client, byte mode, string text
+
+Means of death and hit locations are the index into the lists in hl2rcon.c,
+255 if they are unknown. Clients have to skip records of unknown type.
+*/
+#define HL2RCON_EVENTBATCH_VERSION 1
+
 typedef enum{
     RCONEVENT_PLAYERENTERGAME = 0,
     RCONEVENT_PLAYERLEAVE = 1,
     RCONEVENT_LEVELSTART = 2,
-    RCONEVENT_PLAYERENTERTEAM = 3
+    RCONEVENT_PLAYERENTERTEAM = 3,
+    RCONEVENT_KILL = 4,       //Only in SERVERDATA_EVENTBATCH
+    RCONEVENT_DAMAGE = 5,
+    RCONEVENT_CHAT = 6
 }sourceRconEvents_t;
 
 
@@ -113,6 +153,7 @@ void HL2Rcon_EventClientEnterWorld(int cid);
 void HL2Rcon_EventClientLeave(int cid);
 void HL2Rcon_EventLevelStart();
 void HL2Rcon_Init();
+void HL2Rcon_FlushEventBatch( void );
 qboolean HL2Rcon_InfoAddAdmin(const char* line);
 void HL2Rcon_WriteAdminConfig(char* buffer, int size);
 
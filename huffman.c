@@ -705,27 +705,196 @@ int msg_hData[256] = {
 static huffman_t	msgHuff;
 static qboolean		huffInit = qfalse;
 
+/*
+The message huffman tree never changes once it is built, so it can be turned into lookup tables.
+The decoder resolves HUFF_LOOKUP_BITS bits per step and only walks the tree for longer codes.
+The encoder has the whole code of each symbol. Bits are in transmission order, first bit is the lowest.
+*/
+
+#define HUFF_LOOKUP_BITS 11
+#define HUFF_LOOKUP_SIZE ( 1 << HUFF_LOOKUP_BITS )
+#define HUFF_MAX_CODELEN 32
+
+typedef struct {
+	node_t          *node; /* Leaf or the internal node reached after HUFF_LOOKUP_BITS bits */
+	int             len;
+} huffLookup_t;
+
+typedef struct {
+	unsigned int    code;
+	int             len;
+} huffCode_t;
+
+static huffLookup_t	msgHuffLookup[HUFF_LOOKUP_SIZE];
+static huffCode_t	msgHuffCodes[HMAX + 1];
+static node_t		*msgHuffTablesTree;
+static qboolean		msgHuffTablesValid;
+
+#define MSG_HUFFTREE ( *((node_t**)(0x89297e8)) ) /* The decompressor tree of the executable */
+
+static qboolean Huff_BuildCodes( node_t *node, unsigned int code, int len ) {
+
+	if ( node == NULL ) {
+		return qfalse;
+	}
+	if ( node->symbol != INTERNAL_NODE ) {
+		if ( node->symbol < 0 || node->symbol > HMAX ) {
+			return qfalse;
+		}
+		msgHuffCodes[node->symbol].code = code;
+		msgHuffCodes[node->symbol].len = len;
+		return qtrue;
+	}
+	if ( len >= HUFF_MAX_CODELEN ) {
+		return qfalse;
+	}
+	if ( !Huff_BuildCodes( node->left, code, len + 1 ) ) {
+		return qfalse;
+	}
+	return Huff_BuildCodes( node->right, code | ( 1 << len ), len + 1 );
+}
+
+static void Huff_BuildTables( node_t *tree ) {
+	node_t *node;
+	int i, len;
+
+	msgHuffTablesTree = tree;
+	msgHuffTablesValid = qfalse;
+
+	Com_Memset( msgHuffCodes, 0, sizeof( msgHuffCodes ) );
+
+	if ( !Huff_BuildCodes( tree, 0, 0 ) ) {
+		return;
+	}
+
+	for ( i = 0; i < HUFF_LOOKUP_SIZE; i++ ) {
+		node = tree;
+		for ( len = 0; len < HUFF_LOOKUP_BITS && node->symbol == INTERNAL_NODE; len++ ) {
+			if ( ( i >> len ) & 1 ) {
+				node = node->right;
+			} else {
+				node = node->left;
+			}
+		}
+		msgHuffLookup[i].node = node;
+		msgHuffLookup[i].len = len;
+	}
+	msgHuffTablesValid = qtrue;
+}
+
+static qboolean Huff_TablesReady( void ) {
+
+	if ( MSG_HUFFTREE == NULL ) {
+		return qfalse;
+	}
+	if ( msgHuffTablesTree != MSG_HUFFTREE ) {
+		Huff_BuildTables( MSG_HUFFTREE );
+	}
+	return msgHuffTablesValid;
+}
+
 int MSG_ReadBitsCompress(const byte* input, byte* outputBuf, int readsize){
 
-    readsize = readsize * 8;
     byte *outptr = outputBuf;
+    huffLookup_t *lookup;
+    node_t *node;
+    unsigned int bits;
 
     int get;
     int offset;
+    int readbits;
     int i;
 
     if(readsize <= 0){
         return 0;
     }
 
-    for(offset = 0, i = 0; readsize > offset; i++){
-        Huff_offsetReceive(/*msgHuff.decompressor.tree*/ *((node_t**)(0x89297e8)), &get, (byte*)input, &offset);
+    readbits = readsize * 8;
+
+    if(!Huff_TablesReady()){
+
+        for(offset = 0, i = 0; readbits > offset; i++){
+            Huff_offsetReceive(MSG_HUFFTREE, &get, (byte*)input, &offset);
+            *outptr = (byte)get;
+            outptr++;
+        }
+        return i;
+    }
+
+    for(offset = 0, i = 0; readbits > offset; i++){
+
+        //The lookup needs 3 bytes. The tail of the message gets decoded by walking the tree
+        if((offset >> 3) + 2 >= readsize){
+            Huff_offsetReceive(msgHuffTablesTree, &get, (byte*)input, &offset);
+            *outptr = (byte)get;
+            outptr++;
+            continue;
+        }
+
+        bits = input[offset >> 3] | (input[(offset >> 3) + 1] << 8) | (input[(offset >> 3) + 2] << 16);
+        lookup = &msgHuffLookup[(bits >> (offset & 7)) & (HUFF_LOOKUP_SIZE - 1)];
+        offset += lookup->len;
+        node = lookup->node;
+
+        if(node->symbol == INTERNAL_NODE){
+            Huff_offsetReceive(node, &get, (byte*)input, &offset);
+        }else{
+            get = node->symbol;
+        }
         *outptr = (byte)get;
         outptr++;
     }
     return i;
 }
 
+int __cdecl MSG_WriteBitsCompress( char dummy, const byte *datasrc, byte *buffdest, int bytecount){
+
+    unsigned long long acc;
+    huffCode_t *code;
+    int offset;
+    int accbits;
+    int i;
+
+    if(bytecount <= 0){
+        return 0;
+    }
+
+    if(!Huff_TablesReady()){
+
+        if(!huffInit){
+            MSG_initHuffman();
+        }
+        for(offset = 0, i = 0; i < bytecount; i++){
+            Huff_offsetTransmit(&msgHuff.compressor, (int)datasrc[i], buffdest, &offset);
+        }
+        return (offset + 7) / 8;
+    }
+
+    acc = 0;
+    accbits = 0;
+    offset = 0;
+
+    for(i = 0; i < bytecount; i++){
+
+        code = &msgHuffCodes[datasrc[i]];
+        acc |= (unsigned long long)code->code << accbits;
+        accbits += code->len;
+
+        while(accbits >= 8){
+            buffdest[offset] = (byte)acc;
+            offset++;
+            acc >>= 8;
+            accbits -= 8;
+        }
+    }
+
+    if(accbits > 0){
+        buffdest[offset] = (byte)acc;
+        offset++;
+    }
+    return offset;
+}
+
 
 
 void MSG_initHuffman() {
@@ -24,6 +24,14 @@
 
 #include "qcommon_io.h"
 #include "filesystem.h"
+#include "sys_main.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 
 #define SEGMENT_RECORD_LENGTH 3
@@ -50,44 +58,208 @@
 
 #define RECORD_LENGTH STANDARD_RECORD_LENGTH
 
-unsigned int _GeoIP_seek_record ( unsigned long ipnum ) {
+#define GEOIP_DATABASE "GeoIP.dat"
+#define GEOIP_ASN_DATABASE "GeoIPASNum.dat"
+#define GEOIP_RELOADCHECK_INTERVAL 10000
+#define GEOIP_CACHE_SIZE 1024 //Must be a power of 2
+#define GEOIP_ASNUM_EDITION 9
+
+typedef struct{
+	unsigned long ipnum;
+	unsigned int index;
+	qboolean valid;
+}geoipCacheEntry_t;
+
+typedef struct{
+	const char *filename;
+	const unsigned char *data;	//Whole database mapped into memory
+	size_t size;
+	time_t mtime;
+	unsigned int segments;		//Records below are tree nodes, the ones above point to the data
+	unsigned int lastReloadCheck;
+	qboolean loadFailed;
+	qboolean optional;		//Don't complain if it is missing
+	geoipCacheEntry_t cache[GEOIP_CACHE_SIZE];
+}geoipDatabase_t;
+
+static geoipDatabase_t geoip = { GEOIP_DATABASE };
+static geoipDatabase_t geoipASN = { GEOIP_ASN_DATABASE, .optional = qtrue };
+static int geoipHolds;		//Lookups on worker threads which are in flight, no reload meanwhile
+
+
+static void _GeoIP_unload( geoipDatabase_t *db )
+{
+	if(db->data)
+	{
+		munmap((void*)db->data, db->size);
+	}
+	db->data = NULL;
+	db->size = 0;
+	db->mtime = 0;
+	Com_Memset(db->cache, 0, sizeof(db->cache));
+}
 
-	fileHandle_t file;
+/*
+Reads the structure info at the end of the file which tells where the data begins.
+The country database has got none and uses COUNTRY_BEGIN
+*/
+static qboolean _GeoIP_setup_segments( geoipDatabase_t *db, int edition )
+{
+	const unsigned char *p;
+	int i;
 
-	int depth;
-	unsigned int x;
-	unsigned char stack_buffer[2 * MAX_RECORD_LENGTH];
-	const unsigned char *buf = stack_buffer;
-	unsigned int offset = 0;
+	db->segments = COUNTRY_BEGIN;
 
-	const unsigned char * p;
-	int j;
+	if(edition == 0)
+		return qtrue;
 
-	FS_SV_FOpenFileRead("GeoIP.dat", &file);
+	for(i = 0, p = db->data + db->size - 3; i < STRUCTURE_INFO_MAX_SIZE && p > db->data; i++, p--)
+	{
+		if(p[0] != 255 || p[1] != 255 || p[2] != 255)
+			continue;
 
-	if(!file){
-		Com_Printf("File Read error.\n");
-		return 0;
+		if(p + 7 > db->data + db->size)
+			return qfalse;
+
+		if((p[3] >= 106 ? p[3] - 105 : p[3]) != edition)
+			return qfalse;
+
+		db->segments = p[4] + (p[5] << 8) + (p[6] << 16);
+		return db->segments > 0;
 	}
+	return qfalse;
+}
 
 /*
-	unsigned char *data; = malloc(1024*1024*2);
-	if(!FS_Seek(file, 0, SEEK_SET)){
-		FS_Read(data , 1024*1024*2, file);
+Maps the database into memory. Lookups don't touch the disk anymore afterwards
+*/
+static qboolean _GeoIP_load( geoipDatabase_t *db, int edition )
+{
+	char *ospath;
+	struct stat fileinfo;
+	void *mapped;
+	int fd;
+
+	_GeoIP_unload(db);
+
+	ospath = FS_SV_GetFilepath(db->filename);
+
+	if(ospath == NULL){
+		if(!db->loadFailed && !db->optional)
+			Com_PrintWarning("GeoIP: Can not find %s\n", db->filename);
+		db->loadFailed = qtrue;
+		return qfalse;
+	}
+
+	fd = open(ospath, O_RDONLY);
+	if(fd < 0)
+	{
+		if(!db->loadFailed)
+			Com_PrintWarning("GeoIP: Can not open %s: %s\n", ospath, strerror(errno));
+		db->loadFailed = qtrue;
+		return qfalse;
 	}
+
+	if(fstat(fd, &fileinfo) != 0 || fileinfo.st_size < RECORD_LENGTH * 2)
+	{
+		close(fd);
+		if(!db->loadFailed)
+			Com_PrintWarning("GeoIP: %s is empty or not readable\n", ospath);
+		db->loadFailed = qtrue;
+		return qfalse;
+	}
+
+	mapped = mmap(NULL, fileinfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if(mapped == MAP_FAILED)
+	{
+		if(!db->loadFailed)
+			Com_PrintWarning("GeoIP: mmap of %s failed: %s\n", ospath, strerror(errno));
+		db->loadFailed = qtrue;
+		return qfalse;
+	}
+
+	db->data = mapped;
+	db->size = fileinfo.st_size;
+	db->mtime = fileinfo.st_mtime;
+
+	if(!_GeoIP_setup_segments(db, edition))
+	{
+		if(!db->loadFailed)
+			Com_PrintWarning("GeoIP: %s is no database of the expected edition\n", ospath);
+		_GeoIP_unload(db);
+		db->loadFailed = qtrue;
+		return qfalse;
+	}
+	db->loadFailed = qfalse;
+
+	Com_DPrintf("GeoIP: Loaded %s (%u bytes)\n", ospath, (unsigned int)db->size);
+	return qtrue;
+}
+
+/*
+Reloads the database if the file got replaced. Only stats the file from time to time
+*/
+static void _GeoIP_check_reload( geoipDatabase_t *db, int edition )
+{
+	unsigned int now;
+	char *ospath;
+	struct stat fileinfo;
+
+	if(geoipHolds > 0)
+		return;
+
+	now = Sys_Milliseconds();
+
+	if(db->lastReloadCheck != 0 && now - db->lastReloadCheck < GEOIP_RELOADCHECK_INTERVAL)
+		return;
+
+	db->lastReloadCheck = now;
+
+	if(db->data == NULL)
+	{
+		_GeoIP_load(db, edition);
+		return;
+	}
+
+	ospath = FS_SV_GetFilepath(db->filename);
+
+	if(ospath == NULL || stat(ospath, &fileinfo) != 0)
+		return; //Keep the old database
+
+	if(fileinfo.st_mtime != db->mtime || fileinfo.st_size != db->size)
+	{
+		Com_Printf("GeoIP: %s has changed, reloading\n", db->filename);
+		_GeoIP_load(db, edition);
+	}
+}
+
+/*
+Walks down the tree. Returns the record of the address which is db->segments or more,
+0 if the database is broken. Touches nothing but the mapping, no printing either
 */
-	unsigned int foffset;
+static unsigned int _GeoIP_traverse( const geoipDatabase_t *db, unsigned long ipnum ) {
 
+	int depth;
+	unsigned int x;
+	const unsigned char *buf;
+	unsigned int offset = 0;
+	size_t foffset;
+
+	const unsigned char * p;
+	int j;
 
 	for (depth = 31; depth >= 0; depth--) {
-		/* read from disk */
-		foffset = (long)RECORD_LENGTH * 2 *offset;
 
-		if(!FS_Seek(file, foffset, FS_SEEK_SET)){
-			FS_Read(stack_buffer , RECORD_LENGTH * 2, file);
-		}
+		foffset = (size_t)RECORD_LENGTH * 2 *offset;
+
+		if(foffset + RECORD_LENGTH * 2 > db->size)
+			break;
+
 		/* simply point to record in memory */
-//		buf = data + (long)RECORD_LENGTH * 2 *offset;
+		buf = db->data + foffset;
+
 		if (ipnum & (1 << depth)) {
 			/* Take the right-hand branch */
 			if ( RECORD_LENGTH == 3 ) {
@@ -122,19 +294,106 @@ unsigned int _GeoIP_seek_record ( unsigned long ipnum ) {
 			}
 		}
 
-		if (x >= BEGIN_OFFSET) {
+		if (x >= db->segments) {
 			//gi->netmask = gl->netmask = 32 - depth;
-			FS_FCloseFile(file);
-			return x - BEGIN_OFFSET;
+			return x;
 		}
 		offset = x;
 	}
 	/* shouldn't reach here */
-	Com_PrintError("Traversing Database for ipnum = %lu - Perhaps database is corrupt?\n",ipnum);
-	FS_FCloseFile(file);
 	return 0;
 }
 
+static unsigned int _GeoIP_country_index( const geoipDatabase_t *db, unsigned long ipnum ) {
+
+	unsigned int x;
+
+	if(db->data == NULL)
+		return 0;
+
+	x = _GeoIP_traverse(db, ipnum);
+	if(x < db->segments)
+		return 0;
+
+	return x - db->segments;
+}
+
+unsigned int _GeoIP_seek_record ( unsigned long ipnum ) {
+
+	geoipCacheEntry_t *entry;
+	unsigned int x;
+
+	_GeoIP_check_reload(&geoip, 0);
+
+	if(geoip.data == NULL){
+		return 0;
+	}
+
+	entry = &geoip.cache[(ipnum ^ (ipnum >> 16)) & (GEOIP_CACHE_SIZE -1)];
+
+	if(entry->valid && entry->ipnum == ipnum)
+		return entry->index;
+
+	x = _GeoIP_traverse(&geoip, ipnum);
+	if(x < geoip.segments){
+		Com_PrintError("Traversing Database for ipnum = %lu - Perhaps database is corrupt?\n",ipnum);
+		return 0;
+	}
+
+	entry->ipnum = ipnum;
+	entry->index = x - geoip.segments;
+	entry->valid = qtrue;
+	return entry->index;
+}
+
+/*
+Keeps both databases mapped until _GeoIP_release, _GeoIP_lookup can run on a worker thread
+meanwhile. Both have to be called on the main thread
+*/
+void _GeoIP_hold( void ) {
+
+	_GeoIP_check_reload(&geoip, 0);
+	_GeoIP_check_reload(&geoipASN, GEOIP_ASNUM_EDITION);
+	geoipHolds++;
+}
+
+void _GeoIP_release( void ) {
+
+	geoipHolds--;
+}
+
+/*
+Country index and the "AS<number> <organisation>" string of the address, an empty
+string if there is no ASN database. Thread safe between _GeoIP_hold and _GeoIP_release
+*/
+void _GeoIP_lookup( unsigned long ipnum, unsigned int *index, char *asn, int asnsize ) {
+
+	unsigned int x, len;
+	size_t pos;
+
+	*index = _GeoIP_country_index(&geoip, ipnum);
+	asn[0] = '\0';
+
+	if(geoipASN.data == NULL)
+		return;
+
+	x = _GeoIP_traverse(&geoipASN, ipnum);
+	if(x <= geoipASN.segments)
+		return;	//Exactly segments is no data
+
+	pos = x + (size_t)(2 * RECORD_LENGTH - 1) * geoipASN.segments;
+	if(pos >= geoipASN.size)
+		return;
+
+	for(len = 0; len < MAX_ORG_RECORD_LENGTH && pos + len < geoipASN.size && geoipASN.data[pos + len]; len++);
+
+	if(len >= asnsize)
+		len = asnsize -1;
+
+	memcpy(asn, geoipASN.data + pos, len);
+	asn[len] = '\0';
+}
+
 const char GeoIP_country_code[255][3] = { "--","AP","EU","AD","AE","AF","AG","AI","AL","AM","CW",
 	"AO","AQ","AR","AS","AT","AU","AW","AZ","BA","BB",
 	"BD","BE","BF","BG","BH","BI","BJ","BM","BN","BO",
@@ -311,4 +570,24 @@ const char* _GeoIP_continent_name ( unsigned int index ) {
     else
         return GeoIP_country_continent[index];
 
+}
+
+//Index of a two letter country code or -1
+int _GeoIP_country_index_by_code ( const char* code ) {
+
+    unsigned int i;
+
+    for(i = 0; i < num_GeoIP_countries; i++){
+        if(!Q_stricmp(GeoIP_country_code[i], code))
+            return i;
+    }
+    return -1;
+
+}
+
+//"A1" of the country database
+qboolean _GeoIP_is_anonymous_proxy ( unsigned int index ) {
+
+    return index < num_GeoIP_countries && !strcmp(GeoIP_country_code[index], "A1");
+
 }
\ No newline at end of file
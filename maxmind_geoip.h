@@ -26,4 +26,10 @@ unsigned int _GeoIP_seek_record ( unsigned long ipnum );
 const char* _GeoIP_country_code ( unsigned int index );
 const char* _GeoIP_country_code3 ( unsigned int index );
 const char* _GeoIP_country_name ( unsigned int index );
-const char* _GeoIP_continent_name ( unsigned int index );
\ No newline at end of file
+const char* _GeoIP_continent_name ( unsigned int index );
+qboolean _GeoIP_is_anonymous_proxy ( unsigned int index );
+int _GeoIP_country_index_by_code ( const char* code );
+
+void _GeoIP_hold( void );
+void _GeoIP_release( void );
+void _GeoIP_lookup( unsigned long ipnum, unsigned int *index, char *asn, int asnsize );
\ No newline at end of file
@@ -27,6 +27,7 @@
 #include "g_sv_shared.h"
 #include "punkbuster.h"
 #include "hl2rcon.h"
+#include "qcommon_redirect.h"
 
 char* SL_ConvertToString(unsigned int index)
 {
@@ -39,6 +40,7 @@ char* SL_ConvertToString(unsigned int index)
 
 void AddRedirectLocations()
 {
-    Com_AddRedirect(PbCapatureConsoleOutput_wrapper);
+    //PunkBuster collects the output of the commands it runs, that has to happen right away
+    Com_AddRedirect("punkbuster", PbCapatureConsoleOutput_wrapper, qfalse);
 
 }
\ No newline at end of file
@@ -24,6 +24,7 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <math.h>
 
 #include "msg.h"
@@ -32,6 +33,7 @@
 #include "qcommon_io.h"
 #include "net_game_conf.h"
 #include "huffman.h"
+#include "sys_thread.h"
 
 
 #ifndef	MAX_MSGLEN
@@ -80,6 +82,110 @@ void MSG_Init( msg_t *buf, byte *data, int length ) {
 	buf->maxsize = length;
 }
 
+/*
+==============================================================================
+
+Message buffer pool
+
+Backing storage for short lived messages. Buffers of three sizes are kept on free lists
+and come cache line aligned, so callers don't need MAX_MSGLEN on the stack. The pool
+grows to the number of buffers in use at the same time and never shrinks
+==============================================================================
+*/
+#define MSGBUFFER_HEADER 64			//Keeps the data on its own cache line
+#define MSGBUFFER_CRITSECTION 24
+
+typedef struct msgBufferHeader_s{
+	struct msgBufferHeader_s *next;
+	int tier;
+}msgBufferHeader_t;
+
+static struct{
+	const int		size;
+	msgBufferHeader_t	*freeList;
+	int			allocated;
+	int			inUse;
+	int			peak;
+	unsigned int		requests;
+}msg_bufferTiers[] = {
+	{ 0x800 },
+	{ 0x4000 },
+	{ MAX_MSGLEN }
+};
+
+#define NUM_MSGBUFFER_TIERS ( sizeof(msg_bufferTiers) / sizeof(msg_bufferTiers[0]) )
+
+byte *MSG_GetBuffer( int size ) {
+
+	msgBufferHeader_t *header;
+	int tier;
+
+	for(tier = 0; tier < NUM_MSGBUFFER_TIERS; tier++)
+	{
+		if(size <= msg_bufferTiers[tier].size)
+			break;
+	}
+
+	if(tier == NUM_MSGBUFFER_TIERS)
+		Com_Error(ERR_FATAL, "MSG_GetBuffer: %i bytes exceeds the largest buffer", size);
+
+	Sys_EnterCriticalSection(MSGBUFFER_CRITSECTION);
+
+	header = msg_bufferTiers[tier].freeList;
+	if(header)
+		msg_bufferTiers[tier].freeList = header->next;
+	else
+		msg_bufferTiers[tier].allocated++;
+
+	msg_bufferTiers[tier].requests++;
+	msg_bufferTiers[tier].inUse++;
+	if(msg_bufferTiers[tier].inUse > msg_bufferTiers[tier].peak)
+		msg_bufferTiers[tier].peak = msg_bufferTiers[tier].inUse;
+
+	Sys_LeaveCriticalSection(MSGBUFFER_CRITSECTION);
+
+	if(!header)
+	{
+		if(posix_memalign((void**)&header, MSGBUFFER_HEADER, MSGBUFFER_HEADER + msg_bufferTiers[tier].size))
+			Com_Error(ERR_FATAL, "MSG_GetBuffer: Out of memory");
+
+		header->tier = tier;
+	}
+	return (byte*)header + MSGBUFFER_HEADER;
+}
+
+void MSG_FreeBuffer( byte *data ) {
+
+	msgBufferHeader_t *header;
+
+	if(!data)
+		return;
+
+	header = (msgBufferHeader_t*)(data - MSGBUFFER_HEADER);
+
+	Sys_EnterCriticalSection(MSGBUFFER_CRITSECTION);
+
+	header->next = msg_bufferTiers[header->tier].freeList;
+	msg_bufferTiers[header->tier].freeList = header;
+	msg_bufferTiers[header->tier].inUse--;
+
+	Sys_LeaveCriticalSection(MSGBUFFER_CRITSECTION);
+}
+
+void MSG_BufferStatus_f( void ) {
+
+	int tier;
+
+	Com_Printf("    size allocated inuse  peak   requests\n");
+	Com_Printf("-------- --------- ----- ----- ----------\n");
+
+	for(tier = 0; tier < NUM_MSGBUFFER_TIERS; tier++)
+	{
+		Com_Printf("%8i %9i %5i %5i %10u\n", msg_bufferTiers[tier].size, msg_bufferTiers[tier].allocated,
+			msg_bufferTiers[tier].inUse, msg_bufferTiers[tier].peak, msg_bufferTiers[tier].requests);
+	}
+}
+
 void MSG_Clear( msg_t *buf ) {
 	buf->cursize = 0;
 	buf->overflowed = qfalse;
@@ -156,19 +262,35 @@ void MSG_WriteLong( msg_t *msg, int c ) {
 	msg->cursize += sizeof(int32_t);
 }
 
+//Writes as much as fits, same as writing it byte by byte
 void MSG_WriteData( msg_t *buf, const void *data, int length ) {
-	int i;
-	for(i=0; i < length; i++){
-		MSG_WriteByte(buf, ((byte*)data)[i]);
+	int room;
+
+	if ( length <= 0 ) {
+		return;
 	}
+
+	room = buf->maxsize - buf->cursize;
+
+	if ( length > room ) {
+		if ( room > 0 ) {
+			Com_Memcpy( &buf->data[buf->cursize], data, room );
+			buf->cursize += room;
+		}
+		buf->overflowed = qtrue;
+		return;
+	}
+
+	Com_Memcpy( &buf->data[buf->cursize], data, length );
+	buf->cursize += length;
 }
 
+//Server commands of all clients go through here, so the string is copied straight into the message
 void MSG_WriteString( msg_t *sb, const char *s ) {
 	if ( !s ) {
 		MSG_WriteData( sb, "", 1 );
 	} else {
 		int l;
-		char string[MAX_STRING_CHARS];
 
 		l = strlen( s );
 		if ( l >= MAX_STRING_CHARS ) {
@@ -176,9 +298,8 @@ void MSG_WriteString( msg_t *sb, const char *s ) {
 			MSG_WriteData( sb, "", 1 );
 			return;
 		}
-		Q_strncpyz( string, s, sizeof( string ) );
 
-		MSG_WriteData( sb, string, l + 1 );
+		MSG_WriteData( sb, s, l + 1 );
 	}
 }
 
@@ -187,7 +308,6 @@ void MSG_WriteBigString( msg_t *sb, const char *s ) {
 		MSG_WriteData( sb, "", 1 );
 	} else {
 		int l;
-		char string[BIG_INFO_STRING];
 
 		l = strlen( s );
 		if ( l >= BIG_INFO_STRING ) {
@@ -195,9 +315,8 @@ void MSG_WriteBigString( msg_t *sb, const char *s ) {
 			MSG_WriteData( sb, "", 1 );
 			return;
 		}
-		Q_strncpyz( string, s, sizeof( string ) );
 
-		MSG_WriteData( sb, string, l + 1 );
+		MSG_WriteData( sb, s, l + 1 );
 	}
 }
 
@@ -231,6 +350,69 @@ void MSG_WriteBit0( msg_t* msg )
 	return;
 }
 
+void MSG_WriteBit1( msg_t* msg )
+{
+	if(!((byte)msg->bit & 7)){
+		if(msg->maxsize <= msg->cursize){
+			msg->overflowed = qtrue;
+			return;
+		}
+		msg->bit = msg->cursize*8;
+		msg->data[msg->cursize] = 0;
+		msg->cursize ++;
+	}
+	msg->data[msg->bit >> 3] |= 1 << (msg->bit & 7);
+	msg->bit++;
+}
+
+/*
+The bit cursor keeps pointing into its last byte while whole bytes get appended, so only
+the remaining bits of that byte get filled up. All further bits always go into new bytes at the end
+of the message, so they get written a byte at a time instead of bit by bit
+*/
+void MSG_WriteBits( msg_t* msg, int value, int numBits )
+{
+	unsigned int	bits = value;
+	int		put;
+	int		numBytes;
+
+	if ( msg->maxsize - msg->cursize < 4 ) {
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	if ( numBits <= 0 ) {
+		return;
+	}
+
+	if ( msg->bit & 7 ) {
+		put = 8 - (msg->bit & 7);
+		if ( put > numBits ) {
+			put = numBits;
+		}
+		msg->data[msg->bit >> 3] |= (bits & ((1 << put) - 1)) << (msg->bit & 7);
+		msg->bit += put;
+		numBits -= put;
+		bits >>= put;
+
+		if ( !numBits ) {
+			return;
+		}
+	}
+
+	msg->bit = msg->cursize*8 + numBits;
+
+	for ( numBytes = (numBits + 7) >> 3; numBytes > 0; numBytes-- ) {
+		msg->data[msg->cursize] = (byte)bits;
+		msg->cursize++;
+		bits >>= 8;
+	}
+
+	if ( numBits & 7 ) {
+		msg->data[msg->cursize -1] &= (1 << (numBits & 7)) - 1;
+	}
+}
+
 /*
 void MSG_WriteBits(msg_t* msg, int value, int numBits )
 {
@@ -1664,6 +1846,302 @@ netFieldList_t netFieldList[] =
 
 
 
+/*
+Entity delta cache
+All clients which get a snapshot in the same frame compare their entities against the same new
+states, and clients which have acknowledged the same old state get exactly the same delta. The
+encoded delta (without the entity index which depends on the client's last referenced entity) is
+kept for the current snapshot time and copied into the messages of the next clients.
+Message bits get written into a partial byte while whole bytes get appended behind it, so the
+encoded bytes can only be reused at the same bit position inside the partial byte.
+Nothing but the encoded data is shared, MSG_WriteDeltaField() must not write anything depending
+on the client into the entity fields.
+*/
+#define DELTACACHE_WAYS 4
+#define MAX_DELTACACHE_BYTES 256
+
+typedef struct{
+	int		time;		//Snapshot time, 0 = unused
+	int		align;		//msg->bit & 7 before encoding, -1 = change detection only
+	int		lastChanged;
+	int		length;
+	int		bit;
+	entityState_t	from;
+	entityState_t	to;
+	byte		data[MAX_DELTACACHE_BYTES];
+}deltaCacheEntry_t;
+
+static deltaCacheEntry_t msg_deltaCache[MAX_GENTITIES][DELTACACHE_WAYS];
+static byte msg_deltaCacheNextWay[MAX_GENTITIES];
+
+//align -1 finds any entry with both states, fine for its lastChanged
+static deltaCacheEntry_t* MSG_FindDeltaCacheEntry(int time, entityState_t* from, entityState_t* to, int align)
+{
+	deltaCacheEntry_t *entry;
+	int i;
+
+	if(time == 0)
+		return NULL;
+
+	for(i = 0, entry = msg_deltaCache[to->number]; i < DELTACACHE_WAYS; i++, entry++)
+	{
+		if(entry->time != time || (align >= 0 && entry->align != align))
+			continue;
+
+		if(memcmp(&entry->to, to, sizeof(entityState_t)) || memcmp(&entry->from, from, sizeof(entityState_t)))
+			continue;
+
+		return entry;
+	}
+	return NULL;
+}
+
+static void MSG_StoreDeltaCacheEntry(int time, entityState_t* from, entityState_t* to, int align, int lastChanged, msg_t* encoded)
+{
+	deltaCacheEntry_t *entry;
+	int i;
+
+	if(time == 0 || (encoded && encoded->cursize > MAX_DELTACACHE_BYTES))
+		return;
+
+	//Entries from older snapshots get replaced first
+	for(i = 0, entry = msg_deltaCache[to->number]; i < DELTACACHE_WAYS; i++, entry++)
+	{
+		if(entry->time != time)
+			break;
+	}
+
+	if(i == DELTACACHE_WAYS)
+	{
+		entry = &msg_deltaCache[to->number][msg_deltaCacheNextWay[to->number]];
+		msg_deltaCacheNextWay[to->number] = (msg_deltaCacheNextWay[to->number] + 1) % DELTACACHE_WAYS;
+	}
+
+	entry->time = time;
+	entry->align = align;
+	entry->lastChanged = lastChanged;
+	entry->from = *from;
+	entry->to = *to;
+
+	if(encoded)
+	{
+		entry->length = encoded->cursize;
+		entry->bit = encoded->bit;
+		Com_Memcpy(entry->data, encoded->data, encoded->cursize);
+	}else{
+		entry->length = 0;
+		entry->bit = 0;
+	}
+}
+
+/*
+Appends data which got encoded into another msg_t starting at bit position (msg->bit & 7).
+If that was inside a partial byte, data[0] holds the bits which belong into it. bit is the
+bit cursor of the other msg_t after encoding
+*/
+void MSG_AppendEncoded(msg_t* msg, const byte* data, int length, int bit)
+{
+	int oldsize, partial, lastbyte;
+
+	partial = (msg->bit & 7) ? 1 : 0;
+	oldsize = msg->cursize;
+
+	if(msg->cursize + length - partial > msg->maxsize)
+	{
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	if(partial)
+		msg->data[msg->bit >> 3] |= data[0];
+
+	Com_Memcpy(&msg->data[msg->cursize], data + partial, length - partial);
+	msg->cursize += length - partial;
+
+	if(!(bit & 7))
+	{
+		msg->bit = msg->cursize * 8;	//The next bit starts a new byte anyway
+		return;
+	}
+
+	lastbyte = bit >> 3;
+
+	if(partial && lastbyte == 0)
+		msg->bit = (msg->bit & ~7) | (bit & 7);
+	else
+		msg->bit = (oldsize + lastbyte - partial) * 8 + (bit & 7);
+}
+
+/*
+Change detection plans
+
+The netfield tables never change, so every entity type gets a plan the first
+time it is sent: the word of entityState_t each field sits in and its field bits.
+One pass over the whole state finds all words which differ, SSE2 if the cpu has
+it. The fields get walked from the last one backwards and only those whose word
+differs get the float rounding of the encoder applied, the first which really
+changed gives the result. The encoders themselves are in the binary, this only
+decides how many fields get written.
+*/
+
+#define ENTITYSTATE_WORDS (sizeof(entityState_t) / 4)
+#define MAX_PLANFIELDS 64
+
+typedef struct{
+	int		numFields;		//-1 if the table can not be done with a plan
+	byte		word[MAX_PLANFIELDS];
+	short		bits[MAX_PLANFIELDS];
+}netFieldPlan_t;
+
+static netFieldPlan_t msg_entityPlans[sizeof(netFieldList) / sizeof(netFieldList[0])];
+static qboolean msg_entityPlansBuilt;
+
+//The word mask of MSG_EntityStateDiff has to hold all of them
+typedef char entityStateWordsFit_t[ENTITYSTATE_WORDS <= 64 ? 1 : -1];
+
+static void MSG_BuildEntityPlans( void )
+{
+	netFieldPlan_t* plan;
+	netField_t* field;
+	int i, j;
+
+	for(i = 0; i < sizeof(netFieldList) / sizeof(netFieldList[0]); i++)
+	{
+		plan = &msg_entityPlans[i];
+		plan->numFields = netFieldList[i].numFields;
+
+		if(plan->numFields > MAX_PLANFIELDS)
+		{
+			plan->numFields = -1;
+			continue;
+		}
+
+		for(j = 0, field = netFieldList[i].field; j < netFieldList[i].numFields; j++, field++)
+		{
+			if((field->offset & 3) || field->offset < 0 || field->offset >= sizeof(entityState_t))
+			{
+				plan->numFields = -1;
+				break;
+			}
+			plan->word[j] = field->offset / 4;
+			plan->bits[j] = field->bits;
+		}
+	}
+	msg_entityPlansBuilt = qtrue;
+}
+
+#ifdef Q_HAVE_SSE2
+#include <emmintrin.h>
+
+Q_SSE2 static int MSG_EntityStateDiffSSE2( const int* a, const int* b, uint64_t* mask ) {
+
+	__m128i eq;
+	int i;
+
+	for(i = 0; i + 4 <= ENTITYSTATE_WORDS; i += 4){
+		eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)&a[i]), _mm_loadu_si128((const __m128i*)&b[i]));
+		*mask |= (uint64_t)(~_mm_movemask_ps(_mm_castsi128_ps(eq)) & 15) << i;
+	}
+	return i;
+}
+#endif
+
+//Bit n is set if the n-th word of both states differs
+static uint64_t MSG_EntityStateDiff( const entityState_t* from, const entityState_t* to )
+{
+	const int* a = (const int*)from;
+	const int* b = (const int*)to;
+	uint64_t mask = 0;
+	int i = 0;
+
+#ifdef Q_HAVE_SSE2
+	if(Q_UseSSE2())
+		i = MSG_EntityStateDiffSSE2(a, b, &mask);
+#endif
+	for( ; i < ENTITYSTATE_WORDS; i++){
+		if(a[i] != b[i])
+			mask |= (uint64_t)1 << i;
+	}
+	return mask;
+}
+
+//The fields which differ in their bits only can still be sent as the same value
+static qboolean MSG_NetFieldChanged(int bits, int* fromF, int* toF)
+{
+	int var_01, var_02;
+	int swbits = bits +100;
+
+	switch(swbits){
+		case 8:
+		case 9:
+		case 10:
+			var_01 = (int)floorf(0.5f + *(float*)fromF);
+			var_02 = (int)floorf(0.5f + *(float*)toF);
+			return var_01 != var_02;
+
+		case 0:
+		case 13:
+
+			var_01 = (int)(182.044449f * (*(float*)fromF) + 0.5f);
+			var_02 = (int)(182.044449f * (*(float*)toF) + 0.5f);
+			return (short)var_01 != (short)var_02;
+
+
+		case 5:
+			//(*toF)(*fromF) * 0x51eb851f; This makes no sense
+
+			var_01 = swbits >> 5;
+			var_01 -= *fromF >> 31;
+
+			var_02 = swbits >> 5;
+			var_02 -= *toF >> 31;
+
+			return var_01 != var_02;
+
+		default:
+			return qtrue;
+	}
+}
+
+//Returns the number of fields up to the last one which has changed, mask is what MSG_EntityStateDiff gave
+static int MSG_DeltaEntityLastChanged(netFieldList_t* fieldtype, entityState_t* from, entityState_t* to, uint64_t mask)
+{
+	netFieldPlan_t* plan;
+	netField_t* field;
+	int i;
+	int *fromF, *toF;
+
+	if(!msg_entityPlansBuilt)
+		MSG_BuildEntityPlans();
+
+	plan = &msg_entityPlans[fieldtype - netFieldList];
+
+	if(plan->numFields < 0)
+	{
+		for(i = fieldtype->numFields -1, field = &fieldtype->field[i]; i >= 0; i--, field--){
+
+			fromF = ( int * )( (byte *)from + field->offset );
+			toF = ( int * )( (byte *)to + field->offset );
+
+			if ( *fromF != *toF && MSG_NetFieldChanged(field->bits, fromF, toF) ) {
+				return i +1;
+			}
+		}
+		return 0;
+	}
+
+	for(i = plan->numFields -1; i >= 0; i--){
+
+		if(!((mask >> plan->word[i]) & 1))
+			continue;
+
+		if(MSG_NetFieldChanged(plan->bits[i], (int*)from + plan->word[i], (int*)to + plan->word[i]))
+			return i +1;
+	}
+	return 0;
+}
+
+
 void MSG_WriteDeltaEntity(snapshotInfo_t* snap, msg_t* msg, int time, entityState_t* from, entityState_t* to, int arg_6){
 	// all fields should be 32 bits to avoid any compiler packing issues
 	// the "number" field is not part of the field list
@@ -1674,8 +2152,12 @@ void MSG_WriteDeltaEntity(snapshotInfo_t* snap, msg_t* msg, int time, entityStat
 	netFieldList_t* fieldtype;
 	netField_t* field;
 	int i, lc;
-	int *fromF, *toF;
-	int var_01, var_02;
+	entityState_t viewerTo;
+	deltaCacheEntry_t *entry;
+	msg_t scratch;
+	byte scratchData[MAX_DELTACACHE_BYTES * 4];
+	int align;
+	uint64_t mask;
 
 	if(!to){
 		MSG_WriteEntityIndex(snap, msg, from->number, 0x0a);
@@ -1683,18 +2165,21 @@ void MSG_WriteDeltaEntity(snapshotInfo_t* snap, msg_t* msg, int time, entityStat
 		return;
 	}
 
-	
-
-	if( to->number < 64){
+	//The solid bits depend on who is looking. "to" is shared by all clients which get this snapshot
+	//so work on a copy, otherwise whoever got his snapshot first decides for everyone after him
+	if( to->number < 64 && (to->solid & PLAYER_SOLIDMASK)){
 		if(g_entities[snap->clnum].client->sess.sessionTeam == TEAM_FREE){
 			if(!SV_FFAPlayerCanBlock()){
-				Com_Printf("Solid: %s\n", Q_BitConv(to->solid));
-				to->solid &= ~PLAYER_SOLIDMASK;
-
+				viewerTo = *to;
+				viewerTo.solid &= ~PLAYER_SOLIDMASK;
+				to = &viewerTo;
 			}
 
-		}else if(!SV_FriendlyPlayerCanBlock() && OnSameTeam( &g_entities[to->number], &g_entities[snap->clnum]))
-			to->solid &= ~PLAYER_SOLIDMASK;
+		}else if(!SV_FriendlyPlayerCanBlock() && OnSameTeam( &g_entities[to->number], &g_entities[snap->clnum])){
+			viewerTo = *to;
+			viewerTo.solid &= ~PLAYER_SOLIDMASK;
+			to = &viewerTo;
+		}
 	}
 
 
@@ -1714,93 +2199,88 @@ void MSG_WriteDeltaEntity(snapshotInfo_t* snap, msg_t* msg, int time, entityStat
 
 	fieldtype = &netFieldList[index];
 
-	if(fieldtype->numFields <= 0){
-		MSG_WriteDeltaEntity_EXIT2:
+	//Most entities have not changed at all since the last snapshot, no need to look them up
+	mask = MSG_EntityStateDiff(from, to);
+
+	if(!mask){
 		if(arg_6){
 			MSG_WriteEntityIndex(snap, msg, to->number, 10);
 			MSG_WriteBit0(msg);
 			MSG_WriteBit0(msg);
-//			MSG_GetUsedBitCount(msg);
 		}
 		return;
 	}
 
+	//Another client has already got the same change in this frame
+	entry = MSG_FindDeltaCacheEntry(time, from, to, -1);
 
-	for(i = 0, lc = 0, field = fieldtype->field; i < fieldtype->numFields; i++, field++){
-
-		fromF = ( int * )( (byte *)from + field->offset );
-		toF = ( int * )( (byte *)to + field->offset );
+	if(entry)
+	{
+		lc = entry->lastChanged;
+	}else{
+		lc = MSG_DeltaEntityLastChanged(fieldtype, from, to, mask);
+	}
 
-		if ( *fromF == *toF ) {
-			continue;
-		}
+	if(!lc){
+		if(!entry)
+			MSG_StoreDeltaCacheEntry(time, from, to, -1, 0, NULL);
 
-		int swbits = field->bits +100;
-
-		switch(swbits){
-			case 8:
-			case 9:
-			case 10:
-				var_01 = (int)floorf(0.5f + *(float*)fromF);
-				var_02 = (int)floorf(0.5f + *(float*)toF);
-				if(var_01 != var_02)
-				{
-					lc = i +1;
-				}
-				continue;
-
-			case 0:
-			case 13:
-
-				var_01 = (int)(182.044449f * (*(float*)fromF) + 0.5f);
-				var_02 = (int)(182.044449f * (*(float*)toF) + 0.5f);
-				if((short)var_01 != (short)var_02)
-				{
-					lc = i +1;
-				}
-				continue;
-
-
-			case 5:
-				//(*toF)(*fromF) * 0x51eb851f; This makes no sense
-
-				var_01 = swbits >> 5;
-				var_01 -= *fromF >> 31;
-
-				var_02 = swbits >> 5;
-				var_02 -= *toF >> 31;
-
-				if(var_01 != var_02)
-				{
-					lc = i +1;
-				}
-				continue;
-
-			default:
-			lc = i +1;
+		if(arg_6){
+			MSG_WriteEntityIndex(snap, msg, to->number, 10);
+			MSG_WriteBit0(msg);
+			MSG_WriteBit0(msg);
+//			MSG_GetUsedBitCount(msg);
 		}
+		return;
 	}
 
+	MSG_WriteEntityIndex(snap, msg, to->number, 10);
 
-	if(!lc)
-		goto MSG_WriteDeltaEntity_EXIT2;
+	//The index depends on what this client got before, the rest only on the states and the bit position
+	align = msg->bit & 7;
+	entry = MSG_FindDeltaCacheEntry(time, from, to, align);
 
+	if(entry)
+	{
+		MSG_AppendEncoded(msg, entry->data, entry->length, entry->bit);
+		return;
+	}
 
-	MSG_WriteEntityIndex(snap, msg, to->number, 10);
-	MSG_WriteBit0(msg);
-	MSG_WriteBit1(msg);
-	MSG_WriteBits(msg, lc, GetMinBitCount(fieldtype->numFields));
+	Com_Memset(&scratch, 0, sizeof(scratch));
+	scratch.data = scratchData;
+	scratch.maxsize = sizeof(scratchData);
+	scratch.lastRefEntity = msg->lastRefEntity;
+	if(align)
+	{
+		scratchData[0] = 0;
+		scratch.cursize = 1;
+		scratch.bit = align;
+	}else{
+		scratch.cursize = 0;
+		scratch.bit = 0;
+	}
+
+	MSG_WriteBit0(&scratch);
+	MSG_WriteBit1(&scratch);
+	MSG_WriteBits(&scratch, lc, GetMinBitCount(fieldtype->numFields));
 
-	if(lc > 0)
+	for(i = 0, field = fieldtype->field; i != lc; i++, field++)
 	{
-		for(i = 0, field = fieldtype->field; i != lc; i++, field++)
-		{
-			MSG_WriteDeltaField(snap, msg, time, (unsigned const char*)from, (unsigned const char*)to, field, i, 0);
-		}
+		MSG_WriteDeltaField(snap, &scratch, time, (unsigned const char*)from, (unsigned const char*)to, field, i, 0);
 	}
+
+	if(scratch.overflowed)
+	{
+		msg->overflowed = qtrue;
+		return;
+	}
+
+	MSG_StoreDeltaCacheEntry(time, from, to, align, lc, &scratch);
+	MSG_AppendEncoded(msg, scratch.data, scratch.cursize, scratch.bit);
 //	MSG_GetUsedBitCount(msg);
 }
 
+
 // using the stringizing operator to save typing...
 #define PSF( x ) # x,(int)&( (playerState_t*)0 )->x
 
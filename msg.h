@@ -60,7 +60,11 @@ struct usercmd_s;
 
 
 void MSG_Init( msg_t *buf, byte *data, int length ) ;
+void MSG_AppendEncoded( msg_t* msg, const byte* data, int length, int bit );
 void MSG_Clear( msg_t *buf ) ;
+byte *MSG_GetBuffer( int size );
+void MSG_FreeBuffer( byte *data );
+void MSG_BufferStatus_f( void );
 void MSG_BeginReading( msg_t *msg ) ;
 void MSG_Copy(msg_t *buf, byte *data, int length, msg_t *src);
 void MSG_WriteByte( msg_t *msg, int c ) ;
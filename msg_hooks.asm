@@ -46,13 +46,7 @@ global MSG_WriteEntityIndex
 MSG_WriteEntityIndex:
     jmp 0x813de54
 
-global MSG_WriteBit1
-MSG_WriteBit1:
-    jmp 0x81306dc
 
-global MSG_WriteBits
-MSG_WriteBits:
-    jmp 0x813061c
 
 global MSG_ReadDeltaUsercmdKey
 MSG_ReadDeltaUsercmdKey:
@@ -62,10 +56,6 @@ global MSG_SetDefaultUserCmd
 MSG_SetDefaultUserCmd:
     jmp 0x8130ad0
 
-global MSG_WriteBitsCompress
-MSG_WriteBitsCompress:
-    jmp 0x8130f3c
-
 global MSG_WriteReliableCommandToBuffer
 MSG_WriteReliableCommandToBuffer:
     jmp 0x813e162
\ No newline at end of file
@@ -24,16 +24,368 @@
 #include "q_shared.h"
 #include "qcommon.h"
 #include "qcommon_io.h"
+#include "qcommon_mem.h"
 #include "msg.h"
 #include "sys_net.h"
 #include "server.h"
 #include "net_game.h"
 #include "net_game_conf.h"
+#include "cmd.h"
+#include "cvar.h"
+#include "filesystem.h"
+#include "sys_main.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*
+=================
+Packet capture and replay
+
+"netcapture <file>" records every inbound UDP datagram with the time it came in.
+"netreplay <file> [speed]" feeds such a capture back into SV_PacketEvent at the
+recorded pace times speed, while the server runs as usual. Replayed packets come
+from NET_REPLAY_SOCK, whatever the server sends back to them gets counted and
+dropped in NET_SendPacket. Once the capture ran out the frame time, the outbound
+traffic and the cpu time used get printed.
+
+The clients of a capture got their challenges from another server instance.
+Replayed addresses skip the cookie check and the authorize server for that.
+
+File layout: "CD4XPCAP", int version, then for every packet
+unsigned long long usec since the start, netadr_t from, int len, data
+=================
+*/
+
+#define NETCAPTURE_MAGIC "CD4XPCAP"
+#define NETCAPTURE_VERSION 1
+#define NETCAPTURE_BUFSIZE 0x10000
+
+typedef struct{
+	unsigned long long	usec;
+	netadr_t		from;
+	int			len;
+}netCaptureRecord_t;
+
+static struct{
+	fileHandle_t		file;
+	unsigned long long	startUsec;
+	int			packets;
+	unsigned long long	bytes;
+	int			buflen;
+	byte			buf[NETCAPTURE_BUFSIZE];
+}netcapture;
+
+static struct{
+	qboolean		active;
+	char			filename[MAX_QPATH];
+	byte*			data;
+	int			size;
+	int			pos;
+	float			speed;
+	unsigned long long	startUsec;
+	struct rusage		startUsage;
+	int			packets;
+	unsigned long long	bytesIn;
+	unsigned long long	bytesOut;
+	int			packetsOut;
+	int			frames;
+	unsigned long long	frameUsec;	//Spent in the server frames
+	unsigned long long	frameUsecMax;
+	unsigned long long	packetUsec;	//Spent on the replayed packets
+}netreplay;
+
+
+static void NET_CaptureFlush( void )
+{
+	if(netcapture.buflen > 0)
+		FS_Write(netcapture.buf, netcapture.buflen, netcapture.file);
+	netcapture.buflen = 0;
+}
+
+static void NET_CaptureWrite( const void* data, int len )
+{
+	if(netcapture.buflen + len > NETCAPTURE_BUFSIZE)
+		NET_CaptureFlush();
+
+	if(len > NETCAPTURE_BUFSIZE)
+	{
+		FS_Write(data, len, netcapture.file);
+		return;
+	}
+	Com_Memcpy(netcapture.buf + netcapture.buflen, data, len);
+	netcapture.buflen += len;
+}
+
+static void NET_CapturePacket( netadr_t* from, void* data, int len )
+{
+	netCaptureRecord_t rec;
+
+	rec.usec = Sys_MicrosecondsLong() - netcapture.startUsec;
+	rec.from = *from;
+	rec.len = len;
+
+	NET_CaptureWrite(&rec, sizeof(rec));
+	NET_CaptureWrite(data, len);
+	netcapture.packets++;
+	netcapture.bytes += len;
+}
+
+static void NET_CaptureStop( void )
+{
+	if(!netcapture.file)
+		return;
+
+	NET_CaptureFlush();
+	FS_FCloseFile(netcapture.file);
+	netcapture.file = 0;
+
+	Com_Printf("Packet capture stopped after %d packets (%llu KB)\n", netcapture.packets, netcapture.bytes / 1024);
+}
+
+static void NET_Capture_f( void )
+{
+	int version = NETCAPTURE_VERSION;
+
+	if(Cmd_Argc() != 2)
+	{
+		Com_Printf("Usage: netcapture <filename | stop>\n");
+		return;
+	}
+
+	NET_CaptureStop();
+
+	if(!Q_stricmp(Cmd_Argv(1), "stop"))
+		return;
+
+	netcapture.file = FS_SV_FOpenFileWrite(Cmd_Argv(1));
+	if(!netcapture.file)
+	{
+		Com_PrintError("netcapture: Can not open %s for writing\n", Cmd_Argv(1));
+		return;
+	}
+	netcapture.buflen = 0;
+	netcapture.packets = 0;
+	netcapture.bytes = 0;
+	netcapture.startUsec = Sys_MicrosecondsLong();
+
+	NET_CaptureWrite(NETCAPTURE_MAGIC, 8);
+	NET_CaptureWrite(&version, sizeof(version));
+
+	Com_Printf("Capturing inbound packets to %s\n", Cmd_Argv(1));
+}
+
+
+void NET_ReplayPacketSent( int len )
+{
+	netreplay.packetsOut++;
+	netreplay.bytesOut += len;
+}
+
+static double NET_ReplayCpuSeconds( struct timeval* tv )
+{
+	return tv->tv_sec + tv->tv_usec / 1000000.0;
+}
+
+static void NET_ReplayStop( void )
+{
+	struct rusage usage;
+	client_t* cl;
+	double wall, cpuUser, cpuSys;
+	int i;
+
+	if(!netreplay.active)
+		return;
+
+	netreplay.active = qfalse;
+	free(netreplay.data);
+	netreplay.data = NULL;
+
+	wall = (Sys_MicrosecondsLong() - netreplay.startUsec) / 1000000.0;
+	getrusage(RUSAGE_SELF, &usage);
+	cpuUser = NET_ReplayCpuSeconds(&usage.ru_utime) - NET_ReplayCpuSeconds(&netreplay.startUsage.ru_utime);
+	cpuSys = NET_ReplayCpuSeconds(&usage.ru_stime) - NET_ReplayCpuSeconds(&netreplay.startUsage.ru_stime);
+	if(wall <= 0.0)
+		wall = 0.001;
+
+	Com_Printf("Replay of %s at %.2fx speed finished after %.2f seconds\n", netreplay.filename, netreplay.speed, wall);
+	Com_Printf("  inbound:  %d packets, %llu KB\n", netreplay.packets, netreplay.bytesIn / 1024);
+	Com_Printf("  outbound: %d packets, %llu KB, %.1f KB/s\n", netreplay.packetsOut, netreplay.bytesOut / 1024, netreplay.bytesOut / 1024.0 / wall);
+	if(netreplay.frames > 0)
+	{
+		Com_Printf("  frames:   %d, avg %.3f msec, max %.3f msec\n", netreplay.frames,
+			netreplay.frameUsec / 1000.0 / netreplay.frames, netreplay.frameUsecMax / 1000.0);
+		Com_Printf("  packets:  avg %.3f msec per frame\n", netreplay.packetUsec / 1000.0 / netreplay.frames);
+	}
+	Com_Printf("  cpu:      %.2f sec user, %.2f sec system, %.1f%% of one core\n", cpuUser, cpuSys, (cpuUser + cpuSys) * 100.0 / wall);
+
+	//The replayed clients would only time out otherwise
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(cl->state >= CS_CONNECTED && cl->netchan.remoteAddress.sock == NET_REPLAY_SOCK)
+			SV_DropClient(cl, "EXE_DISCONNECTED");
+	}
+}
+
+static void NET_Replay_f( void )
+{
+	fileHandle_t f;
+	int len, version;
+	float speed;
+
+	if(Cmd_Argc() < 2 || Cmd_Argc() > 3)
+	{
+		Com_Printf("Usage: netreplay <filename | stop> [speed]\n");
+		return;
+	}
+
+	NET_ReplayStop();
+
+	if(!Q_stricmp(Cmd_Argv(1), "stop"))
+		return;
+
+	speed = 1.0;
+	if(Cmd_Argc() == 3)
+		speed = atof(Cmd_Argv(2));
+	if(speed < 0.01 || speed > 1000.0)
+	{
+		Com_Printf("netreplay: speed has to be between 0.01 and 1000\n");
+		return;
+	}
+
+	len = FS_SV_FOpenFileRead(Cmd_Argv(1), &f);
+	if(!f)
+	{
+		Com_PrintError("netreplay: Can not open %s\n", Cmd_Argv(1));
+		return;
+	}
+	if(len < 8 + (int)sizeof(version))
+	{
+		FS_FCloseFile(f);
+		Com_PrintError("netreplay: %s is not a packet capture\n", Cmd_Argv(1));
+		return;
+	}
+
+	netreplay.data = malloc(len);
+	if(netreplay.data == NULL)
+	{
+		FS_FCloseFile(f);
+		Com_PrintError("netreplay: Out of memory for %d bytes\n", len);
+		return;
+	}
+	if(FS_Read(netreplay.data, len, f) != len)
+	{
+		FS_FCloseFile(f);
+		free(netreplay.data);
+		netreplay.data = NULL;
+		Com_PrintError("netreplay: Failed to read %s\n", Cmd_Argv(1));
+		return;
+	}
+	FS_FCloseFile(f);
+
+	Com_Memcpy(&version, netreplay.data + 8, sizeof(version));
+	if(memcmp(netreplay.data, NETCAPTURE_MAGIC, 8) || version != NETCAPTURE_VERSION)
+	{
+		free(netreplay.data);
+		netreplay.data = NULL;
+		Com_PrintError("netreplay: %s is not a packet capture of version %d\n", Cmd_Argv(1), NETCAPTURE_VERSION);
+		return;
+	}
+
+	Q_strncpyz(netreplay.filename, Cmd_Argv(1), sizeof(netreplay.filename));
+	netreplay.size = len;
+	netreplay.pos = 8 + sizeof(version);
+	netreplay.speed = speed;
+	netreplay.packets = 0;
+	netreplay.bytesIn = 0;
+	netreplay.bytesOut = 0;
+	netreplay.packetsOut = 0;
+	netreplay.frames = 0;
+	netreplay.frameUsec = 0;
+	netreplay.frameUsecMax = 0;
+	netreplay.packetUsec = 0;
+	netreplay.startUsec = Sys_MicrosecondsLong();
+	getrusage(RUSAGE_SELF, &netreplay.startUsage);
+	netreplay.active = qtrue;
+
+	Com_Printf("Replaying %s (%d KB) at %.2fx speed\n", netreplay.filename, len / 1024, speed);
+}
+
+/*
+=================
+NET_ReplayFrame
+
+Called after every server frame, feeds the packets which are due
+=================
+*/
+void NET_ReplayFrame( void )
+{
+	netCaptureRecord_t rec;
+	unsigned long long now, due, frameUsec;
+	static byte data[MAX_MSGLEN];
+
+	if(!netreplay.active)
+		return;
+
+	now = Sys_MicrosecondsLong();
+	frameUsec = now - com_uFrameTime;
+	netreplay.frames++;
+	netreplay.frameUsec += frameUsec;
+	if(frameUsec > netreplay.frameUsecMax)
+		netreplay.frameUsecMax = frameUsec;
+
+	due = (now - netreplay.startUsec) * netreplay.speed;
+
+	while(netreplay.pos + (int)sizeof(rec) <= netreplay.size)
+	{
+		Com_Memcpy(&rec, netreplay.data + netreplay.pos, sizeof(rec));
+		if(rec.usec > due)
+			break;
+
+		if(rec.len < 0 || rec.len > MAX_MSGLEN || netreplay.pos + (int)sizeof(rec) + rec.len > netreplay.size)
+		{
+			Com_PrintWarning("netreplay: %s is truncated\n", netreplay.filename);
+			netreplay.pos = netreplay.size;
+			break;
+		}
+		//SV_PacketEvent may write to the data, the capture stays as it is
+		Com_Memcpy(data, netreplay.data + netreplay.pos + sizeof(rec), rec.len);
+		netreplay.pos += sizeof(rec) + rec.len;
+
+		rec.from.sock = NET_REPLAY_SOCK;
+		netreplay.packets++;
+		netreplay.bytesIn += rec.len;
+		NET_UDPPacketEvent(&rec.from, data, rec.len);
+	}
+
+	netreplay.packetUsec += Sys_MicrosecondsLong() - now;
+
+	if(netreplay.pos + (int)sizeof(rec) > netreplay.size)
+		NET_ReplayStop();
+}
+
+void NET_CaptureInit( void )
+{
+	Cmd_AddCommand("netcapture", NET_Capture_f);
+	Cmd_AddCommand("netreplay", NET_Replay_f);
+}
+
+void NET_CaptureShutdown( void )
+{
+	NET_CaptureStop();
+}
+
 
 void NET_UDPPacketEvent(netadr_t* from, void* data, int len)
 {
 
         msg_t msg;
+
+        if(netcapture.file && from->sock != NET_REPLAY_SOCK)
+                NET_CapturePacket(from, data, len);
+
         msg.data = data;
         msg.cursize = len;
         msg.maxsize = len;
@@ -46,6 +398,26 @@ void NET_UDPPacketEvent(netadr_t* from, void* data, int len)
 }
 
 
+/*
+Runs on the query thread of sys_net.c. Whatever the query thread does not answer itself
+gets queued for the main thread
+*/
+void NET_QueryPacketEvent(netadr_t* from, void* data, int len)
+{
+        byte* event;
+
+        if(SV_QueryThreadPacket(from, data, len))
+                return;
+
+        event = Z_TagMalloc(sizeof(netadr_t) + len, TAG_EVENTS);
+        Com_Memcpy(event, from, sizeof(netadr_t));
+        Com_Memcpy(event + sizeof(netadr_t), data, len);
+
+        if(!Com_QueueEvent(0, SE_PACKET, 0, 0, sizeof(netadr_t) + len, event))
+                Z_Free(event);
+}
+
+
 unsigned int NET_TimeGetTime()
 {
         return (unsigned int)com_frameTime;
@@ -104,9 +476,9 @@ tcpclientstate_t NET_TCPAuthPacketEvent(netadr_t* from, byte* bufData, int len,
         msg.readonly = qtrue;
         msg.overflowed = qfalse;
 
-        Com_DPrintf("Packet event from: %s\n", NET_AdrToString(from));
+        Com_DPrintfChannel(DPRINT_NET, 1, "Packet event from: %s\n", NET_AdrToString(from));
 
-        for(i = 0; i < MAX_TCPEVENTS; i++)
+        for(i = 0; i < MAX_TCPEVENTS && tcpevents[i].tcpauthevent != NULL; i++)
         {
             ret = tcpevents[i].tcpauthevent(from, &msg, socketfd, connectionId);
             if(ret != TCP_AUTHNOTME)
@@ -115,7 +487,7 @@ tcpclientstate_t NET_TCPAuthPacketEvent(netadr_t* from, byte* bufData, int len,
                 return ret;
             }
         }
-        Com_DPrintf("^5Bad TCP-Packet from: %s\n", NET_AdrToString(from));
+        Com_DPrintfChannel(DPRINT_NET, 1, "^5Bad TCP-Packet from: %s\n", NET_AdrToString(from));
         return TCP_AUTHBAD; //Close connection
 }
 
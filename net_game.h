@@ -29,8 +29,14 @@
 #include "msg.h"
 
 void NET_UDPPacketEvent(netadr_t* from, void* data, int len);
+void NET_QueryPacketEvent(netadr_t* from, void* data, int len);
 unsigned int NET_TimeGetTime();
 
+void NET_CaptureInit( void );
+void NET_CaptureShutdown( void );
+void NET_ReplayFrame( void );
+void NET_ReplayPacketSent( int len );
+
 void NET_TCPConnectionClosed(netadr_t* adr, int sock, int connectionId, int serviceId);
 tcpclientstate_t NET_TCPAuthPacketEvent(netadr_t* remote, byte* bufData, int cursize, int sock, int* connectionId, int *serviceId);
 void NET_TCPPacketEvent(netadr_t* remote, byte* bufData, int cursize, int sock, int connectionId, int serviceId);
@@ -31,6 +31,7 @@
 #include "q_platform.h"
 #include "plugin_handler.h"
 #include "net_game_conf.h"
+#include "net_game.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -64,8 +65,6 @@ to the new value before sending out any replies.
 
 #define PACKET_HEADER           10          // two ints and a short
 
-#define FRAGMENT_BIT    ( 1 << 31 )
-
 cvar_t      *showpackets;
 cvar_t      *showdrop;
 cvar_t      *qport;
@@ -236,8 +235,10 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 		}
 
 		// copy the fragment to the fragment buffer
+		// the first 4 bytes are kept free for the sequence number so the completed
+		// message can be read straight from there
 		if ( fragmentLength < 0 || msg->readcount + fragmentLength > msg->cursize 
-			|| chan->fragmentLength + fragmentLength > chan->fragmentBufferSize) {
+			|| chan->fragmentLength + fragmentLength > chan->fragmentBufferSize - 4) {
 
 			if ( showdrop->boolean || showpackets->boolean ) {
 				Com_Printf( "%s:illegal fragment length: Current %i \n, fragmentLength"
@@ -246,7 +247,7 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 			return qfalse;
 		}
 
-		memcpy( chan->fragmentBuffer + chan->fragmentLength,	msg->data + msg->readcount, fragmentLength );
+		memcpy( chan->fragmentBuffer + 4 + chan->fragmentLength,	msg->data + msg->readcount, fragmentLength );
 
 		chan->fragmentLength += fragmentLength;
 
@@ -255,19 +256,15 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 			return qfalse;
 		}
 
-		if ( chan->fragmentLength > msg->maxsize ) {
-			Com_Printf( "%s:fragmentLength %i > msg->maxsize\n"
-					, NET_AdrToString( &chan->remoteAddress ),
-						chan->fragmentLength );
-			return qfalse;
-		}
-
-		// copy the full message over the partial fragment
+		// read the full message from the fragment buffer instead of copying it
+		// over the partial fragment. It stays untouched until the next fragmented
+		// message of this channel arrives
 
 		// make sure the sequence number is still there
-		*(int *)msg->data = LittleLong( sequence );
+		*(int *)chan->fragmentBuffer = LittleLong( sequence );
 
-		memcpy( msg->data + 4, chan->fragmentBuffer, chan->fragmentLength );
+		msg->data = chan->fragmentBuffer;
+		msg->maxsize = chan->fragmentBufferSize;
 		msg->cursize = chan->fragmentLength + 4;
 		chan->fragmentLength = 0;
 		msg->readcount = 4; // past the sequence number
@@ -297,22 +294,22 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 Netchan_TransmitNextFragment
 
 Send one fragment of the current message
+
+Bytes in front of the fragment have been sent already, so the packet header gets
+written over them and the datagram goes out straight from the unsent buffer.
+Only the first fragment has no room for that and is copied
 =================
 */
 qboolean Netchan_TransmitNextFragment( netchan_t *chan ) {
 	msg_t send;
 	qboolean sendsucc;
 	byte send_buf[MAX_PACKETLEN];
-	int fragmentLength;
+	int fragmentLength, headerLength;
 	qboolean var_01 = qfalse;
-	// write the packet header
-	MSG_Init( &send, send_buf, sizeof( send_buf ) );                // <-- only do the oob here
-
-	MSG_WriteLong( &send, chan->outgoingSequence | FRAGMENT_BIT );
 
-	// send the qport if we are a client
+	headerLength = 4 + 4 + 2;
 	if ( chan->sock == NS_CLIENT ) {
-		MSG_WriteShort( &send, qport->integer );
+		headerLength += 2;
 	}
 
 	// copy the reliable message to the packet first
@@ -322,9 +319,27 @@ qboolean Netchan_TransmitNextFragment( netchan_t *chan ) {
 		var_01 = qtrue;
 	}
 
+	// write the packet header
+	if ( chan->unsentFragmentStart >= headerLength ) {
+		MSG_Init( &send, chan->unsentBuffer + chan->unsentFragmentStart - headerLength, headerLength + fragmentLength );
+	} else {
+		MSG_Init( &send, send_buf, sizeof( send_buf ) );                // <-- only do the oob here
+	}
+
+	MSG_WriteLong( &send, chan->outgoingSequence | FRAGMENT_BIT );
+
+	// send the qport if we are a client
+	if ( chan->sock == NS_CLIENT ) {
+		MSG_WriteShort( &send, qport->integer );
+	}
+
 	MSG_WriteLong(&send, chan->unsentFragmentStart);
 	MSG_WriteShort( &send, fragmentLength );
-	MSG_WriteData( &send, chan->unsentBuffer + chan->unsentFragmentStart, fragmentLength );
+	if ( send.data == send_buf ) {
+		MSG_WriteData( &send, chan->unsentBuffer + chan->unsentFragmentStart, fragmentLength );
+	} else {
+		send.cursize += fragmentLength;
+	}
 
 	// send the datagram
 	sendsucc = NET_SendPacket( chan->sock, send.cursize, send.data, &chan->remoteAddress );
@@ -478,7 +493,7 @@ qboolean NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t *
 
 	qboolean returnNow = qfalse;
 
-	PHandler_Event(PLUGINS_ONUDPNETSEND, to, data, length, &returnNow);
+	PHandler_UdpNetSendEvent(to, data, length, &returnNow);
 
 	if(returnNow){
 		return qtrue;
@@ -498,6 +513,11 @@ qboolean NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t *
 	if ( to->type == NA_BAD ) {
 		return qfalse;
 	}
+	if ( NET_IsDiscardSock( to->sock ) ) {
+		if ( to->sock == NET_REPLAY_SOCK )
+			NET_ReplayPacketSent( length );
+		return qtrue;
+	}
 	return Sys_SendPacket( length, data, to );
 }
 
@@ -511,7 +531,9 @@ Sends a text message in an out-of-band datagram
 
 __cdecl void QDECL NET_OutOfBandPrint( netsrc_t sock, netadr_t *adr, const char *format, ... ) {
 	va_list		argptr;
-	char		string[MAX_MSGLEN];
+	char		*string;
+
+	string = (char*)MSG_GetBuffer( MAX_MSGLEN );
 
 	// set the header
 	string[0] = -1;
@@ -520,11 +542,12 @@ __cdecl void QDECL NET_OutOfBandPrint( netsrc_t sock, netadr_t *adr, const char
 	string[3] = -1;
 
 	va_start( argptr, format );
-	Q_vsnprintf( string+4, sizeof(string)-4, format, argptr );
+	Q_vsnprintf( string+4, MAX_MSGLEN-4, format, argptr );
 	va_end( argptr );
 
 	// send the datagram
 	NET_SendPacket( sock, strlen( string ), string, adr );
+	MSG_FreeBuffer( (byte*)string );
 }
 
 /*
@@ -535,10 +558,12 @@ Sends a data message in an out-of-band datagram (only used for "PbSvSendToClient
 ================
 */
 void NET_OutOfBandData( netsrc_t sock, netadr_t *adr, byte *format, int len ) {
-	byte string[MAX_MSGLEN];
+	byte *string;
 	int i;
 //	msg_t mbuf;
 
+	string = MSG_GetBuffer( MAX_MSGLEN );
+
 	// set the header
 	string[0] = 0xff;
 	string[1] = 0xff;
@@ -560,6 +585,7 @@ void NET_OutOfBandData( netsrc_t sock, netadr_t *adr, byte *format, int len ) {
 	// send the datagram
 	//NET_SendPacket( sock, mbuf.cursize, mbuf.data, adr );
 	NET_SendPacket( sock, i+4, string, adr );
+	MSG_FreeBuffer( string );
 }
 
 
@@ -43,6 +43,7 @@
 
 #define MAX_PACKETLEN           1400        // max size of a network packet
 #define FRAGMENT_SIZE           ( MAX_PACKETLEN - 100 )
+#define FRAGMENT_BIT            ( 1 << 31 )
 
 
 typedef struct{
@@ -21,6 +21,8 @@
 
 
 
+
+
 //Non volatile config
 //Changed settings will be written to / loaded from a file called nvconfig.cfg
 //If a nonvolatile setting is changed it is saved to that file immediately
@@ -31,20 +33,49 @@
 #include "cmd.h"
 #include "server.h"
 #include "hl2rcon.h"
+#include "sys_thread.h"
 
 #include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 
 #define MAX_NVCONFIG_SIZE 2048*128
+#define MAX_NVCONFIG_LINE 1024
+#define NVCONFIG_FILE "nvconfig.dat"
 
 #define NV_ProcessBegin NV_LoadConfig
 #define NV_ProcessEnd NV_WriteConfig
 
+/*
+The config gets generated into one buffer on the main thread and a worker thread writes it as
+a temporary file which is renamed over nvconfig.dat. Unchanged configs are not written at all.
+Loading waits for a write in progress and is skipped if the file is still the one we wrote or read.
+*/
+
+typedef struct{
+    char	*buffer;
+    int		length;
+    qboolean	failed;
+    char	path[MAX_OSPATH];
+    char	tmppath[MAX_OSPATH];
+}nvWriteJob_t;
+
+static nvWriteJob_t nvWriteJob;
+static qboolean nvWriteRunning;
+static char *nvPendingBuffer;		//Generated while a write was running
+static int nvPendingLength;
+static unsigned int nvWrittenHash;	//Content of the file as we know it
+static int nvWrittenLength;
+static qboolean nvFileKnown;
+static time_t nvFileMtime;
+static off_t nvFileSize;
+
 /*
 ================
 NV_ParseConfigLine
 ================
 */
-
 qboolean NV_ParseConfigLine(char* line, int linenumber){
 
     if(!Q_stricmp(Info_ValueForKey(line, "type") , "cmdMinPower")){
@@ -80,6 +111,139 @@ qboolean NV_ParseConfigLine(char* line, int linenumber){
 }
 
 
+static unsigned int NV_HashConfig(const char* buffer, int length){
+
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for(i = 0; i < length; i++)
+    {
+        hash ^= (unsigned char)buffer[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//Remembers which file we have in memory so it is not parsed again
+static void NV_StatConfig(){
+
+    struct stat st;
+    char* ospath;
+
+    ospath = FS_SV_GetFilepath(NVCONFIG_FILE);
+
+    if(ospath && stat(ospath, &st) == 0){
+        nvFileKnown = qtrue;
+        nvFileMtime = st.st_mtime;
+        nvFileSize = st.st_size;
+    }else{
+        nvFileKnown = qfalse;
+    }
+}
+
+static qboolean NV_ConfigChanged(){
+
+    struct stat st;
+    char* ospath;
+
+    if(!nvFileKnown)
+        return qtrue;
+
+    ospath = FS_SV_GetFilepath(NVCONFIG_FILE);
+
+    if(!ospath || stat(ospath, &st) != 0)
+        return qtrue;
+
+    return st.st_mtime != nvFileMtime || st.st_size != nvFileSize;
+}
+
+
+//Runs on a worker thread
+static void NV_WriteConfigJob(void* arg){
+
+    nvWriteJob_t *job = arg;
+    FILE *file;
+
+    file = fopen(job->tmppath, "wb");
+
+    if(!file){
+        job->failed = qtrue;
+        return;
+    }
+
+    if(fwrite(job->buffer, 1, job->length, file) != job->length)
+        job->failed = qtrue;
+
+    if(ferror(file) | fclose(file))
+        job->failed = qtrue;
+
+    if(job->failed || rename(job->tmppath, job->path) != 0){
+        job->failed = qtrue;
+        remove(job->tmppath);
+    }
+}
+
+static void NV_StartWriteJob(char* buffer, int length);
+
+static void NV_WriteConfigDone(void* arg){
+
+    nvWriteJob_t *job = arg;
+    char *buffer;
+
+    nvWriteRunning = qfalse;
+
+    free(job->buffer);
+    job->buffer = NULL;
+
+    if(job->failed){
+        Com_PrintError("Error Updating NVConfig: Can not write %s\n", job->path);
+        nvWrittenLength = -1; //Retry with the next write
+        nvFileKnown = qfalse;
+    }else{
+        NV_StatConfig();
+        Com_DPrintf("NV-Config Updated\n");
+    }
+
+    if(nvPendingBuffer){
+        buffer = nvPendingBuffer;
+        nvPendingBuffer = NULL;
+        NV_StartWriteJob(buffer, nvPendingLength);
+    }
+}
+
+static void NV_StartWriteJob(char* buffer, int length){
+
+    nvWriteJob_t *job = &nvWriteJob;
+
+    Com_Memset(job, 0, sizeof(nvWriteJob_t));
+
+    job->buffer = buffer;
+    job->length = length;
+
+    Q_strncpyz(job->path, FS_BuildOSPath( fs_homepath->string, NVCONFIG_FILE, "" ), sizeof(job->path));
+    job->path[strlen(job->path)-1] = '\0';
+    Com_sprintf(job->tmppath, sizeof(job->tmppath), "%s.tmp", job->path);
+
+    FS_CreatePath(job->path);
+
+    nvWrittenHash = NV_HashConfig(buffer, length);
+    nvWrittenLength = length;
+
+    nvWriteRunning = qtrue;
+    Sys_AddJob(NV_WriteConfigJob, NV_WriteConfigDone, job);
+}
+
+//Blocks until everything generated so far is on disk
+static void NV_FinishWrites(){
+
+    while(nvWriteRunning)
+    {
+        Sys_WaitForJobs();
+        Sys_RunCompletedJobs();
+    }
+}
+
+
 /*
 ================
 NV_LoadConfig
@@ -88,45 +252,80 @@ NV_LoadConfig
 
 void NV_LoadConfig(){
 
-    int read, i;
+    int i, length, linelen;
     int error = 0;
-    char buf[256];
-    *buf = 0;
+    char line[MAX_NVCONFIG_LINE];
+    const char *data, *end, *eol;
+    const byte *view;
+    char *buffer;
     fileHandle_t file;
 
+    NV_FinishWrites();
+
+    if(!NV_ConfigChanged()){
+        Com_DPrintf("nvconfig.dat is unchanged\n");
+        return;
+    }
+
     SV_RemoteCmdClearAdminList();
     HL2Rcon_ClearSourceRconAdminList();
 
-    FS_SV_FOpenFileRead("nvconfig.dat", &file);
+    length = FS_SV_FOpenFileRead(NVCONFIG_FILE, &file);
     if(!file){
         Com_DPrintf("Couldn't open nvconfig.dat for reading\n");
+        nvFileKnown = qfalse;
         return;
     }
     Com_Printf( "loading nvconfig.dat\n");
 
-    i = 0;
+    NV_StatConfig();
 
-    while(qtrue){
-        read = FS_ReadLine(buf,sizeof(buf),file);
-        if(read == 0){
-            FS_FCloseFile(file);
-            Com_Printf("Loaded nvconfig.dat %i errors\n", error);
-            return;
-        }
-        if(read == -1){
+    //Parse straight from the mapped file, read it in one go if that is not possible
+    buffer = NULL;
+    view = FS_AcquireFileView(file, &length);
+
+    if(view){
+        data = (const char*)view;
+    }else{
+        buffer = malloc(length +1);
+        if(!buffer || FS_Read(buffer, length, file) != length){
             Com_Printf("Can not read from nvconfig.dat\n");
+            free(buffer);
             FS_FCloseFile(file);
             return;
         }
-        i++;//linecouter
+        data = buffer;
+    }
+
+    end = data + length;
+
+    for(i = 1; data < end; i++, data = eol +1)
+    {
+        eol = memchr(data, '\n', end - data);
+        if(!eol)
+            eol = end;
 
-        if(!*buf || *buf == '/' || *buf == '\n'){
+        linelen = eol - data;
+        if(linelen >= sizeof(line))
+            linelen = sizeof(line) -1;
+
+        if(linelen < 1 || *data == '/' || *data == '\r'){
             continue;
         }
-        if(!NV_ParseConfigLine(buf, i)){
+        Com_Memcpy(line, data, linelen);
+        line[linelen] = '\0';
+
+        if(!NV_ParseConfigLine(line, i)){
             error++;
         }
     }
+
+    if(view)
+        FS_ReleaseFileView(view);
+    free(buffer);
+    FS_FCloseFile(file);
+
+    Com_Printf("Loaded nvconfig.dat %i errors\n", error);
 }
 
 /*
@@ -138,20 +337,35 @@ NV_WriteConfig
 void NV_WriteConfig(){
 
     char* buffer;
+    int length;
 
-    buffer = Hunk_AllocateTempMemory(MAX_NVCONFIG_SIZE);
+    buffer = malloc(MAX_NVCONFIG_SIZE);
     if(!buffer){
-        Com_Printf( "Error Updating NVConfig: Hunk_Alloc failed\n" );
+        Com_Printf( "Error Updating NVConfig: Out of memory\n" );
         return;
     }
-    Com_Memset(buffer,0,MAX_NVCONFIG_SIZE);
+    *buffer = 0;
     Q_strcat(buffer,MAX_NVCONFIG_SIZE,"//Autogenerated non volatile config settings\n");
 
     Cmd_WritePowerConfig( buffer, MAX_NVCONFIG_SIZE );
     SV_RemoteCmdWriteAdminConfig( buffer, MAX_NVCONFIG_SIZE );
     HL2Rcon_WriteAdminConfig( buffer, MAX_NVCONFIG_SIZE );
 
-    FS_SV_WriteFile("nvconfig.dat", buffer, strlen(buffer));
-    Hunk_FreeTempMemory( buffer );
-    Com_DPrintf("NV-Config Updated\n");
+    length = strlen(buffer);
+
+    //Nothing changed since the last write and nobody touched the file
+    if(nvPendingBuffer == NULL && length == nvWrittenLength && NV_HashConfig(buffer, length) == nvWrittenHash && (nvWriteRunning || !NV_ConfigChanged())){
+        free(buffer);
+        return;
+    }
+
+    if(nvWriteRunning){
+        //Gets written once the running write is done. Only the newest state matters
+        free(nvPendingBuffer);
+        nvPendingBuffer = buffer;
+        nvPendingLength = length;
+        return;
+    }
+
+    NV_StartWriteJob(buffer, length);
 }
@@ -83,7 +83,7 @@ P_P_F qboolean Plugin_ExportFunction(char *name, void *(*function)()){
         return qfalse;
     }
     if(name==NULL || function==NULL){
-        Com_DPrintf("Plugin_ExportFunction: Error - NULL argument! Plugin ID: %d.\n",pID);
+        Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugin_ExportFunction: Error - NULL argument! Plugin ID: %d.\n",pID);
         return qfalse; // Null argument!
     }
 
@@ -118,7 +118,7 @@ P_P_F void *Plugin_ImportFunction(char *pluginName, char *name){
         if(strncmp(pluginFunctions.plugins[i].name,pluginName,20)==0){
             for(j=0;j<pluginFunctions.plugins[i].exports;++j){
                 if(strncmp(pluginFunctions.plugins[i].exportedFunctions[j].name,name,PLUGIN_COM_MAXNAMELEN)==0){
-                    Com_DPrintf("^2Notice:^7 Plugin #%d imported plugin's #%d function \"%s\"\n.",pID,i,name);
+                    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "^2Notice:^7 Plugin #%d imported plugin's #%d function \"%s\"\n.",pID,i,name);
                     return pluginFunctions.plugins[i].exportedFunctions[j].function;
                 }
             }
@@ -47,6 +47,8 @@ enum PluginEvents{
     PLUGINS_ONSPAWNSERVER,
     PLUGINS_ONPREFASTRESTART,
     PLUGINS_ONPOSTFASTRESTART,
+    PLUGINS_ONTCPCLIENTCONNECT,
+    PLUGINS_ONFRAMEOVERRUN,
     PLUGINS_ITEMCOUNT
 
 };
@@ -22,6 +22,7 @@
 
 
 #include "plugin_handler.h"
+#include "maxmind_geoip.h"
 
 /*=========================================*
  *                                         *
@@ -59,6 +60,30 @@ P_P_F void Plugin_Free(void *ptr)
     }
     PHandler_Free(pID,ptr);
 }
+P_P_F int Plugin_SubmitJob(void (*job)(void*), void (*completion)(void*), void *arg)
+{
+    //Identify the calling plugin
+    volatile int pID = PHandler_CallerID();
+    if(pID<0){
+        Com_Printf("Plugins: Error! Tried submitting a job for unknown plugin!\n");
+        return -1;
+    }
+    if(job == NULL){
+        Com_PrintWarning("Plugins: Plugin #%d tried submitting a job without job function\n",pID);
+        return -1;
+    }
+    return PHandler_SubmitJob(pID,job,completion,arg);
+}
+P_P_F qboolean Plugin_JobDone(int handle)
+{
+    //Identify the calling plugin
+    volatile int pID = PHandler_CallerID();
+    if(pID<0){
+        Com_Printf("Plugins: Error! Tried querying a job for unknown plugin!\n");
+        return qtrue;
+    }
+    return PHandler_JobDone(pID,handle);
+}
 P_P_F void Plugin_Error(int code, char *string)
 {
     volatile int pID = PHandler_CallerID();
@@ -77,6 +102,138 @@ P_P_F clientScoreboard_t Plugin_GetClientScoreboard(int clientNum)
 {
     return level.clients[clientNum].pers.scoreboard;
 }
+/*
+Fills the whole snapshot with one call instead of a call per field and client.
+Returns the number of clients which are at least connected
+*/
+P_P_F int Plugin_GetPlayerSnapshot(pluginPlayerSnapshot_t *snap)
+{
+    client_t *cl;
+    gclient_t *gcl;
+    playerState_t *ps;
+    int i, connected;
+
+    if(!com_sv_running->boolean){
+        snap->numClients = 0;
+        return 0;
+    }
+
+    snap->numClients = sv_maxclients->integer;
+    if(snap->numClients > PLUGIN_SNAPSHOT_MAXCLIENTS)
+        snap->numClients = PLUGIN_SNAPSHOT_MAXCLIENTS;
+    snap->serverTime = svs.time;
+
+    for(i = 0, connected = 0, cl = svs.clients; i < snap->numClients; i++, cl++){
+
+        snap->state[i] = cl->state;
+
+        if(cl->state < CS_CONNECTED){
+            snap->team[i] = 0;
+            snap->ping[i] = 0;
+            snap->uid[i] = 0;
+            snap->score[i] = snap->kills[i] = snap->deaths[i] = snap->assists[i] = 0;
+            Com_Memset(snap->origin[i], 0, sizeof(snap->origin[i]));
+            Com_Memset(snap->viewangles[i], 0, sizeof(snap->viewangles[i]));
+            snap->name[i][0] = 0;
+            snap->guid[i][0] = 0;
+            continue;
+        }
+        connected++;
+
+        gcl = &level.clients[i];
+        snap->team[i] = gcl->sess.sessionTeam;
+        snap->ping[i] = cl->ping;
+        snap->uid[i] = cl->uid;
+        snap->score[i] = gcl->pers.scoreboard.score;
+        snap->kills[i] = gcl->pers.scoreboard.kills;
+        snap->deaths[i] = gcl->pers.scoreboard.deaths;
+        snap->assists[i] = gcl->pers.scoreboard.assists;
+
+        if(cl->state == CS_ACTIVE){
+            ps = SV_GameClientNum(i);
+            VectorCopy(ps->origin, snap->origin[i]);
+            VectorCopy(ps->viewangles, snap->viewangles[i]);
+        }else{
+            Com_Memset(snap->origin[i], 0, sizeof(snap->origin[i]));
+            Com_Memset(snap->viewangles[i], 0, sizeof(snap->viewangles[i]));
+        }
+        Q_strncpyz(snap->name[i], cl->name, sizeof(snap->name[i]));
+        Q_strncpyz(snap->guid[i], cl->pbguid, sizeof(snap->guid[i]));
+    }
+    return connected;
+}
+
+P_P_F qboolean Plugin_GetClientNetStats(unsigned int clientslot, pluginNetStats_t *stats)
+{
+    clientNetStats_t netstats;
+    client_t *cl;
+
+    if(!com_sv_running->boolean || clientslot >= sv_maxclients->integer)
+        return qfalse;
+
+    cl = &svs.clients[clientslot];
+    if(cl->state < CS_CONNECTED)
+        return qfalse;
+
+    SV_GetClientNetStats(cl, &netstats);
+    stats->ping = netstats.ping;
+    stats->mean = netstats.mean;
+    stats->p50 = netstats.p50;
+    stats->p95 = netstats.p95;
+    stats->jitter = netstats.jitter;
+    stats->samples = netstats.samples;
+    stats->loss = netstats.loss;
+    stats->received = netstats.received;
+    stats->lost = netstats.lost;
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_GetClientNetchanStats(unsigned int clientslot, pluginNetchanStats_t *stats)
+{
+    netchanStats_t netchanstats;
+    client_t *cl;
+
+    if(!com_sv_running->boolean || clientslot >= sv_maxclients->integer)
+        return qfalse;
+
+    cl = &svs.clients[clientslot];
+    if(cl->state < CS_CONNECTED)
+        return qfalse;
+
+    SV_GetNetchanStats(cl, &netchanstats);
+    stats->bytesIn = netchanstats.bytesIn;
+    stats->bytesOut = netchanstats.bytesOut;
+    stats->packetsIn = netchanstats.packetsIn;
+    stats->packetsOut = netchanstats.packetsOut;
+    stats->fragmentsIn = netchanstats.fragmentsIn;
+    stats->fragmentsOut = netchanstats.fragmentsOut;
+    stats->dropped = netchanstats.dropped;
+    stats->outOfOrder = netchanstats.outOfOrder;
+    stats->retransmits = netchanstats.retransmits;
+    stats->encodeUsec = netchanstats.encodeUsec;
+    return qtrue;
+}
+
+P_P_F qboolean Plugin_GetClientGeoInfo(unsigned int clientslot, pluginGeoInfo_t *info)
+{
+    geoInfo_t geoinfo;
+    client_t *cl;
+
+    if(!com_sv_running->boolean || clientslot >= sv_maxclients->integer)
+        return qfalse;
+
+    cl = &svs.clients[clientslot];
+    if(cl->state < CS_CONNECTED || !SV_GeoInfoForAddress(&cl->netchan.remoteAddress, &geoinfo))
+        return qfalse;
+
+    info->countryIndex = geoinfo.countryIndex;
+    Q_strncpyz(info->countryCode, _GeoIP_country_code(geoinfo.countryIndex), sizeof(info->countryCode));
+    Q_strncpyz(info->continentCode, _GeoIP_continent_name(geoinfo.countryIndex), sizeof(info->continentCode));
+    Q_strncpyz(info->asn, geoinfo.asn, sizeof(info->asn));
+    info->proxy = geoinfo.proxy;
+    return qtrue;
+}
+
 P_P_F int Plugin_Cmd_GetInvokerUid()
 {
     return SV_RemoteCmdGetInvokerUid();
@@ -114,12 +271,12 @@ P_P_F void Plugin_AddCommand(char *name, xcommand_t xcommand, int power)
     if(!pluginFunctions.plugins[pID].loaded){
         Com_PrintError("Tried adding a command for not loaded plugin! PID: %d.\n",pID);
     }
-    Com_DPrintf("Adding a plugin command for plugin %d, command name: %s.\n",pID,name);
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Adding a plugin command for plugin %d, command name: %s.\n",pID,name);
     Cmd_AddCommand(name,PHandler_CmdExecute_f);
     Cmd_SetPower(name, power);
     pluginFunctions.plugins[pID].cmd[pluginFunctions.plugins[pID].cmds].xcommand = xcommand;
     strcpy(pluginFunctions.plugins[pID].cmd[pluginFunctions.plugins[pID].cmds++].name,name);
-    Com_DPrintf("Command added.\n");
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Command added.\n");
    // pluginFunctions.plugins[pID].
 
 
@@ -334,3 +491,17 @@ P_P_F int Plugin_GetServerTime(void)
 {
     return svs.time;
 }
+
+P_P_F qboolean Plugin_SaveReplay(unsigned int clientslot, const char* basename)
+{
+    int PID = PHandler_CallerID();
+    if(clientslot >= sv_maxclients->integer)
+    {
+        PHandler_Error(PID,P_ERROR_DISABLE, va("Plugin tried to save the replay of bad client: %d\n", clientslot));
+        return qfalse;
+    }
+    if(basename == NULL || !*basename)
+        basename = va("replay_NA_%i_", clientslot);
+
+    return SV_SaveReplay(&svs.clients[clientslot], basename);
+}
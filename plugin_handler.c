@@ -23,6 +23,11 @@
 
 #include "plugin_handler.h"
 #include "elf32_parser.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+#include "qcommon_metrics.h"
+
+#include <sys/stat.h>
 
 /*=========================================*
  *                                         *
@@ -57,7 +62,9 @@ char PHandler_Events[PLUGINS_ITEMCOUNT][32]={
     "OnUdpNetSend",
     "OnSpawnServer",
     "OnPreFastRestart",
-    "OnPostFastRestart"
+    "OnPostFastRestart",
+    "OnTcpClientConnect",
+    "OnFrameOverrun"
 };
 
 void PHandler_Init() // Initialize the Plugin Handler's data structures and add commands
@@ -70,99 +77,195 @@ void PHandler_Init() // Initialize the Plugin Handler's data structures and add
 
     Cmd_AddCommand("loadPlugin", PHandler_LoadPlugin_f);
     Cmd_AddCommand("unloadPlugin", PHandler_UnLoadPlugin_f);
+    Cmd_AddCommand("reloadPlugin", PHandler_ReloadPlugin_f);
     Cmd_AddCommand("plugins", PHandler_PluginList_f);
     Cmd_AddCommand("pluginInfo", PHandler_PluginInfo_f);
+
+    static char* budgetActions[] = {"warn", "disable", NULL};
+    pluginFunctions.eventBudget = Cvar_RegisterInt("plugin_eventBudget", 0, 0, 1000000, 0, "Microseconds a plugin event callback may take. 0 disables the check");
+    pluginFunctions.eventBudgetAction = Cvar_RegisterEnum("plugin_eventBudgetAction", budgetActions, 0, 0, "What happens to a plugin which keeps exceeding plugin_eventBudget");
+    pluginFunctions.memoryLimit = Cvar_RegisterInt("plugin_memoryLimit", 0, 0, 0x400000, 0, "Kilobytes of memory each plugin may allocate. 0 is unlimited");
     
     Com_Printf("PHandler_Init: Plugins initialization successfull.\n");
 }
-void PHandler_Load(char* name, size_t size) // Load a plugin, safe for use
+/*
+ Checks the plugin file for functions plugins must not use. Returns the path of the file or
+ NULL if it can not be loaded
+*/
+/*
+Looks up the event callbacks of a freshly opened plugin. A plugin can export
+'unsigned int OnEventMask()' to tell which of its exported callbacks it really
+implements (bit n = event n), the C++ SDK needs that since it always emits all
+of its callbacks. Events outside the mask stay out of the event tables.
+*/
+static void PHandler_ResolveEvents(plugin_t *plugin, void *lib_handle)
 {
-    int i,j,nstrings;
-    char dll[256],*strings;
-    char* realpath;
-    void *lib_handle;
-    char *error;
-    elf_data_t text;
-    pluginInfo_t info;
+    unsigned int (*OnEventMask)();
+    unsigned int mask;
+    int i;
 
-        if(!pluginFunctions.enabled){
-            Com_Printf("Plugin handler is not initialized!\n");
-            return;
+    OnEventMask = dlsym(lib_handle, "OnEventMask");
+    mask = OnEventMask != NULL ? (*OnEventMask)() : 0xffffffff;
 
-        }
-    if(pluginFunctions.loadedPlugins>=MAX_PLUGINS-1){
-        Com_Printf("Too many plugins loaded.");
-        return;
+    for(i=0;i<PLUGINS_ITEMCOUNT;++i){
+        if(i != PLUGINS_ONINFOREQUEST && !(mask & (1 << i)))
+            plugin->OnEvent[i] = NULL;
+        else
+            plugin->OnEvent[i] = dlsym(lib_handle,PHandler_Events[i]);
     }
+    plugin->OnInfoRequest = plugin->OnEvent[PLUGINS_ONINFOREQUEST];
+}
 
-    if(size>128){
-        Com_Printf("File name too long.");
-        return;
-    }
-    Com_DPrintf("Checking if the plugin is not already loaded...\n");
-    //    Check if the plugin is not already loaded...
-    for(i=0;i<MAX_PLUGINS;i++){
-        if(strcmp(name,pluginFunctions.plugins[i].name)==0){
-            Com_Printf("This plugin is already loaded!\n");
-            return;
+/*
+Plugin files which passed PHandler_CheckPluginFile. Loading or hot swapping the same
+unchanged file again skips parsing it. The key is the inode and its mtime, a new
+build of the plugin never hits an old entry
+*/
+#define PLUGIN_CHECKCACHE_SIZE 32
+
+typedef struct{
+    dev_t       dev;
+    ino_t       ino;
+    time_t      mtime;
+    off_t       size;
+    elf_data_t  text;
+}pluginFileCheck_t;
+
+static pluginFileCheck_t PHandler_CheckCache[PLUGIN_CHECKCACHE_SIZE];
+static int PHandler_CheckCacheNext;
+
+static qboolean PHandler_CheckCacheFind(const struct stat *st, elf_data_t *text)
+{
+    pluginFileCheck_t *entry;
+    int i;
+
+    for(i = 0, entry = PHandler_CheckCache; i < PLUGIN_CHECKCACHE_SIZE; i++, entry++){
+        if(entry->size && entry->dev == st->st_dev && entry->ino == st->st_ino && entry->mtime == st->st_mtime && entry->size == st->st_size){
+            *text = entry->text;
+            return qtrue;
         }
     }
-    Com_DPrintf("Checking if the plugin file exists and is of correct format...\n");
-    sprintf(dll,"plugins/%s.so",name);
+    return qfalse;
+}
+
+static void PHandler_CheckCacheAdd(const struct stat *st, const elf_data_t *text)
+{
+    pluginFileCheck_t *entry;
+
+    entry = &PHandler_CheckCache[PHandler_CheckCacheNext];
+    PHandler_CheckCacheNext = (PHandler_CheckCacheNext + 1) % PLUGIN_CHECKCACHE_SIZE;
+
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtime;
+    entry->size = st->st_size;
+    entry->text = *text;
+}
+
+static char *PHandler_CheckPluginFile(const char *name, elf_data_t *text)
+{
+    int i,nstrings;
+    char dll[256],*strings;
+    char* realpath;
+    struct stat st;
+    qboolean cacheable;
+
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Checking if the plugin file exists and is of correct format...\n");
+    Com_sprintf(dll, sizeof(dll), "plugins/%s.so", name);
     //Additional test if a file is there
     realpath = FS_SV_GetFilepath( dll );
     if(realpath == NULL)
     {
         Com_Printf("No such file found: %s. Can not load this plugin.\n", dll);
-        return;
+        return NULL;
+    }
+    cacheable = stat(realpath, &st) == 0 && st.st_size > 0;
+    if(cacheable && PHandler_CheckCacheFind(&st, text)){
+        Com_DPrintfChannel(DPRINT_PLUGIN, 1, "%s has been checked before and is unchanged.\n", dll);
+        return realpath;
     }
     //Parse the pluginfile and extract function names string table
-    nstrings = ELF32_GetStrTable(realpath,&strings,&text);
+    nstrings = ELF32_GetStrTable(realpath,&strings,text);
     if(!nstrings){
         Com_Printf("%s is not a plugin file or is corrupt.\n",dll);
-        return;
+        return NULL;
     }
-    Com_DPrintf("Parsing plugin function names...\n");
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Parsing plugin function names...\n");
     --nstrings;
-    for(i = 0,j=0 ;i<nstrings;++i){
+    for(i = 0;i<nstrings;++i){
         if(strings[i]==0){
             if(strcmp(strings+i+1,"malloc")==0 || strcmp(strings+i+1,"calloc")==0 || strcmp(strings+i+1,"realloc")==0 || strcmp(strings+i+1,"free")==0 || strcmp(strings+i+1,"printf")==0 || strcmp(strings+i+1,"scanf")==0 ||  strcmp(strings+i+1,"free")==0){ // malloc, calloc, realloc, free, printf, scanf
                 Com_Printf("The plugin file contains one of the disallowed functions! Disallowed function name: \"%s\".\nPlease refer to the documentation for details.\nPlugin load failed.\n",strings+i+1);
                 
                 free(strings);
-                return;
+                return NULL;
             }
             if(strncmp(strings+i+1,"_Znaj",5)==0 || strncmp(strings+i+1,"_Znwj",5)==0){ // new and new[]
                 Com_Printf("The plugin file contains C++'s new operator which is forbidden.\nPlease refer to the documentation for details.\nPlugin load failed.\n");
                 free(strings);
-                return;
+                return NULL;
             }
         }
         else
         i+=strlen(strings+i+1);
     }
     free(strings);
-    Com_DPrintf("Done parsing plugin function names.\n");
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Done parsing plugin function names.\n");
+    if(cacheable)
+        PHandler_CheckCacheAdd(&st, text);
+    return realpath;
+}
+
+void PHandler_Load(char* name, size_t size) // Load a plugin, safe for use
+{
+    int i;
+    char* realpath;
+    void *lib_handle;
+    char *error;
+    elf_data_t text;
+    pluginInfo_t info;
+
+        if(!pluginFunctions.enabled){
+            Com_Printf("Plugin handler is not initialized!\n");
+            return;
+
+        }
+    if(pluginFunctions.loadedPlugins>=MAX_PLUGINS-1){
+        Com_Printf("Too many plugins loaded.");
+        return;
+    }
+
+    if(size>128){
+        Com_Printf("File name too long.");
+        return;
+    }
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Checking if the plugin is not already loaded...\n");
+    //    Check if the plugin is not already loaded...
+    for(i=0;i<MAX_PLUGINS;i++){
+        if(strcmp(name,pluginFunctions.plugins[i].name)==0){
+            Com_Printf("This plugin is already loaded!\n");
+            return;
+        }
+    }
+    realpath = PHandler_CheckPluginFile(name, &text);
+    if(realpath == NULL)
+        return;
     dlerror(); // Clear errors (if any) before loading the .so
-    Com_DPrintf("Loading the plugin .so...\n");
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Loading the plugin .so...\n");
     lib_handle = dlopen(realpath, RTLD_NOW);
     error = dlerror();
     if (!lib_handle || error != NULL){
-        Com_PrintError("Failed to load the plugin! Error string: '%s'.\n",dll,error);
+        Com_PrintError("Failed to load the plugin! Error string: '%s'.\n",error);
         return;
     }
-    Com_DPrintf("Plugin OK! Loading...\n");
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugin OK! Loading...\n");
     // find first free plugin slot
     for(i=0;i<MAX_PLUGINS;i++){
         if(!(pluginFunctions.plugins[i].loaded))
             break;
     }
     pluginFunctions.plugins[i].OnInit = dlsym(lib_handle, "OnInit");
-    for(j=0;j<PLUGINS_ITEMCOUNT;++j){
-        pluginFunctions.plugins[i].OnEvent[j] = dlsym(lib_handle,PHandler_Events[j]);
-    
-    }
-    pluginFunctions.plugins[i].OnInfoRequest = pluginFunctions.plugins[i].OnEvent[PLUGINS_ONINFOREQUEST];
+    PHandler_ResolveEvents(&pluginFunctions.plugins[i], lib_handle);
     
     pluginFunctions.plugins[i].OnUnload = dlsym(lib_handle, "OnUnload");
     
@@ -180,11 +283,13 @@ void PHandler_Load(char* name, size_t size) // Load a plugin, safe for use
         Com_Printf("Error loading plugin's OnInit function.\nPlugin load failed.\n");
         return;
     }
-    Com_DPrintf("Executing plugin's OnInit...\n");
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Executing plugin's OnInit...\n");
     if((*pluginFunctions.plugins[i].OnInit)(/*mainFunctions*/)<0){
         Com_Printf("Error in plugin's OnInit function!\nPlugin load failed.\n");
         pluginFunctions.plugins[i].loaded = qfalse;
         pluginFunctions.initializing_plugin = qfalse;
+        PHandler_CancelJobs(i);
+        PHandler_FreeAll(i);
         memset(pluginFunctions.plugins + i,0x00,sizeof(plugin_t));    // We need to remove all references so we can dlclose.
         dlclose(lib_handle);
         return;
@@ -197,7 +302,7 @@ void PHandler_Load(char* name, size_t size) // Load a plugin, safe for use
         pluginFunctions.plugins[i].lib_handle = lib_handle;
 
         if(pluginFunctions.plugins[i].OnInfoRequest){
-            Com_DPrintf("Fetching plugin information...\n");
+            Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Fetching plugin information...\n");
             (*pluginFunctions.plugins[i].OnInfoRequest)(&info);
             if(info.handlerVersion.major != PLUGIN_HANDLER_VERSION_MAJOR || info.handlerVersion.minor > PLUGIN_HANDLER_VERSION_MINOR || (info.handlerVersion.minor - PLUGIN_HANDLER_VERSION_MINOR) > 100){
                 Com_PrintError("^1ERROR:^7 This plugin might not be compatible with this server version! Requested plugin handler version: %d.%d, server's plugin handler version: %d.%d. Unloading the plugin...\n",info.handlerVersion.major,info.handlerVersion.minor, PLUGIN_HANDLER_VERSION_MAJOR,PLUGIN_HANDLER_VERSION_MINOR);
@@ -214,6 +319,7 @@ void PHandler_Load(char* name, size_t size) // Load a plugin, safe for use
             return;
 
         }
+        PHandler_RebuildEventTables();
         Com_Printf("Plugin %s loaded successfully. Server is currently running %d plugins.\n",pluginFunctions.plugins[i].name,pluginFunctions.loadedPlugins);
         return;
     }
@@ -239,19 +345,211 @@ void PHandler_Unload(int id) // Unload a plugin, safe for use.
         // Remove all server commands of the plugin
         for(i=0;i<pluginFunctions.plugins[id].cmds;i++){
             if(pluginFunctions.plugins[id].cmd[i].xcommand!=NULL){
-                Com_DPrintf("Removing command \"%s\"...\n",pluginFunctions.plugins[id].cmd[i].name);
+                Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Removing command \"%s\"...\n",pluginFunctions.plugins[id].cmd[i].name);
                 Cmd_RemoveCommand(pluginFunctions.plugins[id].cmd[i].name);
             }
 
         }
+        // Drop connects which are still in progress
+        for(i=0;i<PLUGIN_MAX_SOCKETS;i++){
+            if(pluginFunctions.plugins[id].sockets[i].connect.state != TCPCONNECT_IDLE)
+                NET_TcpClientConnectAbort(&pluginFunctions.plugins[id].sockets[i].connect);
+        }
+        PHandler_CancelJobs(id);                                            // Its job functions must not run after dlclose
+        PHandler_FreeAll(id);                                               // Release everything the plugin did not free itself
         lib_handle = pluginFunctions.plugins[id].lib_handle;                // Save the lib handle
         memset(&(pluginFunctions.plugins[id]), 0x00, sizeof(plugin_t));     // Wipe out all the data
         dlclose(lib_handle);                                                // Close the dll as there are no more references to it
         --pluginFunctions.loadedPlugins;
+        PHandler_RebuildEventTables();
     }else{
         Com_Printf("Tried unloading a not loaded plugin!\nPlugin ID: %d.",id);
     }
 }
+/*
+ Hot swap of a loaded plugin
+
+ The new version gets loaded from a copy of the file so the old library can stay open
+ until the new one is up. Both share the plugin slot, so memory, TCP connections and the
+ plugin ID are handed over as they are. The old version can pass additional state with
+ 'void *OnHotSwapSave(int *version)', the new one gets it in
+ 'void OnHotSwapRestore(void *state, int version)' after its OnInit. The state has to be
+ allocated with Plugin_Malloc. Plugins which export functions to other plugins or to
+ scripts can not be swapped, the same as they can't be unloaded
+*/
+static qboolean PHandler_CopyFile(const char *from, const char *to)
+{
+    FILE *in, *out;
+    char buf[8192];
+    size_t len;
+    qboolean success = qtrue;
+
+    in = fopen(from, "rb");
+    if(!in)
+        return qfalse;
+
+    out = fopen(to, "wb");
+    if(!out){
+        fclose(in);
+        return qfalse;
+    }
+
+    while((len = fread(buf, 1, sizeof(buf), in)) > 0){
+        if(fwrite(buf, 1, len, out) != len){
+            success = qfalse;
+            break;
+        }
+    }
+    if(ferror(in))
+        success = qfalse;
+
+    fclose(in);
+    if(fclose(out) != 0)
+        success = qfalse;
+
+    return success;
+}
+
+void PHandler_Reload(int id)
+{
+    static int swapCount;
+    plugin_t *plugin = &pluginFunctions.plugins[id];
+    char copypath[MAX_OSPATH];
+    char *realpath, *error;
+    void *lib_handle, *old_handle, *state;
+    void *(*OnHotSwapSave)(int*);
+    void (*OnHotSwapRestore)(void*, int);
+    int (*OnInit)();
+    void (*OnInfoRequest)();
+    elf_data_t text;
+    pluginInfo_t info;
+    int i, version, startTime;
+
+    if(!plugin->loaded){
+        Com_Printf("Tried reloading a not loaded plugin!\nPlugin ID: %d.\n",id);
+        return;
+    }
+    if(plugin->exports != 0 || plugin->scriptfunctions != 0 || plugin->scriptmethods != 0){
+        Com_PrintError("PHandler_Reload: Cannot swap a library or script-library plugin!\n");
+        return;
+    }
+    startTime = Sys_Milliseconds();
+
+    realpath = PHandler_CheckPluginFile(plugin->name, &text);
+    if(realpath == NULL)
+        return;
+
+    // dlopen would return the library which is already loaded for the same path
+    Com_sprintf(copypath, sizeof(copypath), "%s.swap%d", realpath, ++swapCount);
+    if(!PHandler_CopyFile(realpath, copypath)){
+        Com_PrintError("PHandler_Reload: Can not create %s\n", copypath);
+        remove(copypath);
+        return;
+    }
+
+    dlerror();
+    lib_handle = dlopen(copypath, RTLD_NOW);
+    error = dlerror();
+    remove(copypath);   // The library stays mapped
+    if(!lib_handle || error != NULL){
+        Com_PrintError("Failed to load the new plugin version! Error string: '%s'.\n",error);
+        if(lib_handle)
+            dlclose(lib_handle);
+        return;
+    }
+
+    OnInit = dlsym(lib_handle, "OnInit");
+    OnInfoRequest = dlsym(lib_handle, PHandler_Events[PLUGINS_ONINFOREQUEST]);
+    OnHotSwapRestore = dlsym(lib_handle, "OnHotSwapRestore");
+    dlerror();
+
+    if(OnInit == NULL || OnInfoRequest == NULL){
+        Com_PrintError("The new plugin version lacks OnInit or OnInfoRequest. Keeping the old one.\n");
+        dlclose(lib_handle);
+        return;
+    }
+    (*OnInfoRequest)(&info);
+    if(info.handlerVersion.major != PLUGIN_HANDLER_VERSION_MAJOR || info.handlerVersion.minor > PLUGIN_HANDLER_VERSION_MINOR || (info.handlerVersion.minor - PLUGIN_HANDLER_VERSION_MINOR) > 100){
+        Com_PrintError("^1ERROR:^7 The new plugin version might not be compatible with this server version! Requested plugin handler version: %d.%d. Keeping the old one.\n",info.handlerVersion.major,info.handlerVersion.minor);
+        dlclose(lib_handle);
+        return;
+    }
+
+    // Completions of pending jobs still belong to the old code
+    if(plugin->pendingJobs > 0){
+        Sys_WaitForJobs();
+        Sys_RunCompletedJobs();
+    }
+
+    // Let the old version save what it wants to keep
+    state = NULL;
+    version = 0;
+    old_handle = plugin->lib_handle;
+    OnHotSwapSave = dlsym(old_handle, "OnHotSwapSave");
+    dlerror();
+
+    if(OnHotSwapSave != NULL)
+        state = (*OnHotSwapSave)(&version);
+    else if(plugin->OnUnload != NULL)
+        (*plugin->OnUnload)();
+
+    PHandler_CancelJobs(id);
+
+    for(i=0;i<plugin->cmds;i++){
+        if(plugin->cmd[i].xcommand!=NULL)
+            Cmd_RemoveCommand(plugin->cmd[i].name);
+    }
+    Com_Memset(plugin->cmd, 0, sizeof(plugin->cmd));
+    plugin->cmds = 0;
+
+    // Swap the code, everything else of the slot stays
+    plugin->OnInit = OnInit;
+    PHandler_ResolveEvents(plugin, lib_handle);
+    plugin->OnUnload = dlsym(lib_handle, "OnUnload");
+    dlerror();
+
+    Com_Memset(plugin->eventStats, 0, sizeof(plugin->eventStats));
+    plugin->budgetStrikes = 0;
+    plugin->lib_handle = lib_handle;
+    plugin->lib_start = LIBRARY_ADDRESS_BY_HANDLE(lib_handle) + text.offset;
+    plugin->lib_size = text.size;
+
+    pluginFunctions.initializing_plugin = qtrue;
+    if((*plugin->OnInit)() < 0){
+        pluginFunctions.initializing_plugin = qfalse;
+        Com_PrintError("Error in OnInit of the new plugin version! The plugin has been unloaded.\n");
+        for(i=0;i<plugin->cmds;i++){
+            if(plugin->cmd[i].xcommand!=NULL)
+                Cmd_RemoveCommand(plugin->cmd[i].name);
+        }
+        for(i=0;i<PLUGIN_MAX_SOCKETS;i++){
+            if(plugin->sockets[i].connect.state != TCPCONNECT_IDLE)
+                NET_TcpClientConnectAbort(&plugin->sockets[i].connect);
+        }
+        PHandler_CancelJobs(id);
+        PHandler_FreeAll(id);
+        memset(plugin, 0x00, sizeof(plugin_t));
+        dlclose(lib_handle);
+        dlclose(old_handle);
+        --pluginFunctions.loadedPlugins;
+        PHandler_RebuildEventTables();
+        return;
+    }
+    pluginFunctions.initializing_plugin = qfalse;
+
+    if(OnHotSwapRestore != NULL)
+        (*OnHotSwapRestore)(state, version);
+    else if(state != NULL)
+        Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugin %s saved state for the swap but the new version does not take it\n", plugin->name);
+
+    dlclose(old_handle);
+
+    // Events get dispatched from this thread only, so the new handlers take effect as one
+    PHandler_RebuildEventTables();
+
+    Com_Printf("Plugin %s swapped in %d msec.\n", plugin->name, Sys_Milliseconds() - startTime);
+}
+
 int PHandler_GetID(char *name, size_t size) // Get ID of a plugin by name, safe for use
 {
     int i;
@@ -277,15 +575,94 @@ void PHandler_UnloadByName(char *name, size_t size) // Unload a plugin, safe for
 }
 
 
-void PHandler_Event(int eventID,...) // Fire a plugin event, safe for use
+/*
+ Calls the handler and books the time it took for pluginInfo. A plugin which misses
+ plugin_eventBudget PLUGIN_BUDGET_STRIKES times in a row gets warned about or disabled
+*/
+static void PHandler_CallEvent(int pID, int eventID, void *arg_0, void *arg_1, void *arg_2, void *arg_3, void *arg_4, void *arg_5)
 {
-    int i=0;
+    plugin_t *plugin = &pluginFunctions.plugins[pID];
+    pluginEventStats_t *stats = &plugin->eventStats[eventID];
+    unsigned long long start;
+    unsigned int usec;
 
-    if(!pluginFunctions.enabled)
-            return;
+    start = Sys_MicrosecondsLong();
+    (*plugin->OnEvent[eventID])(arg_0, arg_1, arg_2, arg_3, arg_4, arg_5);
+    usec = Sys_MicrosecondsLong() - start;
+
+    if(!plugin->loaded)
+        return; //Unloaded itself
+
+    stats->calls++;
+    stats->usec += usec;
+    if(usec > stats->maxusec)
+        stats->maxusec = usec;
+
+    if(!pluginFunctions.eventBudget->integer)
+        return;
+
+    if(usec <= pluginFunctions.eventBudget->integer){
+        plugin->budgetStrikes = 0;
+        return;
+    }
+
+    stats->overruns++;
+    if(++plugin->budgetStrikes < PLUGIN_BUDGET_STRIKES)
+        return;
+
+    plugin->budgetStrikes = 0;
+
+    if(pluginFunctions.eventBudgetAction->integer == 1){
+        Com_PrintWarning("Plugin #%d ('%s') exceeded plugin_eventBudget of %d usec %d times in a row and will be disabled. Last event: %s took %u usec\n",
+            pID, plugin->name, pluginFunctions.eventBudget->integer, PLUGIN_BUDGET_STRIKES, PHandler_Events[eventID], usec);
+        plugin->enabled = qfalse;
+        PHandler_RebuildEventTables();
+    }else{
+        Com_PrintWarning("Plugin #%d ('%s') exceeded plugin_eventBudget of %d usec %d times in a row. Last event: %s took %u usec\n",
+            pID, plugin->name, pluginFunctions.eventBudget->integer, PLUGIN_BUDGET_STRIKES, PHandler_Events[eventID], usec);
+    }
+}
+
+/*
+ Collects for every event the enabled plugins which handle it, so firing an event
+ touches only its subscribers. Call it whenever a plugin gets loaded, unloaded or disabled
+*/
+void PHandler_RebuildEventTables(void)
+{
+    int i, j;
+    pluginEventTable_t *table;
+
+    for(j = 0; j < PLUGINS_ITEMCOUNT; j++){
+
+        table = &pluginFunctions.eventTables[j];
+        table->count = 0;
+
+        if(!pluginFunctions.enabled || j == PLUGINS_ONINFOREQUEST)
+            continue;
+
+        for(i = 0; i < MAX_PLUGINS; i++){
+            if(pluginFunctions.plugins[i].loaded && pluginFunctions.plugins[i].enabled && pluginFunctions.plugins[i].OnEvent[j] != NULL)
+                table->plugins[table->count++] = i;
+        }
+    }
+}
+
+/*
+ A handler can unload or disable plugins, so a copy of the table gets walked
+ and every plugin is checked again right before it gets called
+*/
+#define PHANDLER_FOREACH_SUBSCRIBER(eventID, pID) \
+    pluginEventTable_t subscribers = pluginFunctions.eventTables[eventID]; \
+    int subscriber; \
+    for(subscriber = 0; subscriber < subscribers.count; subscriber++) \
+        if((pID = subscribers.plugins[subscriber]), pluginFunctions.plugins[pID].enabled && pluginFunctions.plugins[pID].OnEvent[eventID] != NULL)
+
+void PHandler_DispatchEvent(int eventID,...) // Fire a plugin event, safe for use
+{
+    int pID;
 
     if(eventID < 0 || eventID >= PLUGINS_ITEMCOUNT){
-        Com_DPrintf("Plugins: unknown event occured! Event ID: %d.\n",eventID);
+        Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugins: unknown event occured! Event ID: %d.\n",eventID);
         return;
     }
 
@@ -301,10 +678,24 @@ void PHandler_Event(int eventID,...) // Fire a plugin event, safe for use
 
     va_end(argptr);
 
-    for(i=0;i < pluginFunctions.loadedPlugins; i++){
-        if(pluginFunctions.plugins[i].OnEvent[eventID]!= NULL)
-            (*pluginFunctions.plugins[i].OnEvent[eventID])(arg_0, arg_1, arg_2, arg_3, arg_4, arg_5);
-    }
+    PHANDLER_FOREACH_SUBSCRIBER(eventID, pID)
+        PHandler_CallEvent(pID, eventID, arg_0, arg_1, arg_2, arg_3, arg_4, arg_5);
+}
+
+void PHandler_DispatchFrameEvent(void)
+{
+    int pID;
+
+    PHANDLER_FOREACH_SUBSCRIBER(PLUGINS_ONFRAME, pID)
+        PHandler_CallEvent(pID, PLUGINS_ONFRAME, NULL, NULL, NULL, NULL, NULL, NULL);
+}
+
+void PHandler_DispatchUdpNetSendEvent(netadr_t *to, const void *data, int len, qboolean *returnNow)
+{
+    int pID;
+
+    PHANDLER_FOREACH_SUBSCRIBER(PLUGINS_ONUDPNETSEND, pID)
+        PHandler_CallEvent(pID, PLUGINS_ONUDPNETSEND, to, (void*)data, (void*)len, returnNow, NULL, NULL);
 }
 
 
@@ -356,6 +747,61 @@ void PHandler_ScrRemoveFunction(int pID,char *name)
 }
 */
 
+/*
+Event time of the loaded plugins, summed over all their events
+*/
+void PHandler_WriteMetrics( metricsBuf_t* buf )
+{
+    plugin_t *plugin;
+    pluginEventStats_t totals[MAX_PLUGINS];
+    int i, j;
 
+    Com_Memset(totals, 0, sizeof(totals));
 
+    for(i = 0, plugin = pluginFunctions.plugins; i < MAX_PLUGINS; i++, plugin++)
+    {
+        for(j = 0; j < PLUGINS_ITEMCOUNT && plugin->loaded; j++)
+        {
+            totals[i].calls += plugin->eventStats[j].calls;
+            totals[i].usec += plugin->eventStats[j].usec;
+            totals[i].overruns += plugin->eventStats[j].overruns;
+            if(plugin->eventStats[j].maxusec > totals[i].maxusec)
+                totals[i].maxusec = plugin->eventStats[j].maxusec;
+        }
+    }
 
+    Metrics_Declare(buf, "cod4x_plugin_event_seconds_total", "counter", "Time plugins spent in their event callbacks");
+    for(i = 0, plugin = pluginFunctions.plugins; i < MAX_PLUGINS; i++, plugin++)
+    {
+        if(plugin->loaded)
+            Metrics_Printf(buf, "cod4x_plugin_event_seconds_total{plugin=\"%s\"} %.6f\n", plugin->name, totals[i].usec / 1000000.0);
+    }
+
+    Metrics_Declare(buf, "cod4x_plugin_event_calls_total", "counter", "Event callbacks into plugins");
+    for(i = 0, plugin = pluginFunctions.plugins; i < MAX_PLUGINS; i++, plugin++)
+    {
+        if(plugin->loaded)
+            Metrics_Printf(buf, "cod4x_plugin_event_calls_total{plugin=\"%s\"} %u\n", plugin->name, totals[i].calls);
+    }
+
+    Metrics_Declare(buf, "cod4x_plugin_event_overruns_total", "counter", "Event callbacks which took longer than plugin_eventBudget");
+    for(i = 0, plugin = pluginFunctions.plugins; i < MAX_PLUGINS; i++, plugin++)
+    {
+        if(plugin->loaded)
+            Metrics_Printf(buf, "cod4x_plugin_event_overruns_total{plugin=\"%s\"} %u\n", plugin->name, totals[i].overruns);
+    }
+
+    Metrics_Declare(buf, "cod4x_plugin_event_max_seconds", "gauge", "Longest event callback of the plugin");
+    for(i = 0, plugin = pluginFunctions.plugins; i < MAX_PLUGINS; i++, plugin++)
+    {
+        if(plugin->loaded)
+            Metrics_Printf(buf, "cod4x_plugin_event_max_seconds{plugin=\"%s\"} %.6f\n", plugin->name, totals[i].maxusec / 1000000.0);
+    }
+
+    Metrics_Declare(buf, "cod4x_plugin_memory_bytes", "gauge", "Memory the plugin allocated through the server");
+    for(i = 0, plugin = pluginFunctions.plugins; i < MAX_PLUGINS; i++, plugin++)
+    {
+        if(plugin->loaded)
+            Metrics_Printf(buf, "cod4x_plugin_memory_bytes{plugin=\"%s\"} %u\n", plugin->name, (unsigned int)plugin->usedMem);
+    }
+}
@@ -52,17 +52,24 @@ typedef void convariable_t; //For plugins
 #include "qcommon_io.h" // Com_Printf
 #include "server.h"     // client_t
 #include "sys_net.h"    // Tcp stuff
+#include "cvar.h"       // cvar_t
+#include "qcommon_mem.h" // Z_TagMalloc
 
 #include "plugins/plugin_declarations.h"
 #include "plugin_events.h"
 
-#define PLUGIN_MAX_MALLOCS 50
+#define PLUGIN_ARENA_CHUNK 0x10000   // Small allocations of a plugin are carved from chunks of this size
+#define PLUGIN_ARENA_CLASSES 9      // 16 to 4096 bytes, bigger blocks get allocated on their own
 #define PLUGIN_MAX_SOCKETS 4
 
 // plugins com
 #define PLUGIN_COM_MAXNAMELEN 28    // Max 27 chars + \0
 #define PLUGIN_MAX_EXPORTS 50       // Maximum count of exported functions, each takes 32B of mem = 1kB per plugin
 
+#define PLUGIN_BUDGET_STRIKES 10    // Overruns in a row until plugin_eventBudgetAction applies
+
+#define PLUGIN_MAX_JOBS 128         // Jobs of all plugins which are queued, running or waiting for completion
+
 // ----------------------------//
 //  Plugin Handler's own types //
 // ----------------------------//
@@ -76,11 +83,28 @@ typedef struct{
     xcommand_t xcommand;
 }pluginCmd_t;
 
-typedef struct{
-    size_t size;
-    void *ptr;
+typedef struct pluginMem_s{
+    struct pluginMem_s *next;   // Free list while unused, list of big blocks while in use
+    struct pluginMem_s *prev;   // Big blocks only
+    size_t size;                // Requested size
+    int owner;                  // Plugin ID, PLUGIN_UNKNOWN once freed
+    int sizeClass;              // PLUGIN_ARENA_CLASSES for big blocks
+    int unused;
 }pluginMem_t;
 
+typedef struct pluginArenaChunk_s{
+    struct pluginArenaChunk_s *next;
+    int used;
+}pluginArenaChunk_t;
+
+typedef struct{
+    pluginArenaChunk_t *chunks;     // The first one is the one getting carved
+    pluginMem_t *freeLists[PLUGIN_ARENA_CLASSES];
+    pluginMem_t *bigBlocks;
+    size_t peakMem;
+    unsigned int limitHits;
+}pluginArena_t;
+
 typedef struct{
     char name[PLUGIN_COM_MAXNAMELEN];
     void *(*function)();
@@ -90,8 +114,16 @@ typedef struct{
     int sock;
     netadr_t remote;
     qboolean (*packetEventHandler)(netadr_t *from, msg_t* msg);
+    netTcpClientConnect_t connect; //In progress while connect.state is not TCPCONNECT_IDLE
 }pluginTcpClientSocket_t;
 
+typedef struct{
+    unsigned int calls;
+    unsigned long long usec;    // Time spent inside the callback
+    unsigned int maxusec;
+    unsigned int overruns;      // Calls which took longer than plugin_eventBudget
+}pluginEventStats_t;
+
 typedef struct{
     int (*OnInit)();            // Initialization function
     void (*OnInfoRequest)();    // Info gathering function
@@ -99,6 +131,9 @@ typedef struct{
     void (*OnEvent[PLUGINS_ITEMCOUNT])();
     void (*OnUnload)();    // De-initialization function
 
+    pluginEventStats_t eventStats[PLUGINS_ITEMCOUNT];
+    int budgetStrikes;
+
     pluginCmd_t cmd[20];
     pluginCmd_t scriptFunction[32];
     pluginCmd_t scriptMethod[32];
@@ -108,7 +143,7 @@ typedef struct{
     
     char name[20];
     
-    pluginMem_t memory[PLUGIN_MAX_MALLOCS];
+    pluginArena_t arena;
     pluginTcpClientSocket_t sockets[PLUGIN_MAX_SOCKETS];
     
     pluginExport_t exportedFunctions[PLUGIN_MAX_EXPORTS];
@@ -116,6 +151,8 @@ typedef struct{
     
     size_t usedMem;
     int mallocs;
+
+    int pendingJobs;            // Submitted jobs whose completion did not run yet
     
     qboolean loaded;
     qboolean enabled;
@@ -126,11 +163,20 @@ typedef struct{
 
 }plugin_t;
 
+typedef struct{
+    int count;
+    int plugins[MAX_PLUGINS];   // Enabled plugins which export a handler for this event
+}pluginEventTable_t;
+
 typedef struct{
     plugin_t plugins[MAX_PLUGINS];
+    pluginEventTable_t eventTables[PLUGINS_ITEMCOUNT]; // Rebuilt by PHandler_RebuildEventTables
     int loadedPlugins;
     qboolean enabled;
     qboolean initializing_plugin;
+    cvar_t *eventBudget;
+    cvar_t *eventBudgetAction;
+    cvar_t *memoryLimit;
 }pluginWrapper_t;
 
 extern pluginWrapper_t pluginFunctions; // defined in plugin_handler.c
@@ -141,16 +187,31 @@ extern pluginWrapper_t pluginFunctions; // defined in plugin_handler.c
 
 void PHandler_Load(char*,size_t);
 void PHandler_Unload(int id);
-void PHandler_Event(int, ...);
+void PHandler_Reload(int id);
+void PHandler_DispatchEvent(int, ...);
+void PHandler_DispatchFrameEvent(void);
+void PHandler_DispatchUdpNetSendEvent(netadr_t *to, const void *data, int len, qboolean *returnNow);
+void PHandler_RebuildEventTables(void);
+
+// Fire a plugin event. An event without subscribers costs a single check
+#define PHandler_Event(eventID, ...) do{ if(pluginFunctions.eventTables[eventID].count) PHandler_DispatchEvent(eventID, ##__VA_ARGS__); }while(0)
+
+// Typed versions for the hottest events, they skip the varargs handling
+#define PHandler_FrameEvent() do{ if(pluginFunctions.eventTables[PLUGINS_ONFRAME].count) PHandler_DispatchFrameEvent(); }while(0)
+#define PHandler_UdpNetSendEvent(to, data, len, returnNow) do{ if(pluginFunctions.eventTables[PLUGINS_ONUDPNETSEND].count) PHandler_DispatchUdpNetSendEvent(to, data, len, returnNow); }while(0)
 void PHandler_Init();
 void *PHandler_Malloc(int,size_t);
 void PHandler_Free(int,void *);
 void PHandler_FreeAll(int);
+int PHandler_SubmitJob(int pID, void (*job)(void*), void (*completion)(void*), void *arg);
+qboolean PHandler_JobDone(int pID, int handle);
+void PHandler_CancelJobs(int pID);
 void PHandler_Error(int,int, char *);
 qboolean PHandler_TcpConnect(int,const char *,int);
 int PHandler_TcpGetData(int, int, void*, int);
 qboolean PHandler_TcpSendData(int,int, void*, int);
 void PHandler_TcpCloseConnection(int,int);
+void PHandler_TcpConnectionEvents();
 int PHandler_CallerID();
 void PHandler_ChatPrintf(int,char *,...);
 void PHandler_CmdExecute_f( void ); // fake server command for use in plugin commands
@@ -160,6 +221,7 @@ void PHandler_CmdExecute_f( void ); // fake server command for use in plugin com
 // --------------------------------------//
 
 void PHandler_LoadPlugin_f( void );
+void PHandler_ReloadPlugin_f( void );
 void PHandler_UnLoadPlugin_f( void );
 void PHandler_PluginList_f( void );
 void PHandler_PluginInfo_f( void );
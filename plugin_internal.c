@@ -22,6 +22,7 @@
 
 
 #include "plugin_handler.h"
+#include "sys_thread.h"
 
 
 /*==========================================*
@@ -41,16 +42,16 @@
 ============
 */
 
+/*
+ The connect finishes in PHandler_TcpConnectionEvents, the plugin gets told
+ about the outcome by OnTcpClientConnect(connection, success)
+*/
 qboolean PHandler_TcpConnect(int pID, const char* remote, int connection)
 {
-    if(pluginFunctions.plugins[pID].sockets[connection].sock < 1){
-        pluginFunctions.plugins[pID].sockets[connection].sock = NET_TcpClientConnect( remote );
+    pluginTcpClientSocket_t* ptcs = &pluginFunctions.plugins[pID].sockets[connection];
 
-        if(pluginFunctions.plugins[pID].sockets[connection].sock < 1){
-            Com_Printf("Plugins: Notice! Error connecting to server: %s for plugin #%d!\n", remote, pID);
-            return qfalse;
-        }
-        NET_StringToAdr(remote, &pluginFunctions.plugins[pID].sockets[connection].remote, NA_UNSPEC);
+    if(ptcs->sock < 1 && ptcs->connect.state == TCPCONNECT_IDLE){
+        NET_TcpClientConnectStart(&ptcs->connect, remote);
         return qtrue;
     }
     Com_PrintError("Plugin_TcpConnect: Connection id %d is already in use for plugin #%d!\n",connection ,pID );
@@ -58,11 +59,47 @@ qboolean PHandler_TcpConnect(int pID, const char* remote, int connection)
     return qfalse;
 }
 
+void PHandler_TcpConnectionEvents()
+{
+    int i, j;
+    netTcpConnectState_t state;
+    pluginTcpClientSocket_t* ptcs;
+
+    for(i = 0; i < pluginFunctions.loadedPlugins; i++){
+        for(j = 0; j < PLUGIN_MAX_SOCKETS; j++){
+
+            ptcs = &pluginFunctions.plugins[i].sockets[j];
+
+            if(ptcs->connect.state == TCPCONNECT_IDLE)
+                continue;
+
+            state = NET_TcpClientConnectPoll(&ptcs->connect);
+
+            if(state != TCPCONNECT_CONNECTED && state != TCPCONNECT_FAILED)
+                continue;
+
+            if(state == TCPCONNECT_CONNECTED){
+                ptcs->sock = ptcs->connect.sock;
+                ptcs->remote = ptcs->connect.adr;
+            }else{
+                Com_Printf("Plugins: Notice! Error connecting to server: %s for plugin #%d!\n", ptcs->connect.remote, i);
+            }
+            ptcs->connect.state = TCPCONNECT_IDLE;
+
+            if(pluginFunctions.plugins[i].OnEvent[PLUGINS_ONTCPCLIENTCONNECT] != NULL)
+                (*pluginFunctions.plugins[i].OnEvent[PLUGINS_ONTCPCLIENTCONNECT])(j, state == TCPCONNECT_CONNECTED);
+        }
+    }
+}
+
 int PHandler_TcpGetData(int pID, int connection, void* buf, int size )
 {
     int len;
     pluginTcpClientSocket_t* ptcs = &pluginFunctions.plugins[pID].sockets[connection];
 
+    if(ptcs->connect.state != TCPCONNECT_IDLE)
+        return 0; //Still connecting
+
     if(ptcs->sock < 1){
         Com_PrintWarning("Plugin_TcpGetData: called on a non open socket for plugin ID: #%d\n", pID);
         return -1;
@@ -83,6 +120,11 @@ qboolean PHandler_TcpSendData(int pID, int connection, void* data, int len)
 
     pluginTcpClientSocket_t* ptcs = &pluginFunctions.plugins[pID].sockets[connection];
 
+    if(ptcs->connect.state != TCPCONNECT_IDLE){
+        Com_PrintWarning("Plugin_TcpSendData: called before the connection has been established for plugin ID: #%d\n", pID);
+        return qfalse;
+    }
+
     if(ptcs->sock < 1){
         Com_PrintWarning("Plugin_TcpSendData: called on a non open socket for plugin ID: #%d\n", pID);
         return qfalse;
@@ -101,6 +143,11 @@ void PHandler_TcpCloseConnection(int pID, int connection)
 {
     pluginTcpClientSocket_t* ptcs = &pluginFunctions.plugins[pID].sockets[connection];
 
+    if(ptcs->connect.state != TCPCONNECT_IDLE){
+        NET_TcpClientConnectAbort(&ptcs->connect);
+        return;
+    }
+
     if(ptcs->sock < 1){
         Com_PrintWarning("Plugin_TcpCloseConnection: Called on a non open socket for plugin ID: #%d\n", pID);
         return;
@@ -141,9 +188,9 @@ void PHandler_BoldPrintf(int slot, char *fmt, ... )
 
 void PHandler_CmdExecute_f()
 {
-    Com_DPrintf("Attempting to execute a plugin command '%s'.\n",Cmd_Argv(0));
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Attempting to execute a plugin command '%s'.\n",Cmd_Argv(0));
     if(!pluginFunctions.enabled){
-        Com_DPrintf("Error! Tried executing a plugin command with plugins being disabled! Command name: '%s'.\n",Cmd_Argv(1));
+        Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Error! Tried executing a plugin command with plugins being disabled! Command name: '%s'.\n",Cmd_Argv(1));
         return;
     }
     char name[128];
@@ -154,7 +201,7 @@ void PHandler_CmdExecute_f()
         if(pluginFunctions.plugins[i].loaded && pluginFunctions.plugins[i].enabled){
             for(j=0;j<pluginFunctions.plugins[i].cmds;j++)
                 if(strcmp(name,pluginFunctions.plugins[i].cmd[j].name)==0){
-                    Com_DPrintf("Executing plugin command '%s' for plugin '%s', plugin ID: %d.\n",name,pluginFunctions.plugins[i].name,i);
+                    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Executing plugin command '%s' for plugin '%s', plugin ID: %d.\n",name,pluginFunctions.plugins[i].name,i);
                     func = (void (*)())(pluginFunctions.plugins[i].cmd[j].xcommand);
 
                     func();
@@ -177,75 +224,258 @@ void PHandler_RemoveCommand(int pID,char *name)
                 pluginFunctions.plugins[pID].cmd[k] = pluginFunctions.plugins[pID].cmd[k+1];
 
             }
-            Com_DPrintf("Command '%s' removed for plugin %s.\n",name,pluginFunctions.plugins[pID].name);
+            Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Command '%s' removed for plugin %s.\n",name,pluginFunctions.plugins[pID].name);
             return;
         }
 
     }
-    Com_DPrintf("Warning: tried removing command '%s', which was not found for plugin %s.\n",name,pluginFunctions.plugins[pID].name);
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Warning: tried removing command '%s', which was not found for plugin %s.\n",name,pluginFunctions.plugins[pID].name);
 
 }
 
+/*
+======
+ Plugin memory
+
+ Every plugin allocates from its own arena. Small blocks are carved from chunks and go
+ back onto a free list of their size class, big blocks get allocated on their own and
+ are kept in a list. Freeing all memory of a plugin only has to release the chunks
+ and the big blocks instead of looking at every allocation
+======
+*/
+static int PHandler_SizeClass(size_t size)
+{
+    int sizeClass;
+
+    for(sizeClass = 0; sizeClass < PLUGIN_ARENA_CLASSES; sizeClass++){
+        if(size <= (16 << sizeClass))
+            return sizeClass;
+    }
+    return PLUGIN_ARENA_CLASSES;
+}
+
 void *PHandler_Malloc(int pID,size_t size)
 {
-    int i;
-    Com_DPrintf("Attempting to allocate %dB of memory for plugin #%d...\n",size,pID);
-    //Plugin identified, find the first free spot in it's allocated pointers table
-    for(i=0;i<PLUGIN_MAX_MALLOCS;i++){
-        if(pluginFunctions.plugins[pID].memory[i].ptr==NULL){
-            pluginFunctions.plugins[pID].memory[i].ptr = malloc(size);
-            pluginFunctions.plugins[pID].memory[i].size = size;
-            pluginFunctions.plugins[pID].usedMem += size;
-            ++pluginFunctions.plugins[pID].mallocs;
-            Com_DPrintf("Allocating %dB of memory for plugin #%d.\n",size,pID);
-            return pluginFunctions.plugins[pID].memory[i].ptr;
+    plugin_t *plugin = &pluginFunctions.plugins[pID];
+    pluginArena_t *arena = &plugin->arena;
+    pluginArenaChunk_t *chunk;
+    pluginMem_t *block;
+    int sizeClass, blockSize;
+
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Attempting to allocate %dB of memory for plugin #%d...\n",size,pID);
+
+    if(pluginFunctions.memoryLimit->integer > 0 && plugin->usedMem + size > (size_t)pluginFunctions.memoryLimit->integer * 1024){
+        if(arena->limitHits++ == 0)
+            Com_PrintWarning("Plugins: Plugin #%d ('%s') reached plugin_memoryLimit of %d KB\n",pID,plugin->name,pluginFunctions.memoryLimit->integer);
+        return NULL;
+    }
 
+    sizeClass = PHandler_SizeClass(size);
+
+    if(sizeClass == PLUGIN_ARENA_CLASSES){
+        block = Z_TagMalloc(sizeof(pluginMem_t) + size, TAG_PLUGINS);
+        block->prev = NULL;
+        block->next = arena->bigBlocks;
+        if(arena->bigBlocks)
+            arena->bigBlocks->prev = block;
+        arena->bigBlocks = block;
+
+    }else if(arena->freeLists[sizeClass]){
+        block = arena->freeLists[sizeClass];
+        arena->freeLists[sizeClass] = block->next;
+
+    }else{
+        blockSize = sizeof(pluginMem_t) + (16 << sizeClass);
+        chunk = arena->chunks;
+        if(!chunk || chunk->used + blockSize > PLUGIN_ARENA_CHUNK){
+            chunk = Z_TagMalloc(PLUGIN_ARENA_CHUNK, TAG_PLUGINS);
+            chunk->used = sizeof(pluginArenaChunk_t);
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
         }
-
+        block = (pluginMem_t*)((byte*)chunk + chunk->used);
+        chunk->used += blockSize;
     }
-    Com_Printf("Plugins: Warning! Memory allocations limit reached for plugin #%d!\n",pID);
-    return NULL;
+
+    block->size = size;
+    block->owner = pID;
+    block->sizeClass = sizeClass;
+
+    plugin->usedMem += size;
+    ++plugin->mallocs;
+    if(plugin->usedMem > arena->peakMem)
+        arena->peakMem = plugin->usedMem;
+
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Allocating %dB of memory for plugin #%d.\n",size,pID);
+    return block + 1;
 }
 void PHandler_Free(int pID, void *ptr)
 {
+    plugin_t *plugin = &pluginFunctions.plugins[pID];
+    pluginArena_t *arena = &plugin->arena;
+    pluginMem_t *block;
 
-    int i;
     if(ptr==NULL){
-        Com_DPrintf("Plugins: Warning! Plugin #%d tried freeing a NULL pointer! Called Plugin_Free() twice?\n",pID);
+        Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugins: Warning! Plugin #%d tried freeing a NULL pointer! Called Plugin_Free() twice?\n",pID);
         return;
     }
-    //Plugin identified, find the first free spot in it's allocated pointers table
-    for(i=0;i<PLUGIN_MAX_MALLOCS;i++){
-        if(pluginFunctions.plugins[pID].memory[i].ptr==ptr){
-            free(ptr);
-            pluginFunctions.plugins[pID].memory[i].ptr = NULL;
-            pluginFunctions.plugins[pID].usedMem -= pluginFunctions.plugins[pID].memory[i].size;
-            --pluginFunctions.plugins[pID].mallocs;
-            return;
-        }
+    block = (pluginMem_t*)ptr - 1;
+    if(block->owner != pID){
+        Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugins: Warning! Plugin %d tried freeing an unknown pointer!\n",pID);
+        return;
     }
-    Com_DPrintf("Plugins: Warning! Plugin %d tried freeing an unknown pointer!\n",pID);
-
+    block->owner = PLUGIN_UNKNOWN;
+    plugin->usedMem -= block->size;
+    --plugin->mallocs;
+
+    if(block->sizeClass == PLUGIN_ARENA_CLASSES){
+        if(block->prev)
+            block->prev->next = block->next;
+        else
+            arena->bigBlocks = block->next;
+        if(block->next)
+            block->next->prev = block->prev;
+        Z_TagFree(block);
+        return;
+    }
+    block->next = arena->freeLists[block->sizeClass];
+    arena->freeLists[block->sizeClass] = block;
 }
 
 void PHandler_FreeAll(int pID)
 {
-    int i;
+    pluginArena_t *arena;
+    pluginArenaChunk_t *chunk;
+    pluginMem_t *block;
+
     if(pID<0){
         Com_Printf("Plugins: Error! Tried to free all memory of an unknown plugin!\n");
         return;
     }
-    for(i=0;i<PLUGIN_MAX_MALLOCS;++i){
-        if(pluginFunctions.plugins[pID].memory[i].ptr!=NULL){
-            free(pluginFunctions.plugins[pID].memory[i].ptr);
-            pluginFunctions.plugins[pID].memory[i].ptr=NULL;
-        }
+    arena = &pluginFunctions.plugins[pID].arena;
+
+    while((chunk = arena->chunks) != NULL){
+        arena->chunks = chunk->next;
+        Z_TagFree(chunk);
+    }
+    while((block = arena->bigBlocks) != NULL){
+        arena->bigBlocks = block->next;
+        Z_TagFree(block);
     }
+    Com_Memset(arena->freeLists, 0, sizeof(arena->freeLists));
+
     pluginFunctions.plugins[pID].usedMem = 0;
     pluginFunctions.plugins[pID].mallocs = 0;
-    Com_DPrintf("Plugins: Memory for plugin #%d has been freed.\n",pID);
+    Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugins: Memory for plugin #%d has been freed.\n",pID);
+
+}
+/*
+======
+ Plugin jobs
+
+ The job function runs on a worker thread, the completion gets called from the main loop
+ afterwards. The completion of a plugin which got unloaded in between is skipped
+======
+*/
+typedef struct{
+    int pID;
+    int handle;                 // 0 while the slot is free
+    qboolean cancelled;
+    void (*job)(void*);
+    void (*completion)(void*);
+    void *arg;
+}pluginJob_t;
+
+static pluginJob_t pluginJobs[PLUGIN_MAX_JOBS];
+static int pluginJobSequence;
+
+static void PHandler_RunJob(void *arg)
+{
+    pluginJob_t *job = arg;
+
+    job->job(job->arg);
+}
+
+static void PHandler_CompleteJob(void *arg)
+{
+    pluginJob_t *job = arg;
+
+    if(!job->cancelled){
+        if(job->completion)
+            job->completion(job->arg);
+        --pluginFunctions.plugins[job->pID].pendingJobs;
+    }
+    job->handle = 0;
+}
+
+int PHandler_SubmitJob(int pID, void (*job)(void*), void (*completion)(void*), void *arg)
+{
+    pluginJob_t *slot;
+    int i;
+
+    if(!Sys_IsMainThread()){
+        Com_PrintWarning("Plugins: Plugin #%d tried to submit a job from outside of the main thread\n",pID);
+        return -1;
+    }
+    for(i=0, slot = pluginJobs; i<PLUGIN_MAX_JOBS; i++, slot++){
+        if(slot->handle == 0)
+            break;
+    }
+    if(i==PLUGIN_MAX_JOBS){
+        Com_PrintWarning("Plugins: Plugin #%d can not submit a job, %d jobs are already pending\n",pID,PLUGIN_MAX_JOBS);
+        return -1;
+    }
 
+    //Handles are never 0 and tell the slot and its sequence
+    pluginJobSequence = (pluginJobSequence + 1) & 0x7fffff;
+    if(pluginJobSequence == 0)
+        pluginJobSequence = 1;
+
+    slot->pID = pID;
+    slot->handle = (pluginJobSequence << 8) | i;
+    slot->cancelled = qfalse;
+    slot->job = job;
+    slot->completion = completion;
+    slot->arg = arg;
+    ++pluginFunctions.plugins[pID].pendingJobs;
+
+    i = slot->handle;
+    Sys_AddJob(PHandler_RunJob, PHandler_CompleteJob, slot);   // Can complete right away without worker threads
+    return i;
 }
+
+qboolean PHandler_JobDone(int pID, int handle)
+{
+    pluginJob_t *slot;
+
+    if(handle <= 0)
+        return qtrue;
+
+    slot = &pluginJobs[handle & 0xff];
+    if(slot->handle != handle || slot->pID != pID || slot->cancelled)
+        return qtrue;
+
+    return qfalse;
+}
+
+// Has to be called before the library of the plugin gets closed
+void PHandler_CancelJobs(int pID)
+{
+    int i;
+
+    if(pluginFunctions.plugins[pID].pendingJobs < 1)
+        return;
+
+    // The job functions are code of the plugin
+    Sys_WaitForJobs();
+
+    for(i=0;i<PLUGIN_MAX_JOBS;i++){
+        if(pluginJobs[i].handle != 0 && pluginJobs[i].pID == pID)
+            pluginJobs[i].cancelled = qtrue;
+    }
+    pluginFunctions.plugins[pID].pendingJobs = 0;
+}
+
 P_P_F void PHandler_Error(int pID,int code,char *string)
 {
     if(pluginFunctions.plugins[pID].enabled==qfalse){
@@ -260,13 +490,14 @@ P_P_F void PHandler_Error(int pID,int code,char *string)
         case P_ERROR_DISABLE:
             Com_Printf("Plugin #%d ('%s') returned an error and will be disabled! Error string: \"%s\".\n",pID,pluginFunctions.plugins[pID].name,string);
             pluginFunctions.plugins[pID].enabled = qfalse;
+            PHandler_RebuildEventTables();
             break;
         case P_ERROR_TERMINATE:
             Com_Printf("Plugin #%d ('%s') reported a critical error, the server will be terminated. Error string: \"%s\".\n",pID,pluginFunctions.plugins[pID].name,string);
             Com_Error(ERR_FATAL,string);
             break;
         default:
-            Com_DPrintf("Plugin #%d ('%s') reported an unknown error! Error string: \"%s\", error code: %d.\n",pID,pluginFunctions.plugins[pID].name,string,code);
+            Com_DPrintfChannel(DPRINT_PLUGIN, 1, "Plugin #%d ('%s') reported an unknown error! Error string: \"%s\", error code: %d.\n",pID,pluginFunctions.plugins[pID].name,string,code);
             break;
     }
 
@@ -285,6 +516,21 @@ void PHandler_LoadPlugin_f( void )
         }
         PHandler_Load(Cmd_Argv(1),128);
 }
+void PHandler_ReloadPlugin_f( void )
+{
+    int id;
+
+    if( Cmd_Argc() < 2){
+        Com_Printf("Usage: %s <plugin file name without extension>\n", Cmd_Argv(0));
+        return;
+    }
+    id = PHandler_GetID(Cmd_Argv(1),128);
+    if(id<0){
+        Com_Printf("Cannot reload plugin: plugin %s is not loaded!\n",Cmd_Argv(1));
+        return;
+    }
+    PHandler_Reload(id);
+}
 void PHandler_UnLoadPlugin_f()
 {
     if( Cmd_Argc() < 2){
@@ -326,6 +572,21 @@ void PHandler_PluginInfo_f()
         Com_Printf(" -%s\n",pluginFunctions.plugins[id].cmd[i].name);
     }
     Com_Printf("\n^2Total of %d commands.^7\n\n",pluginFunctions.plugins[id].cmds);
+
+    Com_Printf("\n^2Memory:^7\n%d allocations, %d B in use, %d B at peak",pluginFunctions.plugins[id].mallocs,pluginFunctions.plugins[id].usedMem,pluginFunctions.plugins[id].arena.peakMem);
+    if(pluginFunctions.plugins[id].arena.limitHits)
+        Com_Printf(", %u allocations refused by plugin_memoryLimit",pluginFunctions.plugins[id].arena.limitHits);
+    Com_Printf("\n\n");
+
+    Com_Printf("\n^2Event timings:^7\n\n");
+    Com_Printf(" %-20s %10s %12s %10s %10s %9s\n", "event", "calls", "total usec", "avg usec", "max usec", "overruns");
+    for(i=0;i<PLUGINS_ITEMCOUNT;++i){
+        pluginEventStats_t *stats = &pluginFunctions.plugins[id].eventStats[i];
+        if(!stats->calls)
+            continue;
+        Com_Printf(" %-20s %10u %12llu %10llu %10u %9u\n", PHandler_Events[i], stats->calls, stats->usec, stats->usec / stats->calls, stats->maxusec, stats->overruns);
+    }
+    Com_Printf("\n");
 }
 void PHandler_PluginList_f()
 {
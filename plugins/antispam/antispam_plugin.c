@@ -1,100 +1,234 @@
-#include <time.h>
 #include "../pinc.h"
 
-#define ANTISPAM_MAXMESSAGES 30
+/*
+Every check below costs the same no matter how much a player has said before.
+Message rates are token buckets, one per player and one for the whole server,
+duplicates are found by comparing a hash of the normalized text against a short
+ring per player and a small direct-mapped table shared by everyone.
+*/
+
+#define ANTISPAM_HISTORY 8          // Recent message hashes kept per player
+#define ANTISPAM_SHAREDHASHES 256   // Size of the table of recent hashes of all players, power of 2
 
 typedef struct{
+    float tokens;                   // Messages the player may send right now
+    int lastRefill;
     int lastMessage;
-    int messages[ANTISPAM_MAXMESSAGES];
+    unsigned int recentHash[ANTISPAM_HISTORY];
+    int recentTime[ANTISPAM_HISTORY];
+    int recentNext;
 }userData_t;
 
+typedef struct{
+    unsigned int hash;
+    int time;
+    int lastSlot;
+    int senders;                    // Players in a row who sent this text within the window
+}sharedHash_t;
+
 typedef struct{
     userData_t *players;
     int maxPlayers;
+    float serverTokens;
+    int serverLastRefill;
+    sharedHash_t shared[ANTISPAM_SHAREDHASHES];
     cvar_t *maxMPM;
+    cvar_t *burst;
     cvar_t *minAP;
     cvar_t *minMD;
     cvar_t *renMD;
+    cvar_t *dupWindow;
+    cvar_t *dupSenders;
+    cvar_t *serverMPM;
+    cvar_t *serverBurst;
 }antispam_t;
 
 antispam_t data;
+
 void Antispam_Initialize()
 {
+    int now = Plugin_GetServerTime();
+    int i;
+
     if(data.players != NULL){
 	Plugin_Free(data.players); // just in case, Plugin_Free is safe to be called on unknown pointers and on already freed pointers
     }
     data.maxPlayers = Plugin_GetSlotCount();
     data.players = (userData_t *)Plugin_Malloc(sizeof(userData_t)*data.maxPlayers);
     memset(data.players,0x00,sizeof(userData_t)*data.maxPlayers);
+    memset(data.shared,0x00,sizeof(data.shared));
+    for(i = 0; i < data.maxPlayers; ++i){
+	data.players[i].tokens = data.burst->integer;
+	data.players[i].lastRefill = now;
+    }
+    data.serverTokens = data.serverBurst->integer;
+    data.serverLastRefill = now;
+}
+
+/*
+FNV-1a over the text with color codes, whitespace and case dropped,
+so "Hello" and "^1h e l l o" count as the same message
+*/
+static unsigned int Antispam_HashMessage(const char *message)
+{
+    unsigned int hash = 2166136261u;
+    int c;
+
+    if(*message == 0x15)
+	message++;
+
+    while((c = (unsigned char)*message++) != 0){
+	if(c == '^' && *message != 0){
+	    message++;
+	    continue;
+	}
+	if(c <= ' ')
+	    continue;
+	if(c >= 'A' && c <= 'Z')
+	    c += 'a' - 'A';
+	hash ^= c;
+	hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Adds the tokens earned since the last call and takes one if there is one
+static qboolean Antispam_TakeToken(float *tokens, int *lastRefill, float perMinute, int capacity, int now)
+{
+    *tokens += (now - *lastRefill) * perMinute / 60000.0f;
+    *lastRefill = now;
+    if(*tokens > capacity)
+	*tokens = capacity;
+    if(perMinute <= 0 || *tokens < 1.0f)
+	return qfalse;
+    *tokens -= 1.0f;
+    return qtrue;
+}
+
+static qboolean Antispam_IsDuplicate(userData_t *player, int slot, unsigned int hash, int now)
+{
+    sharedHash_t *shared;
+    int window = data.dupWindow->integer * 1000;
+    int i;
+
+    if(window == 0)
+	return qfalse;
+
+    for(i = 0; i < ANTISPAM_HISTORY; ++i){
+	if(player->recentHash[i] == hash && player->recentTime[i] != 0 && now - player->recentTime[i] < window)
+	    return qtrue;
+    }
+    player->recentHash[player->recentNext] = hash;
+    player->recentTime[player->recentNext] = now;
+    player->recentNext = (player->recentNext + 1) % ANTISPAM_HISTORY;
+
+    // The same text by several players, bots usually come in groups
+    shared = &data.shared[hash & (ANTISPAM_SHAREDHASHES - 1)];
+    if(shared->hash != hash || now - shared->time >= window){
+	shared->hash = hash;
+	shared->senders = 0;
+	shared->lastSlot = -1;
+    }
+    shared->time = now;
+    if(shared->lastSlot != slot){
+	shared->lastSlot = slot;
+	shared->senders++;
+    }
+    return data.dupSenders->integer != 0 && shared->senders > data.dupSenders->integer;
 }
-int OnInit(){	// Funciton called on server initiation
+
+PCL int OnInit(){	// Funciton called on server initiation
 
 	//G_SayCensor_Init();
 	data.maxPlayers = Plugin_GetSlotCount();
 	data.maxMPM = Cvar_RegisterFloat("antispam_maxMessagesPerMinute",8,0,30,0,"Count of maximum messages a player can send in a minute. 0 disables the chat completely.");
+	data.burst = Cvar_RegisterInt("antispam_burst",3,1,30,0,"Messages a player can send at once before antispam_maxMessagesPerMinute applies.");
 	data.minAP = Cvar_RegisterInt("antispam_minAdminPower",50,0,100,0,"Minimum power points which disable the player. 0 means enabled for everyone.");
 	data.minMD = Cvar_RegisterInt("antispam_minMessageDelay",4,0,60,0,"Ammount of time after sending a message after which the player can chat again. 0 disables the limit.");
 	data.renMD = Cvar_RegisterBool("antispam_renewedMessageDelay",qfalse,0,"Do messages sent before minMessageDelay passes make the delay prolonged?");
+	data.dupWindow = Cvar_RegisterInt("antispam_duplicateWindow",30,0,600,0,"Seconds in which repeating a message gets it blocked. 0 disables the duplicate check.");
+	data.dupSenders = Cvar_RegisterInt("antispam_duplicateSenders",3,0,64,0,"How many players may send the same message within antispam_duplicateWindow. 0 disables the limit.");
+	data.serverMPM = Cvar_RegisterFloat("antispam_serverMessagesPerMinute",0,0,1000,0,"Count of maximum messages all players together can send in a minute. 0 disables the server wide limit.");
+	data.serverBurst = Cvar_RegisterInt("antispam_serverBurst",10,1,100,0,"Messages all players together can send at once before antispam_serverMessagesPerMinute applies.");
 	Antispam_Initialize();
 	return 0;
 }
+
+PCL void OnUnload(){
+	Plugin_Free(data.players);
+	data.players = NULL;
+}
+
+PCL void OnPlayerConnect(int clientnum, netadr_t *from, char *originguid, char *userinfo, int authentication, const char **denied){
+	if(clientnum < 0 || clientnum >= data.maxPlayers)
+	    return;
+	memset(&data.players[clientnum],0x00,sizeof(userData_t));
+	data.players[clientnum].tokens = data.burst->integer;
+	data.players[clientnum].lastRefill = Plugin_GetServerTime();
+}
+
 PCL void OnMessageSent(char *message,int slot, qboolean *show){
+	userData_t *player;
+	unsigned int hash;
+	int now;
+
 	if(!(*show))
 	    return;
 	if(!message){
 	    *show = qfalse;
 	    return;
 	}
-	int uid = Plugin_GetPlayerUid(slot);
-	time_t t = time(NULL);
-	if(data.minAP->integer != 0 && uid >= data.minAP->integer){
+	if(slot < 0 || slot >= data.maxPlayers)
+	    return;
+	if(data.minAP->integer != 0 && Plugin_GetPlayerUid(slot) >= data.minAP->integer){
 	    return;
 	}
-	//Plugin_ChatPrintf(slot,"Debug: minMD = %d, time = %d, lastMessage = %d, t - lastMessage = %d\n",data.minMD->integer,t,data.players[slot].lastMessage,t - data.players[slot].lastMessage);
-	if(data.minMD->integer != 0 && (t - data.players[slot].lastMessage < data.minMD->integer)){
+
+	player = &data.players[slot];
+	now = Plugin_GetServerTime();
+
+	if(data.minMD->integer != 0 && player->lastMessage != 0 && now - player->lastMessage < data.minMD->integer * 1000){
 	    *show = qfalse;
 	    if(data.renMD->boolean)
-		data.players[slot].lastMessage = t;
+		player->lastMessage = now;
 	    return;
 	}
-	// Max messages per minute check
-	int i,j=0;
-	for(i=0;( i<ANTISPAM_MAXMESSAGES) && (data.players[slot].messages[i] != 0) && (t - data.players[slot].messages[i] > 60);++i);
-	// the loop above iterates on the messages array until it's end, value of 0 or message older than 1 minute
-	// now the i value holds the number of messages in the messages array which are older than 60 seconds + 1
-	// we need to remove those
-	if(i!=0){
-	    for(j=0;j<ANTISPAM_MAXMESSAGES && i<ANTISPAM_MAXMESSAGES && data.players[slot].messages[j] != 0;++i,++j);{
-		data.players[slot].messages[j] = data.players[slot].messages[i];
-		data.players[slot].messages[i] = 0;
-	    }
-	}
-	Plugin_ChatPrintf(slot,"Debug: %d, %d, %d, %d.\n",j,i,data.maxMPM->integer,data.maxMPM->latchedinteger);
-	for(i=j;i<ANTISPAM_MAXMESSAGES;++i){
-	    data.players[slot].messages[i] = 0;
+
+	hash = Antispam_HashMessage(message);
+	if(Antispam_IsDuplicate(player, slot, hash, now)){
+	    *show = qfalse;
+	    Plugin_ChatPrintf(slot,"^2AntiSpam: this message was sent too often already.");
+	    return;
 	}
-	
-	// j now holds the value of how many messages this player has sent in the last 60 seconds. If it is too much - dont show the msg
-	// if it is ok - show the message and add time to messages[j]
-	if(j<data.maxMPM->integer){
-	    data.players[slot].messages[j] = t;
-	    data.players[slot].lastMessage = t;
-	    *show = qtrue;
+
+	if(!Antispam_TakeToken(&player->tokens, &player->lastRefill, data.maxMPM->value, data.burst->integer, now)){
+	    *show = qfalse;
+	    if(data.maxMPM->value > 0)
+		Plugin_ChatPrintf(slot,"^2AntiSpam: you can send next chat message in %d seconds.",
+		    (int)((1.0f - player->tokens) * 60.0f / data.maxMPM->value) + 1);
+	    return;
 	}
-	else{
+
+	// Shared by everyone, it also keeps floods away from the chat redirects (rcon tools) of the server
+	if(data.serverMPM->value > 0 &&
+	    !Antispam_TakeToken(&data.serverTokens, &data.serverLastRefill, data.serverMPM->value, data.serverBurst->integer, now)){
 	    *show = qfalse;
-	    Plugin_ChatPrintf(slot,"^2AntiSpam: you can send next chat message in %d seconds.",60 - t - data.players[slot].messages[0]);
+	    Plugin_ChatPrintf(slot,"^2AntiSpam: the chat is busy, try again in a moment.");
+	    return;
 	}
+
+	player->lastMessage = now;
 }
-void OnInfoRequest(pluginInfo_t *info){	// Function used to obtain information about the plugin
+
+PCL void OnInfoRequest(pluginInfo_t *info){	// Function used to obtain information about the plugin
     // Memory pointed by info is allocated by the server binary, just fill in the fields
-    
+
     // =====  MANDATORY FIELDS  =====
     info->handlerVersion.major = PLUGIN_HANDLER_VERSION_MAJOR;
     info->handlerVersion.minor = PLUGIN_HANDLER_VERSION_MINOR;	// Requested handler version
-    
+
     // =====  OPTIONAL  FIELDS  =====
-    info->pluginVersion.major = 1;
+    info->pluginVersion.major = 2;
     info->pluginVersion.minor = 0;	// Plugin version
     strncpy(info->fullName,"IceOps antispam plugin by TheKelm",sizeof(info->fullName)); //Full plugin name
     strncpy(info->shortDescription,"This plugin is used to prevent spam in the ingame chat.",sizeof(info->shortDescription)); // Short plugin description
@@ -3,13 +3,29 @@
 #include "censor.h"
 #include "../pinc.h"
 
-typedef struct badwordsList_s {
-    struct	badwordsList_s *next;
-    qboolean	exactmatch;
-    char	word[24];
-}badwordsList_t;
+/*
+The words from badwords.txt get compiled into one Aho-Corasick automaton, so a token
+gets checked in one pass no matter how many words there are.
+Words run through the same normalization as the chat tokens. Only bytes which occur
+in a word get an own alphabet class, everything else shares class 0 which always leads
+back to the root. Transitions are stored as a complete table (numNodes * numClasses).
+*/
+
+#define CENSOR_MATCH_SUBSTRING 1	// A word which may be part of a token ends here
+#define CENSOR_MATCH_EXACT 2		// A word which has to be the whole token ends here
+#define CENSOR_MAX_WORDLEN 256
+
+typedef struct{
+    int		numNodes;
+    int		numClasses;
+    unsigned char classes[256];
+    int		*next;
+    unsigned short *depth;
+    unsigned char *flags;
+    void	*memory;
+}censorAutomaton_t;
 
-badwordsList_t *badwords;
+static censorAutomaton_t badwords;
 
 
 /*
@@ -36,48 +52,6 @@ void Q_strncpyz( char *dest, const char *src, int destsize ) {
 }
 
 
-int Q_stricmpn (const char *s1, const char *s2, int n) {
-	int		c1, c2;
-
-        if ( s1 == NULL ) {
-           if ( s2 == NULL )
-             return 0;
-           else
-             return -1;
-        }
-        else if ( s2==NULL )
-          return 1;
-
-
-	
-	do {
-		c1 = *s1++;
-		c2 = *s2++;
-
-		if (!n--) {
-			return 0;		// strings are equal until end point
-		}
-		
-		if (c1 != c2) {
-			if (c1 >= 'a' && c1 <= 'z') {
-				c1 -= ('a' - 'A');
-			}
-			if (c2 >= 'a' && c2 <= 'z') {
-				c2 -= ('a' - 'A');
-			}
-			if (c1 != c2) {
-				return c1 < c2 ? -1 : 1;
-			}
-		}
-	} while (c1);
-	
-	return 0;		// strings are equal
-}
-
-int Q_stricmp (const char *s1, const char *s2) {
-	return (s1 && s2) ? Q_stricmpn (s1, s2, 99999) : -1;
-}
-
 
 
 
@@ -227,57 +201,6 @@ char* CharConv(char *output, char *string,int size)
 
 
 
-void G_SayCensor_Init()
-{
-	fileHandle_t file;
-	int read;
-	badwordsList_t *this;
-	qboolean exactmatch;
-	char buff[24];
-	char line[24];
-	char* linept;
-	register int i=0;
-
-        FS_SV_FOpenFileRead("badwords.txt",&file);
-        if(!file){
-            Com_Printf("Censor_Plugin: Can not open badwords.txt for reading\n");
-            return;
-        }
-        for(i = 0; ;i++){
-            read = FS_ReadLine(buff,sizeof(buff),file);
-
-            if(read == 0){
-                Com_Printf("%i lines parsed from badwords.txt\n",i);
-                FS_FCloseFile(file);
-                return;
-            }
-            if(read == -1){
-                Com_Printf("Can not read from badwords.txt\n");
-                FS_FCloseFile(file);
-                return;
-            }
-
-            Q_strncpyz(line,buff,sizeof(line));
-            linept = line;
-
-            if(*linept == '#'){
-                exactmatch = qtrue;
-                linept++;
-            }else{
-                exactmatch = qfalse;
-            }
-
-            this = Plugin_Malloc(sizeof(badwordsList_t));
-            if(this){
-                this->next = badwords;
-                this->exactmatch = exactmatch;
-                Q_strncpyz(this->word,linept,strlen(linept));
-            	badwords = this;
-	    }
-        }
-	Com_Printf("Censor: init complete.\n");
-}
-
 char* censor_ignoreMultiple(char *output, char *string, size_t size)
 {
 	if(!output || !string) return NULL;
@@ -299,37 +222,276 @@ char* censor_ignoreMultiple(char *output, char *string, size_t size)
 }
 
 
+/*
+=============
+Censor_Normalize
+
+Brings a word or a token into the form which gets matched: no colors, leetspeak and
+case folded and optional without repeated characters
+=============
+*/
+static void Censor_Normalize(char *output, char *string, size_t size, qboolean collapse)
+{
+	char tmp[1024];
+
+	removeColors(output,string,size);
+	CharConv(tmp,output,sizeof(tmp));
+	if(collapse)
+	    censor_ignoreMultiple(output,tmp,size);
+	else
+	    Q_strncpyz(output,tmp,size);
+}
+
+
+/*
+=============
+Censor_BuildAutomaton
+
+words points to count strings, each prefixed with its match type
+=============
+*/
+static qboolean Censor_BuildAutomaton(censorAutomaton_t *ac, char **words, int count)
+{
+	int i, j, k, node, child, maxNodes, head, tail;
+	int *fail, *queue;
+	unsigned char used[256];
+	unsigned char *word;
+	size_t size;
+	char *mem;
+
+	memset(ac, 0, sizeof(censorAutomaton_t));
+	memset(used, 0, sizeof(used));
+
+	maxNodes = 1;
+	for(i = 0; i < count; i++){
+	    for(word = (unsigned char*)words[i] + 1; *word; word++)
+		used[*word] = 1;
+	    maxNodes += strlen(words[i] + 1);
+	}
+
+	ac->numClasses = 1;
+	for(i = 0; i < 256; i++){
+	    if(used[i])
+		ac->classes[i] = ac->numClasses++;
+	}
+
+	size = (size_t)maxNodes * ac->numClasses * sizeof(int) + maxNodes * (2 * sizeof(int) + sizeof(unsigned short) + sizeof(unsigned char));
+	mem = Plugin_Malloc(size);
+	if(!mem)
+	    return qfalse;
+
+	memset(mem, 0, size);
+	ac->memory = mem;
+	ac->next = (int*)mem;
+	fail = ac->next + maxNodes * ac->numClasses;
+	queue = fail + maxNodes;
+	ac->depth = (unsigned short*)(queue + maxNodes);
+	ac->flags = (unsigned char*)(ac->depth + maxNodes);
+
+	// Build the trie. Node 0 is the root, a transition of 0 means no child yet
+	ac->numNodes = 1;
+	for(i = 0; i < count; i++){
+	    node = 0;
+	    for(word = (unsigned char*)words[i] + 1; *word; word++){
+		k = ac->classes[*word];
+		if(!ac->next[node * ac->numClasses + k]){
+		    ac->depth[ac->numNodes] = ac->depth[node] + 1;
+		    ac->next[node * ac->numClasses + k] = ac->numNodes++;
+		}
+		node = ac->next[node * ac->numClasses + k];
+	    }
+	    ac->flags[node] |= words[i][0];
+	}
+
+	// Breadth first: add the failure links and turn the trie into a complete transition table
+	head = tail = 0;
+	for(k = 0; k < ac->numClasses; k++){
+	    child = ac->next[k];
+	    if(child){
+		fail[child] = 0;
+		queue[tail++] = child;
+	    }
+	}
+
+	while(head < tail){
+	    node = queue[head++];
+	    for(k = 0; k < ac->numClasses; k++){
+		j = node * ac->numClasses + k;
+		child = ac->next[j];
+		if(child){
+		    fail[child] = ac->next[fail[node] * ac->numClasses + k];
+		    ac->flags[child] |= ac->flags[fail[child]] & CENSOR_MATCH_SUBSTRING;
+		    queue[tail++] = child;
+		}else{
+		    ac->next[j] = ac->next[fail[node] * ac->numClasses + k];
+		}
+	    }
+	}
+
+	Com_Printf("Censor: %d words compiled into %d states\n", count, ac->numNodes);
+	return qtrue;
+}
+
+
+/*
+=============
+G_SayCensor_Init
+
+Loads badwords.txt. Lines starting with # have to match a whole token.
+Can be called again to reload the list, the old one stays active if that fails.
+The file is mapped read only, the lines get parsed straight out of the page cache
+=============
+*/
+void G_SayCensor_Init()
+{
+	const byte *filebuf;
+	const char *start, *end, *fileend;
+	int filelen, count, i;
+	char linebuf[CENSOR_MAX_WORDLEN + 1];
+	char *line;
+	char **words;
+	char *wordbuf;
+	char normalized[CENSOR_MAX_WORDLEN];
+	qboolean exactmatch;
+	censorAutomaton_t ac;
+	int wordbufsize, wordbufpos;
+
+	filebuf = FS_SV_AcquireFileView("badwords.txt", &filelen);
+	if(filelen < 0){
+	    Com_Printf("Censor_Plugin: Can not open badwords.txt for reading\n");
+	    return;
+	}
+	if(!filebuf && filelen > 0){
+	    Com_Printf("Can not read from badwords.txt\n");
+	    return;
+	}
+	if(!filebuf)
+	    filelen = 0;
+
+	fileend = (const char*)filebuf + filelen;
+
+	// Every line turns into at most one word, normalizing does not make it longer
+	count = 1;
+	for(i = 0; i < filelen; i++){
+	    if(filebuf[i] == '\n')
+		count++;
+	}
+
+	wordbufsize = filelen + 2 * count;
+	words = Plugin_Malloc(count * sizeof(char*) + wordbufsize);
+	if(!words){
+	    Com_Printf("Censor_Plugin: Out of memory\n");
+	    FS_ReleaseFileView(filebuf);
+	    return;
+	}
+	wordbuf = (char*)(words + count);
+	wordbufpos = 0;
+
+	count = 0;
+	for(start = (const char*)filebuf; start && start < fileend && *start; start = end){
+
+	    end = memchr(start, '\n', fileend - start);
+	    i = end ? end - start : fileend - start;
+	    if(end)
+		end++;
+
+	    // Strip trailing whitespace and carriage returns
+	    while(i > 0 && (start[i -1] == '\r' || start[i -1] == ' ' || start[i -1] == '\t'))
+		i--;
+
+	    if(i >= sizeof(linebuf))
+		continue;
+
+	    memcpy(linebuf, start, i);
+	    linebuf[i] = 0;
+	    line = linebuf;
+
+	    if(*line == '#'){
+		exactmatch = qtrue;
+		line++;
+	    }else{
+		exactmatch = qfalse;
+	    }
+
+	    if(strlen(line) >= sizeof(normalized))
+		continue;
+
+	    Censor_Normalize(normalized, line, sizeof(normalized), !exactmatch);
+	    if(!normalized[0] || wordbufpos + strlen(normalized) + 2 > wordbufsize)
+		continue;
+
+	    words[count] = wordbuf + wordbufpos;
+	    words[count][0] = exactmatch ? CENSOR_MATCH_EXACT : CENSOR_MATCH_SUBSTRING;
+	    strcpy(words[count] + 1, normalized);
+	    wordbufpos += strlen(normalized) + 2;
+	    count++;
+	}
+	FS_ReleaseFileView(filebuf);
+
+	Com_Printf("%i words parsed from badwords.txt\n",count);
+
+	if(!Censor_BuildAutomaton(&ac, words, count)){
+	    Com_Printf("Censor_Plugin: Out of memory, keeping the old list\n");
+	    Plugin_Free(words);
+	    return;
+	}
+	Plugin_Free(words);
+
+	if(badwords.memory)
+	    Plugin_Free(badwords.memory);
+	badwords = ac;
+
+	Com_Printf("Censor: init complete.\n");
+}
+
+void G_SayCensor_Reload_f()
+{
+	G_SayCensor_Init();
+}
+
+
+static int Censor_Run(censorAutomaton_t *ac, const char *token, int match)
+{
+	const unsigned char *c;
+	int state = 0;
+	int len = 0;
+
+	for(c = (const unsigned char*)token; *c; c++, len++){
+	    state = ac->next[state * ac->numClasses + ac->classes[*c]];
+	    if(match == CENSOR_MATCH_SUBSTRING && (ac->flags[state] & CENSOR_MATCH_SUBSTRING))
+		return 1;
+	}
+
+	// Only the states on the path of the whole token have its length as depth
+	return match == CENSOR_MATCH_EXACT && ac->depth[state] == len && (ac->flags[state] & CENSOR_MATCH_EXACT);
+}
+
+
 char* G_SayCensor(char *msg)
 {
 	char token2[1024];
 	char token[1024];
-	badwordsList_t *this;
 	char* ret = msg;
+
+	if(!badwords.numNodes)
+		return ret;
+
 	while(1){
 		msg = Com_ParseGetToken(msg);
 		if(msg==NULL)
 			break;
 
 		int size = Com_ParseTokenLength(msg);
+		if(size >= sizeof(token))
+			size = sizeof(token) - 1;
 		Q_strncpyz(token,msg,size+1);
 
 		removeColors(token2,token,sizeof(token2));
 		CharConv(token,token2,sizeof(token));//	'clear' token
 		censor_ignoreMultiple(token2,token,sizeof(token2));
 
-		for(this = badwords ; this ; this = this->next){
-			if(this->exactmatch){
-				if(!Q_stricmp(token,this->word)){
-					memset(msg,'*',size);
-					break;
-				}
-			}else{
-				if(strstr(token2,this->word)!=NULL){
-					memset(msg,'*',size);
-					break;
-				}
-			}
-		}
+		if(Censor_Run(&badwords, token, CENSOR_MATCH_EXACT) || Censor_Run(&badwords, token2, CENSOR_MATCH_SUBSTRING))
+			memset(msg,'*',size);
 	}
 	return ret;
 }
@@ -1,4 +1,5 @@
 void G_SayCensor_Init(void);
+void G_SayCensor_Reload_f(void);
 char* G_SayCensor(char *msg);
 
 
@@ -4,6 +4,7 @@
 PCL int OnInit(){	// Funciton called on server initiation
 
 	G_SayCensor_Init();
+	Plugin_AddCommand("censor_reload", G_SayCensor_Reload_f, 95);
 	
 	return 0;
 }
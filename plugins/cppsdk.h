@@ -0,0 +1,291 @@
+/*
+===========================================================================
+    C++ plugin SDK
+
+  Header only layer on top of pinc.h. Include it instead of pinc.h, derive
+  your plugin class from cod4x::Plugin<YourClass>, write the event handlers
+  you need as ordinary member functions and put COD4X_PLUGIN(YourClass)
+  into exactly one .cpp file. See cpptest/cpptest_plugin.cpp.
+
+  Handlers are called directly, no virtual functions are involved. Events
+  the class does not implement are left out of OnEventMask so the server
+  never calls them. Requires C++11.
+===========================================================================
+*/
+
+#ifndef PLUGIN_CPPSDK_H
+#define PLUGIN_CPPSDK_H
+
+#ifndef __cplusplus
+    #error The C++ plugin SDK can not be used from C, include pinc.h instead!
+#endif
+
+#include "pinc.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace cod4x {
+
+// Bit numbers of OnEventMask, same order as PHandler_Events in plugin_handler.c
+enum event_t {
+    EV_INFOREQUEST = 0,
+    EV_PLAYERDC,
+    EV_PLAYERCONNECT,
+    EV_EXITLEVEL,
+    EV_MESSAGESENT,
+    EV_FRAME,
+    EV_ONESECOND,
+    EV_TENSECONDS,
+    EV_CLIENTAUTHORIZED,
+    EV_CLIENTSPAWN,
+    EV_CLIENTENTERWORLD,
+    EV_TCPSERVERPACKET,
+    EV_UDPNETEVENT,
+    EV_UDPNETSEND,
+    EV_SPAWNSERVER,
+    EV_PREFASTRESTART,
+    EV_POSTFASTRESTART,
+    EV_TCPCLIENTCONNECT,
+    EV_FRAMEOVERRUN
+};
+
+/*
+==================
+  Plugin base
+
+ Every handler here is an empty placeholder. Hiding it in the derived class
+ is what marks the event as implemented. The object gets constructed right
+ before OnInit and destroyed right after OnUnload (also on reloadPlugin), so
+ members may use the Plugin_ functions in their constructors and destructors.
+==================
+*/
+
+template<class Derived>
+class Plugin {
+public:
+    static void OnInfoRequest(pluginInfo_t *info){}  // Called before the object exists, fill in the optional fields
+
+    int OnInit(){ return 0; }                          // 0 => Initialization successfull
+    void OnUnload(){}
+
+    void OnPlayerDC(client_t_ptr client){}
+    void OnPlayerConnect(int clientnum, netadr_t *from, char *originguid, char *userinfo, int authentication, const char **denied){}
+    void OnExitLevel(){}
+    void OnMessageSent(char *message, int slot, qboolean *show){}
+    void OnFrame(){}
+    void OnTenSeconds(){}
+    void OnClientSpawn(void *ent){}
+    void OnClientEnterWorld(client_t_ptr client){}
+    void OnUdpNetSend(netadr_t *to, const void *data, int len, qboolean *returnNow){}
+    void OnSpawnServer(){}
+    void OnPreFastRestart(){}
+    void OnPostFastRestart(){}
+    void OnTcpClientConnect(int connection, qboolean success){}
+    void OnFrameOverrun(unsigned int workUsec, unsigned int frameUsec, unsigned int simUsec, unsigned int snapUsec, unsigned int dropped){}
+
+protected:
+    Plugin(){}
+    ~Plugin(){}
+
+private:
+    Plugin(const Plugin&);
+    Plugin& operator=(const Plugin&);
+};
+
+namespace detail {
+
+// Storage of the one plugin object. Not a plain static object on purpose: the
+// server frees all Plugin_Malloc memory before dlclose, static destructors
+// would run after that.
+template<class T>
+struct Instance {
+    static typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+    static T& Object(){ return *reinterpret_cast<T*>(&storage); }
+    static void Create(){ new(&storage) T; }
+    static void Destroy(){ Object().~T(); }
+};
+
+template<class T>
+typename std::aligned_storage<sizeof(T), alignof(T)>::type Instance<T>::storage;
+
+} // namespace detail
+} // namespace cod4x
+
+// Is the member still the placeholder of cod4x::Plugin?
+#define COD4X_IMPLEMENTS(Class, name, bit) \
+    (std::is_same<decltype(&Class::name), decltype(&cod4x::Plugin<Class>::name)>::value ? 0u : 1u << cod4x::bit)
+
+/*
+====================================
+  COD4X_PLUGIN(Class)
+
+ Emits the callbacks the server looks up
+ and forwards them to the plugin object.
+====================================
+*/
+
+#define COD4X_PLUGIN(Class) \
+    typedef cod4x::detail::Instance<Class> cod4xInstance_t; \
+    \
+    PCL unsigned int OnEventMask(){ \
+        return 1u << cod4x::EV_INFOREQUEST \
+            | COD4X_IMPLEMENTS(Class, OnPlayerDC, EV_PLAYERDC) \
+            | COD4X_IMPLEMENTS(Class, OnPlayerConnect, EV_PLAYERCONNECT) \
+            | COD4X_IMPLEMENTS(Class, OnExitLevel, EV_EXITLEVEL) \
+            | COD4X_IMPLEMENTS(Class, OnMessageSent, EV_MESSAGESENT) \
+            | COD4X_IMPLEMENTS(Class, OnFrame, EV_FRAME) \
+            | COD4X_IMPLEMENTS(Class, OnTenSeconds, EV_TENSECONDS) \
+            | COD4X_IMPLEMENTS(Class, OnClientSpawn, EV_CLIENTSPAWN) \
+            | COD4X_IMPLEMENTS(Class, OnClientEnterWorld, EV_CLIENTENTERWORLD) \
+            | COD4X_IMPLEMENTS(Class, OnUdpNetSend, EV_UDPNETSEND) \
+            | COD4X_IMPLEMENTS(Class, OnSpawnServer, EV_SPAWNSERVER) \
+            | COD4X_IMPLEMENTS(Class, OnPreFastRestart, EV_PREFASTRESTART) \
+            | COD4X_IMPLEMENTS(Class, OnPostFastRestart, EV_POSTFASTRESTART) \
+            | COD4X_IMPLEMENTS(Class, OnTcpClientConnect, EV_TCPCLIENTCONNECT) \
+            | COD4X_IMPLEMENTS(Class, OnFrameOverrun, EV_FRAMEOVERRUN); \
+    } \
+    \
+    PCL void OnInfoRequest(pluginInfo_t *info){ \
+        info->handlerVersion.major = PLUGIN_HANDLER_VERSION_MAJOR; \
+        info->handlerVersion.minor = PLUGIN_HANDLER_VERSION_MINOR; \
+        Class::OnInfoRequest(info); \
+    } \
+    \
+    PCL int OnInit(){ \
+        int ret; \
+        cod4xInstance_t::Create(); \
+        ret = cod4xInstance_t::Object().OnInit(); \
+        if(ret != 0) \
+            cod4xInstance_t::Destroy(); \
+        return ret; \
+    } \
+    PCL void OnUnload(){ \
+        cod4xInstance_t::Object().OnUnload(); \
+        cod4xInstance_t::Destroy(); \
+    } \
+    \
+    PCL void OnPlayerDC(client_t_ptr client){ cod4xInstance_t::Object().OnPlayerDC(client); } \
+    PCL void OnPlayerConnect(int clientnum, netadr_t *from, char *originguid, char *userinfo, int authentication, const char **denied){ \
+        cod4xInstance_t::Object().OnPlayerConnect(clientnum, from, originguid, userinfo, authentication, denied); \
+    } \
+    PCL void OnExitLevel(){ cod4xInstance_t::Object().OnExitLevel(); } \
+    PCL void OnMessageSent(char *message, int slot, qboolean *show){ cod4xInstance_t::Object().OnMessageSent(message, slot, show); } \
+    PCL void OnFrame(){ cod4xInstance_t::Object().OnFrame(); } \
+    PCL void OnTenSeconds(){ cod4xInstance_t::Object().OnTenSeconds(); } \
+    PCL void OnClientSpawn(void *ent){ cod4xInstance_t::Object().OnClientSpawn(ent); } \
+    PCL void OnClientEnterWorld(client_t_ptr client){ cod4xInstance_t::Object().OnClientEnterWorld(client); } \
+    PCL void OnUdpNetSend(netadr_t *to, const void *data, int len, qboolean *returnNow){ \
+        cod4xInstance_t::Object().OnUdpNetSend(to, data, len, returnNow); \
+    } \
+    PCL void OnSpawnServer(){ cod4xInstance_t::Object().OnSpawnServer(); } \
+    PCL void OnPreFastRestart(){ cod4xInstance_t::Object().OnPreFastRestart(); } \
+    PCL void OnPostFastRestart(){ cod4xInstance_t::Object().OnPostFastRestart(); } \
+    PCL void OnTcpClientConnect(int connection, qboolean success){ cod4xInstance_t::Object().OnTcpClientConnect(connection, success); } \
+    PCL void OnFrameOverrun(unsigned int workUsec, unsigned int frameUsec, unsigned int simUsec, unsigned int snapUsec, unsigned int dropped){ \
+        cod4xInstance_t::Object().OnFrameOverrun(workUsec, frameUsec, simUsec, snapUsec, dropped); \
+    }
+
+namespace cod4x {
+
+/*
+==================
+  PluginPtr<T>
+
+ Owns a block from Plugin_Malloc and gives it back with Plugin_Free.
+ Only for trivial types, nothing gets constructed in the block.
+==================
+*/
+
+template<class T>
+class PluginPtr {
+public:
+    static_assert(std::is_trivial<T>::value, "PluginPtr only holds trivial types");
+
+    PluginPtr() : ptr(NULL){}
+    explicit PluginPtr(T *p) : ptr(p){}
+    PluginPtr(PluginPtr&& other) : ptr(other.ptr){ other.ptr = NULL; }
+    ~PluginPtr(){ reset(); }
+
+    PluginPtr& operator=(PluginPtr&& other){
+        if(this != &other){
+            reset(other.ptr);
+            other.ptr = NULL;
+        }
+        return *this;
+    }
+
+    T* get() const { return ptr; }
+    T& operator*() const { return *ptr; }
+    T* operator->() const { return ptr; }
+    T& operator[](size_t i) const { return ptr[i]; }
+    explicit operator bool() const { return ptr != NULL; }
+
+    T* release(){
+        T *p = ptr;
+        ptr = NULL;
+        return p;
+    }
+    void reset(T *p = NULL){
+        if(ptr != NULL)
+            Plugin_Free(ptr);
+        ptr = p;
+    }
+
+private:
+    PluginPtr(const PluginPtr&);
+    PluginPtr& operator=(const PluginPtr&);
+
+    T *ptr;
+};
+
+// Plugin_Malloc room for count objects, empty if the server refused it
+template<class T>
+inline PluginPtr<T> Allocate(size_t count = 1){
+    return PluginPtr<T>(static_cast<T*>(Plugin_Malloc(sizeof(T) * count)));
+}
+
+/*
+==================
+  TcpConnection
+
+ One of the plugin's TCP connection slots (0 to 3). Closed when
+ the object goes away, OnTcpClientConnect tells when it is up.
+==================
+*/
+
+class TcpConnection {
+public:
+    explicit TcpConnection(int connection) : connection(connection), open(false){}
+    ~TcpConnection(){ Close(); }
+
+    bool Connect(const char *remote){
+        Close();
+        open = Plugin_TcpConnect(connection, remote) == qtrue;
+        return open;
+    }
+    int Receive(void *buf, int size){ return Plugin_TcpGetData(connection, buf, size); }
+    bool Send(const void *data, int len){ return Plugin_TcpSendData(connection, const_cast<void*>(data), len) == qtrue; }
+    void Close(){
+        if(open){
+            Plugin_TcpCloseConnection(connection);
+            open = false;
+        }
+    }
+
+    int Slot() const { return connection; }
+    bool IsOpen() const { return open; }
+
+private:
+    TcpConnection(const TcpConnection&);
+    TcpConnection& operator=(const TcpConnection&);
+
+    int connection;
+    bool open;
+};
+
+} // namespace cod4x
+
+#endif /*PLUGIN_CPPSDK_H*/
@@ -1,12 +1,12 @@
 /*
 ============================
-    Plugin INClude file
+   C++ plugin SDK include
   This contains plugin lib
- This file must be included
+ and includes pinc.h for us
 ============================
 */
 
-#include "../pinc.h"
+#include "../cppsdk.h"
 
 /*
 ==================
@@ -14,57 +14,56 @@
 ==================
 */
 #include <cstring>
-#include <string>
 
 /*
-===========================
-     OnInit callback
- This is a function called
-  right after the plugin
-        is loaded.
-===========================
+============================
+      The plugin class
+ Only the events written here
+  get called by the server,
+  all others are left out.
+============================
 */
 
-PCL int OnInit(){ // Function executed after the plugin is loaded on the server.
+class CppTest : public cod4x::Plugin<CppTest> {
+public:
+    CppTest() : frames(0){}
 
-    Com_Printf("Hello, world! :D\n");
-	return 0;	// 0 => Initialization successfull.
-}
-/*
-=========================
-    Event callbacks
- Those are not mandatory
-=========================
-*/
-PCL void OnPlayerConnect(int slotNum);
-PCL void OnPlayerDC(int slotNum);
-PCL void OnExitLevel();
-PCL void OnMessageSent(char *message);
-PCL void OnTenSeconds();
-PCL void OnFrame();
-PCL void OnClientAuthorized();
-PCL void OnClientSpawn();
-PCL void OnClietnEnterWorld();
-PCL void TCPServerPacket();
+    static void OnInfoRequest(pluginInfo_t *info){	// Function used to obtain information about the plugin
+        // Memory pointed by info is allocated by the server binary, just fill in the fields
+        // The handler version is filled in by the SDK
 
-/*
-============================
-   OnInfoRequest callback
- This function is mandatory
-============================
-*/
+        info->pluginVersion.major = 1;
+        info->pluginVersion.minor = 1;	// Plugin version
+        strncpy(info->fullName,"An example C++ plugin.",sizeof(info->fullName)); //Full plugin name
+        strncpy(info->shortDescription,"This is the plugin's short description.",sizeof(info->shortDescription)); // Short plugin description
+        strncpy(info->longDescription,"This is the plugin's long description.",sizeof(info->longDescription));
+    }
+
+    int OnInit(){	// Function executed after the plugin is loaded on the server.
+        buffer = cod4x::Allocate<char>(1024);	// Given back with Plugin_Free when the plugin unloads
+        if(!buffer)
+            return -1;
+
+        Com_Printf("Hello, world! :D\n");
+        return 0;	// 0 => Initialization successfull.
+    }
+
+    void OnFrame(){
+        ++frames;
+    }
+
+    void OnTenSeconds(){
+        Com_Printf("cpptest: %u server frames during the last ten seconds\n", frames);
+        frames = 0;
+    }
+
+    void OnMessageSent(char *message, int slot, qboolean *show){
+        strncpy(buffer.get(), message, 1023);	// Keep a copy of the last chat message
+    }
+
+private:
+    cod4x::PluginPtr<char> buffer;
+    unsigned int frames;
+};
 
-PCL void OnInfoRequest(pluginInfo_t *info){	// Function used to obtain information about the plugin
-    // Memory pointed by info is allocated by the server binary, just fill in the fields
-    
-    // =====  MANDATORY FIELDS  =====
-    info->handlerVersion.major = PLUGIN_HANDLER_VERSION_MAJOR;
-    info->handlerVersion.minor = PLUGIN_HANDLER_VERSION_MINOR;	// Requested handler version, we request the version compatible with this plugin lib
-    
-    // =====  OPTIONAL  FIELDS  =====
-    info->pluginVersion.major = 1;
-    info->pluginVersion.minor = 0;	// Plugin version
-    strncpy(info->fullName,"An example C++ plugin.",sizeof(info->fullName)); //Full plugin name
-    strncpy(info->shortDescription,"This is the plugin's short description.",sizeof(info->shortDescription)); // Short plugin description
-    strncpy(info->longDescription,"This is the plugin's long description.",sizeof(info->longDescription));
-}
+COD4X_PLUGIN(CppTest)
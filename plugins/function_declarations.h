@@ -50,6 +50,8 @@
     __cdecl int FS_ReadLine(void *buffer, int len, fileHandle_t f);          // Read a line from file
     __cdecl int FS_Write(const void *buffer, int len, fileHandle_t h);       // Write to file
     __cdecl qboolean FS_FCloseFile(fileHandle_t f);                          // Cloase an open file
+    __cdecl const byte* FS_SV_AcquireFileView(const char *filename, int *size); // Read only mapping of a whole file, shared with everyone who maps the same file. NULL if it does not exist (*size is -1) or can not be mapped (*size is the length)
+    __cdecl void FS_ReleaseFileView(const byte* view);                       // Every mapping from FS_SV_AcquireFileView needs this once
 
 
     //      == Networking ==
@@ -63,14 +65,21 @@
     __cdecl int Plugin_Cmd_GetInvokerUid();                                  // Get UID of command invoker
     __cdecl int Plugin_GetPlayerUid(int slot);                               // Get UID of a plyer
     __cdecl int Plugin_GetSlotCount();                                       // Get number of server slots
+    __cdecl int Plugin_GetPlayerSnapshot(pluginPlayerSnapshot_t *snap);      // Fill in the state of all clients at once, returns the number of connected clients
+    __cdecl qboolean Plugin_GetClientNetStats(unsigned int clientslot, pluginNetStats_t *stats); // Ping percentiles, jitter and loss of a client, qfalse if the slot is not connected
+    __cdecl qboolean Plugin_GetClientNetchanStats(unsigned int clientslot, pluginNetchanStats_t *stats); // Traffic counters of a client, qfalse if the slot is not connected
+    __cdecl qboolean Plugin_GetClientGeoInfo(unsigned int clientslot, pluginGeoInfo_t *info); // Country, ASN and proxy flag of a client, qfalse if not connected or no IPv4 address
     __cdecl qboolean Plugin_IsSvRunning();                                   // Is server running?
     __cdecl void Plugin_ChatPrintf(int slot, char *fmt, ...);                  // Print to player's chat (-1 for all)
     __cdecl void Plugin_BoldPrintf(int slot, char *fmt, ...);                  // Print to the player's screen (-1 for all)
     __cdecl char *Plugin_GetPlayerName(int slot);                            // Get a name of a player
+    __cdecl qboolean Plugin_SaveReplay(unsigned int clientslot, const char* basename); // Write the recent demo messages of a player to a demo (sv_replayBufferSize)
     __cdecl void Plugin_AddCommand(char *name, xcommand_t command, int defaultpower); // Add a server command
     __cdecl void *Plugin_Malloc(size_t size);                                // Same as stdlib.h function malloc
     __cdecl void Plugin_Free(void *ptr);                                     // Same as stdlib.h function free
     __cdecl void Plugin_Error(int code, char *string);                       // Notify the server of an error, action depends on code parameter
+    __cdecl int Plugin_SubmitJob(void (*job)(void*), void (*completion)(void*), void *arg); // Run job on a worker thread, completion follows on the main thread. Returns a handle or -1
+    __cdecl qboolean Plugin_JobDone(int handle);                             // Has the completion of the job run?
     __cdecl int Plugin_GetLevelTime();                                       // Self explanatory
     __cdecl int Plugin_GetServerTime();                                      // Self explanatory
 
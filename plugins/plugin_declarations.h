@@ -21,3 +21,55 @@ typedef struct{			        // To be used in OnInfoRequest
     char shortDescription[128];	// Describe in a few words what this plugin does - optional
     char longDescription[1024];	// Full description - optional
 }pluginInfo_t;
+
+#define PLUGIN_SNAPSHOT_MAXCLIENTS 64
+
+typedef struct{                 // Filled by Plugin_GetPlayerSnapshot, one array per field so loops over all clients stay on few cache lines
+    int numClients;             // Number of slots, every array is valid up to here
+    int serverTime;             // svs.time at the time of the snapshot
+    unsigned char state[PLUGIN_SNAPSHOT_MAXCLIENTS];    // Connection state, 0 is a free slot and 4 is active in game
+    unsigned char team[PLUGIN_SNAPSHOT_MAXCLIENTS];
+    short ping[PLUGIN_SNAPSHOT_MAXCLIENTS];
+    int uid[PLUGIN_SNAPSHOT_MAXCLIENTS];
+    int score[PLUGIN_SNAPSHOT_MAXCLIENTS];
+    int kills[PLUGIN_SNAPSHOT_MAXCLIENTS];
+    int deaths[PLUGIN_SNAPSHOT_MAXCLIENTS];
+    int assists[PLUGIN_SNAPSHOT_MAXCLIENTS];
+    float origin[PLUGIN_SNAPSHOT_MAXCLIENTS][3];       // Only valid for active clients
+    float viewangles[PLUGIN_SNAPSHOT_MAXCLIENTS][3];
+    char name[PLUGIN_SNAPSHOT_MAXCLIENTS][64];
+    char guid[PLUGIN_SNAPSHOT_MAXCLIENTS][33];
+}pluginPlayerSnapshot_t;
+
+typedef struct{                 // Filled by Plugin_GetClientNetStats, round trips in msec
+    int ping;                   // What the scoreboard shows, see sv_pingEstimator
+    int mean;                   // Of the last acknowledged frames
+    int p50;
+    int p95;
+    int jitter;
+    int samples;                // Acknowledged frames the round trips are taken from
+    float loss;                 // Recent share of the packets of the client which got lost, 0.0 to 1.0
+    unsigned int received;      // Packets since the connect
+    unsigned int lost;
+}pluginNetStats_t;
+
+typedef struct{                 // Filled by Plugin_GetClientNetchanStats, since the connect of the client
+    unsigned long long bytesIn; // Whole datagrams including the netchan header
+    unsigned long long bytesOut;
+    unsigned int packetsIn;
+    unsigned int packetsOut;
+    unsigned int fragmentsIn;   // Packets which carried a piece of a bigger message
+    unsigned int fragmentsOut;
+    unsigned int dropped;       // Packets of the client which never arrived
+    unsigned int outOfOrder;    // Late or duplicated packets of the client
+    unsigned int retransmits;   // Download blocks which had to be sent again
+    unsigned long long encodeUsec; // Compressing and encoding of the messages to the client
+}pluginNetchanStats_t;
+
+typedef struct{                 // Filled by Plugin_GetClientGeoInfo
+    int countryIndex;
+    char countryCode[4];        // "--" if unknown
+    char continentCode[4];
+    char asn[64];               // "AS<number> <organisation>", empty without GeoIPASNum.dat
+    qboolean proxy;             // Listed as anonymous proxy
+}pluginGeoInfo_t;
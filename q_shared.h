@@ -186,6 +186,16 @@ char* Q_BitConv(int val);
 char	* QDECL va( char *format, ... );
 void Com_TruncateLongString( char *buffer, const char *s );
 
+/*
+SSE2 code paths get compiled with the target attribute as the build does not enable
+the instruction set, and Q_UseSSE2() has to be checked before calling them
+*/
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define Q_HAVE_SSE2
+#define Q_SSE2 __attribute__ ((target ("sse2")))
+qboolean Q_UseSSE2( void );
+#endif
+
 
 qboolean Info_Validate( const char *s );
 char *Info_ValueForKey( const char *s, const char *key );
@@ -193,6 +203,31 @@ void Info_SetValueForKey( char *s, const char *key, const char *value );
 void BigInfo_SetValueForKey( char *s, const char *key, const char *value );
 void Info_Print( const char *s );
 
+/*
+Parsed view of an info string for repeated lookups. Holds its own copy of the string
+and gives the same results as Info_ValueForKey() on it
+*/
+#define INFODICT_MAX_KEYS	( MAX_INFO_STRING / 4 )
+#define INFODICT_HASH_SIZE	( 2 * INFODICT_MAX_KEYS )
+
+typedef struct{
+	unsigned int	hash;
+	const char	*key;
+	const char	*value;
+}infoDictEntry_t;
+
+typedef struct{
+	int		numKeys;
+	qboolean	overflowed;		//Too many keys, lookups fall back to Info_ValueForKey()
+	unsigned short	slots[INFODICT_HASH_SIZE];	//Entry index +1, 0 is empty
+	infoDictEntry_t	entries[INFODICT_MAX_KEYS];
+	char		source[MAX_INFO_STRING];
+	char		buffer[MAX_INFO_STRING];
+}infoDict_t;
+
+void Info_BuildDict( infoDict_t *dict, const char *s );
+const char *Info_DictValueForKey( const infoDict_t *dict, const char *key );
+
 int SV_Cmd_Argc( void );
 int	Cmd_Argc( void );
 char	*SV_Cmd_Argv( int arg );
@@ -43,6 +43,17 @@ void Com_Init(char* cmdline);
 void Com_UpdateRealtime();
 time_t Com_GetRealtime();
 int QDECL Com_AddTimedEvent( int delay, void *function, unsigned int argcount, ...);
+qboolean Com_CancelTimedEvent( int handle );
+void Com_MakeTimedEventArgCached(unsigned int index, unsigned int arg, unsigned int size);
+
+typedef enum {
+	// bk001129 - make sure SE_NONE is zero
+	SE_NONE = 0,    // evTime is still valid
+	SE_CONSOLE, // evPtr is a char*
+	SE_PACKET   // evPtr is a netadr_t followed by data bytes to evPtrLength
+} sysEventType_t;
+
+qboolean Com_QueueEvent( int time, sysEventType_t type, int value, int value2, int ptrLength, void *ptr );
 
 void Com_RandomBytes( byte *string, int len );
 int Com_HashKey( char *string, int maxlen );
@@ -53,14 +53,37 @@ void QDECL Com_PrintNoRedirect( const char *fmt, ... );
 void QDECL Com_PrintError( const char *fmt, ... );
 void QDECL Com_PrintWarning( const char *fmt, ... );
 void QDECL Com_PrintWarningNoRedirect( const char *fmt, ... );
-void QDECL Com_DPrintf( const char *fmt, ... );
+void QDECL (Com_DPrintf)( const char *fmt, ... );
 void QDECL Com_DPrintfWrapper( int drop, const char *fmt, ...);
-void QDECL Com_DPrintNoRedirect( const char *fmt, ... );
+void QDECL (Com_DPrintNoRedirect)( const char *fmt, ... );
 void QDECL Com_Error( int a, const char *error, ...);
 void QDECL Com_PrintRedirect(char *msg, int msglen);
-void Com_AddRedirect(void (*rd_dest)( const char *, int));
 void __cdecl Com_ErrorCleanup(void);
 void QDECL Com_PrintScriptRuntimeWarning( const char *fmt, ... );
 __cdecl void Com_PrintMessage( int dumbIWvar, char *msg, msgtype_t type);
 
+/*
+Developer output channels. com_dprintLevel holds the verbosity of each of them,
+0 while it is off, and follows developer and the developer_<channel> cvars.
+The macros test it before the call, so disabled output does not even
+evaluate the arguments. The functions stay exported for the plugins.
+*/
+typedef enum{
+    DPRINT_GENERAL,     //developer
+    DPRINT_NET,         //developer_net
+    DPRINT_FS,          //developer_fs
+    DPRINT_SCRIPT,      //developer_script
+    DPRINT_PLUGIN,      //developer_plugin
+    DPRINT_NUM_CHANNELS
+}dprintChannel_t;
+
+extern int com_dprintLevel[DPRINT_NUM_CHANNELS];
+
+void Com_InitDPrintChannels( void );
+void QDECL Com_DPrintChannel( const char *fmt, ... );
+
+#define Com_DPrintf(...) do{ if(com_dprintLevel[DPRINT_GENERAL]) (Com_DPrintf)(__VA_ARGS__); }while(0)
+#define Com_DPrintNoRedirect(...) do{ if(com_dprintLevel[DPRINT_GENERAL]) (Com_DPrintNoRedirect)(__VA_ARGS__); }while(0)
+#define Com_DPrintfChannel(channel, level, ...) do{ if(com_dprintLevel[channel] >= (level)) Com_DPrintChannel(__VA_ARGS__); }while(0)
+
 #endif
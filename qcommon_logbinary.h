@@ -0,0 +1,75 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+#ifndef __QCOMMON_LOGBINARY_H__
+#define __QCOMMON_LOGBINARY_H__
+
+/*
+Binary log format of games_mp.bin and adminactions.bin
+
+The file is a sequence of blocks, new blocks get appended. Each block starts with
+logBinaryBlockHeader_t and can be decoded on its own. If storedLength is smaller
+than rawLength the data is a LZ4 block (the raw block format of liblz4), otherwise
+it got stored as it is.
+
+The raw data is a sequence of records:
+	varint		length of the rest of the record
+	byte		type, LOGBINARY_NONEWLINE set if the line did not end with a newline
+	varint		time difference to the record before in the block, zigzag encoded
+	varint		number of fields
+	fields		varint header, header & 1: an integer field with the zigzag encoded value in header >> 1
+			otherwise a string field of header >> 1 bytes which follow
+
+The line is the fields joined by ';'. Types other than LOGBINARY_TEXT stand for the
+first field and are followed by ';' if there are fields. The time of the game log is
+level.time in msec and the one of the admin log unix time in seconds.
+Varints are little endian base 128. Nothing in here depends on the server headers,
+the reader in tools/ includes this file too.
+*/
+
+#define LOGBINARY_BLOCKMAGIC 0x4c423443		//"C4BL"
+#define LOGBINARY_VERSION 1
+#define LOGBINARY_BLOCKSIZE 0x3000		//Blocks have to fit into a quarter of the smallest buffer of the async log writer
+#define LOGBINARY_MAXLINE 1024
+
+#define LOGBINARY_STREAM_GAME 0
+#define LOGBINARY_STREAM_ADMIN 1
+
+#define LOGBINARY_TEXT 0
+#define LOGBINARY_NONEWLINE 0x80
+
+//Names of the types in the order of their values, the first fields of the game log which are common
+#define LOGBINARY_TYPENAMES { NULL, "K", "D", "J", "Q", "W", "L", "say", "sayteam", "tell", "Weapon", "ShutdownGame:" }
+#define LOGBINARY_NUMTYPES 12
+
+typedef struct{
+	unsigned int	magic;
+	unsigned short	version;
+	unsigned short	stream;
+	unsigned int	rawLength;
+	unsigned int	storedLength;
+	unsigned int	records;
+	unsigned int	realtime;		//Unix time of the first record in the block
+}logBinaryBlockHeader_t;
+
+#endif
@@ -26,11 +26,33 @@
 #define __QCOMMON_LOGPRINT_H__
 
 #include "q_shared.h"
+#include "filesystem.h"
+#include "cvar.h"
+
+#define LOGWRITER_CONSOLE 0
+#define LOGWRITER_ADMIN 1
+#define LOGWRITER_ENTERLEAVE 2
+#define LOGWRITER_GAME 3
+#define LOGWRITER_GAMEBINARY 4
+#define LOGWRITER_ADMINBINARY 5
+#define MAX_LOGWRITER_SLOTS 6
 
 void QDECL SV_EnterLeaveLog( const char *fmt, ... );
 void QDECL Com_PrintAdministrativeLog( const char *msg );
 void Com_PrintLogfile( const char *msg );
 void Com_CloseLogFiles(void);
+void Com_InitLogWriter(void);
+void Com_SyncLogWriter(void);
+void Com_WriteLog(int slot, fileHandle_t handle, const char* msg, int len, qboolean sync);
+void Com_ReleaseLog(fileHandle_t handle);
+
+//Structured binary logs, see qcommon_logbinary.h
+extern cvar_t* com_logBinary;
+
+void Com_InitBinaryLogs(void);
+void Com_WriteBinaryLog(int stream, int time, const char* line, int len);
+void Com_FlushBinaryLogs(qboolean force);
+void Com_CloseBinaryLogs(void);
 
 #endif
 
@@ -34,13 +34,30 @@ void __cdecl Hunk_ClearTempMemory(void);
 void __cdecl Hunk_ClearTempMemoryHigh(void);
 void* __cdecl Hunk_AllocateTempMemory(int size);
 void __cdecl Hunk_FreeTempMemory(void *buffer);
-void* __cdecl Z_Malloc( int size);
 void __cdecl Mem_Init(void);
 void __cdecl Mem_BeginAlloc(const char*, qboolean);
 void __cdecl Mem_EndAlloc(const char*, int);
 void* __cdecl TempMalloc( int );
 
-#define Z_Free free
+typedef enum{
+	TAG_GENERAL,
+	TAG_COMMANDS,
+	TAG_ADMINS,
+	TAG_QUERYLIMIT,
+	TAG_EVENTS,
+	TAG_SCRIPT,
+	TAG_DOWNLOAD,
+	TAG_PLUGINS,
+	TAG_COUNT
+}memtag_t;
+
+void* Z_TagMalloc( int size, memtag_t tag );
+void Z_TagFree( void *ptr );
+void Z_LevelCheck( void );
+void Z_MemInfo_f( void );
+
+#define Z_Malloc( size ) Z_TagMalloc( size, TAG_GENERAL )
+#define Z_Free Z_TagFree
 
 #endif
 
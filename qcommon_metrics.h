@@ -0,0 +1,56 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+
+#ifndef __QCOMMON_METRICS_H__
+#define __QCOMMON_METRICS_H__
+
+#include "q_shared.h"
+
+/*
+Prometheus text exposition format (version 0.0.4). Each module which owns counters
+exports a *_WriteMetrics function which appends to the buffer. A line which does
+not fit is dropped as a whole, so a truncated scrape stays parseable
+*/
+
+typedef struct{
+	char* data;
+	int size;
+	int len;
+	qboolean overflowed;
+}metricsBuf_t;
+
+void Metrics_Init( metricsBuf_t* buf, char* data, int size );
+void Metrics_Printf( metricsBuf_t* buf, const char* fmt, ... ) __attribute__ ((format (printf, 2, 3)));
+void Metrics_Declare( metricsBuf_t* buf, const char* name, const char* type, const char* help );
+
+void Com_ProfileWriteMetrics( metricsBuf_t* buf );
+void Z_WriteMetrics( metricsBuf_t* buf );
+void PHandler_WriteMetrics( metricsBuf_t* buf );
+void SV_WriteMetrics( metricsBuf_t* buf );
+void SVC_RateLimitWriteMetrics( metricsBuf_t* buf );
+void SV_DemoWriteMetrics( metricsBuf_t* buf );
+void SV_SnapshotShedWriteMetrics( metricsBuf_t* buf );
+
+#endif
@@ -0,0 +1,62 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+    Copyright (C) 1999-2005 Id Software, Inc.
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+#ifndef __QCOMMON_PROFILE_H__
+#define __QCOMMON_PROFILE_H__
+
+#include "q_shared.h"
+
+typedef enum{
+    PROFILE_FRAME,              //Everything but the sleep between server frames
+    PROFILE_SLEEP,
+    PROFILE_SERVERFRAME,
+    PROFILE_GAMEFRAME,
+    PROFILE_SENDCLIENTMESSAGES,
+    PROFILE_PLUGINFRAME,
+    PROFILE_EVENTLOOP,
+    PROFILE_NETWORK,
+    PROFILE_COMMANDS,
+    PROFILE_GAMELOG,
+    MAX_PROFILE_SCOPES
+}profileScope_t;
+
+extern qboolean com_profiling;
+
+//Main thread only. Costs one compare while profiling is off
+#define PROFILE_BEGIN(scope) if(com_profiling) Com_ProfileBegin(scope)
+#define PROFILE_END(scope) if(com_profiling) Com_ProfileEnd(scope)
+
+void Com_InitProfiler(void);
+void Com_ProfileBegin(profileScope_t scope);
+void Com_ProfileEnd(profileScope_t scope);
+void Com_ProfileFrame(void);
+
+//Startup phases from main() until the first frame completed. Phase names have to be string literals
+extern qboolean com_startupPending;
+
+void Com_StartupPhase(const char* name);
+void Com_StartupDone(void);
+
+#endif
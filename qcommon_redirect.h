@@ -0,0 +1,58 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+#ifndef __QCOMMON_REDIRECT_H__
+#define __QCOMMON_REDIRECT_H__
+
+#include "q_shared.h"
+#include "qcommon_metrics.h"
+
+/*
+Everything the console, the gamelog and the chat put out goes to the redirect
+sinks registered for the channel. Synchronous sinks get called from within the
+print. Queued sinks get the messages copied into a buffer of their own and
+delivered by Com_RedirectFlush once per frame on the main thread, a full buffer
+drops messages and counts them.
+*/
+
+typedef enum{
+	RD_CHANNEL_CONSOLE,
+	RD_CHANNEL_GAMELOG,
+	RD_CHANNEL_CHAT,
+	RD_NUM_CHANNELS
+}rdChannel_t;
+
+typedef void (*rdMessageSink_t)( const char* msg, int len );
+typedef void (*rdChatSink_t)( const char* msg, int client, int mode );
+
+void Com_AddRedirect( const char* name, rdMessageSink_t sink, qboolean queued );
+void G_PrintAddRedirect( const char* name, rdMessageSink_t sink, qboolean queued );
+void G_AddChatRedirect( const char* name, rdChatSink_t sink, qboolean queued );
+
+void Com_RedirectPublish( rdChannel_t channel, const char* msg, int len, int client, int mode );
+void Com_RedirectFlush( void );
+void Com_RedirectStatus_f( void );
+void Com_RedirectWriteMetrics( metricsBuf_t* buf );
+
+#endif
@@ -365,21 +365,209 @@ void Q_strlcat( char *dest, size_t size, const char *src, int cpylimit) {
 Q_strrepl
 =============
 */
+static size_t Q_strnreplAppend( char *dest, size_t size, size_t used, const char *src, size_t len ) {
+
+    if(used + len >= size)
+        len = size - used -1;
+
+    Com_Memcpy(dest + used, src, len);
+    return used + len;
+}
+
+//Single pass, dest gets written once from the front. An empty find copies src
 void Q_strnrepl( char *dest, size_t size, const char *src, const char* find, const char* replacement) {
 
     char* new;
-    *dest = 0;
+    size_t findlen, replen, used;
 
-    int findlen = strlen(find);
+    if(size < 1)
+        return;
 
-    while((new = strstr(src, find)) != NULL){
-        Q_strlcat(dest, size, src, new - src);
-        Q_strlcat(dest, size, replacement, 0);
+    findlen = strlen(find);
+    replen = strlen(replacement);
+    used = 0;
+
+    while(findlen > 0 && used < size -1 && (new = strstr(src, find)) != NULL){
+        used = Q_strnreplAppend(dest, size, used, src, new - src);
+        used = Q_strnreplAppend(dest, size, used, replacement, replen);
         src = &new[findlen];
     }
-    Q_strlcat(dest, size, src, 0);
+    used = Q_strnreplAppend(dest, size, used, src, strlen(src));
+    dest[used] = 0;
+}
+
+
+/*
+=============
+SSE2 string scanning
+
+Most strings contain no color codes and nothing else these functions have to look at, so
+16 bytes get tested at once until something interesting shows up. The scalar code then
+handles that character. Loads are aligned and can never cross into an unmapped page.
+The instruction set gets checked at runtime as the build does not enable SSE2.
+=============
+*/
+#ifdef Q_HAVE_SSE2
+
+#define Q_HAVE_SSE2_STRINGS
+#include <emmintrin.h>
+
+qboolean Q_UseSSE2( void ) {
+
+	static int supported = -1;
+
+	if(supported == -1){
+		__builtin_cpu_init();
+		supported = __builtin_cpu_supports("sse2") ? 1 : 0;
+	}
+	return supported;
+}
+
+Q_SSE2 static const char *Q_stristrSSE2( const char *s, const char *find, char c ) {
+
+	__m128i upper, lower, v, zero;
+	char sc;
+	size_t len;
+	int mask;
+
+	upper = _mm_set1_epi8(c);
+	lower = _mm_set1_epi8(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+	zero = _mm_setzero_si128();
+	len = strlen(find);
+
+	while(1){
+
+		if(((size_t)s & 15) == 0){
+			v = _mm_load_si128((const __m128i*)s);
+			mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, upper), _mm_cmpeq_epi8(v, lower)), _mm_cmpeq_epi8(v, zero)));
+			if(!mask){
+				s += 16;
+				continue;
+			}
+			s += __builtin_ctz(mask);
+		}
+
+		if ((sc = *s) == 0)
+			return NULL;
+		if (sc >= 'a' && sc <= 'z')
+			sc -= ('a' - 'A');
+		if (sc == c && Q_stricmpn(s +1, find, len) == 0)
+			return s;
+		s++;
+	}
+}
+
+Q_SSE2 static int Q_PrintStrlenSSE2( const char *p ) {
+
+	__m128i caret, v, zero;
+	int len, mask;
+
+	caret = _mm_set1_epi8(Q_COLOR_ESCAPE);
+	zero = _mm_setzero_si128();
+	len = 0;
+
+	while(1){
+
+		if(((size_t)p & 15) == 0){
+			v = _mm_load_si128((const __m128i*)p);
+			mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, caret), _mm_cmpeq_epi8(v, zero)));
+			if(!mask){
+				p += 16;
+				len += 16;
+				continue;
+			}
+			mask = __builtin_ctz(mask);
+			p += mask;
+			len += mask;
+		}
+
+		if(!*p)
+			return len;
+		if( Q_IsColorString( p ) ) {
+			p += 2;
+			continue;
+		}
+		p++;
+		len++;
+	}
+}
+
+Q_SSE2 static void Q_CleanStrSSE2( char *string ) {
+
+	__m128i caret, v, printable;
+	char *d, *s;
+	int c, mask;
+
+	caret = _mm_set1_epi8(Q_COLOR_ESCAPE);
+	printable = _mm_set1_epi8(0x20);
+	s = d = string;
+
+	while (1) {
+
+		if(((size_t)s & 15) == 0){
+			v = _mm_load_si128((const __m128i*)s);
+			//Signed compare like the scalar code: catches 0, control characters and everything above 0x7f
+			mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, caret), _mm_cmplt_epi8(v, printable)));
+			if(!mask){
+				if(d != s)
+					_mm_storeu_si128((__m128i*)d, v);
+				s += 16;
+				d += 16;
+				continue;
+			}
+			mask = __builtin_ctz(mask);
+			if(d != s)
+				memmove(d, s, mask);
+			s += mask;
+			d += mask;
+		}
+
+		if ((c = *s) == 0)
+			break;
+		if ( Q_IsColorString( s ) ) {
+			s++;
+		}
+		else if ( c >= 0x20 && c <= 0xFE ) {
+			*d++ = c;
+		}
+		s++;
+	}
+	*d = '\0';
+}
+
+Q_SSE2 static int Q_CountCharSSE2( const char *string, char tocount ) {
+
+	__m128i match, v, zero;
+	int count, mask, end;
+
+	match = _mm_set1_epi8(tocount);
+	zero = _mm_setzero_si128();
+	count = 0;
+
+	while(((size_t)string & 15) != 0){
+		if(!*string)
+			return count;
+		if(*string == tocount)
+			count++;
+		string++;
+	}
+
+	while(1){
+		v = _mm_load_si128((const __m128i*)string);
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, match));
+		end = _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		if(end){
+			//Only what comes before the terminator
+			mask &= (1 << __builtin_ctz(end)) -1;
+			return count + __builtin_popcount(mask);
+		}
+		count += __builtin_popcount(mask);
+		string += 16;
+	}
 }
 
+#endif
+
 
 /*
 * Find the first occurrence of find in s.
@@ -395,6 +583,12 @@ const char *Q_stristr( const char *s, const char *find)
     {
       c -= ('a' - 'A');
     }
+#ifdef Q_HAVE_SSE2_STRINGS
+    if (Q_UseSSE2())
+    {
+      return Q_stristrSSE2(s, find, c);
+    }
+#endif
     len = strlen(find);
     do
     {
@@ -453,6 +647,12 @@ int Q_PrintStrlen( const char *string ) {
 		return 0;
 	}
 
+#ifdef Q_HAVE_SSE2_STRINGS
+	if( Q_UseSSE2() ) {
+		return Q_PrintStrlenSSE2( string );
+	}
+#endif
+
 	len = 0;
 	p = string;
 	while( *p ) {
@@ -473,6 +673,13 @@ char *Q_CleanStr( char *string ) {
 	char*	s;
 	int		c;
 
+#ifdef Q_HAVE_SSE2_STRINGS
+	if ( Q_UseSSE2() ) {
+		Q_CleanStrSSE2( string );
+		return string;
+	}
+#endif
+
 	s = string;
 	d = string;
 	while ((c = *s) != 0 ) {
@@ -492,7 +699,12 @@ char *Q_CleanStr( char *string ) {
 int Q_CountChar(const char *string, char tocount)
 {
 	int count;
-	
+
+#ifdef Q_HAVE_SSE2_STRINGS
+	if(Q_UseSSE2())
+		return Q_CountCharSSE2(string, tocount);
+#endif
+
 	for(count = 0; *string; string++)
 	{
 		if(*string == tocount)
@@ -707,6 +919,115 @@ void BigInfo_RemoveKey( char *s, const char *key ) {
 }
 
 
+/*
+===============
+Info_BuildDict / Info_DictValueForKey
+
+Splits the info string once into a hashed key/value table. The first occurrence of a key
+wins and a trailing key without value is ignored, the same as Info_ValueForKey() does it
+===============
+*/
+static unsigned int Info_HashKey( const char *key ) {
+
+	unsigned int hash = 2166136261u;
+
+	while(*key)
+	{
+		hash ^= (unsigned char)tolower(*key);
+		hash *= 16777619u;
+		key++;
+	}
+	return hash;
+}
+
+void Info_BuildDict( infoDict_t *dict, const char *s ) {
+
+	char *o, *key, *value;
+	unsigned int hash, slot;
+	int i;
+
+	dict->numKeys = 0;
+	dict->overflowed = qfalse;
+	Com_Memset(dict->slots, 0, sizeof(dict->slots));
+
+	Q_strncpyz(dict->source, s, sizeof(dict->source));
+	if(strlen(s) >= sizeof(dict->source))
+	{
+		dict->overflowed = qtrue; //Can not answer it from a truncated copy
+		return;
+	}
+	Q_strncpyz(dict->buffer, s, sizeof(dict->buffer));
+
+	o = dict->buffer;
+	if(*o == '\\')
+		o++;
+
+	while(*o)
+	{
+		key = o;
+		while(*o != '\\')
+		{
+			if(!*o)
+				return;
+			o++;
+		}
+		*o++ = '\0';
+
+		value = o;
+		while(*o != '\\' && *o)
+			o++;
+
+		if(*o)
+			*o++ = '\0';
+
+		hash = Info_HashKey(key);
+
+		for(slot = hash % INFODICT_HASH_SIZE; dict->slots[slot]; slot = (slot +1) % INFODICT_HASH_SIZE)
+		{
+			i = dict->slots[slot] -1;
+			if(dict->entries[i].hash == hash && !Q_stricmp(dict->entries[i].key, key))
+				break;
+		}
+		if(dict->slots[slot])
+			continue; //Already known, the first one counts
+
+		if(dict->numKeys >= INFODICT_MAX_KEYS)
+		{
+			dict->overflowed = qtrue;
+			return;
+		}
+		dict->entries[dict->numKeys].hash = hash;
+		dict->entries[dict->numKeys].key = key;
+		dict->entries[dict->numKeys].value = value;
+		dict->numKeys++;
+		dict->slots[slot] = dict->numKeys;
+	}
+}
+
+const char *Info_DictValueForKey( const infoDict_t *dict, const char *key ) {
+
+	unsigned int hash, slot;
+	const infoDictEntry_t *entry;
+
+	if ( !key ) {
+		return "";
+	}
+
+	if(dict->overflowed)
+		return Info_ValueForKey(dict->source, key);
+
+	hash = Info_HashKey(key);
+
+	for(slot = hash % INFODICT_HASH_SIZE; dict->slots[slot]; slot = (slot +1) % INFODICT_HASH_SIZE)
+	{
+		entry = &dict->entries[dict->slots[slot] -1];
+		if(entry->hash == hash && !Q_stricmp(entry->key, key))
+			return entry->value;
+	}
+	return "";
+}
+
+
 /*
 ===============
 Info_ValueForKey
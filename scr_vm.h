@@ -230,7 +230,6 @@ typedef void *xfunction_t;
 
 typedef struct scr_function_s
 {
-	struct scr_function_s	*next;
 	char			*name;
 	xfunction_t		function;
 	qboolean		developer;
@@ -247,7 +246,8 @@ typedef int scr_entref_t;
 typedef enum{
     SCR_CB_NEW_SAY,
     SCR_CB_NEW_SEQMSG,
-    SCR_CB_NEW_SEQPLAYERMSG
+    SCR_CB_NEW_SEQPLAYERMSG,
+    SCR_CB_NEW_FSDONE
 }script_CallBacks_new_t;
 
 int script_CallBacks_new[8];
@@ -302,6 +302,7 @@ short __cdecl Scr_ExecEntThread( gentity_t* ent, int callbackHook, unsigned int
 short __cdecl Scr_ExecThread( int callbackHook, unsigned int numArgs);
 void __cdecl Scr_FreeThread( short threadId);
 unsigned int __cdecl Scr_CreateCanonicalFilename( const char* name );
+//The variable, thread and string tables of the VM are not mapped, there are only these accessors.
 //Unknown real returntype
 unsigned int __cdecl FindVariable( unsigned int, unsigned int );
 unsigned int __cdecl FindObject( unsigned int );
@@ -345,9 +346,19 @@ qboolean Scr_RemoveMethod( const char *cmd_name );
 void Scr_ClearMethods( void );
 __cdecl void* Scr_GetMethod( const char** v_functionName, qboolean* v_developer );
 
+//Builtin profiler, scr_vm_profile.c
+extern qboolean scr_profileActive;
+
+xfunction_t Scr_ProfileThunk( xfunction_t function, const char* name, qboolean method );
+void Scr_ProfileLoadScripts( void );
+void Scr_ProfileFrame( void );
+void Scr_Profile_f( void );
+
 
 
 #define MAX_SCRIPT_FILEHANDLES 10
+#define SCR_FILEBUFFER_SIZE 0x10000 //Read ahead / write behind buffer of each script file
+#define SCR_MAX_READALL_SIZE 0x1000000
 
 typedef enum{
     SCR_FH_FILE,
@@ -360,8 +371,10 @@ typedef struct{
     FILE* fh;
     scr_fileHandleType_t type;
     char filename[MAX_QPATH];
+    unsigned int filenamehash;
     int baseOffset;
     int fileSize;
+    char* iobuffer;
 }scr_fileHandle_t;
 
 qboolean Scr_FS_CloseFile( scr_fileHandle_t* f );
@@ -373,5 +386,9 @@ qboolean Scr_CloseScriptFile( fileHandle_t fh);
 int Scr_FS_Read( void *buffer, int len, fileHandle_t f );
 int Scr_FS_Write( const void *buffer, int len, fileHandle_t h );
 int Scr_FS_Seek( fileHandle_t f, long offset, int origin );
+int Scr_FS_FileLength( fileHandle_t f );
+void Scr_AddLinesArray( char* buffer, int len );
+int Scr_FS_AsyncStart( char* qpath, fsMode_t mode, const char* data );
+void Scr_FS_AsyncFrame( void );
 
 #endif
@@ -29,63 +29,180 @@
 
 #include <string.h>
 
-scr_function_t *scr_functions = NULL;
-scr_function_t *scr_methods = NULL;
+/*
+Builtins are looked up by name on every script compile, so functions and methods
+are kept in open addressed hash tables with linear probing.
+Names are hashed case insensitive because the lookup is case insensitive.
+*/
+#define SCR_BUILTIN_HASHSIZE 2048
+#define SCR_BUILTIN_MAXCOUNT (SCR_BUILTIN_HASHSIZE * 3 / 4)
+
+typedef struct
+{
+	int		count;
+	scr_function_t	*slots[SCR_BUILTIN_HASHSIZE];
+} scr_builtinTable_t;
+
+static scr_builtinTable_t scr_functions;
+static scr_builtinTable_t scr_methods;
+
+
+static unsigned int Scr_HashBuiltinName( const char *name ) {
+
+	unsigned int hash = 2166136261u;
+	int c;
+
+	while((c = *name++)){
+		if(c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash & (SCR_BUILTIN_HASHSIZE -1);
+}
 
 /*
 ============
-Scr_AddFunction
+Scr_FindBuiltinSlot
+
+Returns the slot of the builtin or -1. exact selects case sensitive matching
 ============
 */
-qboolean Scr_AddFunction( const char *cmd_name, xfunction_t function, qboolean developer) {
+static int Scr_FindBuiltinSlot( scr_builtinTable_t *table, const char *name, qboolean exact ) {
+
+	unsigned int i;
+	scr_function_t *cmd;
+
+	for(i = Scr_HashBuiltinName(name); (cmd = table->slots[i]) != NULL; i = (i +1) & (SCR_BUILTIN_HASHSIZE -1))
+	{
+		if(exact){
+			if(!strcmp(name, cmd->name))
+				return i;
+		}else if(!Q_stricmp(name, cmd->name)){
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+static qboolean Scr_AddBuiltin( scr_builtinTable_t *table, const char *cmd_name, xfunction_t function, qboolean developer, const char *caller ) {
 
 	scr_function_t  *cmd;
+	unsigned int i;
 
 	// fail if the command already exists
-	for ( cmd = scr_functions ; cmd ; cmd = cmd->next ) {
-		if ( !strcmp( cmd_name, cmd->name )) {
-			// allow completion-only commands to be silently doubled
-			if ( function != NULL ) {
-				Com_PrintWarning("Scr_AddFunction: %s already defined\n", cmd_name);
-			}
-			return qfalse;
+	if( Scr_FindBuiltinSlot(table, cmd_name, qtrue) != -1 )
+	{
+		// allow completion-only commands to be silently doubled
+		if ( function != NULL ) {
+			Com_PrintWarning("%s: %s already defined\n", caller, cmd_name);
 		}
+		return qfalse;
+	}
+
+	if( table->count >= SCR_BUILTIN_MAXCOUNT )
+	{
+		Com_PrintError("%s: Exceeded limit of %d builtins. Can not add %s\n", caller, SCR_BUILTIN_MAXCOUNT, cmd_name);
+		return qfalse;
 	}
 
 	// use a small malloc to avoid zone fragmentation
-	cmd = Z_Malloc( sizeof( scr_function_t ) + strlen(cmd_name) + 1);
+	cmd = Z_TagMalloc( sizeof( scr_function_t ) + strlen(cmd_name) + 1, TAG_COMMANDS );
 	strcpy((char*)(cmd +1), cmd_name);
 	cmd->name = (char*)(cmd +1);
 	cmd->function = function;
 	cmd->developer = developer;
-	cmd->next = scr_functions;
-	scr_functions = cmd;
+
+	for(i = Scr_HashBuiltinName(cmd_name); table->slots[i] != NULL; i = (i +1) & (SCR_BUILTIN_HASHSIZE -1));
+
+	table->slots[i] = cmd;
+	table->count++;
 	return qtrue;
 }
 
+
+static qboolean Scr_RemoveBuiltin( scr_builtinTable_t *table, const char *cmd_name ) {
+
+	int i, j;
+	unsigned int home;
+
+	i = Scr_FindBuiltinSlot(table, cmd_name, qtrue);
+	if ( i == -1 ) {
+		// command wasn't active
+		return qfalse;
+	}
+	Z_Free( table->slots[i] );
+	table->slots[i] = NULL;
+	table->count--;
+
+	// Shift following entries of the probe sequence back so no lookup stops at the hole
+	for(j = (i +1) & (SCR_BUILTIN_HASHSIZE -1); table->slots[j] != NULL; j = (j +1) & (SCR_BUILTIN_HASHSIZE -1))
+	{
+		home = Scr_HashBuiltinName(table->slots[j]->name);
+		if(((j - home) & (SCR_BUILTIN_HASHSIZE -1)) >= ((j - i) & (SCR_BUILTIN_HASHSIZE -1)))
+		{
+			table->slots[i] = table->slots[j];
+			table->slots[j] = NULL;
+			i = j;
+		}
+	}
+	return qtrue;
+}
+
+
+static void Scr_ClearBuiltins( scr_builtinTable_t *table ) {
+
+	int i;
+
+	for(i = 0; i < SCR_BUILTIN_HASHSIZE; i++)
+	{
+		if(table->slots[i]){
+			Z_Free( table->slots[i] );
+			table->slots[i] = NULL;
+		}
+	}
+	table->count = 0;
+}
+
+
+static void* Scr_GetBuiltin( scr_builtinTable_t *table, const char** v_functionName, qboolean* v_developer ) {
+
+	scr_function_t  *cmd;
+	xfunction_t thunk;
+	int i;
+
+	i = Scr_FindBuiltinSlot(table, *v_functionName, qfalse);
+	if(i == -1)
+		return NULL;
+
+	cmd = table->slots[i];
+	*v_developer = cmd->developer;
+	*v_functionName = cmd->name;
+
+	if(scr_profileActive && (thunk = Scr_ProfileThunk(cmd->function, cmd->name, table == &scr_methods)) != NULL)
+		return thunk;
+
+	return cmd->function;
+}
+
+/*
+============
+Scr_AddFunction
+============
+*/
+qboolean Scr_AddFunction( const char *cmd_name, xfunction_t function, qboolean developer) {
+
+	return Scr_AddBuiltin(&scr_functions, cmd_name, function, developer, "Scr_AddFunction");
+}
+
 /*
 ============
 Scr_RemoveFunction
 ============
 */
 qboolean Scr_RemoveFunction( const char *cmd_name ) {
-	scr_function_t  *cmd, **back;
-
-	back = &scr_functions;
-	while ( 1 ) {
-		cmd = *back;
-		if ( !cmd ) {
-			// command wasn't active
-			return qfalse;
-		}
-		if ( !strcmp( cmd_name, cmd->name ) ) {
-			*back = cmd->next;
-			Z_Free( cmd );
-			return qtrue;
-		}
-		back = &cmd->next;
-	}
-	return qfalse;
+
+	return Scr_RemoveBuiltin(&scr_functions, cmd_name);
 }
 
 /*
@@ -96,22 +213,7 @@ Scr_ClearFunctions
 
 void Scr_ClearFunctions( )
 {
-	scr_function_t  *cmd, **back;
-
-	int i = 0;
-
-	while ( 1 )
-	{
-		back = &scr_functions;
-		cmd = *back;
-		if ( !cmd ) {
-			// This was the last script function
-			return;
-		}
-		*back = cmd->next;
-		Z_Free( cmd );
-		i++;
-	}
+	Scr_ClearBuiltins(&scr_functions);
 }
 
 /*
@@ -121,18 +223,7 @@ Scr_GetFunction
 */
 __cdecl void* Scr_GetFunction( const char** v_functionName, qboolean* v_developer ) {
 
-	scr_function_t  *cmd;
-
-	for(cmd = scr_functions; cmd != NULL; cmd = cmd->next)
-	{
-		if(!Q_stricmp(*v_functionName, cmd->name))
-		{
-			*v_developer = cmd->developer;
-			*v_functionName = cmd->name;
-			return cmd->function;
-		}
-	}
-	return NULL;
+	return Scr_GetBuiltin(&scr_functions, v_functionName, v_developer);
 }
 
 /*
@@ -142,28 +233,7 @@ Scr_AddMethod
 */
 qboolean Scr_AddMethod( const char *cmd_name, xfunction_t function, qboolean developer) {
 
-	scr_function_t  *cmd;
-
-	// fail if the command already exists
-	for ( cmd = scr_methods ; cmd ; cmd = cmd->next ) {
-		if ( !strcmp( cmd_name, cmd->name )) {
-			// allow completion-only commands to be silently doubled
-			if ( function != NULL ) {
-				Com_PrintWarning( "Scr_AddMethod: %s already defined\n", cmd_name );
-			}
-			return qfalse;
-		}
-	}
-
-	// use a small malloc to avoid zone fragmentation
-	cmd = Z_Malloc( sizeof( scr_function_t ) + strlen(cmd_name) + 1);
-	strcpy((char*)(cmd +1), cmd_name);
-	cmd->name = (char*)(cmd +1);
-	cmd->function = function;
-	cmd->developer = developer;
-	cmd->next = scr_methods;
-	scr_methods = cmd;
-	return qtrue;
+	return Scr_AddBuiltin(&scr_methods, cmd_name, function, developer, "Scr_AddMethod");
 }
 
 /*
@@ -172,23 +242,8 @@ Scr_RemoveMethod
 ============
 */
 qboolean Scr_RemoveMethod( const char *cmd_name ) {
-	scr_function_t  *cmd, **back;
-
-	back = &scr_methods;
-	while ( 1 ) {
-		cmd = *back;
-		if ( !cmd ) {
-			// command wasn't active
-			return qfalse;
-		}
-		if ( !strcmp( cmd_name, cmd->name ) ) {
-			*back = cmd->next;
-			Z_Free( cmd );
-			return qtrue;
-		}
-		back = &cmd->next;
-	}
-	return qfalse;
+
+	return Scr_RemoveBuiltin(&scr_methods, cmd_name);
 }
 
 /*
@@ -198,22 +253,7 @@ Scr_ClearMethods
 */
 void Scr_ClearMethods(  )
 {
-	scr_function_t  *cmd, **back;
-
-	int i = 0;
-
-	while ( 1 )
-	{
-		back = &scr_methods;
-		cmd = *back;
-		if ( !cmd ) {
-			// This was the last script method
-			return;
-		}
-		*back = cmd->next;
-		Z_Free( cmd );
-		i++;
-	}
+	Scr_ClearBuiltins(&scr_methods);
 }
 
 /*
@@ -223,16 +263,5 @@ Scr_GetMethod
 */
 __cdecl void* Scr_GetMethod( const char** v_functionName, qboolean* v_developer ) {
 
-	scr_function_t  *cmd;
-
-	for(cmd = scr_methods; cmd != NULL; cmd = cmd->next)
-	{
-		if(!Q_stricmp(*v_functionName, cmd->name))
-		{
-			*v_developer = cmd->developer;
-			*v_functionName = cmd->name;
-			return cmd->function;
-		}
-	}
-	return NULL;
-}
\ No newline at end of file
+	return Scr_GetBuiltin(&scr_methods, v_functionName, v_developer);
+}
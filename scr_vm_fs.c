@@ -26,11 +26,39 @@
 #include "filesystem.h"
 #include "scr_vm.h"
 #include "cvar.h"
+#include "qcommon_mem.h"
+#include "server.h"
+#include "sys_thread.h"
 
 #include <string.h>
 
+typedef struct{
+	int		id;		//0 if the handle has no asynchronous request
+	fsMode_t	mode;
+	FILE*		fh;
+	int		serverId;	//Results of a previous level get dropped
+	char*		buffer;
+	int		length;
+	int		result;		//Filled by the worker
+	qboolean	done;
+}scr_fsAsync_t;
+
 static int scr_fopencount;
 static scr_fileHandle_t scr_fsh[MAX_SCRIPT_FILEHANDLES];
+static scr_fsAsync_t scr_fsAsync[MAX_SCRIPT_FILEHANDLES];
+static int scr_fsAsyncNextId;
+static int scr_fsAsyncDone;
+
+
+//A handle with an asynchronous request belongs to the worker until the result got delivered
+static qboolean Scr_FS_HandleBusy( fileHandle_t f ) {
+
+	if(scr_fsAsync[f -1].id == 0)
+		return qfalse;
+
+	Com_PrintScriptRuntimeWarning("Script file handle %d is in use by an asynchronous request\n", f);
+	return qtrue;
+}
 
 /*
 ==============
@@ -45,7 +73,10 @@ on files returned by FS_FOpenFile...
 qboolean Scr_FS_CloseFile( scr_fileHandle_t* f ) {
 	// we didn't find it as a pak, so close it as a unique file
 	if (f->fh) {
+	    // fclose flushes the write behind buffer so it has to go first
 	    fclose (f->fh);
+	    if(f->iobuffer)
+	        Z_Free(f->iobuffer);
 	    Com_Memset( f, 0, sizeof( scr_fileHandle_t ));
 	    return qtrue;
 	}
@@ -54,6 +85,20 @@ qboolean Scr_FS_CloseFile( scr_fileHandle_t* f ) {
 }
 
 
+static unsigned int Scr_FS_HashFilename( const char *filename ) {
+
+	unsigned int hash = 2166136261u;
+	int c;
+
+	while((c = *filename++)){
+		if(c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619u;
+	}
+	return hash;
+}
+
+
 /*
 ========================================================================================
 
@@ -103,6 +148,9 @@ int Scr_FS_ReadLine( void *buffer, int len, fileHandle_t f ) {
             return 0;
         }
 
+        if(Scr_FS_HandleBusy(f))
+            return 0;
+
 	buf = buffer;
         *buf = 0;
 	read = fgets (buf, len, scr_fsh[f -1].fh);
@@ -121,6 +169,7 @@ int Scr_FS_ReadLine( void *buffer, int len, fileHandle_t f ) {
 qboolean Scr_FS_AlreadyOpened( char* qpath, char* filename, size_t fnamelen){
 
     int i = 0;
+    unsigned int hash;
     char qpathbuf[MAX_OSPATH];
 
     Q_strncpyz(qpathbuf, qpath, sizeof(qpathbuf));
@@ -136,9 +185,11 @@ qboolean Scr_FS_AlreadyOpened( char* qpath, char* filename, size_t fnamelen){
 
     }while(i > 0);
 
+    hash = Scr_FS_HashFilename(filename);
+
     for(i = 0; i < MAX_SCRIPT_FILEHANDLES; i++){
 
-        if(!Q_stricmp(filename, scr_fsh[i].filename)){
+        if(scr_fsh[i].fh && scr_fsh[i].filenamehash == hash && !Q_stricmp(filename, scr_fsh[i].filename)){
             Com_PrintScriptRuntimeWarning("Script_FileOpen: Tried to open a file with the same name two times: %s\n", filename);
             *filename = 0;
             return qtrue;
@@ -173,6 +224,10 @@ qboolean Scr_FS_FOpenFile( const char *filename, fsMode_t mode, scr_fileHandle_t
 		Com_Printf( "Scr_FS_FOpenFile (fs_homepath): %s\n", ospath );
 	}
 
+	if( mode != FS_READ ){
+		FS_InvalidatePathCache();
+	}
+
         switch(mode){
             case FS_READ:
                 f->fh = fopen( ospath, "rt" );
@@ -262,6 +317,13 @@ fileHandle_t Scr_OpenScriptFile( char* qpath, scr_fileHandleType_t ft, fsMode_t
             }
             scr_fsh[i].type = ft;
             Q_strncpyz(scr_fsh[i].filename, filename, MAX_QPATH);
+            scr_fsh[i].filenamehash = Scr_FS_HashFilename(filename);
+            /*
+            Give stdio a large buffer so reading and writing line by line does not
+            turn into one syscall per line
+            */
+            scr_fsh[i].iobuffer = Z_TagMalloc(SCR_FILEBUFFER_SIZE, TAG_SCRIPT);
+            setvbuf(scr_fsh[i].fh, scr_fsh[i].iobuffer, _IOFBF, SCR_FILEBUFFER_SIZE);
             scr_fopencount++;
             return i+1;
         }
@@ -285,6 +347,10 @@ qboolean Scr_CloseScriptFile( fileHandle_t fh){
         return qfalse;
     }
 
+    //FS_FCloseAll must not pull the file away from under the worker
+    if(scr_fsAsync[fh -1].id)
+        return qfalse;
+
 
     switch(scr_fsh[fh -1].type){
 
@@ -336,6 +402,9 @@ int Scr_FS_Read( void *buffer, int len, fileHandle_t f ) {
             return 0;
         }
 
+        if(Scr_FS_HandleBusy(f))
+            return 0;
+
 	buf = (byte *)buffer;
 
 	remaining = len;
@@ -388,6 +457,9 @@ int Scr_FS_Write( const void *buffer, int len, fileHandle_t h ) {
             return 0;
         }
 
+        if(Scr_FS_HandleBusy(h))
+            return 0;
+
 	f = scr_fsh[h -1].fh;
 	buf = (byte *)buffer;
 
@@ -437,6 +509,9 @@ int Scr_FS_Seek( fileHandle_t f, long offset, int origin ) {
             return -1;
         }
 
+	if(Scr_FS_HandleBusy(f))
+		return -1;
+
 	FILE *file;
 	file = scr_fsh[f -1].fh;
 	switch( origin ) {
@@ -458,5 +533,182 @@ int Scr_FS_Seek( fileHandle_t f, long offset, int origin ) {
 }
 
 
+int Scr_FS_FileLength( fileHandle_t f ) {
+
+	if(f > MAX_SCRIPT_FILEHANDLES || f < 1){
+            Scr_Error("Scr_FS_FileLength: Out of range filehandle\n");
+            return -1;
+        }
+	return scr_fsh[f -1].fileSize;
+}
+
+
+/*
+=================
+Scr_AddLinesArray
+
+Pushes the lines of buffer as array of strings, \n and \r get stripped.
+The buffer gets modified
+=================
+*/
+void Scr_AddLinesArray( char* buffer, int len ) {
+
+	char* line;
+	char* end;
+
+	buffer[len] = 0;
+
+	Scr_MakeArray();
+
+	for(line = buffer; line < buffer + len; line = end +1){
+
+		end = strchr(line, '\n');
+		if(!end)
+			end = buffer + len;
+
+		*end = 0;
+		if(end > line && end[-1] == '\r')
+			end[-1] = 0;
+
+		Scr_AddString(line);
+		Scr_AddArray();
+	}
+}
+
+
+/*
+========================================================================================
+
+Asynchronous whole file reads and writes
 
+The file gets opened by Scr_OpenScriptFile on the main thread, so the path checks and the
+limit of handles stay the same. Only the read or the write and flush of the data is done
+by a worker thread. The handle stays reserved until the next server frame hands the
+result to CodeCallback_FSDone(id, result).
 
+========================================================================================
+*/
+
+//Worker thread, nothing but libc in here
+static void Scr_FS_AsyncJob( void* arg ) {
+
+	scr_fsAsync_t* as = arg;
+
+	if(as->mode == FS_READ){
+
+		as->result = fread(as->buffer, 1, as->length, as->fh);
+		if(ferror(as->fh))
+			as->result = -1;
+
+	}else{
+		as->result = fwrite(as->buffer, 1, as->length, as->fh) == as->length && fflush(as->fh) == 0;
+	}
+}
+
+static void Scr_FS_AsyncCompleted( void* arg ) {
+
+	scr_fsAsync_t* as = arg;
+
+	as->done = qtrue;
+	scr_fsAsyncDone++;
+}
+
+/*
+=================
+Scr_FS_AsyncStart
+
+Queues the read of the whole file or the write of data. mode is FS_READ, FS_WRITE or FS_APPEND
+Returns the id of the request, 0 if the file can not be opened
+=================
+*/
+int Scr_FS_AsyncStart( char* qpath, fsMode_t mode, const char* data ) {
+
+	fileHandle_t fh;
+	scr_fsAsync_t* as;
+	int len;
+
+	fh = Scr_OpenScriptFile(qpath, SCR_FH_FILE, mode);
+	if(!fh)
+		return 0;
+
+	if(mode == FS_READ){
+
+		len = scr_fsh[fh -1].fileSize;
+		if(len < 0 || len > SCR_MAX_READALL_SIZE){
+			Scr_CloseScriptFile(fh);
+			Com_PrintScriptRuntimeWarning("Scr_FS_AsyncStart: %s exceeds the limit of %i bytes\n", qpath, SCR_MAX_READALL_SIZE);
+			return 0;
+		}
+
+	}else{
+		len = strlen(data);
+	}
+
+	as = &scr_fsAsync[fh -1];
+	as->buffer = Z_TagMalloc(len +1, TAG_SCRIPT);
+	if(mode != FS_READ)
+		Com_Memcpy(as->buffer, data, len);
+
+	if(++scr_fsAsyncNextId < 1)
+		scr_fsAsyncNextId = 1;
+
+	as->id = scr_fsAsyncNextId;
+	as->mode = mode;
+	as->fh = scr_fsh[fh -1].fh;
+	as->serverId = sv_serverId;
+	as->length = len;
+	as->result = 0;
+	as->done = qfalse;
+
+	len = as->id;	//Without worker threads the job is already done when Sys_AddJob returns
+	Sys_AddJob(Scr_FS_AsyncJob, Scr_FS_AsyncCompleted, as);
+	return len;
+}
+
+/*
+=================
+Scr_FS_AsyncFrame
+
+Called every server frame. Releases the handles of finished requests and passes
+their results to the gamescript: true or false for writes, the array of lines or
+undefined for reads
+=================
+*/
+void Scr_FS_AsyncFrame( void ) {
+
+	scr_fsAsync_t done;
+	int i, callback, threadId;
+
+	if(scr_fsAsyncDone == 0)
+		return;
+
+	for(i = 0; i < MAX_SCRIPT_FILEHANDLES; i++)
+	{
+		if(!scr_fsAsync[i].id || !scr_fsAsync[i].done)
+			continue;
+
+		//Release the handle first, so the callback can open the file again
+		done = scr_fsAsync[i];
+		Com_Memset(&scr_fsAsync[i], 0, sizeof(scr_fsAsync_t));
+		Scr_CloseScriptFile(i +1);
+		scr_fsAsyncDone--;
+
+		callback = script_CallBacks_new[SCR_CB_NEW_FSDONE];
+
+		if(callback && done.serverId == sv_serverId)
+		{
+			if(done.mode != FS_READ)
+				Scr_AddBool(done.result);
+			else if(done.result < 0)
+				Scr_AddUndefined();
+			else
+				Scr_AddLinesArray(done.buffer, done.result);
+
+			Scr_AddInt(done.id);
+
+			threadId = Scr_ExecThread(callback, 2);
+			Scr_FreeThread(threadId);
+		}
+		Z_Free(done.buffer);
+	}
+}
@@ -34,6 +34,7 @@
 #include "cvar.h"
 #include "misc.h"
 #include "sha256.h"
+#include "qcommon_mem.h"
 
 #include <string.h>
 #include <time.h>
@@ -122,7 +123,7 @@ void PlayerCmd_GetUserinfo(scr_entref_t arg){
 
     cl = &svs.clients[entityNum];
 
-    char* value = Info_ValueForKey(cl->userinfo, u_key);
+    const char* value = SV_UserinfoValueForKey(cl, u_key);
 
     Scr_AddString(value);
 }
@@ -133,7 +134,9 @@ void PlayerCmd_GetUserinfo(scr_entref_t arg){
 PlayerCmd_GetPing
 
 Returns the current measured scoreboard ping of this player.
-Usage: int = self getPing();
+Optional one of "mean", "p50", "p95" and "jitter" in msec, "loss" as
+the recent share of lost packets from 0.0 to 1.0
+Usage: int = self getPing(<statistic>);
 ============
 */
 
@@ -142,6 +145,8 @@ void PlayerCmd_GetPing(scr_entref_t arg){
     gentity_t* gentity;
     int entityNum = 0;
     client_t *cl;
+    clientNetStats_t stats;
+    char* statistic;
 
     if(HIWORD(arg)){
 
@@ -156,13 +161,161 @@ void PlayerCmd_GetPing(scr_entref_t arg){
             Scr_ObjectError(va("Entity: %i is not a player", entityNum));
         }
     }
-    if(Scr_GetNumParam()){
-        Scr_Error("Usage: self getPing()\n");
+    if(Scr_GetNumParam() > 1){
+        Scr_Error("Usage: self getPing(<statistic>)\n");
+    }
+
+    cl = &svs.clients[entityNum];
+
+    if(Scr_GetNumParam() == 0){
+        Scr_AddInt(cl->ping);
+        return;
+    }
+
+    statistic = Scr_GetString(0);
+    SV_GetClientNetStats(cl, &stats);
+
+    if(!Q_stricmp(statistic, "mean"))
+        Scr_AddInt(stats.mean);
+    else if(!Q_stricmp(statistic, "p50"))
+        Scr_AddInt(stats.p50);
+    else if(!Q_stricmp(statistic, "p95"))
+        Scr_AddInt(stats.p95);
+    else if(!Q_stricmp(statistic, "jitter"))
+        Scr_AddInt(stats.jitter);
+    else if(!Q_stricmp(statistic, "loss"))
+        Scr_AddFloat(stats.loss);
+    else
+        Scr_ParamError(0, va("getPing: Unknown statistic %s. Use mean, p50, p95, jitter or loss", statistic));
+}
+
+
+//Looked up in the background when the client asked for the challenge, see sv_geoinfo.c
+static void Scr_ClientGeoInfo(int clnum, geoInfo_t *info){
+
+    if(!SV_GeoInfoForAddress(&svs.clients[clnum].netchan.remoteAddress, info)){
+        info->countryIndex = 0;
+        info->proxy = qfalse;
+        info->asn[0] = '\0';
+    }
+}
+
+static int Scr_ClientGeoIndex(int clnum){
+
+    geoInfo_t info;
+
+    Scr_ClientGeoInfo(clnum, &info);
+    return info.countryIndex;
+}
+
+/*
+============
+PlayerCmd_GetPlayerInfo
+
+Returns an array with one value for each requested key, in the same order.
+Scoreboards need one call per player this way instead of one for every value.
+Keys: "ping", "uid", "guid", "name", "geocode", "geocode3", "country",
+"continent", "asn", "proxy", "mean", "p50", "p95", "jitter", "loss" and "userinfo:<key>"
+Usage: array = self getPlayerInfo(<key string>, ...);
+============
+*/
+
+void PlayerCmd_GetPlayerInfo(scr_entref_t arg){
+
+    gentity_t* gentity;
+    int entityNum = 0;
+    client_t *cl;
+    clientNetStats_t stats;
+    qboolean haveStats = qfalse;
+    geoInfo_t geoinfo;
+    char* key;
+    int i, numParam;
+
+    if(HIWORD(arg)){
+
+        Scr_ObjectError("Not an entity");
+        return;
+
+    }else{
+
+        entityNum = LOWORD(arg);
+        gentity = &g_entities[entityNum];
+
+        if(!gentity->client){
+            Scr_ObjectError(va("Entity: %i is not a player", entityNum));
+            return;
+        }
+    }
+
+    numParam = Scr_GetNumParam();
+    if(numParam < 1){
+        Scr_Error("Usage: self getPlayerInfo( <string>, ... )\n");
     }
 
     cl = &svs.clients[entityNum];
 
-    Scr_AddInt(cl->ping);
+    Scr_MakeArray();
+
+    for(i = 0; i < numParam; i++){
+
+        key = Scr_GetString(i);
+
+        if(!Q_stricmpn(key, "userinfo:", 9)){
+            Scr_AddString(SV_UserinfoValueForKey(cl, key + 9));
+
+        }else if(!Q_stricmp(key, "ping")){
+            Scr_AddInt(cl->ping);
+
+        }else if(!Q_stricmp(key, "uid")){
+            Scr_AddInt(SV_UseUids() ? SV_GetUid(entityNum) : -1);
+
+        }else if(!Q_stricmp(key, "guid")){
+            Scr_AddString(cl->pbguid);
+
+        }else if(!Q_stricmp(key, "name")){
+            Scr_AddString(cl->name);
+
+        }else if(!Q_stricmp(key, "geocode")){
+            Scr_AddString(_GeoIP_country_code(Scr_ClientGeoIndex(entityNum)));
+
+        }else if(!Q_stricmp(key, "geocode3")){
+            Scr_AddString(_GeoIP_country_code3(Scr_ClientGeoIndex(entityNum)));
+
+        }else if(!Q_stricmp(key, "country")){
+            Scr_AddString(_GeoIP_country_name(Scr_ClientGeoIndex(entityNum)));
+
+        }else if(!Q_stricmp(key, "continent")){
+            Scr_AddString(_GeoIP_continent_name(Scr_ClientGeoIndex(entityNum)));
+
+        }else if(!Q_stricmp(key, "asn")){
+            Scr_ClientGeoInfo(entityNum, &geoinfo);
+            Scr_AddString(geoinfo.asn);
+
+        }else if(!Q_stricmp(key, "proxy")){
+            Scr_ClientGeoInfo(entityNum, &geoinfo);
+            Scr_AddBool(geoinfo.proxy);
+
+        }else{
+            if(!haveStats){
+                SV_GetClientNetStats(cl, &stats);
+                haveStats = qtrue;
+            }
+
+            if(!Q_stricmp(key, "mean"))
+                Scr_AddInt(stats.mean);
+            else if(!Q_stricmp(key, "p50"))
+                Scr_AddInt(stats.p50);
+            else if(!Q_stricmp(key, "p95"))
+                Scr_AddInt(stats.p95);
+            else if(!Q_stricmp(key, "jitter"))
+                Scr_AddInt(stats.jitter);
+            else if(!Q_stricmp(key, "loss"))
+                Scr_AddFloat(stats.loss);
+            else
+                Scr_ParamError(i, va("getPlayerInfo: Unknown key %s", key));
+        }
+        Scr_AddArray();
+    }
 }
 
 
@@ -209,9 +362,7 @@ void PlayerCmd_SetGravity(scr_entref_t arg){
         return;
     }
 
-    Pmove_ExtendedTurnOn();
-
-    svs.clients[entityNum].gravity = gravity;
+    Pmove_ExtendedSetGravity(entityNum, gravity);
 
 }
 
@@ -259,9 +410,7 @@ void PlayerCmd_SetJumpHeight(scr_entref_t arg){
         return;
     }
 
-    Pmove_ExtendedTurnOn();
-
-    svs.clients[entityNum].jumpHeight = height;
+    Pmove_ExtendedSetJumpHeight(entityNum, height);
 }
 
 
@@ -308,9 +457,7 @@ void PlayerCmd_SetMoveSpeed(scr_entref_t arg){
         return;
     }
 
-    Pmove_ExtendedTurnOn();
-
-    svs.clients[entityNum].playerMoveSpeed = speed;
+    Pmove_ExtendedSetSpeed(entityNum, speed);
 }
 
 
@@ -361,7 +508,7 @@ void PlayerCmd_GetGeoLocation(scr_entref_t arg){
 
     rettype = Scr_GetInt(0);
 
-    locIndex = _GeoIP_seek_record(BigLong(*(unsigned long*)&svs.clients[entityNum].netchan.remoteAddress.ip));
+    locIndex = Scr_ClientGeoIndex(entityNum);
 
     switch(rettype){
         case SCR_GEOIP_CODE:
@@ -390,6 +537,51 @@ void PlayerCmd_GetGeoLocation(scr_entref_t arg){
 
 
 
+/*
+============
+Scr_InitHalfPixelWidths
+
+Width of every character in half pixels of the default font. Everything which is not listed is 12 wide
+============
+*/
+
+static byte scr_halfPixelWidth[256];
+
+static void Scr_InitHalfPixelWidths(){
+
+    static const struct{
+        byte width;
+        const char* characters;
+    }widths[] = {
+        { 2, "'" },
+        { 4, "ijl.,:;_%" },
+        { 5, "fI-|" },
+        { 6, "tr!/\\\"" },
+        { 7, "()[]" },
+        { 8, "T{}*" },
+        { 9, "acgksvxzFJLYZ" },
+        { 10, " dhnAPSVX?" },
+        { 11, "BDGKOQRU0123456789$<>=+^~" },
+        { 12, "HN#" },
+        { 13, "w&" },
+        { 14, "WM@" },
+        { 27, "m" }	//Has always been counted twice, kept so tokenized lines do not change
+    };
+    const char* c;
+    int i;
+
+    if(scr_halfPixelWidth[0])
+        return;
+
+    Com_Memset(scr_halfPixelWidth, 12, sizeof(scr_halfPixelWidth));
+
+    for(i = 0; i < sizeof(widths) / sizeof(widths[0]); i++){
+        for(c = widths[i].characters; *c; c++)
+            scr_halfPixelWidth[(byte)*c] = widths[i].width;
+    }
+}
+
+
 /*
 ============
 GScr_StrTokByPixLen
@@ -414,11 +606,9 @@ void GScr_StrTokByPixLen(){
     char* src = Scr_GetString(0);
     if(!src)
         return;
-    else
-        Q_strncpyz(buffer, src, sizeof(buffer));
 
-    char* countstring = string;
-    char* lastWordSpace = string;
+    char* countstring;
+    char* lastWordSpace;
 
     int lineBreakIndex = 0;
 
@@ -429,137 +619,34 @@ void GScr_StrTokByPixLen(){
 
     Scr_MakeArray();
 
+    Scr_InitHalfPixelWidths();
+
+    //Fits into one line, so the only token is the string itself and needs no copy
+    for(countstring = src; *countstring && countstring - src < sizeof(buffer) -1; countstring++){
+        halfPixelCounter += scr_halfPixelWidth[(byte)*countstring];
+        if(halfPixelCounter >= maxHalfPixel)
+            break;
+    }
+    if(!*countstring){
+        if(*src){
+            Scr_AddString(src);
+            Scr_AddArray();
+        }
+        return;
+    }
+    halfPixelCounter = 0;
+
+    Q_strncpyz(buffer, src, sizeof(buffer));
+    countstring = string;
+    lastWordSpace = string;
+
     while( *countstring ){
-        switch(*countstring){
-
-        case '\'':
-            halfPixelCounter += 2;
-        break;
-
-        case 'i':
-        case 'j':
-        case 'l':
-        case '.':
-        case ',':
-        case ':':
-        case ';':
-        case '_':
-        case '%':
-            halfPixelCounter += 4;
-        break;
-
-        case 'f':
-        case 'I':
-        case '-':
-        case '|':
-            halfPixelCounter += 5;
-        break;
-
-        case 't':
-        case 'r':
-        case '!':
-        case '/':
-        case '\\':
-        case '"':
-            halfPixelCounter += 6;
-        break;
-
-        case '(':
-        case ')':
-        case '[':
-        case ']':
-            halfPixelCounter += 7;
-        break;
-
-        case 'T':
-        case '{':
-        case '}':
-        case '*':
-            halfPixelCounter += 8;
-        break;
-
-        case 'a':
-        case 'c':
-        case 'g':
-        case 'k':
-        case 's':
-        case 'v':
-        case 'x':
-        case 'z':
-        case 'F':
-        case 'J':
-        case 'L':
-        case 'Y':
-        case 'Z':
-            halfPixelCounter += 9;
-        break;
-
-        case ' ': /*Save the positions of the last recent wordspacer*/
+
+        if(*countstring == ' '){ /*Save the positions of the last recent wordspacer*/
             lWSHalfPixelCounter = halfPixelCounter;
             lastWordSpace = countstring;
-        case 'd':
-        case 'h':
-        case 'n':
-        case 'A':
-        case 'P':
-        case 'S':
-        case 'V':
-        case 'X':
-        case '?':
-            halfPixelCounter += 10;
-        break;
-
-        case 'B':
-        case 'D':
-        case 'G':
-        case 'K':
-        case 'O':
-        case 'Q':
-        case 'R':
-        case 'U':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-        case '$':
-        case '<':
-        case '>':
-        case '=':
-        case '+':
-        case '^':
-        case '~':
-            halfPixelCounter += 11;
-        break;
-
-        case 'H':
-        case 'N':
-        case '#':
-            halfPixelCounter += 12;
-        break;
-
-        case 'w':
-        case '&':
-            halfPixelCounter += 13;
-        break;
-
-        case 'W':
-        case 'M':
-        case '@':
-            halfPixelCounter += 14;
-        break;
-
-        case 'm':
-            halfPixelCounter += 15;
-
-        default:
-            halfPixelCounter += 12;
         }
+        halfPixelCounter += scr_halfPixelWidth[(byte)*countstring];
 
         if(halfPixelCounter >= maxHalfPixel){
             if(lineBreakIndex >= MAX_LINEBREAKS){
@@ -739,137 +826,11 @@ void GScr_StrPixLen(){
 
     int halfPixelCounter = 0;
 
-    while( *string ){
-        switch(*string){
-
-        case '\'':
-            halfPixelCounter += 2;
-        break;
-
-        case 'i':
-        case 'j':
-        case 'l':
-        case '.':
-        case ',':
-        case ':':
-        case ';':
-        case '_':
-        case '%':
-            halfPixelCounter += 4;
-        break;
-
-        case 'f':
-        case 'I':
-        case '-':
-        case '|':
-            halfPixelCounter += 5;
-        break;
-
-        case 't':
-        case 'r':
-        case '!':
-        case '/':
-        case '\\':
-        case '"':
-            halfPixelCounter += 6;
-        break;
-
-        case '(':
-        case ')':
-        case '[':
-        case ']':
-            halfPixelCounter += 7;
-        break;
-
-        case 'T':
-        case '{':
-        case '}':
-        case '*':
-            halfPixelCounter += 8;
-        break;
-
-        case 'a':
-        case 'c':
-        case 'g':
-        case 'k':
-        case 's':
-        case 'v':
-        case 'x':
-        case 'z':
-        case 'F':
-        case 'J':
-        case 'L':
-        case 'Y':
-        case 'Z':
-            halfPixelCounter += 9;
-        break;
-
-        case ' ': /*Save the positions of the last recent wordspacer*/
-        case 'd':
-        case 'h':
-        case 'n':
-        case 'A':
-        case 'P':
-        case 'S':
-        case 'V':
-        case 'X':
-        case '?':
-            halfPixelCounter += 10;
-        break;
-
-        case 'B':
-        case 'D':
-        case 'G':
-        case 'K':
-        case 'O':
-        case 'Q':
-        case 'R':
-        case 'U':
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-        case '$':
-        case '<':
-        case '>':
-        case '=':
-        case '+':
-        case '^':
-        case '~':
-            halfPixelCounter += 11;
-        break;
-
-        case 'H':
-        case 'N':
-        case '#':
-            halfPixelCounter += 12;
-        break;
-
-        case 'w':
-        case '&':
-            halfPixelCounter += 13;
-        break;
-
-        case 'W':
-        case 'M':
-        case '@':
-            halfPixelCounter += 14;
-        break;
-
-        case 'm':
-            halfPixelCounter += 15;
+    Scr_InitHalfPixelWidths();
 
-        default:
-            halfPixelCounter += 12;
-        }
+    while( *string ){
+        halfPixelCounter += scr_halfPixelWidth[(byte)*string];
         string++;
-
     }
     float result = (float)halfPixelCounter / 2.0;
 
@@ -932,6 +893,12 @@ void GScr_StrRepl(){
     char* find = Scr_GetString(1);
     char* replacement = Scr_GetString(2);
 
+    //Nothing to replace, the string table has the result already
+    if(!*find || (strlen(string) < sizeof(buffer) && strstr(string, find) == NULL)){
+        Scr_AddString(string);
+        return;
+    }
+
     Q_strnrepl(buffer, sizeof(buffer), string, find, replacement);
     buffer[sizeof(buffer) -1] = 0;
 
@@ -1096,7 +1063,7 @@ void GScr_FS_FOpen(){
     }
 
     if(!fh){
-            Com_DPrintf("Scr_FS_FOpen() failed\n");
+            Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Scr_FS_FOpen() failed\n");
     }
     Scr_AddInt(fh);
 }
@@ -1137,7 +1104,7 @@ void GScr_FS_FCloseAll(){
 
     int i;
 
-    for(i=0; i < MAX_SCRIPT_FILEHANDLES; i++)
+    for(i=1; i <= MAX_SCRIPT_FILEHANDLES; i++)
     {
         Scr_CloseScriptFile(i);
     }
@@ -1241,7 +1208,7 @@ void GScr_FS_WriteLine(){
 
     if(!ret)
     {
-        Com_DPrintf("^2Scr_FS_WriteLine() failed\n");
+        Com_DPrintfChannel(DPRINT_SCRIPT, 1, "^2Scr_FS_WriteLine() failed\n");
         Scr_AddBool(qfalse);
     }else{
         Scr_AddBool(qtrue);
@@ -1269,7 +1236,7 @@ void GScr_FS_Remove(){
 
     char* qpath = Scr_GetString(0);
 
-    if(!Scr_FS_AlreadyOpened(qpath, filename, sizeof(filename)))
+    if(Scr_FS_AlreadyOpened(qpath, filename, sizeof(filename)))
     {
             Scr_Error("FS_Remove: Tried to delete an opened file!\n");
             Scr_AddBool(qfalse);
@@ -1287,6 +1254,157 @@ void GScr_FS_Remove(){
 }
 
 
+/*
+============
+GScr_FS_ReadAll
+
+This function reads a whole file at once and returns its lines as array of strings.
+The \n and \r characters are stripped from every line.
+This function returns undefined if the file can not be opened or read.
+Usage: array = FS_ReadAll(string <filename>)
+============
+*/
+
+void GScr_FS_ReadAll(){
+
+    fileHandle_t fh;
+    char* buffer;
+    int len;
+
+    if(Scr_GetNumParam() != 1)
+        Scr_Error("Usage: FS_ReadAll(<filename>)\n");
+
+    char* filename = Scr_GetString(0);
+
+    fh = Scr_OpenScriptFile( filename, SCR_FH_FILE, FS_READ);
+    if(!fh){
+        Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Scr_FS_ReadAll() failed\n");
+        Scr_AddUndefined();
+        return;
+    }
+
+    len = Scr_FS_FileLength(fh);
+    if(len < 0 || len > SCR_MAX_READALL_SIZE){
+        Scr_CloseScriptFile(fh);
+        Scr_Error(va("FS_ReadAll(): %s exceeds the limit of %i bytes\n", filename, SCR_MAX_READALL_SIZE));
+        return;
+    }
+
+    buffer = Z_TagMalloc(len +1, TAG_SCRIPT);
+    len = Scr_FS_Read(buffer, len, fh);
+    Scr_CloseScriptFile(fh);
+
+    Scr_AddLinesArray(buffer, len);
+    Z_Free(buffer);
+}
+
+
+/*
+============
+GScr_FS_WriteAll
+
+This function writes the given string to a file in one call. The file gets overwritten.
+Lines have to be separated by \n inside of data.
+This function returns true on success, otherwise it returns false.
+Usage: bool = FS_WriteAll(string <filename>, string <data>)
+============
+*/
+
+void GScr_FS_WriteAll(){
+
+    fileHandle_t fh;
+    int len, ret;
+
+    if(Scr_GetNumParam() != 2)
+        Scr_Error("Usage: FS_WriteAll(<filename>, <data>)\n");
+
+    char* filename = Scr_GetString(0);
+    char* data = Scr_GetString(1);
+
+    fh = Scr_OpenScriptFile( filename, SCR_FH_FILE, FS_WRITE);
+    if(!fh){
+        Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Scr_FS_WriteAll() failed\n");
+        Scr_AddBool(qfalse);
+        return;
+    }
+
+    len = strlen(data);
+    ret = Scr_FS_Write(data, len, fh);
+    Scr_CloseScriptFile(fh);
+
+    if(ret != len)
+    {
+        Com_DPrintfChannel(DPRINT_SCRIPT, 1, "^2Scr_FS_WriteAll() failed\n");
+        Scr_AddBool(qfalse);
+    }else{
+        Scr_AddBool(qtrue);
+    }
+}
+
+
+/*
+============
+GScr_FS_ReadAllAsync
+
+Like FS_ReadAll but the file gets read by a worker thread. The lines get passed to
+CodeCallback_FSDone(id, lines) of _callbacksetup.gsc in one of the next frames,
+lines is undefined if the file could not be read.
+This function returns the id of the request or 0 if the file can not be opened.
+Usage: int = FS_ReadAllAsync(string <filename>)
+============
+*/
+
+void GScr_FS_ReadAllAsync(){
+
+    int id;
+
+    if(Scr_GetNumParam() != 1)
+        Scr_Error("Usage: FS_ReadAllAsync(<filename>)\n");
+
+    char* filename = Scr_GetString(0);
+
+    id = Scr_FS_AsyncStart(filename, FS_READ, NULL);
+    if(!id)
+        Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Scr_FS_ReadAllAsync() failed\n");
+
+    Scr_AddInt(id);
+}
+
+
+/*
+============
+GScr_FS_WriteAllAsync
+
+Like FS_WriteAll but the data gets written by a worker thread. If append is true the
+data gets appended to the file instead of overwriting it. Whether it got written is
+passed to CodeCallback_FSDone(id, success) of _callbacksetup.gsc in one of the next frames.
+This function returns the id of the request or 0 if the file can not be opened.
+Usage: int = FS_WriteAllAsync(string <filename>, string <data>, <optional bool append>)
+============
+*/
+
+void GScr_FS_WriteAllAsync(){
+
+    int id;
+    fsMode_t mode = FS_WRITE;
+
+    if(Scr_GetNumParam() != 2 && Scr_GetNumParam() != 3)
+        Scr_Error("Usage: FS_WriteAllAsync(<filename>, <data>, <optional append>)\n");
+
+    char* filename = Scr_GetString(0);
+    char* data = Scr_GetString(1);
+
+    if(Scr_GetNumParam() == 3 && Scr_GetInt(2))
+        mode = FS_APPEND;
+
+    id = Scr_FS_AsyncStart(filename, mode, data);
+    if(!id)
+        Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Scr_FS_WriteAllAsync() failed\n");
+
+    Scr_AddInt(id);
+}
+
+
 
 /*
 ============
@@ -1472,6 +1590,23 @@ void GScr_SpawnBot(){
 		Scr_AddEntity(clEnt);
 }
 
+/*
+============
+GScr_SpawnBots
+
+Usage: addtestclients(<count>)
+Queues the bots, they connect over the next server frames
+============
+*/
+
+void GScr_SpawnBots(){
+
+	if(Scr_GetNumParam() != 1){
+		Scr_Error("Usage: addtestclients( <count> )\n");
+	}
+	SV_QueueBotClients(Scr_GetInt(0), qfalse);
+}
+
 /*
 ============
 GScr_RemoveAllBots
@@ -1585,14 +1720,10 @@ void PlayerCmd_spawn(scr_entref_t arg){
 
 void GScr_NewHudElem(){
 
-    int i;
-    game_hudelem_t* element = g_hudelems;
+    game_hudelem_t* element = G_HudAllocElem();
 
-    for(i = 0; i < MAX_HUDELEMS; i++, element++)
+    if(element)
     {
-        if(element->inuse)
-            continue;
-
         element->inuse = qtrue;
         element->x = 0;
         element->y = 0;
@@ -1657,22 +1788,18 @@ void GScr_NewHudElem(){
 
 void GScr_NewClientHudElem(){
 
-    int i;
     gentity_t *ent = Scr_GetEntity(0);
-    game_hudelem_t* element = g_hudelems;
+    game_hudelem_t* element;
 
     if(ent->client == NULL){
         Scr_ParamError(0, "GScr_NewClientHudElem: Entity is not a client");
 
     }
 
+    element = G_HudAllocElem();
 
-
-    for(i = 0; i < MAX_HUDELEMS; i++, element++)
+    if(element)
     {
-        if(element->inuse)
-            continue;
-
         element->inuse = qtrue;
         element->x = 0;
         element->y = 0;
@@ -1735,41 +1862,34 @@ void GScr_NewClientHudElem(){
 }
 
 
-void HECmd_SetText(scr_entref_t entnum){
-
-    char buffer[1024];
+void HECmd_Destroy(scr_entref_t entnum){
 
     if(HIWORD(entnum) != 1)
     {
-        Scr_ObjectError("G_HudSetText: Not a hud element");
+        Scr_ObjectError("G_HudDestroy: Not a hud element");
         return;
     }
 
-    game_hudelem_t* element = &g_hudelems[LOWORD(entnum)];
+    //Same as the game's destroy but hands the slot back to the free list
+    G_HudDestroy(&g_hudelems[LOWORD(entnum)]);
+}
 
-    element->var_14 = 0;
-    element->var_15 = 0;
-    element->var_16 = 0;
 
-    element->movex = 0;
-    element->movey = 0;
-    element->movealign = 0;
-    element->movescralign = 0;
+void HECmd_SetText(scr_entref_t entnum){
 
-    element->var_18 = 0;
-    element->var_19 = 0;
-    element->var_20 = 0;
-    element->var_21 = 0;
+    char buffer[1024];
 
-    element->var_28 = 0;
-    element->var_29 = 0;
-    element->var_30 = 0;
+    if(HIWORD(entnum) != 1)
+    {
+        Scr_ObjectError("G_HudSetText: Not a hud element");
+        return;
+    }
 
-    element->hudTextConfigStringIndex = 0;
+    game_hudelem_t* element = &g_hudelems[LOWORD(entnum)];
 
     Scr_ConstructMessageString(0,0, "Hud Elem String", buffer, sizeof(buffer));
-    element->inuse = qtrue;
-    element->hudTextConfigStringIndex = G_LocalizedStringIndex(buffer);
+    //Resets the element like before and skips the configstring search if the text is the same
+    G_HudSetText(element, buffer);
 
 }
 
@@ -34,6 +34,7 @@ typedef int scr_entref_t;
 void PlayerCmd_GetUid(scr_entref_t arg);
 void PlayerCmd_GetUserinfo(scr_entref_t arg);
 void PlayerCmd_GetPing(scr_entref_t arg);
+void PlayerCmd_GetPlayerInfo(scr_entref_t arg);
 void PlayerCmd_SetGravity(scr_entref_t arg);
 void PlayerCmd_SetJumpHeight(scr_entref_t arg);
 void PlayerCmd_SetMoveSpeed(scr_entref_t arg);
@@ -55,7 +56,12 @@ void GScr_FS_TestFile();
 void GScr_FS_ReadLine();
 void GScr_FS_WriteLine();
 void GScr_FS_Remove();
+void GScr_FS_ReadAll();
+void GScr_FS_WriteAll();
+void GScr_FS_ReadAllAsync();
+void GScr_FS_WriteAllAsync();
 void GScr_SpawnBot();
+void GScr_SpawnBots();
 void GScr_RemoveAllBots();
 void GScr_RemoveBot();
 void GScr_KickClient();
@@ -64,6 +70,7 @@ void PlayerCmd_spawn(scr_entref_t arg);
 void GScr_NewHudElem();
 void GScr_NewClientHudElem();
 void HECmd_SetText(scr_entref_t entnum);
+void HECmd_Destroy(scr_entref_t entnum);
 
 __cdecl void ClientScr_SetSessionTeam(gclient_t* gcl, client_fields_t* gfl);
 
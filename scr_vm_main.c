@@ -27,6 +27,7 @@
 #include "qcommon_io.h"
 #include "cvar.h"
 #include "misc.h"
+#include "sys_main.h"
 
 typedef struct{
     char* name;
@@ -200,6 +201,7 @@ void Scr_AddStockFunctions(){
 	Scr_AddFunction("map_restart", (void*)0x80bb6d2, 0);
 	Scr_AddFunction("exitlevel", (void*)0x80bbfe2, 0);
 	Scr_AddFunction("addtestclient", GScr_SpawnBot, 0);
+	Scr_AddFunction("addtestclients", GScr_SpawnBots, 0);
 	Scr_AddFunction("removetestclient", GScr_RemoveBot, 0);
 	Scr_AddFunction("removealltestclients", GScr_RemoveAllBots, 0);
 	Scr_AddFunction("makedvarserverinfo", (void*)0x80c05bc, 0);
@@ -254,6 +256,10 @@ void Scr_AddStockFunctions(){
 	Scr_AddFunction("fs_readline", GScr_FS_ReadLine, 0);
 	Scr_AddFunction("fs_writeline", GScr_FS_WriteLine, 0);
 	Scr_AddFunction("fs_remove", GScr_FS_Remove, 0);
+	Scr_AddFunction("fs_readall", GScr_FS_ReadAll, 0);
+	Scr_AddFunction("fs_writeall", GScr_FS_WriteAll, 0);
+	Scr_AddFunction("fs_readallasync", GScr_FS_ReadAllAsync, 0);
+	Scr_AddFunction("fs_writeallasync", GScr_FS_WriteAllAsync, 0);
 	Scr_AddFunction("getrealtime", GScr_GetRealTime, 0);
 	Scr_AddFunction("timetostring", GScr_TimeToString, 0);
 	Scr_AddFunction("strtokbypixlen", GScr_StrTokByPixLen, 0);
@@ -357,6 +363,7 @@ void Scr_AddStockMethods(){
 	Scr_AddMethod("setrank", (void*)0x80a8ac4, 0);
 	Scr_AddMethod("getuserinfo", PlayerCmd_GetUserinfo, 0);
 	Scr_AddMethod("getping", PlayerCmd_GetPing, 0);
+	Scr_AddMethod("getplayerinfo", PlayerCmd_GetPlayerInfo, 0);
 	//HUD Functions
 	Scr_AddMethod("settext", HECmd_SetText, 0);
 	Scr_AddMethod("clearalltextafterhudelem", (void*)0x808f768, 0);
@@ -375,7 +382,7 @@ void Scr_AddStockMethods(){
 	Scr_AddMethod("scaleovertime", (void*)0x808ee86, 0);
 	Scr_AddMethod("moveovertime", (void*)0x808ed56, 0);
 	Scr_AddMethod("reset", (void*)0x808ebfa, 0);
-	Scr_AddMethod("destroy", (void*)0x808eba6, 0);
+	Scr_AddMethod("destroy", HECmd_Destroy, 0);
 	Scr_AddMethod("setpulsefx", (void*)0x808feb8, 0);
 	Scr_AddMethod("setplayernamestring", (void*)0x808ea9e, 0);
 	Scr_AddMethod("setmapnamestring", (void*)0x808e85a, 0);
@@ -534,7 +541,7 @@ int GScr_LoadScriptAndLabel(const char* scriptName, const char* labelName, qbool
         if(mandatory){
             Com_Error(ERR_DROP, "Could not find script '%s'", scriptName);
         }else{
-            Com_DPrintf("Notice: Could not find script '%s' - this part will be disabled\n", scriptName);
+            Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Notice: Could not find script '%s' - this part will be disabled\n", scriptName);
         }
         return 0;
     }
@@ -545,7 +552,7 @@ int GScr_LoadScriptAndLabel(const char* scriptName, const char* labelName, qbool
         if(mandatory){
             Com_Error(ERR_DROP, "Could not find label '%s' in script '%s'", labelName, scriptName);
         }else{
-            Com_DPrintf("Notice: Could not find label '%s' in script '%s' - this part will be disabled\n", labelName, scriptName);
+            Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Notice: Could not find label '%s' in script '%s' - this part will be disabled\n", labelName, scriptName);
         }
         return 0;
 
@@ -603,6 +610,7 @@ void GScr_LoadGameTypeScript(void){
     }else{
         say_forwardAll = qfalse;
     }
+    script_CallBacks_new[SCR_CB_NEW_FSDONE] = GScr_LoadScriptAndLabel("maps/mp/gametypes/_callbacksetup", "CodeCallback_FSDone", 0);
 }
 
 typedef struct
@@ -715,7 +723,11 @@ __cdecl void GScr_LoadScripts(void){
     char mappath[MAX_QPATH];
     cvar_t* mapname;
     int i;
+    unsigned int starttime;
 
+    starttime = Sys_Milliseconds();
+
+    Scr_ProfileLoadScripts();
     Scr_BeginLoadScripts();
     Scr_InitFunctions();
 
@@ -740,6 +752,8 @@ __cdecl void GScr_LoadScripts(void){
     GScr_AddFieldsForRadiant();
     Scr_EndLoadScripts();
 
+    Com_DPrintfChannel(DPRINT_SCRIPT, 1, "Loading and compiling of scripts took %u msec\n", Sys_Milliseconds() - starttime);
+
 }
 
 
@@ -0,0 +1,385 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+/*
+========================================================================
+
+Script builtin profiler
+
+The script compiler of the binary asks Scr_GetFunction / Scr_GetMethod for
+every builtin it finds and puts the returned address into the compiled code.
+While scr_profile was set when the scripts got loaded, it gets a small thunk
+instead which calls Scr_ProfileCall with the profile entry of that builtin.
+Nothing changes for the scripts of a level loaded with scr_profile 0.
+
+The interpreter itself is in the binary, so the time spent in the script
+functions can not be told apart. Builtins which run script callbacks, such as
+damage, show the builtins called by those as their children in the stacks.
+
+A Scr_Error inside of a builtin jumps right back into the interpreter, the
+stack of active builtins gets reset each server frame because of that.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon.h"
+#include "cvar.h"
+#include "cmd.h"
+#include "filesystem.h"
+#include "scr_vm.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#define SCR_PROFILE_MAXENTRIES 2048
+#define SCR_PROFILE_THUNKSIZE 32
+#define SCR_PROFILE_MAXDEPTH 16
+#define SCR_PROFILE_MAXSTACKS 4096	//Power of 2
+
+typedef struct{
+	xfunction_t	function;
+	char		name[64];
+	qboolean	method;
+	unsigned int	calls;
+	unsigned long long total;	//nsec including the nested builtins
+	unsigned long long self;
+}scrProfileEntry_t;
+
+typedef struct{
+	unsigned int	hash;
+	short		depth;		//0 for an unused slot
+	short		entries[SCR_PROFILE_MAXDEPTH];
+	unsigned long long self;
+}scrProfileStack_t;
+
+typedef struct{
+	short		entry;
+	unsigned long long child;
+}scrProfileFrame_t;
+
+static struct{
+	scrProfileEntry_t	entries[SCR_PROFILE_MAXENTRIES];
+	int			numEntries;
+	byte			*thunks;
+	scrProfileStack_t	stacks[SCR_PROFILE_MAXSTACKS];
+	int			numStacks;
+	unsigned int		droppedStacks;
+	scrProfileFrame_t	frames[SCR_PROFILE_MAXDEPTH];
+	int			depth;
+}scrProfile;
+
+static cvar_t* scr_profile;
+qboolean scr_profileActive;
+
+
+static unsigned long long Scr_ProfileClock( void ) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Adds the self time of the builtin on top of the active ones to its stack
+static void Scr_ProfileRecordStack( int entry, unsigned long long self ) {
+
+	scrProfileStack_t* stack;
+	unsigned int hash, i;
+	int j, depth;
+
+	depth = scrProfile.depth +1;
+
+	for(j = 0, hash = 2166136261u; j < scrProfile.depth; j++)
+		hash = (hash ^ scrProfile.frames[j].entry) * 16777619u;
+	hash = (hash ^ entry) * 16777619u;
+
+	for(i = hash; ; i++)
+	{
+		stack = &scrProfile.stacks[i & (SCR_PROFILE_MAXSTACKS -1)];
+
+		if(stack->depth == 0)
+			break;
+
+		if(stack->hash != hash || stack->depth != depth || stack->entries[depth -1] != entry)
+			continue;
+
+		for(j = 0; j < depth -1; j++)
+		{
+			if(stack->entries[j] != scrProfile.frames[j].entry)
+				break;
+		}
+		if(j == depth -1)
+		{
+			stack->self += self;
+			return;
+		}
+	}
+
+	if(scrProfile.numStacks >= SCR_PROFILE_MAXSTACKS / 4 * 3)
+	{
+		scrProfile.droppedStacks++;
+		return;
+	}
+
+	stack->hash = hash;
+	stack->depth = depth;
+	for(j = 0; j < depth -1; j++)
+		stack->entries[j] = scrProfile.frames[j].entry;
+	stack->entries[depth -1] = entry;
+	stack->self = self;
+	scrProfile.numStacks++;
+}
+
+//Called by the thunks. Functions get the entref too, it does not matter to them
+static void __cdecl Scr_ProfileCall( scrProfileEntry_t* entry, scr_entref_t entref ) {
+
+	unsigned long long start, elapsed, self;
+	int index = entry - scrProfile.entries;
+	int depth = scrProfile.depth;
+
+	start = Scr_ProfileClock();
+
+	if(depth < SCR_PROFILE_MAXDEPTH)
+	{
+		scrProfile.frames[depth].entry = index;
+		scrProfile.frames[depth].child = 0;
+		scrProfile.depth++;
+	}
+
+	((void (__cdecl*)(scr_entref_t))entry->function)(entref);
+
+	elapsed = Scr_ProfileClock() - start;
+
+	if(depth < SCR_PROFILE_MAXDEPTH)
+	{
+		self = elapsed - scrProfile.frames[depth].child;
+		scrProfile.depth = depth;
+		Scr_ProfileRecordStack(index, self);
+		if(depth > 0)
+			scrProfile.frames[depth -1].child += elapsed;
+	}else{
+		self = elapsed;
+	}
+
+	entry->calls++;
+	entry->total += elapsed;
+	entry->self += self;
+}
+
+/*
+============
+Scr_ProfileThunk
+
+Returns the address the compiled scripts call instead of the builtin, NULL if
+there is none
+============
+*/
+xfunction_t Scr_ProfileThunk( xfunction_t function, const char* name, qboolean method ) {
+
+#if defined(__i386__)
+	scrProfileEntry_t* entry;
+	unsigned int imm;
+	byte* code;
+	int i;
+
+	if(function == NULL)
+		return NULL;
+
+	//The entries stay for the whole runtime, compiled scripts might still have their thunks
+	for(i = 0; i < scrProfile.numEntries; i++)
+	{
+		entry = &scrProfile.entries[i];
+		if(entry->function == function && entry->method == method && !Q_stricmp(entry->name, name))
+			return (xfunction_t)(scrProfile.thunks + i * SCR_PROFILE_THUNKSIZE);
+	}
+
+	if(scrProfile.numEntries >= SCR_PROFILE_MAXENTRIES)
+		return NULL;
+
+	if(scrProfile.thunks == NULL)
+	{
+		code = mmap(NULL, SCR_PROFILE_MAXENTRIES * SCR_PROFILE_THUNKSIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(code == MAP_FAILED)
+		{
+			Com_PrintError("Scr_ProfileThunk: Can not allocate memory for the thunks\n");
+			return NULL;
+		}
+		scrProfile.thunks = code;
+	}
+
+	entry = &scrProfile.entries[scrProfile.numEntries];
+	entry->function = function;
+	entry->method = method;
+	Q_strncpyz(entry->name, name, sizeof(entry->name));
+
+	code = scrProfile.thunks + scrProfile.numEntries * SCR_PROFILE_THUNKSIZE;
+	scrProfile.numEntries++;
+
+	code[0] = 0xff;		//push dword [esp+4]	the entref
+	code[1] = 0x74;
+	code[2] = 0x24;
+	code[3] = 0x04;
+	code[4] = 0x68;		//push entry
+	imm = (unsigned int)entry;
+	Com_Memcpy(&code[5], &imm, 4);
+	code[9] = 0xb8;		//mov eax, Scr_ProfileCall
+	imm = (unsigned int)Scr_ProfileCall;
+	Com_Memcpy(&code[10], &imm, 4);
+	code[14] = 0xff;	//call eax
+	code[15] = 0xd0;
+	code[16] = 0x83;	//add esp, 8
+	code[17] = 0xc4;
+	code[18] = 0x08;
+	code[19] = 0xc3;	//ret
+
+	return (xfunction_t)code;
+#else
+	return NULL;
+#endif
+}
+
+//Called before the scripts get compiled
+void Scr_ProfileLoadScripts( void ) {
+
+	scr_profile = Cvar_RegisterBool("scr_profile", qfalse, 0, "Times every builtin the scripts call. Takes effect once the scripts get loaded again, see the command scriptprofile");
+	scr_profileActive = scr_profile->boolean;
+	scrProfile.depth = 0;
+}
+
+void Scr_ProfileFrame( void ) {
+
+	scrProfile.depth = 0;
+}
+
+static int Scr_ProfileCompareSelf( const void* a, const void* b ) {
+
+	const scrProfileEntry_t* ea = &scrProfile.entries[*(const int*)a];
+	const scrProfileEntry_t* eb = &scrProfile.entries[*(const int*)b];
+
+	if(ea->self == eb->self)
+		return 0;
+
+	return ea->self < eb->self ? 1 : -1;
+}
+
+static void Scr_ProfileReset( void ) {
+
+	int i;
+
+	for(i = 0; i < scrProfile.numEntries; i++)
+	{
+		scrProfile.entries[i].calls = 0;
+		scrProfile.entries[i].total = 0;
+		scrProfile.entries[i].self = 0;
+	}
+	Com_Memset(scrProfile.stacks, 0, sizeof(scrProfile.stacks));
+	scrProfile.numStacks = 0;
+	scrProfile.droppedStacks = 0;
+}
+
+//Writes one line "outer;inner usec" per stack, the input of flamegraph.pl
+static void Scr_ProfileDump( const char* filename ) {
+
+	fileHandle_t f;
+	scrProfileStack_t* stack;
+	int i, j;
+
+	f = FS_SV_FOpenFileWrite(filename);
+	if(!f){
+		Com_PrintError("Scr_ProfileDump: Can not open %s for writing\n", filename);
+		return;
+	}
+
+	for(i = 0, stack = scrProfile.stacks; i < SCR_PROFILE_MAXSTACKS; i++, stack++)
+	{
+		if(stack->depth == 0 || stack->self < 1000)
+			continue;
+
+		FS_Printf(f, "scripts");
+		for(j = 0; j < stack->depth; j++)
+			FS_Printf(f, ";%s", scrProfile.entries[stack->entries[j]].name);
+		FS_Printf(f, " %llu\n", stack->self / 1000);
+	}
+	FS_FCloseFile(f);
+
+	Com_Printf("Wrote %d stacks to %s\n", scrProfile.numStacks, filename);
+	if(scrProfile.droppedStacks)
+		Com_PrintWarning("%u calls had no room for their stack\n", scrProfile.droppedStacks);
+}
+
+/*
+============
+Scr_Profile_f
+
+scriptprofile [count] | reset | dump <file>
+============
+*/
+void Scr_Profile_f( void ) {
+
+	int order[SCR_PROFILE_MAXENTRIES];
+	scrProfileEntry_t* entry;
+	int i, count, num;
+
+	if(Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "reset")){
+		Scr_ProfileReset();
+		Com_Printf("Script profile cleared\n");
+		return;
+	}
+
+	if(Cmd_Argc() > 1 && !Q_stricmp(Cmd_Argv(1), "dump")){
+		if(Cmd_Argc() != 3){
+			Com_Printf("Usage: scriptprofile dump <filename>\n");
+			return;
+		}
+		Scr_ProfileDump(Cmd_Argv(2));
+		return;
+	}
+
+	if(!scr_profileActive)
+		Com_Printf("The builtins of the current scripts are not timed. Set scr_profile 1 and load a map\n");
+
+	count = Cmd_Argc() > 1 ? atoi(Cmd_Argv(1)) : 20;
+	if(count < 1)
+		count = 20;
+
+	for(i = 0, num = 0; i < scrProfile.numEntries; i++)
+	{
+		if(scrProfile.entries[i].calls)
+			order[num++] = i;
+	}
+	qsort(order, num, sizeof(order[0]), Scr_ProfileCompareSelf);
+
+	Com_Printf("%-32s %10s %10s %10s %8s\n", "builtin", "calls", "self_ms", "total_ms", "avg_us");
+	for(i = 0; i < num && i < count; i++)
+	{
+		entry = &scrProfile.entries[order[i]];
+		Com_Printf("%-32s %10u %10.2f %10.2f %8.2f\n", entry->name, entry->calls, entry->self / 1000000.0,
+			entry->total / 1000000.0, entry->total / 1000.0 / entry->calls);
+	}
+	Com_Printf("%d of %d builtins got called\n", num, scrProfile.numEntries);
+}
@@ -173,6 +173,7 @@ typedef struct client_s {//90b4f8c
 
 	char*			var_01;		//0x64c
 	char			userinfo[MAX_INFO_STRING];		// name, etc (0x650)
+	//Written by the binary's SV_AddServerCommand at this offset, so it stays an inline ring of strings
 	reliableCommands_t	reliableCommands[MAX_RELIABLE_COMMANDS];	// (0xa50)
 	int			reliableSequence;	// (0x20e50)last added reliable message, not necesarily sent or acknowledged yet
 	int			reliableAcknowledge;	// (0x20e54)last acknowledged reliable message
@@ -261,10 +262,30 @@ int	lasttime;
 int	attempts;
 }connectqueue_t;	//For fair queuing players who wait for an empty slot
 
-#define MAX_TRANSCMDS 32
+#define MAX_TRANSCMDS 256
+#define MAX_TRANSCMD_PARTS 32
+#define TRANSCMD_HASHSIZE 512		//Power of 2, twice MAX_TRANSCMDS
+
+typedef enum{
+	TRANSCMD_TEXT,
+	TRANSCMD_UID,
+	TRANSCMD_CLNUM,
+	TRANSCMD_POW,
+	TRANSCMD_ARG
+}translatedCmdPartType_t;
+
+typedef struct{
+	byte	type;			//translatedCmdPartType_t
+	byte	arg;			//Cmd_Argv() index of a $arg
+	short	start;			//Of the text in cmdargument
+	short	length;
+}translatedCmdPart_t;
+
 typedef struct{
 	char cmdname[32];
 	char cmdargument[1024];
+	int numParts;			//cmdargument split up at the $ variables when the command got added
+	translatedCmdPart_t parts[MAX_TRANSCMD_PARTS];
 }translatedCmds_t;
 
 /*
@@ -342,6 +363,7 @@ typedef struct {
 	qboolean		cmdSystemInitialized;
 	int			randint;
 	translatedCmds_t	translatedCmd[MAX_TRANSCMDS];
+	unsigned short		translatedCmdHash[TRANSCMD_HASHSIZE];	//Index + 1, 0 is empty
 	int			challenge;
 	int			useuids;
 	int			masterServer_id;
@@ -458,11 +480,48 @@ void SV_Heartbeat_f( void );
 void SV_ExecuteClientCommand( client_t *cl, const char *s, qboolean clientOK, qboolean inDl );
 
 void SV_SendClientSnapshot( client_t *cl );
+void SV_ScheduleClientMessages( void );
+int SV_ClientQueuedBytes( client_t *cl );
+qboolean SV_DownloadTakeBudget( client_t *cl, int length );
+void SV_UplinkStatus_f( void );
+void SV_SnapshotShedFrame( unsigned int frameWork, unsigned int frameUsec );
+void SV_SnapshotShedStatus( void );
+int SV_SnapshotShedLevel( void );
+void SV_CompressionStatus_f( void );
+void SV_TraceBench_f( void );
 
 qboolean SV_Acceptclient(int);
 
 void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...);
 
+typedef unsigned long long clientMask_t;
+#define CLIENTMASK_BIT(clnum) (1ULL << (clnum))
+
+clientMask_t SV_ClientMask( int minstate );
+clientMask_t SV_TeamClientMask( int team, int minstate );
+void QDECL SV_SendServerCommandToMask( clientMask_t mask, const char *fmt, ... );
+void SV_ResetClientMasks( client_t *cl );
+clientMask_t SV_ChatIgnoredBy( int clnum );
+
+/*
+The fields the per frame scans of svs.clients need, client_t is too large to walk through
+for them. client_t stays what the binary reads, so every write has to go through these helpers.
+*/
+typedef struct{
+	clientState_t	state;
+	int		lastPacketTime;
+	short		ping;
+	byte		timeoutCount;
+	byte		bot;
+}clientHot_t;
+
+extern clientHot_t sv_clientHot[MAX_CLIENTS];
+
+void SV_SetClientState( client_t *cl, clientState_t state );
+void SV_ClientPacketTime( client_t *cl );
+void SV_SyncClientHot( client_t *cl );
+void SV_SyncAllClientHot( void );
+
 __optimize3 __regparm2 void SV_PacketEvent( netadr_t *from, msg_t *msg );
 
 void SV_AddServerCommand( client_t *cl, int type, const char *cmd );
@@ -474,6 +533,27 @@ char*	SV_IsGUID(char* guid);
 void SV_Shutdown( const char* finalmsg);
 
 void SV_WriteGameState(msg_t*, client_t*);
+void SV_InvalidateGameStateCache( void );
+
+void SV_ResetClientPing( client_t *cl );
+void SV_ClientFrameSent( client_t *cl, int messageSize );
+void SV_ClientFrameAcked( client_t *cl, unsigned int ackTime );
+void SV_ClientPacketReceived( client_t *cl, int dropped );
+
+typedef struct{
+	int		ping;		//What the scoreboard shows, see sv_pingEstimator
+	int		mean;		//Round trips of the last acknowledged frames in msec
+	int		p50;
+	int		p95;
+	int		jitter;
+	int		samples;	//Acknowledged frames the round trips are taken from
+	float		loss;		//Recent share of the packets of the client which got lost on the way
+	unsigned int	received;	//Packets since the connect
+	unsigned int	lost;
+}clientNetStats_t;
+
+void SV_GetClientNetStats( client_t *cl, clientNetStats_t *stats );
+void SV_NetStatus_f( void );
 
 void SV_GetServerStaticHeader(void);
 
@@ -482,6 +562,31 @@ void SV_WriteDemoMessageForClient( byte *msg, int dataLen, client_t *client );
 void SV_StopRecord( client_t *cl );
 void SV_RecordClient( client_t* cl, char* basename );
 void SV_DemoSystemShutdown( void );
+qboolean SV_DemoKeyframeDue( client_t *cl );
+void SV_DemoKeyframe( client_t *cl );
+void SV_ReplayInit( void );
+void SV_ReplayFree( client_t *cl );
+void SV_ReplayReset( client_t *cl );
+qboolean SV_ReplayKeyframeDue( client_t *cl );
+void SV_ReplayKeyframe( client_t *cl );
+void SV_ReplayMessage( client_t *cl, byte *data, int dataLen );
+qboolean SV_SaveReplay( client_t *cl, const char *basename );
+void SV_ServerDemoInit( void );
+void SV_ServerDemoStart( const char *basename );
+void SV_ServerDemoStop( void );
+void SV_ServerDemoFrame( void );
+void SV_ServerDemoEndLevel( void );
+
+//sv_relay.c
+void SV_RelayInit( void );
+void SV_RelayFrame( void );
+qboolean SV_RelayActive( void );
+qboolean SV_RelayWaitingForKeyframe( void );
+void SV_RelayStreamStart( const void *header, int len );
+void SV_RelayStreamEnd( void );
+void SV_RelayFrameBegin( qboolean keyframe );
+void SV_RelayWrite( const void *data, int len );
+void SV_RelayFrameEnd( void );
 void SV_WriteDemoArchive(client_t *client);
 
 
@@ -492,6 +597,13 @@ void SV_Init( void );
 __optimize2 __regparm1 qboolean SV_Frame( unsigned int usec );
 
 unsigned int SV_FrameUsec( void );
+void SV_TickStatus_f( void );
+void SV_HugePageStatus_f( void );
+void SV_AdviseHugePages( void );
+void SV_FrameBudgetStatus( void );
+void SV_ResetFrameBudget( void );
+void SV_GetFrameBudget( unsigned int *overruns, unsigned int *droppedFrames );
+void SVC_GetQueryDrops( unsigned int drops[5] );
 
 void SV_RemoveAllBots( void );
 
@@ -504,7 +616,12 @@ __optimize3 __regparm1 void SV_AuthorizeIpPacket( netadr_t *from );
 __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from );
 __optimize3 __regparm2 void SV_ReceiveStats(netadr_t *from, msg_t* msg);
 void SV_UserinfoChanged( client_t *cl );
+void SV_UserinfoFrame( void );
+void SV_InvalidatePlayerIndex( client_t *cl );
 void SV_DropClient( client_t *drop, const char *reason );
+void SV_InvalidateQueryCache( void );
+void SV_PublishQuerySnapshot( void );
+qboolean SV_QueryThreadPacket( netadr_t *from, const byte *data, int len );
 __optimize3 __regparm3 void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta );
 void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd );
 void SV_WriteDownloadToClient( client_t *cl, msg_t *msg );
@@ -514,6 +631,27 @@ void SV_Netchan_Decode( client_t *client, byte *data, int remaining );
 void SV_Netchan_Encode( client_t *client, byte *data, int cursize );
 qboolean SV_Netchan_Transmit( client_t *client, byte *data, int cursize);
 qboolean SV_Netchan_TransmitNextFragment( client_t *client );
+qboolean SV_Netchan_Process( client_t *client, msg_t *msg );
+qboolean SV_Netchan_EncodeBenchmark( const byte *data, int length, const byte *string, byte key, byte *streamOut, byte *loopOut,
+	unsigned long long *streamUsec, unsigned long long *loopUsec );
+
+typedef struct{
+	unsigned long long	bytesIn;	//Whole datagrams including the netchan header
+	unsigned long long	bytesOut;
+	unsigned int		packetsIn;
+	unsigned int		packetsOut;
+	unsigned int		fragmentsIn;	//Packets which carried a piece of a bigger message
+	unsigned int		fragmentsOut;
+	unsigned int		dropped;	//Packets of the client which never arrived
+	unsigned int		outOfOrder;	//Late or duplicated packets of the client, thrown away
+	unsigned int		retransmits;	//Download blocks which had to be sent again
+	unsigned long long	encodeUsec;	//Compressing and encoding of the messages to the client
+}netchanStats_t;
+
+void SV_NetchanStatsEncodeTime( client_t *client, unsigned int usec );
+void SV_NetchanStatsRetransmit( client_t *client, int count );
+void SV_GetNetchanStats( client_t *client, netchanStats_t *stats );
+void SV_NetchanStatus_f( void );
 void SV_SysAuthorize(char* s);
 int SV_ClientAuthMode(void);
 qboolean SV_FriendlyPlayerCanBlock(void);
@@ -529,6 +667,7 @@ void SV_WriteRconStatus( msg_t *msg );
 
 void G_PrintAdvertForPlayer(client_t*);
 void G_PrintRuleForPlayer(client_t*);
+void G_PrintRulesAndAdverts( void );
 void G_AddRule(const char* newtext);
 void G_AddAdvert(const char* newtext);
 void G_SetupHudMessagesForPlayer(client_t*);
@@ -540,17 +679,32 @@ void SV_SayToPlayers(int clnum, int team, char* text);
 __optimize3 __regparm2 void SV_ExecuteClientMessage( client_t *cl, msg_t *msg );
 
 void SV_GetUserinfo( int index, char *buffer, int bufferSize );
+const char* SV_UserinfoValueForKey( client_t *cl, const char *key );
 
 qboolean SV_Map(const char* levelname);
 void SV_MapRestart( qboolean fastrestart );
 
+/*
+The binary stores the string and queues a "d <index> <string>" reliable command for
+every client inside of SV_SetConfigstring, the game module calls it directly. The
+queueing happens in the binary's SV_AddServerCommand, our version of it is not in use.
+The stock client takes one index and string per "d" command, so several changes can
+not be merged into one command the client understands.
+*/
 void __cdecl SV_SetConfigstring(int index, const char *text);
 //SV_SetConfigstring SV_SetConfigstring = (tSV_SetConfigstring)(0x8173fda);
+void SV_GetConfigstring( int index, char *buffer, int bufferSize );
 const char* SV_GetGuid(unsigned int clnum);
 void SV_ExecuteRemoteCmd(int, const char*);
 qboolean SV_UseUids();
 int SV_GetUid(unsigned int);
 sharedEntity_t* SV_AddBotClient();
+void SV_BotInit();
+void SV_QueueBotClients(int count, qboolean loadbot);
+void SV_CancelBotSpawns();
+void SV_BotSpawnFrame();
+void SV_LoadBotFrame();
+void SV_RemoveLoadBots();
 sharedEntity_t* SV_RemoveBot();
 qboolean SV_AddBan(int, int, char*, char*, time_t, char*);
 
@@ -573,10 +727,57 @@ void SV_RemoteCmdSetAdmin(int uid, char* guid, int power);
 void SV_RemoteCmdUnsetAdmin(int uid, char* guid);
 void SV_RemoteCmdSetPermission(char* command, int power);
 void SV_RemoteCmdListAdmins( void );
+void SV_RemoteCmdApplySharedAdmin(const char* infostring);
+
+//sv_sharedstore.c
+typedef enum{
+	SHAREDSTORE_BAN = 1,
+	SHAREDSTORE_ADMIN
+}sharedStoreType_t;
+
+void SV_SharedStoreInit( void );
+void SV_SharedStoreFrame( void );
+void SV_SharedStorePublish( sharedStoreType_t type, const char* data );
+
+void SV_StatusBoardInit( void );
+void SV_StatusBoardFrame( unsigned int frameWork );
+void SV_StatusBoardShutdown( void );
+
+//sv_mapprefetch.c
+void SV_MapPrefetchInit( void );
+void SV_MapPrefetchLevelStart( void );
+void SV_MapPrefetchFrame( void );
+void SV_MapPrefetchLevelLoad( const char* map );
+
+//sv_geoinfo.c
+typedef struct{
+	unsigned int	countryIndex;	//For the _GeoIP_country_* functions
+	qboolean	proxy;		//Listed as anonymous proxy
+	char		asn[64];	//"AS<number> <organisation>", empty without GeoIPASNum.dat
+}geoInfo_t;
+
+void SV_GeoInfoInit( void );
+void SV_GeoInfoRequest( netadr_t *from );
+qboolean SV_GeoInfoForAddress( netadr_t *adr, geoInfo_t *info );
+const char* SV_GeoInfoDenied( netadr_t *from );
+void SV_GeoInfoStatus_f( void );
+
+//sv_codecbench.c
+typedef enum{
+	CODECCORPUS_SERVER,		//Snapshots and gamestates without the 4 byte header the compression skips
+	CODECCORPUS_CLIENT		//Usercmd packets after the netchan decoding
+}codecCorpusType_t;
+
+void SV_CodecBenchInit( void );
+void SV_CodecCorpusRecord( codecCorpusType_t type, const byte* raw, int rawLength, const byte* packed, int packedLength );
+void SV_CodecBench_f( void );
 
 
+extern cvar_t* sv_hostname;
 extern cvar_t* sv_padPackets;
 extern cvar_t* sv_demoCompletedCmd;
+extern cvar_t* sv_demoKeyframeInterval;
+extern cvar_t* sv_demoIndex;
 extern cvar_t* sv_wwwBaseURL;
 extern cvar_t* sv_maxPing;
 extern cvar_t* sv_minPing;
@@ -585,6 +786,15 @@ extern cvar_t* sv_privateClients;
 extern cvar_t* sv_privatePassword;
 extern cvar_t* sv_reconnectlimit;
 extern cvar_t* sv_wwwDlDisconnected;
+extern cvar_t* sv_maxUplinkRate;
+extern cvar_t* sv_maxDownloadRate;
+extern cvar_t* sv_snapshotShedLoad;
+extern cvar_t* sv_userinfoInterval;
+extern cvar_t* sv_snapshotShedDistance;
+extern cvar_t* sv_pingEstimator;
+extern cvar_t* sv_snapshotFps;
+extern cvar_t* sv_maxCatchupFrames;
+extern cvar_t* sv_maxConnectsPerFrame;
 extern cvar_t* sv_allowDownload;
 extern cvar_t* sv_wwwDownload;
 extern cvar_t* sv_autodemorecord;
@@ -623,11 +833,18 @@ void __cdecl SV_AddServerCommand_old(client_t *client, int unkownzeroorone, cons
 //sv_banlist.c
 void SV_InitBanlist( void );
 qboolean  SV_ReloadBanlist();
+void SV_BanlistBeginReload();
 char* SV_PlayerIsBanned(int uid, char* pbguid, netadr_t *addr);
 char* SV_PlayerBannedByip(netadr_t *netadr);	//Gets called in SV_DirectConnect
 void SV_PlayerAddBanByip(netadr_t *remote, char *reason, int uid, char* guid, int adminuid, int expire);		//Gets called by future implemented ban-commands and if a prior ban got enforced again - This function can also be used to unset bans by setting 0 bantime
 qboolean SV_RemoveBan(int uid, char* guid, char* name);
 void SV_DumpBanlist( void );
+void SV_BanlistApplyShared(const char* line);
+void SV_BanlistFilterFrame( void );
+char* SV_PlayerBannedByRule(netadr_t *netadr);	//Gets called in SV_DirectConnect
+qboolean SV_AddBanRule(const char* type, const char* value, time_t expire, int adminuid, const char* reason);
+qboolean SV_RemoveBanRule(const char* type, const char* value);
+void SV_DumpBanRules( void );
 
 extern	serverStaticExt_t	svse;	// persistant server info across maps
 extern	permServerStatic_t	psvs;	// persistant even if server does shutdown
@@ -21,6 +21,12 @@
 #include <string.h>
 #include "sha256.h"
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SHA256_X86_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 
 #define GET_UINT32(n,b,i)                       \
 {                                               \
@@ -53,7 +59,7 @@ void sha256_starts( sha256_context *ctx )
     ctx->state[7] = 0x5BE0CD19;
 }
 
-void sha256_process( sha256_context *ctx, uint8 data[64] )
+static void sha256_process( sha256_context *ctx, uint8 data[64] )
 {
     uint32 temp1, temp2, W[64];
     uint32 A, B, C, D, E, F, G, H;
@@ -184,6 +190,123 @@ void sha256_process( sha256_context *ctx, uint8 data[64] )
     ctx->state[7] += H;
 }
 
+static void sha256_process_generic( sha256_context *ctx, uint8 *data, uint32 blocks )
+{
+    while( blocks-- )
+    {
+        sha256_process( ctx, data );
+        data += 64;
+    }
+}
+
+#ifdef SHA256_X86_SHANI
+
+static const unsigned int sha256_k[64] __attribute__ ((aligned (16))) =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+/*
+ * Four rounds with the SHA extensions. cur holds the message words of these rounds,
+ * next gets completed by sha256msg2 and prev prepared by sha256msg1 for later rounds
+ */
+#define SHANI_ROUNDS(i, cur, prev, next)                                        \
+{                                                                               \
+    if( i < 4 )                                                                 \
+        cur = _mm_shuffle_epi8( _mm_loadu_si128( (const __m128i*)(data + 16 * i) ), MASK ); \
+    MSG = _mm_add_epi32( cur, _mm_load_si128( (const __m128i*)&sha256_k[4 * i] ) ); \
+    STATE1 = _mm_sha256rnds2_epu32( STATE1, STATE0, MSG );                      \
+    if( i >= 3 && i < 15 )                                                      \
+    {                                                                           \
+        TMP = _mm_alignr_epi8( cur, prev, 4 );                                  \
+        next = _mm_add_epi32( next, TMP );                                      \
+        next = _mm_sha256msg2_epu32( next, cur );                               \
+    }                                                                           \
+    MSG = _mm_shuffle_epi32( MSG, 0x0E );                                       \
+    STATE0 = _mm_sha256rnds2_epu32( STATE0, STATE1, MSG );                      \
+    if( i >= 1 && i < 13 )                                                      \
+        prev = _mm_sha256msg1_epu32( prev, cur );                               \
+}
+
+__attribute__ ((target ("sha,ssse3,sse4.1")))
+static void sha256_process_shani( sha256_context *ctx, uint8 *data, uint32 blocks )
+{
+    __m128i STATE0, STATE1, MSG, TMP;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+    __m128i ABEF_SAVE, CDGH_SAVE;
+    const __m128i MASK = _mm_set_epi8( 12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3 );
+    unsigned int state[8];
+    int i;
+
+    for( i = 0; i < 8; i++ )
+        state[i] = ctx->state[i];
+
+    // The instructions want the state as ABEF and CDGH
+    TMP = _mm_loadu_si128( (const __m128i*)&state[0] );
+    STATE1 = _mm_loadu_si128( (const __m128i*)&state[4] );
+    TMP = _mm_shuffle_epi32( TMP, 0xB1 );
+    STATE1 = _mm_shuffle_epi32( STATE1, 0x1B );
+    STATE0 = _mm_alignr_epi8( TMP, STATE1, 8 );
+    STATE1 = _mm_blend_epi16( STATE1, TMP, 0xF0 );
+
+    MSG0 = MSG1 = MSG2 = MSG3 = _mm_setzero_si128();
+
+    while( blocks-- )
+    {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
+
+        SHANI_ROUNDS(  0, MSG0, MSG3, MSG1 );
+        SHANI_ROUNDS(  1, MSG1, MSG0, MSG2 );
+        SHANI_ROUNDS(  2, MSG2, MSG1, MSG3 );
+        SHANI_ROUNDS(  3, MSG3, MSG2, MSG0 );
+        SHANI_ROUNDS(  4, MSG0, MSG3, MSG1 );
+        SHANI_ROUNDS(  5, MSG1, MSG0, MSG2 );
+        SHANI_ROUNDS(  6, MSG2, MSG1, MSG3 );
+        SHANI_ROUNDS(  7, MSG3, MSG2, MSG0 );
+        SHANI_ROUNDS(  8, MSG0, MSG3, MSG1 );
+        SHANI_ROUNDS(  9, MSG1, MSG0, MSG2 );
+        SHANI_ROUNDS( 10, MSG2, MSG1, MSG3 );
+        SHANI_ROUNDS( 11, MSG3, MSG2, MSG0 );
+        SHANI_ROUNDS( 12, MSG0, MSG3, MSG1 );
+        SHANI_ROUNDS( 13, MSG1, MSG0, MSG2 );
+        SHANI_ROUNDS( 14, MSG2, MSG1, MSG3 );
+        SHANI_ROUNDS( 15, MSG3, MSG2, MSG0 );
+
+        STATE0 = _mm_add_epi32( STATE0, ABEF_SAVE );
+        STATE1 = _mm_add_epi32( STATE1, CDGH_SAVE );
+        data += 64;
+    }
+
+    TMP = _mm_shuffle_epi32( STATE0, 0x1B );
+    STATE1 = _mm_shuffle_epi32( STATE1, 0xB1 );
+    STATE0 = _mm_blend_epi16( TMP, STATE1, 0xF0 );
+    STATE1 = _mm_alignr_epi8( STATE1, TMP, 8 );
+
+    _mm_storeu_si128( (__m128i*)&state[0], STATE0 );
+    _mm_storeu_si128( (__m128i*)&state[4], STATE1 );
+
+    for( i = 0; i < 8; i++ )
+        ctx->state[i] = state[i];
+}
+
+#endif
+
+static void sha256_process_select( sha256_context *ctx, uint8 *data, uint32 blocks );
+
+/*
+ * Compresses whole 64 byte blocks. Points to the best kernel for this CPU once the
+ * first hash got computed
+ */
+static void (*sha256_process_blocks)( sha256_context *ctx, uint8 *data, uint32 blocks ) = sha256_process_select;
+
 void sha256_update( sha256_context *ctx, uint8 *input, uint32 length )
 {
     uint32 left, fill;
@@ -202,17 +325,17 @@ void sha256_update( sha256_context *ctx, uint8 *input, uint32 length )
     if( left && length >= fill )
     {
         memcpy( (void *) (ctx->buffer + left), (void *) input, fill );
-        sha256_process( ctx, ctx->buffer );
+        sha256_process_blocks( ctx, ctx->buffer, 1 );
         length -= fill;
         input  += fill;
         left = 0;
     }
 
-    while( length >= 64 )
+    if( length >= 64 )
     {
-        sha256_process( ctx, input );
-        length -= 64;
-        input  += 64;
+        sha256_process_blocks( ctx, input, length / 64 );
+        input  += length & ~0x3F;
+        length &= 0x3F;
     }
 
     if( length )
@@ -261,24 +384,75 @@ void sha256_finish( sha256_context *ctx, uint8 digest[32] )
 /*
  * those are the standard FIPS-180-2 test vectors
  */
-/*
-static char *msg[] = 
+static const char *sha256_testmsg[] =
 {
     "abc",
     "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
     NULL
 };
 
-static char *val[] =
+static const uint8 sha256_testval[][32] =
 {
-    "ba7816bf8f01cfea414140de5dae2223" \
-    "b00361a396177a9cb410ff61f20015ad",
-    "248d6a61d20638b8e5c026930c3e6039" \
-    "a33ce45964ff2167f6ecedd419db06c1",
-    "cdc76e5c9914fb9281a1c7e284d73e67" \
-    "f1809a48a497200e046d39ccc7112cd0"
+    { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+      0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad },
+    { 0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39,
+      0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb, 0x06, 0xc1 },
+    // One million times 'a'
+    { 0xcd, 0xc7, 0x6e, 0x5c, 0x99, 0x14, 0xfb, 0x92, 0x81, 0xa1, 0xc7, 0xe2, 0x84, 0xd7, 0x3e, 0x67,
+      0xf1, 0x80, 0x9a, 0x48, 0xa4, 0x97, 0x20, 0x0e, 0x04, 0x6d, 0x39, 0xcc, 0xc7, 0x11, 0x2c, 0xd0 }
 };
-*/
+
+/*
+ * Checks the currently selected kernel against the test vectors
+ */
+static int sha256_selftest( void )
+{
+    sha256_context ctx;
+    uint8 digest[32];
+    uint8 buf[1000];
+    int i;
+
+    for( i = 0; sha256_testmsg[i]; i++ )
+    {
+        sha256_starts( &ctx );
+        sha256_update( &ctx, (uint8*)sha256_testmsg[i], strlen( sha256_testmsg[i] ) );
+        sha256_finish( &ctx, digest );
+        if( memcmp( digest, sha256_testval[i], 32 ) )
+            return 0;
+    }
+
+    memset( buf, 'a', sizeof( buf ) );
+    sha256_starts( &ctx );
+    for( i = 0; i < 1000; i++ )
+        sha256_update( &ctx, buf, sizeof( buf ) );
+    sha256_finish( &ctx, digest );
+
+    return memcmp( digest, sha256_testval[2], 32 ) == 0;
+}
+
+static void sha256_process_select( sha256_context *ctx, uint8 *data, uint32 blocks )
+{
+    sha256_process_blocks = sha256_process_generic;
+
+#ifdef SHA256_X86_SHANI
+    unsigned int eax, ebx, ecx, edx;
+
+    if( __get_cpuid( 1, &eax, &ebx, &ecx, &edx ) && (ecx & bit_SSSE3) && (ecx & bit_SSE4_1) &&
+        __get_cpuid_max( 0, NULL ) >= 7 )
+    {
+        __cpuid_count( 7, 0, eax, ebx, ecx, edx );
+        if( ebx & (1 << 29) )
+        {
+            sha256_process_blocks = sha256_process_shani;
+            if( !sha256_selftest() )
+                sha256_process_blocks = sha256_process_generic;
+        }
+    }
+#endif
+
+    sha256_process_blocks( ctx, data, blocks );
+}
+
 const char* Com_SHA256( const char* string )
 {
     int r = strlen(string);
@@ -295,7 +469,7 @@ const char* Com_SHA256( const char* string )
         finalsha[r++] = hex[digestsha[i] >> 4];
         finalsha[r++] = hex[digestsha[i] & 0xf];
     }
-    finalsha[65] = 0x00;
+    finalsha[64] = 0x00;
 
     return finalsha;
 }
\ No newline at end of file
@@ -28,14 +28,18 @@
 #include "cvar.h"
 #include "sys_net.h"
 #include "sys_main.h"
+#include "sys_thread.h"
 #include "server.h"
+#include "maxmind_geoip.h"
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <time.h>
 
 #define BANLIST_DEFAULT_SIZE sizeof(banList_t)*128
-#define MAX_IPBANS 32
+#define BANLIST_HASH_SIZE 0x10000 //Must be a power of 2
+#define MAX_IPBANS 1024
 //Don't ban IPs for more than MAX_IPBAN_MINUTES minutes as they can be shared (Carrier-grade NAT)
 #define MAX_IPBAN_MINUTES 30
 
@@ -65,174 +69,1336 @@ typedef struct banList_s {
     char	pbguid[BANLIST_PBGUID_LENGTH];
     char	reason[128];
     char	playername[MAX_NAME_LENGTH];
+    int		nextuid;	//Hash chains. Index + 1 of the next entry, 0 terminates
+    int		nextguid;
 }banList_t;
 
 banList_t *banlist;
 ipBanList_t ipBans[MAX_IPBANS];
 
+//Heads of the hash chains. Index + 1 into banlist, 0 is empty
+static int banlistUidHash[BANLIST_HASH_SIZE];
+static int banlistGuidHash[BANLIST_HASH_SIZE];
+
+
+/*
+Binary trie over the address bits of ipBans. Every address type has its own root.
+Leaves can sit at any depth so a prefix length other than the full address length describes a netrange.
+The netrange rules further down have a trie of their own.
+*/
+
+#define IPBAN_TRIE_DEFAULT_SIZE 4096
+
+typedef struct{
+    int		child[2];	//0 = no child as node 0 is never a child
+    int		entry;		//Index into ipBans / banRules or -1
+}ipBanTrieNode_t;
+
+typedef struct{
+    ipBanTrieNode_t *nodes;
+    int		roots[4];
+    int		size;
+    int		count;
+    qboolean	failed;		//Out of memory - fall back to linear search
+}ipBanTrie_t;
+
+static ipBanTrie_t ipBanTrie;
+static int ipBanTrieDead; //Removed leaves. Trie gets rebuilt when too many accumulated
+
+//The kernel packet filter of sys_net.c gets the addresses of ipBans
+static qboolean ipBanFilterModified = qtrue;
+static time_t ipBanFilterExpire; //The first entry of the filter times out then, 0 if it has none
+
+
+static unsigned int SV_BanlistUidHash(int uid){
+
+    return ((unsigned int)uid * 2654435761u) >> 16 & (BANLIST_HASH_SIZE -1);
+}
+
+static unsigned int SV_BanlistGuidHash(const char* guid){
+
+    unsigned int hash = 5381;
+    int i;
+
+    for(i = 0; i < BANLIST_PBGUID_LENGTH -1 && guid[i]; i++)
+        hash = hash * 33 + tolower(guid[i]);
+
+    return hash & (BANLIST_HASH_SIZE -1);
+}
+
+static void SV_BanlistClearIndex(){
+
+    Com_Memset(banlistUidHash, 0, sizeof(banlistUidHash));
+    Com_Memset(banlistGuidHash, 0, sizeof(banlistGuidHash));
+}
+
+static void SV_BanlistIndexEntry(int index){
+
+    banList_t *this = &banlist[index];
+    unsigned int hash;
+
+    this->nextuid = 0;
+    this->nextguid = 0;
+
+    if(this->playeruid > 0){
+        hash = SV_BanlistUidHash(this->playeruid);
+        this->nextuid = banlistUidHash[hash];
+        banlistUidHash[hash] = index +1;
+    }
+    if(this->pbguid[0]){
+        hash = SV_BanlistGuidHash(this->pbguid);
+        this->nextguid = banlistGuidHash[hash];
+        banlistGuidHash[hash] = index +1;
+    }
+}
+
+static void SV_BanlistUnindexEntry(int index){
+
+    banList_t *this = &banlist[index];
+    int *link;
+
+    if(this->playeruid > 0){
+        for(link = &banlistUidHash[SV_BanlistUidHash(this->playeruid)]; *link; link = &banlist[*link -1].nextuid){
+            if(*link == index +1){
+                *link = this->nextuid;
+                break;
+            }
+        }
+    }
+    if(this->pbguid[0]){
+        for(link = &banlistGuidHash[SV_BanlistGuidHash(this->pbguid)]; *link; link = &banlist[*link -1].nextguid){
+            if(*link == index +1){
+                *link = this->nextguid;
+                break;
+            }
+        }
+    }
+    this->nextuid = 0;
+    this->nextguid = 0;
+}
+
+//Returns the index of the first entry with this uid or -1
+static int SV_BanlistFindUid(int uid){
+
+    int i;
+
+    for(i = banlistUidHash[SV_BanlistUidHash(uid)]; i; i = banlist[i -1].nextuid){
+        if(banlist[i -1].playeruid == uid)
+            return i -1;
+    }
+    return -1;
+}
+
+//Returns the index of the first entry with this guid (case insensitive) or -1
+static int SV_BanlistFindGuid(const char* guid){
+
+    int i;
+
+    for(i = banlistGuidHash[SV_BanlistGuidHash(guid)]; i; i = banlist[i -1].nextguid){
+        if(!Q_stricmp(banlist[i -1].pbguid, guid))
+            return i -1;
+    }
+    return -1;
+}
+
+
+static int* SV_IPBanTrieRoot(ipBanTrie_t *trie, netadr_t *adr, byte **address, int *bits){
+
+    switch(adr->type)
+    {
+        case NA_IP:
+            *address = adr->ip;
+            *bits = 32;
+            return &trie->roots[0];
+        case NA_TCP:
+            *address = adr->ip;
+            *bits = 32;
+            return &trie->roots[1];
+        case NA_IP6:
+            *address = adr->ip6;
+            *bits = 128;
+            return &trie->roots[2];
+        case NA_TCP6:
+            *address = adr->ip6;
+            *bits = 128;
+            return &trie->roots[3];
+        default:
+            return NULL;
+    }
+}
+
+static int SV_IPBanTrieAllocNode(ipBanTrie_t *trie){
+
+    ipBanTrieNode_t *newtrie;
+    int newsize;
+
+    if(trie->count >= trie->size){
+        newsize = trie->size ? trie->size * 2 : IPBAN_TRIE_DEFAULT_SIZE;
+        newtrie = realloc(trie->nodes, newsize * sizeof(ipBanTrieNode_t));
+        if(!newtrie){
+            Com_PrintError("Could not allocate enougth memory to extend the ipban index. Falling back to linear search\n");
+            trie->failed = qtrue;
+            return 0;
+        }
+        trie->nodes = newtrie;
+        trie->size = newsize;
+    }
+    trie->nodes[trie->count].child[0] = 0;
+    trie->nodes[trie->count].child[1] = 0;
+    trie->nodes[trie->count].entry = -1;
+    return trie->count++;
+}
+
+//Drops all nodes but keeps the memory
+static void SV_IPBanTrieClear(ipBanTrie_t *trie){
+
+    if(trie->nodes == NULL)
+    {
+        trie->failed = qfalse;
+        SV_IPBanTrieAllocNode(trie); //Node 0 is reserved
+    }else{
+        trie->count = 1;
+        trie->failed = qfalse;
+    }
+    Com_Memset(trie->roots, 0, sizeof(trie->roots));
+}
+
+//Walks down the trie. Creates missing nodes if create is set. Returns the node for this address or 0
+static int SV_IPBanTrieWalk(ipBanTrie_t *trie, netadr_t *adr, int prefixlen, qboolean create){
+
+    int *root;
+    byte *address;
+    int bits, i, node, bit, next;
+
+    root = SV_IPBanTrieRoot(trie, adr, &address, &bits);
+
+    if(root == NULL || trie->failed)
+        return 0;
+
+    if(prefixlen < 0 || prefixlen > bits)
+        prefixlen = bits;
+
+    if(*root == 0){
+        if(!create || (*root = SV_IPBanTrieAllocNode(trie)) == 0)
+            return 0;
+    }
+
+    node = *root;
+
+    for(i = 0; i < prefixlen; i++){
+        bit = (address[i >> 3] >> (7 - (i & 7))) & 1;
+        next = trie->nodes[node].child[bit];
+        if(next == 0){
+            if(!create || (next = SV_IPBanTrieAllocNode(trie)) == 0)
+                return 0;
+            trie->nodes[node].child[bit] = next;
+        }
+        node = next;
+    }
+    return node;
+}
+
+//Returns the entry of the longest matching prefix or -1
+static int SV_IPBanTrieFind(ipBanTrie_t *trie, netadr_t *adr){
+
+    int *root;
+    byte *address;
+    int bits, i, node, found;
+
+    root = SV_IPBanTrieRoot(trie, adr, &address, &bits);
+
+    if(root == NULL || *root == 0)
+        return -1;
+
+    node = *root;
+    found = trie->nodes[node].entry;
+
+    for(i = 0; i < bits; i++){
+        node = trie->nodes[node].child[(address[i >> 3] >> (7 - (i & 7))) & 1];
+        if(node == 0)
+            break;
+        if(trie->nodes[node].entry != -1)
+            found = trie->nodes[node].entry;
+    }
+    return found;
+}
+
+static void SV_IPBanTrieInsert(int index){
+
+    int node = SV_IPBanTrieWalk(&ipBanTrie, &ipBans[index].remote, -1, qtrue);
+
+    if(node)
+        ipBanTrie.nodes[node].entry = index;
+
+    ipBanFilterModified = qtrue;
+}
+
+static void SV_IPBanTrieRebuild(){
+
+    int i;
+
+    SV_IPBanTrieClear(&ipBanTrie);
+    ipBanTrieDead = 0;
+
+    for(i = 0; i < MAX_IPBANS; i++){
+        if(ipBans[i].timeout)
+            SV_IPBanTrieInsert(i);
+    }
+}
+
+static void SV_IPBanTrieRemove(int index){
+
+    int node = SV_IPBanTrieWalk(&ipBanTrie, &ipBans[index].remote, -1, qfalse);
+
+    if(node && ipBanTrie.nodes[node].entry == index){
+        ipBanTrie.nodes[node].entry = -1;
+        ipBanTrieDead++;
+    }
+
+    if(ipBanTrieDead > MAX_IPBANS)
+        SV_IPBanTrieRebuild();
+}
+
 
 qboolean SV_OversizeBanlistAlign(){
 
-    banList_t *new_blist;
-    int newSize;
+    banList_t *new_blist;
+    int newSize;
+
+    if(current_banlist_size <= (current_banindex + 1) * sizeof(banList_t)){//Memory extension
+        newSize = current_banlist_size + current_banlist_size / 4;
+        new_blist = realloc(banlist, newSize);
+        if(new_blist){
+            banlist = new_blist;
+            current_banlist_size = newSize;
+
+        }else{
+            Com_PrintError("Could not allocate enougth memory to extend the size of banlist. Failed to add new bans\n");
+            return qfalse;
+        }
+    }
+    return qtrue;
+}
+
+
+
+qboolean SV_ParseBanlist(char* line, time_t aclock, int linenumber){
+    banList_t *this;
+    int playeruid = 0;
+    int adminuid = 0;
+    time_t expire = 0;
+    char reason[128];
+    char guid[9];
+    guid[8] = 0;
+    char playername[MAX_NAME_LENGTH];
+
+    playeruid = atoi(Info_ValueForKey(line, "uid"));
+    adminuid = atoi(Info_ValueForKey(line, "auid"));
+    expire = atoi(Info_ValueForKey(line, "exp"));
+    Q_strncpyz(reason, Info_ValueForKey(line, "rsn"), sizeof(reason));
+    Q_strncpyz(guid, Info_ValueForKey(line, "guid"), sizeof(guid));
+    Q_strncpyz(playername, Info_ValueForKey(line, "nick"), sizeof(guid));
+
+    if(expire < aclock && expire != (time_t)-1){
+            return qtrue;
+    }
+    this = banlist;
+    if(!this)
+        return qfalse;
+
+    if(playeruid){
+        if(playeruid > 0 && SV_BanlistFindUid(playeruid) != -1){
+            Com_Printf("Error: This player with UID: %i is already banned onto this server (line: %d)\n",playeruid, linenumber);
+            return qfalse;
+        }
+    }else if(guid[7]){
+        if(SV_BanlistFindGuid(guid) != -1){
+            Com_Printf("Error: This player with GUID: %s is already banned onto this server (line: %d)\n",guid, linenumber);
+            return qfalse;
+        }
+    }else{
+        Com_Printf("Error: This player has no uid/guid (line: %d)\n",linenumber);
+        return qfalse; //Bad entry: No Id
+    }
+
+    if(!SV_OversizeBanlistAlign())
+        return qfalse;
+
+    this = &banlist[current_banindex];
+
+    this->playeruid = playeruid;
+    this->adminuid = adminuid;
+    this->expire = expire;
+    Q_strncpyz(this->reason, reason, sizeof(this->reason));
+    Q_strncpyz(this->pbguid, guid, sizeof(this->pbguid));
+    Q_strncpyz(this->playername, playername, sizeof(this->playername));
+    SV_BanlistIndexEntry(current_banindex);
+    current_banindex++; //Rise the array index
+    return qtrue;
+}
+
+/*
+A changed banrecord gets appended to the journal. It has the same format as the banlist and its records
+get replayed on top of the banlist when loading. A removed ban is a record with exp 0.
+Once the journal has grown large enough a background thread rewrites the banlist from a snapshot.
+The journal gets renamed to .compacting before so records which are appended meanwhile are never lost.
+*/
+
+#define BANLIST_JOURNAL_COMPACT_RECORDS 512
+
+typedef struct{
+    banList_t	*entries;
+    int		numentries;
+    time_t	aclock;
+    qboolean	failed;
+    char	path[MAX_OSPATH];
+    char	tmppath[MAX_OSPATH];
+    char	compactingpath[MAX_OSPATH];
+}banlistCompactJob_t;
+
+static int banlistJournalRecords;
+static banlistCompactJob_t banlistCompactJob;
+static qboolean banlistCompactRunning;
+static int banlistGeneration;	//Bumped on every write so a readahead can tell it is stale
+
+
+static void SV_BanlistRootedPath(const char* root, const char* filename, char* ospath, int size){
+
+    Q_strncpyz(ospath, FS_BuildOSPath( root, filename, "" ), size);
+    ospath[strlen(ospath)-1] = '\0';
+}
+
+static void SV_BanlistOSPath(const char* filename, char* ospath, int size){
+
+    SV_BanlistRootedPath(fs_homepath->string, filename, ospath, size);
+}
+
+static const char* SV_BanlistJournalName(){
+
+    return va("%s.journal", banlistfile->string);
+}
+
+static const char* SV_BanlistCompactingName(){
+
+    return va("%s.compacting", banlistfile->string);
+}
+
+
+//Does not use va() or print anything as it gets called from the compaction thread
+static qboolean SV_BanlistFieldValid(const char* value){
+
+    return strpbrk(value, "\\;\"") == NULL;
+}
+
+static int SV_BanlistFormatEntry(banList_t *this, char* infostring, int size){
+
+    int len;
+
+    if(this->playeruid > 0){
+        len = Com_sprintf(infostring, size, "\\uid\\%i", this->playeruid);
+    }else if(this->pbguid[7] && SV_BanlistFieldValid(this->pbguid)){
+        len = Com_sprintf(infostring, size, "\\guid\\%s", this->pbguid);
+    }else{
+        return 0;
+    }
+    if(this->playername[0] && SV_BanlistFieldValid(this->playername))
+        len += Com_sprintf(infostring + len, size - len, "\\nick\\%s", this->playername);
+    if(this->reason[0] && SV_BanlistFieldValid(this->reason))
+        len += Com_sprintf(infostring + len, size - len, "\\rsn\\%s", this->reason);
+
+    len += Com_sprintf(infostring + len, size - len, "\\exp\\%i\\auid\\%i\\\n", (int)this->expire, this->adminuid);
+    return len;
+}
+
+
+//Runs on a worker thread
+static void SV_BanlistCompactJob(void* arg){
+
+    banlistCompactJob_t *job = arg;
+    FILE *file;
+    char infostring[1024];
+    banList_t *this;
+    int len;
+    int i;
+
+    file = fopen(job->tmppath, "wb");
+
+    if(file){
+
+        for(i = 0, this = job->entries; i < job->numentries; this++, i++){
+
+            if(this->expire == (time_t)-1 || this->expire > job->aclock){
+
+                len = SV_BanlistFormatEntry(this, infostring, sizeof(infostring));
+                if(len > 0)
+                    fwrite(infostring, 1, len, file);
+            }
+        }
+
+        if(ferror(file) | fclose(file))
+            job->failed = qtrue;
+
+    }else{
+        job->failed = qtrue;
+    }
+
+    if(!job->failed && rename(job->tmppath, job->path) == 0){
+        remove(job->compactingpath);
+    }else{
+        job->failed = qtrue; //Keep the .compacting file. It gets replayed on next load
+    }
+
+    free(job->entries);
+    job->entries = NULL;
+}
+
+static void SV_BanlistCompactDone(void* arg){
+
+    banlistCompactJob_t *job = arg;
+
+    if(!banlistCompactRunning)
+        return; //Already reported by SV_BanlistFinishCompaction
+
+    banlistCompactRunning = qfalse;
+
+    if(job->failed)
+        Com_PrintError("SV_WriteBanlist: Can not write %s\n", job->path);
+}
+
+//Waits for a running compaction if wait is set and reports the result
+static qboolean SV_BanlistFinishCompaction(qboolean wait){
+
+    if(!banlistCompactRunning)
+        return qtrue;
+
+    if(!wait)
+        return qfalse;
+
+    Sys_WaitForJobs();
+    SV_BanlistCompactDone(&banlistCompactJob);
+    return qtrue;
+}
+
+//Moves the journal aside. If a former compaction failed its records are still in .compacting so the journal gets appended to it
+static qboolean SV_BanlistRotateJournal(){
+
+    char journalpath[MAX_OSPATH];
+    char compactingpath[MAX_OSPATH];
+    char buf[4096];
+    FILE *in, *out;
+    int len;
+
+    SV_BanlistOSPath(SV_BanlistJournalName(), journalpath, sizeof(journalpath));
+    SV_BanlistOSPath(SV_BanlistCompactingName(), compactingpath, sizeof(compactingpath));
+
+    in = fopen(journalpath, "rb");
+    if(!in)
+        return qtrue; //No journal
+
+    out = fopen(compactingpath, "rb");
+    if(!out){
+        fclose(in);
+        return rename(journalpath, compactingpath) == 0;
+    }
+    fclose(out);
+
+    out = fopen(compactingpath, "ab");
+    if(!out){
+        fclose(in);
+        return qfalse;
+    }
+
+    while((len = fread(buf, 1, sizeof(buf), in)) > 0)
+        fwrite(buf, 1, len, out);
+
+    fclose(in);
+
+    if(ferror(out) | fclose(out))
+        return qfalse;
+
+    return remove(journalpath) == 0;
+}
+
+
+void SV_WriteBanlist(){
+
+    banlistCompactJob_t *job = &banlistCompactJob;
+
+    if(!banlist)
+        return;
+
+    if(!SV_BanlistFinishCompaction(qfalse))
+        return; //Still busy, the journal keeps everything until next time
+
+    banlistGeneration++;
+
+    if(!SV_BanlistRotateJournal()){
+        Com_PrintError("SV_WriteBanlist: Can not rotate %s\n", SV_BanlistJournalName());
+        return;
+    }
+    banlistJournalRecords = 0;
+
+    Com_Memset(job, 0, sizeof(banlistCompactJob_t));
+
+    job->entries = malloc(current_banindex * sizeof(banList_t) +1);
+    if(!job->entries){
+        Com_PrintError("SV_WriteBanlist: Out of memory\n");
+        return;
+    }
+    Com_Memcpy(job->entries, banlist, current_banindex * sizeof(banList_t));
+    job->numentries = current_banindex;
+    time(&job->aclock);
+
+    SV_BanlistOSPath(banlistfile->string, job->path, sizeof(job->path));
+    SV_BanlistOSPath(va("%s.tmp", banlistfile->string), job->tmppath, sizeof(job->tmppath));
+    SV_BanlistOSPath(SV_BanlistCompactingName(), job->compactingpath, sizeof(job->compactingpath));
+
+    FS_CreatePath(job->path);
+
+    banlistCompactRunning = qtrue;
+    Sys_AddJob(SV_BanlistCompactJob, SV_BanlistCompactDone, job);
+}
+
+//Appends one record to the journal instead of rewriting the whole file
+static void SV_BanlistJournalEntry(banList_t *this){
+
+    fileHandle_t file;
+    char infostring[1024];
+    int len;
+
+    len = SV_BanlistFormatEntry(this, infostring, sizeof(infostring));
+    if(len < 1)
+        return;
+
+    SV_SharedStorePublish(SHAREDSTORE_BAN, infostring);
+
+    banlistGeneration++;
+
+    file = FS_SV_FOpenFileAppend(SV_BanlistJournalName());
+    if(!file){
+        Com_PrintError("SV_WriteBanlist: Can not open %s for writing\n", SV_BanlistJournalName());
+        return;
+    }
+    FS_Write(infostring, len, file);
+    FS_FCloseFile(file);
+
+    banlistJournalRecords++;
+
+    if(banlistJournalRecords >= BANLIST_JOURNAL_COMPACT_RECORDS)
+        SV_WriteBanlist();
+}
+
+//Replays one journal record. It replaces an existing record with the same uid / guid
+qboolean SV_ParseBanlistJournal(char* line, time_t aclock, int linenumber){
+
+    banList_t *this;
+    int playeruid;
+    time_t expire;
+    char guid[9];
+    int i;
+
+    playeruid = atoi(Info_ValueForKey(line, "uid"));
+    expire = atoi(Info_ValueForKey(line, "exp"));
+    Q_strncpyz(guid, Info_ValueForKey(line, "guid"), sizeof(guid));
+
+    banlistJournalRecords++;
+
+    if(playeruid > 0){
+        i = SV_BanlistFindUid(playeruid);
+    }else if(guid[7]){
+        i = SV_BanlistFindGuid(guid);
+    }else{
+        Com_Printf("Error: This player has no uid/guid (line: %d)\n",linenumber);
+        return qfalse;
+    }
+
+    if(i == -1)
+        return SV_ParseBanlist(line, aclock, linenumber);
+
+    SV_BanlistUnindexEntry(i);
+    this = &banlist[i];
+
+    this->playeruid = playeruid;
+    this->adminuid = atoi(Info_ValueForKey(line, "auid"));
+    this->expire = expire;
+    Q_strncpyz(this->reason, Info_ValueForKey(line, "rsn"), sizeof(this->reason));
+    Q_strncpyz(this->pbguid, guid, sizeof(this->pbguid));
+    Q_strncpyz(this->playername, Info_ValueForKey(line, "nick"), sizeof(this->playername));
+
+    SV_BanlistIndexEntry(i);
+    return qtrue;
+}
+
+static void SV_ParseBanlistLines(const char* filename, fileLineReader_t *reader, qboolean (*parse)(char* line, time_t aclock, int linenumber)){
+    time_t aclock;
+    time(&aclock);
+    char buf[256];
+    buf[0] = 0;
+    int read;
+    int error;
+    int i;
+
+    for(i = 0, error = 0 ;error < 32 ;i++){
+
+        read = FS_ReaderReadLine(reader,buf,sizeof(buf));
+        if(read == 0){
+            Com_Printf("%i lines parsed from %s, %i errors occured\n",i,filename,error);
+            return;
+        }
+        if(read == -1){
+            Com_Printf("Can not read from %s\n",filename);
+            return;
+        }
+        if(!*buf || *buf == '/' || *buf == '\n'){
+            continue;
+        }
+        if(!parse(buf, aclock, i+1)) error++; //Executes the function given as argument in execute
+    }
+    Com_PrintWarning("More than 32 errors occured by reading from %s\n",filename);
+}
+
+//The file gets mapped, the lines are parsed straight out of the page cache
+static void SV_LoadBanlistFile(const char* filename, qboolean (*parse)(char* line, time_t aclock, int linenumber)){
+
+    fileLineReader_t reader;
+
+    if(!FS_SV_OpenLineReader(filename, &reader)){
+        Com_DPrintf("SV_ReadBanlist: Can not open %s for reading\n",filename);
+        return;
+    }
+    SV_ParseBanlistLines(filename, &reader, parse);
+    FS_CloseLineReader(&reader);
+}
+
+/*
+Readahead for the map change
+
+SV_BanlistBeginReload reads the banlist files on a worker thread while the binary loads the
+level, SV_ReloadBanlist parses what got read afterwards. If a record was written in between
+or the worker is not done yet the files get read again the regular way.
+*/
+
+#define BANLIST_READAHEAD_FILES 3
+#define BANLIST_READAHEAD_MAXSIZE (64*1024*1024)
+
+typedef struct{
+    char	ospaths[BANLIST_READAHEAD_FILES][2][MAX_OSPATH];	//fs_homepath and fs_basepath, the second one can be empty
+    char	*data[BANLIST_READAHEAD_FILES];			//NULL if the file does not exist
+    int		len[BANLIST_READAHEAD_FILES];
+    int		generation;
+    qboolean	failed;
+    volatile qboolean finished;				//Set by the worker. Sys_WaitForJobs would wait for the map prefetch as well
+}banlistReadahead_t;
+
+static banlistReadahead_t banlistReadahead;
+static qboolean banlistReadaheadRunning;
+static qboolean banlistReadaheadReady;
+static qboolean banlistReadaheadAbandoned;
+
+
+//Runs on a worker thread
+static void SV_BanlistReadaheadJob(void* arg){
+
+    banlistReadahead_t *job = arg;
+    FILE *file;
+    long len;
+    int i, j;
+
+    for(i = 0; i < BANLIST_READAHEAD_FILES; i++){
+
+        for(j = 0, file = NULL; j < 2 && file == NULL; j++){
+            if(job->ospaths[i][j][0])
+                file = fopen(job->ospaths[i][j], "rb");
+        }
+        if(!file)
+            continue;
+
+        if(fseek(file, 0, SEEK_END) == 0 && (len = ftell(file)) >= 0 && len < BANLIST_READAHEAD_MAXSIZE && fseek(file, 0, SEEK_SET) == 0){
+
+            job->data[i] = malloc(len +1);
+            if(job->data[i] && fread(job->data[i], 1, len, file) == len){
+                job->data[i][len] = '\0';
+                job->len[i] = len;
+            }else{
+                free(job->data[i]);
+                job->data[i] = NULL;
+                job->failed = qtrue;
+            }
+        }else{
+            job->failed = qtrue;
+        }
+        fclose(file);
+    }
+    __sync_synchronize();
+    job->finished = qtrue;
+}
+
+static void SV_BanlistFreeReadahead(){
+
+    int i;
+
+    if(banlistReadaheadRunning)
+        return;
+
+    for(i = 0; i < BANLIST_READAHEAD_FILES; i++){
+        free(banlistReadahead.data[i]);
+        banlistReadahead.data[i] = NULL;
+    }
+    banlistReadaheadReady = qfalse;
+}
+
+static void SV_BanlistReadaheadDone(void* arg){
+
+    if(!banlistReadaheadRunning)
+        return; //Already collected by SV_BanlistFinishReadahead
+
+    banlistReadaheadRunning = qfalse;
+    banlistReadaheadReady = qtrue;
+
+    if(banlistReadaheadAbandoned){
+        banlistReadaheadAbandoned = qfalse;
+        SV_BanlistFreeReadahead();
+    }
+}
+
+//Returns qtrue if the buffers can be parsed
+static qboolean SV_BanlistFinishReadahead(){
+
+    if(!banlistReadaheadRunning)
+        return banlistReadaheadReady;
+
+    if(!banlistReadahead.finished){
+        Com_DPrintf("SV_ReloadBanlist: Readahead is not done yet\n");
+        banlistReadaheadAbandoned = qtrue;
+        return qfalse;
+    }
+    __sync_synchronize();
+
+    SV_BanlistReadaheadDone(&banlistReadahead);
+    return banlistReadaheadReady;
+}
+
+//Same as SV_LoadBanlistFile but from a readahead buffer
+static void SV_ParseBanlistReadahead(const char* filename, int index, qboolean (*parse)(char* line, time_t aclock, int linenumber)){
+
+    fileLineReader_t reader;
+
+    if(!banlistReadahead.data[index]){
+        Com_DPrintf("SV_ReadBanlist: Can not open %s for reading\n",filename);
+        return;
+    }
+    FS_OpenBufferLineReader((byte*)banlistReadahead.data[index], banlistReadahead.len[index], &reader);
+    SV_ParseBanlistLines(filename, &reader, parse);
+}
+
+//Called before the level gets loaded. SV_ReloadBanlist picks up the result
+void SV_BanlistBeginReload(){
+
+    banlistReadahead_t *job = &banlistReadahead;
+    const char *names[BANLIST_READAHEAD_FILES];
+    int i;
+
+    if(!banlist || banlistReadaheadRunning)
+        return;
+
+    SV_BanlistFreeReadahead();
+
+    //The banlist file must not get replaced while we read it
+    SV_BanlistFinishCompaction(qtrue);
+
+    Com_Memset(job, 0, sizeof(banlistReadahead_t));
+
+    names[0] = banlistfile->string;
+    names[1] = SV_BanlistCompactingName();
+    names[2] = SV_BanlistJournalName();
+
+    for(i = 0; i < BANLIST_READAHEAD_FILES; i++){
+        SV_BanlistRootedPath(fs_homepath->string, names[i], job->ospaths[i][0], sizeof(job->ospaths[i][0]));
+        if(Q_stricmp(fs_homepath->string, fs_basepath->string))
+            SV_BanlistRootedPath(fs_basepath->string, names[i], job->ospaths[i][1], sizeof(job->ospaths[i][1]));
+    }
+    job->generation = banlistGeneration;
+
+    banlistReadaheadRunning = qtrue;
+    Sys_AddJob(SV_BanlistReadaheadJob, SV_BanlistReadaheadDone, job);
+}
+
+void SV_LoadBanlist(){
+
+    //The banlist file must not get replaced while we read it
+    SV_BanlistFinishCompaction(qtrue);
+
+    banlistJournalRecords = 0;
+
+    if(SV_BanlistFinishReadahead() && !banlistReadahead.failed && banlistReadahead.generation == banlistGeneration){
+
+        SV_ParseBanlistReadahead(banlistfile->string, 0, SV_ParseBanlist);
+        SV_ParseBanlistReadahead(SV_BanlistCompactingName(), 1, SV_ParseBanlistJournal);
+        SV_ParseBanlistReadahead(SV_BanlistJournalName(), 2, SV_ParseBanlistJournal);
+
+    }else{
+
+        SV_LoadBanlistFile(banlistfile->string, SV_ParseBanlist);
+        SV_LoadBanlistFile(SV_BanlistCompactingName(), SV_ParseBanlistJournal);
+        SV_LoadBanlistFile(SV_BanlistJournalName(), SV_ParseBanlistJournal);
+    }
+    SV_BanlistFreeReadahead();
+
+    if(banlistJournalRecords >= BANLIST_JOURNAL_COMPACT_RECORDS)
+        SV_WriteBanlist();
+}
+
+
+//Returns the index into ipBans of the entry for this address or -1
+static int SV_FindIPBan(netadr_t *netadr){
+
+    byte *address;
+    int bits;
+    int i;
+
+    if(!ipBanTrie.failed && SV_IPBanTrieRoot(&ipBanTrie, netadr, &address, &bits) != NULL)
+        return SV_IPBanTrieFind(&ipBanTrie, netadr);
+
+    //Address types which are not indexed
+    for(i = 0; i < MAX_IPBANS; i++){
+        if(ipBans[i].timeout && NET_CompareBaseAdr(netadr, &ipBans[i].remote))
+            return i;
+    }
+    return -1;
+}
+
+static void SV_ClearIPBan(int index){
+
+    if(ipBans[index].timeout)
+    {
+        SV_IPBanTrieRemove(index);
+        ipBanFilterModified = qtrue;
+    }
+
+    Com_Memset(&ipBans[index],0,sizeof(ipBanList_t));
+}
+
+/*
+Ban rules for netranges, countries and autonomous systems
+
+They are kept in banrulefile, one infostring per rule:
+\type\range\val\192.0.2.0/24\exp\-1\auid\0\rsn\reason\
+type is range, country (two letter code) or asn (AS number). On every change they get
+compiled into a trie of the netranges, a bitset of the countries and a sorted list of the
+AS numbers. SV_PlayerBannedByRule() looks at all of them in one pass, the country and the
+AS come from the lookup sv_geoinfo.c did when the client asked for the challenge.
+*/
+
+#define MAX_BANRULES 1024
+
+typedef enum{
+    BANRULE_RANGE = 1,
+    BANRULE_COUNTRY,
+    BANRULE_ASN
+}banRuleType_t;
+
+typedef struct{
+    banRuleType_t type;
+    netadr_t	net;		//BANRULE_RANGE with the host bits cleared
+    int		bits;
+    unsigned int value;		//Country index or AS number
+    time_t	expire;		//-1 is permanent
+    int		adminuid;
+    char	reason[128];
+}banRule_t;
+
+static const char* banRuleTypeNames[] = { "", "range", "country", "asn" };
+
+static cvar_t *banrulefile;
+static banRule_t banRules[MAX_BANRULES];
+static int numBanRules;
+
+//Compiled
+static ipBanTrie_t banRuleTrie;
+static unsigned int banRuleCountries[256 / 32];
+static qboolean banRuleHaveCountries;
+static unsigned int banRuleAsns[MAX_BANRULES];
+static int banRuleNumAsns;
+static time_t banRuleExpire;	//The first rule times out then, 0 if none
+static netadr_t banRuleFilterNets[MAX_BANRULES];
+static int banRuleFilterBits[MAX_BANRULES];
+static int banRuleNumFilterNets;
+
+
+static int SV_BanRuleCompareAsn(const void *a, const void *b){
+
+    unsigned int x = *(const unsigned int*)a;
+    unsigned int y = *(const unsigned int*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void SV_BanRulesCompile(){
+
+    banRule_t *rule;
+    time_t now;
+    int i, node;
+
+    now = Com_GetRealtime();
+
+    //Drop the expired ones first
+    for(i = 0; i < numBanRules; ){
+        if(banRules[i].expire != (time_t)-1 && banRules[i].expire <= now){
+            banRules[i] = banRules[--numBanRules];
+            continue;
+        }
+        i++;
+    }
+
+    SV_IPBanTrieClear(&banRuleTrie);
+    Com_Memset(banRuleCountries, 0, sizeof(banRuleCountries));
+    banRuleHaveCountries = qfalse;
+    banRuleNumAsns = 0;
+    banRuleNumFilterNets = 0;
+    banRuleExpire = 0;
+
+    for(i = 0, rule = banRules; i < numBanRules; i++, rule++){
+
+        switch(rule->type){
+            case BANRULE_RANGE:
+                node = SV_IPBanTrieWalk(&banRuleTrie, &rule->net, rule->bits, qtrue);
+                if(node)
+                    banRuleTrie.nodes[node].entry = i;
+                banRuleFilterNets[banRuleNumFilterNets] = rule->net;
+                banRuleFilterBits[banRuleNumFilterNets] = rule->bits;
+                banRuleNumFilterNets++;
+                break;
+            case BANRULE_COUNTRY:
+                banRuleCountries[rule->value >> 5] |= 1 << (rule->value & 31);
+                banRuleHaveCountries = qtrue;
+                break;
+            case BANRULE_ASN:
+                banRuleAsns[banRuleNumAsns++] = rule->value;
+                break;
+        }
+        if(rule->expire != (time_t)-1 && (banRuleExpire == 0 || rule->expire < banRuleExpire))
+            banRuleExpire = rule->expire;
+    }
+    qsort(banRuleAsns, banRuleNumAsns, sizeof(banRuleAsns[0]), SV_BanRuleCompareAsn);
+
+    ipBanFilterModified = qtrue;
+}
+
+//Fills in type and value from the two strings. Returns qfalse with a message if they make no sense
+static qboolean SV_BanRuleParseValue(banRule_t *rule, const char* type, const char* value){
+
+    char addr[NET_ADDRSTRMAXLEN];
+    const char *slash;
+    int i, index, bits, maxbits;
+
+    if(!Q_stricmp(type, "range")){
+
+        slash = strchr(value, '/');
+        Q_strncpyz(addr, value, slash && slash - value < sizeof(addr) ? slash - value +1 : sizeof(addr));
+
+        //No hostnames, they would get resolved right here
+        if(!addr[0] || strspn(addr, "0123456789abcdefABCDEF:.") != strlen(addr) || NET_StringToAdr(addr, &rule->net, NA_UNSPEC) == 0 ||
+            (rule->net.type != NA_IP && rule->net.type != NA_IP6)){
+            Com_Printf("Not a netrange: %s\n", value);
+            return qfalse;
+        }
+        maxbits = rule->net.type == NA_IP ? 32 : 128;
+        bits = slash ? atoi(slash +1) : maxbits;
+
+        if(bits < 1 || bits > maxbits){
+            Com_Printf("Bad prefix length: %s\n", value);
+            return qfalse;
+        }
+        rule->type = BANRULE_RANGE;
+        rule->bits = bits;
+        rule->net.port = 0;
+
+        for(i = bits; i < maxbits; i++)
+            rule->net.ip6[i >> 3] &= ~(0x80 >> (i & 7));
+
+        return qtrue;
+    }
+    if(!Q_stricmp(type, "country")){
+
+        index = _GeoIP_country_index_by_code(value);
+        if(index <= 0){
+            Com_Printf("Unknown country code: %s\n", value);
+            return qfalse;
+        }
+        rule->type = BANRULE_COUNTRY;
+        rule->value = index;
+        return qtrue;
+    }
+    if(!Q_stricmp(type, "asn")){
+
+        if(!Q_stricmpn(value, "AS", 2))
+            value += 2;
+
+        if(atoi(value) <= 0){
+            Com_Printf("Not an AS number: %s\n", value);
+            return qfalse;
+        }
+        rule->type = BANRULE_ASN;
+        rule->value = atoi(value);
+        return qtrue;
+    }
+    Com_Printf("Unknown ban rule type: %s. Use range, country or asn\n", type);
+    return qfalse;
+}
+
+static const char* SV_BanRuleValueString(banRule_t *rule){
+
+    char addr[NET_ADDRSTRMAXLEN];
+    char *start, *end;
+
+    switch(rule->type){
+        case BANRULE_RANGE:
+            //Without the port and the brackets, "192.0.2.0:0" and "[2001:db8::]:0"
+            Q_strncpyz(addr, NET_AdrToString(&rule->net), sizeof(addr));
+            end = strrchr(addr, ':');
+            if(end)
+                *end = '\0';
+            start = addr;
+            if(*start == '['){
+                start++;
+                end = strchr(start, ']');
+                if(end)
+                    *end = '\0';
+            }
+            return va("%s/%d", start, rule->bits);
+        case BANRULE_COUNTRY:
+            return _GeoIP_country_code(rule->value);
+        case BANRULE_ASN:
+            return va("AS%u", rule->value);
+    }
+    return "";
+}
+
+static int SV_BanRuleFind(banRule_t *match){
 
-    if(current_banlist_size <= (current_banindex + 1) * sizeof(banList_t)){//Memory extension
-        newSize = current_banlist_size + current_banlist_size / 4;
-        new_blist = realloc(banlist, newSize);
-        if(new_blist){
-            banlist = new_blist;
-            current_banlist_size = newSize;
+    int i;
 
-        }else{
-            Com_PrintError("Could not allocate enougth memory to extend the size of banlist. Failed to add new bans\n");
-            return qfalse;
+    for(i = 0; i < numBanRules; i++){
+        if(banRules[i].type != match->type)
+            continue;
+        if(match->type == BANRULE_RANGE){
+            if(banRules[i].bits == match->bits && NET_CompareBaseAdr(&banRules[i].net, &match->net))
+                return i;
+        }else if(banRules[i].value == match->value){
+            return i;
         }
     }
+    return -1;
+}
+
+static void SV_WriteBanRules(){
+
+    fileHandle_t file;
+    banRule_t *rule;
+    int i;
+
+    file = FS_SV_FOpenFileWrite(banrulefile->string);
+    if(!file){
+        Com_PrintError("SV_WriteBanRules: Can not open %s for writing\n", banrulefile->string);
+        return;
+    }
+    for(i = 0, rule = banRules; i < numBanRules; i++, rule++){
+        FS_Printf(file, "\\type\\%s\\val\\%s\\exp\\%i\\auid\\%i\\rsn\\%s\\\n", banRuleTypeNames[rule->type],
+            SV_BanRuleValueString(rule), (int)rule->expire, rule->adminuid, rule->reason);
+    }
+    FS_FCloseFile(file);
+}
+
+static qboolean SV_ParseBanRule(char* line, time_t aclock, int linenumber){
+
+    banRule_t rule;
+
+    if(numBanRules >= MAX_BANRULES){
+        Com_Printf("Error: More than %d ban rules (line: %d)\n", MAX_BANRULES, linenumber);
+        return qfalse;
+    }
+
+    Com_Memset(&rule, 0, sizeof(rule));
+
+    if(!SV_BanRuleParseValue(&rule, Info_ValueForKey(line, "type"), Info_ValueForKey(line, "val"))){
+        Com_Printf("Error: Bad ban rule (line: %d)\n", linenumber);
+        return qfalse;
+    }
+    rule.expire = atoi(Info_ValueForKey(line, "exp"));
+    rule.adminuid = atoi(Info_ValueForKey(line, "auid"));
+    Q_strncpyz(rule.reason, Info_ValueForKey(line, "rsn"), sizeof(rule.reason));
+
+    if(rule.expire != (time_t)-1 && rule.expire < aclock)
+        return qtrue;
+
+    if(SV_BanRuleFind(&rule) != -1)
+        return qtrue;
+
+    banRules[numBanRules++] = rule;
     return qtrue;
 }
 
+/*
+==================
+SV_AddBanRule
 
+expire is -1 for a permanent rule. An existing rule for the same value gets updated
+==================
+*/
+qboolean SV_AddBanRule(const char* type, const char* value, time_t expire, int adminuid, const char* reason){
 
-qboolean SV_ParseBanlist(char* line, time_t aclock, int linenumber){
-    banList_t *this;
-    int playeruid = 0;
-    int adminuid = 0;
-    time_t expire = 0;
-    char reason[128];
-    char guid[9];
-    guid[8] = 0;
-    char playername[MAX_NAME_LENGTH];
+    banRule_t rule;
     int i;
 
-    playeruid = atoi(Info_ValueForKey(line, "uid"));
-    adminuid = atoi(Info_ValueForKey(line, "auid"));
-    expire = atoi(Info_ValueForKey(line, "exp"));
-    Q_strncpyz(reason, Info_ValueForKey(line, "rsn"), sizeof(reason));
-    Q_strncpyz(guid, Info_ValueForKey(line, "guid"), sizeof(guid));
-    Q_strncpyz(playername, Info_ValueForKey(line, "nick"), sizeof(guid));
+    Com_Memset(&rule, 0, sizeof(rule));
 
-    if(expire < aclock && expire != (time_t)-1){
-            return qtrue;
-    }
-    this = banlist;
-    if(!this)
+    if(!SV_BanRuleParseValue(&rule, type, value))
         return qfalse;
 
-    if(playeruid){
-        for(i = 0; i < current_banindex; this++, i++){
-            if(this->playeruid == playeruid){
-                Com_Printf("Error: This player with UID: %i is already banned onto this server (line: %d)\n",playeruid, linenumber);
-                return qfalse;
-            }
-        }
-    }else if(guid[7]){
-        for(i = 0; i < current_banindex; this++, i++){
-            if(!Q_stricmp(this->pbguid, guid)){
-                Com_Printf("Error: This player with GUID: %s is already banned onto this server (line: %d)\n",guid, linenumber);
-                return qfalse;
-            }
+    if(reason && !SV_BanlistFieldValid(reason)){
+        Com_Printf("The reason must not contain \\, ; or \"\n");
+        return qfalse;
+    }
+    rule.expire = expire;
+    rule.adminuid = adminuid;
+    Q_strncpyz(rule.reason, reason ? reason : "", sizeof(rule.reason));
+
+    i = SV_BanRuleFind(&rule);
+    if(i == -1){
+        if(numBanRules >= MAX_BANRULES){
+            Com_Printf("Can not add more than %d ban rules\n", MAX_BANRULES);
+            return qfalse;
         }
-    }else{
-        Com_Printf("Error: This player has no uid/guid (line: %d)\n",linenumber);
-        return qfalse; //Bad entry: No Id
+        i = numBanRules++;
     }
+    banRules[i] = rule;
 
-    if(!SV_OversizeBanlistAlign())
+    SV_BanRulesCompile();
+    SV_WriteBanRules();
+    return qtrue;
+}
+
+qboolean SV_RemoveBanRule(const char* type, const char* value){
+
+    banRule_t rule;
+    int i;
+
+    Com_Memset(&rule, 0, sizeof(rule));
+
+    if(!SV_BanRuleParseValue(&rule, type, value))
         return qfalse;
 
-    this = &banlist[current_banindex];
+    i = SV_BanRuleFind(&rule);
+    if(i == -1)
+        return qfalse;
 
-    this->playeruid = playeruid;
-    this->adminuid = adminuid;
-    this->expire = expire;
-    Q_strncpyz(this->reason, reason, sizeof(this->reason));
-    Q_strncpyz(this->pbguid, guid, sizeof(this->pbguid));
-    Q_strncpyz(this->playername, playername, sizeof(this->playername));
-    current_banindex++; //Rise the array index
+    banRules[i] = banRules[--numBanRules];
+
+    SV_BanRulesCompile();
+    SV_WriteBanRules();
     return qtrue;
 }
 
-void SV_LoadBanlist(){
-    time_t aclock;
-    time(&aclock);
-    char buf[256];
-    buf[0] = 0;
-    fileHandle_t file;
-    int read;
-    int error;
-    int i;
+void SV_DumpBanRules(){
 
-    FS_SV_FOpenFileRead(banlistfile->string,&file);
-    if(!file){
-        Com_DPrintf("SV_ReadBanlist: Can not open %s for reading\n",banlistfile->string);
-        return;
-    }
+    banRule_t *rule;
+    char *timestr;
+    int i;
 
-    for(i = 0, error = 0 ;error < 32 ;i++){
+    for(i = 0, rule = banRules; i < numBanRules; i++, rule++){
 
-        read = FS_ReadLine(buf,sizeof(buf),file);
-        if(read == 0){
-            Com_Printf("%i lines parsed from %s, %i errors occured\n",i,banlistfile->string,error);
-            FS_FCloseFile(file);
-            return;
-        }
-        if(read == -1){
-            Com_Printf("Can not read from %s\n",banlistfile->string);
-            FS_FCloseFile(file);
-            return;
-        }
-        if(!*buf || *buf == '/' || *buf == '\n'){
-            continue;
+        if(rule->expire == (time_t)-1){
+            timestr = "Never";
+        }else{
+            timestr = ctime(&rule->expire);
+            timestr[strlen(timestr) -1] = 0;
         }
-        if(!SV_ParseBanlist(buf, aclock, i+1)) error++; //Executes the function given as argument in execute
+        Com_Printf("%i %s: %s; adminuid: %i; expire: %s; reason: %s\n", i, banRuleTypeNames[rule->type],
+            SV_BanRuleValueString(rule), rule->adminuid, timestr, rule->reason);
     }
-    Com_PrintWarning("More than 32 errors occured by reading from %s\n",banlistfile->string);
-    FS_FCloseFile(file);
+    Com_Printf("%i ban rules\n", numBanRules);
 }
 
+static char* SV_BanRuleMessage(banRule_t *rule){
 
-void SV_WriteBanlist(){
+    if(rule->expire != (time_t)-1 && rule->expire <= Com_GetRealtime())
+        return NULL;
 
-    banList_t *this;
-    time_t aclock;
-    time(&aclock);
-    fileHandle_t file;
-    char infostring[1024];
+    return va("\nYour %s is banned from this gameserver\nReason for this ban:\n%s\n",
+        rule->type == BANRULE_RANGE ? "network" : rule->type == BANRULE_COUNTRY ? "country" : "provider", rule->reason);
+}
+
+char* SV_PlayerBannedByRule(netadr_t *netadr){	//Gets called in SV_DirectConnect
+
+    geoInfo_t info;
+    unsigned int asn;
     int i;
 
-    file = FS_SV_FOpenFileWrite(va("%s.tmp", banlistfile->string));
-    if(!file){
-        Com_PrintError("SV_WriteBanlist: Can not open %s for writing\n",banlistfile->string);
-        return;
+    i = SV_IPBanTrieFind(&banRuleTrie, netadr);
+    if(i != -1)
+        return SV_BanRuleMessage(&banRules[i]);
+
+    if(banRuleNumAsns == 0 && !banRuleHaveCountries)
+        return NULL;
+
+    if(Sys_IsLANAddress(netadr) || !SV_GeoInfoForAddress(netadr, &info))
+        return NULL;
+
+    asn = Q_stricmpn(info.asn, "AS", 2) ? 0 : atoi(info.asn + 2);
+
+    if((info.countryIndex >= 256 || (banRuleCountries[info.countryIndex >> 5] & (1 << (info.countryIndex & 31))) == 0) &&
+        (asn == 0 || bsearch(&asn, banRuleAsns, banRuleNumAsns, sizeof(banRuleAsns[0]), SV_BanRuleCompareAsn) == NULL))
+        return NULL;
+
+    //A hit, the reason is worth a search
+    for(i = 0; i < numBanRules; i++){
+        if((banRules[i].type == BANRULE_COUNTRY && banRules[i].value == info.countryIndex) ||
+            (banRules[i].type == BANRULE_ASN && banRules[i].value == asn))
+            return SV_BanRuleMessage(&banRules[i]);
     }
+    return NULL;
+}
 
-    this = banlist;
-    if(!this)
+
+/*
+==================
+SV_BanlistFilterFrame
+
+Hands the IP bans which are in effect and the netrange rules to the packet filter of sys_net.c once they changed or one timed out
+==================
+*/
+void SV_BanlistFilterFrame(){
+
+    static netadr_t adrs[MAX_IPBANS];
+    time_t now;
+    int i, count;
+
+    now = Com_GetRealtime();
+
+    if(banRuleExpire != 0 && now >= banRuleExpire)
+        SV_BanRulesCompile();
+
+    if(!ipBanFilterModified && (ipBanFilterExpire == 0 || now < ipBanFilterExpire))
         return;
 
-    for(i = 0 ; i < current_banindex; this++, i++){
+    ipBanFilterModified = qfalse;
+    ipBanFilterExpire = 0;
 
-        if(this->expire == (time_t)-1 || this->expire > aclock){
+    for(i = 0, count = 0; i < MAX_IPBANS; i++){
 
-            *infostring = 0;
-            if(this->playeruid > 0){
-                Info_SetValueForKey(infostring, "uid", va("%i", this->playeruid));
-            }else if(this->pbguid[7]){
-                Info_SetValueForKey(infostring, "guid", this->pbguid);
-            }else{
-                continue;
-            }
-            Info_SetValueForKey(infostring, "nick", this->playername);
-            Info_SetValueForKey(infostring, "rsn", this->reason);
-            Info_SetValueForKey(infostring, "exp", va("%i", this->expire));
-            Info_SetValueForKey(infostring, "auid", va("%i", this->adminuid));
-            Q_strcat(infostring, sizeof(infostring), "\\\n");
-            FS_Write(infostring,strlen(infostring),file);
-        }
+        if(ipBans[i].timeout <= now)
+            continue;
+
+        if(ipBans[i].remote.type != NA_IP && ipBans[i].remote.type != NA_IP6)
+            continue;
+
+        adrs[count++] = ipBans[i].remote;
+
+        if(ipBanFilterExpire == 0 || ipBans[i].timeout < ipBanFilterExpire)
+            ipBanFilterExpire = ipBans[i].timeout;
     }
-    FS_FCloseFile(file);
-    FS_SV_HomeCopyFile(va("%s.tmp", banlistfile->string) ,banlistfile->string);
-//    FS_SV_Rename(va("%s.tmp", banlist->string),banlist->string);
+
+    NET_SetPacketFilterBans(adrs, count, banRuleFilterNets, banRuleFilterBits, banRuleNumFilterNets);
 }
 
 
@@ -240,32 +1406,31 @@ char* SV_PlayerBannedByip(netadr_t *netadr){	//Gets called in SV_DirectConnect
     ipBanList_t *this;
     int i;
 
-    for(this = &ipBans[0], i = 0; i < 1024; this++, i++){
+    i = SV_FindIPBan(netadr);
 
-        if(NET_CompareBaseAdr(netadr, &this->remote)){
-
-            if(Com_GetRealtime() < this->timeout)
-            {
+    if(i == -1)
+        return NULL;
 
-                if(this->expire == -1){
-                    return va("\nEnforcing prior ban\nPermanent ban issued onto this gameserver\nYou will be never allowed to join this gameserver again\n Your UID is: %i    Banning admin UID is: %i\nReason for this ban:\n%s\n",
-                    this->uid,this->adminuid,this->banmsg);
+    this = &ipBans[i];
 
-                }else{
+    if(Com_GetRealtime() < this->timeout)
+    {
 
-                    int remaining = (int)(this->expire - Com_GetRealtime()) +1; //in seconds (+1 for fixing up a display error when only some seconds are remaining)
-                    int d = remaining/(60*60*24);
-                    remaining = remaining%(60*60*24);
-                    int h = remaining/(60*60);
-                    remaining = remaining%(60*60);
-                    int m = remaining/60;
+        if(this->expire == -1){
+            return va("\nEnforcing prior ban\nPermanent ban issued onto this gameserver\nYou will be never allowed to join this gameserver again\n Your UID is: %i    Banning admin UID is: %i\nReason for this ban:\n%s\n",
+            this->uid,this->adminuid,this->banmsg);
 
-                    return va("\nEnforcing prior kick/ban\nTemporary ban issued onto this gameserver\nYou are not allowed to rejoin this gameserver for another\n %i days %i hours %i minutes\n Your UID is: %i    Banning admin UID is: %i\nReason for this ban:\n%s\n",
-                    d,h,m,this->uid,this->adminuid,this->banmsg);
-                }
+        }else{
 
+            int remaining = (int)(this->expire - Com_GetRealtime()) +1; //in seconds (+1 for fixing up a display error when only some seconds are remaining)
+            int d = remaining/(60*60*24);
+            remaining = remaining%(60*60*24);
+            int h = remaining/(60*60);
+            remaining = remaining%(60*60);
+            int m = remaining/60;
 
-            }
+            return va("\nEnforcing prior kick/ban\nTemporary ban issued onto this gameserver\nYou are not allowed to rejoin this gameserver for another\n %i days %i hours %i minutes\n Your UID is: %i    Banning admin UID is: %i\nReason for this ban:\n%s\n",
+            d,h,m,this->uid,this->adminuid,this->banmsg);
         }
     }
     return NULL;
@@ -280,7 +1445,7 @@ void SV_PlayerAddBanByip(netadr_t *remote, char *reason, int uid, char* guid, in
     ipBanList_t *list;
     int i;
     int oldest =	0;
-    unsigned int oldestTime = 0;
+    int oldestTime = 0x7fffffff;
     int duration;
 
     if(!remote)
@@ -290,20 +1455,28 @@ void SV_PlayerAddBanByip(netadr_t *remote, char *reason, int uid, char* guid, in
 
     }
 
-    for(list = &ipBans[0], i = 0; i < 1024; list++, i++){	//At first check whether we have already an entry for this player
-        if(NET_CompareBaseAdr(remote, &list->remote)){
-            break;
-        }
-	if (list->systime < oldestTime) {
-		oldestTime = list->systime;
-		oldest = i;
-	}
-    }
+    i = SV_FindIPBan(remote);	//At first check whether we have already an entry for this player
 
-    if(i == 1024){
-	 list = &ipBans[oldest];
+    if(i == -1){
+        //Take a free or expired slot, otherwise replace the oldest entry
+        for(list = &ipBans[0], i = 0; i < MAX_IPBANS; list++, i++){
+            if(list->timeout <= Com_GetRealtime()){
+                break;
+            }
+            if (list->systime < oldestTime) {
+                oldestTime = list->systime;
+                oldest = i;
+            }
+        }
+        if(i == MAX_IPBANS){
+            i = oldest;
+        }
+        SV_ClearIPBan(i);
+        list = &ipBans[i];
+        list->remote = *remote;
+    }else{
+        list = &ipBans[i];
     }
-    list->remote = *remote;
 
     Q_strncpyz(list->banmsg, reason, 128);
 
@@ -327,7 +1500,13 @@ void SV_PlayerAddBanByip(netadr_t *remote, char *reason, int uid, char* guid, in
 
     list->systime = Sys_Milliseconds();
 
-    list->timeout = Com_GetRealtime() + duration;
+    if(list->timeout == 0)
+    {
+        list->timeout = Com_GetRealtime() + duration;
+        SV_IPBanTrieInsert(i);
+    }else{
+        list->timeout = Com_GetRealtime() + duration;
+    }
 
 }
 
@@ -340,11 +1519,11 @@ void SV_RemoveBanByip(netadr_t *remote, int uid, char* guid)
     if(uid > 0)
     {
 
-        for(thisipban = ipBans, i = 0; i < 1024; thisipban++, i++)
+        for(thisipban = ipBans, i = 0; i < MAX_IPBANS; thisipban++, i++)
         {
             if(uid == thisipban->uid)
             {
-                Com_Memset(thisipban,0,sizeof(ipBanList_t));
+                SV_ClearIPBan(i);
                 return;
             }
         }
@@ -356,11 +1535,11 @@ void SV_RemoveBanByip(netadr_t *remote, int uid, char* guid)
     if(guid && strlen(guid) == 8)
     {
 
-        for(thisipban = ipBans, i = 0; i < 1024; thisipban++, i++)
+        for(thisipban = ipBans, i = 0; i < MAX_IPBANS; thisipban++, i++)
         {
             if(!Q_stricmp(guid, thisipban->guid))
             {
-                Com_Memset(thisipban,0,sizeof(ipBanList_t));
+                SV_ClearIPBan(i);
                 return;
             }
         }
@@ -369,13 +1548,11 @@ void SV_RemoveBanByip(netadr_t *remote, int uid, char* guid)
 
     if(remote != NULL)
     {
-        for(thisipban = ipBans, i = 0; i < 1024; thisipban++, i++)
+        i = SV_FindIPBan(remote);
+        if(i != -1)
         {
-            if(NET_CompareBaseAdr(remote, &thisipban->remote))
-            {
-                Com_Memset(thisipban,0,sizeof(ipBanList_t));
-                return;
-            }
+            SV_ClearIPBan(i);
+            return;
         }
 
     }
@@ -384,18 +1561,45 @@ void SV_RemoveBanByip(netadr_t *remote, int uid, char* guid)
 }
 
 
+//Applies a record another server on this host has written to its journal. It is not journaled again
+void SV_BanlistApplyShared(const char* line){
+
+    char buf[1024];
+    char guid[9];
+    time_t aclock;
+    time_t expire;
+    int journalRecords;
+
+    if(!banlist)
+        return;
+
+    time(&aclock);
+    Q_strncpyz(buf, line, sizeof(buf));
+
+    journalRecords = banlistJournalRecords;
+    SV_ParseBanlistJournal(buf, aclock, 0);
+    banlistJournalRecords = journalRecords;
+
+    expire = atoi(Info_ValueForKey(buf, "exp"));
+    if(expire != (time_t)-1 && expire <= aclock){
+        Q_strncpyz(guid, Info_ValueForKey(buf, "guid"), sizeof(guid));
+        SV_RemoveBanByip(NULL, atoi(Info_ValueForKey(buf, "uid")), guid);
+    }
+}
+
 char* SV_PlayerIsBanned(int uid, char* pbguid, netadr_t *addr){
 
   banList_t *this;
   int i;
 
-  this = banlist;
-  if(!this)
+  if(!banlist)
         return NULL;
 
 
   if(uid > 0){
-    for(i = 0 ; i < current_banindex; this++, i++){
+    for(i = banlistUidHash[SV_BanlistUidHash(uid)]; i; i = this->nextuid){
+
+        this = &banlist[i -1];
 
         if(this->playeruid == uid){
 
@@ -424,7 +1628,9 @@ char* SV_PlayerIsBanned(int uid, char* pbguid, netadr_t *addr){
   }else if(strlen(pbguid) == 32){
 
 
-    for(i = 0 ; i < current_banindex; this++, i++){
+    for(i = banlistGuidHash[SV_BanlistGuidHash(&pbguid[24])]; i; i = this->nextguid){
+
+        this = &banlist[i -1];
 
         if(!Q_strncmp(this->pbguid, &pbguid[24], 8)){
 
@@ -458,7 +1664,13 @@ char* SV_PlayerIsBanned(int uid, char* pbguid, netadr_t *addr){
 void SV_InitBanlist(){
 
     Com_Memset(ipBans,0,sizeof(ipBans));
+    SV_IPBanTrieRebuild();
+    SV_BanlistClearIndex();
     banlistfile = Cvar_RegisterString("banlistfile", "banlist.dat", CVAR_INIT, "Name of the file which holds the banlist");
+    banrulefile = Cvar_RegisterString("banrulefile", "banrules.dat", CVAR_INIT, "Name of the file which holds the netrange, country and asn ban rules");
+    numBanRules = 0;
+    SV_LoadBanlistFile(banrulefile->string, SV_ParseBanRule);
+    SV_BanRulesCompile();
     current_banlist_size = BANLIST_DEFAULT_SIZE;
     current_banindex = 0;
     banlist = realloc(NULL, current_banlist_size);//Test for NULL ?
@@ -479,6 +1691,7 @@ qboolean  SV_ReloadBanlist(){
 
     Com_Memset(this, 0, current_banlist_size);
     current_banindex = 0; //Reset the index!
+    SV_BanlistClearIndex();
 
     SV_LoadBanlist();
 
@@ -516,27 +1729,21 @@ qboolean SV_AddBan(int uid, int auid, char* guid, char* name, time_t expire, cha
         return qfalse;
     }
 
-    if(!SV_ReloadBanlist())
+    if(!SV_OversizeBanlistAlign())
         return qfalse;
 
-    for(i = 0 ; i < current_banindex; this++, i++){
-        switch(type)
-        {
-            case 0:
-                if(uid != this->playeruid)
-                    continue;
+    if(type == 0)
+        i = SV_BanlistFindUid(uid);
+    else
+        i = SV_BanlistFindGuid(guid);
 
-            break;
-            case 1:
-                if(Q_stricmp(guid, this->pbguid))
-                    continue;
-        }
-        break;
-    }
-    if(i == current_banindex){
+    if(i == -1){
+        i = current_banindex;
         current_banindex++; //Rise the array index
 
     }else{
+        SV_BanlistUnindexEntry(i);
+
         if(type == 0){
             Com_Printf( "Modifying banrecord for player uid: %i\n", uid);
             SV_PrintAdministrativeLog( "modified banrecord of player uid: %i:", uid);
@@ -546,6 +1753,7 @@ qboolean SV_AddBan(int uid, int auid, char* guid, char* name, time_t expire, cha
         }
     }
 
+    this = &banlist[i];
     this->playeruid = uid;
     this->adminuid = auid;
     this->expire = expire;
@@ -565,20 +1773,53 @@ qboolean SV_AddBan(int uid, int auid, char* guid, char* name, time_t expire, cha
     else
         *this->playername = 0;
 
-    SV_WriteBanlist();
+    SV_BanlistIndexEntry(i);
+
+    SV_BanlistJournalEntry(this);
     return qtrue;
 }
 
 
+static void SV_RemoveBanEntry(banList_t *this){
+
+    char* printguid;
+    char* banreason;
+    char* printnick;
+
+    this->expire = (time_t) 0;
+    SV_RemoveBanByip(NULL, this->playeruid, this->pbguid);
+
+    if(!*this->pbguid){
+        printguid = "N/A";
+    }else{
+        printguid = this->pbguid;
+    }
+
+    if(!*this->reason){
+        banreason = "N/A";
+    }else{
+        banreason = this->reason;
+    }
+
+    if(!*this->playername){
+        printnick = "N/A";
+    }else{
+        printnick = this->playername;
+    }
+
+    Com_Printf("Removing ban for Nick: %s, UID: %i, GUID: %s, Banreason: %s\n", printnick, this->playeruid, printguid, banreason);
+    SV_PrintAdministrativeLog("Removing ban for Nick: %s, UID: %i, GUID: %s, Banreason: %s\n", printnick, this->playeruid, printguid, banreason);
+
+    SV_BanlistJournalEntry(this);
+}
+
+
 qboolean SV_RemoveBan(int uid, char* guid, char* name){
 
     banList_t *this;
     int i;
     int type;
     qboolean succ = qfalse;
-    char* printguid;
-    char* banreason;
-    char* printnick;
 
     if(uid > 0){
         type = 0;
@@ -594,55 +1835,43 @@ qboolean SV_RemoveBan(int uid, char* guid, char* name){
     if(!this)
         return qfalse;
 
-    if(!SV_ReloadBanlist())
-        return qfalse;
-
-    for(i = 0 ; i < current_banindex; this++, i++)
+    switch(type)
     {
-        switch(type)
-        {
-                case 0:
-                    if(uid != this->playeruid)
-                        continue;
-
-                    break;
-                case 1:
-                    if(Q_stricmp(guid, this->pbguid))
-                        continue;
-
-                    break;
-                case 2:
-                    if(!Q_stricmp(name, this->playername))
-                        continue;
-        }
-        this->expire = (time_t) 0;
-        SV_RemoveBanByip(NULL, this->playeruid, this->pbguid);
-        succ = qtrue;
-
-        if(!*this->pbguid){
-            printguid = "N/A";
-        }else{
-            printguid = this->pbguid;
-        }
+        case 0:
+            for(i = banlistUidHash[SV_BanlistUidHash(uid)]; i; i = this->nextuid)
+            {
+                this = &banlist[i -1];
+                if(uid != this->playeruid)
+                    continue;
 
-        if(!*this->reason){
-            banreason = "N/A";
-        }else{
-            banreason = this->reason;
-        }
+                SV_RemoveBanEntry(this);
+                succ = qtrue;
+            }
+            break;
 
-        if(!*this->playername){
-            printnick = "N/A";
-        }else{
-            printnick = this->playername;
-        }
+        case 1:
+            for(i = banlistGuidHash[SV_BanlistGuidHash(guid)]; i; i = this->nextguid)
+            {
+                this = &banlist[i -1];
+                if(Q_stricmp(guid, this->pbguid))
+                    continue;
 
-        Com_Printf("Removing ban for Nick: %s, UID: %i, GUID: %s, Banreason: %s\n", printnick, this->playeruid, printguid, banreason);
-        SV_PrintAdministrativeLog("Removing ban for Nick: %s, UID: %i, GUID: %s, Banreason: %s\n", printnick, this->playeruid, printguid, banreason);
-    }
-    if(succ)
-        SV_WriteBanlist();
+                SV_RemoveBanEntry(this);
+                succ = qtrue;
+            }
+            break;
+
+        case 2:
+            for(i = 0 ; i < current_banindex; this++, i++)
+            {
+                if(!Q_stricmp(name, this->playername))
+                    continue;
 
+                SV_RemoveBanEntry(this);
+                succ = qtrue;
+            }
+            break;
+    }
     return succ;
 }
 
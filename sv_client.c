@@ -39,21 +39,241 @@
 #include "cmd.h"
 #include "sys_thread.h"
 #include "hl2rcon.h"
+#include "sha256.h"
+#include "qcommon_metrics.h"
 
 #include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <string.h>
 
 //AntiDoS
 /*
-int SV_ChallengeCookies(netadr_t from){
-    char string[128];
-    int var_01 = svs.time & 0xff000000;
-    Com_sprintf(string, sizeof(string), "");
-    return var_01;
+=================
+SV_ChallengeCookies
+
+The challenge for an address is a HMAC-SHA256 of the address and a time window
+under a secret which gets created at startup. SV_DirectConnect() can so throw
+away forged or outdated challenges without looking at any state
+=================
+*/
+#define CHALLENGE_COOKIE_WINDOWBITS 16		//About one minute, a cookie is valid for up to two windows
+#define CHALLENGE_HMAC_BLOCKSIZE 64
+
+static byte sv_challengeSecret[32];
+static qboolean sv_challengeSecretInitialized;
+
+static int SV_ChallengeCookies(netadr_t *from, int window){
+
+	sha256_context ctx;
+	byte pad[CHALLENGE_HMAC_BLOCKSIZE];
+	byte digest[32];
+	int i, cookie;
+
+	if(!sv_challengeSecretInitialized)
+	{
+		Com_RandomBytes(sv_challengeSecret, sizeof(sv_challengeSecret));
+		sv_challengeSecretInitialized = qtrue;
+	}
+
+	//Inner hash
+	Com_Memset(pad, 0x36, sizeof(pad));
+	for(i = 0; i < sizeof(sv_challengeSecret); i++)
+		pad[i] ^= sv_challengeSecret[i];
+
+	sha256_starts(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, (byte*)&from->type, sizeof(from->type));
+
+	if(from->type == NA_IP6)
+		sha256_update(&ctx, from->ip6, sizeof(from->ip6));
+	else
+		sha256_update(&ctx, from->ip, sizeof(from->ip));
+
+	sha256_update(&ctx, (byte*)&from->port, sizeof(from->port));
+	sha256_update(&ctx, (byte*)&window, sizeof(window));
+	sha256_finish(&ctx, digest);
+
+	//Outer hash
+	Com_Memset(pad, 0x5c, sizeof(pad));
+	for(i = 0; i < sizeof(sv_challengeSecret); i++)
+		pad[i] ^= sv_challengeSecret[i];
+
+	sha256_starts(&ctx);
+	sha256_update(&ctx, pad, sizeof(pad));
+	sha256_update(&ctx, digest, sizeof(digest));
+	sha256_finish(&ctx, digest);
+
+	Com_Memcpy(&cookie, digest, sizeof(cookie));
+	cookie &= 0x7fffffff;
+
+	if(cookie == 0)	//0 means no challenge
+		cookie = 1;
+
+	return cookie;
+}
+
+static int SV_CurrentChallengeCookie(netadr_t *from){
+
+	return SV_ChallengeCookies(from, Sys_Milliseconds() >> CHALLENGE_COOKIE_WINDOWBITS);
+}
+
+static qboolean SV_VerifyChallengeCookie(netadr_t *from, int challenge){
+
+	if(from->sock == NET_REPLAY_SOCK)	//Got it from the server the capture was taken of
+		return qtrue;
+
+	int window = Sys_Milliseconds() >> CHALLENGE_COOKIE_WINDOWBITS;
 
+	return challenge == SV_ChallengeCookies(from, window) || challenge == SV_ChallengeCookies(from, window -1);
 }
+
+/*
+=================
+Challenge table index
+
+Chains the challenge slots by address so no packet has to scan the whole table.
+The links live outside of challenge_t because the slots get cleared with Com_Memset
+all over the place. A cleared slot just stays in its chain and never matches.
+New slots are taken round robin, slots of clients which came back to us get
+skipped for a few probes so a spoofed getchallenge flood can not push them out
+=================
 */
+#define CHALLENGE_HASH_SIZE 1024
+#define CHALLENGE_ALLOC_PROBES 16
+
+static short sv_challengeHash[CHALLENGE_HASH_SIZE];	//Slot +1, 0 ends the chain
+static short sv_challengeNext[MAX_CHALLENGES];
+static short sv_challengeBucket[MAX_CHALLENGES];	//Bucket +1 this slot is linked into
+static qboolean sv_challengeConfirmed[MAX_CHALLENGES];	//Address has proven to be real
+static int sv_challengeAllocPos;
+
+static unsigned int SV_ChallengeHashForAddress(netadr_t *from){
+
+	unsigned int hash = 2166136261u;
+	int i, len;
+	const byte *b;
+
+	if(from->type == NA_IP6)
+	{
+		b = from->ip6;
+		len = sizeof(from->ip6);
+	}else{
+		b = from->ip;
+		len = sizeof(from->ip);
+	}
+
+	for(i = 0; i < len; i++)
+	{
+		hash ^= b[i];
+		hash *= 16777619u;
+	}
+	hash ^= from->port;
+	hash *= 16777619u;
+
+	return hash % CHALLENGE_HASH_SIZE;
+}
+
+static int SV_FindChallenge(netadr_t *from){
+
+	int c;
+
+	for(c = sv_challengeHash[SV_ChallengeHashForAddress(from)] -1; c >= 0; c = sv_challengeNext[c] -1)
+	{
+		if(NET_CompareAdr(from, &svse.challenges[c].adr))
+			return c;
+	}
+	return -1;
+}
+
+static void SV_UnlinkChallenge(int c){
+
+	short *link;
+
+	if(sv_challengeBucket[c] == 0)
+		return;
+
+	for(link = &sv_challengeHash[sv_challengeBucket[c] -1]; *link; link = &sv_challengeNext[*link -1])
+	{
+		if(*link -1 == c)
+		{
+			*link = sv_challengeNext[c];
+			break;
+		}
+	}
+	sv_challengeNext[c] = 0;
+	sv_challengeBucket[c] = 0;
+}
+
+//Returns a slot for a new address and links it in. The caller fills in everything else
+static challenge_t* SV_AllocChallenge(netadr_t *from){
+
+	int i, c;
+	unsigned int hash;
+
+	for(i = 0; i < CHALLENGE_ALLOC_PROBES; i++)
+	{
+		c = sv_challengeAllocPos;
+		sv_challengeAllocPos = (sv_challengeAllocPos +1) % MAX_CHALLENGES;
+
+		if(!sv_challengeConfirmed[c] || svse.challenges[c].connected || svse.challenges[c].adr.type == NA_BOT)
+			break;
+	}
+
+	SV_UnlinkChallenge(c);
+	Com_Memset(&svse.challenges[c], 0, sizeof(challenge_t));
+	svse.challenges[c].adr = *from;
+	sv_challengeConfirmed[c] = qfalse;
+
+	hash = SV_ChallengeHashForAddress(from);
+	sv_challengeNext[c] = sv_challengeHash[hash];
+	sv_challengeHash[hash] = c +1;
+	sv_challengeBucket[c] = hash +1;
+
+	return &svse.challenges[c];
+}
+
+static qboolean SV_ChallengeIsQueued(int c){
+
+	int i;
+
+	for(i = 0; i < 10; i++)
+	{
+		if(svse.connectqueue[i].firsttime && svse.connectqueue[i].challengeslot == c)
+			return qtrue;
+	}
+	return qfalse;
+}
+
+/*
+=================
+SV_AdmitConnect
+
+Limits how many connect requests per server frame get through the expensive part of
+SV_DirectConnect(). The others are told to wait and the client sends its connect again
+=================
+*/
+static qboolean SV_AdmitConnect( void ){
+
+	static int frameTime;
+	static int admitted;
+
+	if(sv_maxConnectsPerFrame->integer < 1)
+		return qtrue;
+
+	if(frameTime != svs.time)
+	{
+		frameTime = svs.time;
+		admitted = 0;
+	}
+
+	if(admitted >= sv_maxConnectsPerFrame->integer)
+		return qfalse;
+
+	admitted++;
+	return qtrue;
+}
+
 /*
 =================
 SV_GetChallenge
@@ -82,67 +302,61 @@ v4-only auth server for these new types of connections.
 __optimize3 __regparm1 void SV_GetChallenge(netadr_t *from)
 {
 	int		i;
-	int		oldest;
-	int		oldestTime;
-	int		oldestClientTime;
 	int		clientChallenge;
+	int		res;
 	challenge_t	*challenge;
 
-	oldest = 0;
-	oldestClientTime = oldestTime = 0x7fffffff;
-
 	// see if we already have a challenge for this ip
-	challenge = &svse.challenges[0];
 	clientChallenge = atoi(SV_Cmd_Argv(1));
+	i = SV_FindChallenge(from);
 
-	for(i = 0 ; i < MAX_CHALLENGES ; i++, challenge++)
+	if(i >= 0 && svse.challenges[i].connected)
 	{
-		if(NET_CompareAdr(from, &challenge->adr))
-		{
-			if(challenge->connected){
-				Com_Memset(challenge, 0 ,sizeof(challenge_t));
-				continue;
-			}
-
-			if(challenge->time < oldestClientTime)
-				oldestClientTime = challenge->time;
-			break;
-		}
-
-		if(challenge->time < oldestTime)
-		{
-			oldestTime = challenge->time;
-			oldest = i;
-		}
+		Com_Memset(&svse.challenges[i], 0, sizeof(challenge_t));
+		i = -1;
 	}
 
-	if (i == MAX_CHALLENGES)
+	if (i < 0)
 	{
 		// this is the first time this client has asked for a challenge
-		challenge = &svse.challenges[oldest];
+		challenge = SV_AllocChallenge(from);
 		challenge->clientChallenge = clientChallenge;
-		challenge->adr = *from;
 		challenge->firstTime = svs.time;
 		challenge->connected = qfalse;
 		challenge->pbguid[31] = 0;
 		Q_strncpyz(challenge->pbguid, SV_Cmd_Argv(2),33);
 		challenge->ipAuthorize = 0;
-		challenge->challenge = ( (rand() << 16) ^ rand() ) ^ svs.time;
+		challenge->challenge = SV_CurrentChallengeCookie(from);
+	}else{
+		challenge = &svse.challenges[i];
+		if(!SV_VerifyChallengeCookie(from, challenge->challenge)){
+			//Stayed longer than the cookie window
+			challenge->challenge = SV_CurrentChallengeCookie(from);
+		}
 	}
 
 	challenge->time = svs.time;
 
+	if(from->sock != NET_REPLAY_SOCK)
+		SV_GeoInfoRequest(from);
+
 
 	// Drop the authorize stuff if this client is coming in via IPv6 as the auth server does not support ipv6.
 	// Drop also for addresses coming in on local LAN and for stand-alone games independent from id's assets.
-	if(challenge->adr.type == NA_IP && svse.authorizeAddress.type != NA_DOWN && !Sys_IsLANAddress(from) && sv_authorizemode->integer != -1)
+	if(challenge->adr.type == NA_IP && svse.authorizeAddress.type != NA_DOWN && !Sys_IsLANAddress(from) && sv_authorizemode->integer != -1 && from->sock != NET_REPLAY_SOCK)
 	{
 
 		// look up the authorize server's IP
 		if(svse.authorizeAddress.type == NA_BAD)
 		{
-			Com_Printf( "Resolving %s\n", AUTHORIZE_SERVER_NAME );
-			if (NET_StringToAdr(AUTHORIZE_SERVER_NAME, &svse.authorizeAddress, NA_IP))
+			res = NET_StringToAdrNonBlocking(AUTHORIZE_SERVER_NAME, &svse.authorizeAddress, NA_IP);
+			if(res == -1)
+			{
+				// still resolving on a worker thread, the client will ask again
+				svse.authorizeAddress.type = NA_BAD;
+				return;
+			}
+			if (res)
 			{
 				svse.authorizeAddress.port = BigShort( PORT_AUTHORIZE );
 				Com_Printf( "%s resolved to %s\n", AUTHORIZE_SERVER_NAME, NET_AdrToString(&svse.authorizeAddress));
@@ -181,7 +395,7 @@ __optimize3 __regparm1 void SV_GetChallenge(netadr_t *from)
 			}
 
 			// otherwise send their ip to the authorize server
-			Com_DPrintf( "sending getIpAuthorize for %s\n", NET_AdrToString( from ));
+			Com_DPrintfChannel(DPRINT_NET, 1, "sending getIpAuthorize for %s\n", NET_AdrToString( from ));
 
 			// the 0 is for backwards compatibility with obsolete sv_allowanonymous flags
 			// getIpAuthorize <challenge> <IP> <game> 0 <auth-flag>
@@ -243,6 +457,10 @@ __optimize3 __regparm1 void SV_AuthorizeIpPacket( netadr_t *from ) {
 		Com_Printf( "SV_AuthorizeIpPacket: challenge not found\n" );
 		return;
 	}
+	if ( !SV_VerifyChallengeCookie( &svse.challenges[i].adr, challenge ) ) {
+		Com_Printf( "SV_AuthorizeIpPacket: challenge expired\n" );
+		return;
+	}
 	if(svse.challenges[i].connected){
 	    return;
 	}
@@ -360,18 +578,33 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	qport = atoi( Info_ValueForKey( userinfo, "qport" ) );
 	// see if the challenge is valid
 	int		ping;
-	for (c=0 ; c < MAX_CHALLENGES ; c++) {
-		if (NET_CompareAdr(from, &svse.challenges[c].adr)) {
-			if ( challenge == svse.challenges[c].challenge ) {
-				break;		// good
-			}
-		}
+
+	//Forged challenges get rejected by the cookie. Clients waiting in the queue keep
+	//sending the challenge they got first, it can be older than a cookie is valid
+	if ( challenge != 0 && SV_VerifyChallengeCookie(from, challenge) ) {
+		c = SV_FindChallenge(from);
+	} else if ( challenge != 0 && (c = SV_FindChallenge(from)) >= 0 && SV_ChallengeIsQueued(c) ) {
+		//Still waiting for a free slot
+	} else {
+		c = -1;
 	}
 
-	if (c == MAX_CHALLENGES || challenge == 0) {
+	if (c >= 0 && from->sock == NET_REPLAY_SOCK) {
+		svse.challenges[c].challenge = challenge;
+	}
+	if (c < 0 || challenge != svse.challenges[c].challenge) {
 		NET_OutOfBandPrint( NS_SERVER, from, "error\nNo or bad challenge for address.\n" );
 		return;
 	}
+	//The client got our challenge so its address is real
+	sv_challengeConfirmed[c] = qtrue;
+
+	if(!SV_AdmitConnect()){
+		//The time we let them wait is not their ping
+		svse.challenges[c].pingTime = 0;
+		NET_OutOfBandPrint( NS_SERVER, from, "print\nServer is busy. Waiting for a connection slot...\n" );
+		return;
+	}
 
 	newcl = NULL;
 
@@ -436,6 +669,10 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	Q_strncpyz(nick, Info_ValueForKey( userinfo, "name" ),33);
 
 	denied = SV_PlayerBannedByip(from);
+	if(!denied)
+		denied = SV_PlayerBannedByRule(from);
+	if(!denied)
+		denied = SV_GeoInfoDenied(from);
 	if(denied){
             NET_OutOfBandPrint( NS_SERVER, from, "error\n%s\n", denied);
 	    Com_Memset( &svse.challenges[c], 0, sizeof( svse.challenges[c] ));
@@ -555,6 +792,8 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	}
 	//gotnewcl:
 	Com_Memset(newcl, 0x00, sizeof(client_t));
+	SV_ResetClientPing(newcl);
+	SV_ResetClientMasks(newcl);
 
 	newcl->authentication = svse.challenges[c].ipAuthorize;
 	newcl->power = 0; //Sets the default power for the client
@@ -654,9 +893,11 @@ __optimize3 __regparm1 void SV_DirectConnect( netadr_t *from ) {
 	}*/
 
 	newcl->state = CS_CONNECTED;
+	SV_InvalidateQueryCache();
 	newcl->nextSnapshotTime = svs.time;
 	newcl->lastPacketTime = svs.time;
 	newcl->lastConnectTime = svs.time;
+	SV_SyncClientHot(newcl);
 
 	SV_UserinfoChanged(newcl);
 
@@ -735,15 +976,36 @@ __optimize3 __regparm2 void SV_ReceiveStats(netadr_t *from, msg_t* msg){
 		var_02 = cl->receivedstats;
 		var_02 = ~var_02;
 		var_02 = var_02 & 127;
-		cl->lastPacketTime = svs.time;
+		SV_ClientPacketTime(cl);
 
 		NET_OutOfBandPrint( NS_SERVER, from, "statResponse %i", var_02 );
 		return;
 	}
-	Com_DPrintf("SV_ReceiveStats: Received statspacket from disconnected remote client: %s qport: %d\n", NET_AdrToString(from), qport);
+	Com_DPrintfChannel(DPRINT_NET, 1, "SV_ReceiveStats: Received statspacket from disconnected remote client: %s qport: %d\n", NET_AdrToString(from), qport);
 }
 
 
+/*
+=================
+SV_UserinfoValueForKey
+
+Info_ValueForKey() for cl->userinfo from a parsed copy. It gets rebuilt on the
+first lookup after the userinfo changed. The binary writes the userinfo too so
+the copy is compared against the string it was made from
+=================
+*/
+static infoDict_t sv_userinfoDicts[MAX_CLIENTS];
+
+const char* SV_UserinfoValueForKey( client_t *cl, const char *key ) {
+
+	infoDict_t *dict = &sv_userinfoDicts[cl - svs.clients];
+
+	if(strcmp(dict->source, cl->userinfo))
+		Info_BuildDict(dict, cl->userinfo);
+
+	return Info_DictValueForKey(dict, key);
+}
+
 /*
 =================
 SV_UserinfoChanged
@@ -753,13 +1015,16 @@ into a more C friendly form.
 =================
 */
 void SV_UserinfoChanged( client_t *cl ) {
-	char	*val;
+	const char *val;
 	char	ip[128];
 	int	i;
 	int	len;
+	int	maxSnaps;
+	int	frames;
 
 	// name for C code
-	Q_strncpyz( cl->name, Info_ValueForKey (cl->userinfo, "name"), sizeof(cl->name) );
+	Q_strncpyz( cl->name, SV_UserinfoValueForKey(cl, "name"), sizeof(cl->name) );
+	SV_InvalidateQueryCache();
 
 	if(!Q_isprintstring(cl->name) || strstr(cl->name,"ID_") || Q_PrintStrlen(cl->name) < 3){
 		if(cl->state == CS_ACTIVE){
@@ -778,13 +1043,14 @@ void SV_UserinfoChanged( client_t *cl ) {
 	    cl->usernamechanged = UN_VERIFYNAME;
 	}
 	Q_strncpyz(cl->shortname, cl->name, sizeof(cl->shortname));
+	SV_InvalidatePlayerIndex(cl);
 	// rate command
 	// if the client is on the same subnet as the server and we aren't running an
 	// internet public server, assume they don't need a rate choke
 	if ( Sys_IsLANAddress( &cl->netchan.remoteAddress )) {
 		cl->rate = 1048576;	// lans should not rate limit
 	} else {
-		val = Info_ValueForKey (cl->userinfo, "rate");
+		val = SV_UserinfoValueForKey(cl, "rate");
 		if (strlen(val)) {
 			i = atoi(val);
 			cl->rate = i;
@@ -798,7 +1064,11 @@ void SV_UserinfoChanged( client_t *cl ) {
 		}
 	}
 	// snaps command
-	val = Info_ValueForKey (cl->userinfo, "snaps");
+	val = SV_UserinfoValueForKey(cl, "snaps");
+
+	maxSnaps = sv_fps->integer;
+	if(sv_snapshotFps->integer > 0 && sv_snapshotFps->integer < maxSnaps)
+		maxSnaps = sv_snapshotFps->integer;
 
 	if(strlen(val))
 	{
@@ -806,17 +1076,25 @@ void SV_UserinfoChanged( client_t *cl ) {
 
 		if(i < 10)
 			i = 10;
-		else if(i > sv_fps->integer)
-			i = sv_fps->integer;
+		else if(i > maxSnaps)
+			i = maxSnaps;
 		else if(i == 30)
-			i = sv_fps->integer;
-
-		cl->snapshotMsec = 1000 / i;
+			i = maxSnaps;
 	}
 	else
-		cl->snapshotMsec = 50;
+		i = 20;
+
+	if(i > maxSnaps)
+		i = maxSnaps;
+
+	// send every n-th server frame so snapshots don't drift against the simulation when sv_fps is no multiple of snaps
+	frames = (sv_fps->integer + i / 2) / i;
+	if(frames < 1)
+		frames = 1;
 
-	val = Info_ValueForKey(cl->userinfo, "cl_voice");
+	cl->snapshotMsec = frames * 1000 / sv_fps->integer;
+
+	val = SV_UserinfoValueForKey(cl, "cl_voice");
 	cl->hasVoip = atoi(val);
 
 	// TTimo
@@ -827,7 +1105,7 @@ void SV_UserinfoChanged( client_t *cl ) {
 	else
 		Com_sprintf(ip, sizeof(ip), "%s", NET_AdrToConnectionString( &cl->netchan.remoteAddress ));
 
-	val = Info_ValueForKey( cl->userinfo, "ip" );
+	val = SV_UserinfoValueForKey(cl, "ip" );
 
 	if( val[0] )
 		len = strlen( ip ) - strlen( val ) + strlen( cl->userinfo );
@@ -840,7 +1118,7 @@ void SV_UserinfoChanged( client_t *cl ) {
 		Info_SetValueForKey( cl->userinfo, "ip", ip );
 
 	cl->wwwDownload = qfalse;
-	if(Info_ValueForKey(cl->userinfo, "cl_wwwDownload"))
+	if(atoi(SV_UserinfoValueForKey(cl, "cl_wwwDownload")))
 		cl->wwwDownload = qtrue;
 }
 
@@ -859,6 +1137,25 @@ static void SV_UpdateUserinfo_f( client_t *cl ) {
 }*/
 
 
+/*
+Clients which download a plain file read their blocks straight out of a shared
+mapping of it instead of copying every block into own buffers.
+client_t belongs to the original binary, so the views are kept apart from it.
+*/
+static const byte *sv_downloadViews[MAX_CLIENTS];
+static unsigned long long sv_downloadBytesSent;	//Including resent blocks
+
+static void SV_ReleaseDownloadView( client_t *cl ) {
+
+	int clnum = cl - svs.clients;
+
+	if(sv_downloadViews[clnum]){
+		FS_ReleaseFileView(sv_downloadViews[clnum]);
+		sv_downloadViews[clnum] = NULL;
+	}
+}
+
+
 /*
 =====================
 SV_DropClient
@@ -881,10 +1178,13 @@ __cdecl void SV_DropClient( client_t *drop, const char *reason ) {
 		return;     // already dropped
 	}
 
+	SV_InvalidateQueryCache();
+
 	if(drop->demorecording)
 	{
 		SV_StopRecord(drop);
 	}
+	SV_ReplayFree(drop);
 	Q_strncpyz(clientName, drop->name, sizeof(clientName));
 
 	clientnum = drop - svs.clients;
@@ -897,8 +1197,11 @@ __cdecl void SV_DropClient( client_t *drop, const char *reason ) {
 		SV_EnterLeaveLog("^4Client %s %s ^4left this server from slot %d with guid %s", drop->name, NET_AdrToString(&drop->netchan.remoteAddress), clientnum, drop->pbguid);
 
 	SV_FreeClient(drop);
+	SV_ReleaseDownloadView(drop);
 
 	G_DestroyAdsForPlayer(drop);
+	//The game frees the hudelems of this player on its own
+	G_HudInvalidateSlots();
 
 
 	if ( !drop->gentity ) {
@@ -920,7 +1223,7 @@ __cdecl void SV_DropClient( client_t *drop, const char *reason ) {
 	if(!Q_stricmp(reason, "silent")){
 		//Just disconnect him and don't tell anyone about it
 		Com_Printf("Player %s^7, %i dropped: %s\n", clientName, clientnum, reason);
-		drop->state = CS_ZOMBIE;        // become free in a few seconds
+		SV_SetClientState(drop, CS_ZOMBIE);        // become free in a few seconds
 
 		HL2Rcon_EventClientLeave(clientnum);
 		PHandler_Event(PLUGINS_ONPLAYERDC,(void*)drop);	// Plugin event
@@ -961,10 +1264,11 @@ __cdecl void SV_DropClient( client_t *drop, const char *reason ) {
 	if(drop->netchan.remoteAddress.type == NA_BOT){
 		drop->state = CS_FREE;  // become free now
 		drop->netchan.remoteAddress.type = 0; //Reset the botflag
+		SV_SyncClientHot(drop);
 		Com_DPrintf( "Going to CS_FREE for Bot %s\n", clientName );
 	}else{
 
-		drop->state = CS_ZOMBIE;        // become free in a few seconds
+		SV_SetClientState(drop, CS_ZOMBIE);        // become free in a few seconds
 		Com_DPrintf( "Going to CS_ZOMBIE for %s\n", clientName );
 	}
 
@@ -1005,7 +1309,6 @@ each of the backup packets.
 */
 __optimize3 __regparm3 void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 	int i, key, clientNum;
-	unsigned int *ackTime;
 	unsigned int sysTime;
 	int cmdCount;
 	usercmd_t nullcmd;
@@ -1038,10 +1341,8 @@ __optimize3 __regparm3 void SV_UserMove( client_t *cl, msg_t *msg, qboolean delt
 	}
 
 	// save time for ping calculation
-	ackTime = &cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked;
 	sysTime = Sys_Milliseconds();
-	if(*ackTime == 0xFFFFFFFF)
-		*ackTime = sysTime;
+	SV_ClientFrameAcked(cl, sysTime);
 
 
 	clientNum = cl - svs.clients;
@@ -1153,7 +1454,7 @@ void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd ) {
 		return;
 */
 	Com_DPrintf( "Going from CS_PRIMED to CS_ACTIVE for %s\n", client->name );
-	client->state = CS_ACTIVE;
+	SV_SetClientState(client, CS_ACTIVE);
 
 	// set up the entity for the client
 	clientNum = client - svs.clients;
@@ -1212,42 +1513,129 @@ void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd ) {
 }
 
 
-sharedEntity_t* SV_AddBotClient(){
+/*
+============
+Bot names and spawning
 
-    int i, cntnames, read;
+botnames.txt gets read once at startup. Bots queued with SV_QueueBotClients
+connect sv_botSpawnsPerFrame at a time from SV_BotSpawnFrame, so adding a lot
+of them does not stall a single frame.
+============
+*/
+
+#define MAX_BOTNAMES 128
+
+static char sv_botNames[MAX_BOTNAMES][16];
+static int sv_botNameCount;
+static int sv_botSpawnsPending;
+static int sv_loadBotSpawnsPending;
+static cvar_t* sv_botSpawnsPerFrame;
+
+static void SV_LoadBotNames(){
+
+    int read;
+    char* nl;
+    fileLineReader_t reader;
+
+	sv_botNameCount = 0;
+
+	if(!FS_SV_OpenLineReader("botnames.txt", &reader))
+		return;
+
+	for(sv_botNameCount = 0; sv_botNameCount < MAX_BOTNAMES; sv_botNameCount++){
+		read = FS_ReaderReadLine(&reader, sv_botNames[sv_botNameCount], sizeof(sv_botNames[0]));
+		if(read <= 0)
+			break;
+		if(strlen(sv_botNames[sv_botNameCount]) < 2)
+			break;
+		nl = strchr(sv_botNames[sv_botNameCount], '\n');
+		if(nl)
+			*nl = 0;
+	}
+	FS_CloseLineReader(&reader);
+}
+
+void SV_BotInit(){
+
+	sv_botSpawnsPerFrame = Cvar_RegisterInt("sv_botSpawnsPerFrame", 2, 1, 64, 0, "How many queued bots connect per server frame");
+	SV_LoadBotNames();
+}
+
+static sharedEntity_t* SV_ConnectBot(qboolean loadbot);
+
+//Bots beyond the free slots get dropped from the queue once no slot is left
+void SV_QueueBotClients(int count, qboolean loadbot){
+
+	int *pending;
+
+	if(count <= 0)
+		return;
+
+	pending = loadbot ? &sv_loadBotSpawnsPending : &sv_botSpawnsPending;
+
+	*pending += count;
+	if(*pending > MAX_CLIENTS)
+		*pending = MAX_CLIENTS;
+}
+
+void SV_CancelBotSpawns(){
+
+	sv_botSpawnsPending = 0;
+	sv_loadBotSpawnsPending = 0;
+}
+
+void SV_BotSpawnFrame(){
+
+	int i;
+	int *pending;
+	qboolean loadbot;
+
+	for(i = 0; i < sv_botSpawnsPerFrame->integer; i++){
+
+		loadbot = sv_botSpawnsPending == 0;
+		pending = loadbot ? &sv_loadBotSpawnsPending : &sv_botSpawnsPending;
+		if(*pending == 0)
+			break;
+
+		(*pending)--;
+		if(SV_ConnectBot(loadbot) == NULL){
+			if(sv_botSpawnsPending + sv_loadBotSpawnsPending > 0)
+				Com_Printf("Dropping %d queued bots\n", sv_botSpawnsPending + sv_loadBotSpawnsPending);
+			SV_CancelBotSpawns();
+		}
+	}
+}
+
+
+/*
+============
+SV_ConnectBot
+
+Load bots are bots which look like players on the internet to the rest of
+the server. Their address is in 198.18.0.0/15 on NET_LOADBOT_SOCK, so they
+get snapshots with delta compression, the uplink scheduler, netchan and ping
+like everyone else, NET_SendPacket drops the datagrams. SV_LoadBotFrame acts
+as their client.
+============
+*/
+static sharedEntity_t* SV_ConnectBot(qboolean loadbot){
+
+    int i;
     short qport;
     client_t *cl = NULL;
     const char* denied;
     char name[16];
-    char botnames[128][16];
     char userinfo[MAX_INFO_STRING];
     netadr_t botnet;
     usercmd_t ucmd;
-    fileHandle_t file;
 
         //Getting a new name for our bot
-	FS_SV_FOpenFileRead("botnames.txt", &file);
-
-	if(!file){
-		cntnames = 0;
-	}else{
-		for(cntnames = 0; cntnames < 128; cntnames++){
-			read = FS_ReadLine(botnames[cntnames], 16, file);
-			if(read <= 0)
-				break;
-			if(strlen(botnames[cntnames]) < 2)
-				break;
-		}
-		FS_FCloseFile(file);
-	}
-	if(!cntnames){
+	if(loadbot){
+		Q_strncpyz(name,va("loadbot%d", rand() % 9999),sizeof(name));
+	}else if(!sv_botNameCount){
 		Q_strncpyz(name,va("bot%d", rand() % 9999),sizeof(name));
 	}else{
-		Q_strncpyz(name,botnames[rand() % cntnames],sizeof(name));
-		for(i = 0; i < sizeof(name); i++){
-			if(name[i] == '\n')
-				name[i] = 0;
-		}
+		Q_strncpyz(name,sv_botNames[rand() % sv_botNameCount],sizeof(name));
 	}
 
 //Find a free serverslot for our bot
@@ -1278,11 +1666,23 @@ sharedEntity_t* SV_AddBotClient(){
 	Info_SetValueForKey( userinfo, "qport", va("%i", qport));
 
 	Com_Memset(&botnet,0,sizeof(botnet));
-	botnet.type = NA_BOT;
+	if(loadbot){
+		botnet.type = NA_IP;
+		botnet.sock = NET_LOADBOT_SOCK;
+		botnet.ip[0] = 198;
+		botnet.ip[1] = 18;
+		botnet.ip[2] = i >> 8;
+		botnet.ip[3] = i & 0xff;
+		botnet.port = BigShort(28960);
+	}else{
+		botnet.type = NA_BOT;
+	}
 	Info_SetValueForKey( userinfo, "ip", NET_AdrToString( &botnet ) );
 
 	//gotnewcl:
 	Com_Memset(cl, 0x00, sizeof(client_t));
+	SV_ResetClientPing(cl);
+	SV_ResetClientMasks(cl);
 
 	cl->authentication = 1;
 	cl->power = 0; //Sets the default power for the client
@@ -1322,9 +1722,11 @@ sharedEntity_t* SV_AddBotClient(){
 	}
 */
 	cl->state = CS_CONNECTED;
+	SV_InvalidateQueryCache();
 	cl->nextSnapshotTime = svs.time;
 	cl->lastPacketTime = svs.time;
 	cl->lastConnectTime = svs.time;
+	SV_SyncClientHot(cl);
 
 	SV_UserinfoChanged(cl);
 	// when we receive the first packet from the client, we will
@@ -1333,6 +1735,11 @@ sharedEntity_t* SV_AddBotClient(){
 	cl->gamestateMessageNum = -1; //newcl->gamestateMessageNum = -1;
 
 	cl->canNotReliable = 1;
+
+	//SV_LoadBotFrame takes the load bots from here
+	if(loadbot)
+		return SV_GentityNum(i);
+
         //Let enter our new bot the game
 
 //	SV_SendClientGameState(cl);
@@ -1344,6 +1751,91 @@ sharedEntity_t* SV_AddBotClient(){
 	return SV_GentityNum(i);
 }
 
+sharedEntity_t* SV_AddBotClient(){
+
+	return SV_ConnectBot(qfalse);
+}
+
+//Runs forward and strafes left and right, the phases differ per bot
+static void SV_LoadBotCommand(client_t *cl, usercmd_t *cmd){
+
+	int clientNum, phase;
+
+	clientNum = cl - svs.clients;
+
+	Com_Memset(cmd, 0, sizeof(usercmd_t));
+	MSG_SetDefaultUserCmd(SV_GameClientNum(clientNum), cmd);
+
+	cmd->serverTime = svs.time;
+	phase = (svs.time / 100 + clientNum * 7) % 60;
+
+	cmd->forwardmove = 127;
+	if(phase < 20)
+		cmd->rightmove = -127;
+	else if(phase >= 40)
+		cmd->rightmove = 127;
+	if(phase == 30)
+		cmd->upmove = 127;
+}
+
+/*
+============
+SV_LoadBotFrame
+
+Does for the load bots what their packets would do, a client which
+acknowledges every message and sends one command per server frame
+============
+*/
+void SV_LoadBotFrame(){
+
+	int i;
+	client_t *cl;
+	usercmd_t cmd;
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++){
+
+		if(cl->state < CS_CONNECTED || cl->netchan.remoteAddress.sock != NET_LOADBOT_SOCK)
+			continue;
+
+		SV_ClientPacketTime(cl);
+		cl->reliableAcknowledge = cl->reliableSequence;
+		cl->messageAcknowledge = cl->netchan.outgoingSequence -1;
+
+		SV_ClientFrameAcked(cl, Sys_Milliseconds());
+
+		switch(cl->state){
+			case CS_CONNECTED:
+				SV_SendClientGameState(cl);
+				break;
+			case CS_PRIMED:
+				SV_LoadBotCommand(cl, &cmd);
+				SV_ClientEnterWorld(cl, &cmd);
+				break;
+			case CS_ACTIVE:
+				cl->deltaMessage = cl->messageAcknowledge;
+				SV_LoadBotCommand(cl, &cmd);
+				SV_ClientThink(cl, &cmd);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+void SV_RemoveLoadBots(){
+
+	int i;
+	client_t *cl;
+
+	sv_loadBotSpawnsPending = 0;
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++){
+		if(cl->state >= CS_CONNECTED && cl->netchan.remoteAddress.sock == NET_LOADBOT_SOCK){
+			SV_DropClient(cl, "EXE_DISCONNECTED");
+		}
+	}
+}
+
 
 /*
 ============
@@ -1476,6 +1968,7 @@ void SV_WWWRedirect(client_t *cl, msg_t *msg){
 
     cl->wwwDl_var01 = qfalse;
 
+    SV_ReleaseDownloadView(cl);
     if(cl->download){
         FS_FCloseFile(cl->download);
     }
@@ -1496,6 +1989,8 @@ Fill up msg with data
 
 __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 	int curindex;
+	int viewsize;
+	const byte *view;
 	char errorMessage[1024];
 /*
 	if(cl->exploitOn){
@@ -1512,6 +2007,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 
 	if ( !cl->download ) {
 		// We open the file here
+		SV_ReleaseDownloadView(cl);
 
 		// DHM - Nerve
 		// CVE-2006-2082
@@ -1543,6 +2039,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 			MSG_WriteString( msg, errorMessage );
 
 			cl->wwwDl_var01 = 0;
+			SV_ReleaseDownloadView(cl);
 			if(cl->download){
 				FS_FCloseFile(cl->download);
 			}
@@ -1567,16 +2064,36 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 		cl->downloadCount = 0;
 		cl->downloadEOF = qfalse;
 
+		view = FS_AcquireFileView(cl->download, &viewsize);
+		if(view && viewsize != cl->downloadSize){
+			FS_ReleaseFileView(view);
+			view = NULL;
+		}
+		sv_downloadViews[cl - svs.clients] = view;
+
 		cl->wwwDownloadStarted = 0;
 	}
 
+	view = sv_downloadViews[cl - svs.clients];
+
 	while ( cl->downloadCurrentBlock - cl->downloadClientBlock < MAX_DOWNLOAD_WINDOW && cl->downloadSize != cl->downloadCount ) {
 
 		curindex = ( cl->downloadCurrentBlock % MAX_DOWNLOAD_WINDOW );
 
+		if ( view ) {
+			// Block n is always at n * MAX_DOWNLOAD_BLKSIZE inside of the file, nothing to read
+			cl->downloadBlockSize[curindex] = cl->downloadSize - cl->downloadCount;
+			if ( cl->downloadBlockSize[curindex] > MAX_DOWNLOAD_BLKSIZE ) {
+				cl->downloadBlockSize[curindex] = MAX_DOWNLOAD_BLKSIZE;
+			}
+			cl->downloadCount += cl->downloadBlockSize[curindex];
+			cl->downloadCurrentBlock++;
+			continue;
+		}
+
 		// Perform any reads that we need to
 		if ( !cl->downloadBlocks[curindex] ) {
-			cl->downloadBlocks[curindex] = Z_Malloc( MAX_DOWNLOAD_BLKSIZE);
+			cl->downloadBlocks[curindex] = Z_TagMalloc( MAX_DOWNLOAD_BLKSIZE, TAG_DOWNLOAD );
 			if ( !cl->downloadBlocks[curindex]) {//Crash fix for download subsystem
 				SV_DropClient(cl, "Failed to allocate a new chunk of memory for the serverdownloadsystem");
 				return;
@@ -1621,6 +2138,7 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 		//FIXME:  This uses a hardcoded one second timeout for lost blocks
 		//the timeout should be based on client rate somehow
 		if ( svs.time - cl->downloadSendTime > 1000 ) {
+			SV_NetchanStatsRetransmit( cl, cl->downloadCurrentBlock - cl->downloadClientBlock );
 			cl->downloadXmitBlock = cl->downloadClientBlock;
 		} else {
 			return;
@@ -1630,6 +2148,10 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 	// Send current block
 	curindex = ( cl->downloadXmitBlock % MAX_DOWNLOAD_WINDOW );
 
+	if ( !SV_DownloadTakeBudget( cl, cl->downloadBlockSize[curindex] ) ) {
+		return; // Over our share of sv_maxDownloadRate, next message
+	}
+
 	MSG_WriteByte( msg, svc_download );
 	MSG_WriteLong( msg, cl->downloadXmitBlock );
 
@@ -1641,7 +2163,11 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 	MSG_WriteShort( msg, cl->downloadBlockSize[curindex] );
 
 	// Write the block
-	if ( cl->downloadBlockSize[curindex] ) {
+	if ( cl->downloadBlockSize[curindex] && view ) {
+
+		MSG_WriteData( msg, view + cl->downloadXmitBlock * MAX_DOWNLOAD_BLKSIZE, cl->downloadBlockSize[curindex] );
+
+	} else if ( cl->downloadBlockSize[curindex] ) {
 		if ( !cl->downloadBlocks[curindex]) {//Crash evaluation for download subsystem
 			Com_PrintError("FATAL Server error in SV_WriteDownloadToClient.\nClient: %i, Name: %s, File: %s, CLDlBlock: %i, DlSize: %i, DlBlkSize: %i, DlSendTime: %i, ServerTime: %i, XmitBlock: %i, ClientState: %i, CurIndex: %i",
 			cl - svs.clients, cl->name, cl->downloadName, cl->downloadClientBlock, cl->downloadSize, cl->downloadBlockSize[curindex], cl->downloadSendTime, svs.time, cl->downloadXmitBlock, cl->state, curindex);
@@ -1652,6 +2178,8 @@ __cdecl void SV_WriteDownloadToClient( client_t *cl, msg_t *msg ) {
 		MSG_WriteData( msg, cl->downloadBlocks[curindex], cl->downloadBlockSize[curindex] );
 	}
 
+	sv_downloadBytesSent += cl->downloadBlockSize[curindex];
+
 	Com_DPrintf( "clientDownload: %d : writing block %d\n", cl - svs.clients, cl->downloadXmitBlock );
 
 	// Move on to the next block
@@ -1696,7 +2224,7 @@ the wrong gamestate.
 */
 void SV_SendClientGameState( client_t *client ) {
 	msg_t msg;
-	byte msgBuffer[MAX_MSGLEN];
+	byte *msgBuffer;
 
 	while(client->state != CS_FREE && client->netchan.unsentFragments){
 		SV_Netchan_TransmitNextFragment(client);
@@ -1720,7 +2248,7 @@ void SV_SendClientGameState( client_t *client ) {
 
 	Com_DPrintf( "SV_SendClientGameState() for %s\n", client->name );
 	Com_DPrintf( "Going from CS_CONNECTED to CS_PRIMED for %s\n", client->name );
-	client->state = CS_PRIMED;
+	SV_SetClientState(client, CS_PRIMED);
 	client->pureAuthentic = 0;
 
 	// when we receive the first packet from the client, we will
@@ -1728,7 +2256,8 @@ void SV_SendClientGameState( client_t *client ) {
 	// gamestate message was not just sent, forcing a retransmit
 	client->gamestateMessageNum = client->netchan.outgoingSequence;
 
-	MSG_Init( &msg, msgBuffer, sizeof( msgBuffer ) );
+	msgBuffer = MSG_GetBuffer( MAX_MSGLEN );
+	MSG_Init( &msg, msgBuffer, MAX_MSGLEN );
 
 	MSG_ClearLastReferencedEntity(&msg);
 
@@ -1756,7 +2285,9 @@ void SV_SendClientGameState( client_t *client ) {
 	Com_DPrintf( "Sending %i bytes in gamestate to client: %i\n", msg.cursize, client - svs.clients );
 
 	// deliver this to the client
+	SV_ReplayReset( client );
 	SV_SendMessageToClient( &msg, client );
+	MSG_FreeBuffer( msgBuffer );
 	SV_GetServerStaticHeader();
 }
 
@@ -1773,6 +2304,8 @@ clear/free any download vars
 static void SV_CloseDownload( client_t *cl ) {
 	int i;
 
+	SV_ReleaseDownloadView( cl );
+
 	// EOF
 	if ( cl->download ) {
 		FS_FCloseFile( cl->download );
@@ -1815,6 +2348,7 @@ __optimize3 __regparm2 void SV_ExecuteClientMessage( client_t *cl, msg_t *msg )
 
 	MSG_Init(&decompressMsg, buffer, sizeof(buffer));
 	decompressMsg.cursize = MSG_ReadBitsCompress(msg->data + msg->readcount, decompressMsg.data, msg->cursize - msg->readcount);
+	SV_CodecCorpusRecord(CODECCORPUS_CLIENT, decompressMsg.data, decompressMsg.cursize, msg->data + msg->readcount, msg->cursize - msg->readcount);
 
 
 //	SV_DumpToFile(&decompressMsg);
@@ -1891,11 +2425,81 @@ __optimize3 __regparm2 void SV_ExecuteClientMessage( client_t *cl, msg_t *msg )
 
 /*
 ==================
-SV_UpdateUserinfo_f
+Userinfo coalescing
+
+A client can send a new userinfo with every packet and each one runs SV_UserinfoChanged
+and the ClientUserinfoChanged of the game. A change gets applied right away only if the
+last one of the client is sv_userinfoInterval msec ago, otherwise it waits and whatever
+comes meanwhile replaces it, so the last one always gets applied when the time is up.
+A string the same as the last applied one gets dropped, one which leaves all keys the
+server and the game look at alone only gets copied in.
 ==================
 */
-static void SV_UpdateUserinfo_f( client_t *cl ) {
-	Q_strncpyz( cl->userinfo, SV_Cmd_Argv( 1 ), sizeof( cl->userinfo ) );
+typedef struct{
+	int		challenge;			//Tells a new connection in the same slot apart
+	int		lastApplied;
+	qboolean	pending;
+	char		applied[MAX_INFO_STRING];	//As the client sent it
+	char		waiting[MAX_INFO_STRING];
+}userinfoQueue_t;
+
+static userinfoQueue_t sv_userinfoQueues[MAX_CLIENTS];
+static int sv_userinfoNumPending;
+
+//What SV_UserinfoChanged and ClientUserinfoChanged read
+static const char* sv_userinfoEffectiveKeys[] = { "name", "rate", "snaps", "cl_voice", "cl_wwwDownload", "cg_predictItems", NULL };
+
+
+static userinfoQueue_t* SV_UserinfoQueueForClient( client_t *cl ) {
+
+	userinfoQueue_t *queue = &sv_userinfoQueues[cl - svs.clients];
+
+	if(queue->challenge != cl->challenge)
+	{
+		if(queue->pending)
+			sv_userinfoNumPending--;
+		Com_Memset(queue, 0, sizeof(userinfoQueue_t));
+		queue->challenge = cl->challenge;
+		queue->lastApplied = svs.time - sv_userinfoInterval->integer;
+	}
+	return queue;
+}
+
+static qboolean SV_UserinfoSameEffect( const char *a, const char *b ) {
+
+	int i;
+
+	for(i = 0; sv_userinfoEffectiveKeys[i]; i++)
+	{
+		if(strcmp(Info_ValueForKey(a, sv_userinfoEffectiveKeys[i]), Info_ValueForKey(b, sv_userinfoEffectiveKeys[i])))
+			return qfalse;
+	}
+	return qtrue;
+}
+
+static void SV_ApplyUserinfo( client_t *cl, userinfoQueue_t *queue, const char *info ) {
+
+	char ip[128];
+
+	queue->lastApplied = svs.time;
+
+	//Only keys nobody looks at changed, keep the name and the address we set
+	if(queue->applied[0] && SV_UserinfoSameEffect(queue->applied, info))
+	{
+		Q_strncpyz(ip, Info_ValueForKey(cl->userinfo, "ip"), sizeof(ip));
+
+		if(strlen(info) + strlen(ip) + strlen(cl->name) + 10 < MAX_INFO_STRING)
+		{
+			Q_strncpyz(queue->applied, info, sizeof(queue->applied));
+			Q_strncpyz(cl->userinfo, info, sizeof(cl->userinfo));
+			Info_SetValueForKey(cl->userinfo, "name", cl->name);
+			Info_SetValueForKey(cl->userinfo, "ip", ip);
+			return;
+		}
+	}
+
+	Q_strncpyz(queue->applied, info, sizeof(queue->applied));
+	Q_strncpyz( cl->userinfo, info, sizeof( cl->userinfo ) );
 
 	SV_UserinfoChanged( cl );
 
@@ -1903,6 +2507,75 @@ static void SV_UpdateUserinfo_f( client_t *cl ) {
 	ClientUserinfoChanged( cl - svs.clients );
 }
 
+/*
+==================
+SV_UserinfoFrame
+
+Applies the changes which waited long enough
+==================
+*/
+void SV_UserinfoFrame( void ) {
+
+	userinfoQueue_t *queue;
+	client_t *cl;
+	int i;
+
+	if(sv_userinfoNumPending == 0)
+		return;
+
+	for(i = 0, cl = svs.clients, queue = sv_userinfoQueues; i < sv_maxclients->integer; i++, cl++, queue++)
+	{
+		if(!queue->pending)
+			continue;
+
+		if(cl->state < CS_CONNECTED || queue->challenge != cl->challenge)
+		{
+			queue->pending = qfalse;
+			sv_userinfoNumPending--;
+			continue;
+		}
+
+		if(svs.time - queue->lastApplied < sv_userinfoInterval->integer)
+			continue;
+
+		queue->pending = qfalse;
+		sv_userinfoNumPending--;
+		SV_ApplyUserinfo(cl, queue, queue->waiting);
+	}
+}
+
+/*
+==================
+SV_UpdateUserinfo_f
+==================
+*/
+static void SV_UpdateUserinfo_f( client_t *cl ) {
+
+	userinfoQueue_t *queue = SV_UserinfoQueueForClient(cl);
+	const char *info = SV_Cmd_Argv( 1 );
+
+	if(!strcmp(info, queue->pending ? queue->waiting : queue->applied))
+		return;
+
+	if(svs.time - queue->lastApplied < sv_userinfoInterval->integer)
+	{
+		Q_strncpyz(queue->waiting, info, sizeof(queue->waiting));
+		if(!queue->pending)
+		{
+			queue->pending = qtrue;
+			sv_userinfoNumPending++;
+		}
+		return;
+	}
+
+	if(queue->pending)
+	{
+		queue->pending = qfalse;
+		sv_userinfoNumPending--;
+	}
+	SV_ApplyUserinfo(cl, queue, info);
+}
+
 /*
 =================
 SV_Disconnect_f
@@ -1927,6 +2600,9 @@ If we are pure, disconnect the client if they do no meet the following condition
 
 This routine would be a bit simpler with a goto but i abstained
 
+The comparison itself is disabled below, every client which sends "cp" gets
+accepted. Nothing here compares checksums until it gets enabled again.
+
 =================
 */
 static void SV_VerifyPaks_f( client_t *cl ) {
@@ -2143,6 +2819,7 @@ void SV_WWWDownload_f( client_t *cl ) {
 	}else if(!Q_stricmp(download, "done")){
 	
 		cl->wwwDl_var01 = 0;
+		SV_ReleaseDownloadView( cl );
 		if ( cl->download ) {
 			FS_FCloseFile( cl->download );
 		}
@@ -2156,6 +2833,7 @@ void SV_WWWDownload_f( client_t *cl ) {
 		Com_PrintWarning("Client '%s' reported that the http download of '%s' failed, falling back to a server download\n", cl->name, cl->downloadName);
 
 		cl->wwwDl_var01 = 0;
+		SV_ReleaseDownloadView( cl );
 		if ( cl->download ) {
 			FS_FCloseFile( cl->download );
 		}
@@ -2172,6 +2850,7 @@ void SV_WWWDownload_f( client_t *cl ) {
 		Com_PrintWarning("Client '%s' reports that the redirect download for '%s' had wrong checksum.\n        You should make sure that your files on your redirect are the same files you have on your server\n", cl->name, cl->downloadName);
 		
 		cl->wwwDl_var01 = 0;
+		SV_ReleaseDownloadView( cl );
 		if ( cl->download ) {
 			FS_FCloseFile( cl->download );
 		}
@@ -2189,27 +2868,100 @@ void SV_WWWDownload_f( client_t *cl ) {
 	}
 }
 
+/*
+Mute and ignore lists of the clients as bitmasks. Muting is about voice which the binary
+routes, so the muted mask is written through to mutedClients. The chat routing only needs to
+know who ignores the sender, ignoredBy is the other direction of ignored for that.
+*/
+typedef struct{
+	clientMask_t	muted;
+	clientMask_t	ignored;
+	clientMask_t	ignoredBy;
+}clientChatMasks_t;
+
+static clientChatMasks_t sv_chatMasks[MAX_CLIENTS];
+
+
+//A new client in the slot, nobody keeps ignoring or muting the one before
+void SV_ResetClientMasks( client_t* cl ) {
+
+	int clnum = cl - svs.clients;
+	int i;
+
+	for(i = 0; i < MAX_CLIENTS; i++)
+	{
+		sv_chatMasks[i].muted &= ~CLIENTMASK_BIT(clnum);
+		sv_chatMasks[i].ignored &= ~CLIENTMASK_BIT(clnum);
+		sv_chatMasks[i].ignoredBy &= ~CLIENTMASK_BIT(clnum);
+		svs.clients[i].mutedClients[clnum] = 0;
+	}
+	Com_Memset(&sv_chatMasks[clnum], 0, sizeof(clientChatMasks_t));
+	Com_Memset(cl->mutedClients, 0, sizeof(cl->mutedClients));
+}
+
+clientMask_t SV_ChatIgnoredBy( int clnum ) {
+
+	return sv_chatMasks[clnum].ignoredBy;
+}
+
+static int SV_MaskCommandTarget( client_t* cl ) {
+
+	int target = atoi( SV_Cmd_Argv( 1 ) );
+
+	if(target > 63 || target < 0)
+		return -1;
+
+	return target;
+}
+
 void SV_MutePlayer_f(client_t* cl){
 
-	int muteClient = atoi( SV_Cmd_Argv( 1 ) );
+	int muteClient = SV_MaskCommandTarget(cl);
 
-	if(muteClient > 63 || muteClient < 0)
+	if(muteClient < 0)
 		return;
-	
+
+	sv_chatMasks[cl - svs.clients].muted |= CLIENTMASK_BIT(muteClient);
 	cl->mutedClients[muteClient] = 1;
 }
 
 
 void SV_UnmutePlayer_f(client_t* cl){
 
-	int muteClient = atoi( SV_Cmd_Argv( 1 ) );
+	int muteClient = SV_MaskCommandTarget(cl);
 
-	if(muteClient > 63 || muteClient < 0)
+	if(muteClient < 0)
 		return;
-	
+
+	sv_chatMasks[cl - svs.clients].muted &= ~CLIENTMASK_BIT(muteClient);
 	cl->mutedClients[muteClient] = 0;
 }
 
+//Hides the chat of another player
+void SV_IgnorePlayer_f(client_t* cl){
+
+	int clnum = cl - svs.clients;
+	int ignoreClient = SV_MaskCommandTarget(cl);
+
+	if(ignoreClient < 0 || ignoreClient == clnum)
+		return;
+
+	sv_chatMasks[clnum].ignored |= CLIENTMASK_BIT(ignoreClient);
+	sv_chatMasks[ignoreClient].ignoredBy |= CLIENTMASK_BIT(clnum);
+}
+
+void SV_UnignorePlayer_f(client_t* cl){
+
+	int clnum = cl - svs.clients;
+	int ignoreClient = SV_MaskCommandTarget(cl);
+
+	if(ignoreClient < 0)
+		return;
+
+	sv_chatMasks[clnum].ignored &= ~CLIENTMASK_BIT(ignoreClient);
+	sv_chatMasks[ignoreClient].ignoredBy &= ~CLIENTMASK_BIT(clnum);
+}
+
 
 
 typedef struct {
@@ -2231,6 +2983,8 @@ static ucmd_t ucmds[] = {
 	{"wwwdl", SV_WWWDownload_f, 0},
 	{"muteplayer", SV_MutePlayer_f, 0},
 	{"unmuteplayer", SV_UnmutePlayer_f, 0},
+	{"ignoreplayer", SV_IgnorePlayer_f, 0},
+	{"unignoreplayer", SV_UnignorePlayer_f, 0},
 	{NULL, NULL, 0}
 };
 
@@ -2363,3 +3117,96 @@ const char* SV_GetGuid( unsigned int clnum)
 
 	return svs.clients[clnum].pbguid;
 }
+
+/*
+==================
+SV_WriteNetchanMetrics
+
+Per client series are reset on a new connection in the slot, totals are since the start
+==================
+*/
+static void SV_WriteNetchanMetrics( metricsBuf_t* buf ) {
+
+	static const struct{
+		const char*	name;
+		const char*	help;
+		int		offset;
+		qboolean	wide;
+	}counters[] = {
+		{ "cod4x_netchan_received_bytes_total", "Bytes of the datagrams received from clients", offsetof(netchanStats_t, bytesIn), qtrue },
+		{ "cod4x_netchan_sent_bytes_total", "Bytes of the datagrams sent to clients", offsetof(netchanStats_t, bytesOut), qtrue },
+		{ "cod4x_netchan_received_packets_total", "Packets received from clients", offsetof(netchanStats_t, packetsIn), qfalse },
+		{ "cod4x_netchan_sent_packets_total", "Packets sent to clients", offsetof(netchanStats_t, packetsOut), qfalse },
+		{ "cod4x_netchan_received_fragments_total", "Received packets carrying a fragment", offsetof(netchanStats_t, fragmentsIn), qfalse },
+		{ "cod4x_netchan_sent_fragments_total", "Sent packets carrying a fragment", offsetof(netchanStats_t, fragmentsOut), qfalse },
+		{ "cod4x_netchan_dropped_packets_total", "Packets of clients which never arrived", offsetof(netchanStats_t, dropped), qfalse },
+		{ "cod4x_netchan_outoforder_packets_total", "Late or duplicated packets of clients", offsetof(netchanStats_t, outOfOrder), qfalse },
+		{ "cod4x_netchan_retransmits_total", "Download blocks sent again", offsetof(netchanStats_t, retransmits), qfalse },
+		{ "cod4x_netchan_encode_microseconds_total", "Time spent compressing and encoding messages to clients", offsetof(netchanStats_t, encodeUsec), qtrue }
+	};
+	netchanStats_t stats[MAX_CLIENTS +1];
+	const byte* value;
+	client_t *cl;
+	int i, j;
+
+	//Last one is the total
+	for (i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++) {
+		if(cl->state >= CS_CONNECTED && cl->netchan.remoteAddress.type != NA_BOT)
+			SV_GetNetchanStats(cl, &stats[i]);
+	}
+	SV_GetNetchanStats(NULL, &stats[MAX_CLIENTS]);
+
+	for (j = 0; j < sizeof(counters) / sizeof(counters[0]); j++) {
+
+		Metrics_Declare(buf, counters[j].name, "counter", counters[j].help);
+		for (i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++) {
+			if(cl->state < CS_CONNECTED || cl->netchan.remoteAddress.type == NA_BOT)
+				continue;
+			value = (const byte*)&stats[i] + counters[j].offset;
+			Metrics_Printf(buf, "%s{client=\"%d\"} %llu\n", counters[j].name, i,
+				counters[j].wide ? *(const unsigned long long*)value : *(const unsigned int*)value);
+		}
+		value = (const byte*)&stats[MAX_CLIENTS] + counters[j].offset;
+		Metrics_Printf(buf, "%s %llu\n", counters[j].name,
+			counters[j].wide ? *(const unsigned long long*)value : *(const unsigned int*)value);
+	}
+}
+
+/*
+==================
+SV_WriteMetrics
+
+Clients are labeled with their slot, names would give every player their own time series
+==================
+*/
+void SV_WriteMetrics( metricsBuf_t* buf ) {
+
+	client_t *cl;
+	int i, count;
+
+	Metrics_Declare(buf, "cod4x_clients", "gauge", "Clients which are connected or in game");
+	for (i = 0, cl = svs.clients, count = 0; i < sv_maxclients->integer; i++, cl++) {
+		if(cl->state >= CS_CONNECTED)
+			count++;
+	}
+	Metrics_Printf(buf, "cod4x_clients %d\n", count);
+	Metrics_Declare(buf, "cod4x_clients_max", "gauge", "Value of sv_maxclients");
+	Metrics_Printf(buf, "cod4x_clients_max %d\n", sv_maxclients->integer);
+
+	Metrics_Declare(buf, "cod4x_client_ping_seconds", "gauge", "Ping of the clients in game");
+	for (i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++) {
+		if(cl->state == CS_ACTIVE)
+			Metrics_Printf(buf, "cod4x_client_ping_seconds{client=\"%d\"} %.3f\n", i, cl->ping / 1000.0);
+	}
+
+	Metrics_Declare(buf, "cod4x_client_rate_bytes", "gauge", "Rate in bytes per second the clients in game asked for");
+	for (i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++) {
+		if(cl->state == CS_ACTIVE)
+			Metrics_Printf(buf, "cod4x_client_rate_bytes{client=\"%d\"} %d\n", i, cl->rate);
+	}
+
+	Metrics_Declare(buf, "cod4x_download_sent_bytes_total", "counter", "Bytes of UDP downloads sent to clients");
+	Metrics_Printf(buf, "cod4x_download_sent_bytes_total %llu\n", sv_downloadBytesSent);
+
+	SV_WriteNetchanMetrics(buf);
+}
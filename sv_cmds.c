@@ -39,9 +39,11 @@ These commands can only be entered from stdin or by a remote operator datagram
 #include "g_shared.h"
 #include "g_sv_shared.h"
 #include "nvconfig.h"
+#include "scr_vm.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 
 typedef enum {
     SAY_CHAT,
@@ -105,6 +107,146 @@ static void SV_ConSay(client_t *cl, consaytype_t contype) {
 }
 
 
+/*
+==================
+Player handle index
+
+The lowercase name and the lowercase color stripped name of every client, built when
+SV_UserinfoChanged sets the name instead of for each client on every lookup, and hash
+tables from both names and from the uid to the slot. The tables get rebuilt on the next
+lookup after a client changed. Hits are checked against the client itself, so a freed slot
+or a uid which got set somewhere else only costs the scan the lookup did before.
+==================
+*/
+#define PLAYERINDEX_HASHSIZE 256	//Power of 2, room for two names of every client
+
+static struct{
+	qboolean	valid;
+	char		lowerName[MAX_CLIENTS][64];
+	char		cleanName[MAX_CLIENTS][64];	//Only set if not the same as lowerName
+	byte		nameHash[PLAYERINDEX_HASHSIZE];	//Slot + 1, 0 is empty
+	byte		uidHash[PLAYERINDEX_HASHSIZE];
+}sv_playerIndex;
+
+
+static unsigned int SV_PlayerIndexHashString( const char* s ) {
+
+	unsigned int hash = 2166136261u;
+
+	while(*s)
+	{
+		hash ^= (byte)*s;
+		hash *= 16777619u;
+		s++;
+	}
+	return hash;
+}
+
+static unsigned int SV_PlayerIndexHashUid( int uid ) {
+
+	return (unsigned int)uid * 2654435761u;
+}
+
+static void SV_PlayerIndexInsert( byte* table, unsigned int hash, int slot ) {
+
+	while(table[hash & (PLAYERINDEX_HASHSIZE -1)])
+		hash++;
+
+	table[hash & (PLAYERINDEX_HASHSIZE -1)] = slot +1;
+}
+
+//Called whenever the name of a client got set
+void SV_InvalidatePlayerIndex( client_t* cl ) {
+
+	int slot = cl - svs.clients;
+
+	Q_strncpyz(sv_playerIndex.lowerName[slot], cl->name, sizeof(sv_playerIndex.lowerName[slot]));
+	Q_strlwr(sv_playerIndex.lowerName[slot]);
+
+	Q_strncpyz(sv_playerIndex.cleanName[slot], sv_playerIndex.lowerName[slot], sizeof(sv_playerIndex.cleanName[slot]));
+	Q_CleanStr(sv_playerIndex.cleanName[slot]);
+	if(!strcmp(sv_playerIndex.cleanName[slot], sv_playerIndex.lowerName[slot]))
+		sv_playerIndex.cleanName[slot][0] = 0;
+
+	sv_playerIndex.valid = qfalse;
+}
+
+static void SV_BuildPlayerIndex( void ) {
+
+	client_t *cl;
+	int i;
+
+	Com_Memset(sv_playerIndex.nameHash, 0, sizeof(sv_playerIndex.nameHash));
+	Com_Memset(sv_playerIndex.uidHash, 0, sizeof(sv_playerIndex.uidHash));
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(!cl->state)
+			continue;
+
+		SV_PlayerIndexInsert(sv_playerIndex.nameHash, SV_PlayerIndexHashString(sv_playerIndex.lowerName[i]), i);
+		if(sv_playerIndex.cleanName[i][0])
+			SV_PlayerIndexInsert(sv_playerIndex.nameHash, SV_PlayerIndexHashString(sv_playerIndex.cleanName[i]), i);
+		if(cl->uid > 0)
+			SV_PlayerIndexInsert(sv_playerIndex.uidHash, SV_PlayerIndexHashUid(cl->uid), i);
+	}
+	sv_playerIndex.valid = qtrue;
+}
+
+//Clients with the name or the color stripped name, ignoring case. Returns the number of them
+static int SV_FindPlayersByName( const char* lowername, client_t** found ) {
+
+	unsigned int hash;
+	int slot, matches = 0;
+	byte seen[MAX_CLIENTS];
+
+	if(!sv_playerIndex.valid)
+		SV_BuildPlayerIndex();
+
+	Com_Memset(seen, 0, sizeof(seen));
+
+	for(hash = SV_PlayerIndexHashString(lowername); (slot = sv_playerIndex.nameHash[hash & (PLAYERINDEX_HASHSIZE -1)]) != 0; hash++)
+	{
+		slot--;
+		if(seen[slot] || !svs.clients[slot].state)
+			continue;
+
+		if(!strcmp(sv_playerIndex.lowerName[slot], lowername) || !strcmp(sv_playerIndex.cleanName[slot], lowername))
+		{
+			seen[slot] = 1;
+			*found = &svs.clients[slot];
+			matches++;
+		}
+	}
+	return matches;
+}
+
+static client_t* SV_FindPlayerByUid( int uid ) {
+
+	unsigned int hash;
+	int slot, i;
+	client_t *cl;
+
+	if(!sv_playerIndex.valid)
+		SV_BuildPlayerIndex();
+
+	for(hash = SV_PlayerIndexHashUid(uid); (slot = sv_playerIndex.uidHash[hash & (PLAYERINDEX_HASHSIZE -1)]) != 0; hash++)
+	{
+		cl = &svs.clients[slot -1];
+		if(cl->state && cl->uid == uid)
+			return cl;
+	}
+
+	//Uids are assigned by the auth and plugins, the index might not know about it yet
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++){
+		if(cl->state && cl->uid == uid){
+			sv_playerIndex.valid = qfalse;
+			return cl;
+		}
+	}
+	return NULL;
+}
+
 /*
 ==================
 SV_GetPlayerByHandle
@@ -122,7 +264,7 @@ static clanduid_t SV_GetPlayerByHandle( void ) {
 	client_t	*lastfound;
 	int		i, playermatches;
 	char		*s;
-	char		cleanName[64];
+	char		lowerName[64];
 
 	cl.uid = 0;
 	cl.cl = NULL;
@@ -179,43 +321,26 @@ static clanduid_t SV_GetPlayerByHandle( void ) {
 				return cl;
 			}
 
-			playermatches = 0; //This must be one
 			lastfound = NULL;
 
-			// check for a exact name match
-			for ( i=0, cl.cl=svs.clients ; i < sv_maxclients->integer ; i++, cl.cl++ ) {
-				if ( !cl.cl->state ) {
-					continue;
-				}
-				if ( !Q_stricmp( cl.cl->name, s ) ) {
-					lastfound = cl.cl;
-					playermatches++;
-					continue;
-				}
+			Q_strncpyz( lowerName, s, sizeof(lowerName) );
+			Q_strlwr( lowerName );
 
-				Q_strncpyz( cleanName, cl.cl->name, sizeof(cleanName) );
-				Q_CleanStr( cleanName );
-				if ( !Q_stricmp( cleanName, s ) ) {
-					lastfound = cl.cl;
-					playermatches++;
-					continue;
-				}
-			}
+			// check for a exact name match
+			playermatches = SV_FindPlayersByName( lowerName, &lastfound ); //This must be one
 
 			if(!lastfound){ //No exact playermatch found - Now search for partial name matches
 				for ( i=0, cl.cl=svs.clients ; i < sv_maxclients->integer ; i++, cl.cl++ ) {
 					if ( !cl.cl->state ) {
 						continue;
 					}
-					if ( Q_stristr( cl.cl->name, s ) ) {
+					if ( strstr( sv_playerIndex.lowerName[i], lowerName ) ) {
 						lastfound = cl.cl;
 						playermatches++;
 						continue;
 					}
 
-					Q_strncpyz( cleanName, cl.cl->name, sizeof(cleanName) );
-					Q_CleanStr( cleanName );
-					if ( Q_stristr( cleanName, s ) ) {
+					if ( sv_playerIndex.cleanName[i][0] && strstr( sv_playerIndex.cleanName[i], lowerName ) ) {
 						lastfound = cl.cl;
 						playermatches++;
 						continue;
@@ -239,13 +364,7 @@ static clanduid_t SV_GetPlayerByHandle( void ) {
         }
 
         if(!cl.cl && cl.uid > 0){ //See whether this player is currently onto server
-            for(i = 0, cl.cl=svs.clients; i < sv_maxclients->integer; i++, cl.cl++){
-                if(cl.cl->state && cl.uid == cl.cl->uid){
-                    break;
-                }
-            }
-            if(i == sv_maxclients->integer)
-                cl.cl = NULL;
+            cl.cl = SV_FindPlayerByUid(cl.uid);
         }
 
 	return cl;
@@ -483,17 +602,112 @@ static void SV_DumpUser_f( void ) {
 	}*/
 }
 
+/*
+================
+Status rows
+
+The padded columns of a client only change on connect, a rename or a new rate, so they get
+formatted once into pieces per client and each row goes out with a single Com_Printf instead
+of one call for every column and space. The pieces remember what they got built from and
+get rebuilt if that is not the same anymore. Score, ping and lastmsg are printed as they are.
+================
+*/
+typedef struct{
+	//What the pieces got built from
+	char		pbguid[33];
+	char		shortname[MAX_NAME_LENGTH];
+	char		name[64];
+	netadr_t	adr;
+	int		qport;
+	int		rate;
+	//status
+	char		ident[96];		//guid and short name
+	char		net[64];		//address, qport and rate
+	//ministatus
+	char		namePad[36];
+	char		maskedAddress[96];
+}statusRow_t;
+
+static statusRow_t sv_statusRows[MAX_CLIENTS];
+
+//Spaces up to width but at least one, as the loops of the old status did it
+static void SV_StatusPad( char* buf, int size, const char* s, int len, int width ) {
+
+	int pad;
+
+	pad = width - len;
+	if ( pad < 1 )
+		pad = 1;
+
+	Com_sprintf(buf, size, "%s%*s", s, pad, "");
+}
+
+static statusRow_t* SV_StatusRow( client_t* cl ) {
+
+	statusRow_t	*row = &sv_statusRows[cl - svs.clients];
+	char		namebuf[96];
+	const char	*s;
+
+	if ( strcmp(row->pbguid, cl->pbguid) || strcmp(row->shortname, cl->shortname) ) {
+
+		Q_strncpyz(row->pbguid, cl->pbguid, sizeof(row->pbguid));
+		Q_strncpyz(row->shortname, cl->shortname, sizeof(row->shortname));
+
+		// TTimo adding a ^7 to reset the color
+		// NOTE: colored names in status breaks the padding (WONTFIX)
+		Com_sprintf(namebuf, sizeof(namebuf), "%s^7", cl->shortname);
+		SV_StatusPad(row->ident, sizeof(row->ident), cl->pbguid, strlen(cl->pbguid), 33);
+		Q_strcat(row->ident, sizeof(row->ident), namebuf);
+		SV_StatusPad(namebuf, sizeof(namebuf), "", 0, 16 - Q_PrintStrlen(cl->shortname));
+		Q_strcat(row->ident, sizeof(row->ident), namebuf);
+	}
+
+	if ( strcmp(row->name, cl->name) ) {
+		Q_strncpyz(row->name, cl->name, sizeof(row->name));
+		SV_StatusPad(row->namePad, sizeof(row->namePad), "", 0, 33 - Q_PrintStrlen(cl->name));
+	}
+
+	if ( memcmp(&row->adr, &cl->netchan.remoteAddress, sizeof(netadr_t)) || row->qport != cl->netchan.qport || row->rate != cl->rate ) {
+
+		row->adr = cl->netchan.remoteAddress;
+		row->qport = cl->netchan.qport;
+		row->rate = cl->rate;
+
+		s = NET_AdrToString( &cl->netchan.remoteAddress );
+		SV_StatusPad(row->net, sizeof(row->net), s, strlen(s), 21);
+		Q_strcat(row->net, sizeof(row->net), va(" %5i %5i", cl->netchan.qport, cl->rate));
+
+		s = NET_AdrToConnectionStringMask( &cl->netchan.remoteAddress );
+		SV_StatusPad(row->maskedAddress, sizeof(row->maskedAddress), s, strlen(s), 47);
+	}
+
+	return row;
+}
+
+static const char* SV_StatusPing( client_t* cl, char* buf, int size ) {
+
+	if (cl->state == CS_CONNECTED)
+		return "CNCT";
+	else if (cl->state == CS_ZOMBIE)
+		return "ZMBI";
+	else if (cl->state == CS_PRIMED)
+		return "PRIM";
+
+	Com_sprintf(buf, size, "%4i", cl->ping < 9999 ? cl->ping : 9999);
+	return buf;
+}
+
 /*
 ================
 SV_Status_f
 ================
 */
 static void SV_Status_f( void ) {
-	int			i, j, l;
+	int			i;
 	client_t	*cl;
 	gclient_t	*gclient;
-	const char		*s;
-	int			ping;
+	statusRow_t	*row;
+	char		ping[16];
 
 	// make sure server is running
 	if ( !com_sv_running->boolean ) {
@@ -502,6 +716,8 @@ static void SV_Status_f( void ) {
 	}
 
 	Com_Printf ("map: %s\n", sv_mapname->string );
+	SV_FrameBudgetStatus();
+	SV_SnapshotShedStatus();
 
 	Com_Printf ("num score ping guid                             name            lastmsg address               qport rate\n");
 	Com_Printf ("--- ----- ---- -------------------------------- --------------- ------- --------------------- ----- -----\n");
@@ -510,63 +726,10 @@ static void SV_Status_f( void ) {
 	{
 		if (!cl->state)
 			continue;
-		Com_Printf ("%3i ", i);
-		Com_Printf ("%5i ", gclient->pers.scoreboard.score);
-		if (cl->state == CS_CONNECTED)
-			Com_Printf ("CNCT ");
-		else if (cl->state == CS_ZOMBIE)
-			Com_Printf ("ZMBI ");
-		else if (cl->state == CS_PRIMED)
-			Com_Printf ("PRIM ");
-		else
-		{
-			ping = cl->ping < 9999 ? cl->ping : 9999;
-			Com_Printf ("%4i ", ping);
-		}
-
-		Com_Printf ("%s", cl->pbguid );
-
-		l = 33 - strlen(cl->pbguid);
-		j = 0;
-
-		do
-		{
-			Com_Printf (" ");
-			j++;
-		} while(j < l);
-
-		Com_Printf ("%s", cl->shortname);
-
-		// TTimo adding a ^7 to reset the color
-		// NOTE: colored names in status breaks the padding (WONTFIX)
-		Com_Printf ("^7");
-		l = 16 - Q_PrintStrlen(cl->shortname);
-		j = 0;
-
-		do
-		{
-			Com_Printf (" ");
-			j++;
-		} while(j < l);
-
-		Com_Printf ("%7i ", svs.time - cl->lastPacketTime );
-
-		s = NET_AdrToString( &cl->netchan.remoteAddress );
-		Com_Printf ("%s", s);
-		l = 21 - strlen(s);
-		j = 0;
-
-		do
-		{
-			Com_Printf(" ");
-			j++;
-		} while(j < l);
-
-		Com_Printf (" %5i", cl->netchan.qport);
-
-		Com_Printf (" %5i", cl->rate);
 
-		Com_Printf ("\n");
+		row = SV_StatusRow(cl);
+		Com_Printf ("%3i %5i %s %s%7i %s\n", i, gclient->pers.scoreboard.score, SV_StatusPing(cl, ping, sizeof(ping)),
+			row->ident, svs.time - cl->lastPacketTime, row->net);
 	}
 	Com_Printf ("\n");
 }
@@ -989,6 +1152,84 @@ void SV_DumpBanlist_f(){
     SV_DumpBanlist();
 }
 
+/*
+================
+Cmd_BanRule_f
+
+banrule <range|country|asn> <value> <duration> [reason]
+The duration is in minutes, with a h or d appended in hours or days. -1 is permanent
+================
+*/
+
+static void Cmd_BanRule_f(){
+
+    char banreason[256];
+    const char* duration;
+    time_t expire;
+    int length, minutes, i;
+
+    if(Cmd_Argc() < 4){
+        Com_Printf("Usage: banrule <range|country|asn> <value> <minutes|-1> [reason]\n");
+        Com_Printf("e.g. banrule range 192.0.2.0/24 2d Spam bots\n");
+        return;
+    }
+
+    duration = Cmd_Argv(3);
+    length = strlen(duration);
+
+    if(!Q_stricmp(duration, "-1")){
+        expire = (time_t)-1;
+    }else{
+        minutes = atoi(duration);
+        if(length > 0 && duration[length -1] == 'h')
+            minutes *= 60;
+        else if(length > 0 && duration[length -1] == 'd')
+            minutes *= 24 * 60;
+
+        if(minutes < 1){
+            Com_Printf("Error: Did not got a valid bantime\n");
+            return;
+        }
+        expire = Com_GetRealtime() + (time_t)minutes * 60;
+    }
+
+    banreason[0] = 0;
+    for(i = 4; Cmd_Argc() > i ;i++){
+        if(i > 4)
+            Q_strcat(banreason, sizeof(banreason), " ");
+        Q_strcat(banreason, sizeof(banreason), Cmd_Argv(i));
+    }
+    if(strlen(banreason) > 126){
+        Com_Printf("Error: You have exceeded the maximum allowed length of 126 for the reason\n");
+        return;
+    }
+
+    if(!SV_AddBanRule(Cmd_Argv(1), Cmd_Argv(2), expire, SV_RemoteCmdGetInvokerUid(), banreason))
+        return;
+
+    Com_Printf("Ban rule added for %s %s\n", Cmd_Argv(1), Cmd_Argv(2));
+    SV_PrintAdministrativeLog("added ban rule for %s %s duration %s with the following reason: %s", Cmd_Argv(1), Cmd_Argv(2), duration, banreason);
+}
+
+static void Cmd_UnbanRule_f(){
+
+    if(Cmd_Argc() != 3){
+        Com_Printf("Usage: unbanrule <range|country|asn> <value>\n");
+        return;
+    }
+
+    if(!SV_RemoveBanRule(Cmd_Argv(1), Cmd_Argv(2))){
+        Com_Printf("Error: There is no ban rule for %s %s\n", Cmd_Argv(1), Cmd_Argv(2));
+        return;
+    }
+    Com_Printf("Ban rule for %s %s removed\n", Cmd_Argv(1), Cmd_Argv(2));
+    SV_PrintAdministrativeLog("removed ban rule for %s %s", Cmd_Argv(1), Cmd_Argv(2));
+}
+
+static void SV_DumpBanRules_f(){
+    SV_DumpBanRules();
+}
+
 
 
 /*
@@ -997,11 +1238,13 @@ SV_MiniStatus_f
 ================
 */
 static void SV_MiniStatus_f( void ) {
-	int			i, j, l;
+	int			i;
 	client_t	*cl;
 	gclient_t	*gclient;
-	const char	*s;
-	int		ping;
+	statusRow_t	*row;
+	char		ping[16];
+	char		uid[16];
+	const char	*os, *color;
 	qboolean	odd = qfalse;
 
 	// make sure server is running
@@ -1020,77 +1263,35 @@ static void SV_MiniStatus_f( void ) {
 		if (!cl->state)
 			continue;
 
+		row = SV_StatusRow(cl);
+
 		if(odd)
-			Com_Printf ("^8");
-		else
-			Com_Printf ("^7");
-
-		Com_Printf ("%3i ", i);
-		Com_Printf ("%5i ", gclient->pers.scoreboard.score);
-		if (cl->state == CS_CONNECTED)
-			Com_Printf ("CNCT ");
-		else if (cl->state == CS_ZOMBIE)
-			Com_Printf ("ZMBI ");
-		else if (cl->state == CS_PRIMED)
-			Com_Printf ("PRIM ");
+			color = "^8";
 		else
-		{
-			ping = cl->ping < 9999 ? cl->ping : 9999;
-			Com_Printf ("%4i ", ping);
-		}
-
+			color = "^7";
 
 		if(cl->uid > 0){
-			Com_Printf ("%9i ", cl->uid );
+			Com_sprintf(uid, sizeof(uid), "%9i", cl->uid);
 		}else{
-			Com_Printf ("      N/A ");
+			Q_strncpyz(uid, "      N/A", sizeof(uid));
 		}
 
-		Com_Printf ("%s", cl->name);
-
-		// TTimo adding a ^7 to reset the color
-		// NOTE: colored names in status breaks the padding (WONTFIX)
-
-		if(odd)
-			Com_Printf ("^8");
-		else
-			Com_Printf ("^7");
-
-		l = 33 - Q_PrintStrlen(cl->name);
-		j = 0;
-
-		do
-		{
-			Com_Printf (" ");
-			j++;
-		} while(j < l);
-
-		s = NET_AdrToConnectionStringMask( &cl->netchan.remoteAddress );
-		Com_Printf ("%s", s);
-		l = 47 - strlen(s);
-		j = 0;
-
-		do
-		{
-			Com_Printf(" ");
-			j++;
-		} while(j < l);
-
-		Com_Printf("%3i ", cl->clFPS);
-
 		switch(cl->OS){
 			case 'M':
-				Com_Printf ("Mac ");
+				os = "Mac";
 				break;
 			case 'W':
-				Com_Printf ("Win ");
+				os = "Win";
 				break;
 			default:
-				Com_Printf ("N/A ");
+				os = "N/A";
 		}
 
+		// NOTE: colored names in status breaks the padding (WONTFIX)
+		Com_Printf ("%s%3i %5i %s %s %s%s%s%s%3i %s \n", color, i, gclient->pers.scoreboard.score, SV_StatusPing(cl, ping, sizeof(ping)),
+			uid, cl->name, color, row->namePad, row->maskedAddress, cl->clFPS, os);
+
 		odd = ~odd;
-		Com_Printf ("\n");
 	}
 }
 
@@ -1112,66 +1313,160 @@ void SV_Heartbeat_f( void ) {
 
 /*
 ============
-Cmd_ExecuteTranslatedCommand_f
+Translated commands
+
+The string of a command added with addCommand gets split up into its text and its
+$ variables once when it is added, and the commands are found through a hash table
+of their lowercase names. Running one is a lookup and copying the parts together.
 ============
 */
 
-static void Cmd_ExecuteTranslatedCommand_f(){
+static const struct{
+	const char*	name;
+	int		length;
+	byte		type;
+}translatedCmdVariables[] = {
+	{ "$uid", 4, TRANSCMD_UID },
+	{ "$clnum", 6, TRANSCMD_CLNUM },
+	{ "$pow", 4, TRANSCMD_POW },
+	{ "$arg", 4, TRANSCMD_ARG }
+};
 
-    int i;
-    char outstr[128];
+static unsigned int Cmd_TranslatedCommandHash( const char* s ) {
 
-    char *cmdname = Cmd_Argv(0);
-    char *cmdstring = NULL;
-    char *tmp;
+	unsigned int hash = 2166136261u;
 
-    for(i=0; i < MAX_TRANSCMDS; i++){
-        if(!Q_stricmp(cmdname, psvs.translatedCmd[i].cmdname)){
-            cmdname = psvs.translatedCmd[i].cmdname;
-            cmdstring = psvs.translatedCmd[i].cmdargument;
-            break;
-        }
-    }
-    if(!cmdstring) return;
-
-    tmp = outstr;
-    i = 1;
-    while(*cmdstring){
-        if(*cmdstring == '$'){
-            if(!Q_strncmp(cmdstring, "$uid", 4)){
-                Com_sprintf(tmp, sizeof(outstr) - (tmp - outstr), "%i", SV_RemoteCmdGetInvokerUid());
-                tmp += strlen(tmp);
-                cmdstring += 4;
-            }else if(!Q_strncmp(cmdstring, "$clnum", 6)){
-                Com_sprintf(tmp, sizeof(outstr) - (tmp - outstr), "%i", SV_RemoteCmdGetInvokerClnum());
-                tmp += strlen(tmp);
-                cmdstring += 6;
-            }else if(!Q_strncmp(cmdstring, "$pow", 4)){
-                Com_sprintf(tmp, sizeof(outstr) - (tmp - outstr), "%i", SV_RemoteCmdGetInvokerPower());
-                tmp += strlen(tmp);
-                cmdstring += 4;
-            }else if(!Q_strncmp(cmdstring, "$arg", 4)){
-                if(!*Cmd_Argv(i)){
+	while(*s)
+	{
+		hash ^= (byte)tolower(*s);
+		hash *= 16777619u;
+		s++;
+	}
+	return hash;
+}
+
+static translatedCmds_t* Cmd_FindTranslatedCommand( const char* cmdname ) {
+
+	unsigned int hash;
+	int index;
+
+	for(hash = Cmd_TranslatedCommandHash(cmdname); (index = psvs.translatedCmdHash[hash & (TRANSCMD_HASHSIZE -1)]) != 0; hash++)
+	{
+		if(!Q_stricmp(cmdname, psvs.translatedCmd[index -1].cmdname))
+			return &psvs.translatedCmd[index -1];
+	}
+	return NULL;
+}
+
+//Splits cmdargument up, returns qfalse if it has too many variables
+static qboolean Cmd_CompileTranslatedCommand( translatedCmds_t* cmd ) {
+
+	translatedCmdPart_t* part;
+	const char* s;
+	int i, arg;
+
+	cmd->numParts = 0;
+	part = NULL;
+	arg = 1;
+
+	for(s = cmd->cmdargument; *s; )
+	{
+		if(*s == '$')
+		{
+			for(i = 0; i < sizeof(translatedCmdVariables) / sizeof(translatedCmdVariables[0]); i++)
+			{
+				if(!Q_strncmp(s, translatedCmdVariables[i].name, translatedCmdVariables[i].length))
+					break;
+			}
+			if(i < sizeof(translatedCmdVariables) / sizeof(translatedCmdVariables[0]))
+			{
+				if(cmd->numParts == MAX_TRANSCMD_PARTS)
+					return qfalse;
+
+				part = &cmd->parts[cmd->numParts++];
+				part->type = translatedCmdVariables[i].type;
+				part->arg = part->type == TRANSCMD_ARG ? arg++ : 0;
+				s += translatedCmdVariables[i].length;
+				part = NULL;	//The next text starts a new part
+				continue;
+			}
+		}
+
+		if(part == NULL)
+		{
+			if(cmd->numParts == MAX_TRANSCMD_PARTS)
+				return qfalse;
+
+			part = &cmd->parts[cmd->numParts++];
+			part->type = TRANSCMD_TEXT;
+			part->arg = 0;
+			part->start = s - cmd->cmdargument;
+			part->length = 0;
+		}
+		part->length++;
+		s++;
+	}
+	return qtrue;
+}
+
+/*
+============
+Cmd_ExecuteTranslatedCommand_f
+============
+*/
+
+static void Cmd_ExecuteTranslatedCommand_f(){
+
+    char outstr[MAX_STRING_CHARS];
+    translatedCmds_t *cmd;
+    translatedCmdPart_t *part;
+    const char *arg;
+    char number[16];
+    int i, len, outlen;
+
+    cmd = Cmd_FindTranslatedCommand(Cmd_Argv(0));
+    if(!cmd) return;
+
+    for(i = 0, outlen = 0, part = cmd->parts; i < cmd->numParts; i++, part++){
+
+        switch(part->type){
+            case TRANSCMD_UID:
+                Com_sprintf(number, sizeof(number), "%i", SV_RemoteCmdGetInvokerUid());
+                arg = number;
+                break;
+            case TRANSCMD_CLNUM:
+                Com_sprintf(number, sizeof(number), "%i", SV_RemoteCmdGetInvokerClnum());
+                arg = number;
+                break;
+            case TRANSCMD_POW:
+                Com_sprintf(number, sizeof(number), "%i", SV_RemoteCmdGetInvokerPower());
+                arg = number;
+                break;
+            case TRANSCMD_ARG:
+                arg = Cmd_Argv(part->arg);
+                if(!*arg){
                     Com_Printf("Not enought arguments to this command\n");
                     return;
                 }
-                if(strchr(Cmd_Argv(i), ';') || strchr(Cmd_Argv(i), '\n')){
+                if(strchr(arg, ';') || strchr(arg, '\n')){
                     return;
                 }
-                Com_sprintf(tmp, sizeof(outstr) - (tmp - outstr), "%s", Cmd_Argv(i));
-                cmdstring += 4;
-                tmp += strlen(tmp);
-                i++;
-            }
+                break;
+            default:
+                arg = NULL;
+                break;
         }
 
-        *tmp = *cmdstring;
-        cmdstring++;
-        tmp++;
-
+        len = arg ? strlen(arg) : part->length;
+        if(outlen + len >= sizeof(outstr)){
+            Com_Printf("Command %s is too long after the substitution\n", cmd->cmdname);
+            return;
+        }
+        Com_Memcpy(outstr + outlen, arg ? arg : cmd->cmdargument + part->start, len);
+        outlen += len;
     }
 
-    *tmp = 0;
+    outstr[outlen] = 0;
     Com_DPrintf("String to Execute: %s\n", outstr);
     Cbuf_AddText(EXEC_NOW, outstr);
 }
@@ -1186,8 +1481,10 @@ Cmd_AddTranslatedCommand_f
 
 static void Cmd_AddTranslatedCommand_f() {
 
+    translatedCmds_t *cmd;
     char *cmdname;
     char *string;
+    unsigned int hash;
     int free;
     int i;
 
@@ -1199,27 +1496,38 @@ static void Cmd_AddTranslatedCommand_f() {
     cmdname = Cmd_Argv(1);
     string = Cmd_Argv(2);
 
+    if(Cmd_FindTranslatedCommand(cmdname)){
+        Com_Printf("This command is already defined\n");
+        return;
+    }
+
     for(i=0, free = -1; i < MAX_TRANSCMDS; i++){
-        if(!Q_stricmp(cmdname, psvs.translatedCmd[i].cmdname)){
-            Com_Printf("This command is already defined\n");
-            return;
-        }
         if(!*psvs.translatedCmd[i].cmdname){
             free = i;
+            break;
         }
-
     }
     if(free == -1){
         Com_Printf("Exceeded limit of custom commands\n");
         return;
     }
 
-    Q_strncpyz(psvs.translatedCmd[free].cmdname, cmdname, sizeof(psvs.translatedCmd[free].cmdname));
-    Q_strncpyz(psvs.translatedCmd[free].cmdargument, string, sizeof(psvs.translatedCmd[free].cmdargument));
+    cmd = &psvs.translatedCmd[free];
+    Q_strncpyz(cmd->cmdname, cmdname, sizeof(cmd->cmdname));
+    Q_strncpyz(cmd->cmdargument, string, sizeof(cmd->cmdargument));
 
-    Cmd_AddCommand (psvs.translatedCmd[free].cmdname, Cmd_ExecuteTranslatedCommand_f);
-    Cmd_SetPower(psvs.translatedCmd[free].cmdname, 100);
-    Com_Printf("Added custom command: %s -> %s\n", psvs.translatedCmd[free].cmdname, psvs.translatedCmd[free].cmdargument);
+    if(!Cmd_CompileTranslatedCommand(cmd)){
+        Com_Printf("The string of this command has more than %d parts\n", MAX_TRANSCMD_PARTS);
+        Com_Memset(cmd, 0, sizeof(translatedCmds_t));
+        return;
+    }
+
+    for(hash = Cmd_TranslatedCommandHash(cmd->cmdname); psvs.translatedCmdHash[hash & (TRANSCMD_HASHSIZE -1)]; hash++);
+    psvs.translatedCmdHash[hash & (TRANSCMD_HASHSIZE -1)] = free +1;
+
+    Cmd_AddCommand (cmd->cmdname, Cmd_ExecuteTranslatedCommand_f);
+    Cmd_SetPower(cmd->cmdname, 100);
+    Com_Printf("Added custom command: %s -> %s\n", cmd->cmdname, cmd->cmdargument);
 
 }
 
@@ -1331,7 +1639,97 @@ void SV_Record_f( void ) {
 }
 
 
+/*
+====================
+SV_SaveReplay_f
+
+savereplay <client> <demoname>
+
+Writes the instant replay buffer of the client to a demo
+====================
+*/
+static void SV_SaveReplay_f( void ) {
+
+	char name[MAX_QPATH];
+	clanduid_t cl;
+
+	if ( Cmd_Argc() > 3 || Cmd_Argc() < 2) {
+		Com_Printf( "savereplay <client> <demoname>\n" );
+		return;
+	}
+
+	cl = SV_GetPlayerByHandle();
+	if(!cl.cl){
+		Com_Printf("Error: This player is not online\n");
+		return;
+	}
+
+	if ( Cmd_Argc() == 3 ) {
+		SV_SaveReplay(cl.cl, Cmd_Argv( 2 ));
+		return;
+	}
+
+	if(psvs.useuids){
+		if(cl.cl->uid > 0)
+			Com_sprintf(name, sizeof(name), "replay_%i_", cl.cl->uid);
+		else
+			Com_sprintf(name, sizeof(name), "replay_NA_%i_", (int)(cl.cl - svs.clients));
+	}else{
+		Com_sprintf(name, sizeof(name), "replay_%s_", cl.cl->pbguid);
+	}
+	SV_SaveReplay(cl.cl, name);
+}
+
+
+/*
+====================
+SV_SpawnBots_f
+
+spawnbots <count>
+
+Queues bots which connect over the next frames
+====================
+*/
+static void SV_SpawnBots_f( void ) {
+
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "spawnbots <count>\n" );
+		return;
+	}
+	if ( !com_sv_running->boolean ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+	SV_QueueBotClients(atoi(Cmd_Argv( 1 )), qfalse);
+}
+
+
+/*
+====================
+SV_LoadBots_f
+
+loadbots <count | kick>
+
+Queues load bots, players which only exist on the server and
+get the full snapshot and netchan path sent into nowhere
+====================
+*/
+static void SV_LoadBots_f( void ) {
 
+	if ( Cmd_Argc() != 2 ) {
+		Com_Printf( "loadbots <count | kick>\n" );
+		return;
+	}
+	if ( !com_sv_running->boolean ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+	if ( !Q_stricmp(Cmd_Argv( 1 ), "kick") ) {
+		SV_RemoveLoadBots();
+		return;
+	}
+	SV_QueueBotClients(atoi(Cmd_Argv( 1 )), qtrue);
+}
 void SV_ShowRules_f(){
 
     unsigned int clnum;
@@ -1864,6 +2262,9 @@ void SV_AddOperatorCommands(){
 	Cmd_AddCommand ("rules", SV_ShowRules_f);
 	Cmd_AddCommand ("heartbeat", SV_Heartbeat_f);
 	Cmd_AddCommand ("dumpbanlist", SV_DumpBanlist_f);
+	Cmd_AddCommand ("banrule", Cmd_BanRule_f);
+	Cmd_AddCommand ("unbanrule", Cmd_UnbanRule_f);
+	Cmd_AddCommand ("dumpbanrules", SV_DumpBanRules_f);
 	Cmd_AddCommand ("kick", Cmd_KickPlayer_f);
 	Cmd_AddCommand ("clientkick", Cmd_KickPlayer_f);
 	Cmd_AddCommand ("onlykick", Cmd_KickPlayer_f);
@@ -1876,6 +2277,19 @@ void SV_AddOperatorCommands(){
 	Cmd_AddCommand ("banUser", Cmd_BanPlayer_f);
 	Cmd_AddCommand ("banClient", Cmd_BanPlayer_f);
 	Cmd_AddCommand ("ministatus", SV_MiniStatus_f);
+	Cmd_AddCommand ("uplinkstatus", SV_UplinkStatus_f);
+	Cmd_AddCommand ("netstatus", SV_NetStatus_f);
+	Cmd_AddCommand ("netchanstatus", SV_NetchanStatus_f);
+	Cmd_AddCommand ("codecbench", SV_CodecBench_f);
+	Cmd_AddCommand ("geoinfostatus", SV_GeoInfoStatus_f);
+	Cmd_AddCommand ("compressionstatus", SV_CompressionStatus_f);
+	Cmd_AddCommand ("tracebench", SV_TraceBench_f);
+	Cmd_AddCommand ("pmovebench", Pmove_Bench_f);
+	Cmd_AddCommand ("msgbufferstatus", MSG_BufferStatus_f);
+	Cmd_AddCommand ("tickstatus", SV_TickStatus_f);
+	Cmd_AddCommand ("hugepagestatus", SV_HugePageStatus_f);
+	Cmd_AddCommand ("hudelemstatus", G_HudStatus_f);
+	Cmd_AddCommand ("scriptprofile", Scr_Profile_f);
 	Cmd_AddCommand ("writenvcfg", NV_WriteConfig);
 	Cmd_AddCommand ("setAdmin", SV_SetAdmin_f);
 	Cmd_AddCommand ("unsetAdmin", SV_UnsetAdmin_f);
@@ -1898,6 +2312,9 @@ void SV_AddOperatorCommands(){
 
 	Cmd_AddCommand ("stoprecord", SV_StopRecord_f);
 	Cmd_AddCommand ("record", SV_Record_f);
+	Cmd_AddCommand ("savereplay", SV_SaveReplay_f);
+	Cmd_AddCommand ("spawnbots", SV_SpawnBots_f);
+	Cmd_AddCommand ("loadbots", SV_LoadBots_f);
 
 
 	if(Com_IsDeveloper()){
@@ -0,0 +1,497 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+/*
+========================================================================
+
+Codec benchmark
+
+The huffman coder, MSG_WriteBits, the netchan encoding and sha256 get
+timed on messages recorded from real games, and what they produce gets
+compared with what the server produced for the same messages when they
+were recorded.
+
+While sv_codecCorpus names a file in fs_homepath every message sent to a
+client gets written to it before and after the compression, and so does
+every packet of usercmds a client sends. "codecbench <file>" replays such
+a corpus, the server does not need to have a map loaded for that.
+Everything runs on the frame thread and the server stalls meanwhile.
+
+The coders are linked against the loaded binary, which owns the huffman
+tree and MSG_ReadBits, so this lives in the server instead of a build
+target of its own. MSG_WriteDeltaEntity is left out, the field writing
+inside of it is the binary's and the corpus has no entity states.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon_mem.h"
+#include "cvar.h"
+#include "cmd.h"
+#include "msg.h"
+#include "net_game_conf.h"
+#include "huffman.h"
+#include "filesystem.h"
+#include "server.h"
+#include "sys_main.h"
+#include "sha256.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define CODECCORPUS_MAGIC 0x43435843		//"CXCC"
+#define CODECCORPUS_VERSION 1
+#define CODECCORPUS_MAXBYTES ( 64 * 1024 * 1024 )
+#define CODECBENCH_MAXCALLS ( 1024 * 1024 )		//Per codec, the latencies of all of them get kept
+#define CODECBENCH_BUFSIZE ( 8 * MAX_MSGLEN )		//A decoded symbol can take as little as a bit
+
+typedef struct{
+	int	magic;
+	int	version;
+}codecCorpusHeader_t;
+
+typedef struct{
+	int	type;				//codecCorpusType_t
+	int	rawLength;
+	int	packedLength;
+}codecCorpusRecord_t;				//Followed by the raw and the packed bytes
+
+typedef struct{
+	codecCorpusType_t	type;
+	const byte*		raw;
+	const byte*		packed;
+	int			rawLength;
+	int			packedLength;
+}codecBenchMessage_t;
+
+typedef struct{
+	const char*		name;
+	unsigned long long	bytes;
+	unsigned long long	usec;
+	unsigned int*		latency;	//usec of every call
+	int			calls;
+	int			errors;
+}codecBenchResult_t;
+
+enum{
+	CODECBENCH_COMPRESS,
+	CODECBENCH_DECOMPRESS_SERVER,
+	CODECBENCH_DECOMPRESS_CLIENT,
+	CODECBENCH_WRITEBITS,
+	CODECBENCH_NETCHAN_STREAM,
+	CODECBENCH_NETCHAN_LOOP,
+	CODECBENCH_SHA256,
+	CODECBENCH_COUNT
+};
+
+static cvar_t* sv_codecCorpus;
+
+static struct{
+	fileHandle_t	file;
+	char		name[MAX_OSPATH];	//What sv_codecCorpus was when the file got opened
+	int		bytes;
+	qboolean	full;
+}codecCorpus;
+
+//Field widths MSG_WriteBits gets fed with, the mix of a snapshot
+static const int codecBenchBitWidths[] = { 1, 1, 2, 3, 4, 5, 6, 7, 8, 8, 10, 12, 16, 16, 20, 24, 32, 32 };
+
+
+void SV_CodecBenchInit( void ) {
+
+	sv_codecCorpus = Cvar_RegisterString("sv_codecCorpus", "", 0, "File in fs_homepath to record the messages of the clients into, for the codecbench command. Empty disables it");
+}
+
+static void SV_CodecCorpusClose( void ) {
+
+	if(codecCorpus.file)
+	{
+		Com_Printf("Closed codec corpus %s with %d KB\n", codecCorpus.name, codecCorpus.bytes / 1024);
+		FS_FCloseFile(codecCorpus.file);
+	}
+	Com_Memset(&codecCorpus, 0, sizeof(codecCorpus));
+}
+
+/*
+==================
+SV_CodecCorpusRecord
+
+Appends a message to the corpus if sv_codecCorpus is set, raw is what went into the compressor
+==================
+*/
+void SV_CodecCorpusRecord( codecCorpusType_t type, const byte* raw, int rawLength, const byte* packed, int packedLength ) {
+
+	codecCorpusHeader_t header;
+	codecCorpusRecord_t record;
+	int size;
+
+	if(!*sv_codecCorpus->string)
+	{
+		if(codecCorpus.name[0])
+			SV_CodecCorpusClose();
+		return;
+	}
+
+	if(strcmp(codecCorpus.name, sv_codecCorpus->string))
+	{
+		SV_CodecCorpusClose();
+		Q_strncpyz(codecCorpus.name, sv_codecCorpus->string, sizeof(codecCorpus.name));
+
+		codecCorpus.file = FS_SV_FOpenFileWrite(codecCorpus.name);
+		if(!codecCorpus.file)
+		{
+			Com_PrintError("Can not open codec corpus %s for writing\n", codecCorpus.name);
+			return;
+		}
+		header.magic = CODECCORPUS_MAGIC;
+		header.version = CODECCORPUS_VERSION;
+		FS_Write(&header, sizeof(header), codecCorpus.file);
+		codecCorpus.bytes = sizeof(header);
+		Com_Printf("Recording codec corpus %s\n", codecCorpus.name);
+	}
+
+	if(!codecCorpus.file || codecCorpus.full || rawLength < 0 || packedLength < 0)
+		return;
+
+	size = sizeof(record) + rawLength + packedLength;
+	if(codecCorpus.bytes + size > CODECCORPUS_MAXBYTES)
+	{
+		codecCorpus.full = qtrue;
+		Com_Printf("Codec corpus %s is full, no more messages get recorded\n", codecCorpus.name);
+		return;
+	}
+
+	record.type = type;
+	record.rawLength = rawLength;
+	record.packedLength = packedLength;
+	FS_Write(&record, sizeof(record), codecCorpus.file);
+	FS_Write(raw, rawLength, codecCorpus.file);
+	FS_Write(packed, packedLength, codecCorpus.file);
+	codecCorpus.bytes += size;
+}
+
+static int QDECL SV_CodecBenchCompareLatency( const void *a, const void *b ) {
+
+	unsigned int la = *(const unsigned int*)a;
+	unsigned int lb = *(const unsigned int*)b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static void SV_CodecBenchAccount( codecBenchResult_t* result, int bytes, unsigned long long usec ) {
+
+	result->bytes += bytes;
+	result->usec += usec;
+	result->latency[result->calls++] = usec;
+}
+
+static void SV_CodecBenchPrintResult( codecBenchResult_t* result ) {
+
+	unsigned int p50, p99;
+
+	if(result->calls == 0)
+		return;
+
+	qsort(result->latency, result->calls, sizeof(result->latency[0]), SV_CodecBenchCompareLatency);
+	p50 = result->latency[(result->calls * 50 + 99) / 100 - 1];
+	p99 = result->latency[(result->calls * 99 + 99) / 100 - 1];
+
+	Com_Printf("%-20s %9.1f %9u %9u %9d %6d\n", result->name,
+		result->usec ? (double)result->bytes / result->usec : 0.0, p50, p99, result->calls, result->errors);
+}
+
+//The digests everybody agrees on, sha256 throughput only counts if these are right
+static qboolean SV_CodecBenchCheckSHA256( void ) {
+
+	static const struct{
+		const char*	input;
+		byte		digest[32];
+	}vectors[] = {
+		{ "", { 0xe3, 0xb0, 0xc4, 0x42, 0x98, 0xfc, 0x1c, 0x14, 0x9a, 0xfb, 0xf4, 0xc8, 0x99, 0x6f, 0xb9, 0x24,
+			0x27, 0xae, 0x41, 0xe4, 0x64, 0x9b, 0x93, 0x4c, 0xa4, 0x95, 0x99, 0x1b, 0x78, 0x52, 0xb8, 0x55 } },
+		{ "abc", { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde, 0x5d, 0xae, 0x22, 0x23,
+			0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad } },
+		{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", { 0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8,
+			0xe5, 0xc0, 0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39, 0xa3, 0x3c, 0xe4, 0x59, 0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4,
+			0x19, 0xdb, 0x06, 0xc1 } }
+	};
+	sha256_context ctx;
+	byte digest[32];
+	int i;
+
+	for(i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+	{
+		sha256_starts(&ctx);
+		sha256_update(&ctx, (uint8*)vectors[i].input, strlen(vectors[i].input));
+		sha256_finish(&ctx, digest);
+		if(memcmp(digest, vectors[i].digest, sizeof(digest)))
+		{
+			Com_PrintWarning("SHA256 of \"%s\" is wrong\n", vectors[i].input);
+			return qfalse;
+		}
+	}
+	return qtrue;
+}
+
+//Writes the raw bytes as fields of codecBenchBitWidths and reads them back with the MSG_ReadBits of the binary
+static qboolean SV_CodecBenchWriteBits( const codecBenchMessage_t* message, byte* buf, int size, unsigned long long* usec ) {
+
+	unsigned long long start;
+	unsigned int value;
+	msg_t msg;
+	int i, w, bits;
+
+	MSG_Init(&msg, buf, size);
+
+	start = Sys_MicrosecondsLong();
+	for(i = 0, w = 0; i + 4 <= message->rawLength; i += 4, w++)
+	{
+		bits = codecBenchBitWidths[w % (sizeof(codecBenchBitWidths) / sizeof(codecBenchBitWidths[0]))];
+		Com_Memcpy(&value, message->raw + i, 4);
+		if(bits < 32)
+			value &= (1 << bits) - 1;
+		MSG_WriteBits(&msg, value, bits);
+	}
+	*usec = Sys_MicrosecondsLong() - start;
+
+	if(msg.overflowed)
+		return qfalse;
+
+	MSG_BeginReading(&msg);
+	for(i = 0, w = 0; i + 4 <= message->rawLength; i += 4, w++)
+	{
+		bits = codecBenchBitWidths[w % (sizeof(codecBenchBitWidths) / sizeof(codecBenchBitWidths[0]))];
+		Com_Memcpy(&value, message->raw + i, 4);
+		if(bits < 32)
+			value &= (1 << bits) - 1;
+		if((unsigned int)MSG_ReadBits(&msg, bits) != value)
+			return qfalse;
+	}
+	return qtrue;
+}
+
+static codecBenchMessage_t* SV_CodecBenchParse( const byte* data, int length, int* count ) {
+
+	const codecCorpusHeader_t* header = (const codecCorpusHeader_t*)data;
+	codecCorpusRecord_t record;
+	codecBenchMessage_t* messages;
+	int offset, num, max;
+
+	if(length < sizeof(codecCorpusHeader_t) || header->magic != CODECCORPUS_MAGIC || header->version != CODECCORPUS_VERSION)
+	{
+		Com_PrintError("This is no codec corpus of version %d\n", CODECCORPUS_VERSION);
+		return NULL;
+	}
+
+	max = length / sizeof(codecCorpusRecord_t);
+	messages = Z_Malloc(max * sizeof(codecBenchMessage_t));
+
+	for(offset = sizeof(codecCorpusHeader_t), num = 0; offset + sizeof(record) <= length; num++)
+	{
+		Com_Memcpy(&record, data + offset, sizeof(record));
+		offset += sizeof(record);
+
+		if((record.type != CODECCORPUS_SERVER && record.type != CODECCORPUS_CLIENT) ||
+			record.rawLength < 0 || record.rawLength > MAX_MSGLEN || record.packedLength < 0 || record.packedLength > MAX_MSGLEN ||
+			offset + record.rawLength + record.packedLength > length)
+		{
+			Com_PrintWarning("Codec corpus is broken after %d messages\n", num);
+			break;
+		}
+		messages[num].type = record.type;
+		messages[num].rawLength = record.rawLength;
+		messages[num].packedLength = record.packedLength;
+		messages[num].raw = data + offset;
+		messages[num].packed = data + offset + record.rawLength;
+		offset += record.rawLength + record.packedLength;
+	}
+	*count = num;
+	return messages;
+}
+
+/*
+==================
+SV_CodecBench_f
+
+codecbench <file> [rounds]
+==================
+*/
+void SV_CodecBench_f( void ) {
+
+	//What SV_Netchan_Encode mixes in, the corpus does not know the command strings
+	static const byte netchanString[] = "cs 1 \"\\g_gametype\\war\\mapname\\mp_crash\"";
+	codecBenchResult_t results[CODECBENCH_COUNT];
+	codecBenchMessage_t* messages;
+	codecBenchMessage_t* message;
+	sha256_context ctx;
+	fileHandle_t file;
+	unsigned long long start, usec, streamUsec, loopUsec, rawBytes[2];
+	unsigned int* latency;
+	byte digest[32];
+	byte *data, *out, *out2;
+	int length, count, rounds, r, i, n, errors, numMessages[2];
+	char filename[MAX_OSPATH];
+
+	if(Cmd_Argc() < 2)
+	{
+		Com_Printf("Usage: codecbench <file in fs_homepath> [rounds]\n");
+		return;
+	}
+	Q_strncpyz(filename, Cmd_Argv(1), sizeof(filename));
+	rounds = Cmd_Argc() > 2 ? atoi(Cmd_Argv(2)) : 10;
+	if(rounds < 1)
+		rounds = 1;
+	if(rounds > 1000)
+		rounds = 1000;
+
+	length = FS_SV_FOpenFileRead(filename, &file);
+	if(!file)
+	{
+		Com_PrintError("Can not open codec corpus %s\n", filename);
+		return;
+	}
+	if(length <= 0 || length > CODECCORPUS_MAXBYTES)
+	{
+		Com_PrintError("Codec corpus %s has a bad size of %d bytes\n", filename, length);
+		FS_FCloseFile(file);
+		return;
+	}
+	data = Z_Malloc(length);
+	FS_Read(data, length, file);
+	FS_FCloseFile(file);
+
+	messages = SV_CodecBenchParse(data, length, &count);
+	if(messages == NULL || count == 0)
+	{
+		if(messages)
+			Z_Free(messages);
+		Z_Free(data);
+		return;
+	}
+
+	if((long long)count * rounds > CODECBENCH_MAXCALLS)
+	{
+		rounds = count > CODECBENCH_MAXCALLS ? 1 : CODECBENCH_MAXCALLS / count;
+		if(count > CODECBENCH_MAXCALLS)
+			count = CODECBENCH_MAXCALLS;
+	}
+
+	out = Z_Malloc(CODECBENCH_BUFSIZE);
+	out2 = Z_Malloc(CODECBENCH_BUFSIZE);
+	latency = Z_Malloc(CODECBENCH_COUNT * count * rounds * sizeof(unsigned int));
+
+	Com_Memset(results, 0, sizeof(results));
+	results[CODECBENCH_COMPRESS].name = "huff compress";
+	results[CODECBENCH_DECOMPRESS_SERVER].name = "huff decompress srv";
+	results[CODECBENCH_DECOMPRESS_CLIENT].name = "huff decompress cl";
+	results[CODECBENCH_WRITEBITS].name = "msg writebits";
+	results[CODECBENCH_NETCHAN_STREAM].name = "netchan encode";
+	results[CODECBENCH_NETCHAN_LOOP].name = "netchan byteloop";
+	results[CODECBENCH_SHA256].name = "sha256";
+	for(i = 0; i < CODECBENCH_COUNT; i++)
+		results[i].latency = latency + i * count * rounds;
+
+	Com_Memset(numMessages, 0, sizeof(numMessages));
+	Com_Memset(rawBytes, 0, sizeof(rawBytes));
+	for(i = 0; i < count; i++)
+	{
+		numMessages[messages[i].type]++;
+		rawBytes[messages[i].type] += messages[i].rawLength;
+	}
+	Com_Printf("Codec corpus %s: %d server messages with %llu KB, %d client packets with %llu KB, %d rounds\n", filename,
+		numMessages[CODECCORPUS_SERVER], rawBytes[CODECCORPUS_SERVER] / 1024, numMessages[CODECCORPUS_CLIENT],
+		rawBytes[CODECCORPUS_CLIENT] / 1024, rounds);
+
+	for(r = 0; r < rounds; r++)
+	{
+		for(i = 0, message = messages; i < count; i++, message++)
+		{
+			//What the server sent has to come out again bit for bit. The client compresses with the same table,
+			//but the decompressed packet gets the padding bits of the last byte as extra symbols, so it is only decoded
+			if(message->type == CODECCORPUS_SERVER)
+			{
+				start = Sys_MicrosecondsLong();
+				n = MSG_WriteBitsCompress(0, message->raw, out, message->rawLength);
+				SV_CodecBenchAccount(&results[CODECBENCH_COMPRESS], message->rawLength, Sys_MicrosecondsLong() - start);
+				if(n != message->packedLength || memcmp(out, message->packed, n))
+					results[CODECBENCH_COMPRESS].errors++;
+
+				start = Sys_MicrosecondsLong();
+				n = MSG_ReadBitsCompress(message->packed, out, message->packedLength);
+				SV_CodecBenchAccount(&results[CODECBENCH_DECOMPRESS_SERVER], message->rawLength, Sys_MicrosecondsLong() - start);
+				if(n < message->rawLength || memcmp(out, message->raw, message->rawLength))
+					results[CODECBENCH_DECOMPRESS_SERVER].errors++;
+			}
+			else
+			{
+				start = Sys_MicrosecondsLong();
+				n = MSG_ReadBitsCompress(message->packed, out, message->packedLength);
+				SV_CodecBenchAccount(&results[CODECBENCH_DECOMPRESS_CLIENT], message->rawLength, Sys_MicrosecondsLong() - start);
+				if(n != message->rawLength || memcmp(out, message->raw, n))
+					results[CODECBENCH_DECOMPRESS_CLIENT].errors++;
+			}
+
+			if(!SV_CodecBenchWriteBits(message, out, CODECBENCH_BUFSIZE, &usec))
+				results[CODECBENCH_WRITEBITS].errors++;
+			SV_CodecBenchAccount(&results[CODECBENCH_WRITEBITS], message->rawLength, usec);
+
+			//What goes out on the wire is the packed message
+			streamUsec = loopUsec = 0;
+			if(!SV_Netchan_EncodeBenchmark(message->packed, message->packedLength, netchanString, (byte)i, out, out2, &streamUsec, &loopUsec))
+				results[CODECBENCH_NETCHAN_STREAM].errors++;
+			SV_CodecBenchAccount(&results[CODECBENCH_NETCHAN_STREAM], message->packedLength, streamUsec);
+			SV_CodecBenchAccount(&results[CODECBENCH_NETCHAN_LOOP], message->packedLength, loopUsec);
+
+			start = Sys_MicrosecondsLong();
+			sha256_starts(&ctx);
+			sha256_update(&ctx, (uint8*)message->raw, message->rawLength);
+			sha256_finish(&ctx, digest);
+			SV_CodecBenchAccount(&results[CODECBENCH_SHA256], message->rawLength, Sys_MicrosecondsLong() - start);
+		}
+	}
+
+	if(!SV_CodecBenchCheckSHA256())
+		results[CODECBENCH_SHA256].errors++;
+
+	Com_Printf("%-20s %9s %9s %9s %9s %6s\n", "codec", "MB/s", "p50 usec", "p99 usec", "calls", "errors");
+	Com_Printf("-------------------- --------- --------- --------- --------- ------\n");
+	for(i = 0, errors = 0; i < CODECBENCH_COUNT; i++)
+	{
+		SV_CodecBenchPrintResult(&results[i]);
+		errors += results[i].errors;
+	}
+
+	if(errors)
+		Com_PrintWarning("%d outputs differ from the reference\n", errors);
+	else
+		Com_Printf("All outputs match the reference\n");
+
+	Z_Free(latency);
+	Z_Free(out2);
+	Z_Free(out);
+	Z_Free(messages);
+	Z_Free(data);
+}
@@ -30,9 +30,16 @@
 #include "q_platform.h"
 #include "sys_main.h"
 #include "net_game_conf.h"
+#include "qcommon_metrics.h"
+#include "cvar.h"
+#include "cmd.h"
+#include "misc.h"
+#include "sys_thread.h"
 
 #include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #define FS_DEMOWRITEBUF_SIZE NETCHAN_UNSENTBUFFER_SIZE
 
@@ -43,6 +50,133 @@ qboolean FS_FCloseDemoFile( fileHandleData_t* f );
 qboolean FS_DemoFileExists( const char *file );
 void FS_DemoForceFlush(fileHandleData_t *fh);
 int FS_DemoFlush( fileHandleData_t *fh );
+void FS_DemoWriterSync( void );
+
+/*
+============================================================================
+
+Demo index
+
+Every sv_demoKeyframeInterval seconds the snapshot of a recording client is sent
+without delta compression. Where these keyframes start gets remembered and
+SV_StopRecord appends the list after the end marker of the demo, which the
+stock client never reads past:
+	"CD4XDIDX" int version int count {int serverTime int sequence int offset}[count]
+	int offset of "CD4XDIDX" "CD4XDIDX"
+The end of the file tells where the index is, so a tool can go straight to
+any keyframe. The offset is where the message of the keyframe begins.
+client_t belongs to the original binary, so all of this is kept apart from it.
+
+============================================================================
+*/
+
+#define DEMOINDEX_VERSION 1
+#define DEMOINDEX_MAXENTRIES 65536
+
+typedef struct{
+	int serverTime;
+	int sequence;
+	int offset;
+}demoIndexEntry_t;
+
+typedef struct{
+	int offset;			//Bytes written to the demo so far
+	int lastKeyframeTime;
+	qboolean keyframePending;	//The message which gets written next is not delta compressed
+	demoIndexEntry_t *entries;
+	int count;
+	int size;
+}demoIndex_t;
+
+static demoIndex_t sv_demoIndexes[MAX_CLIENTS];
+
+
+static void SV_DemoWriteClient( client_t *cl, const void *data, int len ) {
+
+	FS_DemoWrite( data, len, &cl->demofile );
+	sv_demoIndexes[cl - svs.clients].offset += len;
+}
+
+static void SV_DemoIndexAdd( client_t *cl ) {
+
+	demoIndex_t *index = &sv_demoIndexes[cl - svs.clients];
+	demoIndexEntry_t *entries;
+
+	if(index->count >= index->size)
+	{
+		if(index->size >= DEMOINDEX_MAXENTRIES)
+			return;
+
+		entries = Z_Malloc((index->size ? index->size * 2 : 64) * sizeof(demoIndexEntry_t));
+		if(index->entries)
+		{
+			Com_Memcpy(entries, index->entries, index->count * sizeof(demoIndexEntry_t));
+			Z_Free(index->entries);
+		}
+		index->entries = entries;
+		index->size = index->size ? index->size * 2 : 64;
+	}
+	index->entries[index->count].serverTime = svs.time;
+	index->entries[index->count].sequence = cl->netchan.outgoingSequence;
+	index->entries[index->count].offset = index->offset;
+	index->count++;
+}
+
+static void SV_DemoIndexFree( client_t *cl ) {
+
+	demoIndex_t *index = &sv_demoIndexes[cl - svs.clients];
+
+	if(index->entries)
+		Z_Free(index->entries);
+
+	Com_Memset(index, 0, sizeof(demoIndex_t));
+}
+
+static void SV_DemoIndexWrite( client_t *cl ) {
+
+	demoIndex_t *index = &sv_demoIndexes[cl - svs.clients];
+	int start, value;
+
+	start = index->offset;
+
+	SV_DemoWriteClient( cl, "CD4XDIDX", 8 );
+	value = LittleLong( DEMOINDEX_VERSION );
+	SV_DemoWriteClient( cl, &value, 4 );
+	value = LittleLong( index->count );
+	SV_DemoWriteClient( cl, &value, 4 );
+	SV_DemoWriteClient( cl, index->entries, index->count * sizeof(demoIndexEntry_t) );
+	value = LittleLong( start );
+	SV_DemoWriteClient( cl, &value, 4 );
+	SV_DemoWriteClient( cl, "CD4XDIDX", 8 );
+}
+
+/*
+====================
+SV_DemoKeyframeDue
+
+Asked by SV_WriteSnapshotToClient whether the snapshot for a recording client
+has to go out without delta compression
+====================
+*/
+qboolean SV_DemoKeyframeDue( client_t *cl ) {
+
+	if(sv_demoKeyframeInterval->integer <= 0)
+		return qfalse;
+
+	return svs.time - sv_demoIndexes[cl - svs.clients].lastKeyframeTime >= sv_demoKeyframeInterval->integer * 1000;
+}
+
+//The message which gets built right now is not delta compressed
+void SV_DemoKeyframe( client_t *cl ) {
+
+	demoIndex_t *index = &sv_demoIndexes[cl - svs.clients];
+
+	if(cl->demowaiting)
+		return; //Does not get recorded
+
+	index->keyframePending = qtrue;
+	index->lastKeyframeTime = svs.time;
+}
 
 /*
 ====================
@@ -78,7 +212,7 @@ void SV_WriteDemoArchive(client_t *client){
 	MSG_WriteVector(&msg, ps->viewangles);
 	client->demoArchiveIndex++;
 
-	FS_DemoWrite( msg.data, msg.cursize, &client->demofile );
+	SV_DemoWriteClient( client, msg.data, msg.cursize );
 }
 
 /*
@@ -104,9 +238,16 @@ void SV_WriteDemoMessageForClient( byte *data, int dataLen, client_t *client ){
 
 	// write the servermessagelength
 	MSG_WriteLong(&msg, LittleLong( dataLen ));
-	FS_DemoWrite( msg.data, msg.cursize, &client->demofile );
 
-	FS_DemoWrite( data, dataLen, &client->demofile );
+	if(sv_demoIndexes[client - svs.clients].keyframePending)
+	{
+		sv_demoIndexes[client - svs.clients].keyframePending = qfalse;
+		SV_DemoIndexAdd( client );
+	}
+
+	SV_DemoWriteClient( client, msg.data, msg.cursize );
+
+	SV_DemoWriteClient( client, data, dataLen );
 //	Com_DPrintf("Writing: %i bytes of demodata\n", dataLen+ msg.cursize);
 }
 
@@ -131,12 +272,17 @@ void SV_StopRecord( client_t *cl ) {
 
 	null = 0;
 
-	FS_DemoWrite( &null, 1, &cl->demofile );
+	SV_DemoWriteClient( cl, &null, 1 );
 
 	len = -1;
 
-	FS_DemoWrite( &len, 4, &cl->demofile );
-	FS_DemoWrite( &len, 4, &cl->demofile );
+	SV_DemoWriteClient( cl, &len, 4 );
+	SV_DemoWriteClient( cl, &len, 4 );
+
+	if(sv_demoIndex->boolean)
+		SV_DemoIndexWrite( cl );
+
+	SV_DemoIndexFree( cl );
 
 	FS_FCloseDemoFile( &cl->demofile );
 	cl->demorecording = qfalse;
@@ -145,6 +291,9 @@ void SV_StopRecord( client_t *cl ) {
 	if(!*sv_demoCompletedCmd->string)
 		return;
 
+	//The command expects the complete file
+	FS_DemoWriterSync();
+
 	Com_sprintf(cmdline, sizeof(cmdline), "\"%s/%s\" \"%s/%s\"", fs_homepath->string, sv_demoCompletedCmd->string, fs_homepath->string, cl->demoName);
 
 	Sys_DoStartProcess(cmdline);
@@ -185,11 +334,54 @@ Begins recording a demo from the current position
 ====================
 */
 
-void SV_RecordClient( client_t* cl, char* basename ) {
-	char name[MAX_OSPATH];
-	byte bufData[MAX_MSGLEN];
+/*
+Writes the gamestate message a demo starts with as if it had the given
+packet sequence. Returns the number of bytes written
+*/
+static int SV_DemoWriteGameState( client_t* cl, fileHandleData_t* fh, int sequence ) {
+	byte *bufData;
 	msg_t msg;
 	int len, compLen, swlen;
+
+	// write out the gamestate message
+	bufData = MSG_GetBuffer( MAX_MSGLEN );
+	MSG_Init( &msg, bufData, MAX_MSGLEN );
+
+	// NOTE, MRE: all server->client messages now acknowledge
+	MSG_WriteLong( &msg, cl->lastClientCommand );
+
+	SV_WriteGameState(&msg, cl);
+
+	// write the client num
+	MSG_WriteLong( &msg, cl - svs.clients );
+	// write the checksum feed
+	MSG_WriteLong( &msg, sv.checksumFeed );
+
+	// finished writing the client packet
+	MSG_WriteByte( &msg, svc_EOF );
+
+	*(int32_t*)0x13f39080 = *(int32_t*)msg.data;
+	compLen = 4 + MSG_WriteBitsCompress( 0, msg.data + 4 ,(byte*)0x13f39084 ,msg.cursize - 4);
+	MSG_FreeBuffer( bufData );
+
+	len = 0;
+	FS_DemoWrite( &len, 1, fh );
+
+	// write it to the demo file
+
+	// write the packet sequence
+	swlen = LittleLong( sequence );
+	FS_DemoWrite( &swlen, 4, fh );
+
+	len = LittleLong( compLen );
+	FS_DemoWrite( &len, 4, fh );
+	FS_DemoWrite((byte*)0x13f39080, compLen, fh );
+
+	return 9 + compLen;
+}
+
+void SV_RecordClient( client_t* cl, char* basename ) {
+	char name[MAX_OSPATH];
 	char demoName[MAX_QPATH];
 
 	if ( cl->demorecording ) {
@@ -240,63 +432,967 @@ void SV_RecordClient( client_t* cl, char* basename ) {
 	cl->demoMaxDeltaFrames = 1;
 	cl->demoDeltaFrameCount = 0;
 
-	// write out the gamestate message
-	MSG_Init( &msg, bufData, sizeof( bufData ) );
+	SV_DemoIndexFree( cl );
+	sv_demoIndexes[cl - svs.clients].lastKeyframeTime = svs.time;
 
-	// NOTE, MRE: all server->client messages now acknowledge
-	MSG_WriteLong( &msg, cl->lastClientCommand );
+	sv_demoIndexes[cl - svs.clients].offset += SV_DemoWriteGameState( cl, &cl->demofile, cl->netchan.outgoingSequence );
 
-	SV_WriteGameState(&msg, cl);
+	// the rest of the demo file will be copied from net messages
+}
 
-	// write the client num
-	MSG_WriteLong( &msg, cl - svs.clients );
-	// write the checksum feed
-	MSG_WriteLong( &msg, sv.checksumFeed );
 
-	// finished writing the client packet
-	MSG_WriteByte( &msg, svc_EOF );
+/*
+====================
+SV_DemoSystemShutdown
 
-	*(int32_t*)0x13f39080 = *(int32_t*)msg.data;
-	compLen = 4 + MSG_WriteBitsCompress( 0, msg.data + 4 ,(byte*)0x13f39084 ,msg.cursize - 4);
+stop recording of all demos
+====================
+*/
+void SV_DemoSystemShutdown( ) {
 
-	len = 0;
-	FS_DemoWrite( &len, 1, &cl->demofile );
+	client_t *cl;
+	int i;
 
-	// write it to the demo file
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(cl->demorecording)
+			SV_StopRecord(cl);
+	}
+	SV_ServerDemoEndLevel();
+	FS_DemoWriterSync();
+}
 
-	// write the packet sequence
-	len = cl->netchan.outgoingSequence;
-	swlen = LittleLong( len );
-	FS_DemoWrite( &swlen, 4, &cl->demofile );
 
-	len = LittleLong( compLen );
-	FS_DemoWrite( &len, 4, &cl->demofile );
-	FS_DemoWrite((byte*)0x13f39080, compLen, &cl->demofile );
 
-	// the rest of the demo file will be copied from net messages
+/*
+============================================================================
+
+Instant replay
+
+With sv_replayBufferSize set every message going to a client in game also
+lands in a ring buffer of that client, in the same form as in a demo file.
+SV_SaveReplay writes the buffer out as a demo which starts at its oldest
+keyframe, so there is a recording from before anybody asked for it. Nothing
+touches the disk until then. The keyframes come from sv_demoKeyframeInterval.
+
+============================================================================
+*/
+
+#define REPLAY_MAXKEYFRAMES 256
+
+typedef struct{
+	byte *data;
+	int size;
+	unsigned int head;		//Both only grow, the position in data is modulo size
+	unsigned int tail;
+	unsigned int keyframes[REPLAY_MAXKEYFRAMES];	//head when the keyframe was added
+	int keyframeSequences[REPLAY_MAXKEYFRAMES];
+	int keyframeTimes[REPLAY_MAXKEYFRAMES];
+	int firstKeyframe;
+	int numKeyframes;
+	int lastKeyframeTime;
+	qboolean keyframePending;
+}replayBuffer_t;
+
+static replayBuffer_t sv_replays[MAX_CLIENTS];
+static cvar_t *sv_replayBufferSize;
+
+
+static void SV_ReplayCopyOut( replayBuffer_t *replay, unsigned int pos, void *out, int len ) {
+
+	int start = pos % replay->size;
+	int first = replay->size - start;
+
+	if(first >= len)
+	{
+		Com_Memcpy(out, replay->data + start, len);
+		return;
+	}
+	Com_Memcpy(out, replay->data + start, first);
+	Com_Memcpy((byte*)out + first, replay->data, len - first);
+}
+
+static void SV_ReplayCopyIn( replayBuffer_t *replay, const void *in, int len ) {
+
+	int start = replay->head % replay->size;
+	int first = replay->size - start;
+
+	if(first >= len)
+	{
+		Com_Memcpy(replay->data + start, in, len);
+	}else{
+		Com_Memcpy(replay->data + start, in, first);
+		Com_Memcpy(replay->data, (const byte*)in + first, len - first);
+	}
+	replay->head += len;
 }
 
+void SV_ReplayFree( client_t *cl ) {
+
+	replayBuffer_t *replay = &sv_replays[cl - svs.clients];
+
+	if(replay->data)
+		Z_Free(replay->data);
+
+	Com_Memset(replay, 0, sizeof(replayBuffer_t));
+}
+
+/*
+Drops everything buffered, called when the client gets a new gamestate since
+the messages before it are of no use then
+*/
+void SV_ReplayReset( client_t *cl ) {
+
+	replayBuffer_t *replay = &sv_replays[cl - svs.clients];
+
+	replay->head = replay->tail = 0;
+	replay->numKeyframes = 0;
+	replay->firstKeyframe = 0;
+	replay->keyframePending = qfalse;
+	replay->lastKeyframeTime = svs.time - sv_demoKeyframeInterval->integer * 1000;
+}
+
+qboolean SV_ReplayKeyframeDue( client_t *cl ) {
+
+	replayBuffer_t *replay = &sv_replays[cl - svs.clients];
+
+	if(replay->data == NULL || sv_demoKeyframeInterval->integer <= 0)
+		return qfalse;
+
+	return svs.time - replay->lastKeyframeTime >= sv_demoKeyframeInterval->integer * 1000;
+}
+
+//The message which gets built right now is not delta compressed
+void SV_ReplayKeyframe( client_t *cl ) {
+
+	replayBuffer_t *replay = &sv_replays[cl - svs.clients];
+
+	if(replay->data == NULL)
+		return;
+
+	replay->keyframePending = qtrue;
+	replay->lastKeyframeTime = svs.time;
+}
 
 /*
 ====================
-SV_DemoSystemShutdown
+SV_ReplayMessage
 
-stop recording of all demos
+Called for every message which goes to the client
 ====================
 */
-void SV_DemoSystemShutdown( ) {
+void SV_ReplayMessage( client_t *cl, byte *data, int dataLen ) {
+
+	replayBuffer_t *replay = &sv_replays[cl - svs.clients];
+	byte header[9];
+	int size, len, slot;
+
+	size = sv_replayBufferSize->integer * 1024;
+
+	if(replay->size != size)
+	{
+		SV_ReplayFree(cl);
+		if(size == 0)
+			return;
+
+		replay->data = Z_Malloc(size);
+		replay->size = size;
+		SV_ReplayReset(cl);
+		return; //The first keyframe gets requested by the next snapshot
+	}
+
+	if(size == 0)
+		return;
+
+	if(9 + dataLen > size / 2)
+	{
+		SV_ReplayReset(cl);
+		return;
+	}
+
+	//Make room by dropping the oldest messages
+	while(replay->head + 9 + dataLen - replay->tail > size)
+	{
+		SV_ReplayCopyOut(replay, replay->tail + 5, &len, 4);
+		replay->tail += 9 + LittleLong(len);
+	}
+	while(replay->numKeyframes > 0 && replay->keyframes[replay->firstKeyframe] - replay->tail > replay->head - replay->tail)
+	{
+		replay->firstKeyframe = (replay->firstKeyframe + 1) % REPLAY_MAXKEYFRAMES;
+		replay->numKeyframes--;
+	}
+
+	if(replay->keyframePending)
+	{
+		replay->keyframePending = qfalse;
+		if(replay->numKeyframes == REPLAY_MAXKEYFRAMES)
+		{
+			replay->firstKeyframe = (replay->firstKeyframe + 1) % REPLAY_MAXKEYFRAMES;
+			replay->numKeyframes--;
+		}
+		slot = (replay->firstKeyframe + replay->numKeyframes) % REPLAY_MAXKEYFRAMES;
+		replay->keyframes[slot] = replay->head;
+		replay->keyframeSequences[slot] = cl->netchan.outgoingSequence;
+		replay->keyframeTimes[slot] = svs.time;
+		replay->numKeyframes++;
+	}
+
+	header[0] = 0;
+	*(int32_t*)&header[1] = LittleLong( cl->netchan.outgoingSequence );
+	*(int32_t*)&header[5] = LittleLong( dataLen );
+	SV_ReplayCopyIn(replay, header, 9);
+	SV_ReplayCopyIn(replay, data, dataLen);
+}
+
+/*
+====================
+SV_SaveReplay
+
+Writes what is buffered for the client to demos/<basename>NNNN.dm_1
+====================
+*/
+qboolean SV_SaveReplay( client_t *cl, const char *basename ) {
+
+	replayBuffer_t *replay = &sv_replays[cl - svs.clients];
+	fileHandleData_t file;
+	char name[MAX_OSPATH];
+	char demoName[MAX_QPATH];
+	unsigned int pos, end;
+	byte chunk[4096];
+	int number, len;
+
+	if(replay->data == NULL || cl->state != CS_ACTIVE)
+	{
+		Com_Printf( "Nothing buffered for %s. Instant replays need sv_replayBufferSize\n", cl->name );
+		return qfalse;
+	}
+	if(replay->numKeyframes == 0)
+	{
+		Com_Printf( "No keyframe buffered for %s yet\n", cl->name );
+		return qfalse;
+	}
+
+	// scan for a free demo name
+	for ( number = 0 ; number <= 9999 ; number++ ) {
+		SV_DemoFilename( number, basename, demoName );
+		Com_sprintf( name, sizeof( name ), "demos/%s.dm_%d", demoName, 1 );
+
+		if ( !FS_DemoFileExists( name ) ) {
+			break;  // file doesn't exist
+		}
+	}
+
+	Com_Memset( &file, 0, sizeof(file) );
+	if(!FS_FOpenDemoFileWrite( name, &file ))
+	{
+		Com_Printf( "ERROR: couldn't open %s.\n", name );
+		return qfalse;
+	}
+
+	pos = replay->keyframes[replay->firstKeyframe];
+	end = replay->head;
+
+	SV_DemoWriteGameState( cl, &file, replay->keyframeSequences[replay->firstKeyframe] -1 );
+
+	while(pos != end)
+	{
+		len = end - pos;
+		if(len > sizeof(chunk))
+			len = sizeof(chunk);
+
+		SV_ReplayCopyOut(replay, pos, chunk, len);
+		FS_DemoWrite( chunk, len, &file );
+		pos += len;
+	}
+
+	chunk[0] = 0;
+	FS_DemoWrite( chunk, 1, &file );
+	len = -1;
+	FS_DemoWrite( &len, 4, &file );
+	FS_DemoWrite( &len, 4, &file );
+	FS_FCloseDemoFile( &file );
+
+	Com_Printf( "Saved the last %d seconds of %s to %s\n", (svs.time - replay->keyframeTimes[replay->firstKeyframe]) / 1000, cl->name, name );
+	return qtrue;
+}
+
+void SV_ReplayInit( void ) {
+
+	sv_replayBufferSize = Cvar_RegisterInt("sv_replayBufferSize", 0, 0, 16384, CVAR_ARCHIVE, "Kilobytes per client of the most recent messages kept in memory for savereplay. 0 disables the instant replay");
+}
+
+
+/*
+============================================================================
+
+Server demo
+
+One stream of the authoritative game state instead of a demo per client. Every
+server frame writes what changed since the previous frame: configstrings, the
+entityState_t of all linked entities and the playerState_t of all clients in
+game. The view of any player can be rebuilt from it offline. The same stream
+goes live to the spectator relays of sv_relay.c, with or without a file.
+
+Entities and players are delta coded against the last written copy as runs of
+changed 32 bit words, which is all most of them need when hardly anything moved.
+Every SVDEMO_KEYFRAME_MSEC a keyframe with the full state gets written so a
+player can start anywhere in the file.
+
+File layout, all little endian:
+	"CD4XSVDM" int version int sizeof(entityState_t) int sizeof(playerState_t)
+	int frameusec int maxclients string mapname string gametype
+	then frames:
+	byte SVDEMO_FRAME|SVDEMO_KEYFRAME int svs.time
+		{short cs short len char[len]} short -1
+		{short entnum byte SVDEMO_DELTA|SVDEMO_REMOVE [delta]} short -1
+		{byte clientnum byte SVDEMO_DELTA|SVDEMO_REMOVE [delta] [string name]} byte 0xff
+	byte SVDEMO_END
+	delta: {short firstword byte numwords int[numwords]} short -1
+	string: short len char[len]
+
+============================================================================
+*/
+
+#define SVDEMO_VERSION 1
+#define SVDEMO_KEYFRAME_MSEC 10000
+
+enum{
+	SVDEMO_END,
+	SVDEMO_FRAME,
+	SVDEMO_KEYFRAME
+};
+
+enum{
+	SVDEMO_DELTA,
+	SVDEMO_REMOVE
+};
+
+typedef struct{
+	qboolean active;			//The baselines below are held, for the file and/or the relays
+	qboolean recording;
+	qboolean relaying;
+	qboolean keyframePending;
+	fileHandleData_t file;
+	char name[MAX_OSPATH];
+	int startTime;
+	int lastFrameTime;
+	int lastKeyframeTime;
+	int frames;
+	entityState_t *entities;		//Last written state, MAX_GENTITIES
+	playerState_t *players;			//MAX_CLIENTS
+	byte entityValid[MAX_GENTITIES / 8];
+	qboolean playerValid[MAX_CLIENTS];
+	int configstrings[MAX_CONFIGSTRINGS];	//Last written string index, -1 if none got written yet
+}serverDemo_t;
+
+typedef struct{
+	byte data[256];
+	int len;
+}serverDemoHeader_t;
+
+static serverDemo_t svdemo;
+static cvar_t *sv_autoServerDemo;
+
+
+//The stream goes to the file and to the relays, sv_relay.c
+static void SV_ServerDemoWrite( const void *data, int len ) {
+
+	if ( svdemo.recording ) {
+		FS_DemoWrite( data, len, &svdemo.file );
+	}
+	if ( svdemo.relaying ) {
+		SV_RelayWrite( data, len );
+	}
+}
+
+static void SV_ServerDemoWriteString( const char *string ) {
+
+	short len;
+
+	len = strlen(string);
+	SV_ServerDemoWrite( &len, 2 );
+	SV_ServerDemoWrite( string, len );
+}
+
+/*
+Writes the runs of words which differ between from and to and updates from.
+Unchanged words are only skipped if the run breaks for more than one word, a
+run header costs as much as one word does
+*/
+static void SV_ServerDemoWriteDelta( int *from, const int *to, int numWords ) {
+
+	short first, end;
+	byte count;
+	int i, j;
+
+	for(i = 0; i < numWords; )
+	{
+		if(from[i] == to[i])
+		{
+			i++;
+			continue;
+		}
+
+		for(j = i +1; j < numWords && j - i < 255; j++)
+		{
+			if(from[j] == to[j])
+			{
+				if(j +1 >= numWords || from[j +1] == to[j +1])
+					break;
+			}
+		}
+
+		first = i;
+		count = j - i;
+		SV_ServerDemoWrite( &first, 2 );
+		SV_ServerDemoWrite( &count, 1 );
+		SV_ServerDemoWrite( &to[i], count * 4 );
+		Com_Memcpy( &from[i], &to[i], count * 4 );
+		i = j;
+	}
+	end = -1;
+	SV_ServerDemoWrite( &end, 2 );
+}
+
+static void SV_ServerDemoWriteConfigstrings( void ) {
+
+	char buffer[BIG_INFO_STRING];
+	short index;
+	int i;
+
+	for(i = 0; i < MAX_CONFIGSTRINGS; i++)
+	{
+		if(svdemo.configstrings[i] == sv.configstringIndex[i])
+			continue;
+
+		svdemo.configstrings[i] = sv.configstringIndex[i];
+		SV_GetConfigstring( i, buffer, sizeof(buffer) );
+
+		index = i;
+		SV_ServerDemoWrite( &index, 2 );
+		SV_ServerDemoWriteString( buffer );
+	}
+	index = -1;
+	SV_ServerDemoWrite( &index, 2 );
+}
+
+static void SV_ServerDemoWriteEntities( void ) {
+
+	sharedEntity_t *ent;
+	short num;
+	byte type;
+	int i;
+
+	for(i = 0; i < MAX_GENTITIES; i++)
+	{
+		ent = i < sv.num_entities ? SV_GentityNum( i ) : NULL;
+
+		if(ent == NULL || !ent->r.linked)
+		{
+			if(!(svdemo.entityValid[i >> 3] & (1 << (i & 7))))
+				continue;
+
+			svdemo.entityValid[i >> 3] &= ~(1 << (i & 7));
+			num = i;
+			type = SVDEMO_REMOVE;
+			SV_ServerDemoWrite( &num, 2 );
+			SV_ServerDemoWrite( &type, 1 );
+			continue;
+		}
+
+		if(!(svdemo.entityValid[i >> 3] & (1 << (i & 7))))
+		{
+			//Everything gets written for entities which were not there before
+			Com_Memset( &svdemo.entities[i], 0, sizeof(entityState_t) );
+			svdemo.entityValid[i >> 3] |= 1 << (i & 7);
+		}else if(!memcmp( &svdemo.entities[i], &ent->s, sizeof(entityState_t) )){
+			continue;
+		}
+
+		num = i;
+		type = SVDEMO_DELTA;
+		SV_ServerDemoWrite( &num, 2 );
+		SV_ServerDemoWrite( &type, 1 );
+		SV_ServerDemoWriteDelta( (int*)&svdemo.entities[i], (int*)&ent->s, sizeof(entityState_t) / 4 );
+	}
+	num = -1;
+	SV_ServerDemoWrite( &num, 2 );
+}
+
+static void SV_ServerDemoWritePlayers( void ) {
 
 	client_t *cl;
+	playerState_t *ps;
+	byte num, type;
 	int i;
 
 	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
 	{
-		if(cl->demorecording)
-			SV_StopRecord(cl);
+		if(cl->state != CS_ACTIVE)
+		{
+			if(!svdemo.playerValid[i])
+				continue;
+
+			svdemo.playerValid[i] = qfalse;
+			num = i;
+			type = SVDEMO_REMOVE;
+			SV_ServerDemoWrite( &num, 1 );
+			SV_ServerDemoWrite( &type, 1 );
+			continue;
+		}
+
+		ps = SV_GameClientNum( i );
+
+		if(!svdemo.playerValid[i])
+		{
+			Com_Memset( &svdemo.players[i], 0, sizeof(playerState_t) );
+			svdemo.playerValid[i] = qtrue;
+		}else if(!memcmp( &svdemo.players[i], ps, sizeof(playerState_t) )){
+			continue;
+		}
+
+		num = i;
+		type = SVDEMO_DELTA;
+		SV_ServerDemoWrite( &num, 1 );
+		SV_ServerDemoWrite( &type, 1 );
+		SV_ServerDemoWriteDelta( (int*)&svdemo.players[i], (int*)ps, sizeof(playerState_t) / 4 );
+		SV_ServerDemoWriteString( cl->name );
+	}
+	num = 0xff;
+	SV_ServerDemoWrite( &num, 1 );
+}
+
+//Forgets what got written, the next frame carries the complete state
+static void SV_ServerDemoResetBaselines( void ) {
+
+	int i;
+
+	Com_Memset( svdemo.entityValid, 0, sizeof(svdemo.entityValid) );
+	Com_Memset( svdemo.playerValid, 0, sizeof(svdemo.playerValid) );
+	for(i = 0; i < MAX_CONFIGSTRINGS; i++)
+		svdemo.configstrings[i] = -1;
+}
+
+static void SV_ServerDemoHeaderPut( serverDemoHeader_t *header, const void *data, int len ) {
+
+	if ( header->len + len > sizeof(header->data) ) {
+		return;
+	}
+	Com_Memcpy( &header->data[header->len], data, len );
+	header->len += len;
+}
+
+static void SV_ServerDemoHeaderPutString( serverDemoHeader_t *header, const char *string ) {
+
+	short len;
+
+	len = strlen(string);
+	SV_ServerDemoHeaderPut( header, &len, 2 );
+	SV_ServerDemoHeaderPut( header, string, len );
+}
+
+static void SV_ServerDemoBuildHeader( serverDemoHeader_t *header ) {
+
+	int value;
+
+	header->len = 0;
+	SV_ServerDemoHeaderPut( header, "CD4XSVDM", 8 );
+	value = SVDEMO_VERSION;
+	SV_ServerDemoHeaderPut( header, &value, 4 );
+	value = sizeof(entityState_t);
+	SV_ServerDemoHeaderPut( header, &value, 4 );
+	value = sizeof(playerState_t);
+	SV_ServerDemoHeaderPut( header, &value, 4 );
+	SV_ServerDemoHeaderPut( header, &sv.frameusec, 4 );
+	SV_ServerDemoHeaderPut( header, &sv_maxclients->integer, 4 );
+	SV_ServerDemoHeaderPutString( header, sv_mapname->string );
+	SV_ServerDemoHeaderPutString( header, sv.gametype );
+}
+
+//Everything which starts to read the stream needs the next frame to be a keyframe
+static void SV_ServerDemoActivate( void ) {
+
+	svdemo.keyframePending = qtrue;
+
+	if ( svdemo.active ) {
+		return;
+	}
+
+	svdemo.entities = Z_Malloc( MAX_GENTITIES * sizeof(entityState_t) + MAX_CLIENTS * sizeof(playerState_t) );
+	svdemo.players = (playerState_t*)&svdemo.entities[MAX_GENTITIES];
+	SV_ServerDemoResetBaselines( );
+
+	svdemo.active = qtrue;
+	svdemo.lastFrameTime = svs.time -1;
+	svdemo.lastKeyframeTime = svs.time;
+}
+
+static void SV_ServerDemoDeactivate( void ) {
+
+	if ( !svdemo.active ) {
+		return;
+	}
+
+	Z_Free( svdemo.entities );
+	svdemo.entities = NULL;
+	svdemo.players = NULL;
+	svdemo.active = qfalse;
+}
+
+static void SV_ServerDemoStopRelaying( void ) {
+
+	byte end;
+
+	if ( !svdemo.relaying ) {
+		return;
+	}
+
+	end = SVDEMO_END;
+	SV_RelayFrameBegin( qfalse );
+	SV_RelayWrite( &end, 1 );
+	SV_RelayFrameEnd( );
+	SV_RelayStreamEnd( );
+	svdemo.relaying = qfalse;
+}
+
+/*
+====================
+SV_ServerDemoStart
+====================
+*/
+void SV_ServerDemoStart( const char *basename ) {
+
+	char demoName[MAX_QPATH];
+	serverDemoHeader_t header;
+	int number;
+
+	if ( svdemo.recording ) {
+		Com_Printf( "Already recording a server demo to %s\n", svdemo.name );
+		return;
+	}
+
+	if ( sv.state != SS_GAME ) {
+		Com_Printf( "The server must be running a level to record\n" );
+		return;
+	}
+
+	if( !basename ) {
+		basename = va("server_%s_", sv_mapname->string);
+	}
+
+	// scan for a free demo name
+	for ( number = 0 ; number <= 9999 ; number++ ) {
+		SV_DemoFilename( number, basename, demoName );
+		Com_sprintf( svdemo.name, sizeof( svdemo.name ), "demos/%s.svdm", demoName );
+
+		if ( !FS_DemoFileExists( svdemo.name ) ) {
+			break;  // file doesn't exist
+		}
+	}
+
+	Com_Printf( "recording server demo to %s.\n", svdemo.name );
+	if(!FS_FOpenDemoFileWrite( svdemo.name, &svdemo.file ))
+	{
+		Com_Printf( "ERROR: couldn't open.\n" );
+		return;
+	}
+
+	SV_ServerDemoBuildHeader( &header );
+	FS_DemoWrite( header.data, header.len, &svdemo.file );
+
+	SV_ServerDemoActivate( );
+
+	svdemo.recording = qtrue;
+	svdemo.startTime = svs.time;
+	svdemo.frames = 0;
+}
+
+/*
+====================
+SV_ServerDemoStop
+====================
+*/
+void SV_ServerDemoStop( void ) {
+
+	byte end;
+
+	if ( !svdemo.recording ) {
+		return;
+	}
+
+	end = SVDEMO_END;
+	FS_DemoWrite( &end, 1, &svdemo.file );
+	FS_FCloseDemoFile( &svdemo.file );
+
+	Com_Printf( "Stopped server demo %s: %d frames, %d seconds\n", svdemo.name, svdemo.frames, (svs.time - svdemo.startTime) / 1000 );
+
+	svdemo.recording = qfalse;
+
+	if ( !svdemo.relaying ) {
+		SV_ServerDemoDeactivate( );
 	}
 }
 
+/*
+====================
+SV_ServerDemoEndLevel
 
+Ends the file and the stream of the relays, the baselines belong to this level
+====================
+*/
+void SV_ServerDemoEndLevel( void ) {
+
+	SV_ServerDemoStop( );
+	SV_ServerDemoStopRelaying( );
+	SV_ServerDemoDeactivate( );
+}
+
+/*
+====================
+SV_ServerDemoFrame
+
+Called after the game frames of a server frame ran
+====================
+*/
+void SV_ServerDemoFrame( void ) {
+
+	serverDemoHeader_t header;
+	byte type;
+
+	if ( !svdemo.recording && sv_autoServerDemo->boolean && sv.state == SS_GAME ) {
+		SV_ServerDemoStart( NULL );
+	}
+
+	if ( !svdemo.relaying && sv.state == SS_GAME && SV_RelayActive( ) ) {
+		SV_ServerDemoActivate( );
+		SV_ServerDemoBuildHeader( &header );
+		SV_RelayStreamStart( header.data, header.len );
+		svdemo.relaying = qtrue;
+	} else if ( svdemo.relaying && !SV_RelayActive( ) ) {
+		SV_ServerDemoStopRelaying( );
+		if ( !svdemo.recording ) {
+			SV_ServerDemoDeactivate( );
+		}
+	}
+
+	if ( !svdemo.active ) {
+		return;
+	}
+
+	if ( svs.time == svdemo.lastFrameTime ) {
+		return; //No game frame ran
+	}
+
+	svdemo.lastFrameTime = svs.time;
+
+	if ( svdemo.relaying && SV_RelayWaitingForKeyframe( ) ) {
+		svdemo.keyframePending = qtrue;
+	}
+
+	if ( svdemo.keyframePending || svs.time - svdemo.lastKeyframeTime >= SVDEMO_KEYFRAME_MSEC ) {
+		svdemo.keyframePending = qfalse;
+		svdemo.lastKeyframeTime = svs.time;
+		SV_ServerDemoResetBaselines( );
+		type = SVDEMO_KEYFRAME;
+	} else {
+		type = SVDEMO_FRAME;
+	}
+
+	if ( svdemo.relaying ) {
+		SV_RelayFrameBegin( type == SVDEMO_KEYFRAME );
+	}
+
+	SV_ServerDemoWrite( &type, 1 );
+	SV_ServerDemoWrite( &svs.time, 4 );
+
+	SV_ServerDemoWriteConfigstrings( );
+	SV_ServerDemoWriteEntities( );
+	SV_ServerDemoWritePlayers( );
+
+	if ( svdemo.relaying ) {
+		SV_RelayFrameEnd( );
+	}
+
+	if ( svdemo.recording ) {
+		svdemo.frames++;
+	}
+}
+
+static void SV_ServerRecord_f( void ) {
+
+	if ( Cmd_Argc() > 2 ) {
+		Com_Printf( "serverrecord <demoname>\n" );
+		return;
+	}
+	SV_ServerDemoStart( Cmd_Argc() == 2 ? Cmd_Argv( 1 ) : NULL );
+}
+
+static void SV_ServerStopRecord_f( void ) {
+
+	if ( !svdemo.recording ) {
+		Com_Printf( "Not recording a server demo.\n" );
+		return;
+	}
+	SV_ServerDemoStop( );
+}
+
+void SV_ServerDemoInit( void ) {
+
+	sv_autoServerDemo = Cvar_RegisterBool("sv_autoServerDemo", qfalse, CVAR_ARCHIVE, "Automatically record every level into one server demo which holds the state of all players");
+
+	Cmd_AddCommand ("serverrecord", SV_ServerRecord_f);
+	Cmd_AddCommand ("serverstoprecord", SV_ServerStopRecord_f);
+}
+
+
+
+
+/*
+============================================================================
+
+Background demo writer
+
+Full write buffers of the demo files get queued and a thread writes them to disk,
+so recording many clients does not cost frame time. The queue holds at most
+MAX_DEMOWRITER_BLOCKS buffers, the frame thread waits if it is full.
+All blocks are written by a single thread so they are always written in order.
+
+============================================================================
+*/
+
+#define MAX_DEMOWRITER_BLOCKS 256
+
+typedef struct{
+	FILE *file;
+	void *data; //Gets freed by the writer thread. NULL means close the file
+	int len;
+}demoWriteBlock_t;
+
+typedef struct{
+	demoWriteBlock_t blocks[MAX_DEMOWRITER_BLOCKS];
+	int head;
+	int tail;
+	qboolean busy;
+	qboolean started;
+	qboolean running;
+	int errors;
+	int reportederrors;
+	unsigned long long bytesFlushed;	//Main thread only
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+}demoWriter_t;
+
+static demoWriter_t demowriter = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+
+static void* FS_DemoWriterThread(void* arg){
+
+	demoWriteBlock_t block;
+	FILE *failedfile = NULL;
+
+	Sys_PlaceHelperThread("cod4x-demowriter");
+
+	pthread_mutex_lock(&demowriter.lock);
+
+	while(1)
+	{
+		while(demowriter.tail == demowriter.head){
+			demowriter.busy = qfalse;
+			pthread_cond_broadcast(&demowriter.done);
+			pthread_cond_wait(&demowriter.wake, &demowriter.lock);
+		}
+
+		demowriter.busy = qtrue;
+		block = demowriter.blocks[demowriter.tail % MAX_DEMOWRITER_BLOCKS];
+		demowriter.tail++;
+		pthread_cond_broadcast(&demowriter.done);
+
+		pthread_mutex_unlock(&demowriter.lock);
+
+		if(!block.data){
+			fclose(block.file);
+			if(failedfile == block.file)
+				failedfile = NULL;
+		}else{
+			//Once a write has failed the rest of this file is discarded
+			if(failedfile != block.file && fwrite(block.data, 1, block.len, block.file) != block.len){
+				failedfile = block.file;
+				pthread_mutex_lock(&demowriter.lock);
+				demowriter.errors++;
+				pthread_mutex_unlock(&demowriter.lock);
+			}
+			free(block.data);
+		}
+
+		pthread_mutex_lock(&demowriter.lock);
+	}
+	return NULL;
+}
+
+
+static qboolean FS_DemoWriterStart(){
+
+	if(demowriter.started)
+		return demowriter.running;
+
+	demowriter.started = qtrue;
+
+	if(pthread_create(&demowriter.thread, NULL, FS_DemoWriterThread, NULL) != 0){
+		Com_PrintWarning("Can not create the demo writer thread. Demos will be written synchronously\n");
+		return qfalse;
+	}
+	demowriter.running = qtrue;
+	return qtrue;
+}
+
+
+static void FS_DemoWriterQueue(FILE* file, void* data, int len){
+
+	demoWriteBlock_t *block;
+
+	pthread_mutex_lock(&demowriter.lock);
+
+	while(demowriter.head - demowriter.tail >= MAX_DEMOWRITER_BLOCKS)
+		pthread_cond_wait(&demowriter.done, &demowriter.lock);
+
+	block = &demowriter.blocks[demowriter.head % MAX_DEMOWRITER_BLOCKS];
+	block->file = file;
+	block->data = data;
+	block->len = len;
+	demowriter.head++;
+
+	pthread_cond_signal(&demowriter.wake);
+
+	if(demowriter.errors != demowriter.reportederrors){
+		demowriter.reportederrors = demowriter.errors;
+		pthread_mutex_unlock(&demowriter.lock);
+		Com_PrintWarning("Demo file write error. Some demos are incomplete\n");
+		return;
+	}
+	pthread_mutex_unlock(&demowriter.lock);
+}
+
+/*
+=================
+FS_DemoWriterSync
+
+Blocks until all queued demo data has been written and the files are closed
+=================
+*/
+void FS_DemoWriterSync(){
+
+	if(!demowriter.running)
+		return;
+
+	pthread_mutex_lock(&demowriter.lock);
+
+	while(demowriter.head != demowriter.tail || demowriter.busy)
+		pthread_cond_wait(&demowriter.done, &demowriter.lock);
+
+	pthread_mutex_unlock(&demowriter.lock);
+}
 
 
 /*
@@ -355,17 +1451,27 @@ qboolean FS_FCloseDemoFile( fileHandleData_t *fh ) {
 	// we didn't find it as a pak, so close it as a unique file
 
 	if (fh->handleFiles.file.o) {
-	    FS_DemoFlush( fh );
-	    if(fh->writebuffer){
-		Z_Free(fh->writebuffer);
+	    if(demowriter.running){
+		//The writer thread frees the buffer and closes the file
+		if(fh->writebuffer && fh->bufferPos > 0){
+		    FS_DemoWriterQueue(fh->handleFiles.file.o, fh->writebuffer, fh->bufferPos);
+		}else if(fh->writebuffer){
+		    free(fh->writebuffer);
+		}
+		FS_DemoWriterQueue(fh->handleFiles.file.o, NULL, 0);
+	    }else{
+		FS_DemoFlush( fh );
+		if(fh->writebuffer){
+		    free(fh->writebuffer);
+		}
+		fclose (fh->handleFiles.file.o);
 	    }
-	    fclose (fh->handleFiles.file.o);
 	    Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
 	    return qtrue;
 	}
 
 	if(fh->writebuffer){
-		Z_Free(fh->writebuffer);
+		free(fh->writebuffer);
 	}
 
 	Com_Memset( fh, 0, sizeof( fileHandleData_t ) );
@@ -407,8 +1513,12 @@ qboolean FS_FOpenDemoFileWrite( const char *filename, fileHandleData_t *fh ) {
 	if (!fh->handleFiles.file.o) {
 		return qfalse;
 	}
-	fh->writebuffer = Z_Malloc(FS_DEMOWRITEBUF_SIZE);
-	fh->bufferSize = FS_DEMOWRITEBUF_SIZE;
+	FS_DemoWriterStart();
+
+	fh->writebuffer = malloc(FS_DEMOWRITEBUF_SIZE);
+	if(fh->writebuffer){
+		fh->bufferSize = FS_DEMOWRITEBUF_SIZE;
+	}
 	return qtrue;
 }
 
@@ -466,7 +1576,8 @@ int FS_DemoWrite( const void *buffer, int len, fileHandleData_t *fh ) {
 =================
 FS_DemoFlush
 
-Writting buffer to file
+Writting buffer to file. An owned buffer gets handed to the writer thread
+and replaced by a new one
 =================
 */
 int FS_DemoFlush( fileHandleData_t *fh ) {
@@ -477,11 +1588,26 @@ int FS_DemoFlush( fileHandleData_t *fh ) {
 	FILE	*f;
 	const void *buffer = fh->writebuffer;
 	int len = fh->bufferPos;
+	void	*newbuffer;
 
 	if ( !fh ) {
 		return 0;
 	}
 
+	demowriter.bytesFlushed += len;
+
+	if ( demowriter.running ) {
+
+		if ( fh->bufferSize > 0 && len > 0 && (newbuffer = malloc(fh->bufferSize)) ) {
+			FS_DemoWriterQueue(fh->handleFiles.file.o, fh->writebuffer, len);
+			fh->writebuffer = newbuffer;
+			fh->bufferPos = 0;
+			return len;
+		}
+		//Whatever got queued before has to be written first
+		FS_DemoWriterSync();
+	}
+
 	f = fh->handleFiles.file.o;
 	buf = (byte *)buffer;
 
@@ -523,3 +1649,10 @@ void FS_DemoForceFlush(fileHandleData_t *fh){
 
 }
 
+void SV_DemoWriteMetrics( metricsBuf_t* buf ) {
+
+	Metrics_Declare(buf, "cod4x_demo_written_bytes_total", "counter", "Bytes of demo data handed to the demo writer");
+	Metrics_Printf(buf, "cod4x_demo_written_bytes_total %llu\n", demowriter.bytesFlushed);
+	Metrics_Declare(buf, "cod4x_demo_write_errors_total", "counter", "Demo writes which failed");
+	Metrics_Printf(buf, "cod4x_demo_write_errors_total %d\n", demowriter.errors);
+}
@@ -0,0 +1,242 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+
+/*
+========================================================================
+
+Geo and ASN enrichment of connecting clients
+
+The country, the autonomous system and the anonymous proxy flag of an
+address get looked up on a worker thread as soon as the client asks for
+a challenge. The connect comes at least one round trip later and finds
+them ready, nothing has to wait for the databases to be paged in on the
+frame thread.
+
+Results get kept for the whole /24 of an address. The databases only know
+IPv4, other addresses get no enrichment.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon_mem.h"
+#include "cvar.h"
+#include "server.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+#include "maxmind_geoip.h"
+
+#include <string.h>
+
+#define GEOINFO_CACHE_SIZE 512		//Must be a power of 2
+#define GEOINFO_CACHE_MSEC (30 * 60 * 1000)
+
+typedef struct{
+	unsigned int	net;			//Host order without the last octet
+	int		time;
+	qboolean	pending;
+	qboolean	valid;
+	geoInfo_t	info;
+}geoInfoEntry_t;
+
+typedef struct{
+	unsigned int	net;
+	unsigned long	ipnum;
+	geoInfo_t	info;			//Filled by the worker
+}geoInfoJob_t;
+
+static geoInfoEntry_t sv_geoInfoCache[GEOINFO_CACHE_SIZE];
+static cvar_t* sv_geoBlockProxies;
+static unsigned int sv_geoInfoLookups;
+static unsigned int sv_geoInfoHits;
+
+
+static qboolean SV_GeoInfoIPNum( netadr_t *adr, unsigned long *ipnum ) {
+
+	if(adr->type != NA_IP)
+		return qfalse;
+
+	*ipnum = ((unsigned long)adr->ip[0] << 24) | (adr->ip[1] << 16) | (adr->ip[2] << 8) | adr->ip[3];
+	return qtrue;
+}
+
+static geoInfoEntry_t* SV_GeoInfoEntry( unsigned int net ) {
+
+	return &sv_geoInfoCache[((net >> 8) ^ (net >> 20)) & (GEOINFO_CACHE_SIZE -1)];
+}
+
+static void SV_GeoInfoResolve( unsigned long ipnum, geoInfo_t *info ) {
+
+	_GeoIP_lookup(ipnum, &info->countryIndex, info->asn, sizeof(info->asn));
+	info->proxy = _GeoIP_is_anonymous_proxy(info->countryIndex);
+}
+
+//Worker thread, the databases are held
+static void SV_GeoInfoJob( void* arg ) {
+
+	geoInfoJob_t *job = arg;
+
+	SV_GeoInfoResolve(job->ipnum, &job->info);
+}
+
+static void SV_GeoInfoDone( void* arg ) {
+
+	geoInfoJob_t *job = arg;
+	geoInfoEntry_t *entry;
+
+	_GeoIP_release();
+
+	entry = SV_GeoInfoEntry(job->net);
+
+	//Another network might have taken the slot meanwhile
+	if(entry->pending && entry->net == job->net)
+	{
+		entry->info = job->info;
+		entry->time = Sys_Milliseconds();
+		entry->pending = qfalse;
+		entry->valid = qtrue;
+	}
+	Z_Free(job);
+}
+
+void SV_GeoInfoInit( void ) {
+
+	sv_geoBlockProxies = Cvar_RegisterBool("sv_geoBlockProxies", qfalse, 0, "Refuse connections from addresses which the GeoIP database lists as anonymous proxy");
+}
+
+/*
+==================
+SV_GeoInfoRequest
+
+Called for every getchallenge. Starts the lookup unless the network is known already
+==================
+*/
+void SV_GeoInfoRequest( netadr_t *from ) {
+
+	geoInfoEntry_t *entry;
+	geoInfoJob_t *job;
+	unsigned long ipnum;
+	unsigned int net;
+
+	if(!SV_GeoInfoIPNum(from, &ipnum) || Sys_IsLANAddress(from))
+		return;
+
+	net = ipnum & 0xffffff00;
+	entry = SV_GeoInfoEntry(net);
+
+	if(entry->net == net && (entry->pending || (entry->valid && Sys_Milliseconds() - entry->time < GEOINFO_CACHE_MSEC)))
+		return;
+
+	entry->net = net;
+	entry->pending = qtrue;
+	entry->valid = qfalse;
+
+	job = Z_Malloc(sizeof(geoInfoJob_t));
+	job->net = net;
+	job->ipnum = ipnum;
+
+	sv_geoInfoLookups++;
+	_GeoIP_hold();
+	Sys_AddJob(SV_GeoInfoJob, SV_GeoInfoDone, job);
+}
+
+/*
+==================
+SV_GeoInfoForAddress
+
+Fills in what is known about the address. Looks it up right away if the worker
+had no chance to do it. Returns qfalse for addresses the databases do not cover
+==================
+*/
+qboolean SV_GeoInfoForAddress( netadr_t *adr, geoInfo_t *info ) {
+
+	geoInfoEntry_t *entry;
+	unsigned long ipnum;
+	unsigned int net;
+
+	if(!SV_GeoInfoIPNum(adr, &ipnum))
+		return qfalse;
+
+	net = ipnum & 0xffffff00;
+	entry = SV_GeoInfoEntry(net);
+
+	if(entry->net == net && entry->valid)
+	{
+		sv_geoInfoHits++;
+		*info = entry->info;
+		return qtrue;
+	}
+
+	_GeoIP_hold();
+	SV_GeoInfoResolve(ipnum, info);
+	_GeoIP_release();
+
+	//A pending job for it will finish with the same answer
+	if(!entry->pending || entry->net != net)
+	{
+		entry->net = net;
+		entry->info = *info;
+		entry->time = Sys_Milliseconds();
+		entry->pending = qfalse;
+		entry->valid = qtrue;
+	}
+	return qtrue;
+}
+
+/*
+==================
+SV_GeoInfoDenied
+
+The ban rules on top of the enrichment, for SV_DirectConnect. Returns the reason or NULL
+==================
+*/
+const char* SV_GeoInfoDenied( netadr_t *from ) {
+
+	geoInfo_t info;
+
+	if(!sv_geoBlockProxies->boolean || Sys_IsLANAddress(from))
+		return NULL;
+
+	if(SV_GeoInfoForAddress(from, &info) && info.proxy)
+		return "Connections through anonymous proxies are not allowed on this server";
+
+	return NULL;
+}
+
+void SV_GeoInfoStatus_f( void ) {
+
+	int i, valid, pending;
+
+	for(i = 0, valid = 0, pending = 0; i < GEOINFO_CACHE_SIZE; i++)
+	{
+		if(sv_geoInfoCache[i].pending)
+			pending++;
+		else if(sv_geoInfoCache[i].valid)
+			valid++;
+	}
+	Com_Printf("GeoIP cache: %d networks, %d lookups pending, %u lookups done in the background, %u hits\n",
+		valid, pending, sv_geoInfoLookups, sv_geoInfoHits);
+}
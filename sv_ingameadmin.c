@@ -34,8 +34,10 @@
 
 #include <string.h>
 #include <stdarg.h>
+#include <ctype.h>
 
-#define SV_OUTPUTBUF_LENGTH 1024
+#define SV_OUTPUTBUF_LENGTH 8192
+#define SV_REDIRECT_RELIABLERESERVE 16	// Reliable commands left for the game when the output gets cut
 
 #ifndef MAXPRINTMSG
 #define MAXPRINTMSG 1024
@@ -43,8 +45,12 @@
 
 static cvar_t* sv_rconsys;
 
+#define ADMIN_HASH_SIZE 1024
+
 typedef struct adminPower_s {
     struct	adminPower_s *next;
+    struct	adminPower_s *nextUid;		//Chains of the lookup tables
+    struct	adminPower_s *nextGuid;
     char	name[16];
     int	uid;
     char guid[9];
@@ -63,7 +69,10 @@ typedef struct{
 
 static cmdInvoker_t cmdInvoker;
 static adminPower_t *adminpower;
+static adminPower_t *adminUidHash[ADMIN_HASH_SIZE];
+static adminPower_t *adminGuidHash[ADMIN_HASH_SIZE];
 static client_t *redirectClient;
+static qboolean redirectTruncated;
 static qboolean cmdSystemInitialized;
 
 int SV_RemoteCmdGetInvokerUid()
@@ -132,6 +141,97 @@ void SV_RemoteCmdInit(){
     cmdSystemInitialized = qtrue;
 }
 
+/*
+============
+Admin lookup tables
+
+Every admin stays on the adminpower list which keeps the order for the config file.
+It is also hashed by uid and by guid so power checks don't have to walk the list
+============
+*/
+
+static unsigned int SV_RemoteCmdHashUid(int uid){
+
+    return ((unsigned int)uid * 2654435761u) >> 22;
+}
+
+static unsigned int SV_RemoteCmdHashGuid(const char* guid){
+
+    unsigned int hash = 2166136261u;
+
+    while(*guid)
+    {
+        hash ^= (unsigned char)tolower(*guid);
+        hash *= 16777619u;
+        guid++;
+    }
+    return hash & (ADMIN_HASH_SIZE -1);
+}
+
+static void SV_RemoteCmdLinkAdmin(adminPower_t *admin){
+
+    unsigned int hash;
+
+    admin->next = adminpower;
+    adminpower = admin;
+
+    hash = SV_RemoteCmdHashUid(admin->uid);
+    admin->nextUid = adminUidHash[hash];
+    adminUidHash[hash] = admin;
+
+    hash = SV_RemoteCmdHashGuid(admin->guid);
+    admin->nextGuid = adminGuidHash[hash];
+    adminGuidHash[hash] = admin;
+}
+
+static void SV_RemoteCmdUnlinkAdmin(adminPower_t *admin){
+
+    adminPower_t **this;
+
+    for(this = &adminpower; *this ; this = &(*this)->next){
+        if(*this == admin){
+            *this = admin->next;
+            break;
+        }
+    }
+
+    for(this = &adminUidHash[SV_RemoteCmdHashUid(admin->uid)]; *this ; this = &(*this)->nextUid){
+        if(*this == admin){
+            *this = admin->nextUid;
+            break;
+        }
+    }
+
+    for(this = &adminGuidHash[SV_RemoteCmdHashGuid(admin->guid)]; *this ; this = &(*this)->nextGuid){
+        if(*this == admin){
+            *this = admin->nextGuid;
+            break;
+        }
+    }
+}
+
+static adminPower_t* SV_RemoteCmdFindAdminByUid(int uid){
+
+    adminPower_t *admin;
+
+    for(admin = adminUidHash[SV_RemoteCmdHashUid(uid)]; admin ; admin = admin->nextUid){
+        if(admin->uid == uid)
+            return admin;
+    }
+    return NULL;
+}
+
+static adminPower_t* SV_RemoteCmdFindAdminByGuid(const char* guid){
+
+    adminPower_t *admin;
+
+    for(admin = adminGuidHash[SV_RemoteCmdHashGuid(guid)]; admin ; admin = admin->nextGuid){
+        if(!Q_stricmp(admin->guid, guid))
+            return admin;
+    }
+    return NULL;
+}
+
 void SV_RemoteCmdClearAdminList()
 {
 
@@ -141,6 +241,8 @@ void SV_RemoteCmdClearAdminList()
         *this = admin->next;
         Z_Free(admin);
     }
+    Com_Memset(adminUidHash, 0, sizeof(adminUidHash));
+    Com_Memset(adminGuidHash, 0, sizeof(adminGuidHash));
 }
 
 
@@ -163,23 +265,16 @@ int SV_RemoteCmdGetClPower(client_t* cl){
     if(SV_UseUids()){
         if(uid < 1) return 1;
 
-        for(admin = adminpower; admin ; admin = admin->next){
-
-            if(admin->uid == uid){
-
-                return admin->power;
-            }
-        }
+        admin = SV_RemoteCmdFindAdminByUid(uid);
+        if(admin)
+            return admin->power;
 
     }else{
         if(cl->authentication != 1) return 1;
 
-        for(admin = adminpower; admin ; admin = admin->next){
-
-            if(!Q_stricmp(admin->guid, guid)){
-                return admin->power;
-            }
-        }
+        admin = SV_RemoteCmdFindAdminByGuid(guid);
+        if(admin)
+            return admin->power;
 
     }
 
@@ -198,12 +293,10 @@ int SV_RemoteCmdGetClPowerByUID(int uid){
     adminPower_t *admin;
     if(uid < 1) return 0;
 
-    for(admin = adminpower; admin ; admin = admin->next){
+    admin = SV_RemoteCmdFindAdminByUid(uid);
+    if(admin)
+        return admin->power;
 
-        if(admin->uid == uid){
-            return admin->power;
-        }
-    }
     return 1;
 }
 
@@ -229,6 +322,16 @@ void SV_ReliableSendRedirect(char *sendbuf, qboolean lastcommand){
 
     for(; remaining > 0;){			//We have to split the string into smaller packages of max 240 bytes
 						//This function tries to ensure that every package ends on the last possible linebreak for better formating
+	if(redirectTruncated)
+	    return;
+
+	//An overflow of the reliable commands would drop the client
+	if(redirectClient->reliableSequence - redirectClient->reliableAcknowledge >= MAX_RELIABLE_COMMANDS - SV_REDIRECT_RELIABLERESERVE){
+	    SV_SendServerCommand(redirectClient, "e \"^3Output truncated, use the rcon console for long outputs\"");
+	    redirectTruncated = qtrue;
+	    return;
+	}
+
 	maxlength = remaining;
 
 	if(maxlength > 240) maxlength = 240;
@@ -240,7 +343,7 @@ void SV_ReliableSendRedirect(char *sendbuf, qboolean lastcommand){
 	}
 	if(lastlinebreak > 0){ 
 	    i = lastlinebreak;	//found a linebreak and send everything until that position
-	    remaining -= i-1;
+	    remaining -= i+1;
 	    sendbuf += i+1;
 	    outputbuf[i+1] = 0x00;
 	} else {		//Not a linebreak found send full 240 chars
@@ -307,6 +410,7 @@ void SV_ExecuteRemoteCmd(int clientnum, const char *msg){
 	else
 		Com_Printf( "Command execution: %s   Invoked by: %s   InvokerGUID: %s Power: %i\n", buffer, cl->name, cl->pbguid, power);
 
+	redirectTruncated = qfalse;
 	Com_BeginRedirect(sv_outputbuf, SV_OUTPUTBUF_LENGTH, SV_ReliableSendRedirect);
 
 	i = cmdInvoker.currentCmdPower;
@@ -412,15 +516,14 @@ qboolean SV_RemoteCmdAddAdmin(int uid, char* guid, int power)
             return qfalse;
         }
 
-        admin = Z_Malloc(sizeof(adminPower_t));
+        admin = Z_TagMalloc(sizeof(adminPower_t), TAG_ADMINS);
 
         if(admin)
         {
             admin->uid = uid;
             admin->power = power;
-            admin->next = adminpower;
-            adminpower = admin;
             Q_strncpyz(admin->guid, guid, sizeof(admin->guid));
+            SV_RemoteCmdLinkAdmin(admin);
             return qtrue;
 
         }else{
@@ -496,6 +599,54 @@ void QDECL SV_PrintAdministrativeLog( const char *fmt, ... ) {
 
 }
 
+//Tells the other servers on this host about a changed admin. Power 0 removes it
+static void SV_RemoteCmdPublishAdmin(int uid, const char* guid, int power){
+
+    char infostring[MAX_INFO_STRING];
+
+    *infostring = 0;
+    if(uid > 0)
+        Info_SetValueForKey(infostring, "uid", va("%i", uid));
+    else
+        Info_SetValueForKey(infostring, "guid", guid);
+
+    Info_SetValueForKey(infostring, "power", va("%i", power));
+    SV_SharedStorePublish(SHAREDSTORE_ADMIN, infostring);
+}
+
+//Applies an admin change of another server on this host. It is not written to nvconfig
+void SV_RemoteCmdApplySharedAdmin(const char* infostring){
+
+    adminPower_t *admin;
+    char guid[9];
+    int uid;
+    int power;
+
+    uid = atoi(Info_ValueForKey(infostring, "uid"));
+    power = atoi(Info_ValueForKey(infostring, "power"));
+    Q_strncpyz(guid, Info_ValueForKey(infostring, "guid"), sizeof(guid));
+
+    if(uid > 0)
+        admin = SV_RemoteCmdFindAdminByUid(uid);
+    else if(strlen(guid) == 8)
+        admin = SV_RemoteCmdFindAdminByGuid(guid);
+    else
+        return;
+
+    if(power < 1){
+        if(admin){
+            SV_RemoteCmdUnlinkAdmin(admin);
+            Z_Free(admin);
+        }
+        return;
+    }
+
+    if(admin)
+        admin->power = power;
+    else
+        SV_RemoteCmdAddAdmin(uid, guid, power);
+}
+
 /*
 ============
 Cmd_RemoteSetAdmin_f
@@ -517,26 +668,26 @@ void SV_RemoteCmdSetAdmin(int uid, char* guid, int power)
 
         NV_ProcessBegin();
 
-        for(admin = adminpower ; admin ; admin = admin->next){
-            if(admin->uid == uid){
-                if(admin->power != power){
-                    admin->power = power;
+        admin = SV_RemoteCmdFindAdminByUid(uid);
+        if(admin){
+            if(admin->power != power){
+                admin->power = power;
 
-                    Com_Printf( "Admin power changed for: uid: %i to level: %i\n", uid, power);
-                    SV_PrintAdministrativeLog( "changed power of admin with uid: %i to new power: %i", uid, power);
-                }
-                NV_ProcessEnd();
-                return;
+                Com_Printf( "Admin power changed for: uid: %i to level: %i\n", uid, power);
+                SV_PrintAdministrativeLog( "changed power of admin with uid: %i to new power: %i", uid, power);
+                SV_RemoteCmdPublishAdmin(uid, NULL, power);
             }
+            NV_ProcessEnd();
+            return;
         }
 
-        this = Z_Malloc(sizeof(adminPower_t));
+        this = Z_TagMalloc(sizeof(adminPower_t), TAG_ADMINS);
         if(this){
             this->uid = uid;
             this->power = power;
-            this->next = adminpower;
-            adminpower = this;
+            SV_RemoteCmdLinkAdmin(this);
             Com_Printf( "Admin added: uid: %i level: %i\n", uid, power);
+            SV_RemoteCmdPublishAdmin(uid, NULL, power);
             SV_PrintAdministrativeLog( "added a new admin with uid: %i and power: %i", uid, power);
         }
 
@@ -554,28 +705,28 @@ void SV_RemoteCmdSetAdmin(int uid, char* guid, int power)
 
         NV_ProcessBegin();
 
-        for(admin = adminpower ; admin ; admin = admin->next)
+        admin = SV_RemoteCmdFindAdminByGuid(guid);
+        if(admin)
         {
-            if(!Q_stricmp(admin->guid, guid)){
-                if(admin->power != power){
-                    admin->power = power;
-
-                    Com_Printf( "Admin power changed for: guid: %s to level: %i\n", guid, power);
-                    SV_PrintAdministrativeLog( "changed power of admin with guid: %s to new power: %i", guid, power);
-                }
-                NV_ProcessEnd();
-                return;
+            if(admin->power != power){
+                admin->power = power;
+
+                Com_Printf( "Admin power changed for: guid: %s to level: %i\n", guid, power);
+                SV_PrintAdministrativeLog( "changed power of admin with guid: %s to new power: %i", guid, power);
+                SV_RemoteCmdPublishAdmin(0, guid, power);
             }
+            NV_ProcessEnd();
+            return;
         }
 
-        this = Z_Malloc(sizeof(adminPower_t));
+        this = Z_TagMalloc(sizeof(adminPower_t), TAG_ADMINS);
         if(this)
         {
             Q_strncpyz(this->guid, guid, sizeof(this->guid));
             this->power = power;
-            this->next = adminpower;
-            adminpower = this;
+            SV_RemoteCmdLinkAdmin(this);
             Com_Printf( "Admin added: guid: %s level: %i\n", guid, power);
+            SV_RemoteCmdPublishAdmin(0, guid, power);
             SV_PrintAdministrativeLog( "added a new admin with guid: %s and power: %i", guid, power);
         }
     }
@@ -594,7 +745,7 @@ Cmd_RemoteUnsetAdmin_f
 void SV_RemoteCmdUnsetAdmin(int uid, char* guid)
 {
 
-    adminPower_t *admin, **this;
+    adminPower_t *admin;
 
     if(SV_UseUids()){
 
@@ -605,18 +756,16 @@ void SV_RemoteCmdUnsetAdmin(int uid, char* guid)
 
         NV_ProcessBegin();
 
-        for(this = &adminpower, admin = *this; admin ; admin = *this)
+        admin = SV_RemoteCmdFindAdminByUid(uid);
+        if(admin)
         {
-
-            if(admin->uid == uid){
-                *this = admin->next;
-                Z_Free(admin);
-                NV_ProcessEnd();
-                Com_Printf( "User removed: uid: %i\n", uid);
-                SV_PrintAdministrativeLog( "removed admin with uid: %i", uid);
-                return;
-            }
-            this = &admin->next;
+            SV_RemoteCmdUnlinkAdmin(admin);
+            Z_Free(admin);
+            NV_ProcessEnd();
+            Com_Printf( "User removed: uid: %i\n", uid);
+            SV_RemoteCmdPublishAdmin(uid, NULL, 0);
+            SV_PrintAdministrativeLog( "removed admin with uid: %i", uid);
+            return;
         }
 
     }else{
@@ -632,18 +781,17 @@ void SV_RemoteCmdUnsetAdmin(int uid, char* guid)
         }
 
         NV_ProcessBegin();
-        for(this = &adminpower, admin = *this; admin ; admin = *this)
-        {
 
-            if(!Q_stricmp(admin->guid, guid)){
-                *this = admin->next;
-                Z_Free(admin);
-                NV_ProcessEnd();
-                Com_Printf( "User removed: guid: %s\n", guid);
-                SV_PrintAdministrativeLog( "removed admin with guid: %s", guid);
-                return;
-            }
-            this = &admin->next;
+        admin = SV_RemoteCmdFindAdminByGuid(guid);
+        if(admin)
+        {
+            SV_RemoteCmdUnlinkAdmin(admin);
+            Z_Free(admin);
+            NV_ProcessEnd();
+            Com_Printf( "User removed: guid: %s\n", guid);
+            SV_RemoteCmdPublishAdmin(0, guid, 0);
+            SV_PrintAdministrativeLog( "removed admin with guid: %s", guid);
+            return;
         }
 
     }
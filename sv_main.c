@@ -42,10 +42,15 @@
 #include "xassets.h"
 #include "nvconfig.h"
 #include "hl2rcon.h"
+#include "qcommon_profile.h"
+#include "qcommon_metrics.h"
 
 #include <string.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 cvar_t	*sv_protocol;
 cvar_t	*sv_privateClients;		// number of clients reserved for password
@@ -60,6 +65,16 @@ cvar_t	*sv_allowDownload;
 cvar_t	*sv_wwwDownload;
 cvar_t	*sv_wwwBaseURL;
 cvar_t	*sv_wwwDlDisconnected;
+cvar_t	*sv_maxUplinkRate;
+cvar_t	*sv_maxDownloadRate;
+cvar_t	*sv_snapshotShedLoad;
+cvar_t	*sv_userinfoInterval;
+cvar_t	*sv_snapshotShedDistance;
+cvar_t	*sv_pingEstimator;
+cvar_t	*sv_snapshotFps;
+cvar_t	*sv_maxCatchupFrames;
+cvar_t	*sv_maxConnectsPerFrame;
+cvar_t	*sv_hugePages;
 cvar_t	*sv_voice;
 cvar_t	*sv_voiceQuality;
 cvar_t	*sv_cheats;
@@ -85,6 +100,8 @@ cvar_t	*sv_statusfile;
 cvar_t	*g_friendlyPlayerCanBlock;
 cvar_t	*g_FFAPlayerCanBlock;
 cvar_t	*sv_autodemorecord;
+cvar_t	*sv_demoKeyframeInterval;
+cvar_t	*sv_demoIndex;
 cvar_t	*sv_demoCompletedCmd;
 
 cvar_t	*sv_master[MAX_MASTER_SERVERS];	// master server ip address
@@ -97,6 +114,8 @@ permServerStatic_t	psvs;	// persistant even if server does shutdown
 
 
 #define SV_OUTPUTBUF_LENGTH 1024
+#define SV_RCONOUTPUTBUF_LENGTH 16384	// The whole output of most commands, SV_FlushRedirect splits it
+#define SV_RCONPACKET_TEXT 1300		// Keeps "print" packets below the usual MTU
 
 /*
 cvar_t	*sv_fps = NULL;			// time rate for running non-clients
@@ -268,7 +287,7 @@ A NULL client will broadcast to all clients
 */
 void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
 	va_list		argptr;
-	byte		message[MAX_MSGLEN];
+	byte		message[MAX_STRING_CHARS];	//Longer commands get dropped anyway
 	client_t	*client;
 	int		j;
 
@@ -276,6 +295,7 @@ void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
 	Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
 	va_end (argptr);
 
+	//A truncated message is 1023 characters long
 	if ( strlen ((char *)message) > 1022 ) {
 		return;
 	}
@@ -300,6 +320,103 @@ void QDECL SV_SendServerCommand(client_t *cl, const char *fmt, ...) {
 }
 
 
+/*
+Hot client state, 4 clients share a cache line
+*/
+clientHot_t sv_clientHot[MAX_CLIENTS] __attribute__((aligned(64)));
+
+void SV_SetClientState( client_t *cl, clientState_t state ) {
+
+	cl->state = state;
+	sv_clientHot[cl - svs.clients].state = state;
+}
+
+void SV_ClientPacketTime( client_t *cl ) {
+
+	cl->lastPacketTime = svs.time;
+	sv_clientHot[cl - svs.clients].lastPacketTime = svs.time;
+}
+
+//Copies everything over after the binary or a memset changed the client
+void SV_SyncClientHot( client_t *cl ) {
+
+	clientHot_t *hot = &sv_clientHot[cl - svs.clients];
+
+	hot->state = cl->state;
+	hot->lastPacketTime = cl->lastPacketTime;
+	hot->ping = cl->ping;
+	hot->timeoutCount = cl->timeoutCount > 255 ? 255 : cl->timeoutCount;
+	hot->bot = cl->netchan.remoteAddress.type == NA_BOT;
+}
+
+void SV_SyncAllClientHot( void ) {
+
+	int i;
+
+	Com_Memset(sv_clientHot, 0, sizeof(sv_clientHot));
+
+	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
+		SV_SyncClientHot(&svs.clients[i]);
+	}
+}
+
+
+/*
+Client bitmasks, bit n stands for svs.clients[n]. A message for several clients gets
+formatted once and added to the clients of the mask, the masks themselves are a pass over
+the slots at most.
+*/
+clientMask_t SV_ClientMask( int minstate ) {
+
+	clientMask_t mask = 0;
+	int j;
+
+	for (j = 0; j < sv_maxclients->integer; j++) {
+		if ( sv_clientHot[j].state >= minstate ) {
+			mask |= CLIENTMASK_BIT(j);
+		}
+	}
+	return mask;
+}
+
+clientMask_t SV_TeamClientMask( int team, int minstate ) {
+
+	clientMask_t mask = 0;
+	client_t *cl;
+	int j;
+
+	for (j = 0, cl = svs.clients; j < sv_maxclients->integer; j++, cl++) {
+		if ( cl->state >= minstate && level.clients[j].sess.sessionTeam == team ) {
+			mask |= CLIENTMASK_BIT(j);
+		}
+	}
+	return mask;
+}
+
+void QDECL SV_SendServerCommandToMask( clientMask_t mask, const char *fmt, ... ) {
+	va_list		argptr;
+	byte		message[MAX_STRING_CHARS];
+	int		j;
+
+	va_start (argptr,fmt);
+	Q_vsnprintf ((char *)message, sizeof(message), fmt,argptr);
+	va_end (argptr);
+
+	//A truncated message is 1023 characters long
+	if ( strlen ((char *)message) > 1022 ) {
+		return;
+	}
+
+	while ( mask ) {
+		j = __builtin_ctzll(mask);
+		mask &= mask -1;
+		if ( j < sv_maxclients->integer ) {
+			SV_AddServerCommand_old(&svs.clients[j], 0, (char *)message );
+		}
+	}
+}
+
+
 /*
 ==============================================================================
 
@@ -321,9 +438,10 @@ struct leakyBucket_s {
 	unsigned long long	lastTime;
 	signed char	burst;
 
-	long		hash;
+	unsigned int	hash;
 
-	leakyBucket_t *prev, *next;
+	leakyBucket_t *prev, *next;		//Hash chain
+	leakyBucket_t *lruPrev, *lruNext;	//Least recently used first
 };
 
 
@@ -333,15 +451,38 @@ typedef struct{
     int max_hashes;
     leakyBucket_t *buckets;
     leakyBucket_t **bucketHashes;
+    leakyBucket_t *lruHead;
+    leakyBucket_t *lruTail;
+    uint64_t hashKey[2];
     int queryLimitsEnabled;
+    int ignorePeriod; //sv_queryIgnoreTime in msec
     leakyBucket_t infoBucket;
     leakyBucket_t statusBucket;
     leakyBucket_t rconBucket;
+    //Dropped requests for the metrics
+    unsigned int statusDrops;
+    unsigned int statusAddressDrops;
+    unsigned int infoDrops;
+    unsigned int infoAddressDrops;
+    unsigned int rconDrops;
+    unsigned long long now; //Set by SVC_QueryLock()
 }queryLimit_t;
 
 
     static queryLimit_t querylimit;
 
+//The query thread of sys_net.c uses the limits as well and takes the snapshot from SV_PublishQuerySnapshot
+static pthread_mutex_t sv_queryLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void SVC_QueryLock( void ) {
+	pthread_mutex_lock( &sv_queryLock );
+	querylimit.now = Sys_MicrosecondsLong();
+}
+
+static void SVC_QueryUnlock( void ) {
+	pthread_mutex_unlock( &sv_queryLock );
+}
+
 
 
 // This is deliberately quite large to make it more of an effort to DoS
@@ -353,9 +494,18 @@ SVC_RateLimitInit
 Init the rate limit system
 ================
 */
+static void SVC_RateLimitCvarChanged( cvar_t *var, void *arg ){
+
+	querylimit.ignorePeriod = sv_queryIgnoreTime->integer*1000;
+}
+
 static void SVC_RateLimitInit( ){
 
 	int bytes;
+	int i;
+
+	SVC_RateLimitCvarChanged( sv_queryIgnoreTime, NULL );
+	Cvar_AddChangeCallback( sv_queryIgnoreTime, SVC_RateLimitCvarChanged, NULL );
 
 	if(!sv_queryIgnoreMegs->integer)
 	{
@@ -367,35 +517,60 @@ static void SVC_RateLimitInit( ){
 	bytes = sv_queryIgnoreMegs->integer * 1024*1024;
 
 	querylimit.max_buckets = bytes / sizeof(leakyBucket_t);
-	querylimit.max_hashes = 4096; //static
+
+	//At least one hash slot per bucket keeps the chains short
+	for(querylimit.max_hashes = 4096; querylimit.max_hashes < querylimit.max_buckets; querylimit.max_hashes <<= 1);
 
 	int totalsize = querylimit.max_buckets * sizeof(leakyBucket_t) + querylimit.max_hashes * sizeof(leakyBucket_t*);
 
-	querylimit.buckets = Z_Malloc(totalsize);
+	querylimit.buckets = Z_TagMalloc(totalsize, TAG_QUERYLIMIT);
 
 	if(!querylimit.buckets)
 	{
 		Com_PrintError("QUERY LIMIT: System is out of memory. All queries are disabled\n");
 		querylimit.queryLimitsEnabled = -1;
+		return;
 	}
 
 	querylimit.bucketHashes = (leakyBucket_t**)&querylimit.buckets[querylimit.max_buckets];
+
+	//All buckets start unused on the LRU list
+	for(i = 0; i < querylimit.max_buckets; i++)
+	{
+		querylimit.buckets[i].lruPrev = i > 0 ? &querylimit.buckets[i -1] : NULL;
+		querylimit.buckets[i].lruNext = i < querylimit.max_buckets -1 ? &querylimit.buckets[i +1] : NULL;
+	}
+	querylimit.lruHead = &querylimit.buckets[0];
+	querylimit.lruTail = &querylimit.buckets[querylimit.max_buckets -1];
+
+	//A secret key stops attackers from picking addresses which all land in the same chain
+	Com_RandomBytes((byte*)querylimit.hashKey, sizeof(querylimit.hashKey));
+
 	Com_Printf("QUERY LIMIT: Querylimiting is enabled\n");
 	querylimit.queryLimitsEnabled = 1;
 }
 
 
-
 /*
 ================
 SVC_HashForAddress
+
+SipHash-2-4 of the address with the key from SVC_RateLimitInit
 ================
 */
-__optimize3 __regparm1 static long SVC_HashForAddress( netadr_t *address ) {
-	byte 		*ip = NULL;
-	size_t	size = 0;
-	int			i;
-	long		hash = 0;
+#define SIPROUND \
+	do { \
+		v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+		v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+		v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+		v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+	} while(0)
+
+__optimize3 __regparm1 static unsigned int SVC_HashForAddress( netadr_t *address ) {
+	byte		*ip = NULL;
+	size_t		size = 0;
+	size_t		i, j;
+	uint64_t	v0, v1, v2, v3, m, b;
 
 	switch ( address->type ) {
 		case NA_IP:  ip = address->ip;  size = 4; break;
@@ -403,14 +578,70 @@ __optimize3 __regparm1 static long SVC_HashForAddress( netadr_t *address ) {
 		default: break;
 	}
 
-	for ( i = 0; i < size; i++ ) {
-		hash += (long)( ip[ i ] ) * ( i + 119 );
+	v0 = querylimit.hashKey[0] ^ 0x736f6d6570736575ULL;
+	v1 = querylimit.hashKey[1] ^ 0x646f72616e646f6dULL;
+	v2 = querylimit.hashKey[0] ^ 0x6c7967656e657261ULL;
+	v3 = querylimit.hashKey[1] ^ 0x7465646279746573ULL;
+
+	b = (uint64_t)size << 56;
+
+	for ( i = 0; i + 8 <= size; i += 8 ) {
+		m = 0;
+		for ( j = 0; j < 8; j++ )
+			m |= (uint64_t)ip[ i + j ] << ( 8 * j );
+
+		v3 ^= m;
+		SIPROUND;
+		SIPROUND;
+		v0 ^= m;
 	}
 
-	hash = ( hash ^ ( hash >> 10 ) ^ ( hash >> 20 ) ^ psvs.randint);
-	hash &= ( querylimit.max_hashes - 1 );
+	for ( j = 0; i + j < size; j++ )
+		b |= (uint64_t)ip[ i + j ] << ( 8 * j );
 
-	return hash;
+	v3 ^= b;
+	SIPROUND;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	return (unsigned int)( v0 ^ v1 ^ v2 ^ v3 ) & ( querylimit.max_hashes - 1 );
+}
+
+#undef SIPROUND
+
+static void SVC_BucketUnlinkLRU( leakyBucket_t *bucket ) {
+
+	if ( bucket->lruPrev != NULL ) {
+		bucket->lruPrev->lruNext = bucket->lruNext;
+	} else {
+		querylimit.lruHead = bucket->lruNext;
+	}
+
+	if ( bucket->lruNext != NULL ) {
+		bucket->lruNext->lruPrev = bucket->lruPrev;
+	} else {
+		querylimit.lruTail = bucket->lruPrev;
+	}
+}
+
+//Marks the bucket as most recently used
+static void SVC_BucketTouch( leakyBucket_t *bucket ) {
+
+	if ( querylimit.lruTail == bucket )
+		return;
+
+	SVC_BucketUnlinkLRU( bucket );
+
+	bucket->lruPrev = querylimit.lruTail;
+	bucket->lruNext = NULL;
+	querylimit.lruTail->lruNext = bucket;
+	querylimit.lruTail = bucket;
 }
 
 /*
@@ -418,25 +649,33 @@ __optimize3 __regparm1 static long SVC_HashForAddress( netadr_t *address ) {
 SVC_BucketForAddress
 
 Find or allocate a bucket for an address
+Only the least recently used bucket is a candidate for reuse, so no packet costs more than one chain walk
 ================
 */
 __optimize3 __regparm3 static leakyBucket_t *SVC_BucketForAddress( netadr_t *address, int burst, int period ) {
 	leakyBucket_t		*bucket = NULL;
-	int			i;
-	long			hash = SVC_HashForAddress( address );
-	unsigned long long	now = com_uFrameTime;
+	unsigned int		hash;
+	unsigned long long	now = querylimit.now;
+	int			interval;
+
+	if ( address->type != NA_IP && address->type != NA_IP6 )
+		return NULL;
+
+	hash = SVC_HashForAddress( address );
 
 	for ( bucket = querylimit.bucketHashes[ hash ]; bucket; bucket = bucket->next ) {
 
 		switch ( bucket->type ) {
 			case NA_IP:
-				if ( memcmp( bucket->ipv._4, address->ip, 4 ) == 0 ) {
+				if ( address->type == NA_IP && memcmp( bucket->ipv._4, address->ip, 4 ) == 0 ) {
+					SVC_BucketTouch( bucket );
 					return bucket;
 				}
 				break;
 
 			case NA_IP6:
-				if ( memcmp( bucket->ipv._6, address->ip6, 16 ) == 0 ) {
+				if ( address->type == NA_IP6 && memcmp( bucket->ipv._6, address->ip6, 16 ) == 0 ) {
+					SVC_BucketTouch( bucket );
 					return bucket;
 				}
 				break;
@@ -447,61 +686,50 @@ __optimize3 __regparm3 static leakyBucket_t *SVC_BucketForAddress( netadr_t *add
 
 	}
 
-	for ( i = 0; i < querylimit.max_buckets; i++ ) {
-		int interval;
+	bucket = querylimit.lruHead;
 
-		bucket = &querylimit.buckets[ i ];
-		interval = now - bucket->lastTime;
+	if ( bucket->type != NA_BAD ) {
 
-		// Reclaim expired buckets
-		if ( bucket->lastTime > 0 && ( interval > ( burst * period ) || interval < 0 ) ) 
-		{
-			if ( bucket->prev != NULL ) {
-				bucket->prev->next = bucket->next;
-			} else {
-				querylimit.bucketHashes[ bucket->hash ] = bucket->next;
-			}
-
-			if ( bucket->next != NULL ) {
-				bucket->next->prev = bucket->prev;
-			}
+		// The oldest bucket is still in use, so are all the others
+		interval = now - bucket->lastTime;
+		if ( interval <= ( burst * period ) && interval >= 0 )
+			return NULL;
 
-			Com_Memset( bucket, 0, sizeof( leakyBucket_t ) );
+		// Reclaim the expired bucket
+		if ( bucket->prev != NULL ) {
+			bucket->prev->next = bucket->next;
+		} else {
+			querylimit.bucketHashes[ bucket->hash ] = bucket->next;
 		}
 
-		if ( bucket->type == NA_BAD ) {
-			bucket->type = address->type;
-			switch ( address->type ) {
-				case NA_IP:	bucket->ipv._4[0] = address->ip[0]; 
-						bucket->ipv._4[1] = address->ip[1];
-						bucket->ipv._4[2] = address->ip[2];
-						bucket->ipv._4[3] = address->ip[3];
-						break;
-
-				case NA_IP6: Com_Memcpy( bucket->ipv._6, address->ip6, 16 ); break;
+		if ( bucket->next != NULL ) {
+			bucket->next->prev = bucket->prev;
+		}
+	}
 
-				default: return NULL;
-			}
+	bucket->type = address->type;
+	if ( address->type == NA_IP ) {
+		Com_Memcpy( bucket->ipv._4, address->ip, 4 );
+	} else {
+		Com_Memcpy( bucket->ipv._6, address->ip6, 16 );
+	}
 
-			bucket->lastTime = now;
-			bucket->burst = 0;
-			bucket->hash = hash;
+	bucket->lastTime = now;
+	bucket->burst = 0;
+	bucket->hash = hash;
 
-			// Add to the head of the relevant hash chain
-			bucket->next = querylimit.bucketHashes[ hash ];
-			if ( querylimit.bucketHashes[ hash ] != NULL ) {
-				querylimit.bucketHashes[ hash ]->prev = bucket;
-			}
+	// Add to the head of the relevant hash chain
+	bucket->next = querylimit.bucketHashes[ hash ];
+	if ( querylimit.bucketHashes[ hash ] != NULL ) {
+		querylimit.bucketHashes[ hash ]->prev = bucket;
+	}
 
-			bucket->prev = NULL;
-			querylimit.bucketHashes[ hash ] = bucket;
+	bucket->prev = NULL;
+	querylimit.bucketHashes[ hash ] = bucket;
 
-			return bucket;
-		}
-	}
+	SVC_BucketTouch( bucket );
 
-	// Couldn't allocate a bucket for this address
-	return NULL;
+	return bucket;
 }
 
 
@@ -512,7 +740,7 @@ SVC_RateLimit
 */
 /*__optimize3*/ __attribute__((always_inline)) static qboolean SVC_RateLimit( leakyBucket_t *bucket, int burst, int period ) {
 	if ( bucket != NULL ) {
-		unsigned long long now = com_uFrameTime;
+		unsigned long long now = querylimit.now;
 		int interval = now - bucket->lastTime;
 		int expired = interval / period;
 		int expiredRemainder = interval % period;
@@ -562,149 +790,142 @@ __optimize3 __regparm3 static qboolean SVC_RateLimitAddress( netadr_t *from, int
 
 }
 
+//Same order as the metrics below
+void SVC_GetQueryDrops( unsigned int drops[5] ) {
+
+	drops[0] = querylimit.statusDrops;
+	drops[1] = querylimit.statusAddressDrops;
+	drops[2] = querylimit.infoDrops;
+	drops[3] = querylimit.infoAddressDrops;
+	drops[4] = querylimit.rconDrops;
+}
+
+void SVC_RateLimitWriteMetrics( metricsBuf_t* buf ) {
+
+	Metrics_Declare(buf, "cod4x_querylimit_drops_total", "counter", "Connectionless requests dropped by the query rate limits");
+	Metrics_Printf(buf, "cod4x_querylimit_drops_total{query=\"getstatus\",limit=\"global\"} %u\n", querylimit.statusDrops);
+	Metrics_Printf(buf, "cod4x_querylimit_drops_total{query=\"getstatus\",limit=\"address\"} %u\n", querylimit.statusAddressDrops);
+	Metrics_Printf(buf, "cod4x_querylimit_drops_total{query=\"getinfo\",limit=\"global\"} %u\n", querylimit.infoDrops);
+	Metrics_Printf(buf, "cod4x_querylimit_drops_total{query=\"getinfo\",limit=\"address\"} %u\n", querylimit.infoAddressDrops);
+	Metrics_Printf(buf, "cod4x_querylimit_drops_total{query=\"rcon\",limit=\"global\"} %u\n", querylimit.rconDrops);
+}
+
 
 /*
 ================
-SVC_Status
+Query response cache
 
-Responds with all the info that qplug or qspy can see about the server
-and all connected players.  Used for getting detailed information after
-the simple info query.
+getstatus and getinfo get asked for all the time by browsers and trackers while their
+content changes rarely. The responses are serialized once and reused until a client
+connects, leaves or changes its name, one of the cvars the server adds itself changes,
+or SV_QUERYCACHE_MSEC have passed. Scores and the serverinfo cvars of the game live
+inside the executable, the age limit is what picks those up.
 ================
 */
+#define SV_QUERYCACHE_MSEC 1000
 
-__optimize3 __regparm1 void SVC_Status( netadr_t *from ) {
-	char player[1024];
-	char status[MAX_MSGLEN];
-	int i;
-	client_t    *cl;
-	gclient_t *gclient;
-	int statusLength;
-	int playerLength;
-	char infostring[MAX_INFO_STRING];
+typedef struct{
+	qboolean	valid;
+	int		buildtime;
+	int		infolen;
+	int		playerslen;
+	char		info[MAX_INFO_STRING];
+	char		players[MAX_MSGLEN];
+}svStatusCache_t;
 
+typedef struct{
+	qboolean	valid;
+	int		buildtime;
+	int		infolen;
+	char		info[MAX_INFO_STRING];
+}svInfoCache_t;
 
-	// Allow getstatus to be DoSed relatively easily, but prevent
-	// excess outbound bandwidth usage when being flooded inbound
-	if ( SVC_RateLimit( &querylimit.statusBucket, 20, 20000 ) ) {
-	//	Com_DPrintf( "SVC_Status: overall rate limit exceeded, dropping request\n" );
-		return;
-	}
+static svStatusCache_t sv_statusCache;
+static svInfoCache_t sv_infoCache;
 
-	// Prevent using getstatus as an amplifier
-	if ( SVC_RateLimitAddress( from, 2, sv_queryIgnoreTime->integer*1000 ) ) {
-	//	Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n", NET_AdrToString( *from ) );
-		return;
-	}
+/*
+With net_queryThread getstatus and getinfo get answered on the query thread of sys_net.c.
+SV_Frame publishes copies of the caches for it whenever they would have been rebuilt, the
+thread holds a reference to the snapshot while it writes a response.
+*/
+typedef struct{
+	int		refcount;
+	int		masterServerId;
+	netadr_t	masters[MAX_MASTER_SERVERS][2];
+	svStatusCache_t	status;
+	svInfoCache_t	info;
+}svQuerySnapshot_t;
 
+static svQuerySnapshot_t *sv_querySnapshot;
+static qboolean sv_querySnapshotStale;
 
-	if(strlen(SV_Cmd_Argv(1)) > 128)
-		return;
 
-	strcpy( infostring, Cvar_InfoString( 0, (CVAR_SERVERINFO | CVAR_NORESTART)) );
-	// echo back the parameter to status. so master servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-	Info_SetValueForKey( infostring, "challenge", SV_Cmd_Argv( 1 ) );
+void SV_InvalidateQueryCache( void ) {
+	sv_statusCache.valid = qfalse;
+	sv_infoCache.valid = qfalse;
+	sv_querySnapshotStale = qtrue;
+}
+
+static void SVC_QueryCacheCvarChanged( cvar_t *var, void *arg ) {
+	SV_InvalidateQueryCache();
+}
+
+static void SVC_QueryCacheInit( void ) {
+	Cvar_AddChangeCallback( sv_hostname, SVC_QueryCacheCvarChanged, NULL );
+	Cvar_AddChangeCallback( sv_password, SVC_QueryCacheCvarChanged, NULL );
+	Cvar_AddChangeCallback( sv_authorizemode, SVC_QueryCacheCvarChanged, NULL );
+}
+
+// Adds the echoed challenge key the way Info_SetValueForKey would do it
+static int SVC_WriteChallenge( char *buf, int size, const char *challenge ) {
+
+	if ( !*challenge || strpbrk( challenge, "\\;\"" ) )
+		return 0;
+
+	return Com_sprintf( buf, size, "\\challenge\\%s", challenge );
+}
+
+static void SVC_BuildStatusCache( void ) {
+	char player[1024];
+	int i;
+	client_t    *cl;
+	gclient_t *gclient;
+	int playerLength;
+
+	Q_strncpyz( sv_statusCache.info, Cvar_InfoString( 0, (CVAR_SERVERINFO | CVAR_NORESTART)), sizeof( sv_statusCache.info ) );
 
 	if(*sv_password->string)
-	    Info_SetValueForKey( infostring, "pswrd", "1");
+	    Info_SetValueForKey( sv_statusCache.info, "pswrd", "1");
 
 	if(sv_authorizemode->integer == 1)		//Backward compatibility
-		Info_SetValueForKey( infostring, "type", "1");
+		Info_SetValueForKey( sv_statusCache.info, "type", "1");
 	else
-		Info_SetValueForKey( infostring, "type", va("%i", sv_authorizemode->integer));
+		Info_SetValueForKey( sv_statusCache.info, "type", va("%i", sv_authorizemode->integer));
 	// add "demo" to the sv_keywords if restricted
 
-	status[0] = 0;
-	statusLength = 0;
+	sv_statusCache.players[0] = 0;
+	sv_statusCache.playerslen = 0;
 
 	for ( i = 0, gclient = level.clients ; i < sv_maxclients->integer ; i++, gclient++ ) {
 		cl = &svs.clients[i];
 		if ( cl->state >= CS_CONNECTED ) {
-			Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n",
+			playerLength = Com_sprintf( player, sizeof( player ), "%i %i \"%s\"\n",
 						 gclient->pers.scoreboard.score, cl->ping, cl->name );
-			playerLength = strlen( player );
-			if ( statusLength + playerLength >= sizeof( status ) ) {
+			if ( sv_statusCache.playerslen + playerLength >= sizeof( sv_statusCache.players ) ) {
 				break;      // can't hold any more
 			}
-			strcpy( status + statusLength, player );
-			statusLength += playerLength;
+			Com_Memcpy( sv_statusCache.players + sv_statusCache.playerslen, player, playerLength +1 );
+			sv_statusCache.playerslen += playerLength;
 		}
 	}
-	NET_OutOfBandPrint( NS_SERVER, from, "statusResponse\n%s\n%s", infostring, status );
-}
-
 
-/*
-================
-SVC_Info
+	sv_statusCache.infolen = strlen( sv_statusCache.info );
+	sv_statusCache.buildtime = Sys_Milliseconds();
+	sv_statusCache.valid = qtrue;
+}
 
-Responds with a short info message that should be enough to determine
-if a user is interested in a server to do a full status
-================
-*/
-__optimize3 __regparm1 void SVC_Info( netadr_t *from ) {
+static void SVC_BuildInfoCache( void ) {
 	int		i, count, humans;
-	qboolean	masterserver;
-	char		infostring[MAX_INFO_STRING];
-	char*		s;
-
-	s = SV_Cmd_Argv(1);
-	masterserver = qfalse;
-
-	if(from->type == NA_IP)
-	{
-		for(i = 0; i < MAX_MASTER_SERVERS; i++)
-		{
-			if(NET_CompareAdr( from, &master_adr[i][0]))
-			{
-				masterserver = qtrue;
-				break;
-			}
-		}
-
-
-	}else{
-		for(i = 0; i < MAX_MASTER_SERVERS; i++)
-		{
-			if(NET_CompareAdr( from, &master_adr[i][1]))
-			{
-				masterserver = qtrue;
-				break;
-			}
-		}
-
-	}
-
-	if(!masterserver)
-	{
-		// Allow getstatus to be DoSed relatively easily, but prevent
-		// excess outbound bandwidth usage when being flooded inbound
-		if ( SVC_RateLimit( &querylimit.infoBucket, 100, 100000 ) ) {
-		//	Com_DPrintf( "SVC_Info: overall rate limit exceeded, dropping request\n" );
-			return;
-		}
-
-
-		// Prevent using getstatus as an amplifier
-		if ( SVC_RateLimitAddress( from, 4, sv_queryIgnoreTime->integer*1000 )) {
-		//	Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n", NET_AdrToString( *from ) );
-			return;
-		}
-		infostring[0] = 0;
-	}else{
-		infostring[0] = 0;
-		Info_SetValueForKey( infostring, "server_id", va("%i", psvs.masterServer_id));
-	}
-
-	/*
-	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
-	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
-	 */
-
-	// A maximum challenge length of 128 should be more than plenty.
-	if(strlen(SV_Cmd_Argv(1)) > 128)
-		return;
 
 	// don't count privateclients
 	count = humans = 0;
@@ -718,71 +939,397 @@ __optimize3 __regparm1 void SVC_Info( netadr_t *from ) {
 		}
 	}
 
-	// echo back the parameter to status. so servers can use it as a challenge
-	// to prevent timed spoofed reply packets that add ghost servers
-
-	Info_SetValueForKey( infostring, "challenge", s);
-
+	sv_infoCache.info[0] = 0;
 
-	//Info_SetValueForKey( infostring, "gamename", com_gamename->string );
+	//Info_SetValueForKey( sv_infoCache.info, "gamename", com_gamename->string );
 
-	Info_SetValueForKey(infostring, "protocol", "6");
+	Info_SetValueForKey(sv_infoCache.info, "protocol", "6");
 
-	Info_SetValueForKey( infostring, "hostname", sv_hostname->string );
+	Info_SetValueForKey( sv_infoCache.info, "hostname", sv_hostname->string );
 
 	if(sv_authorizemode->integer == 1)		//Backward compatibility
-		Info_SetValueForKey( infostring, "type", "1");
+		Info_SetValueForKey( sv_infoCache.info, "type", "1");
 	else
-		Info_SetValueForKey( infostring, "type", va("%i", sv_authorizemode->integer));
+		Info_SetValueForKey( sv_infoCache.info, "type", va("%i", sv_authorizemode->integer));
 
-	Info_SetValueForKey( infostring, "mapname", sv_mapname->string );
-	Info_SetValueForKey( infostring, "clients", va("%i", count) );
-	Info_SetValueForKey( infostring, "g_humanplayers", va("%i", humans));
-	Info_SetValueForKey( infostring, "sv_maxclients", va("%i", sv_maxclients->integer - sv_privateClients->integer ) );
-	Info_SetValueForKey( infostring, "gametype", g_gametype->string );
-	Info_SetValueForKey( infostring, "pure", va("%i", sv_pure->boolean ) );
-	Info_SetValueForKey( infostring, "build", va("%i", BUILD_NUMBER));
-	Info_SetValueForKey( infostring, "shortversion", Q3_VERSION );
+	Info_SetValueForKey( sv_infoCache.info, "mapname", sv_mapname->string );
+	Info_SetValueForKey( sv_infoCache.info, "clients", va("%i", count) );
+	Info_SetValueForKey( sv_infoCache.info, "g_humanplayers", va("%i", humans));
+	Info_SetValueForKey( sv_infoCache.info, "sv_maxclients", va("%i", sv_maxclients->integer - sv_privateClients->integer ) );
+	Info_SetValueForKey( sv_infoCache.info, "gametype", g_gametype->string );
+	Info_SetValueForKey( sv_infoCache.info, "pure", va("%i", sv_pure->boolean ) );
+	Info_SetValueForKey( sv_infoCache.info, "build", va("%i", BUILD_NUMBER));
+	Info_SetValueForKey( sv_infoCache.info, "shortversion", Q3_VERSION );
 
         if(*sv_password->string)
-	    Info_SetValueForKey( infostring, "pswrd", "1");
+	    Info_SetValueForKey( sv_infoCache.info, "pswrd", "1");
 	else
-	    Info_SetValueForKey( infostring, "pswrd", "0");
+	    Info_SetValueForKey( sv_infoCache.info, "pswrd", "0");
 
         if(g_cvar_valueforkey("scr_team_fftype")){
-	    Info_SetValueForKey( infostring, "ff", va("%i", g_cvar_valueforkey("scr_team_fftype")));
+	    Info_SetValueForKey( sv_infoCache.info, "ff", va("%i", g_cvar_valueforkey("scr_team_fftype")));
 	}
 
         if(g_cvar_valueforkey("scr_game_allowkillcam")){
-	    Info_SetValueForKey( infostring, "ki", "1");
+	    Info_SetValueForKey( sv_infoCache.info, "ki", "1");
 	}
 
         if(g_cvar_valueforkey("scr_hardcore")){
-	    Info_SetValueForKey( infostring, "hc", "1");
+	    Info_SetValueForKey( sv_infoCache.info, "hc", "1");
 	}
 
         if(g_cvar_valueforkey("scr_oldschool")){
-	    Info_SetValueForKey( infostring, "od", "1");
+	    Info_SetValueForKey( sv_infoCache.info, "od", "1");
 	}
-	Info_SetValueForKey( infostring, "hw", "1");
+	Info_SetValueForKey( sv_infoCache.info, "hw", "1");
 
         if(fs_game->string[0] == '\0' || sv_showasranked->boolean){
-	    Info_SetValueForKey( infostring, "mod", "0");
+	    Info_SetValueForKey( sv_infoCache.info, "mod", "0");
 	}else{
-	    Info_SetValueForKey( infostring, "mod", "1");
+	    Info_SetValueForKey( sv_infoCache.info, "mod", "1");
 	}
-	Info_SetValueForKey( infostring, "voice", va("%i", sv_voice->boolean ) );
-	Info_SetValueForKey( infostring, "pb", va("%i", sv_punkbuster->boolean) );
+	Info_SetValueForKey( sv_infoCache.info, "voice", va("%i", sv_voice->boolean ) );
+	Info_SetValueForKey( sv_infoCache.info, "pb", va("%i", sv_punkbuster->boolean) );
 
 	if( sv_maxPing->integer ) {
-		Info_SetValueForKey( infostring, "sv_maxPing", va("%i", sv_maxPing->integer) );
+		Info_SetValueForKey( sv_infoCache.info, "sv_maxPing", va("%i", sv_maxPing->integer) );
 	}
 
 	if( fs_game->string[0] != '\0' ) {
-		Info_SetValueForKey( infostring, "game", fs_game->string );
+		Info_SetValueForKey( sv_infoCache.info, "game", fs_game->string );
+	}
+
+	sv_infoCache.infolen = strlen( sv_infoCache.info );
+	sv_infoCache.buildtime = Sys_Milliseconds();
+	sv_infoCache.valid = qtrue;
+}
+
+
+static svQuerySnapshot_t *SVC_AcquireQuerySnapshot( void ) {
+	svQuerySnapshot_t *snapshot;
+
+	SVC_QueryLock();
+	snapshot = sv_querySnapshot;
+	if ( snapshot != NULL ) {
+		snapshot->refcount++;
+	}
+	SVC_QueryUnlock();
+	return snapshot;
+}
+
+static void SVC_ReleaseQuerySnapshot( svQuerySnapshot_t *snapshot ) {
+	qboolean last;
+
+	SVC_QueryLock();
+	last = --snapshot->refcount == 0;
+	SVC_QueryUnlock();
+
+	if ( last ) {
+		free( snapshot );
+	}
+}
+
+static void SVC_SetQuerySnapshot( svQuerySnapshot_t *snapshot ) {
+	svQuerySnapshot_t *old;
+
+	SVC_QueryLock();
+	old = sv_querySnapshot;
+	sv_querySnapshot = snapshot;
+	SVC_QueryUnlock();
+
+	if ( old != NULL ) {
+		SVC_ReleaseQuerySnapshot( old );
+	}
+}
+
+/*
+================
+SV_PublishQuerySnapshot
+
+Called every server frame, the snapshot only gets replaced if the caches would have been rebuilt
+================
+*/
+void SV_PublishQuerySnapshot( void ) {
+	svQuerySnapshot_t *snapshot;
+
+	if ( !NET_QueryThreadActive() ) {
+		if ( sv_querySnapshot != NULL )
+			SVC_SetQuerySnapshot( NULL );
+		return;
+	}
+
+	// Only this thread replaces the pointer
+	if ( sv_querySnapshot != NULL && !sv_querySnapshotStale && Sys_Milliseconds() - sv_querySnapshot->status.buildtime <= SV_QUERYCACHE_MSEC )
+		return;
+
+	snapshot = malloc( sizeof( svQuerySnapshot_t ) );
+	if ( snapshot == NULL )
+		return;
+
+	SVC_BuildStatusCache( );
+	SVC_BuildInfoCache( );
+
+	snapshot->refcount = 1;
+	snapshot->masterServerId = psvs.masterServer_id;
+	Com_Memcpy( snapshot->masters, master_adr, sizeof( snapshot->masters ) );
+	Com_Memcpy( &snapshot->status, &sv_statusCache, sizeof( snapshot->status ) );
+	Com_Memcpy( &snapshot->info, &sv_infoCache, sizeof( snapshot->info ) );
+
+	sv_querySnapshotStale = qfalse;
+	SVC_SetQuerySnapshot( snapshot );
+}
+
+// Returns qtrue if the getstatus has to be dropped
+static qboolean SVC_StatusLimited( netadr_t *from ) {
+	qboolean limited = qtrue;
+
+	SVC_QueryLock();
+
+	// Allow getstatus to be DoSed relatively easily, but prevent
+	// excess outbound bandwidth usage when being flooded inbound
+	if ( SVC_RateLimit( &querylimit.statusBucket, 20, 20000 ) ) {
+	//	Com_DPrintf( "SVC_Status: overall rate limit exceeded, dropping request\n" );
+		querylimit.statusDrops++;
+
+	// Prevent using getstatus as an amplifier
+	} else if ( SVC_RateLimitAddress( from, 2, querylimit.ignorePeriod ) ) {
+	//	Com_DPrintf( "SVC_Status: rate limit from %s exceeded, dropping request\n", NET_AdrToString( *from ) );
+		querylimit.statusAddressDrops++;
+
+	} else {
+		limited = qfalse;
+	}
+
+	SVC_QueryUnlock();
+	return limited;
+}
+
+// Returns qtrue if the getinfo has to be dropped
+static qboolean SVC_InfoLimited( netadr_t *from ) {
+	qboolean limited = qtrue;
+
+	SVC_QueryLock();
+
+	// Allow getstatus to be DoSed relatively easily, but prevent
+	// excess outbound bandwidth usage when being flooded inbound
+	if ( SVC_RateLimit( &querylimit.infoBucket, 100, 100000 ) ) {
+	//	Com_DPrintf( "SVC_Info: overall rate limit exceeded, dropping request\n" );
+		querylimit.infoDrops++;
+
+	// Prevent using getstatus as an amplifier
+	} else if ( SVC_RateLimitAddress( from, 4, querylimit.ignorePeriod )) {
+	//	Com_DPrintf( "SVC_Info: rate limit from %s exceeded, dropping request\n", NET_AdrToString( *from ) );
+		querylimit.infoAddressDrops++;
+
+	} else {
+		limited = qfalse;
+	}
+
+	SVC_QueryUnlock();
+	return limited;
+}
+
+static qboolean SVC_IsMasterServer( netadr_t *from, netadr_t masters[MAX_MASTER_SERVERS][2] ) {
+	int i;
+	int family = from->type == NA_IP ? 0 : 1;
+
+	for(i = 0; i < MAX_MASTER_SERVERS; i++)
+	{
+		if(NET_CompareAdr( from, &masters[i][family]))
+			return qtrue;
+	}
+	return qfalse;
+}
+
+static int SVC_WriteStatusResponse( char *packet, int size, const char *challenge, const svStatusCache_t *cache ) {
+	int len;
+	int playerslen;
+
+	len = Com_sprintf( packet, size, "\xff\xff\xff\xff" "statusResponse\n" );
+	// echo back the parameter to status. so master servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	len += SVC_WriteChallenge( packet + len, size - len, challenge );
+
+	Com_Memcpy( packet + len, cache->info, cache->infolen );
+	len += cache->infolen;
+	packet[len++] = '\n';
+
+	playerslen = cache->playerslen;
+	if ( len + playerslen > size )
+		playerslen = size - len;
+
+	Com_Memcpy( packet + len, cache->players, playerslen );
+	len += playerslen;
+	return len;
+}
+
+static int SVC_WriteInfoResponse( char *packet, int size, const char *challenge, qboolean masterserver, int serverId, const svInfoCache_t *cache ) {
+	int len;
+
+	len = Com_sprintf( packet, size, "\xff\xff\xff\xff" "infoResponse\n" );
+
+	if(masterserver)
+		len += Com_sprintf( packet + len, size - len, "\\server_id\\%i", serverId );
+
+	// echo back the parameter to status. so servers can use it as a challenge
+	// to prevent timed spoofed reply packets that add ghost servers
+	len += SVC_WriteChallenge( packet + len, size - len, challenge );
+
+	Com_Memcpy( packet + len, cache->info, cache->infolen );
+	len += cache->infolen;
+	return len;
+}
+
+
+/*
+================
+SVC_Status
+
+Responds with all the info that qplug or qspy can see about the server
+and all connected players.  Used for getting detailed information after
+the simple info query.
+================
+*/
+
+__optimize3 __regparm1 void SVC_Status( netadr_t *from ) {
+	char packet[MAX_MSGLEN];
+	int len;
+
+	if ( SVC_StatusLimited( from ) )
+		return;
+
+	if(strlen(SV_Cmd_Argv(1)) > 128)
+		return;
+
+	if ( !sv_statusCache.valid || Sys_Milliseconds() - sv_statusCache.buildtime > SV_QUERYCACHE_MSEC )
+		SVC_BuildStatusCache( );
+
+	len = SVC_WriteStatusResponse( packet, sizeof( packet ), SV_Cmd_Argv( 1 ), &sv_statusCache );
+
+	NET_SendPacket( NS_SERVER, len, packet, from );
+}
+
+
+/*
+================
+SVC_Info
+
+Responds with a short info message that should be enough to determine
+if a user is interested in a server to do a full status
+================
+*/
+__optimize3 __regparm1 void SVC_Info( netadr_t *from ) {
+	qboolean	masterserver;
+	char		packet[MAX_INFO_STRING + 512];
+	int		len;
+	char*		s;
+
+	s = SV_Cmd_Argv(1);
+	masterserver = SVC_IsMasterServer( from, master_adr );
+
+	if ( !masterserver && SVC_InfoLimited( from ) )
+		return;
+
+	/*
+	 * Check whether Cmd_Argv(1) has a sane length. This was not done in the original Quake3 version which led
+	 * to the Infostring bug discovered by Luigi Auriemma. See http://aluigi.altervista.org/ for the advisory.
+	 */
+
+	// A maximum challenge length of 128 should be more than plenty.
+	if(strlen(s) > 128)
+		return;
+
+	if ( !sv_infoCache.valid || Sys_Milliseconds() - sv_infoCache.buildtime > SV_QUERYCACHE_MSEC )
+		SVC_BuildInfoCache( );
+
+	len = SVC_WriteInfoResponse( packet, sizeof( packet ), s, masterserver, psvs.masterServer_id, &sv_infoCache );
+
+	NET_SendPacket( NS_SERVER, len, packet, from );
+}
+
+
+// Cmd_TokenizeString() for the query thread, returns the rest of the line
+static const char *SVC_QueryToken( const char *s, char *token, int size ) {
+	int n = 0;
+
+	while ( *s && *s <= ' ' )
+		s++;
+
+	if ( *s == '"' ) {
+		s++;
+		while ( *s && *s != '"' ) {
+			if ( n < size -1 )
+				token[n++] = *s;
+			s++;
+		}
+		if ( *s == '"' )
+			s++;
+	} else {
+		while ( *s > ' ' ) {
+			if ( n < size -1 )
+				token[n++] = *s;
+			s++;
+		}
 	}
+	token[n] = 0;
+	return s;
+}
+
+/*
+================
+SV_QueryThreadPacket
+
+Runs on the query thread of sys_net.c and answers from the published snapshot.
+Returns qfalse for everything that has to go to the main thread
+================
+*/
+qboolean SV_QueryThreadPacket( netadr_t *from, const byte *data, int len ) {
+	static char packet[MAX_MSGLEN];	//There is only one query thread
+	char line[MAX_STRING_CHARS];
+	char cmd[MAX_STRING_CHARS];
+	char challenge[MAX_STRING_CHARS];
+	svQuerySnapshot_t *snapshot;
+	qboolean status, masterserver;
+	const char *s;
+	int i, n;
+
+	if ( len < 4 || *(int *)data != -1 )
+		return qfalse;
+
+	for ( i = 4, n = 0; i < len && data[i] && data[i] != '\n' && n < sizeof( line ) -1; i++, n++ )
+		line[n] = data[i];
+	line[n] = 0;
+
+	s = SVC_QueryToken( line, cmd, sizeof( cmd ) );
+	SVC_QueryToken( s, challenge, sizeof( challenge ) );
+
+	if ( !Q_stricmp( cmd, "getstatus" ) )
+		status = qtrue;
+	else if ( !Q_stricmp( cmd, "getinfo" ) )
+		status = qfalse;
+	else
+		return qfalse;
 
-	NET_OutOfBandPrint( NS_SERVER, from, "infoResponse\n%s", infostring );
+	// The server is not running or has not published anything yet
+	snapshot = SVC_AcquireQuerySnapshot();
+	if ( snapshot == NULL )
+		return qfalse;
+
+	if ( status ) {
+		if ( !SVC_StatusLimited( from ) && strlen( challenge ) <= 128 ) {
+			len = SVC_WriteStatusResponse( packet, sizeof( packet ), challenge, &snapshot->status );
+			NET_QuerySendPacket( len, packet, from );
+		}
+	} else {
+		masterserver = SVC_IsMasterServer( from, snapshot->masters );
+		if ( ( masterserver || !SVC_InfoLimited( from ) ) && strlen( challenge ) <= 128 ) {
+			len = SVC_WriteInfoResponse( packet, sizeof( packet ), challenge, masterserver, snapshot->masterServerId, &snapshot->info );
+			NET_QuerySendPacket( len, packet, from );
+		}
+	}
+
+	SVC_ReleaseQuerySnapshot( snapshot );
+	return qtrue;
 }
 
 
@@ -793,7 +1340,34 @@ SVC_FlushRedirect
 ================
 */
 static void SV_FlushRedirect( char *outputbuf, qboolean lastcommand ) {
-	NET_OutOfBandPrint( NS_SERVER, &svse.redirectAddress, "print\n%s", outputbuf );
+
+	char *end, *cut;
+	char c;
+	int len;
+
+	len = strlen( outputbuf );
+
+	do {
+		// End the packet on the last line break that fits
+		end = outputbuf + len;
+		if ( len > SV_RCONPACKET_TEXT ) {
+			end = outputbuf + SV_RCONPACKET_TEXT;
+			for ( cut = end -1; cut > outputbuf; cut-- ) {
+				if ( *cut == '\n' ) {
+					end = cut +1;
+					break;
+				}
+			}
+		}
+
+		c = *end;
+		*end = 0;
+		NET_OutOfBandPrint( NS_SERVER, &svse.redirectAddress, "print\n%s", outputbuf );
+		*end = c;
+
+		len -= end - outputbuf;
+		outputbuf = end;
+	} while ( len > 0 );
 }
 
 /*
@@ -808,27 +1382,31 @@ Redirect all printfs
 __optimize3 __regparm2 static void SVC_RemoteCommand( netadr_t *from, msg_t *msg ) {
 	// TTimo - scaled down to accumulate, but not overflow anything network wise, print wise etc.
 	// (OOB messages are the bottleneck here)
-	char		sv_outputbuf[SV_OUTPUTBUF_LENGTH];
+	char		sv_outputbuf[SV_RCONOUTPUTBUF_LENGTH];
 	char *cmd_aux;
 
 	svse.redirectAddress = *from;
 
 	if ( strcmp (SV_Cmd_Argv(1), sv_rconPassword->string )) {
 		//Send only one deny answer out in 100 ms
+		SVC_QueryLock();
 		if ( SVC_RateLimit( &querylimit.rconBucket, 1, 100 ) ) {
 		//	Com_DPrintf( "SVC_RemoteCommand: rate limit exceeded for bad rcon\n" );
+			querylimit.rconDrops++;
+			SVC_QueryUnlock();
 			return;
 		}
+		SVC_QueryUnlock();
 
 		Com_Printf ("Bad rcon from %s\n", NET_AdrToString (from) );
-		Com_BeginRedirect (sv_outputbuf, SV_OUTPUTBUF_LENGTH, SV_FlushRedirect);
+		Com_BeginRedirect (sv_outputbuf, sizeof(sv_outputbuf), SV_FlushRedirect);
 		Com_Printf ("Bad rcon");
 		Com_EndRedirect ();
 		return;
 	}
 
 	if ( strlen( sv_rconPassword->string) < 8 ) {
-		Com_BeginRedirect (sv_outputbuf, SV_OUTPUTBUF_LENGTH, SV_FlushRedirect);
+		Com_BeginRedirect (sv_outputbuf, sizeof(sv_outputbuf), SV_FlushRedirect);
 		Com_Printf ("No rconpassword set on server or password is shorter than 8 characters.\n");
 		Com_EndRedirect ();
 		return;
@@ -868,7 +1446,7 @@ __optimize3 __regparm2 static void SVC_RemoteCommand( netadr_t *from, msg_t *msg
 
 	Com_Printf ("Rcon from %s: %s\n", NET_AdrToString (from), cmd_aux );
 
-	Com_BeginRedirect (sv_outputbuf, SV_OUTPUTBUF_LENGTH, SV_FlushRedirect);
+	Com_BeginRedirect (sv_outputbuf, sizeof(sv_outputbuf), SV_FlushRedirect);
 
 	if(!Q_stricmpn(cmd_aux, "pb_sv_", 6)){
 
@@ -907,7 +1485,7 @@ __optimize3 __regparm2 void SV_ConnectionlessPacket( netadr_t *from, msg_t *msg
 
 	c = SV_Cmd_Argv(0);
 
-	Com_DPrintf ("SV packet %s : %s\n", NET_AdrToString(from), c);
+	Com_DPrintfChannel(DPRINT_NET, 1, "SV packet %s : %s\n", NET_AdrToString(from), c);
 	//Most sensitive OOB commands first
         if (!Q_stricmp(c, "getstatus")) {
 		SVC_Status( from );
@@ -954,7 +1532,7 @@ __optimize3 __regparm2 void SV_ConnectionlessPacket( netadr_t *from, msg_t *msg
 		SV_GetChallenge(from);
 
 	} else {
-		Com_DPrintf ("bad connectionless packet from %s\n", NET_AdrToString (from));
+		Com_DPrintfChannel(DPRINT_NET, 1, "bad connectionless packet from %s\n", NET_AdrToString (from));
 	}
 	SV_Cmd_EndTokenizeString();
 	return;
@@ -1025,10 +1603,11 @@ __optimize3 __regparm2 void SV_PacketEvent( netadr_t *from, msg_t *msg ) {
 			cl->netchan.remoteAddress.port = from->port;
 		}
 		// make sure it is a valid, in sequence packet
-		if ( Netchan_Process( &cl->netchan, msg ) ) {
+		if ( SV_Netchan_Process( cl, msg ) ) {
 			// zombie clients still need to do the Netchan_Process
 			// to make sure they don't need to retransmit the final
 			// reliable message, but they don't do any other processing
+			SV_ClientPacketReceived( cl, cl->netchan.dropped );
 			cl->serverId = MSG_ReadByte( msg );
 			cl->messageAcknowledge = MSG_ReadLong( msg );
 
@@ -1046,7 +1625,7 @@ __optimize3 __regparm2 void SV_PacketEvent( netadr_t *from, msg_t *msg ) {
 			}
 			SV_Netchan_Decode(cl, &msg->data[msg->readcount], msg->cursize - msg->readcount);
 			if ( cl->state != CS_ZOMBIE ) {
-				cl->lastPacketTime = svs.time;  // don't timeout
+				SV_ClientPacketTime(cl);  // don't timeout
 				if(msg->cursize > 2000){
 					//This will fix up a buffer overflow.
 					//CoD4's message Decompress-function has no buffer overrun check
@@ -1093,11 +1672,13 @@ but not on every player enter or exit.
 #define HEARTBEAT_GAME "COD-4"
 #define HEARTBEAT_DEAD "flatline"
 #define	HEARTBEAT_USEC	180*1000*1000
+#define	HEARTBEAT_RESOLVE_USEC	1000*1000
 void SV_MasterHeartbeat(const char *message)
 {
 	int			i;
 	int			res;
 	int			netenabled;
+	qboolean		pending;
 
 	netenabled = net_enabled->integer;
 
@@ -1118,51 +1699,75 @@ void SV_MasterHeartbeat(const char *message)
 			continue;
 
 		// see if we haven't already resolved the name
-		// resolving usually causes hitches on win95, so only
-		// do it when needed
+		// resolving is done on a worker thread so the names are looked up
+		// again in the next frames until the lookup has finished
 		if(sv_master[i]->modified || (master_adr[i][0].type == NA_BAD && master_adr[i][1].type == NA_BAD))
 		{
-			sv_master[i]->modified = qfalse;
+			pending = qfalse;
 
 			if(netenabled & NET_ENABLEV4)
 			{
-				Com_Printf("Resolving %s (IPv4)\n", sv_master[i]->string);
 				//NA_IPANY For broadcasting to all interfaces
-				res = NET_StringToAdr(sv_master[i]->string, &master_adr[i][0], NA_IP);
+				res = NET_StringToAdrNonBlocking(sv_master[i]->string, &master_adr[i][0], NA_IP);
 
-				if(res == 2)
+				if(res == -1)
 				{
-					// if no port was specified, use the default master port
-					master_adr[i][0].port = BigShort(PORT_MASTER);
+					pending = qtrue;
 				}
-				master_adr[i][0].sock = 0;
-
-				if(res)
-					Com_Printf( "%s resolved to %s\n", sv_master[i]->string, NET_AdrToString(&master_adr[i][0]));
 				else
-					Com_Printf( "%s has no IPv4 address.\n", sv_master[i]->string);
+				{
+					if(res == 2)
+					{
+						// if no port was specified, use the default master port
+						master_adr[i][0].port = BigShort(PORT_MASTER);
+					}
+					master_adr[i][0].sock = 0;
+
+					if(res)
+						Com_Printf( "%s resolved to %s\n", sv_master[i]->string, NET_AdrToString(&master_adr[i][0]));
+					else
+						Com_Printf( "%s has no IPv4 address.\n", sv_master[i]->string);
+				}
 			}
 
 			if(netenabled & NET_ENABLEV6)
 			{
-				Com_Printf("Resolving %s (IPv6)\n", sv_master[i]->string);
-				res = NET_StringToAdr(sv_master[i]->string, &master_adr[i][1], NA_IP6);
+				res = NET_StringToAdrNonBlocking(sv_master[i]->string, &master_adr[i][1], NA_IP6);
 
-				if(res == 2)
+				if(res == -1)
 				{
-					// if no port was specified, use the default master port
-					master_adr[i][1].port = BigShort(PORT_MASTER);
+					pending = qtrue;
 				}
+				else
+				{
+					if(res == 2)
+					{
+						// if no port was specified, use the default master port
+						master_adr[i][1].port = BigShort(PORT_MASTER);
+					}
 
-				master_adr[i][1].sock = 0;
+					master_adr[i][1].sock = 0;
 
-				if(res)
-					Com_Printf( "%s resolved to %s\n", sv_master[i]->string, NET_AdrToString(&master_adr[i][1]));
-				else
-					Com_Printf( "%s has no IPv6 address.\n", sv_master[i]->string);
+					if(res)
+						Com_Printf( "%s resolved to %s\n", sv_master[i]->string, NET_AdrToString(&master_adr[i][1]));
+					else
+						Com_Printf( "%s has no IPv6 address.\n", sv_master[i]->string);
+				}
+			}
+
+			if(pending)
+			{
+				// try again soon. A master which has been resolved already gets its heartbeat now
+				svse.nextHeartbeatTime = com_uFrameTime + HEARTBEAT_RESOLVE_USEC;
+				if(master_adr[i][0].type == NA_BAD && master_adr[i][1].type == NA_BAD)
+					continue;
+			}
+			else
+			{
+				sv_master[i]->modified = qfalse;
 			}
 
-			if(master_adr[i][0].type == NA_BAD && master_adr[i][1].type == NA_BAD)
+			if(!pending && master_adr[i][0].type == NA_BAD && master_adr[i][1].type == NA_BAD)
 			{
 				// if the address failed to resolve, clear it
 				// so we don't take repeated dns hits
@@ -1339,6 +1944,11 @@ __cdecl void SV_Shutdown( const char *finalmsg ) {
 	// free server static data
 	Cvar_SetBool( com_sv_running, qfalse );
 
+	// queries go back to the main thread which ignores them now
+	SVC_SetQuerySnapshot( NULL );
+
+	SV_StatusBoardShutdown( );
+
 	memset( &svs, 0, sizeof( svs ) );
 	memset( &svse, 0, sizeof( svse ) );
 
@@ -1562,6 +2172,7 @@ void SV_InitServerId(){
 void SV_InitCvarsOnce(void){
 
 	cvar_t** tmp;
+	static char* pingEstimators[] = {"mean", "median", NULL};
 
 	sv_paused = Cvar_RegisterBool("sv_paused", qfalse, CVAR_ROM, "True if the server is paused");
 	sv_killserver = Cvar_RegisterBool("sv_killserver", qfalse, CVAR_ROM, "True if the server getting killed");
@@ -1582,12 +2193,22 @@ void SV_InitCvarsOnce(void){
 	sv_wwwDownload = Cvar_RegisterBool("sv_wwwDownload", qfalse, 1, "Enable http download");
 	sv_wwwBaseURL = Cvar_RegisterString("sv_wwwBaseURL", "", 1, "The base url to files for downloading from the HTTP-Server");
 	sv_wwwDlDisconnected = Cvar_RegisterBool("sv_wwwDlDisconnected", qfalse, 1, "Should clients stay connected while downloading from a HTTP-Server?");
+	sv_maxUplinkRate = Cvar_RegisterInt("sv_maxUplinkRate", 0, 0, 0x7fffffff, 1, "Maximum bytes per second sent to all clients together. 0 is no limit");
+	sv_userinfoInterval = Cvar_RegisterInt("sv_userinfoInterval", 1000, 0, 60000, 0, "Minimum msec between two userinfo changes of a client which get applied, the last one of those sent meanwhile waits. 0 applies every change right away");
+	sv_snapshotShedLoad = Cvar_RegisterInt("sv_snapshotShedLoad", 90, 0, 1000, 0, "Percent of the frame interval the work of a frame may take before spectators, dead and lonely players get fewer snapshots. 0 disables it");
+	sv_snapshotShedDistance = Cvar_RegisterInt("sv_snapshotShedDistance", 2500, 0, 100000, 0, "Players with nobody else within this distance count as distant for the snapshot shedding. 0 never treats players as distant");
+	sv_maxDownloadRate = Cvar_RegisterInt("sv_maxDownloadRate", 0, 0, 0x7fffffff, 1, "Maximum bytes per second of UDP downloads to all clients together, shared evenly between the downloading clients. 0 is no limit");
+	sv_pingEstimator = Cvar_RegisterEnum("sv_pingEstimator", pingEstimators, 0, 0, "How the ping of the scoreboard gets estimated from the last acknowledged frames. The median ignores single late frames");
+	sv_snapshotFps = Cvar_RegisterInt("sv_snapshotFps", 0, 0, 250, 1, "Maximum snapshots per second a client can request. 0 is up to sv_fps");
+	sv_maxCatchupFrames = Cvar_RegisterInt("sv_maxCatchupFrames", 5, 1, 1000, 1, "Maximum game frames run at once to catch up after the server fell behind. The rest of the time gets dropped");
+	sv_hugePages = Cvar_RegisterBool("sv_hugePages", qtrue, 1, "Back the client frames and snapshot buffers with transparent huge pages if the kernel allows it. Takes effect with the next map");
 
 	sv_voice = Cvar_RegisterBool("sv_voice", qfalse, 0xd, "Allow serverside voice communication");
 	sv_voiceQuality = Cvar_RegisterInt("sv_voiceQuality", 3, 0, 9, 8, "Voice quality");
 
 	sv_cheats = Cvar_RegisterBool("sv_cheats", qfalse, 0x18, "Enable cheats on the server");
 	sv_reconnectlimit = Cvar_RegisterInt("sv_reconnectlimit", 5, 0, 1800, 1, "Seconds to disallow a prior connected client to reconnect to the server");
+	sv_maxConnectsPerFrame = Cvar_RegisterInt("sv_maxConnectsPerFrame", 3, 0, 64, 1, "How many connecting clients get checked per server frame. The others retry a moment later. 0 is no limit");
 	sv_padPackets = Cvar_RegisterInt("sv_padPackets", 0, 0, 0x7fffffff, 0, "How many nop-bytes to add to insert into each snapshot");
 
 	sv_mapRotation = Cvar_RegisterString("sv_mapRotation", "", 0, "List of all maps server will play");
@@ -1612,6 +2233,8 @@ void SV_InitCvarsOnce(void){
 	sv_uptime = Cvar_RegisterString("uptime", "", CVAR_SERVERINFO | CVAR_ROM, "Time the server is running since last restart");
 	sv_autodemorecord = Cvar_RegisterBool("sv_autodemorecord", qfalse, CVAR_ARCHIVE, "Automatically start from each connected client a demo.");
 	sv_demoCompletedCmd = Cvar_RegisterString("sv_demoCompletedCmd", "", CVAR_ARCHIVE, "This program will be executed when a demo has been completed. The demofilename will be passed as argument.");
+	sv_demoKeyframeInterval = Cvar_RegisterInt("sv_demoKeyframeInterval", 10, 0, 600, CVAR_ARCHIVE, "Seconds between snapshots which get sent without delta compression to clients which are recorded. 0 keeps the intervals which double up to 1024 snapshots");
+	sv_demoIndex = Cvar_RegisterBool("sv_demoIndex", qtrue, CVAR_ARCHIVE, "Append the positions of the demo keyframes after the end of client demos. Players ignore it, disable it for tools which read the file up to its end");
 	sv_consayname = Cvar_RegisterString("sv_consayname", "^2Server: ^7", CVAR_ARCHIVE, "If the server broadcast text-messages this name will be used");
 	sv_contellname = Cvar_RegisterString("sv_contellname", "^5Server^7->^5PM: ^7", CVAR_ARCHIVE, "If the server broadcast text-messages this name will be used");
 
@@ -1688,14 +2311,216 @@ void SV_Init(){
         SV_AddOperatorCommands();
         SV_InitCvarsOnce();
         SVC_RateLimitInit( );
+        SVC_QueryCacheInit( );
+        Com_StartupPhase("banlist");
         SV_InitBanlist();
+        Com_StartupPhase("sv_init_rest");
         Init_CallVote();
         SV_RemoteCmdInit();
+        SV_SharedStoreInit();
+        SV_StatusBoardInit();
+        SV_MapPrefetchInit();
+        SV_GeoInfoInit();
+        SV_CodecBenchInit();
+        SV_ServerDemoInit();
+        SV_RelayInit();
+        SV_BotInit();
+        SV_ReplayInit();
         SV_InitServerId();
         Com_RandomBytes((byte*)&psvs.randint, sizeof(psvs.randint));
 
-}
+}
+
+
+/*
+Ping window of the clients. Every acknowledged frame of the last PACKET_BACKUP adds its round
+trip when the ack comes in and takes it out again once the frame slot gets reused for the next
+message, so SV_CalcPings only has to divide. The window keeps its own copy of the round trips,
+a frame slot which got changed behind our back only stays in the window until it is sent again.
+
+Jitter is the smoothed difference of consecutive round trips as RTP does it (RFC 3550), loss
+the share of the packets of the client which did not arrive, recent ones weigh more.
+*/
+#define SV_LOSS_HALFLIFE 256		//Packets after which the loss counters get halved
+
+typedef struct{
+	int	total;
+	int	count;
+	int	delta[PACKET_BACKUP];		//-1 while the frame is not acknowledged
+	int	lastDelta;			//Round trip of the last ack, -1 before the first one
+	int	jitter16;			//In 1/16 msec
+	qboolean changed;			//The percentiles have to be sorted out again
+	int	median;
+	unsigned int received;
+	unsigned int lost;
+	unsigned int recentReceived;
+	unsigned int recentLost;
+}clientPingWindow_t;
+
+static clientPingWindow_t sv_pingWindows[MAX_CLIENTS];
+
+
+void SV_ResetClientPing( client_t *cl ) {
+
+	clientPingWindow_t *window = &sv_pingWindows[cl - svs.clients];
+	int i;
+
+	Com_Memset(window, 0, sizeof(clientPingWindow_t));
+	window->lastDelta = -1;
+	for ( i = 0 ; i < PACKET_BACKUP ; i++ ) {
+		window->delta[i] = -1;
+	}
+}
+
+//Has to be called instead of filling the frame of the outgoing message directly
+void SV_ClientFrameSent( client_t *cl, int messageSize ) {
+
+	clientPingWindow_t *window = &sv_pingWindows[cl - svs.clients];
+	int slot = cl->netchan.outgoingSequence & PACKET_MASK;
+
+	if ( window->delta[slot] >= 0 ) {
+		window->total -= window->delta[slot];
+		window->count--;
+		window->delta[slot] = -1;
+		window->changed = qtrue;
+	}
+
+	cl->frames[slot].messageSize = messageSize;
+	cl->frames[slot].messageSent = Sys_Milliseconds();
+	cl->frames[slot].messageAcked = 0xFFFFFFFF;
+}
+
+//The client acknowledged cl->messageAcknowledge at ackTime
+void SV_ClientFrameAcked( client_t *cl, unsigned int ackTime ) {
+
+	clientPingWindow_t *window = &sv_pingWindows[cl - svs.clients];
+	int slot = cl->messageAcknowledge & PACKET_MASK;
+	clientSnapshot_t *frame = &cl->frames[slot];
+
+	if ( frame->messageAcked != 0xFFFFFFFF ) {
+		return;
+	}
+	frame->messageAcked = ackTime;
+
+	if ( window->delta[slot] >= 0 ) {
+		window->total -= window->delta[slot];
+		window->count--;
+	}
+	window->delta[slot] = frame->messageAcked - frame->messageSent;
+	if ( window->delta[slot] < 0 ) {
+		window->delta[slot] = 0;
+	}
+	window->total += window->delta[slot];
+	window->count++;
+	window->changed = qtrue;
+
+	if ( window->lastDelta >= 0 ) {
+		window->jitter16 += abs(window->delta[slot] - window->lastDelta) - (window->jitter16 >> 4);
+	}
+	window->lastDelta = window->delta[slot];
+}
+
+//A packet of the client got through Netchan_Process, dropped is the number of packets missing in front of it
+void SV_ClientPacketReceived( client_t *cl, int dropped ) {
+
+	clientPingWindow_t *window = &sv_pingWindows[cl - svs.clients];
+
+	if ( dropped < 0 ) {
+		dropped = 0;
+	}
+	window->received++;
+	window->lost += dropped;
+	window->recentReceived++;
+	window->recentLost += dropped;
+
+	if ( window->recentReceived + window->recentLost > SV_LOSS_HALFLIFE ) {
+		window->recentReceived /= 2;
+		window->recentLost /= 2;
+	}
+}
+
+static int QDECL SV_ComparePingDeltas( const void *a, const void *b ) {
+	return *(const int*)a - *(const int*)b;
+}
+
+//Sorted round trips of the window, returns how many there are
+static int SV_SortedPingDeltas( clientPingWindow_t *window, int *sorted ) {
+
+	int i, count;
+
+	for ( i = 0, count = 0 ; i < PACKET_BACKUP ; i++ ) {
+		if ( window->delta[i] >= 0 ) {
+			sorted[count++] = window->delta[i];
+		}
+	}
+	qsort(sorted, count, sizeof(int), SV_ComparePingDeltas);
+	return count;
+}
+
+static int SV_PingPercentile( const int *sorted, int count, int percent ) {
+
+	int index;
+
+	if ( count == 0 ) {
+		return 999;
+	}
+	index = (count * percent + 99) / 100 - 1;
+	if ( index < 0 ) {
+		index = 0;
+	}
+	return sorted[index] > 999 ? 999 : sorted[index];
+}
+
+void SV_GetClientNetStats( client_t *cl, clientNetStats_t *stats ) {
+
+	clientPingWindow_t *window = &sv_pingWindows[cl - svs.clients];
+	int sorted[PACKET_BACKUP];
+	int count;
+
+	count = SV_SortedPingDeltas(window, sorted);
+
+	stats->ping = cl->ping;
+	stats->mean = count ? window->total / count : 999;
+	if ( stats->mean > 999 ) {
+		stats->mean = 999;
+	}
+	stats->p50 = SV_PingPercentile(sorted, count, 50);
+	stats->p95 = SV_PingPercentile(sorted, count, 95);
+	stats->jitter = window->jitter16 >> 4;
+	stats->samples = count;
+	stats->received = window->received;
+	stats->lost = window->lost;
+	if ( window->recentReceived + window->recentLost > 0 ) {
+		stats->loss = (float)window->recentLost / (window->recentReceived + window->recentLost);
+	} else {
+		stats->loss = 0.0f;
+	}
+}
+
+void SV_NetStatus_f( void ) {
+
+	clientNetStats_t stats;
+	client_t *cl;
+	int i;
+
+	if ( !com_sv_running->boolean ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	Com_Printf ("num ping mean  p50  p95 jitter  loss%%   received     lost name\n");
+	Com_Printf ("--- ---- ---- ---- ---- ------ ------ ---------- -------- --------------------------------\n");
+
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
 
+		if ( cl->state < CS_CONNECTED || cl->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+		SV_GetClientNetStats(cl, &stats);
+		Com_Printf("%3i %4i %4i %4i %4i %6i %6.2f %10u %8u %s\n", i, stats.ping, stats.mean, stats.p50, stats.p95,
+			stats.jitter, stats.loss * 100.0f, stats.received, stats.lost, cl->name);
+	}
+}
 
 /*
 ===================
@@ -1705,46 +2530,48 @@ Updates the cl->ping variables
 ===================
 */
 void SV_CalcPings( void ) {
-	int i, j;
+	int i;
 	client_t    *cl;
-	int total, count;
-	int delta;
-
-	for ( i = 0 ; i < sv_maxclients->integer ; i++ ) {
-		cl = &svs.clients[i];
-
-		if ( cl->state != CS_ACTIVE ) {
-			cl->ping = -1;
-			continue;
-		}
-		if ( !cl->gentity ) {
-			cl->ping = -1;
-			continue;
-		}
-		if ( cl->netchan.remoteAddress.type == NA_BOT ) {
-			cl->ping = 0;
-			cl->lastPacketTime = svs.time;
-			continue;
-		}
-
-		total = 0;
-		count = 0;
-		for ( j = 0 ; j < PACKET_BACKUP ; j++ ) {
-			if ( cl->frames[j].messageAcked == 0xFFFFFFFF ) {
-				continue;
-			}
-			delta = cl->frames[j].messageAcked - cl->frames[j].messageSent;
-			count++;
-			total += delta;
-		}
-		if ( !count ) {
-			cl->ping = 999;
+	clientHot_t *hot;
+	clientPingWindow_t *window;
+	int sorted[PACKET_BACKUP];
+	int count;
+	int ping;
+
+	for ( i = 0, hot = sv_clientHot ; i < sv_maxclients->integer ; i++, hot++ ) {
+
+		// client_t only gets touched for clients in game or when the ping changes
+		if ( hot->state != CS_ACTIVE ) {
+			ping = -1;
+		} else if ( !svs.clients[i].gentity ) {
+			ping = -1;
+		} else if ( hot->bot ) {
+			ping = 0;
+			SV_ClientPacketTime(&svs.clients[i]);
 		} else {
-			cl->ping = total / count;
-			if ( cl->ping > 999 ) {
-				cl->ping = 999;
+			window = &sv_pingWindows[i];
+			if ( !window->count ) {
+				ping = 999;
+			} else if ( sv_pingEstimator->integer == 1 ) {
+				if ( window->changed ) {
+					count = SV_SortedPingDeltas(window, sorted);
+					window->median = SV_PingPercentile(sorted, count, 50);
+					window->changed = qfalse;
+				}
+				ping = window->median;
+			} else {
+				ping = window->total / window->count;
+				if ( ping > 999 ) {
+					ping = 999;
+				}
 			}
 		}
+
+		if ( hot->ping != ping ) {
+			cl = &svs.clients[i];
+			cl->ping = ping;
+			hot->ping = ping;
+		}
 	}
 }
 
@@ -1787,18 +2614,120 @@ typedef struct{
 ===============
 */
 
+/*
+Everything of the gamestate behind the reliable sequence is the same for all clients as long as
+the configstrings and baselines don't change. It gets encoded once and copied into the gamestate
+of every client. Configstrings are identified by their content because string indices get
+reused once a string is freed, baselines only change on level load.
+*/
+static struct{
+	qboolean	valid;
+	unsigned int	hash;
+	unsigned short	unkConfigIndex;
+	unsigned short	configstringIndex[MAX_CONFIGSTRINGS];
+	int		length;
+	int		bit;
+	byte		data[MAX_MSGLEN];
+}sv_gameStateCache;
+
+void SV_InvalidateGameStateCache( void ) {
+
+	sv_gameStateCache.valid = qfalse;
+}
+
+static unsigned int SV_HashConfigstrings( void ) {
+
+	unsigned int hash = 2166136261u;
+	const byte *s;
+	int i;
+
+	for(i = 0; i < MAX_CONFIGSTRINGS; i++)
+	{
+		for(s = (const byte*)SL_ConvertToString(sv.configstringIndex[i]); *s; s++)
+		{
+			hash ^= *s;
+			hash *= 16777619u;
+		}
+		hash ^= 0xff;	//Separator so moved characters change the hash
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+//Player baselines get their solid bits changed depending on who is looking
+static qboolean SV_BaselinesAreShared( void ) {
+
+	entityState_t *base;
+	int i;
+
+	for(i = 0; i < 64; i++)
+	{
+		base = &sv.svEntities[i].baseline;
+		if(base->number && (base->solid & PLAYER_SOLIDMASK))
+			return qfalse;
+	}
+	return qtrue;
+}
+
+static void SV_WriteGameStateBody( msg_t* msg, int clnum );
+
 void SV_WriteGameState( msg_t* msg, client_t* cl ) {
 
+	msg_t cachemsg;
+	unsigned int hash;
+
+	MSG_WriteByte( msg, svc_gamestate );
+	MSG_WriteLong( msg, cl->reliableSequence );
+
+	//The cached data got encoded starting on a byte boundary
+	if((msg->bit & 7) || !SV_BaselinesAreShared())
+	{
+		SV_WriteGameStateBody( msg, cl - svs.clients );
+		return;
+	}
+
+	if(sv_gameStateCache.valid && sv_gameStateCache.unkConfigIndex == sv.unkConfigIndex &&
+		!memcmp(sv_gameStateCache.configstringIndex, sv.configstringIndex, sizeof(sv.configstringIndex)))
+	{
+		hash = SV_HashConfigstrings();
+	}else{
+		hash = 0;
+		sv_gameStateCache.valid = qfalse;
+	}
+
+	if(!sv_gameStateCache.valid || sv_gameStateCache.hash != hash)
+	{
+		MSG_Init( &cachemsg, sv_gameStateCache.data, sizeof( sv_gameStateCache.data ) );
+		SV_WriteGameStateBody( &cachemsg, cl - svs.clients );
+
+		if(cachemsg.overflowed)
+		{
+			sv_gameStateCache.valid = qfalse;
+			SV_WriteGameStateBody( msg, cl - svs.clients );
+			return;
+		}
+
+		sv_gameStateCache.length = cachemsg.cursize;
+		sv_gameStateCache.bit = cachemsg.bit;
+		sv_gameStateCache.unkConfigIndex = sv.unkConfigIndex;
+		Com_Memcpy(sv_gameStateCache.configstringIndex, sv.configstringIndex, sizeof(sv.configstringIndex));
+		sv_gameStateCache.hash = SV_HashConfigstrings();
+		sv_gameStateCache.valid = qtrue;
+	}
+
+	MSG_AppendEncoded( msg, sv_gameStateCache.data, sv_gameStateCache.length, sv_gameStateCache.bit );
+}
+
+static void SV_WriteGameStateBody( msg_t* msg, int clnum ) {
+
 	char* cs;
-	int i, ebx, edi, esi, var_03, clnum;
+	int i, ebx, edi, esi, var_03;
 	entityState_t nullstate, *base;
 	snapshotInfo_t snapInfo;
 	unkGameState_t *gsbase = unkGameStateStr;
 	unkGameState_t *gsindex;
 	unsigned short strindex;
 
-	MSG_WriteByte( msg, svc_gamestate );
-	MSG_WriteLong( msg, cl->reliableSequence );
 	MSG_WriteByte( msg, svc_configstring );
 
 	for ( esi = 0, edi = 0, var_03 = 0 ; esi < MAX_CONFIGSTRINGS ; esi++) {
@@ -1880,7 +2809,6 @@ void SV_WriteGameState( msg_t* msg, client_t* cl ) {
 		}
 	}
 	Com_Memset( &nullstate, 0, sizeof( nullstate ) );
-	clnum = cl - svs.clients;
 
 	// baselines
 	for ( i = 0; i < MAX_GENTITIES ; i++ ) {
@@ -1901,6 +2829,86 @@ void SV_WriteGameState( msg_t* msg, client_t* cl ) {
 	MSG_WriteByte( msg, svc_EOF );
 }
 
+/*
+Infostrings of the clients for SV_WriteRconStatus. Every key costs a pass over the string in
+Info_SetValueForKey, so each client's string is kept together with what it got built from
+and is only built again once one of the values is different.
+*/
+typedef struct{
+	char		name[64];
+	char		pbguid[33];
+	int		uid;
+	int		team;
+	int		score;
+	int		kills;
+	int		deaths;
+	int		assists;
+	int		ping;
+	netadr_t	adr;
+	int		state;
+	int		os;
+	int		power;
+	int		rate;
+}rconStatusKey_t;
+
+static struct{
+	rconStatusKey_t	key;
+	char		infostring[MAX_INFO_STRING];
+}sv_rconStatusRows[MAX_CLIENTS];
+
+static const char* SV_RconStatusClientInfo( client_t* cl, gclient_t* gclient ) {
+
+	rconStatusKey_t key;
+	char *infostring;
+	int i = cl - svs.clients;
+
+	Com_Memset(&key, 0, sizeof(key));
+	Q_strncpyz(key.name, cl->name, sizeof(key.name));
+	Q_strncpyz(key.pbguid, cl->pbguid, sizeof(key.pbguid));
+	key.uid = cl->uid;
+	key.team = gclient->sess.sessionTeam;
+	key.score = gclient->pers.scoreboard.score;
+	key.kills = gclient->pers.scoreboard.kills;
+	key.deaths = gclient->pers.scoreboard.deaths;
+	key.assists = gclient->pers.scoreboard.assists;
+	key.ping = cl->ping;
+	key.adr = cl->netchan.remoteAddress;
+	key.state = cl->state;
+	key.os = cl->OS;
+	key.power = cl->power;
+	key.rate = cl->rate;
+
+	infostring = sv_rconStatusRows[i].infostring;
+
+	if ( *infostring && !memcmp(&key, &sv_rconStatusRows[i].key, sizeof(key)) ) {
+		return infostring;
+	}
+	sv_rconStatusRows[i].key = key;
+
+	infostring[0] = 0;
+	Info_SetValueForKey( infostring, "name", cl->name);
+	Info_SetValueForKey( infostring, "uid", va("%i", cl->uid));
+	Info_SetValueForKey( infostring, "pbguid", cl->pbguid);
+	Info_SetValueForKey( infostring, "team", va("%i", gclient->sess.sessionTeam));
+	Info_SetValueForKey( infostring, "score", va("%i", gclient->pers.scoreboard.score));
+	Info_SetValueForKey( infostring, "kills", va("%i", gclient->pers.scoreboard.kills));
+	Info_SetValueForKey( infostring, "deaths", va("%i", gclient->pers.scoreboard.deaths));
+	Info_SetValueForKey( infostring, "assists", va("%i", gclient->pers.scoreboard.assists));
+	Info_SetValueForKey( infostring, "ping", va("%i", cl->ping));
+
+	if(cl->netchan.remoteAddress.type == NA_BOT)
+		Info_SetValueForKey( infostring, "ipconn", "BOT");
+	else
+		Info_SetValueForKey( infostring, "ipconn", NET_AdrToConnectionString(&cl->netchan.remoteAddress));
+
+	Info_SetValueForKey( infostring, "state", va("%i", cl->state));
+	Info_SetValueForKey( infostring, "os", va("%c", cl->OS));
+	Info_SetValueForKey( infostring, "power", va("%i", cl->power));
+	Info_SetValueForKey( infostring, "rate", va("%i", cl->rate));
+
+	return infostring;
+}
+
 /*
 ================
 SV_RconStatusWrite
@@ -1954,30 +2962,9 @@ void SV_WriteRconStatus( msg_t* msg ) {
 
 		cl = &svs.clients[i];
 
-		infostring[0] = 0;
-
 		if ( cl->state >= CS_CONNECTED ) {
 			MSG_WriteByte( msg, i );	//ClientIndex
-			Info_SetValueForKey( infostring, "name", cl->name);
-			Info_SetValueForKey( infostring, "uid", va("%i", cl->uid));
-			Info_SetValueForKey( infostring, "pbguid", cl->pbguid);
-			Info_SetValueForKey( infostring, "team", va("%i", gclient->sess.sessionTeam));
-			Info_SetValueForKey( infostring, "score", va("%i", gclient->pers.scoreboard.score));
-			Info_SetValueForKey( infostring, "kills", va("%i", gclient->pers.scoreboard.kills));
-			Info_SetValueForKey( infostring, "deaths", va("%i", gclient->pers.scoreboard.deaths));
-			Info_SetValueForKey( infostring, "assists", va("%i", gclient->pers.scoreboard.assists));
-			Info_SetValueForKey( infostring, "ping", va("%i", cl->ping));
-
-			if(cl->netchan.remoteAddress.type == NA_BOT)
-				Info_SetValueForKey( infostring, "ipconn", "BOT");
-			else
-				Info_SetValueForKey( infostring, "ipconn", NET_AdrToConnectionString(&cl->netchan.remoteAddress));
-
-			Info_SetValueForKey( infostring, "state", va("%i", cl->state));
-			Info_SetValueForKey( infostring, "os", va("%c", cl->OS));
-			Info_SetValueForKey( infostring, "power", va("%i", cl->power));
-			Info_SetValueForKey( infostring, "rate", va("%i", cl->rate));
-			MSG_WriteString(msg, infostring);
+			MSG_WriteString(msg, SV_RconStatusClientInfo(cl, gclient));
 		}
 	}
 	MSG_WriteByte( msg, -1 );	//Terminating ClientIndex
@@ -1991,6 +2978,92 @@ void SV_GetServerStaticHeader(){
 
 
 
+/*
+Huge pages for the snapshot memory
+
+The clients with their frames, the archived snapshots and the snapshot entity and client rings
+get read all over the place for every snapshot. They belong to the binary, so all we can do is
+ask for transparent huge pages for the memory they already have. svs is in the bss of the binary,
+the rings get allocated by SV_SpawnServer and are advised again when they moved.
+*/
+typedef struct{
+	const char*	name;
+	void*		start;
+	int		size;
+	int		advised;
+}svHugePagePool_t;
+
+static svHugePagePool_t sv_hugePagePools[] = {
+	{"clients"},
+	{"archived snapshots"},
+	{"snapshot entities"},
+	{"snapshot clients"}
+};
+
+#define NUM_HUGEPAGEPOOLS (sizeof(sv_hugePagePools) / sizeof(sv_hugePagePools[0]))
+
+static void SV_AdviseHugePagePool(svHugePagePool_t* pool, void* start, int size){
+
+	if(pool->start == start && pool->size == size)
+		return;
+
+	pool->start = start;
+	pool->size = size;
+	pool->advised = Sys_MemoryAdviseHugePages(start, size, qtrue);
+}
+
+void SV_AdviseHugePages(){
+
+	if(!sv_hugePages->boolean)
+		return;
+
+	SV_AdviseHugePagePool(&sv_hugePagePools[0], svs.clients, sizeof(svs.clients));
+	//From the end of the snapshot counters up to the index of the archived snapshot buffer
+	SV_AdviseHugePagePool(&sv_hugePagePools[1], svs.bigunknown, (byte*)&svs.nextArchivedSnapshotBuffer - (byte*)svs.bigunknown);
+
+	if(svsHeader.snapshotEntities)
+		SV_AdviseHugePagePool(&sv_hugePagePools[2], svsHeader.snapshotEntities, svsHeader.numSnapshotEntities * sizeof(entityState_t));
+
+	if(svsHeader.snapshotClients)
+		SV_AdviseHugePagePool(&sv_hugePagePools[3], svsHeader.snapshotClients, svsHeader.numSnapshotClients * sizeof(clientState_ts));
+}
+
+void SV_HugePageStatus_f(){
+
+	svHugePagePool_t* pool;
+	char mode[64];
+	FILE* fp;
+	int i, resident, huge;
+
+	Q_strncpyz(mode, "unavailable", sizeof(mode));
+	fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if(fp){
+		if(fgets(mode, sizeof(mode), fp))
+			mode[strcspn(mode, "\n")] = '\0';
+		fclose(fp);
+	}
+
+	Com_Printf("Transparent huge pages: %s\n", mode);
+	Com_Printf("Pool                  Size KB  Advised KB  Resident KB  Huge KB\n");
+	Com_Printf("-------------------- -------- ----------- ------------ --------\n");
+
+	for(i = 0, pool = sv_hugePagePools; i < NUM_HUGEPAGEPOOLS; i++, pool++){
+
+		if(pool->start == NULL){
+			Com_Printf("%-20s %8s\n", pool->name, "-");
+			continue;
+		}
+
+		if(!pool->advised || !Sys_MemoryHugePagesResident(pool->start, pool->size, &resident, &huge)){
+			resident = 0;
+			huge = 0;
+		}
+		Com_Printf("%-20s %8d %11d %12d %8d\n", pool->name, pool->size / 1024, pool->advised / 1024, resident, huge);
+	}
+	Com_Printf("\n");
+}
+
+
 void SV_InitArchivedSnapshot(){
 
 	svs.nextArchivedSnapshotFrames = 0;
@@ -2038,6 +3111,9 @@ void SV_PreLevelLoad(){
 	client_t* client;
 	int i;
 
+	SV_ServerDemoEndLevel();
+	SV_CancelBotSpawns();
+
 	Com_UpdateRealtime();
 	time_t realtime = Com_GetRealtime();
 	char *timestr = ctime(&realtime);
@@ -2049,7 +3125,7 @@ void SV_PreLevelLoad(){
 
 	PHandler_Event(PLUGINS_ONEXITLEVEL, NULL);
 	SV_RemoveAllBots();
-	SV_ReloadBanlist();
+	SV_BanlistBeginReload(); //Files get read while the level loads, SV_PostLevelLoad parses them
 
 	NV_LoadConfig();
 
@@ -2063,9 +3139,22 @@ void SV_PreLevelLoad(){
 	for ( client = svs.clients, i = 0 ; i < sv_maxclients->integer ; i++, client++ ) {
 
 		G_DestroyAdsForPlayer(client); //Remove hud message ads
+	}
+	Pmove_ExtendedResetState();
 
-		// send the new gamestate to all connected clients
-		if ( client->state < CS_ACTIVE ) {
+	HL2Rcon_EventLevelStart();
+
+}
+
+static void SV_DropBannedClients(){
+
+	client_t* client;
+	int i;
+
+	for ( client = svs.clients, i = 0 ; i < sv_maxclients->integer ; i++, client++ ) {
+
+		// the level is loaded already, everyone who stays is connected now
+		if ( client->state < CS_CONNECTED ) {
 			continue;
 		}
 
@@ -2078,13 +3167,21 @@ void SV_PreLevelLoad(){
 			continue;
 		}
 	}
-	Pmove_ExtendedResetState();
-
-	HL2Rcon_EventLevelStart();
-
 }
 
 void SV_PostLevelLoad(){
+	SV_ReloadBanlist();
+	SV_DropBannedClients();
+	SV_SyncAllClientHot();
+	SV_AdviseHugePages();
+	SV_InvalidateQueryCache();
+	G_HudInvalidateSlots();
+	SV_ResetFrameBudget();
+	Z_LevelCheck();
+	XAssets_LevelLoaded(sv_mapname->string);
+	SV_InvalidateGameStateCache();
+	FS_InvalidatePakAllowlist();
+	SV_MapPrefetchLevelStart();
 	PHandler_Event(PLUGINS_ONSPAWNSERVER, NULL);
 	sv.frameusec = 1000000 / sv_fps->integer;
 	sv.serverId = com_frameTime;
@@ -2102,6 +3199,7 @@ qboolean SV_Map( const char *levelname ) {
 	char        *map;
 	char mapname[MAX_QPATH];
 	char expanded[MAX_QPATH];
+	int start, spawnStart, postStart;
 
 	map = FS_GetMapBaseName(levelname);
 	Q_strncpyz(mapname, map, sizeof(mapname));
@@ -2126,11 +3224,19 @@ qboolean SV_Map( const char *levelname ) {
 //	Cbuf_ExecuteBuffer(0, 0, "selectStringTableEntryInDvar mp/didyouknow.csv 0 didyouknow");
 
 	FS_ConvertPath(mapname);
+
+	start = Sys_Milliseconds();
+	SV_MapPrefetchLevelLoad(mapname);
 	SV_PreLevelLoad();
 
+	spawnStart = Sys_Milliseconds();
 	SV_SpawnServer(mapname);
 
+	postStart = Sys_Milliseconds();
 	SV_PostLevelLoad();
+
+	Com_Printf("Map change to %s took %d msec: %d msec before, %d msec loading, %d msec after the level load\n", mapname,
+		Sys_Milliseconds() - start, spawnStart - start, postStart - spawnStart, Sys_Milliseconds() - postStart);
 	return qtrue;
 }
 
@@ -2139,6 +3245,9 @@ void SV_PreFastRestart(){
 	PHandler_Event(PLUGINS_ONPREFASTRESTART, NULL);
 }
 void SV_PostFastRestart(){
+	G_HudInvalidateSlots();
+	SV_InvalidateGameStateCache();
+	SV_SyncAllClientHot();
 	PHandler_Event(PLUGINS_ONPOSTFASTRESTART, NULL);
 }
 
@@ -2285,56 +3394,105 @@ if necessary
 ==================
 */
 #define SV_MAXCS_CONNECTEDTIME 6
+#define SV_TIMEOUT_CHECKINTERVAL 1000	//Longest time between two scans, catches state and cvar changes
+
+/*
+Packets only move the drop points of the clients further away, so the scan can wait until the
+earliest of them is reached. Clients which are past their drop point get checked every frame
+for the timeoutCount. New clients, state changes and lowered timeouts are seen by the scan
+SV_TIMEOUT_CHECKINTERVAL msec later at most.
+*/
+static int sv_nextTimeoutCheck;
+
+static void SV_TimeoutDeadline( int* nextcheck, int lastPacketTime, int timeout ) {
+
+	if ( lastPacketTime + timeout < *nextcheck ) {
+		*nextcheck = lastPacketTime + timeout;
+	}
+}
+
+// wait several frames so a debugger session doesn't cause a timeout
+static qboolean SV_ClientTimeoutFrame( client_t *cl, clientHot_t *hot ) {
+
+	hot->timeoutCount++;
+	cl->timeoutCount = hot->timeoutCount;
+
+	return hot->timeoutCount > 5;
+}
 
 void SV_CheckTimeouts( void ) {
 	int i;
 	client_t    *cl;
+	clientHot_t *hot;
 	int primeddroppoint;
 	int connectdroppoint;
 	int activedroppoint;
 	int zombiepoint;
+	int nextcheck;
+
+	if ( svs.time < sv_nextTimeoutCheck && sv_nextTimeoutCheck - svs.time <= SV_TIMEOUT_CHECKINTERVAL ) {
+		return;
+	}
+	nextcheck = svs.time + SV_TIMEOUT_CHECKINTERVAL;
 
 	activedroppoint = svs.time - 1000 * sv_timeout->integer;
 	primeddroppoint = svs.time - 1000 * sv_connectTimeout->integer;
 	connectdroppoint = svs.time - 1000 * SV_MAXCS_CONNECTEDTIME;
 	zombiepoint = svs.time - 1000 * sv_zombieTime->integer;
 
-	for ( i = 0,cl = svs.clients ; i < sv_maxclients->integer ; i++,cl++ ) {
+	for ( i = 0, cl = svs.clients, hot = sv_clientHot ; i < sv_maxclients->integer ; i++, cl++, hot++ ) {
+
+		if ( hot->state == CS_FREE ) {
+			continue;
+		}
+
 		// message times may be wrong across a changelevel
-		if ( cl->lastPacketTime > svs.time ) {
-			cl->lastPacketTime = svs.time;
+		if ( hot->lastPacketTime > svs.time ) {
+			SV_ClientPacketTime(cl);
 		}
 
-		if ( cl->state == CS_ZOMBIE && cl->lastPacketTime < zombiepoint ) {
+		if ( hot->state == CS_ZOMBIE && hot->lastPacketTime < zombiepoint ) {
 			// using the client id cause the cl->name is empty at this point
 			Com_DPrintf( "Going from CS_ZOMBIE to CS_FREE for client %d\n", i );
-			cl->state = CS_FREE;    // can now be reused
+			SV_SetClientState(cl, CS_FREE);    // can now be reused
 			continue;
 		}
 
-		if(cl->state == CS_ACTIVE && cl->lastPacketTime < activedroppoint){
-			// wait several frames so a debugger session doesn't
-			// cause a timeout
-			if ( ++cl->timeoutCount > 5 ) {
+		if ( (hot->state == CS_ACTIVE && hot->lastPacketTime < activedroppoint) ||
+			(hot->state == CS_CONNECTED && hot->lastPacketTime < connectdroppoint) ||
+			(hot->state == CS_PRIMED && hot->lastPacketTime < primeddroppoint) ) {
+
+			if ( SV_ClientTimeoutFrame(cl, hot) ) {
 				SV_DropClient( cl, "EXE_TIMEDOUT" );
-				cl->state = CS_FREE;    // don't bother with zombie state
+				SV_SetClientState(cl, CS_FREE);    // don't bother with zombie state
 			}
-		} else if ( cl->state == CS_CONNECTED && cl->lastPacketTime < connectdroppoint ) {
-			if ( ++cl->timeoutCount > 5 ) {
-				SV_DropClient( cl, "EXE_TIMEDOUT" );
-				cl->state = CS_FREE;    // don't bother with zombie state
+			nextcheck = svs.time;
+		} else {
+			if ( hot->timeoutCount ) {
+				hot->timeoutCount = 0;
+				cl->timeoutCount = 0;
 			}
-		} else if ( cl->state == CS_PRIMED && cl->lastPacketTime < primeddroppoint ) {
-			// wait several frames so a debugger session doesn't
-			// cause a timeout
-			if ( ++cl->timeoutCount > 5 ) {
-				SV_DropClient( cl, "EXE_TIMEDOUT" );
-				cl->state = CS_FREE;    // don't bother with zombie state
+
+			switch ( hot->state ) {
+				case CS_ZOMBIE:
+					SV_TimeoutDeadline( &nextcheck, hot->lastPacketTime, 1000 * sv_zombieTime->integer );
+					break;
+				case CS_CONNECTED:
+					SV_TimeoutDeadline( &nextcheck, hot->lastPacketTime, 1000 * SV_MAXCS_CONNECTEDTIME );
+					break;
+				case CS_PRIMED:
+					SV_TimeoutDeadline( &nextcheck, hot->lastPacketTime, 1000 * sv_connectTimeout->integer );
+					break;
+				case CS_ACTIVE:
+					SV_TimeoutDeadline( &nextcheck, hot->lastPacketTime, 1000 * sv_timeout->integer );
+					break;
+				default:
+					break;
 			}
-		} else {
-			cl->timeoutCount = 0;
 		}
 	}
+
+	sv_nextTimeoutCheck = nextcheck;
 }
 
 /*
@@ -2390,6 +3548,103 @@ unsigned int SV_FrameUsec()
 		return 1;
 }
 
+/*
+==================
+Tick statistics
+
+Cost of the simulation and of building/sending snapshots per server frame. The simulation
+scales with sv_fps while snapshots scale with what the clients request, so tickstatus can
+estimate the CPU load of other frame rates from one measurement
+==================
+*/
+static struct{
+	unsigned int		frames;
+	unsigned long long	simUsec;
+	unsigned long long	snapUsec;
+	unsigned long long	otherUsec;
+	unsigned int		maxFrameUsec;
+}sv_tickStats;
+
+static unsigned int sv_msecResidual;	//Sub-millisecond part of frameUsec not yet added to svs.time
+
+/*
+Frames whose work took longer than one frame interval, and game frames skipped because the
+server fell more than sv_maxCatchupFrames behind. Reset on every level load
+*/
+static struct{
+	unsigned int	overruns;
+	unsigned int	worstUsec;
+	unsigned int	worstSimUsec;
+	unsigned int	worstSnapUsec;
+	int		worstTime;		//svs.time of the worst overrun
+	unsigned int	droppedFrames;
+	int		lastDropTime;
+}sv_frameBudget;
+
+void SV_ResetFrameBudget( void ) {
+
+	Com_Memset(&sv_frameBudget, 0, sizeof(sv_frameBudget));
+}
+
+void SV_GetFrameBudget( unsigned int *overruns, unsigned int *droppedFrames ) {
+
+	*overruns = sv_frameBudget.overruns;
+	*droppedFrames = sv_frameBudget.droppedFrames;
+}
+
+void SV_FrameBudgetStatus( void ) {
+
+	Com_Printf("frame overruns: %u", sv_frameBudget.overruns);
+
+	if(sv_frameBudget.overruns)
+		Com_Printf(" (worst %u usec: game %u, snapshots %u, %i sec ago)", sv_frameBudget.worstUsec, sv_frameBudget.worstSimUsec,
+			sv_frameBudget.worstSnapUsec, (svs.time - sv_frameBudget.worstTime) / 1000);
+
+	Com_Printf(", dropped frames: %u", sv_frameBudget.droppedFrames);
+
+	if(sv_frameBudget.droppedFrames)
+		Com_Printf(" (last %i sec ago)", (svs.time - sv_frameBudget.lastDropTime) / 1000);
+
+	Com_Printf("\n");
+}
+
+void SV_TickStatus_f( void ) {
+
+	static const int rates[] = {20, 30, 40, 60, 100, 125, 0};
+	unsigned int sim, snap, other, fps;
+	int i, load;
+
+	if ( !com_sv_running->boolean ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if(sv_tickStats.frames == 0 || sv.frameusec <= 0)
+	{
+		Com_Printf("No server frames measured yet\n");
+		return;
+	}
+
+	fps = 1000000 / sv.frameusec;
+	sim = sv_tickStats.simUsec / sv_tickStats.frames;
+	snap = sv_tickStats.snapUsec / sv_tickStats.frames;
+	other = sv_tickStats.otherUsec / sv_tickStats.frames;
+
+	Com_Printf("Server frames: %u at %u fps, longest frame %u usec\n", sv_tickStats.frames, fps, sv_tickStats.maxFrameUsec);
+	Com_Printf("Per frame: simulation %u usec, snapshots %u usec, other %u usec\n", sim, snap, other);
+	Com_Printf("Estimated CPU load with the current clients and snapshot rates:\n");
+
+	for(i = 0; rates[i]; i++)
+	{
+		//Snapshot work per second stays what the clients request, only the simulation follows sv_fps
+		load = ((unsigned long long)(sim + other) * rates[i] + (unsigned long long)snap * fps) / 10000;
+
+		Com_Printf("  sv_fps %3d: %3d%% load, %3d%% headroom%s\n", rates[i], load, load < 100 ? 100 - load : 0, rates[i] == fps ? " (current)" : "");
+	}
+
+	Com_Memset(&sv_tickStats, 0, sizeof(sv_tickStats));
+}
+
 /*
 ==================
 SV_Frame
@@ -2400,9 +3655,9 @@ happen before SV_Frame is called
 */
 __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 	unsigned int frameUsec;
+	unsigned long long frameStart, simStart, snapStart, frameEnd;
+	unsigned int frameWork, pending, dropped;
 	char mapname[MAX_QPATH];
-        client_t* client;
-        int i;
         static qboolean underattack = qfalse;
 
 
@@ -2433,38 +3688,120 @@ __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 	if ( sv.timeResidual < frameUsec ) {
 		// NET_Sleep will give the OS time slices until either get a packet
 		// or time enough for a server frame has gone by
+		PROFILE_BEGIN(PROFILE_SLEEP);
 		underattack = NET_Sleep( frameUsec - sv.timeResidual );
+		PROFILE_END(PROFILE_SLEEP);
 		return qfalse;
 	}
 
+	PROFILE_BEGIN(PROFILE_FRAME);
+	PROFILE_BEGIN(PROFILE_SERVERFRAME);
+
+	frameStart = Sys_MicrosecondsLong();
+
 	if(underattack)
 		NET_Clear();
 
 	SV_PreFrame( );
 
+	// pick up bans and admins other servers on this host have changed
+	SV_SharedStoreFrame( );
+
+	// don't stall for seconds after a hitch, run only a bounded number of extra frames
+	pending = sv.timeResidual / frameUsec;
+	dropped = 0;
+
+	if(pending > sv_maxCatchupFrames->integer)
+	{
+		dropped = pending - sv_maxCatchupFrames->integer;
+		sv.timeResidual -= dropped * frameUsec;
+		sv_frameBudget.droppedFrames += dropped;
+		sv_frameBudget.lastDropTime = svs.time;
+		Com_PrintWarning("Server is %u msec behind, skipping %u game frames\n", pending * frameUsec / 1000, dropped);
+	}
+
 	// run the game simulation in chunks
+	PROFILE_BEGIN(PROFILE_GAMEFRAME);
+	if(scr_profileActive)
+		Scr_ProfileFrame();
+	simStart = Sys_MicrosecondsLong();
 	while ( sv.timeResidual >= frameUsec ) {
 		sv.timeResidual -= frameUsec;
-		svs.time += frameUsec / 1000;
+		// keep the fraction of a millisecond so 30 or 60 fps don't make the game time run slow
+		sv_msecResidual += frameUsec;
+		svs.time += sv_msecResidual / 1000;
+		sv_msecResidual %= 1000;
 
 		// let everything in the world think and move
 		G_RunFrame( svs.time );
 	}
+	SV_ServerDemoFrame();
+	SV_RelayFrame();
+	SV_BotSpawnFrame();
+	SV_LoadBotFrame();
+	Scr_FS_AsyncFrame();
+	PROFILE_END(PROFILE_GAMEFRAME);
 
 	// send messages back to the clients
+	PROFILE_BEGIN(PROFILE_SENDCLIENTMESSAGES);
+	snapStart = Sys_MicrosecondsLong();
+	NET_BeginPacketQueue();
+	SV_ScheduleClientMessages();
 	SV_SendClientMessages();
+	NET_FlushPacketQueue();
+	frameEnd = Sys_MicrosecondsLong();
+	PROFILE_END(PROFILE_SENDCLIENTMESSAGES);
+
+	sv_tickStats.frames++;
+	sv_tickStats.simUsec += snapStart - simStart;
+	sv_tickStats.snapUsec += frameEnd - snapStart;
+	sv_tickStats.otherUsec += simStart - frameStart;
+	if(frameEnd - frameStart > sv_tickStats.maxFrameUsec)
+		sv_tickStats.maxFrameUsec = frameEnd - frameStart;
+
+	frameWork = frameEnd - frameStart;
+
+	SV_SnapshotShedFrame(frameWork, frameUsec);
+
+	if(frameWork > frameUsec)
+	{
+		sv_frameBudget.overruns++;
+
+		if(frameWork > sv_frameBudget.worstUsec)
+		{
+			sv_frameBudget.worstUsec = frameWork;
+			sv_frameBudget.worstSimUsec = snapStart - simStart;
+			sv_frameBudget.worstSnapUsec = frameEnd - snapStart;
+			sv_frameBudget.worstTime = svs.time;
+		}
+	}
+
+	if(frameWork > frameUsec || dropped)
+	{
+		PHandler_Event(PLUGINS_ONFRAMEOVERRUN, (void*)frameWork, (void*)frameUsec, (void*)(unsigned int)(snapStart - simStart),
+			(void*)(unsigned int)(frameEnd - snapStart), (void*)dropped);
+	}
 
 	Scr_SetLoading(0);
 
 	// update ping based on the all received frames
 	SV_CalcPings();
 
+	// apply the userinfo changes which had to wait
+	SV_UserinfoFrame();
+
 	// check timeouts
 	SV_CheckTimeouts();
 
 	// send a heartbeat to the master if needed
 	SV_MasterHeartbeat( HEARTBEAT_GAME );
 
+	SV_PublishQuerySnapshot( );
+
+	SV_StatusBoardFrame( frameWork );
+
+	SV_BanlistFilterFrame( );
+
 	PbServerProcessEvents();
 
 	// if time is about to hit the 32nd bit, kick all clients
@@ -2549,6 +3886,11 @@ __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 		return qtrue;
 	}
 
+	//The players are spread over the message rotation, so this runs each frame
+	if(level.time > level.startTime + 20000){
+		G_PrintRulesAndAdverts();
+	}
+
         if( svs.time > svse.frameNextSecond){	//This runs each second
 	    svse.frameNextSecond = svs.time+1000;
 
@@ -2582,23 +3924,15 @@ __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 		serverStatus_Write();
 
 	        PHandler_Event(PLUGINS_ONTENSECONDS, NULL);	// Plugin event
+		SV_MapPrefetchFrame();
 /*		if(svs.time > svse.nextsecret){
 			svse.nextsecret = svs.time+80000;
 			Com_RandomBytes((byte*)&svse.secret,sizeof(int));
 		}*/
-
-		if(level.time > level.startTime + 20000){
-			for(client = svs.clients, i = 0; i < sv_maxclients->integer; i++, client++){
-				if(client->state != CS_ACTIVE)
-					continue;
-			
-				G_PrintRuleForPlayer(client);
-				G_PrintAdvertForPlayer(client);
-			}
-		}
 	    }
 
 	}
+	PROFILE_END(PROFILE_SERVERFRAME);
 	return qtrue;
 }
 
@@ -2606,8 +3940,6 @@ __optimize3 __regparm1 qboolean SV_Frame( unsigned int usec ) {
 void SV_SayToPlayers(int clnum, int team, char* text)
 {
 
-	client_t *cl;
-
 	if(clnum >= 0 && clnum < 64){
 		SV_SendServerCommand(&svs.clients[clnum], "h \"%s\"", text);
 		return;
@@ -2617,16 +3949,7 @@ void SV_SayToPlayers(int clnum, int team, char* text)
 		SV_SendServerCommand(NULL, "h \"%s\"", text);
 		return;
 	}
-	for(cl = svs.clients, clnum = 0; clnum < sv_maxclients->integer; clnum++){
-
-		if(cl->state < CS_ACTIVE)
-			continue;
-
-		if(team != level.clients[clnum].sess.sessionTeam)
-			continue;
-
-		SV_SendServerCommand(cl, "h \"%s\"", text);
-	}
+	SV_SendServerCommandToMask(SV_TeamClientMask(team, CS_ACTIVE), "h \"%s\"", text);
 }
 
 /*
@@ -0,0 +1,287 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+/*
+========================================================================
+
+Prefetch of the next map of the rotation
+
+The fastfiles and iwds of the map which comes next get read once on a
+worker thread while the current map is running, so the map change finds
+them in the page cache instead of waiting for the disk. Loading the
+assets themselves stays with the map change, the database of the binary
+can not be filled from another thread.
+
+The game does not tell us when the intermission starts, so the prefetch
+starts sv_mapPrefetchDelay seconds into the level. A map change to any
+other map starts a prefetch of that map right away. It reads ahead of the
+binary which decompresses the fastfiles at the same time.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon.h"
+#include "qcommon_mem.h"
+#include "filesystem.h"
+#include "cvar.h"
+#include "server.h"
+#include "g_shared.h"
+#include "sys_main.h"
+#include "sys_thread.h"
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MAPPREFETCH_READSIZE 0x40000
+
+typedef struct{
+	char	roots[2][MAX_OSPATH];		//fs_basepath and fs_homepath, the second one can be empty
+	char	map[MAX_QPATH];
+	int	startTime;
+	int	files;				//Filled by the worker
+	unsigned long long bytes;
+}mapPrefetch_t;
+
+static cvar_t* sv_mapPrefetchDelay;
+static qboolean sv_mapPrefetchDone;	//Already started for the current level
+static qboolean sv_mapPrefetchBusy;
+static char sv_mapPrefetchLast[MAX_QPATH];	//Last map read by SV_MapPrefetchFrame
+
+
+static void SV_MapPrefetchFile( mapPrefetch_t* prefetch, const char* path, byte* buf ) {
+
+	int fd, len;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		return;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	while((len = read(fd, buf, MAPPREFETCH_READSIZE)) > 0)
+		prefetch->bytes += len;
+
+	close(fd);
+	prefetch->files++;
+}
+
+//Worker thread, nothing but libc in here
+static void SV_MapPrefetchJob( void* arg ) {
+
+	mapPrefetch_t* prefetch = arg;
+	char path[2*MAX_OSPATH];
+	char dirpath[2*MAX_OSPATH];
+	struct dirent* entry;
+	DIR* dir;
+	byte* buf;
+	int i;
+
+	buf = malloc(MAPPREFETCH_READSIZE);
+	if(buf == NULL)
+		return;
+
+	for(i = 0; i < 2; i++)
+	{
+		if(!prefetch->roots[i][0])
+			continue;
+
+		//Usermaps bring everything in their own directory
+		Com_sprintf(dirpath, sizeof(dirpath), "%s/usermaps/%s", prefetch->roots[i], prefetch->map);
+		if((dir = opendir(dirpath)) != NULL)
+		{
+			while((entry = readdir(dir)) != NULL)
+			{
+				if(entry->d_name[0] == '.')
+					continue;
+				Com_sprintf(path, sizeof(path), "%s/%s", dirpath, entry->d_name);
+				SV_MapPrefetchFile(prefetch, path, buf);
+			}
+			closedir(dir);
+		}
+
+		//Stock maps are in zone/<language>/
+		Com_sprintf(dirpath, sizeof(dirpath), "%s/zone", prefetch->roots[i]);
+		if((dir = opendir(dirpath)) != NULL)
+		{
+			while((entry = readdir(dir)) != NULL)
+			{
+				if(entry->d_name[0] == '.')
+					continue;
+				Com_sprintf(path, sizeof(path), "%s/%s/%s.ff", dirpath, entry->d_name, prefetch->map);
+				SV_MapPrefetchFile(prefetch, path, buf);
+				Com_sprintf(path, sizeof(path), "%s/%s/%s_load.ff", dirpath, entry->d_name, prefetch->map);
+				SV_MapPrefetchFile(prefetch, path, buf);
+			}
+			closedir(dir);
+		}
+	}
+	free(buf);
+}
+
+static void SV_MapPrefetchDone( void* arg ) {
+
+	mapPrefetch_t* prefetch = arg;
+
+	if(prefetch->files > 0)
+		Com_Printf("Prefetched %d files (%llu KB) of map %s in %d msec\n", prefetch->files,
+			prefetch->bytes / 1024, prefetch->map, Sys_Milliseconds() - prefetch->startTime);
+	else
+		Com_DPrintfChannel(DPRINT_FS, 1, "SV_MapPrefetch: No files found for map %s\n", prefetch->map);
+
+	Z_Free(prefetch);
+	sv_mapPrefetchBusy = qfalse;
+}
+
+/*
+==================
+SV_GetRotationNextMap
+
+The map SV_MapRotate_f or the vote would load next.
+Returns qfalse if it can not be told in advance
+==================
+*/
+static qboolean SV_GetRotationNextMap( char* map, int size ) {
+
+	char* maplist;
+	int len;
+
+	if(*g_votedMapName->string){
+		Q_strncpyz(map, g_votedMapName->string, size);
+		return qtrue;
+	}
+	if(*SV_GetNextMap())	//Whatever "vstr nextmap" does
+		return qfalse;
+
+	Com_ParseReset();
+	maplist = Com_ParseGetToken(sv_mapRotationCurrent->string);
+	if(maplist == NULL){
+		Com_ParseReset();
+		maplist = Com_ParseGetToken(sv_mapRotation->string);
+	}
+
+	while(maplist != NULL)
+	{
+		if(!Q_stricmpn(maplist, "map ", 4)){
+
+			maplist = Com_ParseGetToken(maplist);
+			if(maplist == NULL)
+				break;
+
+			len = Com_ParseTokenLength(maplist);
+			if(len >= size)
+				return qfalse;
+			Q_strncpyz(map, maplist, len+1);
+			return qtrue;
+		}
+		maplist = Com_ParseGetToken(maplist);
+	}
+	return qfalse;
+}
+
+static qboolean SV_MapPrefetchStart( const char* map );
+
+void SV_MapPrefetchInit( void ) {
+
+	sv_mapPrefetchDelay = Cvar_RegisterInt("sv_mapPrefetchDelay", 60, 0, 3600, 0, "Seconds into a level after which the files of the next map in the rotation get read into the page cache. 0 disables the prefetch");
+}
+
+void SV_MapPrefetchLevelStart( void ) {
+
+	sv_mapPrefetchDone = qfalse;
+}
+
+/*
+==================
+SV_MapPrefetchFrame
+
+Called every few seconds, starts the prefetch once per level
+==================
+*/
+void SV_MapPrefetchFrame( void ) {
+
+	char map[MAX_QPATH];
+
+	if(sv_mapPrefetchDone || sv_mapPrefetchBusy || sv_mapPrefetchDelay->integer == 0)
+		return;
+
+	if(level.time < level.startTime + sv_mapPrefetchDelay->integer * 1000)
+		return;
+
+	sv_mapPrefetchDone = qtrue;
+
+	if(!SV_GetRotationNextMap(map, sizeof(map)))
+		return;
+
+	if(!Q_stricmp(map, sv_mapname->string))
+		return;
+
+	if(SV_MapPrefetchStart(map))
+		Q_strncpyz(sv_mapPrefetchLast, map, sizeof(sv_mapPrefetchLast));
+}
+
+/*
+==================
+SV_MapPrefetchLevelLoad
+
+Called by SV_Map before the level gets loaded. Nothing to do
+if the map got prefetched during the level before already
+==================
+*/
+void SV_MapPrefetchLevelLoad( const char* map ) {
+
+	if(sv_mapPrefetchBusy || sv_mapPrefetchDelay->integer == 0)
+		return;
+
+	if(!Q_stricmp(map, sv_mapPrefetchLast) || !Q_stricmp(map, sv_mapname->string))
+		return;
+
+	SV_MapPrefetchStart(map);
+}
+
+static qboolean SV_MapPrefetchStart( const char* map ) {
+
+	mapPrefetch_t* prefetch;
+
+	if(strchr(map, '/') || strchr(map, '\\') || strstr(map, "..")){
+		Com_PrintWarning("SV_MapPrefetch: Refusing to prefetch map %s\n", map);
+		return qfalse;
+	}
+
+	prefetch = Z_Malloc(sizeof(mapPrefetch_t));
+	Q_strncpyz(prefetch->map, map, sizeof(prefetch->map));
+	Q_strncpyz(prefetch->roots[0], fs_basepath->string, sizeof(prefetch->roots[0]));
+	if(Q_stricmp(fs_homepath->string, fs_basepath->string))
+		Q_strncpyz(prefetch->roots[1], fs_homepath->string, sizeof(prefetch->roots[1]));
+	prefetch->startTime = Sys_Milliseconds();
+
+	sv_mapPrefetchBusy = qtrue;
+	Sys_AddJob(SV_MapPrefetchJob, SV_MapPrefetchDone, prefetch);
+	return qtrue;
+}
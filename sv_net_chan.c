@@ -24,6 +24,8 @@
 #include "q_shared.h"
 #include "netchan.h"
 #include "server.h"
+#include "qcommon_io.h"
+#include "sys_main.h"
 
 #include <string.h>
 /*
@@ -88,6 +90,119 @@ void SV_DumpCommands( client_t *client, byte *cmd, int size, qboolean cl_to_serv
 */
 
 
+/*
+==============
+Netchan keystream
+
+The key of byte i is the start key XORed with all string[ j % len ] << ( j & 1 ) up to j = i.
+Everything apart from the start key only depends on the string and repeats every
+2 * lcm( len, 2 ) bytes, so it gets built once per string and packets are XORed with it
+a block at a time. Strings without terminator inside the buffer use the old loop.
+==============
+*/
+#define NETCHAN_MAX_KEYSTREAM ( 4 * MAX_STRING_CHARS )
+
+typedef struct{
+	byte string[MAX_STRING_CHARS];
+	int period;
+	byte stream[NETCHAN_MAX_KEYSTREAM];
+}netchanKeystream_t;
+
+static netchanKeystream_t sv_encodeKeystream[MAX_CLIENTS];
+static netchanKeystream_t sv_decodeKeystream[MAX_CLIENTS];
+
+
+static const byte *SV_Netchan_Keystream( netchanKeystream_t *ks, const byte *string, int *period ) {
+
+	int i, len;
+	byte acc;
+
+	for(len = 0; len < MAX_STRING_CHARS && string[len]; len++);
+
+	if(len == MAX_STRING_CHARS){
+		return NULL;
+	}
+
+	if(ks->period && !memcmp(ks->string, string, len + 1)){
+		*period = ks->period;
+		return ks->stream;
+	}
+
+	memcpy(ks->string, string, len + 1);
+
+	if(len == 0)
+		ks->period = 4;
+	else if(len & 1)
+		ks->period = 4 * len;
+	else
+		ks->period = 2 * len;
+
+	for(i = 0, acc = 0; i < ks->period; i++){
+		acc ^= (byte)(string[ len ? i % len : 0 ] << ( i & 1 ));
+		ks->stream[i] = acc;
+	}
+	*period = ks->period;
+	return ks->stream;
+}
+
+#ifdef Q_HAVE_SSE2
+#include <emmintrin.h>
+
+Q_SSE2 static int SV_Netchan_XORSSE2( byte *data, const byte *stream, int len, byte key ) {
+
+	__m128i k, v;
+	int i;
+
+	k = _mm_set1_epi8(key);
+
+	for(i = 0; i + 16 <= len; i += 16){
+		v = _mm_xor_si128(_mm_loadu_si128((const __m128i*)&data[i]), _mm_loadu_si128((const __m128i*)&stream[i]));
+		_mm_storeu_si128((__m128i*)&data[i], _mm_xor_si128(v, k));
+	}
+	return i;
+}
+#endif
+
+static void SV_Netchan_XOR( byte *data, int len, byte key, const byte *stream, int period ) {
+
+	int i, n, block;
+
+	for(n = 0; n < len; n += block, data += block){
+
+		block = len - n;
+		if(block > period)
+			block = period;
+
+		i = 0;
+#ifdef Q_HAVE_SSE2
+		if(Q_UseSSE2())
+			i = SV_Netchan_XORSSE2(data, stream, block, key);
+#endif
+		for( ; i < block; i++){
+			data[i] ^= key ^ stream[i];
+		}
+	}
+}
+
+//For strings the keystream can not be built from
+static void SV_Netchan_XORLoop( byte *data, int len, byte key, const byte *string ) {
+
+	int i, index;
+
+	for ( i = 0, index = 0; i < len; i++ ) {
+
+		if ( !string[index] ) {
+			index = 0;
+		}
+
+		// modify the key with the last sent and acknowledged server command
+		key ^= string[index] << ( i & 1 );
+		data[i] ^= key;
+
+		index++;
+	}
+}
+
 /*
 ==============
 SV_Netchan_Decode
@@ -100,8 +215,9 @@ SV_Netchan_Decode
 ==============
 */
 void SV_Netchan_Decode( client_t *client, byte *data, int remaining ) {
-	int i, index;
+	int period;
 	byte key, *string;
+	const byte *stream;
 //	extclient_t *extcl = &svs.extclients[ client - svs.clients ];
 	
 //	string = (byte *)extcl->reliableCommands[ client->reliableAcknowledge & ( MAX_RELIABLE_COMMANDS - 1 ) ].command;
@@ -110,18 +226,12 @@ void SV_Netchan_Decode( client_t *client, byte *data, int remaining ) {
 	if(!remaining) return;
 	key = client->challenge ^ client->serverId ^ client->messageAcknowledge;
 
-	for ( i=0, index=0; i < remaining; i++ ) {
-
-		if ( !string[index] ) {
-			index = 0;
-		}
-
-		// modify the key with the last sent and acknowledged server command
-		key ^= string[index] << ( i & 1 );
-		data[i] ^= key;
-
-		index++;
+	stream = SV_Netchan_Keystream(&sv_decodeKeystream[ client - svs.clients ], string, &period);
+	if(stream){
+		SV_Netchan_XOR(data, remaining, key, stream, period);
+		return;
 	}
+	SV_Netchan_XORLoop(data, remaining, key, string);
 }
 
 /*
@@ -136,24 +246,205 @@ SV_Netchan_Encode
 
 void SV_Netchan_Encode( client_t *client, byte *data, int cursize ) {
 
-	int i, index;
+	int period;
 	byte key, *string;
+	const byte *stream;
 
 	string = (byte *)client->lastClientCommandString;
 	key = client->challenge ^ client->netchan.outgoingSequence;
 
-	for ( i = 0, index = 0; i < cursize - 4; i++ ) {
+	if(cursize <= 4) return;
 
-		if ( !string[index] ) {
-			index = 0;
+	stream = SV_Netchan_Keystream(&sv_encodeKeystream[ client - svs.clients ], string, &period);
+	if(stream){
+		SV_Netchan_XOR(data + 4, cursize - 4, key, stream, period);
+		return;
+	}
+	SV_Netchan_XORLoop(data + 4, cursize - 4, key, string);
+}
+
+/*
+==============
+SV_Netchan_EncodeBenchmark
+
+Encodes data with the keystream into streamOut and with the byte loop into loopOut,
+for the codecbench command. Returns qfalse if the two disagree
+==============
+*/
+qboolean SV_Netchan_EncodeBenchmark( const byte *data, int length, const byte *string, byte key, byte *streamOut, byte *loopOut,
+	unsigned long long *streamUsec, unsigned long long *loopUsec ) {
+
+	static netchanKeystream_t benchKeystream;
+	unsigned long long start;
+	const byte *stream;
+	int period;
+
+	Com_Memcpy(streamOut, data, length);
+	Com_Memcpy(loopOut, data, length);
+
+	start = Sys_MicrosecondsLong();
+	stream = SV_Netchan_Keystream(&benchKeystream, string, &period);
+	if(stream){
+		SV_Netchan_XOR(streamOut, length, key, stream, period);
+	}else{
+		SV_Netchan_XORLoop(streamOut, length, key, string);
+	}
+	*streamUsec += Sys_MicrosecondsLong() - start;
+
+	start = Sys_MicrosecondsLong();
+	SV_Netchan_XORLoop(loopOut, length, key, string);
+	*loopUsec += Sys_MicrosecondsLong() - start;
+
+	return memcmp(streamOut, loopOut, length) == 0;
+}
+
+
+/*
+==============
+Netchan statistics
+
+Counted on our side of the channel, the netchan itself does not know which
+client it belongs to. Bytes are whole datagrams including the netchan header.
+Incoming packets get classified from their header before Netchan_Process
+throws the late ones away.
+==============
+*/
+
+typedef struct{
+	int		challenge;	//Tells a new connection in the same slot apart
+	netchanStats_t	stats;
+}clientNetchanStats_t;
+
+static clientNetchanStats_t sv_netchanStats[MAX_CLIENTS];
+static netchanStats_t sv_netchanTotals;		//Since the start of the server, disconnected clients included
+
+
+static netchanStats_t* SV_NetchanStatsForClient( client_t *client ) {
+
+	clientNetchanStats_t *entry = &sv_netchanStats[client - svs.clients];
+
+	if(entry->challenge != client->challenge)
+	{
+		Com_Memset(entry, 0, sizeof(clientNetchanStats_t));
+		entry->challenge = client->challenge;
+	}
+	return &entry->stats;
+}
+
+static void SV_NetchanStatsSent( client_t *client, int length, qboolean fragment ) {
+
+	netchanStats_t *stats = SV_NetchanStatsForClient(client);
+	int size;
+
+	size = length + (fragment ? 4 + 4 + 2 : 4);
+
+	stats->packetsOut++;
+	stats->bytesOut += size;
+	sv_netchanTotals.packetsOut++;
+	sv_netchanTotals.bytesOut += size;
+	if(fragment)
+	{
+		stats->fragmentsOut++;
+		sv_netchanTotals.fragmentsOut++;
+	}
+}
+
+void SV_NetchanStatsEncodeTime( client_t *client, unsigned int usec ) {
+
+	SV_NetchanStatsForClient(client)->encodeUsec += usec;
+	sv_netchanTotals.encodeUsec += usec;
+}
+
+void SV_NetchanStatsRetransmit( client_t *client, int count ) {
+
+	if(count <= 0)
+		return;
+
+	SV_NetchanStatsForClient(client)->retransmits += count;
+	sv_netchanTotals.retransmits += count;
+}
+
+/*
+==============
+SV_Netchan_Process
+
+Netchan_Process for a packet of the client, with the accounting
+==============
+*/
+qboolean SV_Netchan_Process( client_t *client, msg_t *msg ) {
+
+	netchanStats_t *stats = SV_NetchanStatsForClient(client);
+	int sequence;
+
+	stats->packetsIn++;
+	stats->bytesIn += msg->cursize;
+	sv_netchanTotals.packetsIn++;
+	sv_netchanTotals.bytesIn += msg->cursize;
+
+	if(msg->cursize >= 4)
+	{
+		sequence = *(int*)msg->data;
+		if(sequence & FRAGMENT_BIT)
+		{
+			stats->fragmentsIn++;
+			sv_netchanTotals.fragmentsIn++;
+		}
+		if((sequence & ~FRAGMENT_BIT) <= client->netchan.incomingSequence)
+		{
+			stats->outOfOrder++;
+			sv_netchanTotals.outOfOrder++;
 		}
+	}
 
-		// modify the key with the last sent and acknowledged server command
-		key ^= string[index] << ( i & 1 );
-		data[i+4] ^= key;
+	if(!Netchan_Process(&client->netchan, msg))
+		return qfalse;
 
-		index++;
+	if(client->netchan.dropped > 0)
+	{
+		stats->dropped += client->netchan.dropped;
+		sv_netchanTotals.dropped += client->netchan.dropped;
 	}
+	return qtrue;
+}
+
+//Totals of the whole server if client is NULL
+void SV_GetNetchanStats( client_t *client, netchanStats_t *stats ) {
+
+	if(client == NULL)
+		*stats = sv_netchanTotals;
+	else
+		*stats = *SV_NetchanStatsForClient(client);
+}
+
+void SV_NetchanStatus_f( void ) {
+
+	netchanStats_t stats;
+	client_t *cl;
+	int i;
+
+	if ( !com_sv_running->boolean ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	Com_Printf ("num    in KB   out KB  pkts in pkts out frag in frag out  dropped late resent enc msec name\n");
+	Com_Printf ("--- -------- -------- -------- -------- ------- -------- -------- ---- ------ -------- ---------------\n");
+
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+
+		if ( cl->state < CS_CONNECTED || cl->netchan.remoteAddress.type == NA_BOT ) {
+			continue;
+		}
+		SV_GetNetchanStats(cl, &stats);
+		Com_Printf("%3i %8llu %8llu %8u %8u %7u %8u %8u %4u %6u %8llu %s\n", i, stats.bytesIn / 1024, stats.bytesOut / 1024,
+			stats.packetsIn, stats.packetsOut, stats.fragmentsIn, stats.fragmentsOut, stats.dropped, stats.outOfOrder,
+			stats.retransmits, stats.encodeUsec / 1000, cl->name);
+	}
+
+	SV_GetNetchanStats(NULL, &stats);
+	Com_Printf("Total: %llu KB in, %llu KB out, %u fragments out, %u dropped, %u late, %u resent, %llu msec spent encoding\n",
+		stats.bytesIn / 1024, stats.bytesOut / 1024, stats.fragmentsOut, stats.dropped, stats.outOfOrder,
+		stats.retransmits, stats.encodeUsec / 1000);
 }
 
 
@@ -171,14 +462,24 @@ then buffer them and make sure they get sent in correct order
 qboolean SV_Netchan_Transmit( client_t *client, byte *data, int cursize) {   //int length, const byte *data ) {
 
 	qboolean nt_ret;
+	unsigned long long codeStart;
 	int i;
 
 //	SV_DumpCommands(client, (byte*)data, cursize, qfalse);
 
 	if(cursize - 4){
+		codeStart = Sys_MicrosecondsLong();
 		SV_Netchan_Encode(client, data, cursize);
+		SV_NetchanStatsEncodeTime(client, Sys_MicrosecondsLong() - codeStart);
 	}
 	nt_ret = Netchan_Transmit( &client->netchan, cursize, data );
+
+	// only the first fragment went out if it had to be split
+	if(cursize >= FRAGMENT_SIZE)
+		SV_NetchanStatsSent(client, client->netchan.unsentFragmentStart, qtrue);
+	else
+		SV_NetchanStatsSent(client, cursize, qfalse);
+
 	if(client->netchan.unsentFragments){
 		return nt_ret;
 	}
@@ -207,9 +508,11 @@ then buffer them and make sure they get sent in correct order
 */
 __cdecl qboolean SV_Netchan_TransmitNextFragment( client_t *client ) {   //int length, const byte *data ) {
 
-	int i;
+	int i, fragmentStart;
 
+	fragmentStart = client->netchan.unsentFragmentStart;
 	Netchan_TransmitNextFragment( &client->netchan );
+	SV_NetchanStatsSent(client, client->netchan.unsentFragmentStart - fragmentStart, qtrue);
 
 	if(client->netchan.unsentFragments)
 		return qtrue; //Return true if we have still unsent fragments
@@ -0,0 +1,427 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+/*
+========================================================================
+
+Spectator relays
+
+The server connects to every host:port in sv_relayTargets and pushes it
+the live server demo stream of sv_demo.c. Spectators connect to the relays
+instead of taking client slots of the game server, so whatever number of
+them the relays can take costs this server one stream per relay.
+
+The snapshots of the clients get built by the binary out of the running
+game, a relay has no game to build them from. Turning the stream back into
+snapshots for the viewers is up to the relay program.
+
+Stream, all little endian:
+	"CD4XRLAY" int version string sv_relayPassword
+	then for every level the server demo which starts with a keyframe:
+	"CD4XSVDM" header, frames, SVDEMO_END
+	string: short len char[len]
+
+A relay which connects during a level gets the header of the level and
+from the next keyframe on the frames. Frames a relay can not take are
+queued up to sv_relayMaxQueue KB, a relay which falls further behind is
+dropped and connected again.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon_mem.h"
+#include "qcommon.h"
+#include "cvar.h"
+#include "cmd.h"
+#include "server.h"
+#include "sys_main.h"
+#include "sys_net.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define MAX_RELAYS 8
+#define RELAY_VERSION 1
+#define RELAY_RETRY_MSEC 10000
+
+typedef enum{
+	RELAY_IDLE,
+	RELAY_CONNECTING,
+	RELAY_WAITKEYFRAME,	//Connected, gets the stream from the next keyframe on
+	RELAY_STREAMING
+}relayState_t;
+
+typedef struct{
+	char		address[256];
+	relayState_t	state;
+	netTcpClientConnect_t connect;
+	int		sock;
+	byte*		queue;		//Not yet sent are [queueHead, queueHead + queueLen)
+	int		queueSize;
+	int		queueHead;
+	int		queueLen;
+	int		retryTime;
+	unsigned long long bytesSent;
+}relay_t;
+
+static struct{
+	relay_t		relays[MAX_RELAYS];
+	int		numRelays;
+	char		targets[MAX_STRING_CHARS];	//sv_relayTargets the list got built from
+	byte*		header;				//Of the level which is streamed, NULL if none
+	int		headerLen;
+	byte*		frame;
+	int		frameLen;
+	int		frameSize;
+	qboolean	frameKeyframe;
+}sv_relay;
+
+static cvar_t* sv_relayTargets;
+static cvar_t* sv_relayPassword;
+static cvar_t* sv_relayMaxQueue;
+
+
+static void SV_RelayDrop( relay_t* relay, const char* reason, qboolean closeSocket ) {
+
+	if(relay->state >= RELAY_WAITKEYFRAME)
+		Com_PrintWarning("Spectator relay %s dropped: %s\n", relay->address, reason);
+
+	if(relay->state == RELAY_CONNECTING)
+		NET_TcpClientConnectAbort(&relay->connect);
+
+	if(closeSocket && relay->sock > 0)
+		NET_TcpCloseSocket(relay->sock);
+
+	free(relay->queue);
+	relay->queue = NULL;
+	relay->queueSize = 0;
+	relay->queueHead = 0;
+	relay->queueLen = 0;
+	relay->sock = -1;
+	relay->state = RELAY_IDLE;
+	relay->retryTime = Sys_Milliseconds() + RELAY_RETRY_MSEC;
+}
+
+//Writes out as much of the queue as the kernel takes
+static void SV_RelayFlush( relay_t* relay ) {
+
+	int sent;
+
+	while(relay->queueLen > 0)
+	{
+		sent = NET_TcpTrySend(relay->sock, relay->queue + relay->queueHead, relay->queueLen);
+		if(sent < 0)
+		{
+			SV_RelayDrop(relay, "Connection lost", qfalse);	//NET_TcpTrySend closed the socket already
+			return;
+		}
+		if(sent == 0)
+			return;
+
+		relay->queueHead += sent;
+		relay->queueLen -= sent;
+		relay->bytesSent += sent;
+	}
+	relay->queueHead = 0;
+}
+
+static void SV_RelaySend( relay_t* relay, const void* data, int len ) {
+
+	int sent;
+
+	if(relay->state < RELAY_WAITKEYFRAME)
+		return;	//Got dropped
+
+	if(relay->queueLen == 0)
+	{
+		sent = NET_TcpTrySend(relay->sock, data, len);
+		if(sent < 0)
+		{
+			SV_RelayDrop(relay, "Connection lost", qfalse);
+			return;
+		}
+		relay->bytesSent += sent;
+		if(sent >= len)
+			return;
+
+		data += sent;
+		len -= sent;
+	}
+
+	if(relay->queueHead + relay->queueLen + len > relay->queueSize && relay->queueHead > 0)
+	{
+		memmove(relay->queue, relay->queue + relay->queueHead, relay->queueLen);
+		relay->queueHead = 0;
+	}
+
+	if(relay->queueLen + len > relay->queueSize)
+	{
+		SV_RelayDrop(relay, "Too far behind", qtrue);
+		return;
+	}
+
+	Com_Memcpy(relay->queue + relay->queueHead + relay->queueLen, data, len);
+	relay->queueLen += len;
+}
+
+static void SV_RelaySendString( relay_t* relay, const char* string ) {
+
+	short len;
+
+	len = strlen(string);
+	SV_RelaySend(relay, &len, 2);
+	SV_RelaySend(relay, string, len);
+}
+
+static void SV_RelayConnected( relay_t* relay ) {
+
+	int version;
+
+	relay->sock = relay->connect.sock;
+	relay->connect.state = TCPCONNECT_IDLE;
+
+	relay->queueSize = sv_relayMaxQueue->integer * 1024;
+	relay->queue = malloc(relay->queueSize);
+	if(relay->queue == NULL)
+	{
+		SV_RelayDrop(relay, "Out of memory", qtrue);
+		return;
+	}
+	relay->queueHead = 0;
+	relay->queueLen = 0;
+	relay->bytesSent = 0;
+	relay->state = RELAY_WAITKEYFRAME;
+
+	SV_RelaySend(relay, "CD4XRLAY", 8);
+	version = RELAY_VERSION;
+	SV_RelaySend(relay, &version, 4);
+	SV_RelaySendString(relay, sv_relayPassword->string);
+
+	if(relay->state == RELAY_WAITKEYFRAME)
+		Com_Printf("Spectator relay %s connected\n", relay->address);
+}
+
+//Builds the list of relays again whenever sv_relayTargets got changed
+static void SV_RelayUpdateTargets( void ) {
+
+	char* token;
+	int i, len;
+
+	if(!strcmp(sv_relay.targets, sv_relayTargets->string))
+		return;
+
+	for(i = 0; i < sv_relay.numRelays; i++)
+		SV_RelayDrop(&sv_relay.relays[i], "Removed from sv_relayTargets", qtrue);
+
+	Com_Memset(sv_relay.relays, 0, sizeof(sv_relay.relays));
+	sv_relay.numRelays = 0;
+	Q_strncpyz(sv_relay.targets, sv_relayTargets->string, sizeof(sv_relay.targets));
+
+	Com_ParseReset();
+	token = Com_ParseGetToken(sv_relay.targets);
+
+	while(token != NULL && sv_relay.numRelays < MAX_RELAYS)
+	{
+		len = Com_ParseTokenLength(token);
+		if(len >= sizeof(sv_relay.relays[0].address))
+			len = sizeof(sv_relay.relays[0].address) -1;
+
+		Q_strncpyz(sv_relay.relays[sv_relay.numRelays].address, token, len +1);
+		sv_relay.relays[sv_relay.numRelays].sock = -1;
+		sv_relay.relays[sv_relay.numRelays].state = RELAY_IDLE;
+		sv_relay.numRelays++;
+
+		token = Com_ParseGetToken(token);
+	}
+}
+
+/*
+==================
+SV_RelayFrame
+
+Called every server frame. Connects the relays and writes out their queues
+==================
+*/
+void SV_RelayFrame( void ) {
+
+	relay_t* relay;
+	netTcpConnectState_t state;
+	int i;
+
+	SV_RelayUpdateTargets();
+
+	for(i = 0, relay = sv_relay.relays; i < sv_relay.numRelays; i++, relay++)
+	{
+		switch(relay->state)
+		{
+			case RELAY_IDLE:
+				if(Sys_Milliseconds() - relay->retryTime < 0)
+					break;
+				NET_TcpClientConnectStart(&relay->connect, relay->address);
+				relay->state = RELAY_CONNECTING;
+				break;
+
+			case RELAY_CONNECTING:
+				state = NET_TcpClientConnectPoll(&relay->connect);
+				if(state == TCPCONNECT_CONNECTED)
+					SV_RelayConnected(relay);
+				else if(state == TCPCONNECT_FAILED)
+					SV_RelayDrop(relay, "Can not connect", qfalse);
+				break;
+
+			case RELAY_WAITKEYFRAME:
+			case RELAY_STREAMING:
+				SV_RelayFlush(relay);
+				break;
+		}
+	}
+}
+
+qboolean SV_RelayActive( void ) {
+
+	int i;
+
+	for(i = 0; i < sv_relay.numRelays; i++)
+	{
+		if(sv_relay.relays[i].state >= RELAY_WAITKEYFRAME)
+			return qtrue;
+	}
+	return qfalse;
+}
+
+qboolean SV_RelayWaitingForKeyframe( void ) {
+
+	int i;
+
+	for(i = 0; i < sv_relay.numRelays; i++)
+	{
+		if(sv_relay.relays[i].state == RELAY_WAITKEYFRAME)
+			return qtrue;
+	}
+	return qfalse;
+}
+
+//A level begins, the header gets sent ahead of the first keyframe of every relay
+void SV_RelayStreamStart( const void* header, int len ) {
+
+	SV_RelayStreamEnd();
+
+	sv_relay.header = Z_Malloc(len);
+	Com_Memcpy(sv_relay.header, header, len);
+	sv_relay.headerLen = len;
+}
+
+void SV_RelayStreamEnd( void ) {
+
+	int i;
+
+	if(sv_relay.header)
+		Z_Free(sv_relay.header);
+
+	sv_relay.header = NULL;
+	sv_relay.headerLen = 0;
+
+	for(i = 0; i < sv_relay.numRelays; i++)
+	{
+		if(sv_relay.relays[i].state == RELAY_STREAMING)
+			sv_relay.relays[i].state = RELAY_WAITKEYFRAME;
+	}
+}
+
+void SV_RelayFrameBegin( qboolean keyframe ) {
+
+	sv_relay.frameLen = 0;
+	sv_relay.frameKeyframe = keyframe;
+}
+
+void SV_RelayWrite( const void* data, int len ) {
+
+	byte* frame;
+	int size;
+
+	if(sv_relay.frameLen + len > sv_relay.frameSize)
+	{
+		for(size = sv_relay.frameSize ? sv_relay.frameSize : 0x10000; size < sv_relay.frameLen + len; size *= 2);
+
+		frame = Z_Malloc(size);
+		if(sv_relay.frame)
+		{
+			Com_Memcpy(frame, sv_relay.frame, sv_relay.frameLen);
+			Z_Free(sv_relay.frame);
+		}
+		sv_relay.frame = frame;
+		sv_relay.frameSize = size;
+	}
+	Com_Memcpy(sv_relay.frame + sv_relay.frameLen, data, len);
+	sv_relay.frameLen += len;
+}
+
+//The same bytes go to every relay which reads the stream
+void SV_RelayFrameEnd( void ) {
+
+	relay_t* relay;
+	int i;
+
+	for(i = 0, relay = sv_relay.relays; i < sv_relay.numRelays; i++, relay++)
+	{
+		if(relay->state == RELAY_WAITKEYFRAME && sv_relay.frameKeyframe && sv_relay.header)
+		{
+			relay->state = RELAY_STREAMING;
+			SV_RelaySend(relay, sv_relay.header, sv_relay.headerLen);
+		}
+		if(relay->state == RELAY_STREAMING)
+			SV_RelaySend(relay, sv_relay.frame, sv_relay.frameLen);
+	}
+}
+
+static void SV_RelayStatus_f( void ) {
+
+	static const char* states[] = { "idle", "connecting", "waiting", "streaming" };
+	relay_t* relay;
+	int i;
+
+	if(sv_relay.numRelays == 0)
+	{
+		Com_Printf("No spectator relays in sv_relayTargets\n");
+		return;
+	}
+
+	Com_Printf("relay                          state      sent_KB queued_KB\n");
+	for(i = 0, relay = sv_relay.relays; i < sv_relay.numRelays; i++, relay++)
+	{
+		Com_Printf("%-30.30s %-10s %7llu %9d\n", relay->address, states[relay->state],
+			relay->bytesSent / 1024, relay->queueLen / 1024);
+	}
+}
+
+void SV_RelayInit( void ) {
+
+	sv_relayTargets = Cvar_RegisterString("sv_relayTargets", "", 0, "Space separated host:port list of spectator relays which get the live server demo stream");
+	sv_relayPassword = Cvar_RegisterString("sv_relayPassword", "", 0, "Password which is sent to the spectator relays");
+	sv_relayMaxQueue = Cvar_RegisterInt("sv_relayMaxQueue", 4096, 256, 65536, 0, "KB of the stream which can be waiting for a spectator relay before it gets dropped");
+
+	Cmd_AddCommand("relaystatus", SV_RelayStatus_f);
+}
@@ -0,0 +1,293 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+/*
+========================================================================
+
+Shared store for ban and admin updates of servers running on the same box
+
+All instances which set sv_sharedStore to the same file map it and append
+the records they write into the banlist journal or nvconfig to a ring in
+it. Every frame each instance replays the records the others appended
+since, so a ban is active on all servers right away without reading any
+file. The files stay the persistent storage, the ring only carries the
+changes.
+
+Every record has its own sequence lock: the writer clears the serial,
+fills the record and publishes the serial again. A reader which sees the
+same serial before and after copying a record got it consistent. Writers
+serialize on a lock word holding their pid, so a crashed writer can not
+block the others forever.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon.h"
+#include "filesystem.h"
+#include "cvar.h"
+#include "server.h"
+#include "nvconfig.h"
+#include "sys_main.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+
+#define SHAREDSTORE_MAGIC 0x52545353		//"SSTR"
+#define SHAREDSTORE_VERSION 1
+#define SHAREDSTORE_RECORDS 1024		//Must be a power of 2
+#define SHAREDSTORE_RECORDLENGTH 1012
+#define SHAREDSTORE_LOCKTIMEOUT 250		//Milliseconds until the owner of the lock gets checked
+
+
+typedef struct{
+	volatile unsigned int	serial;		//Record number + 1 while it is valid, 0 while it gets written
+	int	type;
+	int	origin;				//pid of the writer
+	char	data[SHAREDSTORE_RECORDLENGTH];
+}sharedStoreRecord_t;
+
+typedef struct{
+	int	magic;
+	int	version;
+	volatile int	lock;			//pid of the writer or 0
+	volatile unsigned int	head;		//Number of records written so far
+	sharedStoreRecord_t	records[SHAREDSTORE_RECORDS];
+}sharedStore_t;
+
+
+static cvar_t *sv_sharedStore;
+static sharedStore_t *sharedstore;
+static unsigned int sharedstoreHead;		//Number of records we have seen
+static int sharedstorePid;
+
+
+/*
+================
+SV_SharedStoreInit
+================
+*/
+void SV_SharedStoreInit( void ) {
+
+	char ospath[MAX_OSPATH];
+	struct stat fileinfo;
+	void *mapped;
+	int fd;
+
+	sv_sharedStore = Cvar_RegisterString("sv_sharedStore", "", CVAR_INIT, "File in fs_homepath which servers on the same host map to share ban and admin updates. Empty disables it");
+
+	if(!*sv_sharedStore->string || sharedstore)
+		return;
+
+	Q_strncpyz(ospath, FS_BuildOSPath( fs_homepath->string, sv_sharedStore->string, "" ), sizeof(ospath));
+	ospath[strlen(ospath)-1] = '\0';
+
+	fd = open(ospath, O_RDWR | O_CREAT, 0644);
+	if(fd < 0)
+	{
+		Com_PrintWarning("Shared store: Can not open %s: %s\n", ospath, strerror(errno));
+		return;
+	}
+
+	//Only one instance may create the file at a time
+	flock(fd, LOCK_EX);
+
+	if(fstat(fd, &fileinfo) != 0 || (fileinfo.st_size < sizeof(sharedStore_t) && ftruncate(fd, sizeof(sharedStore_t)) != 0))
+	{
+		Com_PrintWarning("Shared store: Can not resize %s: %s\n", ospath, strerror(errno));
+		flock(fd, LOCK_UN);
+		close(fd);
+		return;
+	}
+
+	mapped = mmap(NULL, sizeof(sharedStore_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	if(mapped == MAP_FAILED)
+	{
+		Com_PrintWarning("Shared store: mmap of %s failed: %s\n", ospath, strerror(errno));
+		flock(fd, LOCK_UN);
+		close(fd);
+		return;
+	}
+
+	sharedstore = mapped;
+
+	if(sharedstore->magic != SHAREDSTORE_MAGIC || sharedstore->version != SHAREDSTORE_VERSION)
+	{
+		Com_Memset(sharedstore, 0, sizeof(sharedStore_t));
+		sharedstore->version = SHAREDSTORE_VERSION;
+		__sync_synchronize();
+		sharedstore->magic = SHAREDSTORE_MAGIC;
+	}
+
+	flock(fd, LOCK_UN);
+	close(fd);
+
+	//Everything written before is in the files we have loaded already
+	sharedstoreHead = sharedstore->head;
+	sharedstorePid = getpid();
+
+	Com_Printf("Sharing ban and admin updates through %s\n", ospath);
+}
+
+
+static void SV_SharedStoreLock( void ) {
+
+	unsigned int start;
+	int owner;
+
+	start = Sys_Milliseconds();
+
+	while(!__sync_bool_compare_and_swap(&sharedstore->lock, 0, sharedstorePid))
+	{
+		if(Sys_Milliseconds() - start > SHAREDSTORE_LOCKTIMEOUT)
+		{
+			//Take the lock over from a writer which died while holding it
+			owner = sharedstore->lock;
+			if(owner != 0 && kill(owner, 0) != 0 && errno == ESRCH)
+				__sync_bool_compare_and_swap(&sharedstore->lock, owner, 0);
+
+			start = Sys_Milliseconds();
+		}
+		usleep(0);
+	}
+}
+
+
+static void SV_SharedStoreUnlock( void ) {
+
+	__sync_synchronize();
+	sharedstore->lock = 0;
+}
+
+
+/*
+================
+SV_SharedStorePublish
+
+Appends a record for all other servers
+================
+*/
+void SV_SharedStorePublish( sharedStoreType_t type, const char* data ) {
+
+	sharedStoreRecord_t *record;
+	unsigned int head;
+
+	if(!sharedstore)
+		return;
+
+	if(strlen(data) >= SHAREDSTORE_RECORDLENGTH)
+	{
+		Com_PrintWarning("Shared store: Record is too long\n");
+		return;
+	}
+
+	SV_SharedStoreLock();
+
+	head = sharedstore->head;
+	record = &sharedstore->records[head & (SHAREDSTORE_RECORDS -1)];
+
+	record->serial = 0;
+	__sync_synchronize();
+
+	record->type = type;
+	record->origin = sharedstorePid;
+	Q_strncpyz(record->data, data, sizeof(record->data));
+
+	__sync_synchronize();
+	record->serial = head +1;
+	sharedstore->head = head +1;
+
+	SV_SharedStoreUnlock();
+
+	//Our own records are not replayed
+	if(sharedstoreHead == head)
+		sharedstoreHead = head +1;
+}
+
+
+/*
+================
+SV_SharedStoreFrame
+
+Replays the records the other servers have appended
+================
+*/
+void SV_SharedStoreFrame( void ) {
+
+	sharedStoreRecord_t record;
+	sharedStoreRecord_t *shared;
+	unsigned int head;
+	unsigned int serial;
+
+	if(!sharedstore)
+		return;
+
+	head = sharedstore->head;
+	__sync_synchronize();
+
+	while(sharedstoreHead != head)
+	{
+		shared = &sharedstore->records[sharedstoreHead & (SHAREDSTORE_RECORDS -1)];
+
+		serial = shared->serial;
+		__sync_synchronize();
+		Com_Memcpy(&record, shared, sizeof(record));
+		__sync_synchronize();
+
+		if(serial != sharedstoreHead +1 || shared->serial != serial)
+		{
+			//We fell behind by more than the whole ring
+			Com_PrintWarning("Shared store: Missed updates, reloading banlist and nvconfig\n");
+			SV_ReloadBanlist();
+			NV_LoadConfig();
+			sharedstoreHead = head;
+			return;
+		}
+
+		sharedstoreHead++;
+
+		if(record.origin == sharedstorePid)
+			continue;
+
+		record.data[sizeof(record.data) -1] = '\0';
+
+		switch(record.type)
+		{
+			case SHAREDSTORE_BAN:
+				SV_BanlistApplyShared(record.data);
+				break;
+			case SHAREDSTORE_ADMIN:
+				SV_RemoteCmdApplySharedAdmin(record.data);
+				break;
+		}
+	}
+}
@@ -28,10 +28,13 @@
 #include "huffman.h"
 #include "msg.h"
 #include "sys_main.h"
+#include "g_shared.h"
+#include "qcommon_metrics.h"
 
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 /*
 =============================================================================
@@ -79,113 +82,29 @@ __cdecl void SV_UpdateServerCommandsToClient( client_t *client, msg_t *msg ) {
 }
 
 
-__cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
+/*
+==================
+SV_WriteSnapshotBody
+
+The playerstate, the entities and the clients of a snapshot
+==================
+*/
+static void SV_WriteSnapshotBody( snapshotInfo_t *snapInfo, msg_t *msg, clientSnapshot_t *frame, clientSnapshot_t *oldframe ) {
 
-    snapshotInfo_t snapInfo;
-    int lastframe;
     int from_num_entities;
     int newindex, oldindex, newnum, oldnum;
     clientState_ts *newcs, *oldcs;
     entityState_t *newent, *oldent;
-    clientSnapshot_t *frame, *oldframe;
-    int i;
-    int snapFlags;
-    int var_x, from_first_entity, from_num_clients, from_first_client;
-
-    snapInfo.clnum = client - svsHeader.clients;
-    snapInfo.cl = (void*)client;
-    snapInfo.var_01 = 0;
-    snapInfo.var_02 = 0;
-    snapInfo.var_03 = 0;
-
-    frame = &client->frames[client->netchan.outgoingSequence & PACKET_MASK];
-    frame->var_03 = svsHeader.time;
-
-    if(client->deltaMessage <= 0 ||  client->state != CS_ACTIVE) {
-        oldframe = NULL;
-        lastframe = 0;
-        var_x = 0;
-
-    } else if(client->netchan.outgoingSequence - client->deltaMessage >= PACKET_BACKUP - 3) {
-        Com_DPrintf("%s: Delta request from out of date packet.\n", client->name);
-        oldframe = NULL;
-        lastframe = 0;
-        var_x = 0;
-
-    } else if(client->demoDeltaFrameCount <= 0 && client->demorecording){
-
-        oldframe = NULL;
-        lastframe = 0;
-        var_x = 0;
-        client->demowaiting = qfalse;
-        Com_DPrintf("Force a nondelta frame for %s for demo recording\n", client->name);
-
-        if(client->demoMaxDeltaFrames < 1024)
-        {
-            client->demoMaxDeltaFrames <<= 1;
-        }
-        client->demoDeltaFrameCount = client->demoMaxDeltaFrames;
-
-
-    } else {
-        oldframe = &client->frames[client->deltaMessage & PACKET_MASK];
-        lastframe = client->netchan.outgoingSequence - client->deltaMessage;
-        var_x = oldframe->var_03;
-        client->demoDeltaFrameCount--;
-
-        if(oldframe->first_entity <  svsHeader.nextSnapshotEntities - svsHeader.numSnapshotEntities) {
-            Com_PrintWarning("%s: Delta request from out of date entities - delta against entity %i, oldest is %i, current is %i.  Their old snapshot had %i entities in it\n",
-                            client->name, oldframe->first_entity, svs.nextSnapshotEntities - svs.numSnapshotEntities, svs.nextSnapshotEntities, oldframe->num_entities );
-            oldframe = NULL;
-            lastframe = 0;
-            var_x = 0;
-
-        } else if(oldframe->first_client <  svsHeader.nextSnapshotClients - svsHeader.numSnapshotClients) {
-
-            Com_PrintWarning("%s: Delta request from out of date clients - delta against client %i, oldest is %i, current is %i.  Their old snapshot had %i clients in it\n", 
-                            client->name, oldframe->first_client, svs.nextSnapshotClients - svs.numSnapshotClients, svs.nextSnapshotClients, oldframe->num_clients);
-            oldframe = NULL;
-            lastframe = 0;
-            var_x = 0;
-        }
-    }
-
-
-    MSG_WriteByte(msg, svc_snapshot);
-    MSG_WriteLong(msg, svsHeader.time);
-    MSG_WriteByte(msg, lastframe);
-    snapInfo.var_01 = var_x;
-
-    snapFlags = svsHeader.snapFlagServerBit;
-
-    if(client->rateDelayed){
-	snapFlags |= 1;
-    }
-
-    if(client->state == CS_ACTIVE) {
-
-	client->unksnapshotvar = 1;
-
-    } else {
-	if(client->state != CS_ZOMBIE){
-		client->unksnapshotvar = 0;
-	}
-    }
-
-    if(!client->unksnapshotvar){
-	snapFlags |= 2;
-    }
-
-    MSG_WriteByte(msg, snapFlags);
+    int from_first_entity, from_num_clients, from_first_client;
 
     if(oldframe) {
-		MSG_WriteDeltaPlayerstate( &snapInfo, msg, svsHeader.time, &oldframe->ps, &frame->ps);
+		MSG_WriteDeltaPlayerstate( snapInfo, msg, svsHeader.time, &oldframe->ps, &frame->ps);
 		from_num_entities = oldframe->num_entities;
 		from_first_entity = oldframe->first_entity;
 		from_num_clients = oldframe->num_clients;
 		from_first_client = oldframe->first_client;
     } else {
-	        MSG_WriteDeltaPlayerstate( &snapInfo, msg, svsHeader.time, 0, &frame->ps);
+	        MSG_WriteDeltaPlayerstate( snapInfo, msg, svsHeader.time, 0, &frame->ps);
 		from_num_entities = 0;
 		from_first_entity = 0;
 		from_num_clients = 0;
@@ -198,7 +117,7 @@ __cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
     newindex = 0;
     oldindex = 0;
 
-//    Com_Printf("\nDelta client: %i:\n", snapInfo.clnum);
+//    Com_Printf("\nDelta client: %i:\n", snapInfo->clnum);
 
 
     while ( newindex < frame->num_entities || oldindex < from_num_entities){
@@ -224,7 +143,7 @@ __cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
 		// in any bytes being emited if the entity has not changed at all
 //		if(newent->number < 64 || oldent->number < 64)
 //			Com_Printf("   Delta Update Entity - New delta: %i, %x  Old delta: %i, %x\n", newent->number, newent, oldent->number, oldent);
-		MSG_WriteDeltaEntity( &snapInfo, msg, svsHeader.time, oldent, newent, qfalse );
+		MSG_WriteDeltaEntity( snapInfo, msg, svsHeader.time, oldent, newent, qfalse );
 		oldindex++;
 		newindex++;
 		continue;
@@ -232,11 +151,11 @@ __cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
 
 	if ( newnum < oldnum ) {
 		// this is a new entity, send it from the baseline
-		snapInfo.var_02 = 1;
+		snapInfo->var_02 = 1;
 //		if(newent->number < 64)
 //			Com_Printf("   Delta Add Entity: %i, %x\n", newent->number, newent);
-		MSG_WriteDeltaEntity( &snapInfo, msg, svsHeader.time, &svsHeader.svEntities[newnum].baseline, newent, qtrue );
-		snapInfo.var_02 = 0;
+		MSG_WriteDeltaEntity( snapInfo, msg, svsHeader.time, &svsHeader.svEntities[newnum].baseline, newent, qtrue );
+		snapInfo->var_02 = 0;
 		newindex++;
 		continue;
 	}
@@ -245,14 +164,14 @@ __cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
 		// the old entity isn't present in the new message
 //		if(oldent->number < 64)
 //			Com_Printf("   Delta Remove Entity: %i, %x\n", oldent->number, oldent);
-		MSG_WriteDeltaEntity( &snapInfo, msg, svsHeader.time, oldent, NULL, qtrue );
+		MSG_WriteDeltaEntity( snapInfo, msg, svsHeader.time, oldent, NULL, qtrue );
 		oldindex++;
 		continue;
 	}
     }
 
 
-    MSG_WriteEntityIndex(&snapInfo, msg, ( MAX_GENTITIES - 1 ), GENTITYNUM_BITS);
+    MSG_WriteEntityIndex(snapInfo, msg, ( MAX_GENTITIES - 1 ), GENTITYNUM_BITS);
     MSG_ClearLastReferencedEntity(msg);
 
     newindex = 0;
@@ -281,26 +200,267 @@ __cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
 		// delta update from old position
 		// because the force parm is qfalse, this will not result
 		// in any bytes being emited if the entity has not changed at all
-		MSG_WriteDeltaClient( &snapInfo, msg, svsHeader.time, oldcs, newcs, qfalse );
+		MSG_WriteDeltaClient( snapInfo, msg, svsHeader.time, oldcs, newcs, qfalse );
 		oldindex++;
 		newindex++;
 		continue;
 	}
 
 	if ( newnum < oldnum ) {
-		MSG_WriteDeltaClient( &snapInfo, msg, svsHeader.time, NULL, newcs, qtrue );
+		MSG_WriteDeltaClient( snapInfo, msg, svsHeader.time, NULL, newcs, qtrue );
 		newindex++;
 		continue;
 	}
 
 	if ( newnum > oldnum ) {
-		MSG_WriteDeltaClient( &snapInfo, msg, svsHeader.time, oldcs, NULL, qtrue );
+		MSG_WriteDeltaClient( snapInfo, msg, svsHeader.time, oldcs, NULL, qtrue );
 		oldindex++;
 		continue;
 	}
     }
 
     MSG_WriteBit0(msg);
+}
+
+
+/*
+==================
+Shared snapshot bodies
+
+Spectators who follow the same player with the same delta base get identical
+bodies, only the header in front of it with the reliable commands, the sequence
+and the snapFlags is their own. The first of them encodes it, the others of the
+same server frame get the encoded bits copied if their inputs match: the old and
+the new frame by content, the time of the old frame, the bit position the body
+starts at and the team of the viewer, which the solid bits of the entities depend on.
+==================
+*/
+#define SNAPCACHE_ENTRIES 8
+#define SNAPCACHE_MAXBYTES 0x4000
+
+typedef struct{
+	int			time;		//svsHeader.time, 0 = unused
+	int			align;
+	int			team;
+	int			oldTime;
+	clientSnapshot_t	*frame;		//Of the client who encoded it, valid while time is current
+	clientSnapshot_t	*oldframe;
+	int			length;
+	int			bit;
+	byte			data[SNAPCACHE_MAXBYTES];
+}snapshotCacheEntry_t;
+
+static snapshotCacheEntry_t sv_snapshotCache[SNAPCACHE_ENTRIES];
+static int sv_snapshotCacheNext;
+static unsigned int sv_snapshotCacheHits;
+static unsigned int sv_snapshotCacheMisses;
+
+
+static qboolean SV_SnapshotFramesMatch( clientSnapshot_t *a, clientSnapshot_t *b ) {
+
+	int i;
+
+	if(a == b)
+		return qtrue;
+
+	if(a == NULL || b == NULL)
+		return qfalse;
+
+	if(a->num_entities != b->num_entities || a->num_clients != b->num_clients)
+		return qfalse;
+
+	if(memcmp(&a->ps, &b->ps, sizeof(playerState_t)))
+		return qfalse;
+
+	for(i = 0; i < a->num_entities; i++)
+	{
+		if(memcmp(&svsHeader.snapshotEntities[(a->first_entity + i) % svsHeader.numSnapshotEntities],
+			&svsHeader.snapshotEntities[(b->first_entity + i) % svsHeader.numSnapshotEntities], sizeof(entityState_t)))
+			return qfalse;
+	}
+
+	for(i = 0; i < a->num_clients; i++)
+	{
+		if(memcmp(&svsHeader.snapshotClients[(a->first_client + i) % svsHeader.numSnapshotClients],
+			&svsHeader.snapshotClients[(b->first_client + i) % svsHeader.numSnapshotClients], sizeof(clientState_ts)))
+			return qfalse;
+	}
+	return qtrue;
+}
+
+static void SV_WriteSharedSnapshotBody( snapshotInfo_t *snapInfo, msg_t *msg, clientSnapshot_t *frame, clientSnapshot_t *oldframe ) {
+
+	snapshotCacheEntry_t *entry;
+	msg_t scratch;
+	byte *scratchData;
+	int i, align, team;
+
+	align = msg->bit & 7;
+	team = g_entities[snapInfo->clnum].client->sess.sessionTeam;
+
+	for(i = 0, entry = sv_snapshotCache; i < SNAPCACHE_ENTRIES; i++, entry++)
+	{
+		if(entry->time != svsHeader.time || entry->align != align || entry->team != team || entry->oldTime != snapInfo->var_01)
+			continue;
+
+		if(entry->frame->ps.clientNum != frame->ps.clientNum || (entry->oldframe == NULL) != (oldframe == NULL))
+			continue;
+
+		if(!SV_SnapshotFramesMatch(entry->frame, frame) || !SV_SnapshotFramesMatch(entry->oldframe, oldframe))
+			continue;
+
+		sv_snapshotCacheHits++;
+		MSG_AppendEncoded(msg, entry->data, entry->length, entry->bit);
+		return;
+	}
+
+	sv_snapshotCacheMisses++;
+
+	scratchData = MSG_GetBuffer(SNAPCACHE_MAXBYTES);
+	MSG_Init(&scratch, scratchData, SNAPCACHE_MAXBYTES);
+	if(align)
+	{
+		scratchData[0] = 0;
+		scratch.cursize = 1;
+		scratch.bit = align;
+	}
+
+	SV_WriteSnapshotBody(snapInfo, &scratch, frame, oldframe);
+
+	if(scratch.overflowed)
+	{
+		//Too big to be kept, encode it straight into the message
+		MSG_FreeBuffer(scratchData);
+		SV_WriteSnapshotBody(snapInfo, msg, frame, oldframe);
+		return;
+	}
+
+	entry = &sv_snapshotCache[sv_snapshotCacheNext];
+	sv_snapshotCacheNext = (sv_snapshotCacheNext + 1) % SNAPCACHE_ENTRIES;
+
+	entry->time = svsHeader.time;
+	entry->align = align;
+	entry->team = team;
+	entry->oldTime = snapInfo->var_01;
+	entry->frame = frame;
+	entry->oldframe = oldframe;
+	entry->length = scratch.cursize;
+	entry->bit = scratch.bit;
+	Com_Memcpy(entry->data, scratchData, scratch.cursize);
+
+	MSG_AppendEncoded(msg, scratchData, scratch.cursize, scratch.bit);
+	MSG_FreeBuffer(scratchData);
+}
+
+
+__cdecl void SV_WriteSnapshotToClient(client_t* client, msg_t* msg){
+
+    snapshotInfo_t snapInfo;
+    int lastframe;
+    clientSnapshot_t *frame, *oldframe;
+    int i;
+    int snapFlags;
+    int var_x;
+
+    snapInfo.clnum = client - svsHeader.clients;
+    snapInfo.cl = (void*)client;
+    snapInfo.var_01 = 0;
+    snapInfo.var_02 = 0;
+    snapInfo.var_03 = 0;
+
+    frame = &client->frames[client->netchan.outgoingSequence & PACKET_MASK];
+    frame->var_03 = svsHeader.time;
+
+    if(client->deltaMessage <= 0 ||  client->state != CS_ACTIVE) {
+        oldframe = NULL;
+        lastframe = 0;
+        var_x = 0;
+
+    } else if(client->netchan.outgoingSequence - client->deltaMessage >= PACKET_BACKUP - 3) {
+        Com_DPrintf("%s: Delta request from out of date packet.\n", client->name);
+        oldframe = NULL;
+        lastframe = 0;
+        var_x = 0;
+
+    } else if((client->demorecording && (client->demoDeltaFrameCount <= 0 || SV_DemoKeyframeDue(client))) || SV_ReplayKeyframeDue(client)){
+
+        oldframe = NULL;
+        lastframe = 0;
+        var_x = 0;
+        client->demowaiting = qfalse;
+        Com_DPrintf("Force a nondelta frame for %s for demo recording\n", client->name);
+
+        if(client->demoMaxDeltaFrames < 1024)
+        {
+            client->demoMaxDeltaFrames <<= 1;
+        }
+        client->demoDeltaFrameCount = client->demoMaxDeltaFrames;
+
+
+    } else {
+        oldframe = &client->frames[client->deltaMessage & PACKET_MASK];
+        lastframe = client->netchan.outgoingSequence - client->deltaMessage;
+        var_x = oldframe->var_03;
+        client->demoDeltaFrameCount--;
+
+        if(oldframe->first_entity <  svsHeader.nextSnapshotEntities - svsHeader.numSnapshotEntities) {
+            Com_PrintWarning("%s: Delta request from out of date entities - delta against entity %i, oldest is %i, current is %i.  Their old snapshot had %i entities in it\n",
+                            client->name, oldframe->first_entity, svs.nextSnapshotEntities - svs.numSnapshotEntities, svs.nextSnapshotEntities, oldframe->num_entities );
+            oldframe = NULL;
+            lastframe = 0;
+            var_x = 0;
+
+        } else if(oldframe->first_client <  svsHeader.nextSnapshotClients - svsHeader.numSnapshotClients) {
+
+            Com_PrintWarning("%s: Delta request from out of date clients - delta against client %i, oldest is %i, current is %i.  Their old snapshot had %i clients in it\n", 
+                            client->name, oldframe->first_client, svs.nextSnapshotClients - svs.numSnapshotClients, svs.nextSnapshotClients, oldframe->num_clients);
+            oldframe = NULL;
+            lastframe = 0;
+            var_x = 0;
+        }
+    }
+
+
+    if(oldframe == NULL)
+    {
+        if(client->demorecording)
+            SV_DemoKeyframe(client);
+
+        SV_ReplayKeyframe(client);
+    }
+
+    MSG_WriteByte(msg, svc_snapshot);
+    MSG_WriteLong(msg, svsHeader.time);
+    MSG_WriteByte(msg, lastframe);
+    snapInfo.var_01 = var_x;
+
+    snapFlags = svsHeader.snapFlagServerBit;
+
+    if(client->rateDelayed){
+	snapFlags |= 1;
+    }
+
+    if(client->state == CS_ACTIVE) {
+
+	client->unksnapshotvar = 1;
+
+    } else {
+	if(client->state != CS_ZOMBIE){
+		client->unksnapshotvar = 0;
+	}
+    }
+
+    if(!client->unksnapshotvar){
+	snapFlags |= 2;
+    }
+
+    MSG_WriteByte(msg, snapFlags);
+
+    //Spectators see the playerstate of whom they follow
+    if(frame->ps.clientNum != snapInfo.clnum)
+        SV_WriteSharedSnapshotBody(&snapInfo, msg, frame, oldframe);
+    else
+        SV_WriteSnapshotBody(&snapInfo, msg, frame, oldframe);
 
     if(sv_padPackets->integer){
 	for( i=0 ; i < sv_padPackets->integer ; i++){
@@ -350,6 +510,575 @@ static int SV_RateMsec( client_t *client, int messageSize ) {
 }
 
 
+/*
+=======================
+Global uplink scheduler
+
+sv_maxUplinkRate limits the bytes per second all clients get together. The budget is a
+token bucket which SV_SendMessageToClient() drains. Each frame SV_ScheduleClientMessages()
+looks at all clients which are due for a message, ranks them and holds back the ones the
+budget can not take anymore until one of the next frames. Clients waiting for long rank
+higher so nobody starves, downloads yield to players in game.
+=======================
+*/
+#define UPLINK_MIN_MESSAGE 200		//Estimate for clients we have not sent anything to yet
+
+typedef struct{
+	int	clientnum;
+	int	cost;
+	int	priority;
+}uplinkCandidate_t;
+
+static struct{
+	int	tokens;
+	int	lastRefillTime;
+	int	queuedBytes[MAX_CLIENTS];	//Estimated size of the held back message
+	int	deferredFrames[MAX_CLIENTS];
+	qboolean playersDeferred;		//A player in game got held back this frame, downloads wait
+}sv_uplink;
+
+/*
+Download share
+
+sv_maxDownloadRate is a second bucket for the download blocks alone. Every frame its
+tokens get split evenly between the clients which are downloading right now (deficit
+round robin), a client which can not use its share keeps up to a few blocks of it and
+hands the rest back. So one fast client can not take the bandwidth of the slow ones
+and the download traffic as a whole stays below the cap no matter how many join.
+*/
+#define DOWNLOAD_MAX_DEFICIT (4 * (MAX_DOWNLOAD_BLKSIZE + HEADER_RATE_BYTES))
+
+static struct{
+	int	tokens;
+	int	lastRefillTime;
+	int	numDownloading;
+	int	deficit[MAX_CLIENTS];
+	int	deferredBlocks[MAX_CLIENTS];
+}sv_dlshare;
+
+static qboolean SV_ClientDownloadsUDP( client_t *cl ) {
+
+	return cl->state >= CS_CONNECTED && *cl->downloadName && cl->download && !cl->wwwDl_var02;
+}
+
+static void SV_ScheduleDownloads( void ) {
+
+	client_t *cl;
+	int i, rate, burst, quantum, spare;
+
+	for(i = 0, sv_dlshare.numDownloading = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(SV_ClientDownloadsUDP(cl))
+			sv_dlshare.numDownloading++;
+		else{
+			sv_dlshare.deficit[i] = 0;
+			sv_dlshare.deferredBlocks[i] = 0;
+		}
+	}
+
+	rate = sv_maxDownloadRate->integer;
+
+	if(rate <= 0)
+	{
+		sv_dlshare.lastRefillTime = svs.time;
+		return;
+	}
+
+	burst = rate / 10;
+	if(burst < DOWNLOAD_MAX_DEFICIT)
+		burst = DOWNLOAD_MAX_DEFICIT;
+
+	if(svs.time > sv_dlshare.lastRefillTime)
+		sv_dlshare.tokens += (int)(((long long)(svs.time - sv_dlshare.lastRefillTime) * rate) / 1000);
+
+	sv_dlshare.lastRefillTime = svs.time;
+
+	if(sv_dlshare.tokens > burst)
+		sv_dlshare.tokens = burst;
+
+	if(sv_dlshare.numDownloading == 0)
+		return;
+
+	quantum = sv_dlshare.tokens / sv_dlshare.numDownloading;
+	sv_dlshare.tokens -= quantum * sv_dlshare.numDownloading;
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(!SV_ClientDownloadsUDP(cl))
+			continue;
+
+		sv_dlshare.deficit[i] += quantum;
+		if(sv_dlshare.deficit[i] > DOWNLOAD_MAX_DEFICIT)
+		{
+			spare = sv_dlshare.deficit[i] - DOWNLOAD_MAX_DEFICIT;
+			sv_dlshare.deficit[i] = DOWNLOAD_MAX_DEFICIT;
+			sv_dlshare.tokens += spare;
+		}
+	}
+}
+
+/*
+Called by SV_WriteDownloadToClient() before it puts a block into the message.
+Returns qfalse if the block has to wait for one of the next messages
+*/
+qboolean SV_DownloadTakeBudget( client_t *cl, int length ) {
+
+	int clnum = cl - svs.clients;
+
+	//Players in game first, the download is fine a frame later
+	if(sv_uplink.playersDeferred)
+	{
+		sv_dlshare.deferredBlocks[clnum]++;
+		return qfalse;
+	}
+
+	if(sv_maxDownloadRate->integer <= 0)
+		return qtrue;
+
+	length += HEADER_RATE_BYTES;
+
+	if(sv_dlshare.deficit[clnum] < length)
+	{
+		sv_dlshare.deferredBlocks[clnum]++;
+		return qfalse;
+	}
+	sv_dlshare.deficit[clnum] -= length;
+	return qtrue;
+}
+
+static int SV_CompareUplinkCandidates( const void *a, const void *b ) {
+
+	return ((uplinkCandidate_t*)b)->priority - ((uplinkCandidate_t*)a)->priority;
+}
+
+void SV_ScheduleClientMessages( void ) {
+
+	uplinkCandidate_t candidates[MAX_CLIENTS];
+	uplinkCandidate_t *cand;
+	client_t *cl;
+	int i, numCandidates, rate, burst, budget, age, now;
+
+	sv_uplink.playersDeferred = qfalse;
+
+	SV_ScheduleDownloads();
+
+	rate = sv_maxUplinkRate->integer;
+
+	if(rate <= 0)
+	{
+		sv_uplink.lastRefillTime = svs.time;
+		return;
+	}
+
+	//Allow a burst of 100 msec but at least a couple of full sized packets
+	burst = rate / 10;
+	if(burst < 4 * (1500 + HEADER_RATE_BYTES))
+		burst = 4 * (1500 + HEADER_RATE_BYTES);
+
+	if(svs.time > sv_uplink.lastRefillTime)
+		sv_uplink.tokens += (int)(((long long)(svs.time - sv_uplink.lastRefillTime) * rate) / 1000);
+
+	sv_uplink.lastRefillTime = svs.time;
+
+	if(sv_uplink.tokens > burst)
+		sv_uplink.tokens = burst;
+
+	now = Sys_Milliseconds();
+
+	for(i = 0, numCandidates = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		sv_uplink.queuedBytes[i] = 0;
+
+		if(cl->state < CS_CONNECTED || svs.time < cl->nextSnapshotTime)
+		{
+			sv_uplink.deferredFrames[i] = 0;
+			continue;
+		}
+
+		if(cl->netchan.remoteAddress.type == NA_LOOPBACK || cl->netchan.remoteAddress.type == NA_BOT || Sys_IsLANAddress(&cl->netchan.remoteAddress))
+			continue;
+
+		cand = &candidates[numCandidates++];
+		cand->clientnum = i;
+		cand->cost = cl->frames[(cl->netchan.outgoingSequence -1) & PACKET_MASK].messageSize;
+		if(cand->cost < UPLINK_MIN_MESSAGE)
+			cand->cost = UPLINK_MIN_MESSAGE;
+
+		cand->cost += HEADER_RATE_BYTES;
+
+		age = now - cl->frames[(cl->netchan.outgoingSequence -1) & PACKET_MASK].messageSent;
+		if(age < 0 || age > 10000)
+			age = 10000;
+
+		//Snapshot age first, then the rate the client asked for
+		cand->priority = age * 4 + sv_uplink.deferredFrames[i] * 100 + cl->rate / 1000;
+
+		if(*cl->downloadName)
+			cand->priority /= 2;
+		else if(cl->state == CS_ACTIVE)
+			cand->priority += 200;
+	}
+
+	if(numCandidates == 0)
+		return;
+
+	qsort(candidates, numCandidates, sizeof(uplinkCandidate_t), SV_CompareUplinkCandidates);
+
+	budget = sv_uplink.tokens;
+
+	for(i = 0, cand = candidates; i < numCandidates; i++, cand++)
+	{
+		//The most important client always gets through if there is anything left so a big message can not block forever
+		if(budget >= cand->cost || (i == 0 && budget > 0))
+		{
+			budget -= cand->cost;
+			sv_uplink.deferredFrames[cand->clientnum] = 0;
+			continue;
+		}
+		cl = &svs.clients[cand->clientnum];
+		cl->nextSnapshotTime = svs.time +1;
+		sv_uplink.queuedBytes[cand->clientnum] = cand->cost;
+		sv_uplink.deferredFrames[cand->clientnum]++;
+
+		if(cl->state == CS_ACTIVE && !*cl->downloadName)
+			sv_uplink.playersDeferred = qtrue;
+	}
+}
+
+/*
+=======================
+Snapshot shedding
+
+When the work of the frames keeps taking more than sv_snapshotShedLoad percent of the
+frame interval, the clients which matter least get their snapshots less often so the
+players in the fight keep a steady tick. Every level of shedding reaches one more class
+and stretches the interval of those it reached already a bit more:
+
+level 1: spectators get every 2nd snapshot
+level 2: spectators every 3rd, dead players every 2nd
+level 3: spectators every 4th, dead players every 3rd, players with nobody else
+         within sv_snapshotShedDistance every 2nd
+
+Levels go up quickly and come down slowly once the load is well below the threshold again.
+=======================
+*/
+#define SHED_MAX_LEVEL 3
+#define SHED_RAISE_MSEC 500		//Between two raises
+#define SHED_LOWER_MSEC 2000		//Below the threshold before a level gets taken back
+#define SHED_CLASSIFY_MSEC 250
+
+typedef enum{
+	SHED_NONE,
+	SHED_SPECTATOR,
+	SHED_DEAD,
+	SHED_DISTANT,
+	SHED_NUMCLASSES
+}shedClass_t;
+
+static const char* sv_shedClassNames[SHED_NUMCLASSES] = { "none", "spectator", "dead", "distant" };
+
+//Level from which on a class gets fewer snapshots
+static const int sv_shedClassLevel[SHED_NUMCLASSES] = { SHED_MAX_LEVEL +1, 1, 2, 3 };
+
+static struct{
+	int		load16;				//Smoothed frame work in 1/16 percent of the frame interval
+	int		shedLevel;
+	int		lastChange;
+	int		lastClassify;
+	byte		clientClass[MAX_CLIENTS];
+	unsigned int	levelChanges;
+	unsigned int	stretched[SHED_NUMCLASSES];	//Snapshots which got sent later than the client asked for
+}sv_shed;
+
+static void SV_SnapshotShedClassify( void ) {
+
+	client_t *cl;
+	gclient_t *gclient;
+	vec3_t delta;
+	float maxDist;
+	int i, j;
+	qboolean playing[MAX_CLIENTS];
+
+	maxDist = (float)sv_snapshotShedDistance->integer * sv_snapshotShedDistance->integer;
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		playing[i] = cl->state == CS_ACTIVE && cl->gentity && level.clients[i].pers.playerState == STATE_PLAYING;
+	}
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		sv_shed.clientClass[i] = SHED_NONE;
+
+		if(cl->state != CS_ACTIVE || !cl->gentity)
+			continue;
+
+		gclient = &level.clients[i];
+
+		if(gclient->pers.playerState == STATE_SPECTATOR)
+		{
+			sv_shed.clientClass[i] = SHED_SPECTATOR;
+			continue;
+		}
+		if(gclient->pers.playerState == STATE_DEAD)
+		{
+			sv_shed.clientClass[i] = SHED_DEAD;
+			continue;
+		}
+		if(!playing[i] || sv_snapshotShedDistance->integer <= 0)
+			continue;
+
+		for(j = 0; j < sv_maxclients->integer; j++)
+		{
+			if(j == i || !playing[j])
+				continue;
+
+			VectorSubtract(svs.clients[j].gentity->r.currentOrigin, cl->gentity->r.currentOrigin, delta);
+			if(DotProduct(delta, delta) < maxDist)
+				break;
+		}
+		if(j == sv_maxclients->integer)
+			sv_shed.clientClass[i] = SHED_DISTANT;
+	}
+	sv_shed.lastClassify = svs.time;
+}
+
+/*
+Called at the end of every server frame with the time its work took
+*/
+void SV_SnapshotShedFrame( unsigned int frameWork, unsigned int frameUsec ) {
+
+	int load, threshold;
+
+	threshold = sv_snapshotShedLoad->integer;
+
+	if(threshold <= 0 || frameUsec == 0)
+	{
+		sv_shed.shedLevel = 0;
+		sv_shed.load16 = 0;
+		return;
+	}
+
+	load = (unsigned long long)frameWork * 100 / frameUsec;
+	if(load > 1000)
+		load = 1000;
+
+	sv_shed.load16 += load * 2 - sv_shed.load16 / 8;
+
+	if(sv_shed.load16 / 16 > threshold)
+	{
+		if(sv_shed.shedLevel < SHED_MAX_LEVEL && svs.time - sv_shed.lastChange >= SHED_RAISE_MSEC)
+		{
+			sv_shed.shedLevel++;
+			sv_shed.lastChange = svs.time;
+			sv_shed.levelChanges++;
+			sv_shed.lastClassify = 0;
+			Com_DPrintf("Frames take %d%% of the interval, snapshot shedding raised to level %d\n", sv_shed.load16 / 16, sv_shed.shedLevel);
+		}
+	}
+	else if(sv_shed.load16 / 16 < threshold * 3 / 4)
+	{
+		if(sv_shed.shedLevel > 0 && svs.time - sv_shed.lastChange >= SHED_LOWER_MSEC)
+		{
+			sv_shed.shedLevel--;
+			sv_shed.lastChange = svs.time;
+			sv_shed.levelChanges++;
+			Com_DPrintf("Frames take %d%% of the interval, snapshot shedding lowered to level %d\n", sv_shed.load16 / 16, sv_shed.shedLevel);
+		}
+	}
+	else
+	{
+		//Neither way, the lowering has to wait for a full period below the threshold
+		sv_shed.lastChange = svs.time;
+	}
+
+	if(sv_shed.shedLevel > 0 && svs.time - sv_shed.lastClassify >= SHED_CLASSIFY_MSEC)
+		SV_SnapshotShedClassify();
+}
+
+//Additional msec until the next snapshot of a client in game
+static int SV_SnapshotShedMsec( client_t *client, int rateMsec ) {
+
+	int class, stretch;
+
+	if(sv_shed.shedLevel == 0)
+		return 0;
+
+	class = sv_shed.clientClass[client - svs.clients];
+	stretch = sv_shed.shedLevel - sv_shedClassLevel[class] + 1;
+
+	if(stretch <= 0)
+		return 0;
+
+	sv_shed.stretched[class]++;
+	return rateMsec * stretch;
+}
+
+int SV_SnapshotShedLevel( void ) {
+
+	return sv_shed.shedLevel;
+}
+
+void SV_SnapshotShedStatus( void ) {
+
+	int i, count[SHED_NUMCLASSES];
+
+	if(sv_snapshotShedLoad->integer <= 0)
+	{
+		Com_Printf("snapshot shedding: disabled\n");
+		return;
+	}
+
+	Com_Memset(count, 0, sizeof(count));
+	if(sv_shed.shedLevel > 0)
+	{
+		for(i = 0; i < sv_maxclients->integer; i++)
+			count[sv_shed.clientClass[i]]++;
+	}
+
+	Com_Printf("snapshot shedding: level %d, frames take %d%% of the interval (threshold %d%%), %d spectators, %d dead and %d distant players reached\n",
+		sv_shed.shedLevel, sv_shed.load16 / 16, sv_snapshotShedLoad->integer,
+		sv_shed.shedLevel >= sv_shedClassLevel[SHED_SPECTATOR] ? count[SHED_SPECTATOR] : 0,
+		sv_shed.shedLevel >= sv_shedClassLevel[SHED_DEAD] ? count[SHED_DEAD] : 0,
+		sv_shed.shedLevel >= sv_shedClassLevel[SHED_DISTANT] ? count[SHED_DISTANT] : 0);
+}
+
+void SV_SnapshotShedWriteMetrics( metricsBuf_t* buf ) {
+
+	int i;
+
+	Metrics_Declare(buf, "cod4x_snapshot_shed_level", "gauge", "How many classes of clients get fewer snapshots because the frames run late");
+	Metrics_Printf(buf, "cod4x_snapshot_shed_level %d\n", sv_shed.shedLevel);
+	Metrics_Declare(buf, "cod4x_snapshot_shed_frame_load_ratio", "gauge", "Smoothed work of a frame relative to the frame interval");
+	Metrics_Printf(buf, "cod4x_snapshot_shed_frame_load_ratio %.3f\n", sv_shed.load16 / 1600.0);
+	Metrics_Declare(buf, "cod4x_snapshot_shed_level_changes_total", "counter", "Times the shedding level went up or down");
+	Metrics_Printf(buf, "cod4x_snapshot_shed_level_changes_total %u\n", sv_shed.levelChanges);
+
+	Metrics_Declare(buf, "cod4x_snapshot_shed_delayed_total", "counter", "Snapshots sent later than the client asked for to take load off the frames");
+	for(i = SHED_SPECTATOR; i < SHED_NUMCLASSES; i++)
+		Metrics_Printf(buf, "cod4x_snapshot_shed_delayed_total{class=\"%s\"} %u\n", sv_shedClassNames[i], sv_shed.stretched[i]);
+}
+
+static void SV_UplinkAccount( int length ) {
+
+	if(sv_maxUplinkRate->integer > 0)
+		sv_uplink.tokens -= length + HEADER_RATE_BYTES;
+}
+
+/*
+Bytes which are waiting for this client, either held back by the scheduler or left in the netchan
+*/
+int SV_ClientQueuedBytes( client_t *cl ) {
+
+	int queued = sv_uplink.queuedBytes[cl - svs.clients];
+
+	if(cl->netchan.unsentFragments)
+		queued += cl->netchan.unsentLength - cl->netchan.unsentFragmentStart;
+
+	return queued;
+}
+
+void SV_UplinkStatus_f( void ) {
+
+	int i;
+	client_t *cl;
+
+	if ( !com_sv_running->boolean ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	if(sv_maxUplinkRate->integer > 0)
+		Com_Printf("Uplink budget: %d bytes/sec, %d bytes available\n", sv_maxUplinkRate->integer, sv_uplink.tokens);
+	else
+		Com_Printf("Uplink budget: unlimited\n");
+
+	if(sv_maxDownloadRate->integer > 0)
+		Com_Printf("Download budget: %d bytes/sec shared by %d clients\n", sv_maxDownloadRate->integer, sv_dlshare.numDownloading);
+	else
+		Com_Printf("Download budget: unlimited, %d clients downloading\n", sv_dlshare.numDownloading);
+
+	Com_Printf ("num rate   queued deferred dlwait name\n");
+	Com_Printf ("--- ------ ------ -------- ------ --------------------------------\n");
+
+	for(i = 0, cl = svs.clients; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(cl->state < CS_CONNECTED)
+			continue;
+
+		Com_Printf("%3i %6i %6i %8i %6i %s%s\n", i, cl->rate, SV_ClientQueuedBytes(cl), sv_uplink.deferredFrames[i], sv_dlshare.deferredBlocks[i], cl->name, *cl->downloadName ? " (downloading)" : "");
+	}
+}
+
+
+/*
+=======================
+Payload compression statistics
+
+Everything the server sends to a client is already entropy coded with the static huffman
+table the client knows, so this keeps track of what that buys and what it costs
+=======================
+*/
+static struct{
+	int			challenge[MAX_CLIENTS];	//Tells a new connection in the same slot apart
+	unsigned long long	rawBytes[MAX_CLIENTS];
+	unsigned long long	packedBytes[MAX_CLIENTS];
+	unsigned long long	usec[MAX_CLIENTS];
+	unsigned int		messages[MAX_CLIENTS];
+}sv_compression;
+
+static void SV_CompressionAccount( client_t *client, int rawLength, int packedLength, unsigned int usec ) {
+
+	int clnum = client - svs.clients;
+
+	if(sv_compression.challenge[clnum] != client->challenge)
+	{
+		sv_compression.challenge[clnum] = client->challenge;
+		sv_compression.rawBytes[clnum] = 0;
+		sv_compression.packedBytes[clnum] = 0;
+		sv_compression.usec[clnum] = 0;
+		sv_compression.messages[clnum] = 0;
+	}
+	sv_compression.rawBytes[clnum] += rawLength;
+	sv_compression.packedBytes[clnum] += packedLength;
+	sv_compression.usec[clnum] += usec;
+	sv_compression.messages[clnum]++;
+}
+
+void SV_CompressionStatus_f( void ) {
+
+	int i;
+	client_t *cl;
+	unsigned long long raw, packed, usec;
+
+	if ( !com_sv_running->boolean ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	Com_Printf ("num     messages    raw KB packed KB ratio usec/msg name\n");
+	Com_Printf ("--- ------------ --------- --------- ----- -------- --------------------------------\n");
+
+	for(i = 0, cl = svs.clients, raw = 0, packed = 0, usec = 0; i < sv_maxclients->integer; i++, cl++)
+	{
+		if(cl->state < CS_CONNECTED || sv_compression.challenge[i] != cl->challenge || !sv_compression.messages[i])
+			continue;
+
+		Com_Printf("%3i %12u %9llu %9llu %5.2f %8.1f %s\n", i, sv_compression.messages[i], sv_compression.rawBytes[i] / 1024,
+				sv_compression.packedBytes[i] / 1024, (float)sv_compression.packedBytes[i] / (float)sv_compression.rawBytes[i],
+				(float)sv_compression.usec[i] / (float)sv_compression.messages[i], cl->name);
+
+		raw += sv_compression.rawBytes[i];
+		packed += sv_compression.packedBytes[i];
+		usec += sv_compression.usec[i];
+	}
+	if(raw)
+		Com_Printf("Total: %llu KB raw, %llu KB sent, ratio %.2f, %llu msec spent coding\n", raw / 1024, packed / 1024, (float)packed / (float)raw, usec / 1000);
+	if(sv_snapshotCacheHits + sv_snapshotCacheMisses)
+		Com_Printf("Spectator snapshots: %u encoded, %u shared\n", sv_snapshotCacheMisses, sv_snapshotCacheHits);
+}
+
+
 int irand()
 {
 
@@ -368,10 +1097,16 @@ Called by SV_SendClientSnapshot and SV_SendClientGameState
 __cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 	int rateMsec;
 	int len;
+	unsigned long long codeStart;
 
 	*(int32_t*)0x13f39080 = *(int32_t*)msg->data;
 
+	codeStart = Sys_MicrosecondsLong();
 	len = 4 + MSG_WriteBitsCompress( 0, msg->data + 4 ,(byte*)0x13f39084 ,msg->cursize - 4);
+	codeStart = Sys_MicrosecondsLong() - codeStart;
+	SV_CompressionAccount( client, msg->cursize, len, codeStart );
+	SV_NetchanStatsEncodeTime( client, codeStart );
+	SV_CodecCorpusRecord( CODECCORPUS_SERVER, msg->data + 4, msg->cursize - 4, (byte*)0x13f39084, len - 4 );
 
 	if(client->var_01){
 		SV_DropClient(client, client->var_01);
@@ -380,13 +1115,14 @@ __cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 	if(client->demorecording && !client->demowaiting)
 		SV_WriteDemoMessageForClient((byte*)0x13f39080, len, client);
 
+	SV_ReplayMessage(client, (byte*)0x13f39080, len);
+
 	// record information about the message
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = len;
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = Sys_Milliseconds();
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = 0xFFFFFFFF;
+	SV_ClientFrameSent( client, len );
 
 	// send the datagram
 	SV_Netchan_Transmit( client, (byte*)0x13f39080, len );
+	SV_UplinkAccount( len );
 
 	// set nextSnapshotTime based on rate and requested number of updates
 
@@ -427,6 +1163,11 @@ __cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 
 	client->nextSnapshotTime = svs.time + rateMsec;
 
+	// fewer snapshots for the clients which matter least while the frames run late
+	if ( client->state == CS_ACTIVE && !*client->downloadName ) {
+		client->nextSnapshotTime += SV_SnapshotShedMsec( client, rateMsec );
+	}
+
 	// don't pile up empty snapshots while connecting
 	if ( client->state != CS_ACTIVE && !*client->downloadName) {
 		// a gigantic connection message may have already put the nextSnapshotTime
@@ -439,6 +1180,11 @@ __cdecl void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 	sv.var_01 += len ;
 }
 
+/*
+The frame of the client, that is which entities it can see, gets built inside
+of SV_BeginClientSnapshot by the binary. The cluster and area checks are done
+there too, all we get is the finished entity list of the frame.
+*/
 void SV_SendClientSnapshot(client_t *cl){
 
 	msg_t msg;
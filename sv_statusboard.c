@@ -0,0 +1,252 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+
+/*
+========================================================================
+
+Status board for local tools
+
+Panels, bots and other tools on the same host can read players, scores,
+the map and frame statistics out of a mapped file instead of sending
+getstatus or rcon. The server rewrites the board every
+sv_statusBoardInterval msec under a sequence lock, readers never make
+the server wait. The layout is in sv_statusboard.h, tools/statusboard_reader.c
+shows how to read it.
+
+A path which does not start with / is relative to fs_homepath. A path in
+/dev/shm keeps the kernel from writing the pages back to the disk.
+
+========================================================================
+*/
+
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "qcommon.h"
+#include "filesystem.h"
+#include "cvar.h"
+#include "server.h"
+#include "g_shared.h"
+#include "sys_main.h"
+#include "sv_statusboard.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+
+static cvar_t *sv_statusBoard;
+static cvar_t *sv_statusBoardInterval;
+static statusBoard_t *statusboard;
+static int statusboardLastUpdate;
+static unsigned int statusboardFrames;
+static unsigned long long statusboardFrameUsec;	//Sum since the last update
+static unsigned int statusboardFrameUsecMax;
+
+
+/*
+================
+SV_StatusBoardInit
+================
+*/
+void SV_StatusBoardInit( void ) {
+
+	char ospath[MAX_OSPATH];
+	void *mapped;
+	int fd;
+
+	sv_statusBoard = Cvar_RegisterString("sv_statusBoard", "", CVAR_INIT, "File local tools map to read players, scores and frame statistics without querying the server. Relative to fs_homepath unless it starts with /. Empty disables it");
+	sv_statusBoardInterval = Cvar_RegisterInt("sv_statusBoardInterval", 500, 50, 10000, 0, "Milliseconds between two updates of the status board");
+
+	if(!*sv_statusBoard->string || statusboard)
+		return;
+
+	if(sv_statusBoard->string[0] == '/')
+	{
+		Q_strncpyz(ospath, sv_statusBoard->string, sizeof(ospath));
+	}else{
+		Q_strncpyz(ospath, FS_BuildOSPath( fs_homepath->string, sv_statusBoard->string, "" ), sizeof(ospath));
+		ospath[strlen(ospath)-1] = '\0';
+	}
+
+	fd = open(ospath, O_RDWR | O_CREAT, 0644);
+	if(fd < 0)
+	{
+		Com_PrintWarning("Status board: Can not open %s: %s\n", ospath, strerror(errno));
+		return;
+	}
+
+	//Readers may have it mapped already, the file must not shrink underneath them
+	if(ftruncate(fd, sizeof(statusBoard_t)) != 0)
+	{
+		Com_PrintWarning("Status board: Can not resize %s: %s\n", ospath, strerror(errno));
+		close(fd);
+		return;
+	}
+
+	mapped = mmap(NULL, sizeof(statusBoard_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if(mapped == MAP_FAILED)
+	{
+		Com_PrintWarning("Status board: mmap of %s failed: %s\n", ospath, strerror(errno));
+		return;
+	}
+
+	statusboard = mapped;
+
+	//Readers of an old board see an odd sequence until the new one is complete
+	statusboard->sequence |= 1;
+	__sync_synchronize();
+	statusboard->magic = STATUSBOARD_MAGIC;
+	statusboard->version = STATUSBOARD_VERSION;
+	statusboard->pid = getpid();
+	statusboard->updates = 0;
+	statusboard->running = 0;
+	__sync_synchronize();
+	statusboard->sequence++;
+
+	Com_Printf("Publishing the server status to %s\n", ospath);
+}
+
+
+static void SV_StatusBoardFill( statusBoard_t *board ) {
+
+	statusBoardPlayer_t *player;
+	client_t *cl;
+	gclient_t *gclient;
+	int i, maxclients;
+
+	board->updates++;
+	board->realtime = time(NULL);
+	board->running = 1;
+
+	Q_strncpyz(board->hostname, sv_hostname->string, sizeof(board->hostname));
+	Q_strncpyz(board->mapname, sv_mapname->string, sizeof(board->mapname));
+	Q_strncpyz(board->gametype, sv.gametype, sizeof(board->gametype));
+	board->levelTime = level.time - level.startTime;
+	board->fps = sv.frameusec > 0 ? 1000000 / sv.frameusec : 0;
+
+	board->frames += statusboardFrames;
+	board->frameUsecAvg = statusboardFrames ? statusboardFrameUsec / statusboardFrames : 0;
+	board->frameUsecMax = statusboardFrameUsecMax;
+	SV_GetFrameBudget(&board->overruns, &board->droppedFrames);
+	board->snapshotShedLevel = SV_SnapshotShedLevel();
+	SVC_GetQueryDrops(board->queryDrops);
+
+	maxclients = sv_maxclients->integer;
+	if(maxclients > STATUSBOARD_MAXPLAYERS)
+		maxclients = STATUSBOARD_MAXPLAYERS;
+
+	board->maxclients = maxclients;
+	board->numPlayers = 0;
+	board->numHumans = 0;
+
+	for(i = 0, cl = svs.clients, gclient = level.clients, player = board->players; i < STATUSBOARD_MAXPLAYERS; i++, cl++, gclient++, player++)
+	{
+		if(i >= maxclients || cl->state < CS_CONNECTED)
+		{
+			if(player->state)
+				Com_Memset(player, 0, sizeof(statusBoardPlayer_t));
+			continue;
+		}
+
+		player->state = cl->state == CS_ACTIVE ? STATUSBOARD_ACTIVE : STATUSBOARD_CONNECTED;
+		player->bot = cl->netchan.remoteAddress.type == NA_BOT;
+		player->uid = cl->uid;
+		player->team = gclient->sess.sessionTeam;
+		player->score = gclient->pers.scoreboard.score;
+		player->kills = gclient->pers.scoreboard.kills;
+		player->deaths = gclient->pers.scoreboard.deaths;
+		player->assists = gclient->pers.scoreboard.assists;
+		player->ping = cl->ping;
+		Q_strncpyz(player->name, cl->name, sizeof(player->name));
+
+		board->numPlayers++;
+		if(!player->bot)
+			board->numHumans++;
+	}
+}
+
+/*
+================
+SV_StatusBoardFrame
+
+Called every server frame with the work of the frame in usec
+================
+*/
+void SV_StatusBoardFrame( unsigned int frameWork ) {
+
+	int now;
+
+	if(!statusboard)
+		return;
+
+	statusboardFrames++;
+	statusboardFrameUsec += frameWork;
+	if(frameWork > statusboardFrameUsecMax)
+		statusboardFrameUsecMax = frameWork;
+
+	now = Sys_Milliseconds();
+	if(statusboard->updates && now - statusboardLastUpdate < sv_statusBoardInterval->integer)
+		return;
+
+	statusboardLastUpdate = now;
+
+	statusboard->sequence++;
+	__sync_synchronize();
+
+	SV_StatusBoardFill(statusboard);
+
+	__sync_synchronize();
+	statusboard->sequence++;
+
+	statusboardFrames = 0;
+	statusboardFrameUsec = 0;
+	statusboardFrameUsecMax = 0;
+}
+
+void SV_StatusBoardShutdown( void ) {
+
+	if(!statusboard)
+		return;
+
+	statusboard->sequence++;
+	__sync_synchronize();
+
+	statusboard->updates++;
+	statusboard->running = 0;
+	statusboard->numPlayers = 0;
+	statusboard->numHumans = 0;
+	Com_Memset(statusboard->players, 0, sizeof(statusboard->players));
+
+	__sync_synchronize();
+	statusboard->sequence++;
+
+	statusboardLastUpdate = 0;
+}
@@ -0,0 +1,95 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+
+#ifndef __SV_STATUSBOARD_H__
+#define __SV_STATUSBOARD_H__
+
+/*
+Layout of the status board, the file sv_statusBoard names
+
+The server rewrites it every sv_statusBoardInterval msec. Readers map the file
+read only and copy the board out under the sequence lock:
+
+	do{
+		seq = board->sequence;		//Odd while the server writes
+		barrier
+		copy the board
+		barrier
+	}while((seq & 1) || board->sequence != seq);
+
+The server never waits for a reader. Nothing in here depends on the server
+headers, the reader in tools/ includes this file too.
+*/
+
+#define STATUSBOARD_MAGIC 0x42535843		//"CXSB"
+#define STATUSBOARD_VERSION 1
+#define STATUSBOARD_MAXPLAYERS 64
+
+#define STATUSBOARD_CONNECTED 1			//Values of statusBoardPlayer_t.state
+#define STATUSBOARD_ACTIVE 2
+
+typedef struct{
+	int		state;				//0 for a free slot
+	int		bot;
+	int		uid;
+	int		team;				//0 free, 1 axis, 2 allies, 3 spectator
+	int		score;
+	int		kills;
+	int		deaths;
+	int		assists;
+	int		ping;
+	char		name[64];
+}statusBoardPlayer_t;
+
+typedef struct{
+	unsigned int	magic;
+	unsigned int	version;
+	volatile unsigned int sequence;
+	int		pid;				//Of the server, the board is stale if it is gone
+	unsigned int	updates;
+	unsigned int	realtime;			//Unix time of the last update
+	int		running;			//0 once the server got shut down
+
+	char		hostname[128];
+	char		mapname[64];
+	char		gametype[32];
+	int		levelTime;			//msec since the level started
+	int		maxclients;
+	int		numPlayers;			//Connected, bots included
+	int		numHumans;
+
+	int		fps;
+	unsigned int	frames;				//Since startup
+	unsigned int	frameUsecAvg;			//Work per frame over the last interval
+	unsigned int	frameUsecMax;
+	unsigned int	overruns;			//Since the level started
+	unsigned int	droppedFrames;
+	int		snapshotShedLevel;
+
+	unsigned int	queryDrops[5];			//getstatus global / address, getinfo global / address, rcon
+
+	statusBoardPlayer_t players[STATUSBOARD_MAXPLAYERS];
+}statusBoard_t;
+
+#endif
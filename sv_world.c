@@ -23,8 +23,15 @@
 
 
 #include "q_shared.h"
+#include "qcommon_io.h"
 #include "trace.h"
 #include "server.h"
+#include "cmd.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 
 typedef struct moveclip_s{
 //	vec3_t boxmins, boxmaxs;	// enclose the test object along entire move
@@ -43,6 +50,47 @@ typedef struct moveclip_s{
 
 vec3_t vec3_origin = {0,0,0};
 
+/*
+Players and what they own let each other pass depending on g_FFAPlayerCanBlock and
+g_friendlyPlayerCanBlock. Needs the client of the entity which moves, so it only
+gets asked for entities which are in the way
+*/
+static qboolean SV_ClipPassesThrough( moveclip_t *clip, sharedEntity_t *touch, int touchNum ) {
+
+	gentity_t *pass = &g_entities[clip->passEntityNum];
+	int ownerNum = touch->r.ownerNum -1;
+
+	if(pass->client == NULL)
+		return qfalse;
+
+	if(pass->client->sess.sessionTeam == TEAM_FREE){
+
+		if(SV_FFAPlayerCanBlock())
+			return qfalse;
+
+		if(touchNum < 64)
+			return qtrue;
+
+		return ownerNum < 64 && touch->r.contents & CONTENTS_PLAYERCLIP;
+	}
+
+	if(SV_FriendlyPlayerCanBlock())
+		return qfalse;
+
+	if(touchNum < 64)
+		return OnSameTeam( pass, &g_entities[touchNum] );
+
+	if(ownerNum >= 0 && ownerNum < 64 && touch->r.contents & CONTENTS_PLAYERCLIP)
+		return OnSameTeam( pass, &g_entities[ownerNum] );
+
+	return qfalse;
+}
+
+/*
+The binary walks its sectors and calls this for each entity in them. The filters which
+only need the entity itself come first, then the bounding box test, and the team rules
+which have to look at both clients run for the entities in the way only
+*/
 __cdecl void SV_ClipMoveToEntity(moveclip_t *clip, svEntity_t *entity, trace_t *trace){
 
 	sharedEntity_t *touch;
@@ -73,52 +121,16 @@ __cdecl void SV_ClipMoveToEntity(moveclip_t *clip, svEntity_t *entity, trace_t *
 			if( touch->r.ownerNum - 1 == clip->passOwnerNum )
 			    return;
 		}
-
-		if(clip->passEntityNum < 64 && clip->contentmask & CONTENTS_PLAYERCLIP){
-
-			if(g_entities[clip->passEntityNum].client->sess.sessionTeam == TEAM_FREE){
-
-				if(!SV_FFAPlayerCanBlock()){
-					if(touchNum < 64){
-						return;
-
-					}else if(touch->r.ownerNum -1 < 64 && touch->r.contents & CONTENTS_PLAYERCLIP){
-						return;
-					}
-				}
-
-			}else if(!SV_FriendlyPlayerCanBlock()){
-
-				if(touchNum < 64){
-					if(OnSameTeam( &g_entities[clip->passEntityNum], &g_entities[touchNum]))
-						return;
-
-				}else if(touch->r.ownerNum -1 < 64 && touch->r.contents & CONTENTS_PLAYERCLIP){
-
-					if(OnSameTeam( &g_entities[clip->passEntityNum], &g_entities[touch->r.ownerNum -1]))
-						return;
-
-				}
-			}
-		}
-
-/*		if(clip->passEntityNum < 64 && touch->r.ownerNum < 64){
-			char temp1[48];
-			char temp2[48];
-			Q_strncpyz(temp1, Q_BitConv(clip->contentmask), sizeof(temp1));
-			Q_strncpyz(temp2, Q_BitConv(touch->r.contents), sizeof(temp2));
-
-			Com_Printf("EntityNum: %i O. EntityNum: %i Content s.: %s Content o.: %s t.: %i owns. %i owno: %i\n", 
-			clip->passEntityNum , touchNum, temp1, temp2, OnSameTeam( &g_entities[clip->passEntityNum], &g_entities[touch->r.ownerNum]),clip->passOwnerNum ,touch->r.ownerNum -1);
-		}*/
 	}
 
-
 	VectorAdd(touch->r.absmin, clip->mins, mins);
 	VectorAdd(touch->r.absmax, clip->maxs, maxs);
 
 	if(CM_TraceBox(clip->start, mins, maxs, trace->fraction))
 		return;
+
+	if(clip->passEntityNum < 64 && clip->contentmask & CONTENTS_PLAYERCLIP && SV_ClipPassesThrough(clip, touch, touchNum))
+		return;
 	
 	if(!touch->r.bmodel)
 		clipHandle = CM_TempBoxModel(touch->r.mins, touch->r.maxs, touch->r.contents);
@@ -145,3 +157,179 @@ __cdecl void SV_ClipMoveToEntity(moveclip_t *clip, svEntity_t *entity, trace_t *
 
 }
 
+
+/*
+==================
+SV_TraceBench_f
+
+tracebench <traces> [entities] [seed]
+
+Sends traces through SV_ClipMoveToEntity against the entities of the running
+level and reports how fast they are. The sector walk of the binary is left out,
+every trace gets all candidates, so this is what the filters and the collision
+tests cost. Half of the traces are shots from the eyes of the players, the others
+player sized moves. Without players the traces start at random linked entities.
+entities repeats the linked entities until there are that many candidates,
+which stands in for a level with more of them.
+The server stands still while this runs
+==================
+*/
+#define TRACEBENCH_MAXTRACES 1000000
+
+static int SV_TraceBenchCompare( const void *a, const void *b ) {
+
+	unsigned int x = *(const unsigned int*)a;
+	unsigned int y = *(const unsigned int*)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static unsigned int SV_TraceBenchRandom( unsigned int *state ) {
+
+	*state ^= *state << 13;
+	*state ^= *state >> 17;
+	*state ^= *state << 5;
+	return *state;
+}
+
+void SV_TraceBench_f( void ) {
+
+	static const vec3_t playerMins = { -15, -15, 0 };
+	static const vec3_t playerMaxs = { 15, 15, 70 };
+	svEntity_t **linked;
+	unsigned int *times;
+	int numLinked, numCandidates, numTraces, numPlayers;
+	int players[MAX_CLIENTS];
+	int i, j, hits, from;
+	unsigned int seed;
+	unsigned long long total;
+	struct timespec t0, t1, start;
+	moveclip_t clip;
+	trace_t trace;
+	sharedEntity_t *ent;
+	float yaw, pitch;
+
+	if ( Cmd_Argc() < 2 || Cmd_Argc() > 4 ) {
+		Com_Printf( "tracebench <traces> [entities] [seed]\n" );
+		return;
+	}
+
+	if ( sv.state != SS_GAME ) {
+		Com_Printf( "The server must be running a level\n" );
+		return;
+	}
+
+	numTraces = atoi( Cmd_Argv( 1 ) );
+	if ( numTraces < 1 || numTraces > TRACEBENCH_MAXTRACES ) {
+		Com_Printf( "The number of traces has to be between 1 and %d\n", TRACEBENCH_MAXTRACES );
+		return;
+	}
+	numCandidates = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 0;
+	seed = Cmd_Argc() > 3 ? strtoul( Cmd_Argv( 3 ), NULL, 10 ) : 0x9e3779b9;
+	if ( seed == 0 ) {
+		seed = 1;
+	}
+
+	linked = malloc( MAX_GENTITIES * sizeof(svEntity_t*) );
+	times = malloc( numTraces * sizeof(unsigned int) );
+	if ( linked == NULL || times == NULL ) {
+		free( linked );
+		free( times );
+		Com_PrintError( "tracebench: Out of memory\n" );
+		return;
+	}
+
+	for ( i = 0, numLinked = 0, numPlayers = 0; i < sv.num_entities; i++ ) {
+		ent = SV_GentityNum( i );
+		if ( !ent->r.linked ) {
+			continue;
+		}
+		linked[numLinked++] = &sv.svEntities[i];
+		if ( i < sv_maxclients->integer && svs.clients[i].state == CS_ACTIVE ) {
+			players[numPlayers++] = i;
+		}
+	}
+
+	if ( numLinked == 0 ) {
+		Com_Printf( "No linked entities\n" );
+		free( linked );
+		free( times );
+		return;
+	}
+	if ( numCandidates <= 0 || numCandidates > MAX_GENTITIES ) {
+		numCandidates = numLinked;
+	}
+	for ( i = numLinked; i < numCandidates; i++ ) {
+		linked[i] = linked[i % numLinked];
+	}
+
+	hits = 0;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+
+	for ( i = 0; i < numTraces; i++ ) {
+
+		Com_Memset( &clip, 0, sizeof(clip) );
+		Com_Memset( &trace, 0, sizeof(trace) );
+		trace.fraction = 1.0f;
+		trace.entityNum = ENTITYNUM_NONE;
+
+		if ( numPlayers > 0 ) {
+			from = players[SV_TraceBenchRandom( &seed ) % numPlayers];
+		} else {
+			from = linked[SV_TraceBenchRandom( &seed ) % numLinked] - sv.svEntities;
+		}
+		ent = SV_GentityNum( from );
+		clip.passEntityNum = numPlayers > 0 ? from : ENTITYNUM_NONE;
+		clip.passOwnerNum = -1;
+		VectorCopy( ent->r.currentOrigin, clip.start );
+
+		yaw = ( SV_TraceBenchRandom( &seed ) % 3600 ) * ( M_PI / 1800.0f );
+
+		if ( i & 1 ) {
+			// A player moving a bit
+			VectorCopy( playerMins, clip.mins );
+			VectorCopy( playerMaxs, clip.maxs );
+			clip.contentmask = CONTENTS_SOLID | CONTENTS_PLAYERCLIP | CONTENTS_BODY;
+			clip.end[0] = clip.start[0] + cos( yaw ) * 32;
+			clip.end[1] = clip.start[1] + sin( yaw ) * 32;
+			clip.end[2] = clip.start[2];
+		} else {
+			// A bullet from eye height
+			pitch = ( (int)( SV_TraceBenchRandom( &seed ) % 1200 ) - 600 ) * ( M_PI / 1800.0f );
+			clip.start[2] += 60;
+			clip.contentmask = CONTENTS_SOLID | CONTENTS_BODY;
+			clip.end[0] = clip.start[0] + cos( yaw ) * cos( pitch ) * 8192;
+			clip.end[1] = clip.start[1] + sin( yaw ) * cos( pitch ) * 8192;
+			clip.end[2] = clip.start[2] + sin( pitch ) * 8192;
+		}
+
+		clock_gettime( CLOCK_MONOTONIC, &t0 );
+		for ( j = 0; j < numCandidates; j++ ) {
+			SV_ClipMoveToEntity( &clip, linked[j], &trace );
+		}
+		clock_gettime( CLOCK_MONOTONIC, &t1 );
+
+		times[i] = ( t1.tv_sec - t0.tv_sec ) * 1000000000 + ( t1.tv_nsec - t0.tv_nsec );
+		if ( trace.entityNum != ENTITYNUM_NONE ) {
+			hits++;
+		}
+	}
+
+	for ( i = 0, total = 0; i < numTraces; i++ ) {
+		total += times[i];
+	}
+	qsort( times, numTraces, sizeof(unsigned int), SV_TraceBenchCompare );
+
+	Com_Printf( "%d traces against %d candidates (%d linked entities, %d players), %d hit an entity\n",
+		numTraces, numCandidates, numLinked, numPlayers, hits );
+	Com_Printf( "%.0f traces/sec, %.1f nsec per candidate\n", total ? numTraces * 1e9 / total : 0.0,
+		(double)total / numTraces / numCandidates );
+	Com_Printf( "usec per trace: avg %.2f p50 %.2f p90 %.2f p99 %.2f max %.2f\n", total / 1000.0 / numTraces,
+		times[numTraces / 2] / 1000.0, times[numTraces * 9 / 10] / 1000.0, times[numTraces * 99 / 100] / 1000.0,
+		times[numTraces -1] / 1000.0 );
+	clock_gettime( CLOCK_MONOTONIC, &t1 );
+	Com_Printf( "Took %d msec\n", (int)( ( t1.tv_sec - start.tv_sec ) * 1000 + ( t1.tv_nsec - start.tv_nsec ) / 1000000 ) );
+
+	free( linked );
+	free( times );
+}
@@ -0,0 +1,586 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+#include "sv_wwwserver.h"
+#include "q_shared.h"
+#include "qcommon_io.h"
+#include "cvar.h"
+#include "filesystem.h"
+#include "msg.h"
+#include "sys_net.h"
+#include "net_game.h"
+#include "server.h"
+#include "sys_main.h"
+#include "qcommon_metrics.h"
+#include "qcommon_redirect.h"
+#include "qcommon_profile.h"
+#include "qcommon_mem.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define WWWSERVER_SERVICEID 0x48545450
+
+typedef struct{
+	int sock;				//0 if this slot is free
+	netadr_t remote;
+	int fd;					//File which is getting sent or -1
+	int offset;
+	int remaining;
+	qboolean keepalive;
+	qboolean closing;			//Close as soon as everything got written
+	unsigned int lastActivity;
+	int requestlen;
+	char request[MAX_WWWSERVER_REQUEST];
+}wwwConnection_t;
+
+static wwwConnection_t wwwConnections[MAX_WWWSERVER_CONNECTIONS];
+static cvar_t *sv_wwwServer;
+static cvar_t *sv_wwwMetrics;
+static unsigned long long wwwBytesSent;
+static unsigned int wwwRequests;
+static char wwwMetricsBuf[WWWSERVER_METRICSBUF];
+
+
+static void SV_WWWServer_CloseFile( wwwConnection_t *conn ) {
+
+	if(conn->fd >= 0)
+		close(conn->fd);
+
+	conn->fd = -1;
+	conn->remaining = 0;
+}
+
+static void SV_WWWServer_SendResponse( wwwConnection_t *conn, const char *status, const char *extraheaders, int contentlength ) {
+
+	char header[1024];
+
+	Com_sprintf(header, sizeof(header), "HTTP/1.1 %s\r\nServer: CoD4X\r\nContent-Length: %d\r\n%sConnection: %s\r\n\r\n",
+		status, contentlength, extraheaders, conn->keepalive ? "keep-alive" : "close");
+
+	NET_TcpSendData(conn->sock, header, strlen(header));
+	wwwBytesSent += strlen(header);
+}
+
+static void SV_WWWServer_SendError( wwwConnection_t *conn, const char *status ) {
+
+	conn->keepalive = qfalse;
+	SV_WWWServer_SendResponse(conn, status, "", 0);
+	conn->closing = qtrue;
+}
+
+static void SV_WWWServer_WriteMetrics( metricsBuf_t *buf ) {
+
+	int i, count;
+
+	for(i = 0, count = 0; i < MAX_WWWSERVER_CONNECTIONS; i++)
+	{
+		if(wwwConnections[i].sock != 0)
+			count++;
+	}
+	Metrics_Declare(buf, "cod4x_www_connections", "gauge", "Open connections of the HTTP server");
+	Metrics_Printf(buf, "cod4x_www_connections %d\n", count);
+	Metrics_Declare(buf, "cod4x_www_requests_total", "counter", "Requests the HTTP server answered");
+	Metrics_Printf(buf, "cod4x_www_requests_total %u\n", wwwRequests);
+	Metrics_Declare(buf, "cod4x_www_sent_bytes_total", "counter", "Bytes the HTTP server sent including the headers");
+	Metrics_Printf(buf, "cod4x_www_sent_bytes_total %llu\n", wwwBytesSent);
+}
+
+/*
+Everything gets read straight out of the counters of the modules, nothing
+on their side has to know about the scrape
+*/
+static void SV_WWWServer_SendMetrics( wwwConnection_t *conn, qboolean head ) {
+
+	metricsBuf_t buf;
+
+	Metrics_Init(&buf, wwwMetricsBuf, sizeof(wwwMetricsBuf));
+
+	SV_WriteMetrics(&buf);
+	SV_SnapshotShedWriteMetrics(&buf);
+	SVC_RateLimitWriteMetrics(&buf);
+	SV_DemoWriteMetrics(&buf);
+	SV_WWWServer_WriteMetrics(&buf);
+	Com_ProfileWriteMetrics(&buf);
+	Z_WriteMetrics(&buf);
+	PHandler_WriteMetrics(&buf);
+	Com_RedirectWriteMetrics(&buf);
+
+	if(buf.overflowed)
+		Com_PrintWarning("HTTP: Metrics got truncated to %d bytes\n", buf.len);
+
+	SV_WWWServer_SendResponse(conn, "200 OK", "Content-Type: text/plain; version=0.0.4\r\n", buf.len);
+
+	if(!head)
+	{
+		NET_TcpSendData(conn->sock, buf.data, buf.len);
+		wwwBytesSent += buf.len;
+	}
+
+	if(!conn->keepalive)
+		conn->closing = qtrue;
+}
+
+/*
+Decodes the request target into a path as we know it from cl->downloadName.
+Returns qfalse for anything which can not be a valid download
+*/
+static qboolean SV_WWWServer_DecodePath( const char *target, int len, char *path, int size ) {
+
+	int i, j, c;
+	char hex[3];
+
+	while(len > 0 && *target == '/')
+	{
+		target++;
+		len--;
+	}
+
+	for(i = 0, j = 0; i < len && target[i] != '?' && target[i] != '#'; i++)
+	{
+		c = target[i];
+		if(c == '%')
+		{
+			if(i + 2 >= len || !isxdigit(target[i +1]) || !isxdigit(target[i +2]))
+				return qfalse;
+
+			hex[0] = target[i +1];
+			hex[1] = target[i +2];
+			hex[2] = '\0';
+			c = strtol(hex, NULL, 16);
+			i += 2;
+		}
+		if(c < ' ' || c == '\\' || c == ':' || c > 126 || j >= size -1)
+			return qfalse;
+
+		path[j++] = c;
+	}
+	path[j] = '\0';
+
+	if(j == 0 || strstr(path, ".."))
+		return qfalse;
+
+	return qtrue;
+}
+
+/*
+Parses "bytes=first-last", "bytes=first-" and "bytes=-suffix".
+Returns qfalse if the range should be ignored which makes us send the whole file
+*/
+static qboolean SV_WWWServer_ParseRange( const char *value, int filesize, int *first, int *last ) {
+
+	char *end;
+	long a, b;
+
+	while(*value == ' ')
+		value++;
+
+	if(Q_stricmpn(value, "bytes=", 6) || strchr(value, ','))
+		return qfalse; //Multiple ranges are not supported
+
+	value += 6;
+
+	if(*value == '-')
+	{
+		b = strtol(value +1, &end, 10);
+		if(end == value +1 || b <= 0)
+			return qfalse;
+
+		if(b > filesize)
+			b = filesize;
+
+		*first = filesize - b;
+		*last = filesize -1;
+		return qtrue;
+	}
+
+	a = strtol(value, &end, 10);
+	if(end == value || *end != '-' || a < 0)
+		return qfalse;
+
+	value = end +1;
+	if(*value >= '0' && *value <= '9')
+	{
+		b = strtol(value, &end, 10);
+		if(b < a)
+			return qfalse;
+	}else{
+		b = filesize -1;
+	}
+
+	if(b >= filesize)
+		b = filesize -1;
+
+	*first = a;
+	*last = b; //first > last means it is not satisfiable
+	return qtrue;
+}
+
+/*
+Handles the request header at the beginning of conn->request if it is complete.
+Returns the length of the header or 0 if it is not complete yet
+*/
+static int SV_WWWServer_HandleRequest( wwwConnection_t *conn ) {
+
+	char *end, *line, *next, *target, *version;
+	char path[MAX_QPATH];
+	char headers[256];
+	qboolean head, hasrange;
+	int first, last, size, fd, headerlen;
+	fileHandle_t file;
+
+	conn->request[conn->requestlen] = '\0';
+
+	end = strstr(conn->request, "\r\n\r\n");
+	if(end == NULL)
+	{
+		if(conn->requestlen >= MAX_WWWSERVER_REQUEST -1)
+		{
+			SV_WWWServer_SendError(conn, "413 Request Entity Too Large");
+			return conn->requestlen;
+		}
+		return 0;
+	}
+	*end = '\0';
+	headerlen = end +4 - conn->request;
+
+	if(!Q_strncmp(conn->request, "GET ", 4))
+	{
+		head = qfalse;
+		target = conn->request + 4;
+	}else if(!Q_strncmp(conn->request, "HEAD ", 5)){
+		head = qtrue;
+		target = conn->request + 5;
+	}else{
+		SV_WWWServer_SendError(conn, "405 Method Not Allowed");
+		return headerlen;
+	}
+
+	line = strstr(target, "\r\n");
+	if(line)
+	{
+		*line = '\0';
+		next = line +2;
+	}else{
+		next = NULL;
+	}
+
+	version = strchr(target, ' ');
+	if(version == NULL)
+	{
+		SV_WWWServer_SendError(conn, "400 Bad Request");
+		return headerlen;
+	}
+	*version = '\0';
+	version++;
+
+	conn->keepalive = Q_stricmp(version, "HTTP/1.0") ? qtrue : qfalse;
+	hasrange = qfalse;
+	first = last = 0;
+
+	//Header fields. Range can not be looked at before we know the size of the file
+	for(line = next; line; line = next)
+	{
+		next = strstr(line, "\r\n");
+		if(next)
+		{
+			*next = '\0';
+			next += 2;
+		}
+
+		if(!Q_stricmpn(line, "Connection:", 11))
+		{
+			if(Q_stristr(line +11, "close"))
+				conn->keepalive = qfalse;
+			else if(Q_stristr(line +11, "keep-alive"))
+				conn->keepalive = qtrue;
+
+		}else if(!Q_stricmpn(line, "Range:", 6)){
+			hasrange = qtrue;
+			Q_strncpyz(headers, line +6, sizeof(headers));
+		}
+	}
+
+	wwwRequests++;
+
+	if(sv_wwwMetrics->integer && !Q_strncmp(target, "/metrics", 8) && (target[8] == '\0' || target[8] == '?'))
+	{
+		if(sv_wwwMetrics->integer == 2 || Sys_IsLANAddress(&conn->remote))
+		{
+			SV_WWWServer_SendMetrics(conn, head);
+			return headerlen;
+		}
+		SV_WWWServer_SendError(conn, "403 Forbidden");
+		return headerlen;
+	}
+
+	if(!sv_wwwServer->boolean)
+	{
+		SV_WWWServer_SendError(conn, "404 Not Found");
+		return headerlen;
+	}
+
+	if(!SV_WWWServer_DecodePath(target, strlen(target), path, sizeof(path)) || !FS_VerifyPak(path))
+	{
+		Com_DPrintf("HTTP: Refused download of %s for %s\n", target, NET_AdrToString(&conn->remote));
+		SV_WWWServer_SendError(conn, "404 Not Found");
+		return headerlen;
+	}
+
+	size = FS_SV_FOpenFileRead(path, &file);
+	if(size <= 0)
+	{
+		if(file)
+			FS_FCloseFile(file);
+
+		SV_WWWServer_SendError(conn, "404 Not Found");
+		return headerlen;
+	}
+	fd = FS_DupFileDescriptor(file);
+	FS_FCloseFile(file);
+
+	if(fd < 0)
+	{
+		SV_WWWServer_SendError(conn, "500 Internal Server Error");
+		return headerlen;
+	}
+
+	if(hasrange && SV_WWWServer_ParseRange(headers, size, &first, &last))
+	{
+		if(first > last)
+		{
+			close(fd);
+			Com_sprintf(headers, sizeof(headers), "Content-Range: bytes */%d\r\n", size);
+			conn->keepalive = qfalse;
+			SV_WWWServer_SendResponse(conn, "416 Requested Range Not Satisfiable", headers, 0);
+			conn->closing = qtrue;
+			return headerlen;
+		}
+		Com_sprintf(headers, sizeof(headers), "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nContent-Range: bytes %d-%d/%d\r\n", first, last, size);
+		SV_WWWServer_SendResponse(conn, "206 Partial Content", headers, last - first +1);
+	}else{
+		first = 0;
+		last = size -1;
+		SV_WWWServer_SendResponse(conn, "200 OK", "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n", size);
+	}
+
+	if(head)
+	{
+		close(fd);
+		if(!conn->keepalive)
+			conn->closing = qtrue;
+		return headerlen;
+	}
+
+	Com_DPrintf("HTTP: Sending %s (%d bytes) to %s\n", path, last - first +1, NET_AdrToString(&conn->remote));
+
+	conn->fd = fd;
+	conn->offset = first;
+	conn->remaining = last - first +1;
+	return headerlen;
+}
+
+/*
+Sends file data and processes further requests until the socket is full.
+The connection might be closed and freed when this returns
+*/
+static void SV_WWWServer_Pump( wwwConnection_t *conn ) {
+
+	int sock = conn->sock;
+	int pending, sent, headerlen;
+
+	while(conn->sock == sock)
+	{
+		pending = NET_TcpFlushPending(sock);
+		if(pending < 0)
+			return; //Socket got closed
+
+		if(conn->fd >= 0)
+		{
+			if(pending > 0)
+				return;
+
+			sent = NET_TcpSendFile(sock, conn->fd, &conn->offset, conn->remaining);
+			if(sent < 0)
+				return;
+
+			if(sent == 0)
+				return; //Wait till the client reads more
+
+			conn->lastActivity = Sys_Milliseconds();
+			conn->remaining -= sent;
+			wwwBytesSent += sent;
+
+			if(conn->remaining <= 0)
+			{
+				SV_WWWServer_CloseFile(conn);
+				if(!conn->keepalive)
+					conn->closing = qtrue;
+			}
+			continue;
+		}
+
+		if(conn->closing)
+		{
+			if(pending == 0)
+				NET_TcpCloseSocket(sock);
+			return;
+		}
+
+		headerlen = SV_WWWServer_HandleRequest(conn);
+		if(headerlen == 0)
+			return;
+
+		//Keep whatever got pipelined behind this request
+		conn->requestlen -= headerlen;
+		memmove(conn->request, conn->request + headerlen, conn->requestlen);
+	}
+}
+
+static void SV_WWWServer_AppendData( wwwConnection_t *conn, msg_t *msg ) {
+
+	int len = msg->cursize;
+
+	if(conn->closing)
+		return;
+
+	if(len > MAX_WWWSERVER_REQUEST -1 - conn->requestlen)
+		len = MAX_WWWSERVER_REQUEST -1 - conn->requestlen;
+
+	Com_Memcpy(conn->request + conn->requestlen, msg->data, len);
+	conn->requestlen += len;
+	conn->lastActivity = Sys_Milliseconds();
+}
+
+static tcpclientstate_t SV_WWWServer_Auth( netadr_t *from, msg_t *msg, int socketfd, int *connectionId ) {
+
+	int i;
+	wwwConnection_t *conn;
+
+	if(!sv_wwwServer->boolean && !sv_wwwMetrics->integer)
+		return TCP_AUTHNOTME;
+
+	if(msg->cursize < 5 || (Q_strncmp((char*)msg->data, "GET ", 4) && Q_strncmp((char*)msg->data, "HEAD ", 5)))
+		return TCP_AUTHNOTME;
+
+	if(SV_PlayerBannedByip(from))
+		return TCP_AUTHBAD;
+
+	for(i = 0, conn = wwwConnections; i < MAX_WWWSERVER_CONNECTIONS; i++, conn++)
+	{
+		if(conn->sock == 0)
+			break;
+	}
+	if(i == MAX_WWWSERVER_CONNECTIONS)
+	{
+		Com_DPrintf("HTTP: Too many connections, refusing %s\n", NET_AdrToString(from));
+		return TCP_AUTHBAD;
+	}
+
+	Com_Memset(conn, 0, sizeof(wwwConnection_t));
+	conn->sock = socketfd;
+	conn->remote = *from;
+	conn->fd = -1;
+	SV_WWWServer_AppendData(conn, msg);
+	*connectionId = i;
+
+	//The connection is not accepted yet so the request gets answered by the next SV_WWWServer_Frame()
+	return TCP_AUTHSUCCESSFULL;
+}
+
+static qboolean SV_WWWServer_Event( netadr_t *from, msg_t *msg, int socketfd, int connectionId ) {
+
+	wwwConnection_t *conn;
+
+	if(connectionId < 0 || connectionId >= MAX_WWWSERVER_CONNECTIONS || wwwConnections[connectionId].sock != socketfd)
+	{
+		Com_PrintError("SV_WWWServer_Event: bad connectionId: %i\n", connectionId);
+		return qtrue;
+	}
+	conn = &wwwConnections[connectionId];
+
+	SV_WWWServer_AppendData(conn, msg);
+	SV_WWWServer_Pump(conn);
+	return qfalse;
+}
+
+static void SV_WWWServer_Disconnect( netadr_t *from, int socketfd, int connectionId ) {
+
+	wwwConnection_t *conn;
+
+	if(connectionId < 0 || connectionId >= MAX_WWWSERVER_CONNECTIONS)
+	{
+		Com_Error(ERR_FATAL, "SV_WWWServer_Disconnect: bad connectionId: %i", connectionId);
+		return;
+	}
+	conn = &wwwConnections[connectionId];
+
+	SV_WWWServer_CloseFile(conn);
+	conn->sock = 0;
+}
+
+/*
+==================
+SV_WWWServer_Frame
+
+Keeps the transfers going. The file data itself never leaves the kernel
+==================
+*/
+void SV_WWWServer_Frame( void ) {
+
+	int i;
+	unsigned int now;
+	wwwConnection_t *conn;
+
+	now = Sys_Milliseconds();
+
+	for(i = 0, conn = wwwConnections; i < MAX_WWWSERVER_CONNECTIONS; i++, conn++)
+	{
+		if(conn->sock == 0)
+			continue;
+
+		if(conn->lastActivity + (conn->fd >= 0 ? WWWSERVER_STALLTIMEOUT : WWWSERVER_IDLETIMEOUT) < now)
+		{
+			NET_TcpCloseSocket(conn->sock);
+			continue;
+		}
+		SV_WWWServer_Pump(conn);
+	}
+}
+
+void SV_WWWServer_Init( void ) {
+
+	static qboolean	initialized;
+
+	if ( initialized ) {
+		return;
+	}
+	initialized = qtrue;
+
+	sv_wwwServer = Cvar_RegisterBool("sv_wwwServer", qfalse, CVAR_ARCHIVE, "Answer HTTP download requests on the server port. Point sv_wwwBaseURL to http://<this server>:<net_port>");
+	sv_wwwMetrics = Cvar_RegisterInt("sv_wwwMetrics", 0, 0, 2, CVAR_ARCHIVE, "Serve Prometheus metrics at http://<this server>:<net_port>/metrics. 0 = off, 1 = to LAN addresses only, 2 = to everybody");
+
+	NET_TCPAddEventType(SV_WWWServer_Event, SV_WWWServer_Auth, SV_WWWServer_Disconnect, WWWSERVER_SERVICEID);
+}
@@ -0,0 +1,46 @@
+/*
+===========================================================================
+    Copyright (C) 2010-2013  Ninja and TheKelm of the IceOps-Team
+
+    This file is part of CoD4X17a-Server source code.
+
+    CoD4X17a-Server source code is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    CoD4X17a-Server source code is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>
+===========================================================================
+*/
+
+
+
+#ifndef __SV_WWWSERVER_H__
+#define __SV_WWWSERVER_H__
+
+/*
+========================================================================
+
+Built-in HTTP server for sv_wwwDownload. It shares the TCP port of the game
+server and only hands out the files a client could also get by UDP download.
+With sv_wwwMetrics it also answers /metrics for Prometheus
+
+========================================================================
+*/
+
+#define MAX_WWWSERVER_CONNECTIONS 32
+#define MAX_WWWSERVER_REQUEST 2048		//Has to hold the whole request header
+#define WWWSERVER_IDLETIMEOUT 15000		//Keep-alive connections without a request
+#define WWWSERVER_STALLTIMEOUT 60000		//Transfers the client stopped reading
+#define WWWSERVER_METRICSBUF 131072		//Whole /metrics response body
+
+void SV_WWWServer_Init( void );
+void SV_WWWServer_Frame( void );
+
+#endif
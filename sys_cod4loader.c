@@ -33,18 +33,25 @@
 #include "server.h"
 #include "scr_vm_functions.h"
 #include "sys_thread.h"
+#include "msg.h"
 
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <elf.h>
+#include <sys/stat.h>
 
 
 
 #define ELF_TYPEOFFSET 16
 #define DLLMOD_FILESIZE 2281820
 
+#define IMAGECACHE_FILE "cod4_lnxded-patched.so"
+#define IMAGECACHE_MAGIC 0x50344443	//"CD4P"
+#define IMAGECACHE_VERSION 1
+
 static qboolean Sys_LoadImagePrepareFile(const char* path)
 {
         FILE* fp;
@@ -313,6 +320,8 @@ static byte patchblock_NET_OOB_CALL4[] = { 0x9B, 0x53, 0x17, 0x8,
 	SetJump(0x81aa0be, Info_SetValueForKey);
 	SetJump(0x81d6fca, Sys_Milliseconds);
 	SetJump(0x81a9f8a, va);
+	SetJump(0x813061c, MSG_WriteBits);
+	SetJump(0x81306dc, MSG_WriteBit1);
 
 	SetJump(0x8140e9c, Sys_GetValue);
 	SetJump(0x8140efe, Sys_IsMainThread);
@@ -349,6 +358,162 @@ static qboolean Sys_PatchImage()
 }
 
 
+/*
+=============
+Image cache
+
+A copy of the module with all patches of Sys_PatchImageData already applied.
+Loading it skips the patching, and since nothing writes to its code pages
+they stay shared in the page cache between all servers on the host instead of
+every instance keeping private copies of the patched pages.
+
+Appended to the end of the ELF file comes a trailer with a key of the stock
+module and our own executable, the patches are built into the latter. Only
+done for a non PIE executable since the patches contain our addresses.
+=============
+*/
+
+typedef struct{
+	int		magic;
+	int		version;
+	struct{
+		unsigned int	dev, ino, size, mtime;
+	}files[2];			//The stock module and /proc/self/exe
+}imageCacheTrailer_t;
+
+static qboolean Sys_ImageCacheKey(const char* module, imageCacheTrailer_t* key)
+{
+	const char* paths[2];
+	struct stat st;
+	Elf32_Ehdr ehdr;
+	FILE* fp;
+	int i;
+
+	fp = fopen("/proc/self/exe", "rb");
+	if(fp == NULL)
+		return qfalse;
+	if(fread(&ehdr, 1, sizeof(ehdr), fp) != sizeof(ehdr) || ehdr.e_type != ET_EXEC)
+	{
+		fclose(fp);
+		return qfalse;
+	}
+	fclose(fp);
+
+	memset(key, 0, sizeof(imageCacheTrailer_t));
+	key->magic = IMAGECACHE_MAGIC;
+	key->version = IMAGECACHE_VERSION;
+
+	paths[0] = module;
+	paths[1] = "/proc/self/exe";
+
+	for(i = 0; i < 2; i++)
+	{
+		if(stat(paths[i], &st) != 0)
+			return qfalse;
+		key->files[i].dev = st.st_dev;
+		key->files[i].ino = st.st_ino;
+		key->files[i].size = st.st_size;
+		key->files[i].mtime = st.st_mtime;
+	}
+	return qtrue;
+}
+
+static qboolean Sys_ImageCacheValid(const char* path, const imageCacheTrailer_t* key)
+{
+	imageCacheTrailer_t trailer;
+	FILE* fp;
+	qboolean valid;
+
+	fp = fopen(path, "rb");
+	if(fp == NULL)
+		return qfalse;
+
+	valid = !fseek(fp, 0, SEEK_END) && ftell(fp) == DLLMOD_FILESIZE + sizeof(trailer) &&
+		!fseek(fp, DLLMOD_FILESIZE, SEEK_SET) && fread(&trailer, 1, sizeof(trailer), fp) == sizeof(trailer) &&
+		!memcmp(&trailer, key, sizeof(trailer));
+
+	fclose(fp);
+	return valid;
+}
+
+//Copies the patched memory of [IMAGE_BASE + offset, +length) to where the file has it
+static qboolean Sys_ImageCacheCopySection(byte* image, int offset, int length)
+{
+	Elf32_Ehdr* ehdr = (Elf32_Ehdr*)image;
+	Elf32_Phdr* phdr;
+	unsigned int vaddr = IMAGE_BASE + offset;
+	int i;
+
+	if(ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf32_Phdr) > DLLMOD_FILESIZE)
+		return qfalse;
+
+	for(i = 0; i < ehdr->e_phnum; i++)
+	{
+		phdr = (Elf32_Phdr*)(image + ehdr->e_phoff) + i;
+		if(phdr->p_type != PT_LOAD)
+			continue;
+		if(vaddr < phdr->p_vaddr || vaddr + length > phdr->p_vaddr + phdr->p_filesz)
+			continue;
+		if(phdr->p_offset + (vaddr - phdr->p_vaddr) + length > DLLMOD_FILESIZE)
+			return qfalse;
+
+		memcpy(image + phdr->p_offset + (vaddr - phdr->p_vaddr), (void*)vaddr, length);
+		return qtrue;
+	}
+	return qfalse;
+}
+
+static void Sys_WriteImageCache(const char* module, const char* path, const imageCacheTrailer_t* key)
+{
+	char tmppath[MAX_OSPATH];
+	byte* image;
+	FILE* fp;
+	qboolean ok;
+
+	image = malloc(DLLMOD_FILESIZE);
+	if(image == NULL)
+		return;
+
+	fp = fopen(module, "rb");
+	if(fp == NULL)
+	{
+		free(image);
+		return;
+	}
+	ok = fread(image, 1, DLLMOD_FILESIZE, fp) == DLLMOD_FILESIZE;
+	fclose(fp);
+
+	if(ok)
+		ok = Sys_ImageCacheCopySection(image, TEXT_SECTION_OFFSET, TEXT_SECTION_LENGTH) &&
+			Sys_ImageCacheCopySection(image, RODATA_SECTION_OFFSET, RODATA_SECTION_LENGTH);
+
+	if(!ok)
+	{
+		printf("Can not build the patched image cache %s\n", path);
+		free(image);
+		return;
+	}
+
+	//Write it beside and rename it, other instances might be loading the old one right now
+	Com_sprintf(tmppath, sizeof(tmppath), "%s.%d", path, getpid());
+	fp = fopen(tmppath, "wb");
+	if(fp == NULL)
+	{
+		free(image);
+		return;
+	}
+	ok = fwrite(image, 1, DLLMOD_FILESIZE, fp) == DLLMOD_FILESIZE && fwrite(key, 1, sizeof(imageCacheTrailer_t), fp) == sizeof(imageCacheTrailer_t);
+	ok = fclose(fp) == 0 && ok;
+	free(image);
+
+	if(!ok || rename(tmppath, path) != 0)
+	{
+		printf("Failed to write the patched image cache %s Error: %s\n", path, strerror(errno));
+		remove(tmppath);
+	}
+}
+
+
 /*
 =============
 Sys_LoadImage
@@ -360,8 +525,12 @@ void Sys_LoadImage( ){
     void *dl;
     char *error;
     char module[MAX_OSPATH];
+    char cache[MAX_OSPATH];
+    imageCacheTrailer_t key;
+    qboolean havekey;
 
     Com_sprintf(module, sizeof(module), "%s/%s", Sys_BinaryPath(), COD4_DLL);
+    Com_sprintf(cache, sizeof(cache), "%s/%s", Sys_BinaryPath(), IMAGECACHE_FILE);
 
     if(!Sys_LoadImagePrepareFile( module ))
     {
@@ -369,6 +538,17 @@ void Sys_LoadImage( ){
         _exit(1);
     }
 
+    havekey = Sys_ImageCacheKey(module, &key);
+
+    if(havekey && Sys_ImageCacheValid(cache, &key))
+    {
+        dl = dlopen(cache, RTLD_LAZY);
+        if(dl != NULL)
+            return; //Already patched
+
+        printf("Failed to load the patched image cache %s Error: %s\n", cache, dlerror());
+    }
+
     dl = dlopen(module, RTLD_LAZY);
 
     if(dl == NULL)
@@ -385,4 +565,7 @@ void Sys_LoadImage( ){
         printf("Failed to patch module: %s\n", module);
         _exit(1);
     }
+
+    if(havekey)
+        Sys_WriteImageCache(module, cache, &key);
 }
@@ -25,6 +25,7 @@
 #include "cmd_completion.h"
 #include "qcommon_io.h"
 #include "cvar.h"
+#include "sys_thread.h"
 
 
 #include <unistd.h>
@@ -35,6 +36,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
 
 
 /*
@@ -75,6 +78,40 @@ void Field_AutoComplete( field_t *field );
 #define MAXPRINTMSG 1024
 #endif
 
+/*
+Console writer
+
+CON_Print only appends the converted message to a ring buffer, a background thread writes it
+to stderr in batches and hides and shows the edit line once per batch instead of once per message.
+A slow reader on the other end of stderr (journald, the docker log driver) can so not stall the
+server frame anymore. If the buffer is full the message gets dropped and the number of dropped
+messages gets printed with the next batch.
+The writer thread takes ttycon_lock for the edit line, which CON_Input holds while it edits it.
+Output is written synchronously until CON_Init started the thread.
+*/
+
+#define CONWRITER_BUFFERSIZE 0x40000
+#define CONWRITER_STAGINGSIZE 0x4000
+#define CONWRITER_FLUSHTIMEOUT 2000 //msec CON_Shutdown waits for a blocked stderr
+
+typedef struct{
+	char buffer[CONWRITER_BUFFERSIZE];
+	volatile unsigned int head;
+	volatile unsigned int tail;
+	volatile qboolean busy;
+	qboolean running;
+	int dropped;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+}conWriter_t;
+
+static conWriter_t conwriter = { .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+static pthread_mutex_t ttycon_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void CON_Hide( void );
+static void CON_Show( void );
+
 
 /*
 ==================
@@ -173,6 +210,125 @@ static void CON_Show( void )
 	}
 }
 
+static void CON_WriteFd( int fd, const char* data, int len )
+{
+	int written;
+
+	while(len > 0)
+	{
+		written = write(fd, data, len);
+		if(written < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return;
+		}
+		data += written;
+		len -= written;
+	}
+}
+
+static void* CON_WriterThread( void* arg )
+{
+	static char staging[CONWRITER_STAGINGSIZE];
+	char dropmsg[64];
+	unsigned int pos, len;
+	int dropped;
+
+	Sys_PlaceHelperThread("cod4x-conwriter");
+
+	while(1)
+	{
+		pthread_mutex_lock(&conwriter.lock);
+		while(conwriter.tail == conwriter.head)
+			pthread_cond_wait(&conwriter.wake, &conwriter.lock);
+
+		len = conwriter.head - conwriter.tail;
+		if(len > CONWRITER_STAGINGSIZE)
+			len = CONWRITER_STAGINGSIZE;
+
+		pos = conwriter.tail % CONWRITER_BUFFERSIZE;
+		if(pos + len > CONWRITER_BUFFERSIZE)
+		{
+			Com_Memcpy(staging, conwriter.buffer + pos, CONWRITER_BUFFERSIZE - pos);
+			Com_Memcpy(staging + CONWRITER_BUFFERSIZE - pos, conwriter.buffer, len - (CONWRITER_BUFFERSIZE - pos));
+		}else{
+			Com_Memcpy(staging, conwriter.buffer + pos, len);
+		}
+		conwriter.tail += len;
+		dropped = conwriter.dropped;
+		conwriter.dropped = 0;
+		conwriter.busy = qtrue;
+		pthread_mutex_unlock(&conwriter.lock);
+
+		if(ttycon_on)
+			pthread_mutex_lock(&ttycon_lock);
+
+		CON_Hide();
+		CON_WriteFd(STDERR_FILENO, staging, len);
+		if(dropped > 0)
+		{
+			Com_sprintf(dropmsg, sizeof(dropmsg), "Console output overflow: %d messages dropped\n", dropped);
+			CON_WriteFd(STDERR_FILENO, dropmsg, strlen(dropmsg));
+		}
+		CON_Show();
+
+		if(ttycon_on)
+			pthread_mutex_unlock(&ttycon_lock);
+
+		__sync_synchronize();
+		conwriter.busy = qfalse;
+	}
+	return NULL;
+}
+
+static void CON_InitWriter( void )
+{
+	if(conwriter.running)
+		return;
+
+	if(pthread_create(&conwriter.thread, NULL, CON_WriterThread, NULL) != 0)
+	{
+		Com_PrintWarning("CON_InitWriter: Can not create writer thread. Console output will be written synchronously\n");
+		return;
+	}
+	conwriter.running = qtrue;
+}
+
+//Must be called with conwriter.lock held
+static qboolean CON_WriterAppend( const char* data, int len )
+{
+	unsigned int pos, contiguous;
+
+	if(len > CONWRITER_BUFFERSIZE - (conwriter.head - conwriter.tail))
+		return qfalse;
+
+	pos = conwriter.head % CONWRITER_BUFFERSIZE;
+	contiguous = CONWRITER_BUFFERSIZE - pos;
+	if(contiguous < len)
+	{
+		Com_Memcpy(conwriter.buffer + pos, data, contiguous);
+		Com_Memcpy(conwriter.buffer, data + contiguous, len - contiguous);
+	}else{
+		Com_Memcpy(conwriter.buffer + pos, data, len);
+	}
+	conwriter.head += len;
+	return qtrue;
+}
+
+//Waits up to timeout msec until the writer thread has written everything
+static void CON_FlushWriter( int timeout )
+{
+	if(!conwriter.running)
+		return;
+
+	while((conwriter.tail != conwriter.head || conwriter.busy) && timeout > 0)
+	{
+		usleep(1000);
+		timeout--;
+	}
+}
+
 /*
 ==================
 CON_Shutdown
@@ -182,6 +338,8 @@ Never exit without calling this, or your terminal will be left in a pretty bad s
 */
 void CON_Shutdown( void )
 {
+	CON_FlushWriter(CONWRITER_FLUSHTIMEOUT);
+
 	if (ttycon_on)
 	{
 		CON_Back(); // Delete "]"
@@ -312,6 +470,7 @@ void CON_Init( void )
 		Com_Printf("tty console mode disabled\n");
 		ttycon_on = qfalse;
 		stdin_active = qtrue;
+		CON_InitWriter();
 		return;
 	}
 
@@ -340,19 +499,24 @@ void CON_Init( void )
 	tc.c_cc[VMIN] = 1;
 	tc.c_cc[VTIME] = 0;
 	tcsetattr (STDIN_FILENO, TCSADRAIN, &tc);
+
+	pthread_mutex_lock(&ttycon_lock);
 	ttycon_on = qtrue;
+	pthread_mutex_unlock(&ttycon_lock);
 
 	com_ansiColor = Cvar_RegisterBool("ttycon_ansiColor", qtrue, CVAR_ARCHIVE, "Use ansi colors for sysconsole output");
+
+	CON_InitWriter();
 }
 
 
 
 /*
 ==================
-CON_Input
+CON_ReadInput
 ==================
 */
-char *CON_Input( void )
+static char *CON_ReadInput( void )
 {
 	// we use this when sending back commands
 	static char text[MAX_EDIT_LINE];
@@ -487,6 +651,27 @@ char *CON_Input( void )
 	return NULL;
 }
 
+/*
+==================
+CON_Input
+
+The writer thread must not redraw the edit line while it gets edited
+==================
+*/
+char *CON_Input( void )
+{
+	char *text;
+
+	if(!ttycon_on)
+		return CON_ReadInput();
+
+	pthread_mutex_lock(&ttycon_lock);
+	text = CON_ReadInput();
+	pthread_mutex_unlock(&ttycon_lock);
+
+	return text;
+}
+
 /*
 ==================
 CON_Print
@@ -494,14 +679,40 @@ CON_Print
 */
 void CON_Print( const char *msg )
 {
-	CON_Hide( );
+	unsigned int head;
+	qboolean ok;
+
+	if(!conwriter.running)
+	{
+		CON_Hide( );
+
+		if( com_ansiColor && com_ansiColor->integer )
+			Sys_AnsiColorPrint( msg );
+		else
+			fputs( msg, stderr );
+
+		CON_Show( );
+		return;
+	}
+
+	pthread_mutex_lock(&conwriter.lock);
+
+	head = conwriter.head;
 
 	if( com_ansiColor && com_ansiColor->integer )
-		Sys_AnsiColorPrint( msg );
+		ok = Sys_AnsiColorConvert( msg, CON_WriterAppend );
 	else
-		fputs( msg, stderr );
+		ok = CON_WriterAppend( msg, strlen(msg) );
+
+	if(!ok)
+	{
+		//Nothing of a message which does not fit
+		conwriter.head = head;
+		conwriter.dropped++;
+	}
 
-	CON_Show( );
+	pthread_cond_signal(&conwriter.wake);
+	pthread_mutex_unlock(&conwriter.lock);
 }
 
 //============================================================================
@@ -509,6 +720,12 @@ void CON_Print( const char *msg )
 
 
 
+static qboolean Sys_AnsiColorFputs( const char *data, int len )
+{
+	fwrite( data, 1, len, stderr );
+	return qtrue;
+}
+
 /*
 =================
 Sys_AnsiColorPrint
@@ -518,7 +735,19 @@ Transform Q3 colour codes to ANSI escape sequences
 */
 void Sys_AnsiColorPrint( const char *msg )
 {
-	static char buffer[ MAXPRINTMSG ];
+	Sys_AnsiColorConvert( msg, Sys_AnsiColorFputs );
+}
+
+/*
+=================
+Sys_AnsiColorConvert
+
+Hands the transformed message to output in pieces. Stops and returns qfalse once output failed
+=================
+*/
+qboolean Sys_AnsiColorConvert( const char *msg, qboolean (*output)( const char *data, int len ) )
+{
+	char        buffer[ MAXPRINTMSG ];
 	int         length = 0;
 	static int  q3ToAnsi[ 8 ] =
 	{
@@ -539,15 +768,16 @@ void Sys_AnsiColorPrint( const char *msg )
 			// First empty the buffer
 			if( length > 0 )
 			{
-				buffer[ length ] = '\0';
-				fputs( buffer, stderr );
+				if( !output( buffer, length ) )
+					return qfalse;
 				length = 0;
 			}
 
 			if( *msg == '\n' )
 			{
 				// Issue a reset and then the newline
-				fputs( "\033[0m\n", stderr );
+				if( !output( "\033[0m\n", 5 ) )
+					return qfalse;
 				msg++;
 			}
 			else
@@ -555,7 +785,8 @@ void Sys_AnsiColorPrint( const char *msg )
 				// Print the color code
 				Com_sprintf( buffer, sizeof( buffer ), "\033[1;%dm",
 						q3ToAnsi[ ColorIndex( *( msg + 1 ) ) ] );
-				fputs( buffer, stderr );
+				if( !output( buffer, strlen( buffer ) ) )
+					return qfalse;
 				msg += 2;
 			}
 		}
@@ -573,8 +804,8 @@ void Sys_AnsiColorPrint( const char *msg )
 	// Empty anything still left in the buffer
 	if( length > 0 )
 	{
-		buffer[ length ] = '\0';
-		fputs( buffer, stderr );
+		return output( buffer, length );
 	}
+	return qtrue;
 }
 
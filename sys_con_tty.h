@@ -24,7 +24,10 @@
 #ifndef __SYS_CON_TTY_H__
 #define __SYS_CON_TTY_H__
 
+#include "q_shared.h"
+
 void Sys_AnsiColorPrint( const char *msg );
+qboolean Sys_AnsiColorConvert( const char *msg, qboolean (*output)( const char *data, int len ) );
 void CON_Shutdown( void );
 void CON_Init(void);
 char *CON_Input( void );
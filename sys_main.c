@@ -24,6 +24,7 @@
 
 #include "q_shared.h"
 #include "sys_main.h"
+#include "qcommon_profile.h"
 #include "q_platform.h"
 #include "qcommon_io.h"
 #include "qcommon_logprint.h"
@@ -44,6 +45,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <wait.h>
 #include <fpu_control.h>
 
@@ -65,49 +67,58 @@ static char installPath[ MAX_OSPATH ] = { 0 };
 Sys_Milliseconds
 ================
 */
-/* base time in seconds, that's our origin
-   timeval:tv_sec is an int:
-   assuming this wraps every 0x7fffffff - ~68 years since the Epoch (1970) - we're safe till 2038
-   using unsigned long data type to work right with Sys_XTimeToSysTime */
-/* current time in ms, using sys_timeBase as origin
-   NOTE: sys_timeBase*1000 + curtime -> ms since the Epoch
-	 0x7fffffff ms - ~24 days
-   although timeval:tv_usec is an int, I'm not sure wether it is actually used as an unsigned int
-	 (which would affect the wrap period) */
+/* All times are taken from the monotonic clock so stepping the system time (NTP, date)
+   doesn't make frames jump or stall. CLOCK_MONOTONIC gets slewed by NTP but never steps
+   and gets read through the vDSO without a syscall.
+   sys_timeBase is the clock's second at Sys_TimerInit, that's our origin.
+	 0xffffffff ms - ~49 days until Sys_Milliseconds wraps */
 
 unsigned int sys_timeBase;
+static clockid_t sys_clockId = CLOCK_MONOTONIC;
+
+static void Sys_ClockTime( struct timespec *ts )
+{
+	if(clock_gettime( sys_clockId, ts ) != 0)
+	{
+		//No monotonic clock. Should not happen on any kernel we run on
+		struct timeval tp;
+		gettimeofday( &tp, NULL );
+		ts->tv_sec = tp.tv_sec;
+		ts->tv_nsec = tp.tv_usec * 1000;
+	}
+}
 
 unsigned int Sys_Milliseconds( void )
 {
-	struct timeval tp;
+	struct timespec ts;
 
-	gettimeofday( &tp, NULL );
+	Sys_ClockTime( &ts );
 
-	return ( tp.tv_sec - sys_timeBase ) * 1000 + tp.tv_usec / 1000;
+	return ( ts.tv_sec - sys_timeBase ) * 1000 + ts.tv_nsec / 1000000;
 }
 
 unsigned long long Sys_MillisecondsLong( void )
 {
 	unsigned long long time;
 
-	struct timeval tp;
+	struct timespec ts;
 
-	gettimeofday( &tp, NULL );
+	Sys_ClockTime( &ts );
 
-	time = (unsigned long long)tp.tv_sec - (unsigned long long)sys_timeBase;
-	time = time * 1000 + tp.tv_usec / 1000;
+	time = (unsigned long long)ts.tv_sec - (unsigned long long)sys_timeBase;
+	time = time * 1000 + ts.tv_nsec / 1000000;
 	return time;
 }
 
 
 void Sys_TimerInit( void ) {
-	struct timeval tp;
+	struct timespec ts;
 
-	gettimeofday( &tp, NULL );
+	Sys_ClockTime( &ts );
 
 	if ( !sys_timeBase )
 	{
-		sys_timeBase = tp.tv_sec;
+		sys_timeBase = ts.tv_sec;
 	}
 }
 
@@ -117,43 +128,25 @@ void Sys_TimerInit( void ) {
 Sys_Microseconds
 ================
 */
-/* base time in seconds, that's our origin
-   timeval:tv_sec is an int:
-   assuming this wraps every 0x7fffffff - ~68 years since the Epoch (1970) - we're safe till 2038
-   using unsigned long data type to work right with Sys_XTimeToSysTime */
-/* current time in ms, using sys_timeBase as origin
-   NOTE: sys_timeBase*1000 + curtime -> ms since the Epoch
-	 0x7fffffff ms - ~24 days
-   although timeval:tv_usec is an int, I'm not sure wether it is actually used as an unsigned int
-	 (which would affect the wrap period) */
 unsigned long long Sys_MicrosecondsLong( void ) {
-	struct timeval tp;
-	unsigned long long orgtime;
+	struct timespec ts;
 	unsigned long long time;
 
-	gettimeofday( &tp, NULL );
+	Sys_ClockTime( &ts );
 
-	orgtime = tp.tv_sec - sys_timeBase;
-
-	time = (orgtime << 19);
-	time = time + (orgtime << 18);
-	time = time + (orgtime << 17);
-	time = time + (orgtime << 16);
-	time = time + (orgtime << 14);
-	time = time + (orgtime << 9);
-	time = time + (orgtime << 6);
-	time = time + (unsigned long long)tp.tv_usec;
+	time = (unsigned long long)ts.tv_sec - (unsigned long long)sys_timeBase;
+	time = time * 1000000 + ts.tv_nsec / 1000;
 
 	return time;
 }
 
 
 int Sys_Seconds( void ) {
-	struct timeval tp;
+	struct timespec ts;
 
-	gettimeofday( &tp, NULL );
+	Sys_ClockTime( &ts );
 
-	return tp.tv_sec - sys_timeBase;
+	return ts.tv_sec - sys_timeBase;
 }
 
 /*
@@ -424,8 +417,12 @@ __cdecl int main(int argc, char* argv[]){
 
     Sys_SetDefaultInstallPath( DEFAULT_BASEDIR );
 
+    Com_StartupPhase("loadimage");
+
     Sys_LoadImage( );
 
+    Com_StartupPhase("platform");
+
     Sys_TimerInit( );
 
     Sys_PlatformInit( );
@@ -458,6 +455,8 @@ __cdecl int main(int argc, char* argv[]){
 
     Sys_InitCrashDumps();
 
+    Com_StartupPhase("com_init");
+
     Com_Init( commandLine );
 
 
@@ -59,6 +59,8 @@ void Sys_InitCrashDumps();
 qboolean Sys_MemoryProtectWrite(void* startoffset, int len);
 qboolean Sys_MemoryProtectExec(void* startoffset, int len);
 qboolean Sys_MemoryProtectReadonly(void* startoffset, int len);
+int Sys_MemoryAdviseHugePages(void* start, int len, qboolean collapse);
+qboolean Sys_MemoryHugePagesResident(void* start, int len, int* residentKB, int* hugeKB);
 const char *Sys_DefaultHomePath(void);
 const char *Sys_TempPath( void );
 void __cdecl Sys_Init(void);
@@ -21,6 +21,9 @@
 */
 
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //recvmmsg() / sendmmsg()
+#endif
 
 #include "qcommon_io.h"
 #include "sys_net.h"
@@ -29,6 +32,8 @@
 #include "net_game_conf.h"
 #include "cmd.h"
 #include "net_game.h"
+#include "sys_thread.h"
+#include "msg.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -36,6 +41,7 @@
 #ifdef _WIN32
 #	include <winsock2.h>
 #	include <ws2tcpip.h>
+#	include <io.h>
 #	if WINVER < 0x501
 #		ifdef __MINGW32__
 			// wspiapi.h isn't available on MinGW, so if it's
@@ -81,6 +87,7 @@ static qboolean	winsockInitialized = qfalse;
 #	include <net/if.h>
 #	include <sys/ioctl.h>
 #	include <sys/types.h>
+#	include <time.h>
 #	include <sys/time.h>
 #	include <unistd.h>
 #	if !defined(__sun) && !defined(__sgi)
@@ -91,6 +98,26 @@ static qboolean	winsockInitialized = qfalse;
 #		include <sys/filio.h>
 #	endif
 
+#	ifdef __linux__
+#		include <sys/epoll.h>
+#		include <sys/sendfile.h>
+#		include <sys/prctl.h>
+#		include <sys/eventfd.h>
+#		define NET_HAVE_EPOLL
+#		define NET_HAVE_EVENTFD
+#		define NET_HAVE_SENDFILE
+#		define NET_HAVE_MMSG
+#		include <linux/filter.h>
+#		include <poll.h>
+#		include <pthread.h>
+#		if defined(SO_REUSEPORT) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#			define NET_HAVE_QUERYTHREAD
+#		endif
+#		if defined(SO_ATTACH_FILTER) && defined(SKF_NET_OFF)
+#			define NET_HAVE_PACKETFILTER
+#		endif
+#	endif
+
 
 #	define INVALID_SOCKET		-1
 #	define SOCKET_ERROR		-1
@@ -119,12 +146,12 @@ void Cmd_AddCommand(char* name, void* fun){}
 unsigned int net_timeBase;
 int NET_TimeGetTime( void )
 {
-	struct timeval tp;
-	gettimeofday( &tp, NULL );
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
 	if ( !net_timeBase )
-		net_timeBase = tp.tv_sec;
+		net_timeBase = ts.tv_sec;
 
-	return ( tp.tv_sec - net_timeBase ) * 1000 + tp.tv_usec / 1000;
+	return ( ts.tv_sec - net_timeBase ) * 1000 + ts.tv_nsec / 1000000;
 }
 #endif
 
@@ -137,6 +164,10 @@ void NET_TCPConnectionClosed(netadr_t* adr, int sock, int connectionId, int serv
 void NET_UDPPacketEvent(netadr_t* from, void* data, int len){}
 #endif
 #ifndef __NET_GAME_H__
+#pragma message "Function NET_QueryPacketEvent is undefined"
+void NET_QueryPacketEvent(netadr_t* from, void* data, int len){}
+#endif
+#ifndef __NET_GAME_H__
 #pragma message "Function NET_TCPAuthPacketEvent is undefined"
 tcpclientstate_t NET_TCPAuthPacketEvent(netadr_t* remote, byte* bufData, int cursize, int* sock, int* connectionId, int *serviceId){ return TCP_AUTHSUCCESSFULL; }
 #endif
@@ -168,6 +199,12 @@ static cvar_t	*net_mcast6addr;
 static cvar_t	*net_mcast6iface;
 
 static cvar_t	*net_dropsim;
+static cvar_t	*net_eventBackend;
+static cvar_t	*net_udpBatch;
+static cvar_t	*net_framePacing;
+static cvar_t	*net_queryThread;
+static cvar_t	*net_dualStack;
+static cvar_t	*net_packetFilter;
 
 
 
@@ -184,6 +221,7 @@ static netadr_t	ip_defaultSock = { 0 };
 static SOCKET	tcp_socket = INVALID_SOCKET;
 static SOCKET	tcp6_socket = INVALID_SOCKET;
 static SOCKET	socks_socket = INVALID_SOCKET;
+static SOCKET	net_dualStackSocket = INVALID_SOCKET; //ip_socket[0] if it serves IPv4 as well
 //static SOCKET	multicast6_socket = INVALID_SOCKET;
 
 pthread_t net_thread;
@@ -215,6 +253,26 @@ typedef struct
 static nip_localaddr_t localIP[MAX_IPS];
 static int numIP;
 
+/*
+LAN prefixes for Sys_IsLANAddress()
+The private ranges and the networks of the local interfaces in network byte order, so testing
+an address is one masked word compare per prefix. Rebuilt with the list of local addresses.
+*/
+typedef struct{
+	uint32_t	net;
+	uint32_t	mask;
+}netLanPrefix4_t;
+
+typedef struct{
+	uint64_t	net[2];
+	uint64_t	mask[2];
+}netLanPrefix6_t;
+
+static netLanPrefix4_t net_lanPrefixes4[MAX_IPS + 4];
+static netLanPrefix6_t net_lanPrefixes6[MAX_IPS + 2];
+static int net_numLanPrefixes4;
+static int net_numLanPrefixes6;
+
 
 //=============================================================================
 
@@ -224,6 +282,25 @@ static int numIP;
 #define MAX_TCPAUTHWAITTIME 3000
 #define MAX_TCPCONNECTEDTIMEOUT 1800000 //30 minutes - close this if we have too many waiting connections
 
+/*
+Output which the kernel did not take right away waits in a per connection queue
+and gets written with one sendmsg() as soon as the socket becomes writable again.
+Queue entries reference shared buffers so a broadcast is stored only once for all receivers.
+*/
+#define NET_TCPSENDQUEUE_ENTRIES 64
+#define NET_TCPSENDQUEUE_MAXBYTES (512*1024)
+
+struct netTcpSendBuffer_s{
+	int			refcount;
+	int			length;
+	byte			data[1];
+};
+
+typedef struct{
+	netTcpSendBuffer_t	*buf;
+	int			offset;
+}tcpSendQueueEntry_t;
+
 typedef struct{
 	netadr_t		remote;
 	unsigned int		lastMsgTime;
@@ -231,6 +308,11 @@ typedef struct{
 	int			serviceId;
 	tcpclientstate_t	state;
 	SOCKET			sock;
+	tcpSendQueueEntry_t	sendqueue[NET_TCPSENDQUEUE_ENTRIES];
+	int			sendqueuehead; //Oldest entry
+	int			sendqueuecount;
+	int			sendqueuebytes;
+	qboolean		wantwrite; //Waiting for EPOLLOUT
 }tcpConnections_t;
 
 
@@ -244,6 +326,128 @@ typedef struct{
 
 tcpServer_t tcpServer;
 
+static void NET_TcpClearSendQueue( tcpConnections_t *conn );
+
+
+/*
+Event backends for NET_Sleep() and NET_TcpServerPacketEventLoop()
+select() has to rebuild and scan its fd_set every frame and can not handle descriptors above FD_SETSIZE.
+epoll keeps the descriptors registered inside the kernel so idle TCP sessions cost nothing per frame.
+*/
+
+typedef enum{
+	NET_EVENTBACKEND_SELECT,
+	NET_EVENTBACKEND_EPOLL
+}netEventBackend_t;
+
+static netEventBackend_t net_activeBackend = NET_EVENTBACKEND_SELECT;
+
+#ifdef NET_HAVE_EPOLL
+
+#define NET_EPOLL_MAXEVENTS 64
+
+//Tags stored in epoll_event.data.u32. The lower bits are the index into ip_socket[] or tcpServer.connections[]
+#define NET_EPOLLTAG_UDP 0x10000
+#define NET_EPOLLTAG_TCPLISTEN 0x20000
+#define NET_EPOLLTAG_TCPCONN 0x40000
+#define NET_EPOLLTAG_WAKEUP 0x80000
+#define NET_EPOLLTAG_INDEXMASK 0xffff
+
+static int net_epollfd = -1; //UDP sockets and TCP listen sockets, waited on by NET_Sleep()
+static int net_tcpepollfd = -1; //Accepted TCP connections, polled by NET_TcpServerPacketEventLoop()
+static unsigned int net_lastAuthTimeoutCheck;
+
+#endif
+
+/*
+Wakeup of NET_Sleep() from other threads
+NET_Wakeup() makes an eventfd readable which is part of the descriptors NET_Sleep() waits on.
+*/
+
+#ifdef NET_HAVE_EVENTFD
+static int net_wakeupfd = -1;
+#endif
+static volatile qboolean net_wokenUp;
+
+/*
+Batched UDP I/O
+NET_Event() drains up to net_udpBatch datagrams per recvmmsg() call.
+Packets sent between NET_BeginPacketQueue() and NET_FlushPacketQueue() get collected and leave with one sendmmsg() per socket.
+*/
+
+#ifdef NET_HAVE_MMSG
+
+#define NET_UDPBATCH_MAX 64
+#define NET_UDPBATCH_RECVSLOTSIZE 0x4000
+#define NET_UDPBATCH_SENDSLOTSIZE 0x800 //Larger packets bypass the queue
+
+typedef struct{
+	struct mmsghdr		msgs[NET_UDPBATCH_MAX];
+	struct iovec		iovecs[NET_UDPBATCH_MAX];
+	struct sockaddr_storage	addrs[NET_UDPBATCH_MAX];
+	byte			data[NET_UDPBATCH_MAX][NET_UDPBATCH_RECVSLOTSIZE];
+}netRecvBatch_t;
+
+typedef struct{
+	qboolean		active;
+	SOCKET			sock;
+	int			count;
+	struct mmsghdr		msgs[NET_UDPBATCH_MAX];
+	struct iovec		iovecs[NET_UDPBATCH_MAX];
+	struct sockaddr_storage	addrs[NET_UDPBATCH_MAX];
+	byte			data[NET_UDPBATCH_MAX][NET_UDPBATCH_SENDSLOTSIZE];
+}netSendQueue_t;
+
+static netRecvBatch_t net_recvBatch;
+static netSendQueue_t net_sendQueue;
+
+#endif
+
+/*
+Query thread
+With net_queryThread the UDP sockets get opened with SO_REUSEPORT and each one gets a twin bound
+to the same address. A classic BPF program attached to the group steers the datagrams which start
+with "\xff\xff\xff\xffgetstatus" or "\xff\xff\xff\xffgetinfo" to the twin, everything else stays on the
+socket NET_Sleep() waits on. A thread reads the twins and passes the datagrams to NET_QueryPacketEvent()
+with the address of the original socket, so a flood of queries can not delay the usercmds of the clients.
+*/
+
+#ifdef NET_HAVE_QUERYTHREAD
+
+#define NET_QUERYTHREAD_POLLMSEC 250 //How long NET_CloseQuerySockets() might wait for the thread
+#define NET_QUERYTHREAD_PACKETSIZE 0x4000
+#define NET_QUERYTHREAD_BURST 64
+
+static SOCKET net_querySockets[MAX_IPS];
+static int net_querySocketCount;
+static pthread_t net_queryThreadHandle;
+static volatile qboolean net_queryThreadRunning;
+static volatile qboolean net_queryThreadQuit;
+
+#endif
+
+/*
+Frame pacing
+With net_framePacing > 0 NET_Sleep() only sleeps until net_framePacing usec before the deadline
+and then keeps polling the sockets with a zero timeout until the deadline is reached.
+This trades a little CPU for server frames that start within a few usec of the requested time.
+*/
+
+typedef struct{
+	unsigned int		frames;
+	unsigned int		lateFrames; //Deadline overshot by more than NET_PACING_LATEUSEC
+	unsigned long long	sumOvershoot;
+	unsigned int		maxOvershoot;
+	unsigned long long	sumSpin;
+}netPacingStats_t;
+
+#define NET_PACING_LATEUSEC 500
+
+static netPacingStats_t net_pacingStats;
+#ifdef __linux__
+static int net_pacingTimerSlack = -1;
+#endif
+
 
 /*
 ====================
@@ -311,6 +515,16 @@ static void NetadrToSockadr( netadr_t *a, struct sockaddr *s ) {
 		((struct sockaddr_in *)s)->sin_port = a->port;
 		((struct sockaddr_in *)s)->sin_addr.s_addr = INADDR_BROADCAST;
 	}
+	else if( a->type == NA_IP && a->sock == net_dualStackSocket && net_dualStackSocket != INVALID_SOCKET ) {
+		// v4-mapped, ::ffff:a.b.c.d
+		((struct sockaddr_in6 *)s)->sin6_family = AF_INET6;
+		memset(&((struct sockaddr_in6 *)s)->sin6_addr, 0, 10);
+		((struct sockaddr_in6 *)s)->sin6_addr.s6_addr[10] = 0xff;
+		((struct sockaddr_in6 *)s)->sin6_addr.s6_addr[11] = 0xff;
+		memcpy(&((struct sockaddr_in6 *)s)->sin6_addr.s6_addr[12], a->ip, 4);
+		((struct sockaddr_in6 *)s)->sin6_port = a->port;
+		((struct sockaddr_in6 *)s)->sin6_scope_id = 0;
+	}
 	else if( a->type == NA_IP || a->type == NA_TCP ) {
 		((struct sockaddr_in *)s)->sin_family = AF_INET;
 		((struct sockaddr_in *)s)->sin_addr.s_addr = *(int *)&a->ip;
@@ -341,6 +555,17 @@ __optimize3 __regparm3 static void SockadrToNetadr( struct sockaddr *s, netadr_t
 		*(int *)&a->ip = ((struct sockaddr_in *)s)->sin_addr.s_addr;
 		a->port = ((struct sockaddr_in *)s)->sin_port;
 	}
+	else if(s->sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)s)->sin6_addr))
+	{
+		// IPv4 client on the dual-stack socket
+		if(!tcp)
+			a->type = NA_IP;
+		else
+			a->type = NA_TCP;
+
+		memcpy(a->ip, &((struct sockaddr_in6 *)s)->sin6_addr.s6_addr[12], 4);
+		a->port = ((struct sockaddr_in6 *)s)->sin6_port;
+	}
 	else if(s->sa_family == AF_INET6)
 	{
 		if(!tcp)
@@ -422,14 +647,14 @@ static qboolean Sys_StringToSockaddr(const char *s, struct sockaddr *sadr, int s
 				search->ai_addrlen = sadr_len;
 				
 			memcpy(sadr, search->ai_addr, search->ai_addrlen);
-			freeaddrinfo(search);
+			freeaddrinfo(res);
 			
 			return qtrue;
 		}
-		else
+		else if(Sys_IsMainThread())
 			Com_PrintError("Sys_StringToSockaddr: Error resolving %s: No address of required type found.\n", s);
 	}
-	else
+	else if(Sys_IsMainThread())
 		Com_PrintError("Sys_StringToSockaddr: Error resolving %s: %s\n", s, gai_strerror(retval));
 	
 	if(res)
@@ -530,11 +755,33 @@ NET_CompareBaseAdrMask
 Compare without port, and up to the bit number given in netmask.
 ===================
 */
+// Mask of the first bits of a word in network byte order
+static inline uint32_t NET_PrefixMask32(int bits)
+{
+	return bits <= 0 ? 0 : htonl(0xffffffffu << (32 - bits));
+}
+
+static inline uint64_t NET_PrefixMask64(int bits)
+{
+	uint64_t mask;
+
+	if(bits <= 0)
+		return 0;
+	if(bits > 64)
+		bits = 64;
+
+	mask = 0xffffffffffffffffULL << (64 - bits);
+#ifdef Q3_LITTLE_ENDIAN
+	mask = __builtin_bswap64(mask);
+#endif
+	return mask;
+}
+
 qboolean NET_CompareBaseAdrMask(netadr_t *a, netadr_t *b, int netmask)
 {
-	byte cmpmask, *addra, *addrb;
-	int curbyte;
-	
+	uint32_t a4, b4;
+	uint64_t a6[2], b6[2];
+
 	if (a->type != b->type)
 		return qfalse;
 
@@ -543,43 +790,27 @@ qboolean NET_CompareBaseAdrMask(netadr_t *a, netadr_t *b, int netmask)
 
 	if(a->type == NA_IP || a->type == NA_TCP)
 	{
-		addra = (byte *) &a->ip;
-		addrb = (byte *) &b->ip;
-		
 		if(netmask < 0 || netmask > 32)
 			netmask = 32;
+
+		memcpy(&a4, a->ip, sizeof(a4));
+		memcpy(&b4, b->ip, sizeof(b4));
+
+		return ((a4 ^ b4) & NET_PrefixMask32(netmask)) == 0;
 	}
 	else if(a->type == NA_IP6 || a->type == NA_TCP6)
 	{
-		addra = (byte *) &a->ip6;
-		addrb = (byte *) &b->ip6;
-		
 		if(netmask < 0 || netmask > 128)
 			netmask = 128;
-	}
-	else
-	{
-		Com_PrintError ("NET_CompareBaseAdr: bad address type\n");
-		return qfalse;
-	}
-
-	curbyte = netmask >> 3;
 
-	if(curbyte && memcmp(addra, addrb, curbyte))
-			return qfalse;
-
-	netmask &= 0x07;
-	if(netmask)
-	{
-		cmpmask = (1 << netmask) - 1;
-		cmpmask <<= 8 - netmask;
+		memcpy(a6, a->ip6, sizeof(a6));
+		memcpy(b6, b->ip6, sizeof(b6));
 
-		if((addra[curbyte] & cmpmask) == (addrb[curbyte] & cmpmask))
-			return qtrue;
+		return ((a6[0] ^ b6[0]) & NET_PrefixMask64(netmask)) == 0 &&
+			((a6[1] ^ b6[1]) & NET_PrefixMask64(netmask - 64)) == 0;
 	}
-	else
-		return qtrue;
-	
+
+	Com_PrintError ("NET_CompareBaseAdr: bad address type\n");
 	return qfalse;
 }
 
@@ -829,6 +1060,113 @@ __optimize3 __regparm3 int NET_GetPacket(netadr_t *net_from, void *net_message,
 
 
 
+#ifdef NET_HAVE_MMSG
+/*
+==================
+NET_SendQueuedPackets
+
+Hands all queued datagrams to the kernel with as few sendmmsg() calls as possible
+==================
+*/
+static void NET_SendQueuedPackets( void )
+{
+	int ret;
+	int offset = 0;
+	int err;
+
+	while(offset < net_sendQueue.count)
+	{
+		ret = sendmmsg(net_sendQueue.sock, &net_sendQueue.msgs[offset], net_sendQueue.count - offset, 0);
+
+		if(ret == SOCKET_ERROR)
+		{
+			err = socketError;
+
+			if(err == EINTR)
+				continue;
+
+			// wouldblock is silent
+			if(err != EAGAIN)
+				Com_PrintWarningNoRedirect( "NET_SendPacket: %s\n", NET_ErrorString() );
+
+			//The first datagram failed - skip it and continue with the remaining ones
+			offset++;
+			continue;
+		}
+		offset += ret;
+	}
+	net_sendQueue.count = 0;
+}
+#endif
+
+/*
+==================
+NET_BeginPacketQueue
+
+Datagrams passed to Sys_SendPacket() get queued until NET_FlushPacketQueue() is called
+==================
+*/
+void NET_BeginPacketQueue( void )
+{
+#ifdef NET_HAVE_MMSG
+	if(net_udpBatch == NULL || net_udpBatch->integer < 2)
+		return;
+
+	net_sendQueue.active = qtrue;
+#endif
+}
+
+/*
+==================
+NET_FlushPacketQueue
+==================
+*/
+void NET_FlushPacketQueue( void )
+{
+#ifdef NET_HAVE_MMSG
+	NET_SendQueuedPackets();
+	net_sendQueue.active = qfalse;
+#endif
+}
+
+#ifdef NET_HAVE_MMSG
+/*
+==================
+NET_QueuePacket
+==================
+*/
+static void NET_QueuePacket( SOCKET sock, int length, const void *data, struct sockaddr_storage *addr, socklen_t addrlen )
+{
+	int maxcount;
+	int i;
+
+	maxcount = net_udpBatch->integer;
+	if(maxcount > NET_UDPBATCH_MAX)
+		maxcount = NET_UDPBATCH_MAX;
+
+	//One sendmmsg() covers only one socket
+	if(net_sendQueue.count > 0 && (net_sendQueue.sock != sock || net_sendQueue.count >= maxcount))
+		NET_SendQueuedPackets();
+
+	i = net_sendQueue.count;
+
+	memcpy(net_sendQueue.data[i], data, length);
+	memcpy(&net_sendQueue.addrs[i], addr, addrlen);
+
+	net_sendQueue.iovecs[i].iov_base = net_sendQueue.data[i];
+	net_sendQueue.iovecs[i].iov_len = length;
+
+	memset(&net_sendQueue.msgs[i], 0, sizeof(net_sendQueue.msgs[i]));
+	net_sendQueue.msgs[i].msg_hdr.msg_name = &net_sendQueue.addrs[i];
+	net_sendQueue.msgs[i].msg_hdr.msg_namelen = addrlen;
+	net_sendQueue.msgs[i].msg_hdr.msg_iov = &net_sendQueue.iovecs[i];
+	net_sendQueue.msgs[i].msg_hdr.msg_iovlen = 1;
+
+	net_sendQueue.sock = sock;
+	net_sendQueue.count++;
+}
+#endif
+
 /*
 ==================
 Sys_SendPacket
@@ -838,6 +1176,7 @@ qboolean Sys_SendPacket( int length, const void *data, netadr_t *to ) {
 	int	ret = SOCKET_ERROR;
 	int	i;
 	struct sockaddr_storage	addr;
+	netadr_t	dualto;
 
 	if( to->type != NA_BROADCAST && to->type != NA_IP && to->type != NA_IP6 && to->type != NA_MULTICAST6)
 	{
@@ -845,12 +1184,23 @@ qboolean Sys_SendPacket( int length, const void *data, netadr_t *to ) {
 		return qfalse;
 	}
 
+	if( NET_IsDiscardSock(to->sock) )
+		return qfalse;
+
 	if( (to->type == NA_IP && to->sock == INVALID_SOCKET) || (to->type == NA_IP6 && to->sock == INVALID_SOCKET) || (to->sock == INVALID_SOCKET && to->type == NA_MULTICAST6) )
 		return qfalse;
 
 	if(to->type == NA_MULTICAST6 && (net_enabled->integer & NET_DISABLEMCAST))
 		return qfalse;
 
+	//There is no other socket to pick
+	if(to->sock == 0 && net_dualStackSocket != INVALID_SOCKET && (to->type == NA_IP || to->type == NA_IP6))
+	{
+		dualto = *to;
+		dualto.sock = net_dualStackSocket;
+		to = &dualto;
+	}
+
 	memset(&addr, 0, sizeof(addr));
 	NetadrToSockadr( to, (struct sockaddr *) &addr );
 /*
@@ -866,6 +1216,19 @@ qboolean Sys_SendPacket( int length, const void *data, netadr_t *to ) {
 
 	} else {*/
 
+#ifdef NET_HAVE_MMSG
+	if(net_sendQueue.active)
+	{
+		if(to->sock != 0 && length <= NET_UDPBATCH_SENDSLOTSIZE && (addr.ss_family == AF_INET || addr.ss_family == AF_INET6))
+		{
+			NET_QueuePacket(to->sock, length, data, &addr, addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+			return qtrue;
+		}
+		//Keep the order of datagrams
+		NET_SendQueuedPackets();
+	}
+#endif
+
 	if(to->sock != 0)
 	{
 		if(addr.ss_family == AF_INET)
@@ -921,9 +1284,9 @@ LAN clients will have their rate var ignored
 ==================
 */
 qboolean Sys_IsLANAddress( netadr_t *adr ) {
-	int		index, run, addrsize;
-	qboolean differed;
-	byte *compareadr, *comparemask, *compareip;
+	int		i;
+	uint32_t	ip4;
+	uint64_t	ip6[2];
 
 	if( adr->type == NA_LOOPBACK ) {
 		return qtrue;
@@ -931,68 +1294,28 @@ qboolean Sys_IsLANAddress( netadr_t *adr ) {
 
 	if( adr->type == NA_IP || adr->type == NA_TCP )
 	{
-		// RFC1918:
-		// 10.0.0.0        -   10.255.255.255  (10/8 prefix)
-		// 172.16.0.0      -   172.31.255.255  (172.16/12 prefix)
-		// 192.168.0.0     -   192.168.255.255 (192.168/16 prefix)
-		if(adr->ip[0] == 10)
-			return qtrue;
-		if(adr->ip[0] == 172 && (adr->ip[1]&0xf0) == 16)
-			return qtrue;
-		if(adr->ip[0] == 192 && adr->ip[1] == 168)
-			return qtrue;
+		memcpy(&ip4, adr->ip, sizeof(ip4));
 
-		if(adr->ip[0] == 127)
-			return qtrue;
+		// The interface prefixes behind the private ones only count for the family of the local addresses
+		for(i = 0; i < net_numLanPrefixes4; i++)
+		{
+			if((ip4 & net_lanPrefixes4[i].mask) == net_lanPrefixes4[i].net)
+				return i < 4 || adr->type == NA_IP;
+		}
 	}
 	else if(adr->type == NA_IP6 || adr->type == NA_TCP6)
 	{
-		if(adr->ip6[0] == 0xfe && (adr->ip6[1] & 0xc0) == 0x80)
-			return qtrue;
-		if((adr->ip6[0] & 0xfe) == 0xfc)
-			return qtrue;
-	}
-	
-	// Now compare against the networks this computer is member of.
-	for(index = 0; index < numIP; index++)
-	{
-		if(localIP[index].type == adr->type)
-		{
-			if(adr->type == NA_IP || adr->type == NA_TCP)
-			{
-				compareip = (byte *) &((struct sockaddr_in *) &localIP[index].addr)->sin_addr.s_addr;
-				comparemask = (byte *) &((struct sockaddr_in *) &localIP[index].netmask)->sin_addr.s_addr;
-				compareadr = adr->ip;
-				
-				addrsize = sizeof(adr->ip);
-			}
-			else
-			{
-				// TODO? should we check the scope_id here?
-
-				compareip = (byte *) &((struct sockaddr_in6 *) &localIP[index].addr)->sin6_addr;
-				comparemask = (byte *) &((struct sockaddr_in6 *) &localIP[index].netmask)->sin6_addr;
-				compareadr = adr->ip6;
-				
-				addrsize = sizeof(adr->ip6);
-			}
-
-			differed = qfalse;
-			for(run = 0; run < addrsize; run++)
-			{
-				if((compareip[run] & comparemask[run]) != (compareadr[run] & comparemask[run]))
-				{
-					differed = qtrue;
-					break;
-				}
-			}
-			
-			if(!differed)
-				return qtrue;
+		// TODO? should we check the scope_id here?
+		memcpy(ip6, adr->ip6, sizeof(ip6));
 
+		for(i = 0; i < net_numLanPrefixes6; i++)
+		{
+			if((ip6[0] & net_lanPrefixes6[i].mask[0]) == net_lanPrefixes6[i].net[0] &&
+				(ip6[1] & net_lanPrefixes6[i].mask[1]) == net_lanPrefixes6[i].net[1])
+				return i < 2 || adr->type == NA_IP6;
 		}
 	}
-	
+
 	return qfalse;
 }
 
@@ -1020,6 +1343,29 @@ void Sys_ShowIP(void) {
 //=============================================================================
 
 
+/*
+====================
+NET_SetReusePort
+
+The query sockets of NET_OpenQuerySockets() can only join sockets which had SO_REUSEPORT set
+before they got bound. Another server of the same user can bind such a port as well, so with
+net_queryThread every server on the host needs its own net_port
+====================
+*/
+static void NET_SetReusePort( SOCKET sock )
+{
+#ifdef NET_HAVE_QUERYTHREAD
+	int one = 1;
+
+	if(!net_queryThread || !net_queryThread->boolean)
+		return;
+
+	if(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *) &one, sizeof(one)) == SOCKET_ERROR)
+		Com_PrintWarning("NET_SetReusePort: setsockopt SO_REUSEPORT: %s\n", NET_ErrorString());
+#endif
+}
+
+
 /*
 ====================
 NET_IPSocket
@@ -1068,6 +1414,7 @@ int NET_IPSocket( char *net_interface, int port, int *err, qboolean tcp) {
 		if( setsockopt( newsocket, SOL_SOCKET, SO_BROADCAST, (char *) &i, sizeof(i) ) == SOCKET_ERROR ) {
 			Com_PrintWarning( "NET_IPSocket: setsockopt SO_BROADCAST: %s\n", NET_ErrorString() );
 		}
+		NET_SetReusePort( newsocket );
 	}
 
 	if( !net_interface || !net_interface[0]) {
@@ -1115,7 +1462,7 @@ int NET_IPSocket( char *net_interface, int port, int *err, qboolean tcp) {
 NET_IP6Socket
 ====================
 */
-int NET_IP6Socket( char *net_interface, int port, struct sockaddr_in6 *bindto, int *err, qboolean tcp) {
+int NET_IP6Socket( char *net_interface, int port, struct sockaddr_in6 *bindto, int *err, qboolean tcp, qboolean dualstack) {
 	SOCKET				newsocket;
 	struct sockaddr_in6		address;
 	ioctlarg_t			_true = 1;
@@ -1165,17 +1512,20 @@ int NET_IP6Socket( char *net_interface, int port, struct sockaddr_in6 *bindto, i
 
 #ifdef IPV6_V6ONLY
 	{
-		int i = 1;
+		int i = !dualstack;
 
-		// ipv4 addresses should not be allowed to connect via this socket.
+		// ipv4 addresses should not be allowed to connect via this socket, except it is the dual-stack one
 		if(setsockopt(newsocket, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &i, sizeof(i)) == SOCKET_ERROR)
 		{
 			// win32 systems don't seem to support this anyways.
-			Com_DPrintf("WARNING: NET_IP6Socket: setsockopt IPV6_V6ONLY: %s\n", NET_ErrorString());
+			Com_DPrintfChannel(DPRINT_NET, 1, "WARNING: NET_IP6Socket: setsockopt IPV6_V6ONLY: %s\n", NET_ErrorString());
 		}
 	}
 #endif
 
+	if(!tcp)
+		NET_SetReusePort( newsocket );
+
 	if( !net_interface || !net_interface[0]) {
 		address.sin6_family = AF_INET6;
 		address.sin6_addr = in6addr_any;
@@ -1279,7 +1629,7 @@ void NET_JoinMulticast6(void)
 	}
 	else
 	{
-		if((multicast6_socket = NET_IP6Socket(net_mcast6addr->string, ntohs(boundto.sin6_port), NULL, &err, qfalse)) == INVALID_SOCKET)
+		if((multicast6_socket = NET_IP6Socket(net_mcast6addr->string, ntohs(boundto.sin6_port), NULL, &err, qfalse, qfalse)) == INVALID_SOCKET)
 		{
 			// If the OS does not support binding to multicast addresses, like WinXP, at least try with the normal file descriptor.
 			multicast6_socket = ip6_socket;
@@ -1503,6 +1853,60 @@ void NET_OpenSocks( int port ) {
 NET_AddLocalAddress
 =====================
 */
+static void NET_AddLanPrefix4(const byte *ip, const byte *mask)
+{
+	netLanPrefix4_t *prefix;
+
+	if(net_numLanPrefixes4 >= sizeof(net_lanPrefixes4) / sizeof(net_lanPrefixes4[0]))
+		return;
+
+	prefix = &net_lanPrefixes4[net_numLanPrefixes4++];
+	memcpy(&prefix->mask, mask, sizeof(prefix->mask));
+	memcpy(&prefix->net, ip, sizeof(prefix->net));
+	prefix->net &= prefix->mask;
+}
+
+static void NET_AddLanPrefix6(const byte *ip, const byte *mask)
+{
+	netLanPrefix6_t *prefix;
+
+	if(net_numLanPrefixes6 >= sizeof(net_lanPrefixes6) / sizeof(net_lanPrefixes6[0]))
+		return;
+
+	prefix = &net_lanPrefixes6[net_numLanPrefixes6++];
+	memcpy(prefix->mask, mask, sizeof(prefix->mask));
+	memcpy(prefix->net, ip, sizeof(prefix->net));
+	prefix->net[0] &= prefix->mask[0];
+	prefix->net[1] &= prefix->mask[1];
+}
+
+/*
+The private ranges come first, Sys_IsLANAddress() counts them for TCP as well
+*/
+static void NET_ResetLanPrefixes(void)
+{
+	static const byte private4[4][2][4] = {
+		{{10, 0, 0, 0}, {255, 0, 0, 0}},		// RFC1918 10/8
+		{{172, 16, 0, 0}, {255, 240, 0, 0}},	// RFC1918 172.16/12
+		{{192, 168, 0, 0}, {255, 255, 0, 0}},	// RFC1918 192.168/16
+		{{127, 0, 0, 0}, {255, 0, 0, 0}}		// Loopback
+	};
+	static const byte private6[2][2][16] = {
+		{{0xfe, 0x80}, {0xff, 0xc0}},	// Link local fe80::/10
+		{{0xfc}, {0xfe}}			// Unique local fc00::/7
+	};
+	int i;
+
+	net_numLanPrefixes4 = 0;
+	net_numLanPrefixes6 = 0;
+
+	for(i = 0; i < 4; i++)
+		NET_AddLanPrefix4(private4[i][0], private4[i][1]);
+
+	for(i = 0; i < 2; i++)
+		NET_AddLanPrefix6(private6[i][0], private6[i][1]);
+}
+
 static void NET_AddLocalAddress(char *ifname, struct sockaddr *addr, struct sockaddr *netmask)
 {
 	int addrlen;
@@ -1535,7 +1939,12 @@ static void NET_AddLocalAddress(char *ifname, struct sockaddr *addr, struct sock
 
 		memcpy(&localIP[numIP].addr, addr, addrlen);
 		memcpy(&localIP[numIP].netmask, netmask, addrlen);
-		
+
+		if(family == AF_INET)
+			NET_AddLanPrefix4((byte *) &((struct sockaddr_in *) addr)->sin_addr, (byte *) &((struct sockaddr_in *) netmask)->sin_addr);
+		else
+			NET_AddLanPrefix6((byte *) &((struct sockaddr_in6 *) addr)->sin6_addr, (byte *) &((struct sockaddr_in6 *) netmask)->sin6_addr);
+
 		numIP++;
 	}
 }
@@ -1546,6 +1955,7 @@ static void NET_GetLocalAddress(void)
 	struct ifaddrs *ifap, *search;
 
 	numIP = 0;
+	NET_ResetLanPrefixes();
 
 	if(getifaddrs(&ifap))
 		Com_PrintError("NET_GetLocalAddress: Unable to get list of network interfaces: %s\n", NET_ErrorString());
@@ -1570,6 +1980,7 @@ static void NET_GetLocalAddress( void ) {
 	struct addrinfo	*res = NULL;
 
 	numIP = 0;
+	NET_ResetLanPrefixes();
 
 	if(gethostname( hostname, 256 ) == SOCKET_ERROR)
 		return;
@@ -1616,16 +2027,68 @@ static void NET_GetLocalAddress( void ) {
 
 /*
 ====================
-NET_OpenIP
+NET_OpenDualStack
+
+One UDP socket on [::] with IPV6_V6ONLY off serves both families, IPv4 peers show up as v4-mapped
+addresses which SockadrToNetadr() turns back into NA_IP. A wildcard socket leaves the source
+address of replies to the routing table, so this is for hosts with one address per family.
+TCP keeps its sockets for both families.
 ====================
 */
-void NET_OpenIP( void ) {
-	int		i, j, socketindex;
-	int		socketindex6 = 0;
-	int		err;
-	int		port;
-	int		port6;
-	int		limit;
+static qboolean NET_OpenDualStack( int port, int limit ) {
+	char	addrbuf[NET_ADDRSTRMAXLEN];
+	int	i, err;
+
+	for( i = 0 ; i < limit ; i++ )
+	{
+		Com_sprintf(addrbuf, sizeof(addrbuf), "[::]:%d", port + i );
+		NET_StringToAdr(addrbuf, &ip_socket[0], NA_IP6);
+
+		ip_socket[0].sock = NET_IP6Socket( "::", port + i, &boundto, &err, qfalse, qtrue);
+
+		if(ip_socket[0].sock == INVALID_SOCKET)
+		{
+			if(err == EAFNOSUPPORT)
+				return qfalse;
+			continue;
+		}
+
+		tcp6_socket = NET_IP6Socket( "::", port + i, &boundto, &err, qtrue, qfalse);
+		if(tcp6_socket != INVALID_SOCKET || err == EAFNOSUPPORT)
+			tcp_socket = NET_IPSocket( "0.0.0.0", port + i, &err, qtrue);
+
+		if(tcp_socket == INVALID_SOCKET && err != EAFNOSUPPORT)
+		{
+			//Port is in use by someone else
+			closesocket( ip_socket[0].sock );
+			ip_socket[0].sock = INVALID_SOCKET;
+			if(tcp6_socket != INVALID_SOCKET)
+				closesocket( tcp6_socket );
+			tcp6_socket = INVALID_SOCKET;
+			continue;
+		}
+
+		net_dualStackSocket = ip_socket[0].sock;
+		Cvar_SetInt( net_port, port + i );
+		Cvar_SetInt( net_port6, port + i );
+		Com_Printf("Dual-stack socket for IPv4 and IPv6 on port %d\n", port + i);
+		return qtrue;
+	}
+	return qfalse;
+}
+
+/*
+====================
+NET_OpenIP
+====================
+*/
+void NET_OpenIP( void ) {
+	int		i, j, socketindex;
+	int		socketindex6 = 0;
+	int		err;
+	int		port;
+	int		port6;
+	int		limit;
 	int		limit6;
 	char		addrbuf[NET_ADDRSTRMAXLEN];
 	char		addrbuf2[NET_ADDRSTRMAXLEN];
@@ -1658,8 +2121,18 @@ void NET_OpenIP( void ) {
 	}
 	tcp_socket = INVALID_SOCKET;
 	tcp6_socket = INVALID_SOCKET;
+	net_dualStackSocket = INVALID_SOCKET;
 	NET_GetLocalAddress();
 
+	if(net_dualStack->boolean && (net_enabled->integer & NET_ENABLEV4) && (net_enabled->integer & NET_ENABLEV6) &&
+		!Q_stricmp(net_ip->string, "0.0.0.0") && !Q_stricmp(net_ip6->string, "::") && port6 == port)
+	{
+		if(NET_OpenDualStack(port, limit))
+			return;
+
+		Com_PrintWarning( "Couldn't open a dual-stack socket, using separate IPv4 and IPv6 sockets\n");
+	}
+
 	// automatically scan for a valid port, so multiple
 	// dedicated servers can be started without requiring
 	// a different net_port for each one
@@ -1679,7 +2152,7 @@ void NET_OpenIP( void ) {
 				Com_sprintf(addrbuf2, sizeof(addrbuf2), "[%s]:%d", net_ip6->string, port6 + i );
 				NET_StringToAdr(addrbuf2, &ip_socket[0], NA_IP6);
 
-				ip_socket[0].sock = NET_IP6Socket(net_ip6->string, port6 + i, &boundto, &err, qfalse);
+				ip_socket[0].sock = NET_IP6Socket(net_ip6->string, port6 + i, &boundto, &err, qfalse, qfalse);
 
 				if(ip_socket[0].sock != INVALID_SOCKET)
 				{
@@ -1711,7 +2184,7 @@ void NET_OpenIP( void ) {
 					Com_sprintf(addrbuf2, sizeof(addrbuf2), "[%s]:%d", addrbuf, port6 + i );
 					NET_StringToAdr(addrbuf2, &ip_socket[socketindex6], NA_IP6);
 
-					ip_socket[socketindex6].sock = NET_IP6Socket(addrbuf, port6 + i, &boundto, &err, qfalse);
+					ip_socket[socketindex6].sock = NET_IP6Socket(addrbuf, port6 + i, &boundto, &err, qfalse, qfalse);
 
 					if(ip_socket[socketindex6].sock == INVALID_SOCKET)
 					{
@@ -1731,7 +2204,7 @@ void NET_OpenIP( void ) {
 			if( validsock6 )// && tcp6_socket != INVALID_SOCKET)
 			{
 
-				tcp6_socket = NET_IP6Socket( net_ip6->string, port6 + i, &boundto, &err, qtrue);
+				tcp6_socket = NET_IP6Socket( net_ip6->string, port6 + i, &boundto, &err, qtrue, qfalse);
 
 				if(tcp6_socket != INVALID_SOCKET){
 					Cvar_SetInt( net_port6, port6 + i );
@@ -1868,191 +2341,888 @@ void NET_OpenIP( void ) {
 }
 
 
-//===================================================================
+#ifdef NET_HAVE_EPOLL
+/*
+====================
+NET_EpollAdd
+====================
+*/
+static qboolean NET_EpollAdd(int epollfd, SOCKET sock, unsigned int tag)
+{
+	struct epoll_event ev;
 
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = tag;
+
+	if(epoll_ctl(epollfd, EPOLL_CTL_ADD, sock, &ev) == SOCKET_ERROR)
+	{
+		Com_PrintWarning("NET_EpollAdd: epoll_ctl() syscall failed: %s\n", NET_ErrorString());
+		return qfalse;
+	}
+	return qtrue;
+}
 
 /*
 ====================
-NET_GetCvars
+NET_EpollSetWantWrite
+
+Also reports writability of a TCP connection while it has queued output
 ====================
 */
-static qboolean NET_GetCvars( void ) {
-	int modified;
-
-#ifdef DEDICATED
-	// I want server owners to explicitly turn on ipv6 support.
-	net_enabled = Cvar_RegisterInt( "net_enabled", 3, 0, 8, CVAR_LATCH | CVAR_ARCHIVE, "Enables / Disables Network" );
-#else
-	/* End users have it enabled so they can connect to ipv6-only hosts, but ipv4 will be
-	 * used if available due to ping */
-	net_enabled = Cvar_RegisterInt( "net_enabled", 1, 0, 8, CVAR_LATCH | CVAR_ARCHIVE, "Enables / Disables Network");
-#endif
-	modified = net_enabled->modified;
-	net_enabled->modified = qfalse;
+static void NET_EpollSetWantWrite(tcpConnections_t *conn, qboolean wantwrite)
+{
+	struct epoll_event ev;
 
-	net_ip = Cvar_RegisterString( "net_ip", "0.0.0.0", CVAR_LATCH, "Default Network Address" );
-	modified += net_ip->modified;
-	net_ip->modified = qfalse;
-	
-	net_ip6 = Cvar_RegisterString( "net_ip6", "::", CVAR_LATCH , "Default IPv6 Network Address");
-	modified += net_ip6->modified;
-	net_ip6->modified = qfalse;
-	
-	net_port = Cvar_RegisterInt( "net_port", 0, 0, 65535, CVAR_LATCH, "Network Port Server will listen on");
-	modified += net_port->modified;
-	net_port->modified = qfalse;
-	
-	net_port6 = Cvar_RegisterInt( "net_port6", 0, 0, 65535, CVAR_LATCH, "IPv6 Network Port Server will listen on" );
-	modified += net_port6->modified;
-	net_port6->modified = qfalse;
+	if(conn->wantwrite == wantwrite || net_activeBackend != NET_EVENTBACKEND_EPOLL)
+		return;
 
-	// Some cvars for configuring multicast options which facilitates scanning for servers on local subnets.
-	net_mcast6addr = Cvar_RegisterString( "net_mcast6addr", NET_MULTICAST_IP6, CVAR_LATCH | CVAR_ARCHIVE,  "IPv6 Network multicast address");
-	modified += net_mcast6addr->modified;
-	net_mcast6addr->modified = qfalse;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = wantwrite ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.u32 = NET_EPOLLTAG_TCPCONN | (conn - tcpServer.connections);
 
-#ifdef _WIN32
-	net_mcast6iface = Cvar_RegisterInt( "net_mcast6iface", 0, 0, 65535, CVAR_LATCH | CVAR_ARCHIVE ,  "IPv6 Network multicast interface");
-#else
-	net_mcast6iface = Cvar_RegisterString( "net_mcast6iface", "", CVAR_LATCH | CVAR_ARCHIVE ,  "IPv6 Network multicast interface");
+	if(epoll_ctl(net_tcpepollfd, EPOLL_CTL_MOD, conn->sock, &ev) == SOCKET_ERROR)
+	{
+		Com_PrintWarningNoRedirect("NET_EpollSetWantWrite: epoll_ctl() syscall failed: %s\n", NET_ErrorString());
+		return;
+	}
+	conn->wantwrite = wantwrite;
+}
 #endif
-	modified += net_mcast6iface->modified;
-	net_mcast6iface->modified = qfalse;
 
-	net_socksEnabled = Cvar_RegisterInt( "net_socksEnabled", 0, 0, 1, CVAR_LATCH | CVAR_ARCHIVE, "Net enable socks proxy support");
-	modified += net_socksEnabled->modified;
-	net_socksEnabled->modified = qfalse;
+/*
+====================
+NET_InitWakeup
+====================
+*/
+static void NET_InitWakeup( void )
+{
+#ifdef NET_HAVE_EVENTFD
+	if(net_wakeupfd != -1)
+		return;
 
-	net_socksServer = Cvar_RegisterString( "net_socksServer", "", CVAR_LATCH | CVAR_ARCHIVE, "Net socks proxyserver address");
-	modified += net_socksServer->modified;
-	net_socksServer->modified = qfalse;
+	net_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-	net_socksPort = Cvar_RegisterInt( "net_socksPort", 1080, 0, 65535, CVAR_LATCH | CVAR_ARCHIVE, "Net socks proxyserver port");
-	modified += net_socksPort->modified;
-	net_socksPort->modified = qfalse;
+	if(net_wakeupfd == -1)
+		Com_PrintWarning("NET_InitWakeup: eventfd() syscall failed: %s - events from other threads wait for the next server frame\n", NET_ErrorString());
+#endif
+}
 
-	net_socksUsername = Cvar_RegisterString( "net_socksUsername", "", CVAR_LATCH | CVAR_ARCHIVE , "Net socks proxyserver username");
-	modified += net_socksUsername->modified;
-	net_socksUsername->modified = qfalse;
+/*
+====================
+NET_Wakeup
 
-	net_socksPassword = Cvar_RegisterString( "net_socksPassword", "", CVAR_LATCH | CVAR_ARCHIVE , "Net socks proxyserver password");
-	modified += net_socksPassword->modified;
-	net_socksPassword->modified = qfalse;
+Safe to call from any thread. Makes the running or next NET_Sleep() return
+====================
+*/
+void NET_Wakeup( void )
+{
+#ifdef NET_HAVE_EVENTFD
+	uint64_t one = 1;
 
-	net_dropsim = Cvar_RegisterInt("net_dropsim", 0,0,100, CVAR_TEMP, "Net enable packetloss simulation");
-	return modified ? qtrue : qfalse;
+	//Fails only with EAGAIN if the counter is full - a wakeup is pending then anyway
+	if(net_wakeupfd != -1 && write(net_wakeupfd, &one, sizeof(one)) != sizeof(one))
+		return;
+#endif
 }
 
+/*
+====================
+NET_ClearWakeup
+====================
+*/
+static void NET_ClearWakeup( void )
+{
+#ifdef NET_HAVE_EVENTFD
+	uint64_t count;
+
+	if(read(net_wakeupfd, &count, sizeof(count)) == sizeof(count))
+		net_wokenUp = qtrue;
+#endif
+}
 
 /*
 ====================
-NET_Config
+NET_ConsumeWakeup
+
+Returns qtrue once after NET_Sleep() got woken up by NET_Wakeup()
 ====================
 */
-void NET_Config( qboolean enableNetworking ) {
-	qboolean	modified;
-	qboolean	stop;
-	qboolean	start;
-	int		i;
+qboolean NET_ConsumeWakeup( void )
+{
+	if(!net_wokenUp)
+		return qfalse;
 
-	// get any latched changes to cvars
-	modified = NET_GetCvars();
+	net_wokenUp = qfalse;
+	return qtrue;
+}
 
-	if( !net_enabled->integer ) {
-		enableNetworking = 0;
+/*
+====================
+NET_EventBackendShutdown
+====================
+*/
+static void NET_EventBackendShutdown( void )
+{
+#ifdef NET_HAVE_EPOLL
+	if(net_epollfd != -1)
+	{
+		close(net_epollfd);
+		net_epollfd = -1;
+	}
+	if(net_tcpepollfd != -1)
+	{
+		close(net_tcpepollfd);
+		net_tcpepollfd = -1;
 	}
+#endif
+	net_activeBackend = NET_EVENTBACKEND_SELECT;
+}
 
-	// if enable state is the same and no cvars were modified, we have nothing to do
-	if( enableNetworking == networkingEnabled && !modified ) {
+/*
+====================
+NET_EventBackendInit
+
+Has to be called after NET_OpenIP() has opened all sockets.
+Falls back to select() if epoll is unavailable
+====================
+*/
+static void NET_EventBackendInit( void )
+{
+#ifdef NET_HAVE_EPOLL
+	int i;
+	qboolean success;
+
+	NET_EventBackendShutdown();
+
+	if(net_eventBackend->integer != NET_EVENTBACKEND_EPOLL)
+	{
+		Com_Printf("Network event backend: select\n");
 		return;
 	}
 
-	if( enableNetworking == networkingEnabled ) {
-		if( enableNetworking ) {
-			stop = qtrue;
-			start = qtrue;
-		}
-		else {
-			stop = qfalse;
-			start = qfalse;
-		}
-	}
-	else {
-		if( enableNetworking ) {
-			stop = qfalse;
-			start = qtrue;
-		}
-		else {
-			stop = qtrue;
-			start = qfalse;
-		}
-		networkingEnabled = enableNetworking;
+	net_epollfd = epoll_create(MAX_IPS + 2);
+	net_tcpepollfd = epoll_create(MAX_TCPCONNECTIONS);
+
+	if(net_epollfd == -1 || net_tcpepollfd == -1)
+	{
+		Com_PrintWarning("NET_EventBackendInit: epoll_create() syscall failed: %s - falling back to select()\n", NET_ErrorString());
+		NET_EventBackendShutdown();
+		return;
 	}
 
-	if( stop ) {
+	success = qtrue;
 
-		tcpConnections_t *con;
+	for(i = 0; i < numIP && success; i++)
+	{
+		if(ip_socket[i].sock == INVALID_SOCKET)
+			break;
 
+		success = NET_EpollAdd(net_epollfd, ip_socket[i].sock, NET_EPOLLTAG_UDP | i);
+	}
 
-		for(i = 0, con = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, con++){
+	if(success && tcp_socket != INVALID_SOCKET)
+		success = NET_EpollAdd(net_epollfd, tcp_socket, NET_EPOLLTAG_TCPLISTEN);
 
-			if(con->lastMsgTime > 0 && con->sock != INVALID_SOCKET)
-				NET_TcpCloseSocket(con->sock);
-		}
+	if(success && tcp6_socket != INVALID_SOCKET)
+		success = NET_EpollAdd(net_epollfd, tcp6_socket, NET_EPOLLTAG_TCPLISTEN);
 
-		for(i = 0; i < numIP; i++){
+	if(success && net_wakeupfd != -1)
+		success = NET_EpollAdd(net_epollfd, net_wakeupfd, NET_EPOLLTAG_WAKEUP);
 
-			if(ip_socket[i].sock != INVALID_SOCKET){
-				closesocket( ip_socket[i].sock );
-				ip_socket[i].sock = INVALID_SOCKET;
-			}
-		}
+	if(!success)
+	{
+		Com_PrintWarning("NET_EventBackendInit: Falling back to select()\n");
+		NET_EventBackendShutdown();
+		return;
+	}
 
-		if ( tcp_socket != INVALID_SOCKET ) {
-			//closesocket( tcp_socket );
-			shutdown(con->sock, 2);
-			tcp_socket = INVALID_SOCKET;
-		}
+	net_activeBackend = NET_EVENTBACKEND_EPOLL;
+	Com_Printf("Network event backend: epoll\n");
+#else
+	net_activeBackend = NET_EVENTBACKEND_SELECT;
+#endif
+}
 
 /*
-		if(multicast6_socket)
-		{
-			if(multicast6_socket != ip6_socket)
-				closesocket(multicast6_socket);
-				
-			multicast6_socket = INVALID_SOCKET;
-		}
+====================
+NET_QueryThread
+
+Reads the query sockets. Nothing but NET_QueryPacketEvent() gets called in here
+====================
 */
-		if ( tcp6_socket != INVALID_SOCKET ) {
-			closesocket( tcp6_socket );
-			tcp6_socket = INVALID_SOCKET;
-		}
+#ifdef NET_HAVE_QUERYTHREAD
+static void* NET_QueryThread( void* arg )
+{
+	struct pollfd fds[MAX_IPS];
+	int mainsock[MAX_IPS];
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	netadr_t from;
+	byte buf[NET_QUERYTHREAD_PACKETSIZE];
+	int i, j, count, len;
 
-		if ( socks_socket != INVALID_SOCKET ) {
-			closesocket( socks_socket );
-			socks_socket = INVALID_SOCKET;
-		}
-		
-	}
+	Sys_PlaceHelperThread("cod4x-query");
 
-	if( start )
+	for(i = 0, count = 0; i < MAX_IPS; i++)
 	{
-		if (net_enabled->integer)
-		{
-			NET_OpenIP();
-			//NET_SetMulticast6();
-		}
+		if(net_querySockets[i] == INVALID_SOCKET)
+			continue;
+
+		fds[count].fd = net_querySockets[i];
+		fds[count].events = POLLIN;
+		mainsock[count] = ip_socket[i].sock;
+		count++;
 	}
-}
 
-//Dumb trick to find out which socket is suitable to send data over
-void NET_RegisterDefaultCommunicationSocket(netadr_t *adr){
+	while(!net_queryThreadQuit)
+	{
+		if(poll(fds, count, NET_QUERYTHREAD_POLLMSEC) <= 0)
+			continue;
 
-	netadr_t *socketadr = NET_SockToAdr(adr->sock);
-	netadr_t test;
+		for(i = 0; i < count; i++)
+		{
+			if(!(fds[i].revents & POLLIN))
+				continue;
 
+			//Bounded so a flood on one address can not starve the others
+			for(j = 0; j < NET_QUERYTHREAD_BURST; j++)
+			{
+				addrlen = sizeof(addr);
+				len = recvfrom(fds[i].fd, (void *)buf, sizeof(buf), MSG_TRUNC, (struct sockaddr *) &addr, &addrlen);
+
+				if(len == SOCKET_ERROR)
+					break;
+
+				if(len > sizeof(buf))
+					continue;
+
+				//Replies and forwarded packets look like they came in on the socket of the server
+				SockadrToNetadr( (struct sockaddr *) &addr, &from, qfalse, mainsock[i]);
+				NET_QueryPacketEvent(&from, buf, len);
+			}
+		}
+	}
+	return NULL;
+}
+#endif
+
+/*
+Kernel packet filter
+
+With net_packetFilter every UDP socket gets a classic BPF program which drops in the kernel what
+SV_PacketEvent() would throw away anyway: datagrams too short for a netchan header, connectionless
+packets with a command SV_ConnectionlessPacket() does not know and everything coming from the addresses
+NET_SetPacketFilterBans() got, IPv4 netranges included. The socket filter sees the UDP header at offset 0
+and the IP header at SKF_NET_OFF. Conditional jumps only reach 255 instructions, so every ban ends in its
+own return.
+*/
+
+#ifdef NET_HAVE_PACKETFILTER
+
+#define NET_PACKETFILTER_UDPHDR 8
+#define NET_PACKETFILTER_MINLEN 6	//Sequence number and qport
+#define NET_PACKETFILTER_FIXED 64	//Room for everything besides the bans
+#define NET_PACKETFILTER_ACCEPT 0xffffffff
+
+//The first 4 characters of the commands of SV_ConnectionlessPacket() in lower case
+static const unsigned int net_packetFilterVerbs[] = {
+	0x67657473,	// "gets"tatus
+	0x67657469,	// "geti"nfo
+	0x72636f6e,	// "rcon"
+	0x636f6e6e,	// "conn"ect
+	0x69706175,	// "ipau"thorize
+	0x73746174,	// "stat"s
+	0x67657463	// "getc"hallenge
+};
+
+static struct sock_filter net_packetFilterProg[BPF_MAXINSNS];
+static int net_packetFilterLen;
+static qboolean net_packetFilterAttached;	//The sockets of NET_OpenIP() are open and have it
+
+static void NET_PacketFilterInsn(int *len, unsigned short code, unsigned char jt, unsigned char jf, unsigned int k)
+{
+	struct sock_filter *insn = &net_packetFilterProg[(*len)++];
+
+	insn->code = code;
+	insn->jt = jt;
+	insn->jf = jf;
+	insn->k = k;
+}
+
+static void NET_BuildPacketFilter( const netadr_t *bans, int count, const netadr_t *ranges, const int *rangebits, int rangecount )
+{
+	int len, i, j, jump6, jumpverbs, numbans, numverbs;
+	uint32_t word, mask;
+
+	numverbs = sizeof(net_packetFilterVerbs) / sizeof(net_packetFilterVerbs[0]);
+	len = 0;
+	numbans = 0;
+
+	NET_PacketFilterInsn(&len, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+	NET_PacketFilterInsn(&len, BPF_JMP | BPF_JGE | BPF_K, 1, 0, NET_PACKETFILTER_UDPHDR + NET_PACKETFILTER_MINLEN);
+	NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, 0);
+
+	//A dual-stack socket sees IPv4 headers as well
+	NET_PacketFilterInsn(&len, BPF_LD | BPF_B | BPF_ABS, 0, 0, SKF_NET_OFF);
+	NET_PacketFilterInsn(&len, BPF_ALU | BPF_RSH | BPF_K, 0, 0, 4);
+	NET_PacketFilterInsn(&len, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 4);
+	NET_PacketFilterInsn(&len, BPF_JMP | BPF_JA, 0, 0, 1);
+	jump6 = len;
+	NET_PacketFilterInsn(&len, BPF_JMP | BPF_JA, 0, 0, 0);
+
+	NET_PacketFilterInsn(&len, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 12);
+	for(i = 0; i < count && len + 2 < BPF_MAXINSNS - NET_PACKETFILTER_FIXED; i++)
+	{
+		if(bans[i].type != NA_IP)
+			continue;
+
+		memcpy(&word, bans[i].ip, sizeof(word));
+		NET_PacketFilterInsn(&len, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, ntohl(word));
+		NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, 0);
+		numbans++;
+	}
+
+	//The masking destroys the address, X keeps a copy of it
+	if(rangecount > 0)
+		NET_PacketFilterInsn(&len, BPF_MISC | BPF_TAX, 0, 0, 0);
+
+	for(i = 0; i < rangecount && len + 4 < BPF_MAXINSNS - NET_PACKETFILTER_FIXED; i++)
+	{
+		if(ranges[i].type != NA_IP || rangebits[i] < 1 || rangebits[i] > 32)
+			continue;
+
+		mask = rangebits[i] == 32 ? 0xffffffff : ~(0xffffffff >> rangebits[i]);
+		memcpy(&word, ranges[i].ip, sizeof(word));
+		NET_PacketFilterInsn(&len, BPF_MISC | BPF_TXA, 0, 0, 0);
+		NET_PacketFilterInsn(&len, BPF_ALU | BPF_AND | BPF_K, 0, 0, mask);
+		NET_PacketFilterInsn(&len, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, ntohl(word) & mask);
+		NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, 0);
+		numbans++;
+	}
+	jumpverbs = len;
+	NET_PacketFilterInsn(&len, BPF_JMP | BPF_JA, 0, 0, 0);
+	net_packetFilterProg[jump6].k = len - jump6 - 1;
+
+	//The source address of IPv6 is at SKF_NET_OFF + 8
+	for(i = 0; i < count && len + 9 < BPF_MAXINSNS - NET_PACKETFILTER_FIXED; i++)
+	{
+		if(bans[i].type != NA_IP6)
+			continue;
+
+		for(j = 0; j < 4; j++)
+		{
+			memcpy(&word, &bans[i].ip6[4*j], sizeof(word));
+			NET_PacketFilterInsn(&len, BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_NET_OFF + 8 + 4*j);
+			NET_PacketFilterInsn(&len, BPF_JMP | BPF_JEQ | BPF_K, 0, 7 - 2*j, ntohl(word));
+		}
+		NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, 0);
+		numbans++;
+	}
+	net_packetFilterProg[jumpverbs].k = len - jumpverbs - 1;
+
+	for(i = 0, j = 0; i < count; i++)
+	{
+		if(bans[i].type == NA_IP || bans[i].type == NA_IP6)
+			j++;
+	}
+	for(i = 0; i < rangecount; i++)
+	{
+		if(ranges[i].type == NA_IP && rangebits[i] >= 1 && rangebits[i] <= 32)
+			j++;
+	}
+	if(numbans < j)
+		Com_PrintWarning("NET_BuildPacketFilter: %d of %d banned addresses do not fit into the program\n", j - numbans, j);
+
+	//Game packets are left to Netchan_Process()
+	NET_PacketFilterInsn(&len, BPF_LD | BPF_W | BPF_ABS, 0, 0, NET_PACKETFILTER_UDPHDR);
+	NET_PacketFilterInsn(&len, BPF_JMP | BPF_JEQ | BPF_K, 1, 0, 0xffffffff);
+	NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, NET_PACKETFILTER_ACCEPT);
+
+	//PunkBuster is case sensitive
+	NET_PacketFilterInsn(&len, BPF_LD | BPF_W | BPF_ABS, 0, 0, NET_PACKETFILTER_UDPHDR + 4);
+	NET_PacketFilterInsn(&len, BPF_ALU | BPF_AND | BPF_K, 0, 0, 0xffffff00);
+	NET_PacketFilterInsn(&len, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0x50425f00);	// "PB_"
+	NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, NET_PACKETFILTER_ACCEPT);
+
+	//Setting bit 5 turns upper case letters into lower case and nothing else into letters
+	NET_PacketFilterInsn(&len, BPF_LD | BPF_W | BPF_ABS, 0, 0, NET_PACKETFILTER_UDPHDR + 4);
+	NET_PacketFilterInsn(&len, BPF_ALU | BPF_OR | BPF_K, 0, 0, 0x20202020);
+	for(i = 0; i < numverbs; i++)
+		NET_PacketFilterInsn(&len, BPF_JMP | BPF_JEQ | BPF_K, numverbs - i, 0, net_packetFilterVerbs[i]);
+
+	NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, 0);
+	NET_PacketFilterInsn(&len, BPF_RET | BPF_K, 0, 0, NET_PACKETFILTER_ACCEPT);
+
+	net_packetFilterLen = len;
+}
+
+static void NET_AttachPacketFilterSocket( SOCKET sock )
+{
+	struct sock_fprog prog;
+
+	prog.len = net_packetFilterLen;
+	prog.filter = net_packetFilterProg;
+
+	if(setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == SOCKET_ERROR)
+		Com_PrintWarning("NET_AttachPacketFilter: setsockopt: %s\n", NET_ErrorString());
+}
+
+#endif
+
+/*
+====================
+NET_AttachPacketFilter
+
+Puts the current program onto all UDP sockets, replaces the one they had
+====================
+*/
+static void NET_AttachPacketFilter( void )
+{
+#ifdef NET_HAVE_PACKETFILTER
+	int i;
+
+	if(!net_packetFilter->boolean)
+		return;
+
+	if(net_packetFilterLen == 0)
+		NET_BuildPacketFilter(NULL, 0, NULL, NULL, 0);
+
+	for(i = 0; i < MAX_IPS; i++)
+	{
+		if(ip_socket[i].sock == INVALID_SOCKET)
+			break;
+
+		NET_AttachPacketFilterSocket(ip_socket[i].sock);
+	}
+
+#ifdef NET_HAVE_QUERYTHREAD
+	for(i = 0; i < MAX_IPS && net_querySocketCount > 0; i++)
+	{
+		if(net_querySockets[i] != INVALID_SOCKET)
+			NET_AttachPacketFilterSocket(net_querySockets[i]);
+	}
+#endif
+	net_packetFilterAttached = qtrue;
+#endif
+}
+
+/*
+====================
+NET_SetPacketFilterBans
+
+Datagrams from these addresses and from the NA_IP netranges with rangebits[i] leading bits
+get dropped by the kernel. Only NA_IP and NA_IP6 are used for the addresses, what does not
+fit into the program is still up to the server
+====================
+*/
+void NET_SetPacketFilterBans( const netadr_t *bans, int count, const netadr_t *ranges, const int *rangebits, int rangecount )
+{
+#ifdef NET_HAVE_PACKETFILTER
+	NET_BuildPacketFilter(bans, count, ranges, rangebits, rangecount);
+
+	if(net_packetFilterAttached)
+		NET_AttachPacketFilter();
+#endif
+}
+
+/*
+====================
+NET_CloseQuerySockets
+
+Stops the query thread, has to happen before the sockets of the server get closed
+====================
+*/
+static void NET_CloseQuerySockets( void )
+{
+#ifdef NET_HAVE_QUERYTHREAD
+	int i;
+
+	if(net_queryThreadRunning)
+	{
+		net_queryThreadQuit = qtrue;
+		pthread_join(net_queryThreadHandle, NULL);
+		net_queryThreadRunning = qfalse;
+	}
+
+	//The array is not initialized before the first NET_OpenQuerySockets()
+	if(net_querySocketCount == 0)
+		return;
+
+	for(i = 0; i < MAX_IPS; i++)
+	{
+		if(net_querySockets[i] != INVALID_SOCKET)
+			closesocket(net_querySockets[i]);
+
+		net_querySockets[i] = INVALID_SOCKET;
+	}
+	net_querySocketCount = 0;
+#endif
+}
+
+/*
+====================
+NET_OpenQuerySockets
+
+Has to be called after NET_OpenIP(). Every UDP socket gets a twin and the steering program
+====================
+*/
+static void NET_OpenQuerySockets( void )
+{
+#ifdef NET_HAVE_QUERYTHREAD
+	//Returns the index of the socket in the group, the ones of NET_OpenIP() come first
+	static struct sock_filter steer[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0xffffffff, 0, 12),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x67657473, 0, 4),	// "gets"
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x74617475, 0, 8),	// "tatu"
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 12),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 's', 5, 6),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x67657469, 0, 5),	// "geti"
+		BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 8),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x6e66, 0, 3),		// "nf"
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 10),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 'o', 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0)
+	};
+	struct sock_fprog prog;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	ioctlarg_t _true = 1;
+	SOCKET sock;
+	int i, one = 1, v6only;
+	socklen_t optlen;
+
+	for(i = 0; i < MAX_IPS; i++)
+		net_querySockets[i] = INVALID_SOCKET;
+
+	net_querySocketCount = 0;
+
+	if(!net_queryThread->boolean)
+		return;
+
+	prog.len = sizeof(steer) / sizeof(steer[0]);
+	prog.filter = steer;
+
+	for(i = 0; i < numIP; i++)
+	{
+		if(ip_socket[i].sock == INVALID_SOCKET)
+			break;
+
+		addrlen = sizeof(addr);
+		if(getsockname(ip_socket[i].sock, (struct sockaddr *) &addr, &addrlen) == SOCKET_ERROR)
+			continue;
+
+		if(addr.ss_family != AF_INET && addr.ss_family != AF_INET6)
+			continue;
+
+		//The twin of the dual-stack socket has to take IPv4 as well
+		v6only = 1;
+		optlen = sizeof(v6only);
+		if(addr.ss_family == AF_INET6)
+			getsockopt(ip_socket[i].sock, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &v6only, &optlen);
+
+		sock = socket(addr.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+		if(sock == INVALID_SOCKET)
+			continue;
+
+		if(ioctlsocket(sock, FIONBIO, &_true) == SOCKET_ERROR ||
+			setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *) &one, sizeof(one)) == SOCKET_ERROR ||
+			(addr.ss_family == AF_INET6 && setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &v6only, sizeof(v6only)) == SOCKET_ERROR) ||
+			bind(sock, (struct sockaddr *) &addr, addrlen) == SOCKET_ERROR ||
+			setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) == SOCKET_ERROR)
+		{
+			Com_PrintWarning("NET_OpenQuerySockets: No query socket for %s: %s\n", NET_AdrToString(&ip_socket[i]), NET_ErrorString());
+			closesocket(sock);
+			continue;
+		}
+		net_querySockets[i] = sock;
+		net_querySocketCount++;
+	}
+
+	if(net_querySocketCount == 0)
+		return;
+
+	net_queryThreadQuit = qfalse;
+	if(pthread_create(&net_queryThreadHandle, NULL, NET_QueryThread, NULL) != 0)
+	{
+		//Nobody would read what gets steered to the twins
+		Com_PrintWarning("NET_OpenQuerySockets: Can not create the query thread\n");
+		NET_CloseQuerySockets();
+		return;
+	}
+	net_queryThreadRunning = qtrue;
+	Com_Printf("Query thread answers getstatus and getinfo on %d sockets\n", net_querySocketCount);
+#endif
+}
+
+/*
+====================
+NET_QueryThreadActive
+
+qtrue if getstatus and getinfo arrive on the query thread instead of NET_Event()
+====================
+*/
+qboolean NET_QueryThreadActive( void )
+{
+#ifdef NET_HAVE_QUERYTHREAD
+	return net_queryThreadRunning;
+#else
+	return qfalse;
+#endif
+}
+
+/*
+====================
+NET_QuerySendPacket
+
+Sys_SendPacket() for the query thread, goes out right away and never through the packet queue
+====================
+*/
+qboolean NET_QuerySendPacket( int length, const void *data, netadr_t *to )
+{
+	struct sockaddr_storage	addr;
+	int ret;
+
+	if( (to->type != NA_IP && to->type != NA_IP6) || to->sock == INVALID_SOCKET || to->sock == 0 )
+		return qfalse;
+
+	memset(&addr, 0, sizeof(addr));
+	NetadrToSockadr( to, (struct sockaddr *) &addr );
+
+	ret = sendto( to->sock, data, length, 0, (struct sockaddr *) &addr, addr.ss_family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6) );
+
+	return ret != SOCKET_ERROR;
+}
+
+//===================================================================
+
+
+/*
+====================
+NET_GetCvars
+====================
+*/
+static qboolean NET_GetCvars( void ) {
+	static char* eventBackendEnum[] = {"select", "epoll", NULL};
+	int modified;
+
+#ifdef DEDICATED
+	// I want server owners to explicitly turn on ipv6 support.
+	net_enabled = Cvar_RegisterInt( "net_enabled", 3, 0, 8, CVAR_LATCH | CVAR_ARCHIVE, "Enables / Disables Network" );
+#else
+	/* End users have it enabled so they can connect to ipv6-only hosts, but ipv4 will be
+	 * used if available due to ping */
+	net_enabled = Cvar_RegisterInt( "net_enabled", 1, 0, 8, CVAR_LATCH | CVAR_ARCHIVE, "Enables / Disables Network");
+#endif
+	modified = net_enabled->modified;
+	net_enabled->modified = qfalse;
+
+	net_ip = Cvar_RegisterString( "net_ip", "0.0.0.0", CVAR_LATCH, "Default Network Address" );
+	modified += net_ip->modified;
+	net_ip->modified = qfalse;
+	
+	net_ip6 = Cvar_RegisterString( "net_ip6", "::", CVAR_LATCH , "Default IPv6 Network Address");
+	modified += net_ip6->modified;
+	net_ip6->modified = qfalse;
+	
+	net_port = Cvar_RegisterInt( "net_port", 0, 0, 65535, CVAR_LATCH, "Network Port Server will listen on");
+	modified += net_port->modified;
+	net_port->modified = qfalse;
+	
+	net_port6 = Cvar_RegisterInt( "net_port6", 0, 0, 65535, CVAR_LATCH, "IPv6 Network Port Server will listen on" );
+	modified += net_port6->modified;
+	net_port6->modified = qfalse;
+
+	// Some cvars for configuring multicast options which facilitates scanning for servers on local subnets.
+	net_mcast6addr = Cvar_RegisterString( "net_mcast6addr", NET_MULTICAST_IP6, CVAR_LATCH | CVAR_ARCHIVE,  "IPv6 Network multicast address");
+	modified += net_mcast6addr->modified;
+	net_mcast6addr->modified = qfalse;
+
+#ifdef _WIN32
+	net_mcast6iface = Cvar_RegisterInt( "net_mcast6iface", 0, 0, 65535, CVAR_LATCH | CVAR_ARCHIVE ,  "IPv6 Network multicast interface");
+#else
+	net_mcast6iface = Cvar_RegisterString( "net_mcast6iface", "", CVAR_LATCH | CVAR_ARCHIVE ,  "IPv6 Network multicast interface");
+#endif
+	modified += net_mcast6iface->modified;
+	net_mcast6iface->modified = qfalse;
+
+	net_socksEnabled = Cvar_RegisterInt( "net_socksEnabled", 0, 0, 1, CVAR_LATCH | CVAR_ARCHIVE, "Net enable socks proxy support");
+	modified += net_socksEnabled->modified;
+	net_socksEnabled->modified = qfalse;
+
+	net_socksServer = Cvar_RegisterString( "net_socksServer", "", CVAR_LATCH | CVAR_ARCHIVE, "Net socks proxyserver address");
+	modified += net_socksServer->modified;
+	net_socksServer->modified = qfalse;
+
+	net_socksPort = Cvar_RegisterInt( "net_socksPort", 1080, 0, 65535, CVAR_LATCH | CVAR_ARCHIVE, "Net socks proxyserver port");
+	modified += net_socksPort->modified;
+	net_socksPort->modified = qfalse;
+
+	net_socksUsername = Cvar_RegisterString( "net_socksUsername", "", CVAR_LATCH | CVAR_ARCHIVE , "Net socks proxyserver username");
+	modified += net_socksUsername->modified;
+	net_socksUsername->modified = qfalse;
+
+	net_socksPassword = Cvar_RegisterString( "net_socksPassword", "", CVAR_LATCH | CVAR_ARCHIVE , "Net socks proxyserver password");
+	modified += net_socksPassword->modified;
+	net_socksPassword->modified = qfalse;
+
+	net_dropsim = Cvar_RegisterInt("net_dropsim", 0,0,100, CVAR_TEMP, "Net enable packetloss simulation");
+
+#ifdef NET_HAVE_EPOLL
+	net_eventBackend = Cvar_RegisterEnum("net_eventBackend", eventBackendEnum, NET_EVENTBACKEND_EPOLL, CVAR_LATCH | CVAR_ARCHIVE, "Mechanism used to wait for network events");
+#else
+	net_eventBackend = Cvar_RegisterEnum("net_eventBackend", eventBackendEnum, NET_EVENTBACKEND_SELECT, CVAR_LATCH | CVAR_ARCHIVE, "Mechanism used to wait for network events");
+#endif
+	modified += net_eventBackend->modified;
+	net_eventBackend->modified = qfalse;
+
+#ifdef NET_HAVE_MMSG
+	net_udpBatch = Cvar_RegisterInt("net_udpBatch", 32, 0, NET_UDPBATCH_MAX, CVAR_ARCHIVE, "Maximum number of UDP datagrams received or sent with one syscall. 0 disables batching");
+#endif
+	net_framePacing = Cvar_RegisterInt("net_framePacing", 0, 0, 5000, CVAR_ARCHIVE, "Microseconds before a server frame where NET_Sleep stops sleeping and busy-polls the sockets. 0 disables frame pacing");
+
+	net_dualStack = Cvar_RegisterBool("net_dualStack", qfalse, CVAR_LATCH | CVAR_ARCHIVE, "Serve IPv4 and IPv6 with one UDP socket on [::] if both are enabled on all addresses and the same port. Replies leave with the address the routing table picks");
+	modified += net_dualStack->modified;
+	net_dualStack->modified = qfalse;
+
+#ifdef NET_HAVE_QUERYTHREAD
+	net_queryThread = Cvar_RegisterBool("net_queryThread", qfalse, CVAR_LATCH | CVAR_ARCHIVE, "Answer getstatus and getinfo on a separate thread and socket. Every server on this host needs its own net_port then");
+	modified += net_queryThread->modified;
+	net_queryThread->modified = qfalse;
+#endif
+
+#ifdef NET_HAVE_PACKETFILTER
+	net_packetFilter = Cvar_RegisterBool("net_packetFilter", qfalse, CVAR_LATCH | CVAR_ARCHIVE, "Let the kernel drop malformed packets, unknown connectionless commands and everything from IP banned addresses, rcon included");
+	modified += net_packetFilter->modified;
+	net_packetFilter->modified = qfalse;
+#endif
+
+	return modified ? qtrue : qfalse;
+}
+
+
+/*
+====================
+NET_Config
+====================
+*/
+void NET_Config( qboolean enableNetworking ) {
+	qboolean	modified;
+	qboolean	stop;
+	qboolean	start;
+	int		i;
+
+	// get any latched changes to cvars
+	modified = NET_GetCvars();
+
+	if( !net_enabled->integer ) {
+		enableNetworking = 0;
+	}
+
+	// if enable state is the same and no cvars were modified, we have nothing to do
+	if( enableNetworking == networkingEnabled && !modified ) {
+		return;
+	}
+
+	if( enableNetworking == networkingEnabled ) {
+		if( enableNetworking ) {
+			stop = qtrue;
+			start = qtrue;
+		}
+		else {
+			stop = qfalse;
+			start = qfalse;
+		}
+	}
+	else {
+		if( enableNetworking ) {
+			stop = qfalse;
+			start = qtrue;
+		}
+		else {
+			stop = qtrue;
+			start = qfalse;
+		}
+		networkingEnabled = enableNetworking;
+	}
+
+	if( stop ) {
+
+		tcpConnections_t *con;
+
+		NET_CloseQuerySockets();
+#ifdef NET_HAVE_PACKETFILTER
+		net_packetFilterAttached = qfalse;
+#endif
 
-	if(socketadr != NULL && socketadr->type == NA_IP){
+		for(i = 0, con = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, con++){
+
+			if(con->lastMsgTime > 0 && con->sock != INVALID_SOCKET)
+				NET_TcpCloseSocket(con->sock);
+		}
+
+		for(i = 0; i < numIP; i++){
+
+			if(ip_socket[i].sock != INVALID_SOCKET){
+				closesocket( ip_socket[i].sock );
+				ip_socket[i].sock = INVALID_SOCKET;
+			}
+		}
+		net_dualStackSocket = INVALID_SOCKET;
+
+		if ( tcp_socket != INVALID_SOCKET ) {
+			//closesocket( tcp_socket );
+			shutdown(con->sock, 2);
+			tcp_socket = INVALID_SOCKET;
+		}
+
+/*
+		if(multicast6_socket)
+		{
+			if(multicast6_socket != ip6_socket)
+				closesocket(multicast6_socket);
+				
+			multicast6_socket = INVALID_SOCKET;
+		}
+*/
+		if ( tcp6_socket != INVALID_SOCKET ) {
+			closesocket( tcp6_socket );
+			tcp6_socket = INVALID_SOCKET;
+		}
+
+		if ( socks_socket != INVALID_SOCKET ) {
+			closesocket( socks_socket );
+			socks_socket = INVALID_SOCKET;
+		}
+
+		NET_EventBackendShutdown();
+	}
+
+	if( start )
+	{
+		if (net_enabled->integer)
+		{
+			NET_OpenIP();
+			NET_OpenQuerySockets();
+			NET_AttachPacketFilter();
+			NET_EventBackendInit();
+			//NET_SetMulticast6();
+		}
+	}
+}
+
+//Dumb trick to find out which socket is suitable to send data over
+void NET_RegisterDefaultCommunicationSocket(netadr_t *adr){
+
+	netadr_t *socketadr = NET_SockToAdr(adr->sock);
+	netadr_t test;
+
+
+	if(socketadr != NULL && (socketadr->type == NA_IP || socketadr->sock == net_dualStackSocket)){
 		
 		NET_StringToAdr("127.0.0.1", &test, NA_IP);
 
@@ -2086,84 +3256,422 @@ Functions for TCP networking which can be used by client and server
 ===============
 NET_TcpCloseSocket
 
-This function should be able to close all types of open TCP sockets
-===============
+This function should be able to close all types of open TCP sockets
+===============
+*/
+
+void NET_TcpCloseSocket(int socket)
+{
+        int i;
+	tcpConnections_t	*conn;
+
+	if(socket == INVALID_SOCKET)
+		return;
+
+	//Close the socket
+	closesocket(socket);
+
+	//See if this was a serversocket and clear all references to it
+	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
+	{
+		if(conn->sock == socket)
+		{
+			NET_TcpClearSendQueue(conn);
+			conn->lastMsgTime = 0;
+			//Closing the descriptor removes it from the epoll set as well
+			if(net_activeBackend == NET_EVENTBACKEND_SELECT)
+				FD_CLR(conn->sock, &tcpServer.fdr);
+			if(conn->state >= TCP_AUTHSUCCESSFULL)
+			{
+				tcpServer.activeConnectionCount--;
+				NET_TCPConnectionClosed(&conn->remote, conn->sock, conn->connectionId, conn->serviceId);
+			}
+			conn->state = 0;
+
+			conn->sock = INVALID_SOCKET;
+			return;
+		}
+	}
+}
+
+/*
+==================
+NET_TcpAllocSendBuffer
+
+Copies the data into a reference counted buffer which can be handed to
+NET_TcpSendBuffer() for as many sockets as needed.
+The caller owns one reference and has to drop it with NET_TcpReleaseSendBuffer()
+==================
+*/
+
+netTcpSendBuffer_t* NET_TcpAllocSendBuffer( const void *data, int length ) {
+
+	netTcpSendBuffer_t *buf;
+
+	buf = malloc(sizeof(netTcpSendBuffer_t) + length);
+	if(buf == NULL)
+		return NULL;
+
+	buf->refcount = 1;
+	buf->length = length;
+	Com_Memcpy(buf->data, data, length);
+	return buf;
+}
+
+void NET_TcpReleaseSendBuffer( netTcpSendBuffer_t *buf ) {
+
+	if(buf == NULL)
+		return;
+
+	buf->refcount--;
+	if(buf->refcount <= 0)
+		free(buf);
+}
+
+static void NET_TcpClearSendQueue( tcpConnections_t *conn ) {
+
+	while(conn->sendqueuecount > 0)
+	{
+		NET_TcpReleaseSendBuffer(conn->sendqueue[conn->sendqueuehead].buf);
+		conn->sendqueuehead = (conn->sendqueuehead + 1) % NET_TCPSENDQUEUE_ENTRIES;
+		conn->sendqueuecount--;
+	}
+	conn->sendqueuehead = 0;
+	conn->sendqueuebytes = 0;
+	conn->wantwrite = qfalse; //Closing the descriptor removes it from the epoll set
+}
+
+static tcpConnections_t* NET_TcpServerConnectionForSocket( int sock ) {
+
+	int i;
+	tcpConnections_t *conn;
+
+	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
+	{
+		if(conn->sock == sock && conn->lastMsgTime)
+			return conn;
+	}
+	return NULL;
+}
+
+/*
+==================
+NET_TcpTrySend
+
+Non blocking send. Returns the number of bytes the kernel took or -1 after the socket got closed
+==================
+*/
+
+int NET_TcpTrySend( int sock, const void *data, int length ) {
+
+	int state, err;
+
+	state = send( sock, data, length, MSG_NOSIGNAL | MSG_MORE); // FIX: flag NOSIGNAL prevents SIGPIPE in case of connection problems
+
+	if(state != SOCKET_ERROR)
+		return state;
+
+	err = socketError;
+	if(err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
+		return 0;
+
+	Com_PrintWarningNoRedirect ("NET_SendTCPPacket: Couldn't send data to remote host: %s\n", NET_ErrorString());
+	NET_TcpCloseSocket(sock);
+	return -1;
+}
+
+/*
+==================
+NET_TcpFlushSendQueue
+
+Writes as much of the queued output as the kernel takes.
+Return -1 if an fatal error happened on this socket otherwise 0
+==================
+*/
+
+static int NET_TcpFlushSendQueue( tcpConnections_t *conn ) {
+
+	int i, ret, err, remaining;
+	tcpSendQueueEntry_t *entry;
+#ifndef _WIN32
+	struct iovec iov[NET_TCPSENDQUEUE_ENTRIES];
+	struct msghdr mh;
+#endif
+
+	while(conn->sendqueuecount > 0)
+	{
+#ifndef _WIN32
+		for(i = 0; i < conn->sendqueuecount; i++)
+		{
+			entry = &conn->sendqueue[(conn->sendqueuehead + i) % NET_TCPSENDQUEUE_ENTRIES];
+			iov[i].iov_base = entry->buf->data + entry->offset;
+			iov[i].iov_len = entry->buf->length - entry->offset;
+		}
+
+		memset(&mh, 0, sizeof(mh));
+		mh.msg_iov = iov;
+		mh.msg_iovlen = conn->sendqueuecount;
+
+		ret = sendmsg(conn->sock, &mh, MSG_NOSIGNAL);
+#else
+		entry = &conn->sendqueue[conn->sendqueuehead];
+		ret = send(conn->sock, entry->buf->data + entry->offset, entry->buf->length - entry->offset, 0);
+#endif
+		if(ret == SOCKET_ERROR)
+		{
+			err = socketError;
+			if(err == EINTR)
+				continue;
+
+			if(err == EAGAIN || err == EWOULDBLOCK)
+				break;
+
+			Com_PrintWarningNoRedirect ("NET_SendTCPPacket: Couldn't send data to remote host: %s\n", NET_ErrorString());
+			NET_TcpCloseSocket(conn->sock);
+			return -1;
+		}
+
+		if(ret == 0)
+			break;
+
+		conn->sendqueuebytes -= ret;
+
+		//Drop what got written
+		while(ret > 0)
+		{
+			entry = &conn->sendqueue[conn->sendqueuehead];
+			remaining = entry->buf->length - entry->offset;
+
+			if(ret < remaining)
+			{
+				entry->offset += ret;
+				break;
+			}
+			ret -= remaining;
+			NET_TcpReleaseSendBuffer(entry->buf);
+			conn->sendqueuehead = (conn->sendqueuehead + 1) % NET_TCPSENDQUEUE_ENTRIES;
+			conn->sendqueuecount--;
+		}
+	}
+
+#ifdef NET_HAVE_EPOLL
+	NET_EpollSetWantWrite(conn, conn->sendqueuecount > 0);
+#endif
+	return 0;
+}
+
+static int NET_TcpQueueSendBuffer( tcpConnections_t *conn, netTcpSendBuffer_t *buf, int offset ) {
+
+	tcpSendQueueEntry_t *entry;
+
+	if(conn->sendqueuecount >= NET_TCPSENDQUEUE_ENTRIES || conn->sendqueuebytes + buf->length - offset > NET_TCPSENDQUEUE_MAXBYTES)
+	{
+		//The remote host does not read what we send
+		Com_PrintNoRedirect("NET_TcpSendData: Command overflow\n");
+		NET_TcpCloseSocket(conn->sock);
+		return -1;
+	}
+
+	entry = &conn->sendqueue[(conn->sendqueuehead + conn->sendqueuecount) % NET_TCPSENDQUEUE_ENTRIES];
+	entry->buf = buf;
+	entry->offset = offset;
+	buf->refcount++;
+
+	conn->sendqueuecount++;
+	conn->sendqueuebytes += buf->length - offset;
+
+#ifdef NET_HAVE_EPOLL
+	NET_EpollSetWantWrite(conn, qtrue);
+#endif
+	return 0;
+}
+
+/*
+==================
+NET_TcpSendBuffer
+Only for Stream sockets (TCP)
+Sends a buffer from NET_TcpAllocSendBuffer(). Whatever does not fit into the kernel
+buffer gets queued without copying the data.
+Return -1 if an fatal error happened on this socket otherwise 0
+==================
+*/
+
+int NET_TcpSendBuffer( int sock, netTcpSendBuffer_t *buf ) {
+
+	tcpConnections_t *conn;
+	int sent = 0;
+
+	if(sock < 1 || buf == NULL)
+		return -1;
+
+	conn = NET_TcpServerConnectionForSocket(sock);
+	if(conn == NULL)
+		return NET_TcpSendData(sock, buf->data, buf->length);
+
+	if(conn->sendqueuecount == 0)
+	{
+		sent = NET_TcpTrySend(sock, buf->data, buf->length);
+		if(sent < 0)
+			return -1;
+
+		if(sent >= buf->length)
+			return 0;
+	}
+	return NET_TcpQueueSendBuffer(conn, buf, sent);
+}
+
+/*
+==================
+NET_TcpSendData
+Only for Stream sockets (TCP)
+Return -1 if an fatal error happened on this socket otherwise 0
+==================
+*/
+
+int NET_TcpSendData( int sock, const void *data, int length ) {
+
+	int state, ret;
+	tcpConnections_t *conn;
+	netTcpSendBuffer_t *buf;
+
+	if(sock < 1)
+		return -1;
+
+	conn = NET_TcpServerConnectionForSocket(sock);
+
+	if(conn == NULL)
+	{
+		//Outgoing connection (plugins) - no queue for these
+		do
+		{
+			state = NET_TcpTrySend(sock, data, length);
+
+			if(state < 0)
+				return -1;
+
+			if(state == 0)
+			{
+				Com_PrintNoRedirect("NET_TcpSendData: Command overflow\n");
+				NET_TcpCloseSocket(sock);
+				return -1;
+			}
+
+			length -= state;
+			data += state;
+
+		}while( length > 0);
+
+		return 0;
+	}
+
+	if(conn->sendqueuecount == 0)
+	{
+		state = NET_TcpTrySend(sock, data, length);
+
+		if(state < 0)
+			return -1;
+
+		if(state >= length)
+			return 0;
+
+		length -= state;
+		data += state;
+	}
+
+	buf = NET_TcpAllocSendBuffer(data, length);
+	if(buf == NULL)
+	{
+		NET_TcpCloseSocket(sock);
+		return -1;
+	}
+	ret = NET_TcpQueueSendBuffer(conn, buf, 0);
+	NET_TcpReleaseSendBuffer(buf);
+	return ret;
+}
+
+/*
+==================
+NET_TcpFlushPending
+Only for Stream sockets (TCP)
+Tries to write out what is still queued for this socket.
+Returns the number of bytes which are still waiting or -1 if the socket got closed
+==================
 */
 
-void NET_TcpCloseSocket(int socket)
-{
-        int i;
-	tcpConnections_t	*conn;
+int NET_TcpFlushPending( int sock ) {
 
-	if(socket == INVALID_SOCKET)
-		return;
+	tcpConnections_t *conn;
 
-	//Close the socket
-	closesocket(socket);
+	if(sock < 1)
+		return -1;
 
-	//See if this was a serversocket and clear all references to it
-	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
-	{
-		if(conn->sock == socket)
-		{
-			conn->lastMsgTime = 0;
-			FD_CLR(conn->sock, &tcpServer.fdr);
-			conn->state = 0;
+	conn = NET_TcpServerConnectionForSocket(sock);
+	if(conn == NULL)
+		return 0;
 
-			if(conn->state >= TCP_AUTHSUCCESSFULL)
-			{
-				tcpServer.activeConnectionCount--;
-				NET_TCPConnectionClosed(&conn->remote, conn->sock, conn->connectionId, conn->serviceId);
-			}
+	if(conn->sendqueuecount > 0 && NET_TcpFlushSendQueue(conn) < 0)
+		return -1;
 
-			conn->sock = INVALID_SOCKET;
-			return;
-		}
-	}
+	return conn->sendqueuebytes;
 }
 
 /*
 ==================
-NET_TcpSendData
+NET_TcpSendFile
 Only for Stream sockets (TCP)
-Return -1 if an fatal error happened on this socket otherwise 0
+Sends up to count bytes of the file fd starting at *offset without copying them
+through userspace and advances *offset. Data queued with NET_TcpSendData() has to
+be flushed first (NET_TcpFlushPending()) or it gets overtaken.
+Returns the number of bytes sent, 0 if the socket is full or -1 if the socket got closed
 ==================
 */
 
-int NET_TcpSendData( int sock, const void *data, int length ) {
+int NET_TcpSendFile( int sock, int fd, int *offset, int count ) {
 
-	int state, err;
+	int ret;
+#ifndef NET_HAVE_SENDFILE
+	byte buf[16384];
 
-	if(sock < 1)
+	if(sock < 1 || count <= 0)
 		return -1;
 
-	do
+	if(count > sizeof(buf))
+		count = sizeof(buf);
+
+	//No sendfile() here, bounce it through a small buffer
+	if(lseek(fd, *offset, SEEK_SET) != *offset || (count = read(fd, buf, count)) <= 0)
 	{
-		state = send( sock, data, length, MSG_NOSIGNAL | MSG_MORE); // FIX: flag NOSIGNAL prevents SIGPIPE in case of connection problems
+		NET_TcpCloseSocket(sock);
+		return -1;
+	}
 
-		if(state == SOCKET_ERROR)
-		{
-			err = SOCKET_ERROR;
+	ret = NET_TcpTrySend(sock, buf, count);
+	if(ret > 0)
+		*offset += ret;
+	return ret;
+#else
+	int err;
+	off_t off;
 
-			if( err == EAGAIN )
-			{
-				Com_PrintNoRedirect("NET_TcpSendData: Command overflow\n");
-			}else{
-				Com_PrintWarningNoRedirect ("NET_SendTCPPacket: Couldn't send data to remote host: %s\n", NET_ErrorString());
-			}
-			NET_TcpCloseSocket(sock);
-			return -1;
-		}
+	if(sock < 1 || count <= 0)
+		return -1;
 
-		length -= state;
-		data += state;
+	off = *offset;
+	ret = sendfile(sock, fd, &off, count);
 
-		if(state == 0)
+	if(ret == SOCKET_ERROR)
+	{
+		err = socketError;
+		if(err == EAGAIN || err == EWOULDBLOCK || err == EINTR)
 			return 0;
 
-	}while( length > 0);
-
-	return 0;
+		Com_PrintWarningNoRedirect ("NET_TcpSendFile: Couldn't send data to remote host: %s\n", NET_ErrorString());
+		NET_TcpCloseSocket(sock);
+		return -1;
+	}
+	*offset = off;
+	return ret;
+#endif
 }
 
 /*========================================================================================================
@@ -2226,6 +3734,147 @@ int NET_TcpServerGetPacket(tcpConnections_t *conn, void *netmsg, int maxsize, qb
 }
 
 
+/*
+==================
+NET_TcpServerConnectionEvent
+Only for Stream sockets (TCP)
+Data is waiting on this connection. Read it and call executing functions
+==================
+*/
+
+static void NET_TcpServerConnectionEvent(tcpConnections_t *conn, byte *bufData, int bufsize){
+
+	int ret;
+	int cursize;
+
+	switch(conn->state)
+	{
+	case TCP_AUTHWAIT:
+	case TCP_AUTHAGAIN:
+
+		cursize = 0;
+
+		while( cursize < 2048 )
+		{
+			ret = NET_TcpServerGetPacket(conn, bufData + cursize, bufsize - cursize, qfalse);
+
+			if(ret < 1)
+				break;
+			else
+				cursize += ret;
+		}
+
+		if(conn->lastMsgTime == 0 || conn->sock < 1)
+		{
+			break; //Connection closed unexpected
+		//Close connection, we don't want to process huge messages as auth-packet or want to quit if the login was bad
+		}else if(cursize > 2048 || (conn->state = NET_TCPAuthPacketEvent(&conn->remote, bufData, cursize, conn->sock, &conn->connectionId, &conn->serviceId)) == TCP_AUTHBAD){
+			NET_TcpCloseSocket(conn->sock);
+
+		}else if(conn->state == TCP_AUTHSUCCESSFULL){
+			tcpServer.activeConnectionCount++;
+			Com_PrintNoRedirect("New connection accepted for: %s from type: %d\n", NET_AdrToString(&conn->remote), conn->serviceId);
+		}
+		break;
+
+	case TCP_AUTHNOTME:
+	case TCP_AUTHBAD:	//Should not happen
+		NET_TcpCloseSocket(conn->sock);
+		break;
+
+	case TCP_AUTHSUCCESSFULL:
+
+		cursize = 0;
+		do{
+			ret = NET_TcpServerGetPacket(conn, bufData + cursize, bufsize - cursize, qtrue);
+			if(ret < 1)
+				break;
+			else
+				cursize += ret;
+
+		}while(cursize < bufsize);
+
+		if(cursize >= bufsize)
+		{
+			Com_PrintWarningNoRedirect( "NET_TcpServerPacketEventLoop: Oversize packet from %s\n", NET_AdrToString (&conn->remote));
+			cursize = bufsize;
+		}
+		NET_TCPPacketEvent(&conn->remote, bufData, cursize, conn->sock, conn->connectionId, conn->serviceId);
+		break;
+	}
+}
+
+
+#ifdef NET_HAVE_EPOLL
+/*
+==================
+NET_TcpServerEpollEventLoop
+Only for Stream sockets (TCP)
+The kernel hands us only connections which have pending data
+==================
+*/
+
+static void NET_TcpServerEpollEventLoop(byte *bufData, int bufsize){
+
+	struct epoll_event events[NET_EPOLL_MAXEVENTS];
+	tcpConnections_t *conn;
+	unsigned int index;
+	unsigned int now;
+	int activefd, i;
+
+	while(qtrue){
+
+		activefd = epoll_wait(net_tcpepollfd, events, NET_EPOLL_MAXEVENTS, 0);
+
+		if(activefd < 0)
+		{
+			if(socketError == EINTR)
+				continue;
+
+			Com_PrintWarningNoRedirect("NET_TcpServerPacketEventLoop: epoll_wait() syscall failed: %s\n", NET_ErrorString());
+			break;
+		}
+
+		for(i = 0; i < activefd; i++)
+		{
+			index = events[i].data.u32 & NET_EPOLLTAG_INDEXMASK;
+
+			if(index >= MAX_TCPCONNECTIONS)
+				continue;
+
+			conn = &tcpServer.connections[index];
+
+			if(conn->lastMsgTime == 0 || conn->sock == INVALID_SOCKET)
+				continue; //Got closed while processing an earlier event
+
+			if((events[i].events & EPOLLOUT) && NET_TcpFlushSendQueue(conn) == -1)
+				continue;
+
+			if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				NET_TcpServerConnectionEvent(conn, bufData, bufsize);
+		}
+
+		if(activefd < NET_EPOLL_MAXEVENTS)
+			break; //No more events
+	}
+
+	//Idle connections don't generate events so look for unauthenticated connections which timed out from time to time
+	now = NET_TimeGetTime();
+
+	if(now - net_lastAuthTimeoutCheck < MIN_TCPAUTHWAITTIME)
+		return;
+
+	net_lastAuthTimeoutCheck = now;
+
+	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
+	{
+		if(conn->lastMsgTime && conn->state < TCP_AUTHSUCCESSFULL && conn->lastMsgTime + MAX_TCPAUTHWAITTIME < now){
+			NET_TcpCloseSocket(conn->sock);
+		}
+	}
+}
+#endif
+
 /*
 ==================
 NET_TcpServerPacketEventLoop
@@ -2240,12 +3889,29 @@ void NET_TcpServerPacketEventLoop(){
 	struct timeval timeout;
 	timeout.tv_sec = 0;
 	timeout.tv_usec = 0;
-	int activefd, i, ret;
-	int cursize;
+	int activefd, i;
 	fd_set fdr;
 	tcpConnections_t	*conn;
 
-	byte bufData[MAX_MSGLEN];
+	byte *bufData;
+
+	bufData = MSG_GetBuffer(MAX_MSGLEN);
+
+#ifdef NET_HAVE_EPOLL
+	if(net_activeBackend == NET_EVENTBACKEND_EPOLL)
+	{
+		NET_TcpServerEpollEventLoop(bufData, MAX_MSGLEN);
+		MSG_FreeBuffer(bufData);
+		return;
+	}
+#endif
+
+	//select() is only asked for readability, just retry the pending output every frame
+	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
+	{
+		if(conn->sendqueuecount > 0 && conn->sock != INVALID_SOCKET)
+			NET_TcpFlushSendQueue(conn);
+	}
 
 	while(qtrue){
 
@@ -2262,64 +3928,9 @@ void NET_TcpServerPacketEventLoop(){
 			for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
 			{
 
-				if(FD_ISSET(conn->sock, &fdr))
+				if(conn->sock != INVALID_SOCKET && FD_ISSET(conn->sock, &fdr))
 				{
-
-					switch(conn->state)
-					{
-					case TCP_AUTHWAIT:
-					case TCP_AUTHAGAIN:
-
-                                                cursize = 0;
-
-                                                while( cursize < 2048 )
-                                                {
-                                                    ret = NET_TcpServerGetPacket(conn, bufData + cursize, sizeof(bufData) - cursize, qfalse);
-
-                                                    if(ret < 1)
-                                                        break;
-                                                    else
-                                                        cursize += ret;
-                                                }
-
-						if(conn->lastMsgTime == 0 || conn->sock < 1)
-						{
-							break; //Connection closed unexpected
-						//Close connection, we don't want to process huge messages as auth-packet or want to quit if the login was bad
-						}else if(cursize > 2048 || (conn->state = NET_TCPAuthPacketEvent(&conn->remote, bufData, cursize, conn->sock, &conn->connectionId, &conn->serviceId)) == TCP_AUTHBAD){
-							NET_TcpCloseSocket(conn->sock);
-
-						}else if(conn->state == TCP_AUTHSUCCESSFULL){
-							tcpServer.activeConnectionCount++;
-							Com_PrintNoRedirect("New connection accepted for: %s from type: %d\n", NET_AdrToString(&conn->remote), conn->serviceId);
-						}
-						break;
-
-					case TCP_AUTHNOTME:
-					case TCP_AUTHBAD:	//Should not happen
-						NET_TcpCloseSocket(conn->sock);
-						break;
-
-					case TCP_AUTHSUCCESSFULL:
-
-						cursize = 0;
-						do{
-                                                        ret = NET_TcpServerGetPacket(conn, bufData + cursize, sizeof(bufData) - cursize, qtrue);
-                                                        if(ret < 1)
-                                                            break;
-                                                        else
-                                                            cursize += ret;
-
-                                                }while(cursize < sizeof(bufData));
-
-						if(cursize >= sizeof(bufData))
-						{
-							Com_PrintWarningNoRedirect( "NET_TcpServerPacketEventLoop: Oversize packet from %s\n", NET_AdrToString (&conn->remote));
-							cursize = sizeof(bufData);
-						}
-						NET_TCPPacketEvent(&conn->remote, bufData, cursize, conn->sock, conn->connectionId, conn->serviceId);
-						break;
-					}
+					NET_TcpServerConnectionEvent(conn, bufData, MAX_MSGLEN);
 
 				}else if(conn->lastMsgTime && conn->state < TCP_AUTHSUCCESSFULL && conn->lastMsgTime + MAX_TCPAUTHWAITTIME < NET_TimeGetTime()){
 					NET_TcpCloseSocket(conn->sock);
@@ -2329,6 +3940,7 @@ void NET_TcpServerPacketEventLoop(){
 			break; //No more events
 		}
 	}
+	MSG_FreeBuffer(bufData);
 }
 
 /*
@@ -2350,6 +3962,13 @@ void NET_TcpServerOpenConnection(netadr_t *from, int newfd){
 	int			oldest = 0;
 	int			i;
 
+	if(net_activeBackend == NET_EVENTBACKEND_SELECT && newfd >= FD_SETSIZE)
+	{
+		closesocket(newfd); //Can not be watched by select()
+		Com_PrintWarning("NET_TcpServerOpenConnection: Socket exceeds FD_SETSIZE, dropping connectrequest from: %s\n", NET_AdrToString(from));
+		return;
+	}
+
 	for(i = 0, conn = tcpServer.connections; i < MAX_TCPCONNECTIONS; i++, conn++)
 	{
 		if((NET_CompareBaseAdr(from, &conn->remote) && conn->state < TCP_AUTHSUCCESSFULL) || conn->sock < 1){//Net request from same address - Close the old not confirmed connection
@@ -2371,9 +3990,7 @@ void NET_TcpServerOpenConnection(netadr_t *from, int newfd){
 	if(i == MAX_TCPCONNECTIONS)
 	{
 		if(tcpServer.activeConnectionCount > MAX_TCPCONNECTIONS / 3 && oldestTimeAccepted + MAX_TCPCONNECTEDTIMEOUT < NET_TimeGetTime()){
-				conn = &tcpServer.connections[oldestAccepted];
-				tcpServer.activeConnectionCount--; //As this connection is going to be closed decrease the counter
-				NET_TCPConnectionClosed(&conn->remote, conn->sock, conn->connectionId, conn->serviceId);
+				conn = &tcpServer.connections[oldestAccepted]; //NET_TcpCloseSocket() below tells the service about it
 
 		}else if(oldestTime + MIN_TCPAUTHWAITTIME < NET_TimeGetTime()){
 				conn = &tcpServer.connections[oldest];
@@ -2402,6 +4019,15 @@ void NET_TcpServerOpenConnection(netadr_t *from, int newfd){
 	conn->serviceId = -1;
 	conn->connectionId = -1;
 
+#ifdef NET_HAVE_EPOLL
+	if(net_activeBackend == NET_EVENTBACKEND_EPOLL)
+	{
+		if(!NET_EpollAdd(net_tcpepollfd, conn->sock, NET_EPOLLTAG_TCPCONN | (conn - tcpServer.connections)))
+			NET_TcpCloseSocket(conn->sock);
+		return;
+	}
+#endif
+
 	FD_SET(conn->sock, &tcpServer.fdr);
 
 	if(tcpServer.highestfd < conn->sock)
@@ -2419,62 +4045,40 @@ Try to accept this request
 */
 
 
-__optimize3 __regparm3 qboolean NET_TcpServerConnectRequest(netadr_t* net_from, int *newfd, fd_set *fdr){
+__optimize3 __regparm3 qboolean NET_TcpServerConnectRequest(netadr_t* net_from, int *newfd, SOCKET listensock){
 
 	*newfd = INVALID_SOCKET;
 	struct sockaddr_storage from;
 	socklen_t	fromlen;
 	int		err;
 
-	if(tcp_socket != INVALID_SOCKET && FD_ISSET(tcp_socket, fdr))
-	{
-		fromlen = sizeof(from);
-
-		*newfd = accept(tcp_socket, (struct sockaddr *) &from, &fromlen);
-		if (*newfd == SOCKET_ERROR)
-		{
-			err = socketError;
+	if(listensock == INVALID_SOCKET)
+		return qfalse;
 
-			if( err != EAGAIN && err != ECONNRESET )
-				Com_PrintWarning( "NET_TcpServerConnectRequest: %s\n", NET_ErrorString() );
+	fromlen = sizeof(from);
 
-			return qfalse;
-		}
-		else
-		{
-			SockadrToNetadr( (struct sockaddr *) &from, net_from, qtrue, 0);
-			return qtrue;
-		}
-	}
-	
-	if(tcp6_socket != INVALID_SOCKET && FD_ISSET(tcp6_socket, fdr))
+	*newfd = accept(listensock, (struct sockaddr *) &from, &fromlen);
+	if (*newfd == SOCKET_ERROR)
 	{
-		fromlen = sizeof(from);
-		*newfd = accept(tcp6_socket, (struct sockaddr *) &from, &fromlen);
-		
-		if (*newfd == SOCKET_ERROR)
-		{
-			err = socketError;
+		err = socketError;
 
-			if( err != EAGAIN && err != ECONNRESET )
-				Com_PrintWarning( "NET_TcpServerConnectRequest: %s\n", NET_ErrorString() );
+		if( err != EAGAIN && err != ECONNRESET )
+			Com_PrintWarning( "NET_TcpServerConnectRequest: %s\n", NET_ErrorString() );
 
-			return qfalse;
-		}
-		else
-		{
-			SockadrToNetadr((struct sockaddr *) &from, net_from, qtrue, 0);
-			return qtrue;
-		}
+		return qfalse;
+	}
+	else
+	{
+		SockadrToNetadr( (struct sockaddr *) &from, net_from, qtrue, 0);
+		return qtrue;
 	}
-	return qfalse;
 }
 
 
 #define MAX_NETPACKETS 666
 
 
-__optimize3 __regparm1 qboolean NET_TcpServerConnectEvent(fd_set *fdr)
+__optimize3 __regparm1 qboolean NET_TcpServerConnectEvent(SOCKET listensock)
 {
 	netadr_t from;
 	int newtcpfd;
@@ -2483,7 +4087,7 @@ __optimize3 __regparm1 qboolean NET_TcpServerConnectEvent(fd_set *fdr)
 	//Give the system a possibility to abort processing network packets so it won't block execution of frames if the network getting flooded
 	for(i = 0; i < MAX_NETPACKETS; i++)
 	{
-		if(NET_TcpServerConnectRequest(&from, &newtcpfd, fdr)){
+		if(NET_TcpServerConnectRequest(&from, &newtcpfd, listensock)){
 
 			NET_TcpServerOpenConnection(&from, newtcpfd);
 
@@ -2560,79 +4164,140 @@ int NET_TcpClientGetData(int sock, void* buf, const int buflen){
 
 /*
 ====================
-NET_TcpClientConnect
+NET_TcpClientConnectStart
+
+Begins a connect which gets finished by NET_TcpClientConnectPoll.
+Neither of them blocks, the name lookup happens on a worker thread.
 ====================
 */
-int NET_TcpClientConnect( const char *remoteAdr ) {
-	SOCKET			newsocket;
-	struct sockaddr_in	address;
-	netadr_t remoteadr;
-	int err = 0;
-	int retval;
-	fd_set fdr;
-	struct timeval timeout;
+#define NET_TCPCONNECT_TIMEOUT 5000
+
+void NET_TcpClientConnectStart( netTcpClientConnect_t *conn, const char *remoteAdr ) {
+
+	Com_Memset(conn, 0, sizeof(netTcpClientConnect_t));
+	Q_strncpyz(conn->remote, remoteAdr, sizeof(conn->remote));
+	conn->sock = INVALID_SOCKET;
+	conn->state = TCPCONNECT_RESOLVING;
+	conn->starttime = NET_TimeGetTime();
 
 	Com_Printf( "Connecting to: %s\n", remoteAdr);
+}
+
+static qboolean NET_TcpClientConnectBegin( netTcpClientConnect_t *conn ) {
+	SOCKET			newsocket;
+	struct sockaddr_storage	address;
+	int err;
 
-	if( ( newsocket = socket( PF_INET, SOCK_STREAM, IPPROTO_TCP ) ) == INVALID_SOCKET ) {
+	if( ( newsocket = socket( conn->adr.type == NA_IP6 ? PF_INET6 : PF_INET, SOCK_STREAM, IPPROTO_TCP ) ) == INVALID_SOCKET ) {
 		Com_PrintWarning( "NET_TCPConnect: socket: %s\n", NET_ErrorString() );
-		return INVALID_SOCKET;
+		return qfalse;
 	}
 	// make it non-blocking
 	ioctlarg_t	_true = 1;
 	if( ioctlsocket( newsocket, FIONBIO, &_true ) == SOCKET_ERROR ) {
 		Com_PrintWarning( "NET_TCPIPSocket: ioctl FIONBIO: %s\n", NET_ErrorString() );
 		closesocket(newsocket);
-		return INVALID_SOCKET;
+		return qfalse;
 	}
 
-	if(NET_StringToAdr(remoteAdr, &remoteadr, NA_UNSPEC))
-	{
-		Com_Printf( "Resolved %s to: %s\n", remoteAdr, NET_AdrToString(&remoteadr));
-	}else{
-		Com_PrintWarning( "Couldn't resolve: %s\n", remoteAdr);
-		closesocket( newsocket );
-		return INVALID_SOCKET;
+	Com_Memset(&address, 0, sizeof(address));
+	NetadrToSockadr( &conn->adr, (struct sockaddr *)&address);
+
+	if( connect( newsocket, (void *)&address, conn->adr.type == NA_IP6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in) ) == SOCKET_ERROR ) {
+
+		err = socketError;
+		if(err != EINPROGRESS){
+			Com_PrintWarning( "NET_TCPOpenConnection: connect: %s\n", NET_ErrorString() );
+			closesocket( newsocket );
+			return qfalse;
+		}
+		conn->sock = newsocket;
+		conn->state = TCPCONNECT_CONNECTING;
+		return qtrue;
 	}
+	conn->sock = newsocket;
+	conn->state = TCPCONNECT_CONNECTED;
+	return qtrue;
+}
 
-	NetadrToSockadr( &remoteadr, (struct sockaddr *)&address);
+/*
+====================
+NET_TcpClientConnectPoll
 
-	if( connect( newsocket, (void *)&address, sizeof(address) ) == SOCKET_ERROR ) {
+Call it every frame until it returns TCPCONNECT_CONNECTED or TCPCONNECT_FAILED.
+On success conn->sock is the connected socket and belongs to the caller.
+====================
+*/
+netTcpConnectState_t NET_TcpClientConnectPoll( netTcpClientConnect_t *conn ) {
+	int err = 0;
+	int retval;
+	fd_set fdw;
+	struct timeval timeout;
+	socklen_t so_len;
 
-		err = socketError;
-		if(err == EINPROGRESS){
+	if(conn->state == TCPCONNECT_RESOLVING)
+	{
+		retval = NET_StringToAdrNonBlocking(conn->remote, &conn->adr, NA_UNSPEC);
 
-			FD_ZERO(&fdr);
-			FD_SET(newsocket, &fdr);
-			timeout.tv_sec = 2;
-			timeout.tv_usec = 0;
+		if(retval == 0)
+		{
+			Com_PrintWarning( "Couldn't resolve: %s\n", conn->remote);
+			conn->state = TCPCONNECT_FAILED;
+		}
+		else if(retval > 0)
+		{
+			Com_Printf( "Resolved %s to: %s\n", conn->remote, NET_AdrToString(&conn->adr));
+			if(!NET_TcpClientConnectBegin(conn))
+				conn->state = TCPCONNECT_FAILED;
+		}
+	}
 
-			retval = select(newsocket +1, NULL, &fdr, NULL, &timeout);
+	if(conn->state == TCPCONNECT_CONNECTING)
+	{
+		FD_ZERO(&fdw);
+		FD_SET(conn->sock, &fdw);
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 0;
 
-			if(retval < 0){
-				Com_PrintWarning("NET_TcpConnect: select() syscall failed: %s\n", NET_ErrorString());
-				closesocket( newsocket );
-				return INVALID_SOCKET;
-			}else if(retval > 0){
+		retval = select(conn->sock +1, NULL, &fdw, NULL, &timeout);
 
-				socklen_t so_len = sizeof(err);
+		if(retval < 0){
+			Com_PrintWarning("NET_TcpConnect: select() syscall failed: %s\n", NET_ErrorString());
+			NET_TcpClientConnectAbort(conn);
+			conn->state = TCPCONNECT_FAILED;
+		}else if(retval > 0){
 
-				if(getsockopt(newsocket, SOL_SOCKET, SO_ERROR, &err, &so_len) == 0);
-				{
-					return newsocket;
-				}
+			so_len = sizeof(err);
 
+			if(getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, (void*)&err, &so_len) == SOCKET_ERROR || err != 0)
+			{
+				Com_PrintWarning("NET_TcpConnect: Connecting to: %s failed: %s\n", conn->remote, err ? strerror(err) : NET_ErrorString());
+				NET_TcpClientConnectAbort(conn);
+				conn->state = TCPCONNECT_FAILED;
 			}else{
-				Com_PrintWarning("NET_TcpConnect: Connecting to: %s timed out\n", remoteAdr);
-				closesocket( newsocket );
-				return INVALID_SOCKET;
+				conn->state = TCPCONNECT_CONNECTED;
 			}
 		}
-		Com_PrintWarning( "NET_TCPOpenConnection: connect: %s\n", NET_ErrorString() );
-		closesocket( newsocket );
-		return INVALID_SOCKET;
 	}
-	return newsocket;
+
+	if((conn->state == TCPCONNECT_RESOLVING || conn->state == TCPCONNECT_CONNECTING)
+		&& NET_TimeGetTime() - conn->starttime > NET_TCPCONNECT_TIMEOUT)
+	{
+		Com_PrintWarning("NET_TcpConnect: Connecting to: %s timed out\n", conn->remote);
+		NET_TcpClientConnectAbort(conn);
+		conn->state = TCPCONNECT_FAILED;
+	}
+
+	return conn->state;
+}
+
+void NET_TcpClientConnectAbort( netTcpClientConnect_t *conn ) {
+
+	if(conn->sock != INVALID_SOCKET && conn->state != TCPCONNECT_CONNECTED)
+		closesocket(conn->sock);
+
+	conn->sock = INVALID_SOCKET;
+	conn->state = TCPCONNECT_IDLE;
 }
 
 
@@ -2645,17 +4310,103 @@ Called from NET_Sleep which uses select() to determine which sockets have seen a
 ====================
 */
 
+#ifdef NET_HAVE_MMSG
+/*
+====================
+NET_BatchEvent
+
+Same as NET_Event but receives up to batchsize datagrams with one recvmmsg() call
+====================
+*/
+
+static qboolean NET_BatchEvent(int socket, int batchsize)
+{
+	netadr_t from;
+	int i, j, count, ret, err;
+
+	if(batchsize > NET_UDPBATCH_MAX)
+		batchsize = NET_UDPBATCH_MAX;
+
+	//Give the system a possibility to abort processing network packets so it won't block execution of frames if the network getting flooded
+	for(i = 0; i < MAX_NETPACKETS; )
+	{
+		count = batchsize;
+		if(count > MAX_NETPACKETS - i)
+			count = MAX_NETPACKETS - i;
+
+		for(j = 0; j < count; j++)
+		{
+			net_recvBatch.iovecs[j].iov_base = net_recvBatch.data[j];
+			net_recvBatch.iovecs[j].iov_len = sizeof(net_recvBatch.data[j]);
+			memset(&net_recvBatch.msgs[j], 0, sizeof(net_recvBatch.msgs[j]));
+			net_recvBatch.msgs[j].msg_hdr.msg_name = &net_recvBatch.addrs[j];
+			net_recvBatch.msgs[j].msg_hdr.msg_namelen = sizeof(net_recvBatch.addrs[j]);
+			net_recvBatch.msgs[j].msg_hdr.msg_iov = &net_recvBatch.iovecs[j];
+			net_recvBatch.msgs[j].msg_hdr.msg_iovlen = 1;
+		}
+
+		ret = recvmmsg(socket, net_recvBatch.msgs, count, MSG_DONTWAIT, NULL);
+
+		if(ret == SOCKET_ERROR)
+		{
+			err = socketError;
+
+			if( err != EAGAIN && err != ECONNRESET && err != EINTR ){
+				Com_PrintWarningNoRedirect( "NET_GetPacket on (%s): %s\n", NET_AdrToString(NET_SockToAdr(socket)), NET_ErrorString() );
+			}
+			return qfalse;
+		}
+
+		for(j = 0; j < ret; j++)
+		{
+			SockadrToNetadr( (struct sockaddr *) &net_recvBatch.addrs[j], &from, qfalse, socket);
+
+			if(net_recvBatch.msgs[j].msg_hdr.msg_flags & MSG_TRUNC)
+			{
+				Com_PrintWarningNoRedirect( "Oversize packet from %s\n", NET_AdrToString (&from) );
+				continue;
+			}
+
+			if(net_dropsim->value > 0 && net_dropsim->value <= 100)
+			{
+				// com_dropsim->value percent of incoming packets get dropped.
+				if(rand() % 101 <= net_dropsim->value)
+					continue;          // drop this packet
+			}
+
+			NET_UDPPacketEvent(&from, net_recvBatch.data[j], net_recvBatch.msgs[j].msg_len);
+		}
+
+		i += ret;
+
+		if(ret < count)
+			return qfalse; //Socket is drained
+	}
+	return qtrue;
+}
+#endif
+
+
 __optimize3 __regparm1 qboolean NET_Event(int socket)
 {
-	byte bufData[MAX_MSGLEN];
+	byte *bufData;
 	netadr_t from;
 	int i, len;
+	qboolean pending;
+
+#ifdef NET_HAVE_MMSG
+	if(net_udpBatch->integer > 1)
+		return NET_BatchEvent(socket, net_udpBatch->integer);
+#endif
+
+	bufData = MSG_GetBuffer(MAX_MSGLEN);
+	pending = qtrue;
 
 	//Give the system a possibility to abort processing network packets so it won't block execution of frames if the network getting flooded
 	for(i = 0; i < MAX_NETPACKETS; i++)
 	{
 
-		if((len = NET_GetPacket(&from, bufData, sizeof(bufData), socket)) > 0)
+		if((len = NET_GetPacket(&from, bufData, MAX_MSGLEN, socket)) > 0)
 		{
 			if(net_dropsim->value > 0 && net_dropsim->value <= 100)
 			{
@@ -2670,10 +4421,12 @@ __optimize3 __regparm1 qboolean NET_Event(int socket)
 			//else
 			//	CL_PacketEvent(from, &netmsg);
 		}else{
-			return qfalse;
+			pending = qfalse;
+			break;
 		}
 	}
-	return qtrue;
+	MSG_FreeBuffer(bufData);
+	return pending;
 }
 
 
@@ -2698,9 +4451,12 @@ void NET_Init( void ) {
 	Com_Printf( "Winsock Initialized\n" );
 #endif
 
+	NET_InitWakeup();
+
 	NET_Config( qtrue );
 	
 	Cmd_AddCommand ("net_restart", NET_Restart_f);
+	Cmd_AddCommand ("net_pacingstats", NET_PacingStats_f);
 
 //	pthread_create( &net_thread, NULL, &NET_Frame, NULL );
 
@@ -2726,14 +4482,90 @@ void NET_Shutdown( void ) {
 }
 
 
+#ifdef NET_HAVE_EPOLL
 /*
 ====================
-NET_Sleep
+NET_EpollSleep
+
+epoll_wait() has only millisecond resolution. The epoll descriptor itself becomes readable
+once any registered socket is ready, so we select() on this single descriptor to keep the
+microsecond timeout of NET_Sleep
+====================
+*/
+static qboolean NET_EpollSleep(unsigned int usec)
+{
+	struct epoll_event events[NET_EPOLL_MAXEVENTS];
+	struct timeval timeout;
+	fd_set fdr;
+	unsigned int index;
+	int retval;
+	int i;
+	qboolean netabort = qfalse;
+
+	if(usec > 0)
+	{
+		FD_ZERO(&fdr);
+		FD_SET(net_epollfd, &fdr);
+
+		timeout.tv_sec = 0;
+		timeout.tv_usec = usec;
+
+		retval = select(net_epollfd + 1, &fdr, NULL, NULL, &timeout);
+
+		if(retval < 0){
+			if(socketError != EINTR)
+				Com_PrintWarningNoRedirect("NET_Sleep: select() syscall failed: %s\n", NET_ErrorString());
+			return qfalse;
+		}else if(retval == 0){
+			return qfalse;
+		}
+	}
+
+	retval = epoll_wait(net_epollfd, events, NET_EPOLL_MAXEVENTS, 0);
+
+	if(retval < 0){
+		if(socketError != EINTR)
+			Com_PrintWarningNoRedirect("NET_Sleep: epoll_wait() syscall failed: %s\n", NET_ErrorString());
+		return qfalse;
+	}
+
+	for(i = 0; i < retval; i++)
+	{
+		if(events[i].data.u32 & NET_EPOLLTAG_UDP)
+		{
+			index = events[i].data.u32 & NET_EPOLLTAG_INDEXMASK;
+
+			if(index < MAX_IPS && ip_socket[index].sock != INVALID_SOCKET)
+			{
+				if(NET_Event(ip_socket[index].sock))
+					netabort = qtrue;
+			}
+
+		}else if(events[i].data.u32 & NET_EPOLLTAG_TCPLISTEN){
+
+			if(NET_TcpServerConnectEvent(tcp_socket))
+				netabort = qtrue;
+
+			if(NET_TcpServerConnectEvent(tcp6_socket))
+				netabort = qtrue;
+
+		}else if(events[i].data.u32 & NET_EPOLLTAG_WAKEUP){
+
+			NET_ClearWakeup();
+		}
+	}
+	return netabort;
+}
+#endif
+
+/*
+====================
+NET_SleepBackend
 
 Sleeps usec or until something happens on the network
 ====================
 */
-__optimize3 __regparm1 qboolean NET_Sleep(unsigned int usec)
+static qboolean NET_SleepBackend(unsigned int usec)
 {
 	struct timeval timeout;
 	fd_set fdr;
@@ -2743,8 +4575,10 @@ __optimize3 __regparm1 qboolean NET_Sleep(unsigned int usec)
 	qboolean netabort = qfalse; //This will be true if we had to process more than 666 packets on one single interface
 				  //Usually this marks an ongoing floodattack onto this CoD4 server
 
-	if(usec < 0 || usec > 999999)
-		usec = 0;
+#ifdef NET_HAVE_EPOLL
+	if(net_activeBackend == NET_EVENTBACKEND_EPOLL)
+		return NET_EpollSleep(usec);
+#endif
 
 	FD_ZERO(&fdr);
 
@@ -2777,6 +4611,16 @@ __optimize3 __regparm1 qboolean NET_Sleep(unsigned int usec)
 			highestfd = tcp6_socket;
 	}
 
+#ifdef NET_HAVE_EVENTFD
+	if(net_wakeupfd != -1)
+	{
+		FD_SET(net_wakeupfd, &fdr);
+
+		if(net_wakeupfd > highestfd)
+			highestfd = net_wakeupfd;
+	}
+#endif
+
 	timeout.tv_sec = 0;
 	timeout.tv_usec = usec;
 	
@@ -2809,14 +4653,156 @@ __optimize3 __regparm1 qboolean NET_Sleep(unsigned int usec)
 
 		}
 
-		if(FD_ISSET(tcp_socket, &fdr) || FD_ISSET(tcp6_socket, &fdr))
+		if(tcp_socket != INVALID_SOCKET && FD_ISSET(tcp_socket, &fdr))
+		{
+			if(NET_TcpServerConnectEvent(tcp_socket))
+				netabort = qtrue;
+		}
+
+		if(tcp6_socket != INVALID_SOCKET && FD_ISSET(tcp6_socket, &fdr))
 		{
-			if(NET_TcpServerConnectEvent(&fdr))
+			if(NET_TcpServerConnectEvent(tcp6_socket))
 				netabort = qtrue;
 		}
 
+#ifdef NET_HAVE_EVENTFD
+		if(net_wakeupfd != -1 && FD_ISSET(net_wakeupfd, &fdr))
+			NET_ClearWakeup();
+#endif
+	}
+	return netabort;
+}
+
+
+#ifndef _WIN32
+static unsigned long long NET_PacingTime( void )
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+
+/*
+====================
+NET_PaceSleep
+
+Sleeps until spinUsec before the deadline, then polls the sockets until the deadline has passed.
+Returns early if a packet has woken the sleep phase so the caller can recompute the deadline
+====================
+*/
+static qboolean NET_PaceSleep(unsigned int usec, unsigned int spinUsec)
+{
+#ifdef _WIN32
+	return NET_SleepBackend(usec);
+#else
+	unsigned long long now, deadline, spinStart;
+	unsigned int overshoot;
+	qboolean netabort = qfalse;
+
+#ifdef __linux__
+	//select() and epoll wake up timer slack (50 usec by default) after the timeout. Not wanted here
+	if(net_pacingTimerSlack != 1)
+	{
+		prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+		net_pacingTimerSlack = 1;
+	}
+#endif
+
+	now = NET_PacingTime();
+	deadline = now + usec;
+
+	if(usec > spinUsec)
+	{
+		if(NET_SleepBackend(usec - spinUsec))
+			netabort = qtrue;
+
+		now = NET_PacingTime();
+
+		if(now + spinUsec < deadline)
+			return netabort; //Woken by network traffic
 	}
+
+	spinStart = now;
+
+	while(now < deadline)
+	{
+		if(NET_SleepBackend(0))
+			netabort = qtrue;
+
+		now = NET_PacingTime();
+	}
+
+	overshoot = now - deadline;
+
+	net_pacingStats.frames++;
+	net_pacingStats.sumOvershoot += overshoot;
+	net_pacingStats.sumSpin += now - spinStart;
+
+	if(overshoot > net_pacingStats.maxOvershoot)
+		net_pacingStats.maxOvershoot = overshoot;
+
+	if(overshoot > NET_PACING_LATEUSEC)
+		net_pacingStats.lateFrames++;
+
 	return netabort;
+#endif
+}
+
+/*
+====================
+NET_Sleep
+
+Sleeps usec or until something happens on the network
+====================
+*/
+__optimize3 __regparm1 qboolean NET_Sleep(unsigned int usec)
+{
+	if(usec < 0 || usec > 999999)
+		usec = 0;
+
+	if(usec > 0 && net_framePacing && net_framePacing->integer > 0)
+		return NET_PaceSleep(usec, net_framePacing->integer);
+
+#ifdef __linux__
+	if(net_pacingTimerSlack == 1)
+	{
+		prctl(PR_SET_TIMERSLACK, 0, 0, 0, 0); //Back to the default slack
+		net_pacingTimerSlack = 0;
+	}
+#endif
+
+	return NET_SleepBackend(usec);
+}
+
+
+/*
+====================
+NET_PacingStats_f
+
+Prints the accuracy of paced frames since the last call
+====================
+*/
+void NET_PacingStats_f( void )
+{
+	if(!net_framePacing || net_framePacing->integer <= 0)
+	{
+		Com_Printf("Frame pacing is disabled. Set net_framePacing to enable it\n");
+		return;
+	}
+
+	if(net_pacingStats.frames == 0)
+	{
+		Com_Printf("No paced frames yet\n");
+		return;
+	}
+
+	Com_Printf("Paced frames: %u\n", net_pacingStats.frames);
+	Com_Printf("Deadline overshoot: avg %u usec, max %u usec\n", (unsigned int)(net_pacingStats.sumOvershoot / net_pacingStats.frames), net_pacingStats.maxOvershoot);
+	Com_Printf("Frames later than %d usec: %u\n", NET_PACING_LATEUSEC, net_pacingStats.lateFrames);
+	Com_Printf("Average busy-poll time: %u usec per frame\n", (unsigned int)(net_pacingStats.sumSpin / net_pacingStats.frames));
+
+	Com_Memset(&net_pacingStats, 0, sizeof(net_pacingStats));
 }
 
 
@@ -2905,3 +4891,139 @@ int NET_StringToAdr( const char *s, netadr_t *a, netadrtype_t family )
 		return 2;
 	}
 }
+
+
+/*
+=============
+NET_StringToAdrNonBlocking
+
+Looks the name up on a worker thread and keeps the result for NET_RESOLVE_TTL msec.
+Returns -1 until the lookup has finished, then the same as NET_StringToAdr.
+An expired entry still gets returned while it is getting refreshed.
+getaddrinfo() does not report the real DNS TTL, so a fixed time is used.
+=============
+*/
+
+#define MAX_RESOLVECACHE 32
+#define NET_RESOLVE_TTL (15*60*1000)
+#define NET_RESOLVE_FAILED_TTL (30*1000)
+
+typedef struct{
+	char name[MAX_STRING_CHARS];
+	netadrtype_t family;
+	netadr_t adr;
+	int result;
+}netResolveJob_t;
+
+typedef struct{
+	char name[MAX_STRING_CHARS];
+	netadrtype_t family;
+	netadr_t adr;
+	int result;
+	qboolean valid; //Has a result, maybe expired
+	qboolean pending;
+	unsigned int expire;
+	unsigned int lastused;
+}netResolveEntry_t;
+
+static netResolveEntry_t net_resolveCache[MAX_RESOLVECACHE];
+
+
+//Runs on a worker thread. Sys_StringToSockaddr does not print from there
+static void NET_ResolveJob(void* arg)
+{
+	netResolveJob_t *job = arg;
+
+	job->result = NET_StringToAdr(job->name, &job->adr, job->family);
+}
+
+static void NET_ResolveJobDone(void* arg)
+{
+	netResolveJob_t *job = arg;
+	netResolveEntry_t *entry;
+	int i;
+
+	for(i = 0, entry = net_resolveCache; i < MAX_RESOLVECACHE; i++, entry++)
+	{
+		if(!entry->pending || entry->family != job->family || strcmp(entry->name, job->name))
+			continue;
+
+		if(!job->result)
+			Com_PrintError("NET_StringToAdrNonBlocking: Couldn't resolve address %s\n", job->name);
+
+		entry->adr = job->adr;
+		entry->result = job->result;
+		entry->valid = qtrue;
+		entry->pending = qfalse;
+
+		if(job->result)
+			entry->expire = NET_TimeGetTime() + NET_RESOLVE_TTL;
+		else
+			entry->expire = NET_TimeGetTime() + NET_RESOLVE_FAILED_TTL;
+		break;
+	}
+	free(job);
+}
+
+static netResolveEntry_t* NET_GetResolveEntry(const char *s, netadrtype_t family)
+{
+	netResolveEntry_t *entry, *oldest = NULL;
+	int i;
+
+	for(i = 0, entry = net_resolveCache; i < MAX_RESOLVECACHE; i++, entry++)
+	{
+		if(entry->name[0] && entry->family == family && !strcmp(entry->name, s))
+			return entry;
+
+		// Pending entries can not be replaced, the job would not find them anymore
+		if(entry->pending)
+			continue;
+
+		if(!oldest || !entry->name[0] || (oldest->name[0] && entry->lastused < oldest->lastused))
+			oldest = entry;
+	}
+
+	if(!oldest)
+		return NULL;
+
+	Com_Memset(oldest, 0, sizeof(netResolveEntry_t));
+	Q_strncpyz(oldest->name, s, sizeof(oldest->name));
+	oldest->family = family;
+	return oldest;
+}
+
+int NET_StringToAdrNonBlocking( const char *s, netadr_t *a, netadrtype_t family )
+{
+	netResolveEntry_t *entry;
+	netResolveJob_t *job;
+
+	if(strlen(s) >= MAX_STRING_CHARS)
+		return NET_StringToAdr(s, a, family);
+
+	entry = NET_GetResolveEntry(s, family);
+	if(!entry)
+		return -1; //All entries are busy
+
+	entry->lastused = NET_TimeGetTime();
+
+	if(!entry->pending && (!entry->valid || (int)(entry->expire - NET_TimeGetTime()) < 0))
+	{
+		job = malloc(sizeof(netResolveJob_t));
+		if(!job)
+			return NET_StringToAdr(s, a, family);
+
+		Q_strncpyz(job->name, s, sizeof(job->name));
+		job->family = family;
+		job->result = 0;
+		entry->pending = qtrue;
+
+		//Calls NET_ResolveJobDone right now if there is no worker thread
+		Sys_AddJob(NET_ResolveJob, NET_ResolveJobDone, job);
+	}
+
+	if(!entry->valid)
+		return -1;
+
+	*a = entry->adr;
+	return entry->result;
+}
@@ -76,12 +76,19 @@ typedef struct {
 	};
 }netadr_t;
 
+#define NET_REPLAY_SOCK -2	//Source of the packets netreplay feeds in
+#define NET_LOADBOT_SOCK -3	//Socket of the load bots
+//Nothing gets sent to these, NET_SendPacket counts and drops it
+#define NET_IsDiscardSock(sock) ((sock) == NET_REPLAY_SOCK || (sock) == NET_LOADBOT_SOCK)
+
 typedef int SOCKET; // Moved from sys_net.c
 
 void		NET_Init( void );
 void		NET_Shutdown( void );
 void		NET_Restart_f( void );
+void		NET_PacingStats_f( void );
 void		NET_Config( qboolean enableNetworking );
+void		NET_BeginPacketQueue(void);
 void		NET_FlushPacketQueue(void);
 qboolean	NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t *to);
 void		QDECL NET_OutOfBandPrint( netsrc_t net_socket, netadr_t *adr, const char *format, ...) __attribute__ ((format (printf, 3, 4)));
@@ -100,10 +107,16 @@ const char	*NET_AdrToConnectionString(netadr_t *a);
 const char	*NET_AdrToConnectionStringShort(netadr_t *a);
 const char	*NET_AdrToConnectionStringMask(netadr_t *a);
 int		NET_StringToAdr ( const char *s, netadr_t *a, netadrtype_t family);
+int		NET_StringToAdrNonBlocking( const char *s, netadr_t *a, netadrtype_t family );
 //qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_message);
 void		NET_JoinMulticast6(void);
 void		NET_LeaveMulticast6(void);
 __optimize3 __regparm1 qboolean	NET_Sleep(unsigned int usec);
+void		NET_Wakeup(void);
+qboolean	NET_ConsumeWakeup(void);
+qboolean	NET_QueryThreadActive(void);
+qboolean	NET_QuerySendPacket( int length, const void *data, netadr_t *to );
+void		NET_SetPacketFilterBans( const netadr_t *bans, int count, const netadr_t *ranges, const int *rangebits, int rangecount );
 void NET_Clear(void);
 const char*	NET_AdrMaskToString(netadr_t *adr);
 
@@ -114,9 +127,35 @@ qboolean	Sys_StringToAdr( const char *s, netadr_t *a, netadrtype_t family );
 qboolean	Sys_IsLANAddress (netadr_t *adr);
 void		Sys_ShowIP(void);
 
+typedef struct netTcpSendBuffer_s netTcpSendBuffer_t;
+
 int NET_TcpSendData( int sock, const void *data, int length );
+int NET_TcpTrySend( int sock, const void *data, int length );
+netTcpSendBuffer_t* NET_TcpAllocSendBuffer( const void *data, int length );
+void NET_TcpReleaseSendBuffer( netTcpSendBuffer_t *buf );
+int NET_TcpSendBuffer( int sock, netTcpSendBuffer_t *buf );
+int NET_TcpFlushPending( int sock );
+int NET_TcpSendFile( int sock, int fd, int *offset, int count );
 void NET_TcpServerPacketEventLoop();
-int NET_TcpClientConnect( const char *remoteAdr );
+typedef enum {
+	TCPCONNECT_IDLE,
+	TCPCONNECT_RESOLVING,
+	TCPCONNECT_CONNECTING,
+	TCPCONNECT_CONNECTED,
+	TCPCONNECT_FAILED
+}netTcpConnectState_t;
+
+typedef struct {
+	char remote[256];
+	netadr_t adr;
+	int sock;
+	netTcpConnectState_t state;
+	unsigned int starttime;
+}netTcpClientConnect_t;
+
+void NET_TcpClientConnectStart( netTcpClientConnect_t *conn, const char *remoteAdr );
+netTcpConnectState_t NET_TcpClientConnectPoll( netTcpClientConnect_t *conn );
+void NET_TcpClientConnectAbort( netTcpClientConnect_t *conn );
 int NET_TcpClientGetData(int sock, void* buf, const int buflen);
 void NET_TcpCloseSocket(int socket);
 
@@ -21,24 +21,72 @@
 
 
 
-//This are dummy functions for the single thread server :D
+//Critical sections are recursive mutexes. Only the main thread runs game code,
+//worker threads execute jobs added with Sys_AddJob and must not call into the engine.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE //cpu_set_t and pthread_setaffinity_np()
+#endif
 
 #include "q_shared.h"
+#include "qcommon_io.h"
+#include "cvar.h"
 #include "sys_thread.h"
+#include "sys_net.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+static pthread_mutex_t sys_critSections[MAX_CRITSECTIONS];
+static pthread_t sys_mainThread;
+static qboolean sys_threadInitialized;
+
 
 void __cdecl Sys_EnterCriticalSection(int section)
 {
+    if(!sys_threadInitialized)
+        return;
+
+    if(section < 0 || section >= MAX_CRITSECTIONS)
+        return;
 
+    pthread_mutex_lock(&sys_critSections[section]);
 }
 
 void __cdecl Sys_LeaveCriticalSection(int section)
 {
+    if(!sys_threadInitialized)
+        return;
+
+    if(section < 0 || section >= MAX_CRITSECTIONS)
+        return;
 
+    pthread_mutex_unlock(&sys_critSections[section]);
 }
 
 void __cdecl Sys_ThreadInit( void )
 {
+    pthread_mutexattr_t attr;
+    int i;
 
+    if(sys_threadInitialized)
+        return;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+    for(i = 0; i < MAX_CRITSECTIONS; i++)
+        pthread_mutex_init(&sys_critSections[i], &attr);
+
+    pthread_mutexattr_destroy(&attr);
+
+    sys_mainThread = pthread_self();
+    sys_threadInitialized = qtrue;
 }
 
 void __cdecl Sys_ThreadMain( void )
@@ -48,7 +96,212 @@ void __cdecl Sys_ThreadMain( void )
 
 qboolean __cdecl Sys_IsMainThread( void )
 {
-	return qtrue;
+    if(!sys_threadInitialized)
+        return qtrue;
+
+    return pthread_equal(pthread_self(), sys_mainThread) != 0;
+}
+
+
+/*
+Jobs get executed by the worker threads. The completion function of a job gets called from
+the main thread inside Com_EventLoop once the job has finished. The number of jobs which are
+queued, running or waiting for completion is limited to MAX_JOBS so both queues can never overflow.
+*/
+
+typedef struct{
+    void (*job)(void* arg);
+    void (*completion)(void* arg);
+    void *arg;
+}sysJob_t;
+
+typedef struct{
+    sysJob_t jobs[MAX_JOBS];
+    int head;
+    int tail;
+}sysJobQueue_t;
+
+static sysJobQueue_t sys_jobQueue;
+static sysJobQueue_t sys_completionQueue;
+static int sys_jobsPending;
+static int sys_jobsRunning;
+static qboolean sys_jobsShutdown;
+
+static pthread_mutex_t sys_jobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sys_jobCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t sys_jobIdleCond = PTHREAD_COND_INITIALIZER;
+
+static pthread_t sys_workerThreads[MAX_WORKERTHREADS];
+static int sys_numWorkerThreads;
+
+
+static void Sys_PushJob(sysJobQueue_t *queue, sysJob_t *job)
+{
+    queue->jobs[queue->head % MAX_JOBS] = *job;
+    queue->head++;
+}
+
+static qboolean Sys_PopJob(sysJobQueue_t *queue, sysJob_t *job)
+{
+    if(queue->tail == queue->head)
+        return qfalse;
+
+    *job = queue->jobs[queue->tail % MAX_JOBS];
+    queue->tail++;
+    return qtrue;
+}
+
+
+static void* Sys_WorkerThread(void* arg)
+{
+    sysJob_t job;
+
+    Sys_PlaceHelperThread("cod4x-worker");
+
+    pthread_mutex_lock(&sys_jobLock);
+
+    while(1)
+    {
+        while(!Sys_PopJob(&sys_jobQueue, &job))
+        {
+            if(sys_jobsShutdown)
+            {
+                pthread_mutex_unlock(&sys_jobLock);
+                return NULL;
+            }
+            pthread_cond_wait(&sys_jobCond, &sys_jobLock);
+        }
+
+        sys_jobsRunning++;
+        pthread_mutex_unlock(&sys_jobLock);
+
+        job.job(job.arg);
+
+        pthread_mutex_lock(&sys_jobLock);
+        sys_jobsRunning--;
+
+        if(job.completion)
+        {
+            Sys_PushJob(&sys_completionQueue, &job);
+            NET_Wakeup(); //Run the completion without waiting for the next server frame
+        }
+        else
+            sys_jobsPending--;
+
+        pthread_cond_broadcast(&sys_jobIdleCond);
+    }
+}
+
+
+void Sys_InitWorkerThreads(int count)
+{
+    int i;
+
+    if(sys_numWorkerThreads > 0)
+        return;
+
+    if(count > MAX_WORKERTHREADS)
+        count = MAX_WORKERTHREADS;
+
+    sys_jobsShutdown = qfalse;
+
+    for(i = 0; i < count; i++)
+    {
+        if(pthread_create(&sys_workerThreads[sys_numWorkerThreads], NULL, Sys_WorkerThread, NULL) != 0)
+        {
+            Com_PrintWarning("Sys_InitWorkerThreads: Can not create worker thread %i\n", i);
+            break;
+        }
+        sys_numWorkerThreads++;
+    }
+
+    if(sys_numWorkerThreads > 0)
+        Com_Printf("Started %i worker threads\n", sys_numWorkerThreads);
+}
+
+//Executes all queued jobs and stops the worker threads
+void Sys_ShutdownWorkerThreads()
+{
+    int i;
+
+    if(sys_numWorkerThreads < 1)
+        return;
+
+    pthread_mutex_lock(&sys_jobLock);
+    sys_jobsShutdown = qtrue;
+    pthread_cond_broadcast(&sys_jobCond);
+    pthread_mutex_unlock(&sys_jobLock);
+
+    for(i = 0; i < sys_numWorkerThreads; i++)
+        pthread_join(sys_workerThreads[i], NULL);
+
+    sys_numWorkerThreads = 0;
+
+    Sys_RunCompletedJobs();
+}
+
+/*
+Queues a job for a worker thread. If there are no worker threads or the queue is full
+the job and its completion get executed right now.
+*/
+void Sys_AddJob(void (*job)(void* arg), void (*completion)(void* arg), void* arg)
+{
+    sysJob_t newjob;
+
+    newjob.job = job;
+    newjob.completion = completion;
+    newjob.arg = arg;
+
+    pthread_mutex_lock(&sys_jobLock);
+
+    if(sys_numWorkerThreads < 1 || sys_jobsShutdown || sys_jobsPending >= MAX_JOBS)
+    {
+        pthread_mutex_unlock(&sys_jobLock);
+
+        job(arg);
+        if(completion)
+            completion(arg);
+        return;
+    }
+
+    sys_jobsPending++;
+    Sys_PushJob(&sys_jobQueue, &newjob);
+    pthread_cond_signal(&sys_jobCond);
+
+    pthread_mutex_unlock(&sys_jobLock);
+}
+
+//Gets called from the main thread. Executes the completion functions of finished jobs
+void Sys_RunCompletedJobs()
+{
+    sysJob_t job;
+
+    while(1)
+    {
+        pthread_mutex_lock(&sys_jobLock);
+
+        if(!Sys_PopJob(&sys_completionQueue, &job))
+        {
+            pthread_mutex_unlock(&sys_jobLock);
+            return;
+        }
+        sys_jobsPending--;
+
+        pthread_mutex_unlock(&sys_jobLock);
+
+        job.completion(job.arg);
+    }
+}
+
+//Blocks until all queued jobs have been executed. Completion functions are not called
+void Sys_WaitForJobs()
+{
+    pthread_mutex_lock(&sys_jobLock);
+
+    while(sys_jobsRunning > 0 || sys_jobQueue.tail != sys_jobQueue.head)
+        pthread_cond_wait(&sys_jobIdleCond, &sys_jobLock);
+
+    pthread_mutex_unlock(&sys_jobLock);
 }
 
 
@@ -68,6 +321,358 @@ void __cdecl Sys_SetValue(int key, const void* value)
 
 
 
+/*
+Thread placement
+
+sys_mainCpus pins the thread which runs the server frames, sys_workerCpus takes all helper
+threads: job workers, log, demo and console writers and the query thread. Helpers call
+Sys_PlaceHelperThread() once they run. The ones which started before the cvars were there are
+remembered and placed by Sys_InitThreadPlacement(). A realtime policy is only for the main
+thread, helpers go back to SCHED_OTHER so a busy one can not starve the frame.
+*/
+
+#ifdef __linux__
+
+#define MAX_EARLYTHREADS 8
+
+static struct{
+    qboolean initialized;
+    qboolean pinMain;
+    qboolean pinWorkers;
+    cpu_set_t mainCpus;
+    cpu_set_t workerCpus;
+    int numEarly;
+    pthread_t early[MAX_EARLYTHREADS];
+}sys_placement;
+
+static pthread_mutex_t sys_placementLock = PTHREAD_MUTEX_INITIALIZER;
+
+static char* sys_schedPolicyNames[] = {"other", "fifo", "rr", NULL};
+
+static qboolean Sys_ParseCpuList(const char* list, cpu_set_t* set)
+{
+    const char* s = list;
+    char* end;
+    long first, last;
+
+    CPU_ZERO(set);
+
+    while(*s)
+    {
+        first = strtol(s, &end, 10);
+        if(end == s)
+            return qfalse;
+
+        last = first;
+        if(*end == '-')
+        {
+            s = end +1;
+            last = strtol(s, &end, 10);
+            if(end == s)
+                return qfalse;
+        }
+        if(first < 0 || last < first || last >= CPU_SETSIZE)
+            return qfalse;
+
+        for( ; first <= last; first++)
+            CPU_SET(first, set);
+
+        s = end;
+        if(*s == ',')
+            s++;
+        else if(*s && *s != '\n')
+            return qfalse;
+        else
+            break;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+static void Sys_CpuListToString(const cpu_set_t* set, char* buf, int size)
+{
+    int cpu, last;
+
+    buf[0] = '\0';
+
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, set))
+            continue;
+
+        for(last = cpu; last +1 < CPU_SETSIZE && CPU_ISSET(last +1, set); last++);
+
+        if(buf[0])
+            Q_strcat(buf, size, ",");
+
+        if(last > cpu)
+            Q_strcat(buf, size, va("%d-%d", cpu, last));
+        else
+            Q_strcat(buf, size, va("%d", cpu));
+
+        cpu = last;
+    }
+}
+
+static qboolean Sys_ReadSysFile(const char* path, char* buf, int size)
+{
+    FILE* fp;
+    qboolean ok;
+
+    fp = fopen(path, "r");
+    if(fp == NULL)
+        return qfalse;
+
+    ok = fgets(buf, size, fp) != NULL;
+    fclose(fp);
+
+    if(ok)
+        buf[strcspn(buf, "\n")] = '\0';
+
+    return ok;
+}
+
+static void Sys_ApplyHelperPlacement(pthread_t thread)
+{
+    struct sched_param param;
+    int policy;
+
+    if(sys_placement.pinWorkers)
+        pthread_setaffinity_np(thread, sizeof(cpu_set_t), &sys_placement.workerCpus);
+
+    if(pthread_getschedparam(thread, &policy, &param) == 0 && policy != SCHED_OTHER)
+    {
+        param.sched_priority = 0;
+        pthread_setschedparam(thread, SCHED_OTHER, &param);
+    }
+}
+
+/*
+Prints the packages and cores and warns if the main thread shares a core with the helpers
+*/
+static void Sys_ReportTopology(void)
+{
+    char buf[256], cpus[256];
+    cpu_set_t online, siblings;
+    int cpu, other, packages, cores;
+
+    if(!Sys_ReadSysFile("/sys/devices/system/cpu/online", buf, sizeof(buf)) || !Sys_ParseCpuList(buf, &online))
+        return;
+
+    packages = 0;
+    cores = 0;
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, &online))
+            continue;
+
+        if(Sys_ReadSysFile(va("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu), buf, sizeof(buf)) && atoi(buf) +1 > packages)
+            packages = atoi(buf) +1;
+
+        //Count each core once at its first thread
+        if(Sys_ReadSysFile(va("/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu), buf, sizeof(buf)) &&
+            Sys_ParseCpuList(buf, &siblings))
+        {
+            for(other = 0; other < cpu && !CPU_ISSET(other, &siblings); other++);
+            if(other == cpu)
+                cores++;
+        }
+    }
+
+    Sys_CpuListToString(&online, cpus, sizeof(cpus));
+    if(!Sys_ReadSysFile("/sys/devices/system/cpu/isolated", buf, sizeof(buf)) || !buf[0])
+        Q_strncpyz(buf, "none", sizeof(buf));
+
+    Com_Printf("CPU topology: %d CPUs online (%s), %d cores, %d packages, isolated: %s\n", CPU_COUNT(&online), cpus, cores, packages, buf);
+
+    if(!sys_placement.pinMain || !sys_placement.pinWorkers)
+        return;
+
+    for(cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(!CPU_ISSET(cpu, &sys_placement.mainCpus))
+            continue;
+
+        if(!Sys_ReadSysFile(va("/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu), buf, sizeof(buf)) ||
+            !Sys_ParseCpuList(buf, &siblings))
+            continue;
+
+        CPU_AND(&siblings, &siblings, &sys_placement.workerCpus);
+        if(CPU_COUNT(&siblings) > 0)
+        {
+            Sys_CpuListToString(&siblings, cpus, sizeof(cpus));
+            Com_PrintWarning("CPU %d of the main thread shares its core with worker CPUs %s\n", cpu, cpus);
+        }
+    }
+}
+
+/*
+Writes sys_irqCpus into the affinity of every interrupt whose name in /proc/interrupts
+contains sys_irqInterface. Needs root
+*/
+static void Sys_SteerInterrupts(const char* iface, const char* cpus)
+{
+    char line[1024];
+    char* name;
+    FILE* fp;
+    FILE* irqfp;
+    int irq, steered = 0, failed = 0, err = 0;
+    qboolean ok;
+
+    fp = fopen("/proc/interrupts", "r");
+    if(fp == NULL)
+        return;
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(sscanf(line, " %d:", &irq) != 1)
+            continue;
+
+        line[strcspn(line, "\n")] = '\0';
+        name = strrchr(line, ' ');
+        if(name == NULL || strstr(name +1, iface) == NULL)
+            continue;
+
+        irqfp = fopen(va("/proc/irq/%d/smp_affinity_list", irq), "w");
+        if(irqfp == NULL)
+        {
+            err = errno;
+            failed++;
+            continue;
+        }
+        //The kernel checks the list when it gets flushed
+        ok = fprintf(irqfp, "%s\n", cpus) >= 0;
+        ok = fclose(irqfp) == 0 && ok;
+        if(!ok)
+        {
+            err = errno;
+            failed++;
+        }
+        else
+            steered++;
+    }
+    fclose(fp);
+
+    if(steered)
+        Com_Printf("Steered %d interrupts of %s to CPUs %s\n", steered, iface, cpus);
+    if(failed)
+        Com_PrintWarning("Can not set the affinity of %d interrupts of %s: %s\n", failed, iface, err == EACCES ? "root is needed" : strerror(err));
+    if(!steered && !failed)
+        Com_PrintWarning("No interrupts of %s found in /proc/interrupts\n", iface);
+}
+
+#endif
+
+/*
+==================
+Sys_InitThreadPlacement
+
+Called from the main thread once the command line got parsed
+==================
+*/
+void Sys_InitThreadPlacement( void )
+{
+    cvar_t* sys_mainCpus;
+    cvar_t* sys_workerCpus;
+    cvar_t* sys_schedPolicy;
+    cvar_t* sys_schedPriority;
+    cvar_t* sys_nice;
+    cvar_t* sys_irqInterface;
+    cvar_t* sys_irqCpus;
+
+    sys_mainCpus = Cvar_RegisterString("sys_mainCpus", "", CVAR_INIT, "CPUs like \"2\" or \"2,6-7\" the thread running the server frames is pinned to. Empty leaves it to the scheduler");
+    sys_workerCpus = Cvar_RegisterString("sys_workerCpus", "", CVAR_INIT, "CPUs the job workers, writer threads and the query thread are pinned to. Empty leaves them to the scheduler");
+    sys_schedPolicy = Cvar_RegisterEnum("sys_schedPolicy", sys_schedPolicyNames, 0, CVAR_INIT, "Scheduling policy of the main thread. fifo and rr are realtime policies and need CAP_SYS_NICE");
+    sys_schedPriority = Cvar_RegisterInt("sys_schedPriority", 10, 1, 99, CVAR_INIT, "Realtime priority of the main thread for sys_schedPolicy fifo and rr");
+    sys_nice = Cvar_RegisterInt("sys_nice", 0, -20, 19, CVAR_INIT, "Nice value of the process. Negative values need CAP_SYS_NICE");
+    sys_irqInterface = Cvar_RegisterString("sys_irqInterface", "", CVAR_INIT, "Network interface whose interrupts get steered to sys_irqCpus. Needs root");
+    sys_irqCpus = Cvar_RegisterString("sys_irqCpus", "", CVAR_INIT, "CPUs the interrupts of sys_irqInterface are steered to");
+
+#ifdef __linux__
+    struct sched_param param;
+    char mainstr[256], workerstr[256];
+    int i, policy;
+
+    pthread_mutex_lock(&sys_placementLock);
+
+    if(sys_mainCpus->string[0] && !(sys_placement.pinMain = Sys_ParseCpuList(sys_mainCpus->string, &sys_placement.mainCpus)))
+        Com_PrintWarning("sys_mainCpus: Bad CPU list %s\n", sys_mainCpus->string);
+
+    if(sys_workerCpus->string[0] && !(sys_placement.pinWorkers = Sys_ParseCpuList(sys_workerCpus->string, &sys_placement.workerCpus)))
+        Com_PrintWarning("sys_workerCpus: Bad CPU list %s\n", sys_workerCpus->string);
+
+    if(sys_placement.pinMain && pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &sys_placement.mainCpus) != 0)
+    {
+        Com_PrintWarning("Can not pin the main thread to CPUs %s\n", sys_mainCpus->string);
+        sys_placement.pinMain = qfalse;
+    }
+
+    if(sys_nice->integer != 0 && setpriority(PRIO_PROCESS, 0, sys_nice->integer) != 0)
+        Com_PrintWarning("Can not set the nice value to %d: %s\n", sys_nice->integer, strerror(errno));
+
+    if(sys_schedPolicy->integer != 0)
+    {
+        policy = sys_schedPolicy->integer == 1 ? SCHED_FIFO : SCHED_RR;
+        param.sched_priority = sys_schedPriority->integer;
+        if((errno = pthread_setschedparam(pthread_self(), policy, &param)) != 0)
+            Com_PrintWarning("Can not set the scheduling policy %s: %s\n", sys_schedPolicyNames[sys_schedPolicy->integer], strerror(errno));
+    }
+
+    sys_placement.initialized = qtrue;
+    for(i = 0; i < sys_placement.numEarly; i++)
+        Sys_ApplyHelperPlacement(sys_placement.early[i]);
+    sys_placement.numEarly = 0;
+
+    pthread_mutex_unlock(&sys_placementLock);
+
+    Sys_ReportTopology();
+
+    if(sys_placement.pinMain || sys_placement.pinWorkers || sys_schedPolicy->integer != 0)
+    {
+        if(sys_placement.pinMain)
+            Sys_CpuListToString(&sys_placement.mainCpus, mainstr, sizeof(mainstr));
+        else
+            Q_strncpyz(mainstr, "any", sizeof(mainstr));
+
+        if(sys_placement.pinWorkers)
+            Sys_CpuListToString(&sys_placement.workerCpus, workerstr, sizeof(workerstr));
+        else
+            Q_strncpyz(workerstr, "any", sizeof(workerstr));
+
+        Com_Printf("Main thread on CPUs %s with policy %s, helper threads on CPUs %s\n", mainstr, sys_schedPolicyNames[sys_schedPolicy->integer], workerstr);
+    }
+
+    if(sys_irqInterface->string[0] && sys_irqCpus->string[0])
+        Sys_SteerInterrupts(sys_irqInterface->string, sys_irqCpus->string);
+#endif
+}
+
+/*
+==================
+Sys_PlaceHelperThread
+
+Every thread besides the main thread calls this first thing
+==================
+*/
+void Sys_PlaceHelperThread( const char* name )
+{
+#ifdef __linux__
+    char shortname[16];
+
+    Q_strncpyz(shortname, name, sizeof(shortname));
+    pthread_setname_np(pthread_self(), shortname);
+
+    pthread_mutex_lock(&sys_placementLock);
+
+    if(sys_placement.initialized)
+        Sys_ApplyHelperPlacement(pthread_self());
+    else if(sys_placement.numEarly < MAX_EARLYTHREADS)
+        sys_placement.early[sys_placement.numEarly++] = pthread_self();
+
+    pthread_mutex_unlock(&sys_placementLock);
+#endif
+}
+
+
 void Com_InitThreadData()
 {
 
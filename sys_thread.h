@@ -24,6 +24,10 @@
 #ifndef __SYS_THREAD_H__
 #define __SYS_THREAD_H__
 
+#define MAX_CRITSECTIONS 32
+#define MAX_WORKERTHREADS 16
+#define MAX_JOBS 256
+
 void __cdecl Sys_EnterCriticalSection(int section);
 void __cdecl Sys_LeaveCriticalSection(int section);
 void __cdecl Sys_ThreadInit( void );
@@ -33,4 +37,13 @@ void Com_InitThreadData(void);
 const void* __cdecl Sys_GetValue(int key);
 void __cdecl Sys_SetValue(int key, const void* value);
 
+void Sys_InitWorkerThreads(int count);
+void Sys_ShutdownWorkerThreads(void);
+void Sys_AddJob(void (*job)(void* arg), void (*completion)(void* arg), void* arg);
+void Sys_RunCompletedJobs(void);
+void Sys_WaitForJobs(void);
+
+void Sys_InitThreadPlacement(void);
+void Sys_PlaceHelperThread(const char* name);
+
 #endif
\ No newline at end of file
@@ -33,27 +33,190 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <pthread.h>
 
 /*
 ==================
-Sys_RandomBytes
+Random pool
+
+Every thread has its own ChaCha20 key, seeded from the kernel. Each refill
+makes 8 blocks, the first 32 bytes of those become the next key right away
+so an inspected pool can not give away what it handed out before. The key
+gets replaced by a new one from the kernel after RANDOMPOOL_RESEED bytes and
+in a forked child, which gets told by the generation counter.
 ==================
 */
-qboolean Sys_RandomBytes( byte *string, int len )
+
+#define RANDOMPOOL_BLOCKS 8
+#define RANDOMPOOL_RESEED 0x100000
+
+typedef struct{
+	uint32_t	key[8];
+	uint32_t	counter;
+	int		generation;	//sys_randomGeneration it was seeded in, 0 if never
+	int		produced;
+	int		avail;
+	byte		buf[RANDOMPOOL_BLOCKS * 64];
+}sysRandomPool_t;
+
+static __thread sysRandomPool_t sys_randomPool;
+static volatile int sys_randomGeneration = 1;
+static pthread_once_t sys_randomOnce = PTHREAD_ONCE_INIT;
+
+static void Sys_RandomForked( void )
 {
-	FILE *fp;
+	sys_randomGeneration++;
+}
 
-	fp = fopen( "/dev/urandom", "r" );
-	if( !fp )
-		return qfalse;
+static void Sys_RandomInitOnce( void )
+{
+	pthread_atfork(NULL, NULL, Sys_RandomForked);
+}
 
-	if( !fread( string, sizeof( byte ), len, fp ) )
+static qboolean Sys_KernelRandomBytes( byte *string, int len )
+{
+	int fd, n;
+
+#ifdef SYS_getrandom
+	while(len > 0)
 	{
-		fclose( fp );
+		n = syscall(SYS_getrandom, string, len, 0);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;	//Older kernel, take the device
+		}
+		string += n;
+		len -= n;
+	}
+	if(len == 0)
+		return qtrue;
+#endif
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if(fd < 0)
 		return qfalse;
+
+	while(len > 0)
+	{
+		n = read(fd, string, len);
+		if(n <= 0)
+		{
+			if(n < 0 && errno == EINTR)
+				continue;
+			close(fd);
+			return qfalse;
+		}
+		string += n;
+		len -= n;
+	}
+	close(fd);
+	return qtrue;
+}
+
+#define CHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define CHACHA_QR(a, b, c, d) \
+	a += b; d ^= a; d = CHACHA_ROTL(d, 16); \
+	c += d; b ^= c; b = CHACHA_ROTL(b, 12); \
+	a += b; d ^= a; d = CHACHA_ROTL(d, 8); \
+	c += d; b ^= c; b = CHACHA_ROTL(b, 7)
+
+static void Sys_ChaCha20Block( const uint32_t *key, uint32_t counter, byte *out )
+{
+	uint32_t in[16], x[16];
+	int i;
+
+	in[0] = 0x61707865;
+	in[1] = 0x3320646e;
+	in[2] = 0x79622d32;
+	in[3] = 0x6b206574;
+	for(i = 0; i < 8; i++)
+		in[4 + i] = key[i];
+	in[12] = counter;
+	in[13] = in[14] = in[15] = 0;
+
+	for(i = 0; i < 16; i++)
+		x[i] = in[i];
+
+	for(i = 0; i < 10; i++)
+	{
+		CHACHA_QR(x[0], x[4], x[8], x[12]);
+		CHACHA_QR(x[1], x[5], x[9], x[13]);
+		CHACHA_QR(x[2], x[6], x[10], x[14]);
+		CHACHA_QR(x[3], x[7], x[11], x[15]);
+		CHACHA_QR(x[0], x[5], x[10], x[15]);
+		CHACHA_QR(x[1], x[6], x[11], x[12]);
+		CHACHA_QR(x[2], x[7], x[8], x[13]);
+		CHACHA_QR(x[3], x[4], x[9], x[14]);
 	}
 
-	fclose( fp );
+	for(i = 0; i < 16; i++)
+	{
+		x[i] += in[i];
+		out[4*i] = x[i];
+		out[4*i +1] = x[i] >> 8;
+		out[4*i +2] = x[i] >> 16;
+		out[4*i +3] = x[i] >> 24;
+	}
+}
+
+static qboolean Sys_RandomPoolRefill( sysRandomPool_t *pool )
+{
+	int i;
+
+	if(pool->generation != sys_randomGeneration || pool->produced >= RANDOMPOOL_RESEED)
+	{
+		pthread_once(&sys_randomOnce, Sys_RandomInitOnce);
+		if(!Sys_KernelRandomBytes((byte*)pool->key, sizeof(pool->key)))
+			return qfalse;
+		pool->generation = sys_randomGeneration;
+		pool->counter = 0;
+		pool->produced = 0;
+	}
+
+	for(i = 0; i < RANDOMPOOL_BLOCKS; i++)
+		Sys_ChaCha20Block(pool->key, pool->counter++, &pool->buf[64 * i]);
+
+	Com_Memcpy(pool->key, pool->buf, sizeof(pool->key));
+	pool->counter = 0;
+	memset(pool->buf, 0, sizeof(pool->key));
+	pool->avail = sizeof(pool->buf) - sizeof(pool->key);
+	return qtrue;
+}
+
+/*
+==================
+Sys_RandomBytes
+==================
+*/
+qboolean Sys_RandomBytes( byte *string, int len )
+{
+	sysRandomPool_t *pool = &sys_randomPool;
+	byte *src;
+	int n;
+
+	while(len > 0)
+	{
+		if(pool->avail == 0 || pool->generation != sys_randomGeneration)
+		{
+			if(!Sys_RandomPoolRefill(pool))
+				return qfalse;
+		}
+
+		n = len < pool->avail ? len : pool->avail;
+		src = &pool->buf[sizeof(pool->buf) - pool->avail];
+		Com_Memcpy(string, src, n);
+		memset(src, 0, n);
+
+		pool->avail -= n;
+		pool->produced += n;
+		string += n;
+		len -= n;
+	}
 	return qtrue;
 }
 
@@ -147,6 +310,86 @@ qboolean Sys_MemoryProtectExec(void* startoffset, int len)
 	return qtrue;
 }
 
+/*
+==================
+Sys_MemoryAdviseHugePages
+
+Transparent huge pages for memory we can not allocate ourselves because it belongs to the binary.
+Only the 2 MB aligned part of the range can get them. With collapse the pages which are already
+there get merged right away instead of whenever khugepaged comes by. Returns the bytes advised
+==================
+*/
+#if defined(__linux__) && !defined(MADV_COLLAPSE)
+#define MADV_COLLAPSE 25
+#endif
+
+#define SYS_HUGEPAGE_SIZE 0x200000
+
+int Sys_MemoryAdviseHugePages(void* start, int len, qboolean collapse)
+{
+#ifdef MADV_HUGEPAGE
+	uintptr_t begin, end;
+
+	begin = ((uintptr_t)start + SYS_HUGEPAGE_SIZE -1) & ~(uintptr_t)(SYS_HUGEPAGE_SIZE -1);
+	end = ((uintptr_t)start + len) & ~(uintptr_t)(SYS_HUGEPAGE_SIZE -1);
+
+	if(end <= begin)
+		return 0;
+
+	if(madvise((void*)begin, end - begin, MADV_HUGEPAGE) != 0)
+		return 0;
+
+	//Older kernels do not know it, khugepaged does the same later on
+	if(collapse)
+		madvise((void*)begin, end - begin, MADV_COLLAPSE);
+
+	return end - begin;
+#else
+	return 0;
+#endif
+}
+
+/*
+==================
+Sys_MemoryHugePagesResident
+
+Sums up Rss and AnonHugePages in KB of the mappings which lie within the range
+==================
+*/
+qboolean Sys_MemoryHugePagesResident(void* start, int len, int* residentKB, int* hugeKB)
+{
+	char line[256];
+	unsigned long long vmstart, vmend;
+	qboolean inside = qfalse;
+	int value;
+	FILE* fp;
+
+	*residentKB = 0;
+	*hugeKB = 0;
+
+	fp = fopen("/proc/self/smaps", "r");
+	if(fp == NULL)
+		return qfalse;
+
+	while(fgets(line, sizeof(line), fp))
+	{
+		if(sscanf(line, "%llx-%llx ", &vmstart, &vmend) == 2)
+		{
+			inside = vmstart >= (uintptr_t)start && vmend <= (uintptr_t)start + len;
+			continue;
+		}
+		if(!inside)
+			continue;
+
+		if(sscanf(line, "Rss: %d kB", &value) == 1)
+			*residentKB += value;
+		else if(sscanf(line, "AnonHugePages: %d kB", &value) == 1)
+			*hugeKB += value;
+	}
+	fclose(fp);
+	return qtrue;
+}
+
 qboolean Sys_MemoryProtectReadonly(void* startoffset, int len)
 {
 
@@ -0,0 +1,340 @@
+/*
+Reads the binary logs the server writes with com_logBinary set (games_mp.bin, adminactions.bin)
+and prints the records as the lines of the text log, as JSON lines or a summary of them.
+The format is described in qcommon_logbinary.h.
+
+logbinary_reader [-j] [-s] [-t type] file...
+	-j		one JSON object per record
+	-s		only count records and blocks
+	-t type		only records of this type, like K or say. "text" are the lines without one
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../qcommon_logbinary.h"
+
+enum{
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_SUMMARY
+};
+
+static const char* typenames[] = LOGBINARY_TYPENAMES;
+static int output = OUTPUT_TEXT;
+static int filtertype = -1;
+
+static unsigned long long typecounts[LOGBINARY_NUMTYPES];
+static unsigned long long totalblocks, totalraw, totalstored;
+
+
+static const unsigned char* GetVarint(const unsigned char* p, const unsigned char* end, unsigned long long* value){
+
+	int shift = 0;
+
+	*value = 0;
+	while(p < end && shift < 64){
+		*value |= (unsigned long long)(*p & 0x7f) << shift;
+		if(!(*p++ & 0x80))
+			return p;
+		shift += 7;
+	}
+	return NULL;
+}
+
+static int Unzigzag(unsigned long long value){
+
+	return (int)((unsigned int)(value >> 1) ^ -(unsigned int)(value & 1));
+}
+
+//Returns the length of the output or -1 if the block is broken
+static int DecompressBlock(const unsigned char* src, int srclen, unsigned char* dst, int dstcap){
+
+	const unsigned char* end = src + srclen;
+	unsigned char* op = dst;
+	unsigned int length, offset;
+	int token;
+
+	while(src < end){
+
+		token = *src++;
+
+		length = token >> 4;
+		if(length == 15){
+			while(src < end && *src == 255){
+				length += *src++;
+			}
+			if(src >= end)
+				return -1;
+			length += *src++;
+		}
+		if(length > (unsigned int)(end - src) || length > (unsigned int)(dst + dstcap - op))
+			return -1;
+		memcpy(op, src, length);
+		op += length;
+		src += length;
+
+		if(src >= end) //The last literals
+			break;
+
+		if(end - src < 2)
+			return -1;
+		offset = src[0] | (src[1] << 8);
+		src += 2;
+		if(offset == 0 || offset > (unsigned int)(op - dst))
+			return -1;
+
+		length = token & 15;
+		if(length == 15){
+			while(src < end && *src == 255){
+				length += *src++;
+			}
+			if(src >= end)
+				return -1;
+			length += *src++;
+		}
+		length += 4;
+		if(length > (unsigned int)(dst + dstcap - op))
+			return -1;
+
+		//Overlapping copies repeat the pattern
+		while(length-- > 0){
+			*op = *(op - offset);
+			op++;
+		}
+	}
+	return op - dst;
+}
+
+static void PrintJsonString(const unsigned char* s, int len){
+
+	int i;
+
+	putchar('"');
+	for(i = 0; i < len; i++){
+		if(s[i] == '"' || s[i] == '\\')
+			printf("\\%c", s[i]);
+		else if(s[i] < 0x20)
+			printf("\\u%04x", s[i]);
+		else
+			putchar(s[i]);
+	}
+	putchar('"');
+}
+
+static int PrintRecord(const logBinaryBlockHeader_t* header, const unsigned char* p, const unsigned char* end, int time){
+
+	unsigned long long fieldcount, value;
+	int type, flags, i, len, intfield;
+
+	type = *p & ~LOGBINARY_NONEWLINE;
+	flags = *p & LOGBINARY_NONEWLINE;
+	p++;
+	if(type >= LOGBINARY_NUMTYPES)
+		return -1;
+
+	typecounts[type]++;
+
+	p = GetVarint(p, end, &value); //Time, read by the caller already
+	if(p == NULL || (p = GetVarint(p, end, &fieldcount)) == NULL)
+		return -1;
+
+	if(output == OUTPUT_SUMMARY || (filtertype >= 0 && type != filtertype))
+		return 0;
+
+	if(output == OUTPUT_JSON){
+		printf("{\"stream\":\"%s\",\"time\":%d,\"type\":\"%s\",\"fields\":[", header->stream == LOGBINARY_STREAM_GAME ? "game" : "admin",
+			time, type == LOGBINARY_TEXT ? "text" : typenames[type]);
+	}else{
+		if(header->stream == LOGBINARY_STREAM_GAME)
+			printf("%3i:%i%i ", time / 60000, (time / 10000) % 6, (time / 1000) % 10);
+		if(type != LOGBINARY_TEXT)
+			printf("%s%s", typenames[type], fieldcount > 0 ? ";" : "");
+	}
+
+	for(i = 0; i < fieldcount; i++){
+
+		p = GetVarint(p, end, &value);
+		if(p == NULL)
+			return -1;
+
+		intfield = value & 1;
+		value >>= 1;
+		if(!intfield && value > (unsigned long long)(end - p))
+			return -1;
+		len = intfield ? 0 : (int)value;
+
+		if(i > 0)
+			putchar(output == OUTPUT_JSON ? ',' : ';');
+
+		if(intfield)
+			printf("%d", Unzigzag(value));
+		else if(output == OUTPUT_JSON)
+			PrintJsonString(p, len);
+		else
+			fwrite(p, 1, len, stdout);
+
+		p += len;
+	}
+
+	if(output == OUTPUT_JSON)
+		printf("]}\n");
+	else if(!flags)
+		putchar('\n');
+
+	return 0;
+}
+
+static int ReadBlock(const char* filename, const logBinaryBlockHeader_t* header, const unsigned char* data){
+
+	static unsigned char raw[LOGBINARY_BLOCKSIZE];
+	const unsigned char *p, *end, *recordend;
+	unsigned long long len, timedelta;
+	unsigned int records;
+	int time;
+
+	if(header->storedLength < header->rawLength){
+		if(DecompressBlock(data, header->storedLength, raw, sizeof(raw)) != (int)header->rawLength)
+			return -1;
+		p = raw;
+	}else{
+		p = data;
+	}
+	end = p + header->rawLength;
+
+	time = 0;
+	for(records = 0; p < end; records++){
+
+		p = GetVarint(p, end, &len);
+		if(p == NULL || len > (unsigned long long)(end - p) || len < 1)
+			return -1;
+		recordend = p + len;
+
+		if(GetVarint(p + 1, recordend, &timedelta) == NULL)
+			return -1;
+		time += Unzigzag(timedelta);
+
+		if(PrintRecord(header, p, recordend, time) < 0)
+			return -1;
+
+		p = recordend;
+	}
+
+	if(records != header->records)
+		return -1;
+
+	totalblocks++;
+	totalraw += header->rawLength;
+	totalstored += header->storedLength + sizeof(logBinaryBlockHeader_t);
+	return 0;
+}
+
+static int ReadFile(const char* filename){
+
+	logBinaryBlockHeader_t header;
+	const unsigned char* map;
+	struct stat st;
+	size_t pos;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if(fd < 0 || fstat(fd, &st) != 0){
+		fprintf(stderr, "Can not open %s\n", filename);
+		if(fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	if(st.st_size == 0){
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		fprintf(stderr, "Can not map %s\n", filename);
+		return -1;
+	}
+	madvise((void*)map, st.st_size, MADV_SEQUENTIAL);
+
+	for(pos = 0; pos < st.st_size; pos += sizeof(header) + header.storedLength){
+
+		if(st.st_size - pos < sizeof(header))
+			break;
+
+		memcpy(&header, map + pos, sizeof(header));
+
+		if(header.magic != LOGBINARY_BLOCKMAGIC || header.version != LOGBINARY_VERSION ||
+			header.rawLength > LOGBINARY_BLOCKSIZE || header.storedLength > header.rawLength){
+			fprintf(stderr, "%s: Bad block header at offset %lu\n", filename, (unsigned long)pos);
+			break;
+		}
+		if(st.st_size - pos - sizeof(header) < header.storedLength)
+			break;
+
+		if(ReadBlock(filename, &header, map + pos + sizeof(header)) < 0){
+			fprintf(stderr, "%s: Broken block at offset %lu\n", filename, (unsigned long)pos);
+			break;
+		}
+	}
+
+	if(pos < st.st_size)
+		fprintf(stderr, "%s: Stopped %lu bytes before the end\n", filename, (unsigned long)(st.st_size - pos));
+
+	munmap((void*)map, st.st_size);
+	return 0;
+}
+
+static void PrintSummary(){
+
+	int i;
+
+	printf("blocks: %llu\nraw bytes: %llu\nstored bytes: %llu\n", totalblocks, totalraw, totalstored);
+	for(i = 0; i < LOGBINARY_NUMTYPES; i++){
+		if(typecounts[i] > 0)
+			printf("%s: %llu\n", i == LOGBINARY_TEXT ? "text" : typenames[i], typecounts[i]);
+	}
+}
+
+int main(int argc, char** argv){
+
+	int i, files = 0;
+
+	for(i = 1; i < argc; i++){
+
+		if(!strcmp(argv[i], "-j")){
+			output = OUTPUT_JSON;
+		}else if(!strcmp(argv[i], "-s")){
+			output = OUTPUT_SUMMARY;
+		}else if(!strcmp(argv[i], "-t") && i + 1 < argc){
+			i++;
+			for(filtertype = 0; filtertype < LOGBINARY_NUMTYPES; filtertype++){
+				if(filtertype == LOGBINARY_TEXT ? !strcmp(argv[i], "text") : !strcmp(argv[i], typenames[filtertype]))
+					break;
+			}
+			if(filtertype == LOGBINARY_NUMTYPES){
+				fprintf(stderr, "Unknown record type %s\n", argv[i]);
+				return 1;
+			}
+		}else{
+			ReadFile(argv[i]);
+			files++;
+		}
+	}
+
+	if(files == 0){
+		fprintf(stderr, "Usage: %s [-j] [-s] [-t type] file...\n", argv[0]);
+		return 1;
+	}
+
+	if(output == OUTPUT_SUMMARY)
+		PrintSummary();
+
+	return 0;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+
+gcc -Wall -O2 -o logbinary_reader logbinary_reader.c
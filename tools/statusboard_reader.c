@@ -0,0 +1,134 @@
+/*
+Prints the status board a server writes with sv_statusBoard set. It reads the
+mapping without any syscall of its own once the file is mapped, the way a
+sidecar would. The layout is described in sv_statusboard.h.
+
+statusboard_reader [-w msec] file
+	-w msec		print it again every msec milliseconds
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../sv_statusboard.h"
+
+static const char* teamnames[] = { "free", "axis", "allies", "spectator" };
+
+
+//Returns 0 if the server did not finish a consistent update in time
+static int ReadBoard(const statusBoard_t* shared, statusBoard_t* board){
+
+	unsigned int seq;
+	int tries;
+
+	for(tries = 0; tries < 1000; tries++){
+
+		seq = shared->sequence;
+		__sync_synchronize();
+		memcpy(board, (const void*)shared, sizeof(statusBoard_t));
+		__sync_synchronize();
+
+		if(!(seq & 1) && shared->sequence == seq)
+			return 1;
+
+		usleep(100);
+	}
+	return 0;
+}
+
+static void PrintBoard(const statusBoard_t* board){
+
+	const statusBoardPlayer_t* player;
+	int i;
+
+	if(board->magic != STATUSBOARD_MAGIC || board->version != STATUSBOARD_VERSION){
+		printf("No status board of version %d\n", STATUSBOARD_VERSION);
+		return;
+	}
+
+	printf("pid %d%s, update %u at %u\n", board->pid, kill(board->pid, 0) != 0 && errno == ESRCH ? " (gone)" : "",
+		board->updates, board->realtime);
+
+	if(!board->running){
+		printf("Server is not running\n");
+		return;
+	}
+
+	printf("%s: %s %s, %d sec into the level\n", board->hostname, board->mapname, board->gametype, board->levelTime / 1000);
+	printf("players %d/%d (%d humans)\n", board->numPlayers, board->maxclients, board->numHumans);
+	printf("sv_fps %d, frames %u, frame work avg %u usec max %u usec, overruns %u, dropped frames %u, snapshot shedding %d\n",
+		board->fps, board->frames, board->frameUsecAvg, board->frameUsecMax, board->overruns, board->droppedFrames, board->snapshotShedLevel);
+	printf("query drops: getstatus %u/%u, getinfo %u/%u, rcon %u\n", board->queryDrops[0], board->queryDrops[1],
+		board->queryDrops[2], board->queryDrops[3], board->queryDrops[4]);
+
+	printf("num team      score kills deaths assists ping name\n");
+	for(i = 0, player = board->players; i < STATUSBOARD_MAXPLAYERS; i++, player++){
+
+		if(!player->state)
+			continue;
+
+		printf("%3d %-9s %6d %5d %6d %7d %4d %.*s%s%s\n", i, player->team >= 0 && player->team < 4 ? teamnames[player->team] : "?",
+			player->score, player->kills, player->deaths, player->assists, player->ping, (int)sizeof(player->name), player->name,
+			player->bot ? " (bot)" : "", player->state == STATUSBOARD_CONNECTED ? " (connecting)" : "");
+	}
+}
+
+int main(int argc, char** argv){
+
+	const statusBoard_t* shared;
+	statusBoard_t board;
+	struct stat st;
+	int interval = 0;
+	int fd, opt;
+
+	while((opt = getopt(argc, argv, "w:")) != -1){
+		switch(opt){
+			case 'w':
+				interval = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-w msec] file\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if(optind >= argc){
+		fprintf(stderr, "usage: %s [-w msec] file\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if(fd < 0 || fstat(fd, &st) != 0 || st.st_size < sizeof(statusBoard_t)){
+		fprintf(stderr, "Can not open %s or it is no status board\n", argv[optind]);
+		return 1;
+	}
+
+	shared = mmap(NULL, sizeof(statusBoard_t), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(shared == MAP_FAILED){
+		perror("mmap");
+		return 1;
+	}
+
+	do{
+		if(ReadBoard(shared, &board))
+			PrintBoard(&board);
+		else
+			printf("Server holds the board for too long\n");
+
+		if(interval > 0){
+			printf("\n");
+			fflush(stdout);
+			usleep(interval * 1000);
+		}
+	}while(interval > 0);
+
+	return 0;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+
+gcc -Wall -O2 -o statusboard_reader statusboard_reader.c
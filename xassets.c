@@ -27,8 +27,11 @@
 #include "sys_patch.h"
 #include "qcommon_mem.h"
 #include "cmd.h"
+#include "cvar.h"
 
 #include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
 void XAssetUsage_f();
 
@@ -79,6 +82,9 @@ void R_Init(){
 #define MAX_WEAPON 196
 #define MAX_FX 680
 
+#define XASSET_POOLALIGN 0x200000	//Lets the kernel back the pools with huge pages
+#define XASSET_MAPHISTORY 8
+
 typedef enum{
         XModelPieces,
         PhysPreset,
@@ -134,30 +140,83 @@ typedef struct XAssetsHeaderCommon_s{
 
 
 
+/*
+The pools the binary has too few entries in. Their size is set by the cvars,
+which can only be given on the command line since the pools get patched before
+any fastfile is loaded. The stock size of the binary is the lower limit.
+*/
+typedef struct{
+	int		type;
+	const char*	cvarName;
+	int		defaultSize;
+	const char*	description;
+	int		size;
+}xassetPoolLimit_t;
+
+static xassetPoolLimit_t xassetPoolLimits[] = {
+	{XModel, "xassets_maxXModels", MAX_XMODELS, "Size of the xmodel asset pool"},
+	{WeaponDef, "xassets_maxWeapons", MAX_WEAPON, "Size of the weapon asset pool"},
+	{FxEffectDef, "xassets_maxFx", MAX_FX, "Size of the fx asset pool"},
+	{GfxImage, "xassets_maxImages", MAX_GFXIMAGE, "Size of the image asset pool"}
+};
+
+#define NUM_POOLLIMITS (sizeof(xassetPoolLimits) / sizeof(xassetPoolLimits[0]))
+
+typedef struct{
+	char	mapname[MAX_QPATH];
+	int	used[NUM_POOLLIMITS];
+}xassetMapUsage_t;
+
+static int xassetPeak[NumXAssets];				//Most entries ever in use since the start
+static xassetMapUsage_t xassetMapHistory[XASSET_MAPHISTORY];	//In use right after the last maps got loaded
+static int xassetMapHistoryCount;
+static int xassetPoolMemory;
+
+
 void XAssets_PatchLimits(){
 
         void* ptr;
+        byte* pools;
+        int offsets[NUM_POOLLIMITS];
+        int total, i;
+        xassetPoolLimit_t* limit;
+        cvar_t* cvar;
 
         int size = NUM_ASSETTYPES * sizeof(void*);
 
         void* *DB_XAssetPool = (void*)DB_XAssetPool_ADDR;
-        ptr = &DB_XAssetPool[0];
+        int *DB_XAssetPoolSize = (int*)g_poolsize_ADDR;
 
-	if(!Sys_MemoryProtectWrite(ptr, size))
+	for(i = 0, total = 0; i < NUM_POOLLIMITS; i++)
 	{
-		Com_Error(ERR_FATAL,"XAssets_PatchLimits: Failed to change memory to writeable\n");
+		limit = &xassetPoolLimits[i];
+		cvar = Cvar_RegisterInt(limit->cvarName, limit->defaultSize, DB_XAssetPoolSize[limit->type], 65536, CVAR_INIT, limit->description);
+		limit->size = cvar->integer;
+		offsets[i] = total;
+		total += (limit->size * DB_GetXAssetTypeSize(limit->type) +4 +63) & ~63;
 	}
-        DB_XAssetPool[XModel] = Z_Malloc(MAX_XMODELS*DB_GetXAssetTypeSize(XModel) +4);
-        DB_XAssetPool[WeaponDef] = Z_Malloc(MAX_WEAPON*DB_GetXAssetTypeSize(WeaponDef) +4);
-        DB_XAssetPool[FxEffectDef] = Z_Malloc(MAX_FX*DB_GetXAssetTypeSize(FxEffectDef) +4);
-        DB_XAssetPool[GfxImage] = Z_Malloc(MAX_GFXIMAGE*DB_GetXAssetTypeSize(GfxImage) +4);
 
-	if(DB_XAssetPool[XModel] == NULL || DB_XAssetPool[WeaponDef] == NULL || DB_XAssetPool[FxEffectDef] == NULL || DB_XAssetPool[GfxImage] == NULL)
+	//One block for all of them, it is never freed
+	total = (total + XASSET_POOLALIGN -1) & ~(XASSET_POOLALIGN -1);
+	if(posix_memalign((void**)&pools, XASSET_POOLALIGN, total) != 0)
 	{
 		Com_Error(ERR_FATAL, "Failed to get enought memory for Assets. Can not continue\n");
 		return;
-	
 	}
+#ifdef MADV_HUGEPAGE
+	madvise(pools, total, MADV_HUGEPAGE);
+#endif
+	Com_Memset(pools, 0, total);
+	xassetPoolMemory = total;
+
+        ptr = &DB_XAssetPool[0];
+
+	if(!Sys_MemoryProtectWrite(ptr, size))
+	{
+		Com_Error(ERR_FATAL,"XAssets_PatchLimits: Failed to change memory to writeable\n");
+	}
+	for(i = 0; i < NUM_POOLLIMITS; i++)
+		DB_XAssetPool[xassetPoolLimits[i].type] = pools + offsets[i];
 
 	if(!Sys_MemoryProtectReadonly(ptr, size))
 	{
@@ -166,8 +225,6 @@ void XAssets_PatchLimits(){
 
 	//Patch XAssets poolsize
 
-        int *DB_XAssetPoolSize = (int*)g_poolsize_ADDR;
-
 	ptr = &DB_XAssetPoolSize[0];
 
 	if(!Sys_MemoryProtectWrite(ptr, size))
@@ -175,10 +232,8 @@ void XAssets_PatchLimits(){
 		Com_Error(ERR_FATAL,"XAssets_PatchLimits: Failed to change memory to writeable\n");
 	}
 
-        DB_XAssetPoolSize[XModel] = MAX_XMODELS;
-        DB_XAssetPoolSize[WeaponDef] = MAX_WEAPON;
-        DB_XAssetPoolSize[FxEffectDef] = MAX_FX;
-        DB_XAssetPoolSize[GfxImage] = MAX_GFXIMAGE;
+	for(i = 0; i < NUM_POOLLIMITS; i++)
+		DB_XAssetPoolSize[xassetPoolLimits[i].type] = xassetPoolLimits[i].size;
 
 	if(!Sys_MemoryProtectReadonly(ptr, size))
 	{
@@ -187,32 +242,87 @@ void XAssets_PatchLimits(){
 
 }
 
-void XAssetUsage_f()
+//Walks the free list, so it gets called on level load and by the command only
+static int XAssets_CountFree(int assettype)
 {
-    int i, assettype, j, l;
     void* *DB_XAssetPool = (void*)DB_XAssetPool_ADDR;
     int *DB_XAssetPoolSize = (int*)g_poolsize_ADDR;
-    char* *g_assetNames = (char**)g_assetNames_ADDR;
-
     XAssetsHeaderCommon_t *header;
+    int i;
 
-    Com_Printf("XAsset usage:\n");
-    Com_Printf("Name                 Used  Free \n");
-    Com_Printf("-------------------- ----- -----\n");
+    header = DB_XAssetPool[assettype];
+
+    for(i = 0; i < DB_XAssetPoolSize[assettype]; i++)
+    {
+        if(header == NULL)
+            break;
+
+        else
+            header = header->next;
+    }
+    return i;
+}
+
+static int XAssets_SampleUsage(int assettype)
+{
+    int *DB_XAssetPoolSize = (int*)g_poolsize_ADDR;
+    int used;
+
+    used = DB_XAssetPoolSize[assettype] - XAssets_CountFree(assettype);
+    if(used > xassetPeak[assettype])
+        xassetPeak[assettype] = used;
+
+    return used;
+}
+
+/*
+==================
+XAssets_LevelLoaded
+
+Records the high-water mark of the map which just got loaded
+==================
+*/
+void XAssets_LevelLoaded(const char* mapname)
+{
+    xassetMapUsage_t *usage;
+    int assettype, i, pool;
+
+    usage = &xassetMapHistory[xassetMapHistoryCount % XASSET_MAPHISTORY];
+    xassetMapHistoryCount++;
+
+    Q_strncpyz(usage->mapname, mapname, sizeof(usage->mapname));
 
     for(assettype = 0; assettype < NumXAssets; assettype++)
     {
+        pool = -1;
+        for(i = 0; i < NUM_POOLLIMITS; i++)
+        {
+            if(xassetPoolLimits[i].type == assettype)
+                pool = i;
+        }
 
-	header = DB_XAssetPool[assettype];
+        if(pool == -1)
+            XAssets_SampleUsage(assettype);
+        else
+            usage->used[pool] = XAssets_SampleUsage(assettype);
+    }
+}
 
-	for(i = 0; i < DB_XAssetPoolSize[assettype]; i++)
-	{
-	    if(header == NULL)
-	        break;
+void XAssetUsage_f()
+{
+    int i, assettype, j, l, used;
+    int *DB_XAssetPoolSize = (int*)g_poolsize_ADDR;
+    char* *g_assetNames = (char**)g_assetNames_ADDR;
+    xassetMapUsage_t *usage;
 
-	    else
-	        header = header->next;
-	}
+    Com_Printf("XAsset usage:\n");
+    Com_Printf("Name                 Used  Free  Peak \n");
+    Com_Printf("-------------------- ----- ----- -----\n");
+
+    for(assettype = 0; assettype < NumXAssets; assettype++)
+    {
+
+	used = XAssets_SampleUsage(assettype);
 
 	Com_Printf("%s", g_assetNames[assettype]);
 
@@ -226,10 +336,31 @@ void XAssetUsage_f()
 	} while(j < l);
 
 
-	Com_Printf(" %5d %5d\n", DB_XAssetPoolSize[assettype] - i, i);
+	Com_Printf(" %5d %5d %5d\n", used, DB_XAssetPoolSize[assettype] - used, xassetPeak[assettype]);
 
 
     }
+    Com_Printf("\nEnlarged pools use %d KB\n", xassetPoolMemory / 1024);
+
+    if(xassetMapHistoryCount == 0)
+    {
+        Com_Printf("\n");
+        return;
+    }
+
+    Com_Printf("\nUsed after the last maps got loaded:\n");
+    Com_Printf("Map                 ");
+    for(i = 0; i < NUM_POOLLIMITS; i++)
+        Com_Printf(" %10s", g_assetNames[xassetPoolLimits[i].type]);
     Com_Printf("\n");
-}
 
+    for(j = xassetMapHistoryCount > XASSET_MAPHISTORY ? xassetMapHistoryCount - XASSET_MAPHISTORY : 0; j < xassetMapHistoryCount; j++)
+    {
+        usage = &xassetMapHistory[j % XASSET_MAPHISTORY];
+        Com_Printf("%-20.20s", usage->mapname);
+        for(i = 0; i < NUM_POOLLIMITS; i++)
+            Com_Printf(" %4d/%5d", usage->used[i], xassetPoolLimits[i].size);
+        Com_Printf("\n");
+    }
+    Com_Printf("\n");
+}
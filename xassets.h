@@ -40,5 +40,6 @@ void __cdecl DB_LoadXAssets(XZoneInfo*, unsigned int assetscount, int);
 int __cdecl DB_GetXAssetTypeSize(int type);
 void __cdecl XAnimInit(void);
 void XAssets_PatchLimits(void);
+void XAssets_LevelLoaded(const char* mapname);
 
 #endif